@@ -0,0 +1,16 @@
+option (ENABLE_COMPLEX_X4 "Build wider (AVX single or AVX-512 double) Complex kernels, selected at run time by CPUID" ON)
+
+if (MSVC OR ENABLE_PURE32 OR NOT (CMAKE_SYSTEM_PROCESSOR MATCHES "(x86_64)|(AMD64)|(amd64)|(i.86)"))
+    set(ENABLE_COMPLEX_X4 OFF)
+endif ()
+
+if (ENABLE_COMPLEX_X4)
+    if (ENABLE_COMPLEX8)
+        set_source_files_properties (src/common/widesimd_x4.cpp PROPERTIES COMPILE_FLAGS -mavx)
+    else (ENABLE_COMPLEX8)
+        # Some GCC versions warn on the deliberately undefined pass-through operands inside the AVX-512 intrinsics.
+        set_source_files_properties (src/common/widesimd_x4.cpp PROPERTIES COMPILE_FLAGS "-mavx512f -Wno-uninitialized -Wno-maybe-uninitialized")
+    endif (ENABLE_COMPLEX8)
+
+    target_sources (qrack PRIVATE src/common/widesimd_x4.cpp)
+endif (ENABLE_COMPLEX_X4)
@@ -0,0 +1,10 @@
+option (ENABLE_MPI "Build QMPIPager, to split registers across the ranks of an MPI job" OFF)
+
+if (ENABLE_MPI)
+    find_package (MPI REQUIRED)
+    target_sources (qrack PRIVATE src/qmpipager.cpp)
+    target_include_directories (qrack PUBLIC ${MPI_CXX_INCLUDE_PATH})
+    target_link_libraries (qrack PUBLIC ${MPI_CXX_LIBRARIES})
+else (ENABLE_MPI)
+    target_compile_definitions (qrack PUBLIC ENABLE_MPI=0)
+endif (ENABLE_MPI)
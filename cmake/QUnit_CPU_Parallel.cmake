@@ -1 +1 @@
-option (ENABLE_QUNIT_CPU_PARALLEL "Make QEngineCPU partially async, so QUnit can parallelize over it (may exceed shell threading limits)" ON)
+option (ENABLE_QUNIT_CPU_PARALLEL "Give each QEngineCPU an async work queue, so QUnit can parallelize over its shards (may exceed shell threading limits)" ON)
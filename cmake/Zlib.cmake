@@ -0,0 +1,15 @@
+option (ENABLE_ZLIB "Compress checkpoint amplitudes with zlib, if it's found" ON)
+
+if (ENABLE_ZLIB)
+    find_package (ZLIB)
+    if (NOT ZLIB_FOUND)
+        set (ENABLE_ZLIB OFF)
+    endif (NOT ZLIB_FOUND)
+endif (ENABLE_ZLIB)
+
+if (ENABLE_ZLIB)
+    target_include_directories (qrack PUBLIC ${ZLIB_INCLUDE_DIRS})
+    target_link_libraries (qrack PUBLIC ${ZLIB_LIBRARIES})
+else (ENABLE_ZLIB)
+    target_compile_definitions (qrack PUBLIC ENABLE_ZLIB=0)
+endif (ENABLE_ZLIB)
@@ -54,9 +54,8 @@ int main()
         // The "oracle" tags one permutation input, which we theoretically don't know.
         Oracle(qReg);
 
-        qReg->H(0, 8);
-        qReg->ZeroPhaseFlip(0, 8);
-        qReg->H(0, 8);
+        // This is equivalent to H(0, 8), ZeroPhaseFlip(0, 8), and H(0, 8), but in two passes over the state.
+        qReg->GroverDiffusion(0, 8);
         qReg->PhaseFlip();
         std::cout << "\t" << std::setw(2) << i << "> chance of match:" << qReg->ProbAll(TARGET_INPUT) << std::endl;
     }
@@ -70,6 +70,12 @@ int main()
     }
     toLoad[TARGET_KEY] = TARGET_VALUE;
 
+#if ENABLE_OPENCL
+    // Every Grover iteration reads the same table. Registered, it's uploaded to the device once, rather than once per
+    // IndexedSBC/IndexedADC call, for as long as "table" lives.
+    OCLLookupTablePtr table = OCLEngine::Instance()->RegisterTable(toLoad, 1 << indexLength);
+#endif
+
     // Our input to the subroutine "oracle" is 8 bits.
     qReg->SetPermutation(0);
     qReg->H(valueLength, indexLength);
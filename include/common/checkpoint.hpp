@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "qrack_types.hpp"
+
+// "QRCK," (as the low bytes of a little-endian word,) at the head of every checkpoint stream
+#define QRACK_CHECKPOINT_MAGIC 0x4b435251U
+#define QRACK_CHECKPOINT_VERSION 1U
+// Amplitudes per checkpoint chunk, (or the whole state vector, if it is smaller)
+#define QRACK_CHECKPOINT_CHUNK_AMPS (1U << 16U)
+
+namespace Qrack {
+
+/// Tags of the records in a checkpoint stream, one per layer that writes its own record
+enum QCheckpointRecord {
+    /// A state vector, in chunks, (from any QEngine, QPager, QHybrid, or the generic QInterface fallback)
+    CHECKPOINT_AMPLITUDES = 1,
+    /// A QStabilizer tableau
+    CHECKPOINT_STABILIZER,
+    /// A QStabilizerHybrid, followed by either a CHECKPOINT_STABILIZER or its engine's record
+    CHECKPOINT_STABILIZER_HYBRID,
+    /// A QUnit shard layout and phase buffers, followed by the record of each of its units
+    CHECKPOINT_QUNIT
+};
+
+/**
+ * Writes a checkpoint stream. (See QInterface::SaveCheckpoint().) Layers write their own records with the typed Write()
+ * methods, and nest the records of the layers they own.
+ *
+ * State vectors are written in chunks of QRACK_CHECKPOINT_CHUNK_AMPS amplitudes, read out of the register by a
+ * callback, (such as QEngine::GetAmplitudePage(),) so that at most a few chunks are ever staged in host memory. With
+ * compression on, chunks are deflated with zlib in parallel batches. While one batch is written to the stream, the
+ * next batch is read out of the register and compressed. If Qrack was built without zlib, (ENABLE_ZLIB,) compression
+ * requests are ignored, and chunks are written raw.
+ */
+class QCheckpointWriter {
+public:
+    /// Copies "length" amplitudes, starting at amplitude "offset," into "pagePtr"
+    typedef std::function<void(complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length)> GetPageFn;
+
+protected:
+    std::ostream& os;
+    bool doCompress;
+    int32_t threadCount;
+
+    void WriteBytes(const void* data, size_t length);
+
+public:
+    QCheckpointWriter(std::ostream& stream, bool compress = false);
+
+    /// Write the magic number and version that open a checkpoint stream
+    void WriteHeader();
+
+    void Write(const uint8_t& value) { WriteBytes(&value, sizeof(value)); }
+    void Write(const uint64_t& value) { WriteBytes(&value, sizeof(value)); }
+    void Write(const bool& value) { Write((uint8_t)(value ? 1U : 0U)); }
+    void Write(const complex& value);
+    void Write(const std::vector<uint64_t>& values);
+    void Write(const std::vector<uint8_t>& values);
+
+    /// Open a record for a "qubitCount" qubit register
+    void WriteRecord(const QCheckpointRecord& tag, const bitLenInt& qubitCount)
+    {
+        Write((uint8_t)tag);
+        Write((uint64_t)qubitCount);
+    }
+
+    /// Write the whole state vector of a "qubitCount" qubit register, as a CHECKPOINT_AMPLITUDES record
+    void WriteAmplitudes(const bitLenInt& qubitCount, GetPageFn getPage);
+};
+
+/**
+ * Reads a checkpoint stream written by QCheckpointWriter. Malformed or mismatched streams throw std::invalid_argument,
+ * and failed reads throw std::runtime_error.
+ *
+ * State vectors are read back in chunks, handed to a callback, (such as QEngine::SetAmplitudePage(),) so restoring
+ * never stages more than a few chunks beside the register itself. Compressed chunks are inflated in parallel batches,
+ * while the next batch is read from the stream.
+ */
+class QCheckpointReader {
+public:
+    /// Copies "length" amplitudes from "pagePtr" into the register, starting at amplitude "offset"
+    typedef std::function<void(const complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length)>
+        SetPageFn;
+
+protected:
+    std::istream& is;
+    int32_t threadCount;
+
+    void ReadBytes(void* data, size_t length);
+    /// Read a compressed chunk, and check that its recorded length is at most "maxLength," before allocating it
+    void ReadPacked(std::vector<uint8_t>& values, const size_t& maxLength);
+
+public:
+    QCheckpointReader(std::istream& stream);
+
+    /// Read and check the magic number and version that open a checkpoint stream
+    void ReadHeader();
+
+    void Read(uint8_t& value) { ReadBytes(&value, sizeof(value)); }
+    void Read(uint64_t& value) { ReadBytes(&value, sizeof(value)); }
+    void Read(bool& value);
+    void Read(complex& value);
+    /// Read a vector, and check that its recorded length is "length," before allocating it
+    void Read(std::vector<uint64_t>& values, const size_t& length);
+    void Read(std::vector<uint8_t>& values, const size_t& length);
+
+    /// Read the opening of a record, and check that it is a "tag" record for a "qubitCount" qubit register
+    void ReadRecord(const QCheckpointRecord& tag, const bitLenInt& qubitCount);
+
+    /// Read a CHECKPOINT_AMPLITUDES record of a "qubitCount" qubit register into "setPage"
+    void ReadAmplitudes(const bitLenInt& qubitCount, SetPageFn setPage);
+};
+} // namespace Qrack
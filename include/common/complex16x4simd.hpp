@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is an AVX-512 implementation of a vector of 4 double precision complex numbers.
+// Unlike Complex16x2Simd, it is only included by translation units that are compiled with
+// AVX-512 enabled, and only called after a CPUID check.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <complex>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+namespace Qrack {
+
+/** AVX-512 implementation of the double precision complex vector type of 4 complex numbers, for the wide SIMD kernels.
+ */
+struct Complex16x4Simd {
+    __m512d _val4;
+
+    inline Complex16x4Simd(){};
+    inline Complex16x4Simd(const __m512d& v4) { _val4 = v4; }
+    /// Broadcast one complex number to all 4 lanes
+    inline Complex16x4Simd(const std::complex<double>& c)
+    {
+        _val4 = _mm512_set_pd(c.imag(), c.real(), c.imag(), c.real(), c.imag(), c.real(), c.imag(), c.real());
+    }
+    /// Load 4 contiguous complex numbers
+    inline Complex16x4Simd(const std::complex<double>* c) { _val4 = _mm512_loadu_pd((const double*)c); }
+    /// Store 4 contiguous complex numbers
+    inline void store(std::complex<double>* c) const { _mm512_storeu_pd((double*)c, _val4); }
+    inline Complex16x4Simd operator+(const Complex16x4Simd& other) const { return _mm512_add_pd(_val4, other._val4); }
+    inline Complex16x4Simd operator+=(const Complex16x4Simd& other)
+    {
+        _val4 = _mm512_add_pd(_val4, other._val4);
+        return _val4;
+    }
+    inline Complex16x4Simd operator-(const Complex16x4Simd& other) const { return _mm512_sub_pd(_val4, other._val4); }
+    inline Complex16x4Simd operator-=(const Complex16x4Simd& other)
+    {
+        _val4 = _mm512_sub_pd(_val4, other._val4);
+        return _val4;
+    }
+    inline Complex16x4Simd operator*(const Complex16x4Simd& other) const
+    {
+        // (a + bi)(c + di) = (ac - bd) + (bc + ad)i, with "fmaddsub" subtracting in real lanes and adding in imaginary
+        return _mm512_fmaddsub_pd(_val4, _mm512_movedup_pd(other._val4),
+            _mm512_mul_pd(_mm512_permute_pd(_val4, 0x55), _mm512_permute_pd(other._val4, 0xFF)));
+    }
+    inline Complex16x4Simd operator*=(const Complex16x4Simd& other)
+    {
+        _val4 = (*this * other)._val4;
+        return _val4;
+    }
+    inline Complex16x4Simd operator*(const double rhs) const { return _mm512_mul_pd(_val4, _mm512_set1_pd(rhs)); }
+    inline Complex16x4Simd operator-() const { return _mm512_mul_pd(_mm512_set1_pd(-1.0), _val4); }
+    inline Complex16x4Simd operator*=(const double& other)
+    {
+        _val4 = _mm512_mul_pd(_val4, _mm512_set1_pd(other));
+        return _val4;
+    }
+};
+
+inline Complex16x4Simd operator*(const double lhs, const Complex16x4Simd& rhs)
+{
+    return _mm512_mul_pd(_mm512_set1_pd(lhs), rhs._val4);
+}
+
+/// Squared magnitude of each complex number, duplicated into both of its lanes
+inline __m512d norms(const Complex16x4Simd& c)
+{
+    __m512d sqr = _mm512_mul_pd(c._val4, c._val4);
+    return _mm512_add_pd(sqr, _mm512_permute_pd(sqr, 0x55));
+}
+
+inline double norm(const Complex16x4Simd& c) { return _mm512_reduce_add_pd(_mm512_mul_pd(c._val4, c._val4)); }
+} // namespace Qrack
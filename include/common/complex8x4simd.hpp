@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is an AVX implementation of a vector of 4 single precision complex numbers.
+// Unlike Complex8x2Simd, it is only included by translation units that are compiled with
+// AVX enabled, and only called after a CPUID check.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <complex>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+namespace Qrack {
+
+/** AVX implementation of the single precision complex vector type of 4 complex numbers, for the wide SIMD kernels. */
+struct Complex8x4Simd {
+    __m256 _val4;
+
+    inline Complex8x4Simd(){};
+    inline Complex8x4Simd(const __m256& v4) { _val4 = v4; }
+    /// Broadcast one complex number to all 4 lanes
+    inline Complex8x4Simd(const std::complex<float>& c)
+    {
+        _val4 = _mm256_set_ps(c.imag(), c.real(), c.imag(), c.real(), c.imag(), c.real(), c.imag(), c.real());
+    }
+    /// Load 4 contiguous complex numbers
+    inline Complex8x4Simd(const std::complex<float>* c) { _val4 = _mm256_loadu_ps((const float*)c); }
+    /// Store 4 contiguous complex numbers
+    inline void store(std::complex<float>* c) const { _mm256_storeu_ps((float*)c, _val4); }
+    inline Complex8x4Simd operator+(const Complex8x4Simd& other) const { return _mm256_add_ps(_val4, other._val4); }
+    inline Complex8x4Simd operator+=(const Complex8x4Simd& other)
+    {
+        _val4 = _mm256_add_ps(_val4, other._val4);
+        return _val4;
+    }
+    inline Complex8x4Simd operator-(const Complex8x4Simd& other) const { return _mm256_sub_ps(_val4, other._val4); }
+    inline Complex8x4Simd operator-=(const Complex8x4Simd& other)
+    {
+        _val4 = _mm256_sub_ps(_val4, other._val4);
+        return _val4;
+    }
+    inline Complex8x4Simd operator*(const Complex8x4Simd& other) const
+    {
+        // (a + bi)(c + di) = (ac - bd) + (bc + ad)i, with "addsub" subtracting in real lanes and adding in imaginary
+        return _mm256_addsub_ps(_mm256_mul_ps(_val4, _mm256_moveldup_ps(other._val4)),
+            _mm256_mul_ps(_mm256_permute_ps(_val4, 177), _mm256_movehdup_ps(other._val4)));
+    }
+    inline Complex8x4Simd operator*=(const Complex8x4Simd& other)
+    {
+        _val4 = (*this * other)._val4;
+        return _val4;
+    }
+    inline Complex8x4Simd operator*(const float rhs) const { return _mm256_mul_ps(_val4, _mm256_set1_ps(rhs)); }
+    inline Complex8x4Simd operator-() const { return _mm256_mul_ps(_mm256_set1_ps(-1.0f), _val4); }
+    inline Complex8x4Simd operator*=(const float& other)
+    {
+        _val4 = _mm256_mul_ps(_val4, _mm256_set1_ps(other));
+        return _val4;
+    }
+};
+
+inline Complex8x4Simd operator*(const float lhs, const Complex8x4Simd& rhs)
+{
+    return _mm256_mul_ps(_mm256_set1_ps(lhs), rhs._val4);
+}
+
+/// Squared magnitude of each complex number, duplicated into both of its lanes
+inline __m256 norms(const Complex8x4Simd& c)
+{
+    __m256 sqr = _mm256_mul_ps(c._val4, c._val4);
+    return _mm256_add_ps(sqr, _mm256_permute_ps(sqr, 177));
+}
+
+inline float norm(const Complex8x4Simd& c)
+{
+    __m256 sqr = _mm256_mul_ps(c._val4, c._val4);
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sqr), _mm256_extractf128_ps(sqr, 1));
+    sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, 1));
+    return _mm_cvtss_f32(sum4);
+}
+} // namespace Qrack
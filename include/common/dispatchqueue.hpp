@@ -10,37 +10,61 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
-// From https://github.com/embeddedartistry/embedded-resources/blob/master/examples/cpp/dispatch.cpp
+// Originally from https://github.com/embeddedartistry/embedded-resources/blob/master/examples/cpp/dispatch.cpp
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <vector>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Slots in each queue's ring, (a power of 2,) and bytes of in-place storage for each queued callable
+#define QRACK_DISPATCH_RING_SIZE 256U
+#define QRACK_DISPATCH_INLINE_BYTES 128U
+// Times a waiting thread polls before it parks
+#define QRACK_DISPATCH_SPIN_COUNT 2048U
 
 namespace Qrack {
 
+/**
+ * A bounded, single producer, single consumer queue of work, run in order on one dedicated thread.
+ *
+ * Callables are constructed in place in a ring of fixed slots, (falling back to the heap only if they are larger than
+ * QRACK_DISPATCH_INLINE_BYTES,) and the ring's indices are atomics, so dispatching neither locks nor allocates. A side
+ * that has to wait, (the consumer on an empty ring, or the producer on a full one or in finish(),) spins briefly, and
+ * then parks on a condition variable, which the other side only signals if it sees the waiter parked.
+ *
+ * Only one thread may call dispatch(), finish(), and dump().
+ */
 class DispatchQueue {
-    typedef std::function<void(void)> fp_t;
-
 public:
     DispatchQueue();
     ~DispatchQueue();
 
-    // dispatch and copy
-    void dispatch(const fp_t& op);
-    // dispatch and move
-    void dispatch(fp_t&& op);
+    // dispatch (copy or move) a callable
+    template <typename Fn> void dispatch(Fn&& op)
+    {
+        typedef typename std::decay<Fn>::type FnType;
+        typedef std::integral_constant<bool,
+            (sizeof(FnType) <= QRACK_DISPATCH_INLINE_BYTES) && (alignof(FnType) <= alignof(std::max_align_t))>
+            IsInline;
+
+        Emplace<FnType>(AcquireSlot(), std::forward<Fn>(op), IsInline());
+        Publish();
+    }
     // finish queue
     void finish();
-    // dump queue
+    // dump queue, (waiting for any operation that is already running)
     void dump();
     // check if queue is finished
-    bool isFinished() { return isFinished_; }
+    bool isFinished() { return !isStarted_ || (head_.load() == tail_.load(std::memory_order_relaxed)); }
 
     // Deleted operations
     DispatchQueue(const DispatchQueue& rhs) = delete;
@@ -49,15 +73,48 @@ public:
     DispatchQueue& operator=(DispatchQueue&& rhs) = delete;
 
 private:
-    std::mutex lock_;
+    struct Slot {
+        alignas(std::max_align_t) unsigned char storage[QRACK_DISPATCH_INLINE_BYTES];
+        void (*invoke)(void*);
+        void (*destroy)(void*);
+    };
+
+    std::unique_ptr<Slot[]> ring_;
+    // Written only by the producer: the count of operations ever dispatched, and the count before which queued
+    // operations are skipped, (by dump())
+    std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> dumpTo_;
+    // (A cache line apart, without relying on over-aligned allocation, which C++11 doesn't guarantee)
+    char padding_[64];
+    // Written only by the consumer: the count of operations that have been run, (or skipped,) and released their slots
+    std::atomic<uint64_t> head_;
+    std::atomic<bool> quit_;
+    std::atomic<bool> isConsumerParked_;
+    std::atomic<bool> isProducerParked_;
+    std::mutex parkLock_;
+    std::condition_variable consumerCv_;
+    std::condition_variable producerCv_;
     std::future<void> thread_;
-    std::queue<fp_t> q_;
-    std::condition_variable cv_;
-    std::condition_variable cvFinished_;
-    bool quit_;
-    bool isFinished_;
     bool isStarted_;
 
+    template <typename FnType, typename Fn> static void Emplace(Slot& slot, Fn&& op, std::true_type isInline)
+    {
+        new (slot.storage) FnType(std::forward<Fn>(op));
+        slot.invoke = [](void* s) { (*((FnType*)s))(); };
+        slot.destroy = [](void* s) { ((FnType*)s)->~FnType(); };
+    }
+    template <typename FnType, typename Fn> static void Emplace(Slot& slot, Fn&& op, std::false_type isInline)
+    {
+        *((FnType**)slot.storage) = new FnType(std::forward<Fn>(op));
+        slot.invoke = [](void* s) { (**((FnType**)s))(); };
+        slot.destroy = [](void* s) { delete *((FnType**)s); };
+    }
+
+    Slot& AcquireSlot();
+    void Publish();
+    // Spin, then park, until the consumer has released slot "count"
+    void WaitForHead(const uint64_t& count);
+
     void dispatch_thread_handler(void);
 };
 
@@ -22,12 +22,15 @@
 #include <direct.h>
 #endif
 
+#include <cstdlib>
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <vector>
 
 #if defined(__APPLE__)
 #define CL_SILENCE_DEPRECATION
@@ -38,6 +41,13 @@
 #include <CL/cl2.hpp>
 #endif
 
+// Uses of one gate shape, on one device, after which a kernel specialized on it is compiled
+#define QRACK_OCL_SPEC_HOT_COUNT 32U
+// Most specialized kernels compiled per device
+#define QRACK_OCL_SPEC_MAX_KERNELS 64U
+// Most distinct gate shapes counted per device, (past which new shapes are never specialized)
+#define QRACK_OCL_SPEC_MAX_KEYS 4096U
+
 namespace Qrack {
 
 class OCLDeviceCall;
@@ -57,6 +67,9 @@ enum OCLAPI {
     OCL_API_APPLY2X2_SINGLE_WIDE,
     OCL_API_APPLY2X2_NORM_SINGLE_WIDE,
     OCL_API_APPLY2X2_DOUBLE_WIDE,
+    OCL_API_APPLYNXN,
+    OCL_API_APPLY2X2_TILED,
+    OCL_API_APPLY2X2_EACH,
     OCL_API_PHASE_SINGLE,
     OCL_API_PHASE_SINGLE_WIDE,
     OCL_API_INVERT_SINGLE,
@@ -65,6 +78,10 @@ enum OCLAPI {
     OCL_API_UNIFORMPARITYRZ,
     OCL_API_UNIFORMPARITYRZ_NORM,
     OCL_API_CUNIFORMPARITYRZ,
+    OCL_API_QFT_RADIX2,
+    OCL_API_QFT_RADIX4,
+    OCL_API_GROVER_DIFFUSION_SUM,
+    OCL_API_GROVER_DIFFUSION,
     OCL_API_COMPOSE,
     OCL_API_COMPOSE_WIDE,
     OCL_API_COMPOSE_MID,
@@ -76,8 +93,12 @@ enum OCLAPI {
     OCL_API_PROBREGALL,
     OCL_API_PROBMASK,
     OCL_API_PROBMASKALL,
+    OCL_API_PROBCDF,
+    OCL_API_PROBCDFADD,
+    OCL_API_SAMPLECDF,
     OCL_API_PROBPARITY,
     OCL_API_FORCEMPARITY,
+    OCL_API_EXPECTATIONPAULI,
     OCL_API_X_SINGLE,
     OCL_API_X_SINGLE_WIDE,
     OCL_API_Z_SINGLE,
@@ -131,6 +152,31 @@ struct OCLKernelHandle {
     }
 };
 
+/**
+ * A kernel of qspecialize.cl, compiled for one gate shape, with the arguments that the generic kernel would read from
+ * constant memory defined as literals. (See OCLDeviceContext::GetSpecialized().)
+ */
+struct OCLSpecializedKernel {
+    std::string kernelName;
+    // The #define lines of this specialization, which the program sources point into
+    std::string defines;
+    size_t useCount;
+    // Valid once compilation has started, and true once it has succeeded
+    std::shared_future<bool> isBuilt;
+    cl::Program program;
+    cl::Kernel kernel;
+    std::mutex mutex;
+
+    OCLSpecializedKernel(const std::string& name, const std::string& defs)
+        : kernelName(name)
+        , defines(defs)
+        , useCount(0U)
+    {
+    }
+};
+
+typedef std::shared_ptr<OCLSpecializedKernel> OCLSpecializedKernelPtr;
+
 class OCLDeviceCall {
 protected:
     std::lock_guard<std::mutex> guard;
@@ -165,24 +211,57 @@ public:
     EventVecPtr wait_events;
 
 protected:
+    // Whether the queue records device timestamps for each command, (set by the QRACK_OCL_PROFILE environment variable)
+    bool isProfiling;
     std::mutex waitEventsMutex;
     std::map<OCLAPI, cl::Kernel> calls;
     std::map<OCLAPI, std::unique_ptr<std::mutex>> mutexes;
+    // Whether hot gate shapes get specialized kernels, (cleared by the QRACK_OCL_NO_SPECIALIZE environment variable)
+    bool isSpecializing;
+    std::mutex specMutex;
+    std::map<std::string, OCLSpecializedKernelPtr> specializations;
+    size_t specBuildCount;
+
+    // Set once the context, queue, and kernels exist, (see OCLEngine::InitDeviceContext())
+    bool isInitialized;
+    // Set if the program failed to build for this device, so that the build isn't retried
+    bool isBuildFailed;
+    std::mutex initMutex;
+
+    /// Compile "spec" for this device, (on a worker thread,) returning whether the build succeeded
+    bool BuildSpecialized(OCLSpecializedKernelPtr spec);
+
+    /// Create the command queue, once "context" is set
+    void MakeQueue()
+    {
+        const cl_command_queue_properties profilingFlag = isProfiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+        cl_int error;
+        queue = cl::CommandQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | profilingFlag, &error);
+        if (error != CL_SUCCESS) {
+            queue = cl::CommandQueue(context, device, profilingFlag, &error);
+        }
+        if (error != CL_SUCCESS) {
+            isProfiling = false;
+            queue = cl::CommandQueue(context, device);
+        }
+    }
 
 public:
-    OCLDeviceContext(cl::Platform& p, cl::Device& d, cl::Context& c, int dev_id, int cntxt_id)
+    /**
+     * Only the platform and device are set here. The context, queue, and kernels are made by
+     * OCLEngine::InitDeviceContext(), before the first QEngineOCL on this device uses them.
+     */
+    OCLDeviceContext(cl::Platform& p, cl::Device& d, int dev_id, int cntxt_id)
         : platform(p)
         , device(d)
-        , context(c)
         , context_id(cntxt_id)
         , device_id(dev_id)
+        , isProfiling(getenv("QRACK_OCL_PROFILE") && (std::string(getenv("QRACK_OCL_PROFILE")) != "0"))
+        , isSpecializing(!getenv("QRACK_OCL_NO_SPECIALIZE"))
+        , specBuildCount(0U)
+        , isInitialized(false)
+        , isBuildFailed(false)
     {
-        cl_int error;
-        queue = cl::CommandQueue(context, d, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &error);
-        if (error != CL_SUCCESS) {
-            queue = cl::CommandQueue(context, d);
-        }
-
         wait_events =
             std::shared_ptr<std::vector<cl::Event>>(new std::vector<cl::Event>(), [](std::vector<cl::Event>* vec) {
                 vec->clear();
@@ -190,7 +269,31 @@ public:
             });
     }
 
-    OCLDeviceCall Reserve(OCLAPI call) { return OCLDeviceCall(*(mutexes[call]), calls[call]); }
+    /// Whether the context, queue, and kernels of this device have been made yet
+    bool IsInitialized()
+    {
+        std::lock_guard<std::mutex> guard(initMutex);
+        return isInitialized;
+    }
+
+    /// Reserve the kernel for "call," or, if "spec" is given, the specialized kernel that stands in for it
+    OCLDeviceCall Reserve(OCLAPI call, OCLSpecializedKernelPtr spec = nullptr)
+    {
+        if (spec) {
+            return OCLDeviceCall(spec->mutex, spec->kernel);
+        }
+        return OCLDeviceCall(*(mutexes[call]), calls[call]);
+    }
+
+    /**
+     * Count one use of the qspecialize.cl kernel "kernelName," specialized by the #define lines "defines," and return
+     * it, if it's ready. The QRACK_OCL_SPEC_HOT_COUNT-th use of a specialization starts its compilation, in the
+     * background, and until the compiled kernel is ready, (or if it fails to compile, or if the device already holds
+     * QRACK_OCL_SPEC_MAX_KERNELS of them,) this returns nullptr, and the caller should dispatch its generic kernel.
+     */
+    OCLSpecializedKernelPtr GetSpecialized(const std::string& kernelName, const std::string& defines);
+
+    bool IsProfiling() { return isProfiling; }
 
     EventVecPtr ResetWaitEvents()
     {
@@ -217,6 +320,19 @@ public:
         }
     }
 
+    /// Count the events in the wait list that are still queued or running on this device
+    size_t GetPendingEventCount()
+    {
+        std::lock_guard<std::mutex> guard(waitEventsMutex);
+        size_t count = 0;
+        for (auto&& event : *(wait_events.get())) {
+            if (event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) {
+                count++;
+            }
+        }
+        return count;
+    }
+
     size_t GetPreferredConcurrency()
     {
         size_t nrmGroupSize =
@@ -235,13 +351,62 @@ public:
     friend class OCLEngine;
 };
 
+/**
+ * A classical table, (such as the "values" argument of QInterface::IndexedLDA(), IndexedADC(), IndexedSBC(), or
+ * Hash(),) registered with OCLEngine::RegisterTable(). While the handle lives, every QEngineOCL call that is passed the
+ * same host pointer reads one copy of the table per OpenCL context, uploaded on its first use, instead of uploading the
+ * table again on every call.
+ */
+class OCLLookupTable {
+protected:
+    const unsigned char* values;
+    size_t size;
+    std::mutex mutex;
+    // Device copies, by OCLDeviceContext::context_id
+    std::map<int, std::shared_ptr<cl::Buffer>> buffers;
+
+public:
+    OCLLookupTable(const unsigned char* v, size_t s)
+        : values(v)
+        , size(s)
+    {
+    }
+
+    const unsigned char* GetValues() { return values; }
+    size_t GetSize() { return size; }
+    /// Get the copy of the table in the context of "devCntxt," uploading it, if there isn't one yet
+    std::shared_ptr<cl::Buffer> GetBuffer(DeviceContextPtr devCntxt);
+    /// Drop every device copy, so that the next call uploads the table again, (after the host table has been changed)
+    void Update()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        buffers.clear();
+    }
+};
+
+typedef std::shared_ptr<OCLLookupTable> OCLLookupTablePtr;
+
 /** "Qrack::OCLEngine" manages the single OpenCL context. */
 class OCLEngine {
 public:
     /// Get a pointer to the Instance of the singleton. (The instance will be instantiated, if it does not exist yet.)
     static OCLEngine* Instance();
-    /// Get a pointer one of the available OpenCL contexts, by its index in the list of all contexts.
+    /**
+     * Get a pointer one of the available OpenCL contexts, by its index in the list of all contexts. (This is cheap,
+     * and only the platform and device of the result can be used, until InitDeviceContext() has been called on it.)
+     */
     DeviceContextPtr GetDeviceContextPtr(const int& dev = -1);
+    /**
+     * Get the device as GetDeviceContextPtr() does, with its context, queue, and kernels made. If the programs fail
+     * to build for the default device, ("dev" of -1,) the first device that can build them becomes the default.
+     */
+    DeviceContextPtr GetBuiltDeviceContextPtr(const int& dev = -1);
+    /**
+     * Make the context of the platform of "devCntxt," if no device of the platform has made it yet, then the command
+     * queue of the device, and build or load its program, returning whether the build succeeded. This runs once per
+     * device, and later calls return at once.
+     */
+    bool InitDeviceContext(DeviceContextPtr devCntxt);
     /// Get the list of all available devices (and their supporting objects).
     std::vector<DeviceContextPtr> GetDeviceContextPtrVector();
     /** Set the list of DeviceContextPtr object available for use. If one takes the result of
@@ -258,6 +423,14 @@ public:
     /// Initialize the OCL environment, with the option to save the generated binaries. Binaries will be saved/loaded
     /// from the folder path "home". This returns a Qrack::OCLInitResult object which should be passed to
     /// SetDeviceContextPtrVector().
+    ///
+    /// Unless the QRACK_OCL_NO_BINARY_CACHE environment variable is set, any program that has to be JIT compiled is
+    /// also cached in "home," under a file name that is keyed on the kernel source, the device, the driver, and the
+    /// build flags, and later initializations load that cached binary first.
+    ///
+    /// This only lists the platforms and devices. Contexts are made, and programs built, for each device as it is
+    /// first used, (see InitDeviceContext(),) unless "saveBinaries" is true, or the QRACK_OCL_EAGER_INIT environment
+    /// variable is set, in which case every device is built here.
     static void InitOCL(bool buildFromSource = false, bool saveBinaries = false, std::string home = "*");
     /// Get default location for precompiled binaries:
     static std::string GetDefaultBinaryPath()
@@ -281,23 +454,48 @@ public:
 #endif
     }
 
+    /**
+     * Register the classical table of "size" bytes at "values," to be kept resident on each device that reads it, for
+     * as long as the returned handle lives. Registering the same pointer and size again returns the same handle. The
+     * host table must outlive the handle, and OCLLookupTable::Update() must be called after changing it.
+     */
+    OCLLookupTablePtr RegisterTable(const unsigned char* values, size_t size);
+    /// Get the live registered table at "values," if it holds at least "size" bytes, (or else nullptr)
+    OCLLookupTablePtr GetTable(const unsigned char* values, size_t size);
+
 private:
     static const std::vector<OCLKernelHandle> kernelHandles;
     static const std::string binary_file_prefix;
     static const std::string binary_file_ext;
     std::vector<DeviceContextPtr> all_device_contexts;
     DeviceContextPtr default_device_context;
+    std::mutex tablesMutex;
+    std::map<const unsigned char*, std::weak_ptr<OCLLookupTable>> tables;
+    // Build parameters of InitOCL(), kept for devices that are built later
+    bool isBuildingFromSource;
+    bool isSavingBinaries;
+    std::string binaryHome;
+    // Contexts, by OCLDeviceContext::context_id, (one per platform,) made with the first device of each platform
+    std::mutex contextsMutex;
+    std::map<int, cl::Context> platformContexts;
+    std::map<int, std::vector<cl::Device>> platformDevices;
 
     OCLEngine(); // Private so that it can  not be called
     OCLEngine(OCLEngine const&); // copy constructor is private
     OCLEngine& operator=(OCLEngine const& rhs); // assignment operator is private
     static OCLEngine* m_pInstance;
 
-    /// Make the program, from either source or binary
-    static cl::Program MakeProgram(bool buildFromSource, cl::Program::Sources sources, std::string path,
-        std::shared_ptr<OCLDeviceContext> devCntxt);
+    /// Make the program, from either source or the first binary in "paths" that loads, ("isBinary" is set true if a
+    /// binary was loaded)
+    static cl::Program MakeProgram(bool buildFromSource, cl::Program::Sources sources, std::vector<std::string> paths,
+        std::shared_ptr<OCLDeviceContext> devCntxt, bool& isBinary);
     /// Save the program binary:
     static void SaveBinary(cl::Program program, std::string path, std::string fileName);
+    /// Get the file name of the cached binary for "device," keyed on a hash of the kernel source, the device and
+    /// driver, the build options, and the precision flags of this build
+    static std::string GetBinaryCacheFileName(cl::Platform platform, cl::Device device, std::string buildOptions);
+    /// Build, or load, the program for "devCntxt," and get its kernels, (with its context and queue already made)
+    bool BuildProgram(DeviceContextPtr devCntxt);
 
     unsigned long PowerOf2LessThan(unsigned long number);
 };
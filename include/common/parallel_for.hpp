@@ -13,6 +13,7 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
 #include <set>
 #include <vector>
 
@@ -25,15 +26,42 @@ class ParallelFor {
 private:
     int32_t numCores;
 
+    /// par_norm() over a dense array of amplitudes, with the wide SIMD kernels
+    real1 par_norm_runs(const bitCapInt maxQPower, const complex* amplitudes, real1 norm_thresh);
+
+    /// Hand out chunks of "stride" items, of "itemCount" in all, to "threads" pool threads, as fn(first, last, cpu)
+    void par_chunks(const bitCapInt itemCount, const bitCapIntOcl stride, const int32_t threads,
+        std::function<void(const bitCapInt, const bitCapInt, const int)> fn);
+
+    /**
+     * Fill "masks" with the (low, high) mask pair for each bit in maskArray, for par_for_mask(). Returns true if the
+     * masked bits are exactly the highest bits below "end," (so that a plain par_for() skips them).
+     */
+    bool GetSkipMasks(
+        const bitCapInt end, const bitCapInt* maskArray, const bitLenInt maskLen, std::vector<bitCapInt>& masks);
+
 public:
+    /// Classes of kernel, by per-item cost, for the purpose of choosing a grain size
+    enum ParallelKernel { PAR_KERNEL_FOR = 0, PAR_KERNEL_NORM = 1 };
+
     ParallelFor()
         : numCores(1)
     {
     }
     virtual ~ParallelFor() {}
 
-    void SetConcurrencyLevel(int32_t num) { numCores = num; }
+    /// Set the count of threads to use, (starting shared pool workers, as necessary)
+    void SetConcurrencyLevel(int32_t num);
     int32_t GetConcurrencyLevel() { return numCores; }
+
+    /**
+     * Choose the chunk size ("stride") and thread count for a loop over "itemCount" items of the given kernel class.
+     *
+     * Small loops stay on one thread. Past the crossover point, (measured once per process,) each thread gets enough
+     * items to amortize dispatch, and chunks grow with the loop, (never smaller than 2^PSTRIDEPOW).
+     */
+    void GetGrain(const bitCapInt itemCount, const ParallelKernel kernel, bitCapIntOcl& stride, int32_t& threads);
+
     /*
      * Parallelization routines for spreading work across multiple cores.
      */
@@ -41,11 +69,44 @@ public:
     /**
      * Iterate through the permutations a maximum of end-begin times, allowing
      * the caller to control the incrementation offset through 'inc'.
+     *
+     * "inc" and "fn" are taken by type, (rather than as IncrementFunc and ParallelFunc,) so that both are inlined into
+     * the loop over each chunk, leaving one indirect call per chunk, instead of two per item.
      */
-    void par_for_inc(const bitCapInt begin, const bitCapInt itemCount, IncrementFunc, ParallelFunc fn);
+    template <typename IncFn, typename Fn>
+    void par_for_inc(const bitCapInt begin, const bitCapInt itemCount, IncFn&& inc, Fn&& fn)
+    {
+        bitCapIntOcl stride;
+        int32_t threads;
+        GetGrain(itemCount, PAR_KERNEL_FOR, stride, threads);
+
+        if (threads <= 1) {
+            const bitCapInt maxLcv = begin + itemCount;
+            for (bitCapInt j = begin; j < maxLcv; j++) {
+                fn(inc(j, 0), 0);
+            }
+            return;
+        }
+
+        par_chunks(itemCount, stride, threads, [&](const bitCapInt first, const bitCapInt last, const int cpu) {
+            for (bitCapInt k = first; k < last; k++) {
+                fn(inc(begin + k, cpu), cpu);
+            }
+        });
+    }
 
     /** Call fn once for every numerical value between begin and end. */
-    void par_for(const bitCapInt begin, const bitCapInt end, ParallelFunc fn);
+    template <typename Fn> void par_for(const bitCapInt begin, const bitCapInt end, Fn&& fn)
+    {
+        par_for_inc(
+            begin, end - begin, [](const bitCapInt i, const int cpu) { return i; }, fn);
+    }
+
+    /**
+     * Call fn once for every numerical value between begin and end, where each call costs about as much as "weight"
+     * par_for() items, (for example, one call per row of a packed bit matrix that is "weight" words wide).
+     */
+    void par_for_weighted(const bitCapInt begin, const bitCapInt end, const bitCapIntOcl weight, ParallelFunc fn);
 
     /**
      * Skip over the skipPower bits.
@@ -55,12 +116,65 @@ public:
      *     ^     ^     ^     ^     ^     ^     ^     ^ - The second bit is
      *                                                   untouched.
      */
-    void par_for_skip(const bitCapInt begin, const bitCapInt end, const bitCapInt skipPower,
-        const bitLenInt skipBitCount, ParallelFunc fn);
+    template <typename Fn>
+    void par_for_skip(
+        const bitCapInt begin, const bitCapInt end, const bitCapInt skipMask, const bitLenInt maskWidth, Fn&& fn)
+    {
+        /*
+         * Add maskWidth bits by shifting the incrementor up that number of
+         * bits, filling with 0's.
+         *
+         * For example, if the skipMask is 0x8, then the lowMask will be 0x7
+         * and the high mask will be ~(0x7 + 0x8) ==> ~0xf, shifted by the
+         * number of extra bits to add.
+         */
+
+        if ((skipMask << maskWidth) >= end) {
+            // If we're skipping trailing bits, this is much cheaper:
+            par_for(begin, skipMask, fn);
+            return;
+        }
+
+        const bitCapInt lowMask = skipMask - ONE_BCI;
+        const bitCapInt highMask = ~lowMask;
+
+        if (lowMask == 0) {
+            // If we're skipping leading bits, this is much cheaper:
+            par_for_inc(
+                begin, (end - begin) >> maskWidth,
+                [maskWidth](const bitCapInt i, const int cpu) { return (i << maskWidth); }, fn);
+        } else {
+            par_for_inc(
+                begin, (end - begin) >> maskWidth,
+                [lowMask, highMask, maskWidth](
+                    const bitCapInt i, const int cpu) { return ((i & lowMask) | ((i & highMask) << maskWidth)); },
+                fn);
+        }
+    }
 
     /** Skip over the bits listed in maskArray in the same fashion as par_for_skip. */
+    template <typename Fn>
     void par_for_mask(
-        const bitCapInt, const bitCapInt, const bitCapInt* maskArray, const bitLenInt maskLen, ParallelFunc fn);
+        const bitCapInt begin, const bitCapInt end, const bitCapInt* maskArray, const bitLenInt maskLen, Fn&& fn)
+    {
+        /* Pre-calculate the masks to simplify the increment function later. */
+        std::vector<bitCapInt> masks;
+        if (GetSkipMasks(end, maskArray, maskLen, masks)) {
+            par_for(begin, end >> maskLen, fn);
+            return;
+        }
+
+        par_for_inc(
+            begin, (end - begin) >> maskLen,
+            [&masks, maskLen](bitCapInt i, const int cpu) {
+                /* Push i apart, one mask at a time. */
+                for (bitLenInt m = 0; m < maskLen; m++) {
+                    i = ((i << ONE_BCI) & masks[(m << 1U) + 1U]) | (i & masks[m << 1U]);
+                }
+                return i;
+            },
+            fn);
+    }
 
     /** Iterate over a sparse state vector. */
     void par_for_set(const std::set<bitCapInt>& sparseSet, ParallelFunc fn);
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Duration histogram bins, by power of 2 of nanoseconds, (with the last bin collecting everything longer)
+#define QRACK_PROFILE_HISTOGRAM_BINS 32U
+// Trace events kept before further events are dropped, (and counted as dropped)
+#define QRACK_PROFILE_TRACE_MAX_EVENTS (1U << 20U)
+// Device kernels that can be timed individually, (indexed by OCLAPI)
+#define QRACK_PROFILE_MAX_KERNELS 128U
+
+namespace Qrack {
+
+/// Instrumented hot paths, (in the order the external API numbers them)
+enum QProfileOp {
+    /// A pass of a 2x2 matrix over the state vector, (in a QEngineCPU or QEngineOCL)
+    PROFILE_APPLY_2X2 = 0,
+    /// A QUnit combining two of its subsystems into one
+    PROFILE_QUNIT_COMPOSE,
+    /// A QUnit splitting qubits off of one of its subsystems, (whether kept or disposed)
+    PROFILE_QUNIT_DECOMPOSE,
+    /// A transfer from host to device memory, by a QEngineOCL, (with its size in bytes)
+    PROFILE_OCL_UPLOAD,
+    /// A transfer from device to host memory, by a QEngineOCL, (with its size in bytes)
+    PROFILE_OCL_READBACK,
+    /// A QStabilizerHybrid converting its stabilizer tableau to a state vector engine
+    PROFILE_STABILIZER_TO_ENGINE,
+    /// A QUnit probing a qubit of an entangled subsystem for separability, by its Z and X basis probabilities
+    PROFILE_QUNIT_SEPARATE_PROBE,
+    PROFILE_OP_COUNT
+};
+
+/**
+ * Process-wide counters, timers, and duration histograms for the instrumented hot paths, with an optional trace of
+ * every event in Chrome's trace event format, (which Perfetto also reads).
+ *
+ * Profiling is off by default, in which case each instrumented call costs one relaxed atomic load. It can be turned on
+ * with SetEnabled(), or from the start of the process by setting the QRACK_PROFILE environment variable. If
+ * QRACK_PROFILE_TRACE names a file, tracing is also on from the start, and the trace is written there at exit.
+ *
+ * Device kernels are timed separately, by kernel, (from OpenCL event profiling, if QRACK_OCL_PROFILE is set,) and
+ * reported in aggregate, rather than per call.
+ */
+class QProfiler {
+public:
+    static bool IsEnabled() { return isEnabled.load(std::memory_order_relaxed); }
+    static bool IsTracing() { return isTracing.load(std::memory_order_relaxed); }
+
+    static void SetEnabled(bool enable);
+    /// Also keep a trace event per call, (which implies SetEnabled(true) when turned on)
+    static void SetTracing(bool enable);
+    /// Zero every counter and histogram, and clear the trace
+    static void Reset();
+
+    /// Nanoseconds since an arbitrary, fixed epoch
+    static uint64_t Now();
+    static void Record(QProfileOp op, uint64_t startNs, uint64_t durationNs, uint64_t bytes = 0U);
+
+    static uint64_t GetCount(QProfileOp op);
+    static uint64_t GetNanoseconds(QProfileOp op);
+    static uint64_t GetBytes(QProfileOp op);
+    /// Calls that took [2^(bin-1), 2^bin) nanoseconds, (or less than 1 ns, for bin 0)
+    static uint64_t GetHistogram(QProfileOp op, unsigned bin);
+    static uint64_t GetDroppedTraceEvents();
+    static const char* GetName(QProfileOp op);
+
+    static void SetKernelName(unsigned kernel, const std::string& name);
+    /// Add one run of a device kernel, (timed on the device)
+    static void RecordKernel(unsigned kernel, uint64_t durationNs);
+    static uint64_t GetKernelCount(unsigned kernel);
+    static uint64_t GetKernelNanoseconds(unsigned kernel);
+    static const char* GetKernelName(unsigned kernel);
+
+    /// Write the trace as a Chrome trace event JSON object
+    static void WriteTrace(std::ostream& os);
+    static bool WriteTrace(const char* fileName);
+
+private:
+    static std::atomic<bool> isEnabled;
+    static std::atomic<bool> isTracing;
+};
+
+/// Records the call of "op" over the lifetime of the scope, if profiling was on at its start
+class QProfileScope {
+public:
+    QProfileScope(QProfileOp o, uint64_t b = 0U)
+        : op(o)
+        , bytes(b)
+        , start(QProfiler::IsEnabled() ? QProfiler::Now() : 0U)
+        , isActive(start != 0U)
+    {
+    }
+
+    ~QProfileScope()
+    {
+        if (isActive) {
+            QProfiler::Record(op, start, QProfiler::Now() - start, bytes);
+        }
+    }
+
+    QProfileScope(const QProfileScope&) = delete;
+    QProfileScope& operator=(const QProfileScope&) = delete;
+
+private:
+    QProfileOp op;
+    uint64_t bytes;
+    uint64_t start;
+    bool isActive;
+};
+
+} // namespace Qrack
@@ -27,29 +27,67 @@
 #include <immintrin.h>
 #endif
 
+#include <cstddef>
+#include <cstdint>
+
 #include "qrack_types.hpp"
 
+// Hardware random words drawn per refill of an RdRandom buffer
+#define QRACK_RDRAND_BUFFER_SIZE 256U
+// 64-bit outputs of the counter-based PRNG, (see RdRandom::SetCounterPrng(),) before it is rekeyed from hardware
+#define QRACK_RDRAND_PRNG_RESEED (1ULL << 20U)
+
 namespace Qrack {
 
 bool getRdRand(unsigned int* pv);
+/// Fill "pv" with "count" words from RDRAND, stopping early, (and returning the count filled,) if it fails.
+size_t getRdRandBulk(unsigned int* pv, size_t count);
+/// Get a seed from RDSEED, if the CPU supports it, and otherwise from RDRAND.
+bool getRdSeed(uint64_t* pv);
 
+/**
+ * Random real numbers from the CPU's hardware generator, (or from files, if ENABLE_RNDFILE).
+ *
+ * Hardware words are drawn a buffer at a time, so that Next() usually costs a load, rather than an RDRAND and its retry
+ * loop. For bulk sampling, FillRandom() fills a whole array at once. Optionally, (see SetCounterPrng(),) the hardware
+ * only keys a fast counter-based PRNG, for workloads that need many more samples than true entropy.
+ *
+ * The QRACK_RDRAND_PRNG environment variable turns the counter-based PRNG on by default.
+ */
 class RdRandom {
 public:
-#if ENABLE_RNDFILE
-    RdRandom()
-        : didInit(false)
-        , isPageTwo(false)
-        , data1()
-        , data2()
-        , dataOffset(0)
-        , fileOffset(0)
-    {
-    }
-#endif
+    RdRandom();
     bool SupportsRDRAND();
     real1 Next();
-#if ENABLE_RNDFILE
+    /// Fill "values" with "count" random real numbers in [0, 1), (the same as calling Next() "count" times)
+    void FillRandom(real1* values, size_t count);
+
+    /**
+     * Draw words from a counter-based PRNG, (SplitMix64,) keyed by RDSEED and rekeyed every QRACK_RDRAND_PRNG_RESEED
+     * outputs, instead of directly from RDRAND. This is much faster, but only as unpredictable as its key.
+     */
+    void SetCounterPrng(bool isPrng);
+    bool GetCounterPrng() { return isCounterPrng; }
+
 private:
+    unsigned int buffer[QRACK_RDRAND_BUFFER_SIZE];
+    size_t bufferOffset;
+    bool isCounterPrng;
+    uint64_t prngKey;
+    uint64_t prngCounter;
+
+    // Refill "buffer," and reset "bufferOffset"
+    void Refill();
+    unsigned int NextWord()
+    {
+        if (bufferOffset == QRACK_RDRAND_BUFFER_SIZE) {
+            Refill();
+        }
+        return buffer[bufferOffset++];
+    }
+    void Rekey();
+
+#if ENABLE_RNDFILE
     bool didInit = false;
     bool isPageTwo;
     std::vector<char> data1;
@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Freed buffers held per size class, per device, at most
+#define QRACK_STATEVEC_POOL_DEPTH 4U
+// Default total size of all buffers held by one pool, (overridden by the QRACK_STATEVEC_POOL_BYTES environment
+// variable)
+#define QRACK_STATEVEC_POOL_BYTES (1U << 26U)
+
+namespace Qrack {
+
+/**
+ * A pool of freed state vector buffers, to be reused by later allocations of exactly the same size on the same device.
+ * State vector sizes are powers of two, so the size is the size class. QUnit merges and splits shards constantly, and
+ * this saves a round trip through the allocator, (or the OpenCL driver,) for every shard that comes and goes.
+ *
+ * The pool never holds more than QRACK_STATEVEC_POOL_DEPTH buffers of one size on one device, or more than
+ * QRACK_STATEVEC_POOL_BYTES in total. Buffers that don't fit are refused, and the caller destroys them as usual.
+ */
+template <typename T> class StateVecPool {
+public:
+    typedef void (*DestroyFn)(T&);
+
+protected:
+    typedef std::pair<int, size_t> PoolKey;
+
+    std::map<PoolKey, std::vector<T>> buffers;
+    std::mutex poolMutex;
+    DestroyFn destroy;
+    size_t pooledBytes;
+    size_t maxPooledBytes;
+
+public:
+    /// "destroyFn" releases a buffer that is still held by the pool when the pool clears or goes out of scope.
+    StateVecPool(DestroyFn destroyFn)
+        : destroy(destroyFn)
+        , pooledBytes(0)
+        , maxPooledBytes(QRACK_STATEVEC_POOL_BYTES)
+    {
+        if (getenv("QRACK_STATEVEC_POOL_BYTES")) {
+            maxPooledBytes = (size_t)std::stoull(std::string(getenv("QRACK_STATEVEC_POOL_BYTES")));
+        }
+    }
+
+    ~StateVecPool() { Clear(); }
+
+    /// If the pool holds a buffer of "size" bytes for "device," move it into "out" and return true.
+    bool Acquire(int device, size_t size, T& out)
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+
+        auto it = buffers.find(PoolKey(device, size));
+        if ((it == buffers.end()) || (it->second.size() == 0)) {
+            return false;
+        }
+
+        out = std::move(it->second.back());
+        it->second.pop_back();
+        pooledBytes -= size;
+
+        return true;
+    }
+
+    /// Offer a freed buffer to the pool. If this returns false, the pool did not take it, and the caller still owns it.
+    bool Release(int device, size_t size, T& item)
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+
+        if ((pooledBytes + size) > maxPooledBytes) {
+            return false;
+        }
+
+        std::vector<T>& sizeClass = buffers[PoolKey(device, size)];
+        if (sizeClass.size() >= QRACK_STATEVEC_POOL_DEPTH) {
+            return false;
+        }
+
+        sizeClass.push_back(std::move(item));
+        pooledBytes += size;
+
+        return true;
+    }
+
+    /// Destroy every buffer held by the pool.
+    void Clear()
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+
+        for (auto it = buffers.begin(); it != buffers.end(); it++) {
+            for (size_t i = 0; i < it->second.size(); i++) {
+                destroy(it->second[i]);
+            }
+        }
+        buffers.clear();
+        pooledBytes = 0;
+    }
+
+    /// Get the total size, in bytes, of all buffers currently held by the pool.
+    size_t GetPooledBytes()
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+        return pooledBytes;
+    }
+};
+
+} // namespace Qrack
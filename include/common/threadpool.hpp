@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Qrack {
+
+/**
+ * "Qrack::ThreadPool" is a process-wide set of persistent worker threads, shared by all ParallelFor instances, so that
+ * parallel kernels don't pay for thread creation and destruction on every call.
+ *
+ * Every worker owns a deque of tasks. A worker takes tasks from the back of its own deque, and, when that is empty,
+ * steals from the front of the other workers' deques. The thread that submits a batch of tasks also works on the batch,
+ * (stealing like any other worker,) until every task in the batch is done.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(const int32_t)> fp_t;
+
+    /// Get a pointer to the Instance of the singleton. (The instance will be instantiated, if it does not exist yet.)
+    static ThreadPool* Instance();
+
+    /// Start workers, if necessary, such that at least "threadCount" threads (including the caller) can run at once.
+    void Reserve(int32_t threadCount);
+
+    /// Get the count of running worker threads, (not counting callers of RunAll)
+    int32_t GetWorkerCount() { return workerCount; }
+
+    /**
+     * Call fn(0) through fn(taskCount - 1), in parallel, and block until all calls have returned. If any call throws,
+     * the first exception caught is rethrown here, once every call has finished.
+     */
+    void RunAll(int32_t taskCount, const fp_t& fn);
+
+    ~ThreadPool();
+
+    // Deleted operations
+    ThreadPool(const ThreadPool& rhs) = delete;
+    ThreadPool& operator=(const ThreadPool& rhs) = delete;
+    ThreadPool(ThreadPool&& rhs) = delete;
+    ThreadPool& operator=(ThreadPool&& rhs) = delete;
+
+private:
+    struct Batch {
+        const fp_t* fn;
+        std::atomic<int32_t> remaining;
+        // The first exception thrown by a task of the batch, for RunAll() to rethrow
+        std::exception_ptr error;
+        std::mutex errorLock;
+    };
+
+    struct Task {
+        Batch* batch;
+        int32_t index;
+    };
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    // Worker deques are allocated up front, so that thieves never race with a resize.
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<int32_t> workerCount;
+    std::atomic<int32_t> pendingCount;
+    std::atomic<uint32_t> nextWorker;
+    std::mutex reserveLock;
+    std::mutex sleepLock;
+    std::condition_variable sleepCv;
+    bool quit;
+
+    ThreadPool();
+
+    bool TryRunOne(int32_t home);
+    /// Run task "index" of "batch," keeping any exception it throws, and count it done
+    void RunTask(Batch* batch, int32_t index);
+    void WorkerLoop(int32_t home);
+};
+
+} // namespace Qrack
@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include "qrack_types.hpp"
+
+/// Number of complex amplitudes processed per wide SIMD instruction
+#define WIDE_SIMD_WIDTH 4U
+
+namespace Qrack {
+
+/*
+ * Kernels over contiguous runs of amplitudes, 4 complex numbers at a time, (AVX for single precision, AVX-512 for
+ * double precision,) with a portable scalar fallback. The implementation is chosen once, at run time, by CPUID, so
+ * a single binary runs on hardware without the wider instructions.
+ */
+
+/// True if this build has wide SIMD kernels and the running CPU supports them
+bool IsWideSimdSupported();
+
+/// Apply the 2x2 matrix "mtrx" to every pair (amps0[i], amps1[i]), for 0 <= i < count
+void Apply2x2Run(complex* amps0, complex* amps1, const bitCapIntOcl& count, const complex* mtrx);
+
+/// Sum the squared magnitudes of "count" contiguous amplitudes, skipping any that are less than "norm_thresh"
+real1 NormRun(const complex* amps, const bitCapIntOcl& count, const real1& norm_thresh = ZERO_R1);
+
+} // namespace Qrack
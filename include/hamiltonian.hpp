@@ -12,6 +12,7 @@
 #pragma once
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "common/qrack_types.hpp"
@@ -147,4 +148,54 @@ struct UniformHamiltonianOp : HamiltonianOp {
  */
 typedef std::shared_ptr<HamiltonianOp> HamiltonianOpPtr;
 typedef std::vector<HamiltonianOpPtr> Hamiltonian;
+
+class QInterface;
+class CompiledHamiltonian;
+typedef std::shared_ptr<CompiledHamiltonian> CompiledHamiltonianPtr;
+
+/**
+ * A Hamiltonian with its exponentials precomputed for one time step, for evolving by many steps of the same length.
+ *
+ * The "order" of the product formula is 1, (each exponential applied once per step, in vector index order, exactly as
+ * QInterface::TimeEvolve() does,) 2, (the symmetric Strang splitting, forward over half a step then backward over half
+ * a step,) or 4, (the Trotter-Suzuki recursion of five 2nd order steps). While compiling, each exponential is moved
+ * earlier past any ops that act on disjoint qubits, (with which it commutes,) and fused with the last op on exactly the
+ * same target, controls, and toggles, so one step costs as few gate passes as the Hamiltonian's qubit structure allows.
+ */
+class CompiledHamiltonian {
+protected:
+    struct FusedOp {
+        HamiltonianOpPtr op;
+        BitOp mtrx;
+    };
+
+    Hamiltonian hamiltonian;
+    real1 timeStep;
+    int order;
+    std::vector<FusedOp> fused;
+
+    static bool IsSameGate(const HamiltonianOp& a, const HamiltonianOp& b);
+    static bool IsDisjoint(const HamiltonianOp& a, const HamiltonianOp& b);
+    /// Append one 2nd order step, of length "fraction" times the time step, as (op index, fraction) pairs
+    void AppendStrangStep(std::vector<std::pair<size_t, real1>>& seq, const real1& fraction);
+    void Compile();
+
+public:
+    CompiledHamiltonian(const Hamiltonian& h, const real1& timeDiff, const int& o = 1);
+
+    real1 GetTimeStep() { return timeStep; }
+    int GetOrder() { return order; }
+    /// Get the count of gates that one step applies, after fusion
+    size_t GetGateCount() { return fused.size(); }
+
+    /// Change the time step, recomputing (only) the exponentials
+    void SetTimeStep(const real1& timeDiff)
+    {
+        timeStep = timeDiff;
+        Compile();
+    }
+
+    /// Evolve "qReg" by "steps" time steps
+    void Evolve(QInterface& qReg, const bitCapIntOcl& steps = 1U);
+};
 } // namespace Qrack
@@ -26,6 +26,39 @@ typedef bool (*ProbAmpCallback)(size_t, double, double);
 struct _QrackTimeEvolveOpHeader;
 #endif
 
+/// Instructions for run_program(). Each has the semantics of the single call of the same name.
+enum QrackProgramOpCode {
+    QRACK_PROGRAM_X = 0,
+    QRACK_PROGRAM_Y,
+    QRACK_PROGRAM_Z,
+    QRACK_PROGRAM_H,
+    QRACK_PROGRAM_S,
+    QRACK_PROGRAM_T,
+    QRACK_PROGRAM_ADJS,
+    QRACK_PROGRAM_ADJT,
+    /// params[0], params[1], and params[2] are theta, phi, and lambda.
+    QRACK_PROGRAM_U,
+    /// "arg" is the Pauli basis, as in R(), and params[0] is the angle.
+    QRACK_PROGRAM_R,
+    /// "arg" is the second qubit ID.
+    QRACK_PROGRAM_SWAP,
+    /// Appends the result to the "results" array of run_program(). (Controls are ignored.)
+    QRACK_PROGRAM_M
+};
+
+/**
+ * One instruction for run_program(): "op" is a QrackProgramOpCode, applied to qubit ID "target," controlled by the
+ * first "controlLen" qubit IDs in "controls." ("arg" and "params" are used as each opcode describes.)
+ */
+struct _QrackProgramOp {
+    unsigned op;
+    unsigned target;
+    unsigned arg;
+    unsigned controlLen;
+    unsigned controls[32];
+    double params[3];
+};
+
 extern "C" {
 // non-quantum
 MICROSOFT_QUANTUM_DECL unsigned init();
@@ -35,6 +68,23 @@ MICROSOFT_QUANTUM_DECL void seed(_In_ unsigned sid, _In_ unsigned s);
 MICROSOFT_QUANTUM_DECL void set_concurrency(_In_ unsigned sid, _In_ unsigned p);
 MICROSOFT_QUANTUM_DECL void Dump(_In_ unsigned sid, _In_ ProbAmpCallback callback);
 
+// profiling, (process-wide, with "op" numbered as Qrack::QProfileOp)
+MICROSOFT_QUANTUM_DECL void set_profiling(_In_ bool enable, _In_ bool trace);
+MICROSOFT_QUANTUM_DECL void reset_profile();
+MICROSOFT_QUANTUM_DECL unsigned profile_op_count();
+MICROSOFT_QUANTUM_DECL const char* profile_op_name(_In_ unsigned op);
+MICROSOFT_QUANTUM_DECL unsigned long long profile_count(_In_ unsigned op);
+MICROSOFT_QUANTUM_DECL unsigned long long profile_ns(_In_ unsigned op);
+MICROSOFT_QUANTUM_DECL unsigned long long profile_bytes(_In_ unsigned op);
+MICROSOFT_QUANTUM_DECL unsigned profile_histogram(
+    _In_ unsigned op, _In_ unsigned n, _In_reads_(n) unsigned long long* bins);
+MICROSOFT_QUANTUM_DECL bool write_profile_trace(_In_ const char* fileName);
+// (device kernels, numbered as Qrack::OCLAPI, and timed only if QRACK_OCL_PROFILE is set)
+MICROSOFT_QUANTUM_DECL unsigned profile_kernel_count();
+MICROSOFT_QUANTUM_DECL const char* profile_kernel_name(_In_ unsigned kernel);
+MICROSOFT_QUANTUM_DECL unsigned long long profile_kernel_calls(_In_ unsigned kernel);
+MICROSOFT_QUANTUM_DECL unsigned long long profile_kernel_ns(_In_ unsigned kernel);
+
 // pseudo-quantum
 MICROSOFT_QUANTUM_DECL double Prob(_In_ unsigned sid, _In_ unsigned q);
 
@@ -114,6 +164,10 @@ MICROSOFT_QUANTUM_DECL void CLXNOR(_In_ unsigned sid, _In_ bool ci, _In_ unsigne
 
 MICROSOFT_QUANTUM_DECL double Prob(_In_ unsigned sid, _In_ unsigned q);
 
+// Run "n" instructions under one lock, and return the number of measurement results written to "results"
+MICROSOFT_QUANTUM_DECL unsigned run_program(
+    _In_ unsigned sid, _In_ unsigned n, _In_reads_(n) _QrackProgramOp* ops, unsigned* results);
+
 #if !ENABLE_PURE32
 MICROSOFT_QUANTUM_DECL void TimeEvolve(_In_ unsigned sid, _In_ double t, _In_ unsigned n,
     _In_reads_(n) _QrackTimeEvolveOpHeader* teos, unsigned mn, _In_reads_(mn) double* mtrx);
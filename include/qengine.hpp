@@ -63,6 +63,9 @@ public:
 
     virtual void ZeroAmplitudes() = 0;
 
+    /** Get the total probability of the state vector, as of the last UpdateRunningNorm() or normalizing operation */
+    real1 GetRunningNorm() { return runningNorm; }
+
     virtual void CopyStateVec(QInterfacePtr src) = 0;
 
     virtual void GetAmplitudePage(complex* pagePtr, const bitCapInt offset, const bitCapInt length) = 0;
@@ -73,6 +76,11 @@ public:
      * sub-engine  boundaries. */
     virtual void ShuffleBuffers(QEnginePtr engine) = 0;
 
+    /// Stream the state vector to a checkpoint in chunks, through GetAmplitudePage()
+    virtual void WriteCheckpoint(QCheckpointWriter& writer);
+    /// Stream the state vector from a checkpoint in chunks, through SetAmplitudePage()
+    virtual void ReadCheckpoint(QCheckpointReader& reader);
+
     virtual bool ForceM(bitLenInt qubitIndex, bool result, bool doForce = true, bool doApply = true);
     virtual bitCapInt ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply = true);
     virtual bitCapInt ForceMReg(
@@ -132,6 +140,9 @@ public:
     virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG) = 0;
 
 protected:
+    /// True if Apply2x2() keeps runningNorm current for controlled gates, so that no separate reduction is needed
+    virtual bool IsRunningNormTracked() { return false; }
+
     virtual void Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
         const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh = REAL1_DEFAULT_ARG) = 0;
     virtual void ApplyControlled2x2(
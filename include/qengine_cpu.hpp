@@ -12,9 +12,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include "common/parallel_for.hpp"
+#include "common/widesimd.hpp"
 #include "qengine.hpp"
 #include "statevector.hpp"
 
@@ -22,6 +24,11 @@
 #include "common/dispatchqueue.hpp"
 #endif
 
+// Pending diagonal terms, (see SetGateFusion(),) past which they are applied, since each adds work per amplitude
+#define QRACK_FUSED_DIAGONAL_TERMS 64U
+// Default amplitudes per cache tile, (as a power of 2,) sized for L2, (see SetTileQubits())
+#define QRACK_CPU_TILE_QB 14U
+
 namespace Qrack {
 
 class QEngineCPU;
@@ -39,6 +46,30 @@ class QEngineCPU : virtual public QEngine, public ParallelFor {
 protected:
     StateVectorPtr stateVec;
     bool isSparse;
+    bool isSparseSwitching;
+    // Set by a queued measurement that left a dense state vector sparse enough to switch
+    std::atomic<bool> isSparseDue;
+    real1 denseFill;
+    real1 sparseFill;
+    bool isMapped;
+    QStoragePrecision storagePrecision;
+    bool isFusing;
+    bool isLazyNorm;
+    int numaNode;
+    bitCapInt fusedMask;
+    std::vector<complex> fusedMtrxs;
+
+    /// A pending phase, applied to every basis state "k" where (k & mask) == perm, by the parity of (k & parityMask)
+    struct DiagonalTerm {
+        bitCapInt mask;
+        bitCapInt perm;
+        bitCapInt parityMask;
+        complex phases[2];
+    };
+    // Qubits that any pending diagonal term depends on
+    bitCapInt fusedDiagonalMask;
+    std::vector<DiagonalTerm> fusedDiagonal;
+    bitLenInt tileQubits;
 #if ENABLE_QUNIT_CPU_PARALLEL
     DispatchQueue dispatchQueue;
 #endif
@@ -46,17 +77,88 @@ protected:
     StateVectorSparsePtr CastStateVecSparse() { return std::dynamic_pointer_cast<StateVectorSparse>(stateVec); }
 
 public:
+    /**
+     * For the CPU engine, "deviceID" names a NUMA node: large state vectors prefer pages on that node. The default of
+     * -1 interleaves large state vectors round-robin over all nodes, on multi-socket Linux hosts.
+     */
     QEngineCPU(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp = nullptr,
-        complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = false, bool randomGlobalPhase = true, bool ignored = false,
-        int ignored2 = -1, bool useHardwareRNG = true, bool useSparseStateVec = false,
+        complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = false, bool randomGlobalPhase = true,
+        bool useHostMem = false, int deviceID = -1, bool useHardwareRNG = true, bool useSparseStateVec = false,
         real1 norm_thresh = REAL1_EPSILON, std::vector<int> ignored3 = {}, bitLenInt ignored4 = 0);
 
     virtual ~QEngineCPU() { Dump(); }
 
     virtual void SetConcurrency(uint32_t threadsPerEngine) { SetConcurrencyLevel(threadsPerEngine); }
 
+    /**
+     * Buffer runs of single qubit gates, per qubit, multiplying them into one pending 2x2 matrix that is only applied
+     * to the state vector once another operation depends on that qubit. Turning fusion off flushes the buffer.
+     *
+     * Phase-only gates, (like ApplySinglePhase(), RZ(), CZ(), and UniformParityRZ(),) on any qubits, commute, so they
+     * are buffered together, as diagonal terms, and applied in one pass over the state vector, once a non-diagonal
+     * operation touches any of their qubits.
+     */
+    virtual void SetGateFusion(bool doFuse)
+    {
+        if (!doFuse) {
+            FlushFusedGates();
+        }
+        isFusing = doFuse;
+    }
+    virtual bool GetGateFusion() { return isFusing; }
+
+    /**
+     * When fused gates are flushed, pending matrices on qubits below "qb" are applied together, one tile of 2^qb
+     * amplitudes at a time, so that the whole run costs one sweep of the state vector, (in and out of cache,) instead
+     * of one sweep per gate. The default, QRACK_CPU_TILE_QB, can also be set with the environment variable of the same
+     * name. A dense state vector only a tile wide, or narrower, is swept per gate, as it already fits in cache.
+     */
+    virtual void SetTileQubits(bitLenInt qb) { tileQubits = qb; }
+    virtual bitLenInt GetTileQubits() { return tileQubits; }
+
+    /**
+     * With normalization on, track the change in norm inside each controlled gate's own pass over the state vector,
+     * instead of following the gate with a separate full reduction. The rescale is folded into the next single qubit
+     * gate, (which touches every amplitude anyway,) or applied by a standalone pass only before a read, like Prob().
+     */
+    virtual void SetLazyNormalization(bool isLazy) { isLazyNorm = isLazy; }
+    virtual bool GetLazyNormalization() { return isLazyNorm; }
+
+    /**
+     * Store amplitudes at a narrower precision than "complex," (see StateVectorNarrow,) cutting the state vector's
+     * footprint and memory traffic. STORAGE_BF16 keeps about 3 significant digits per amplitude. Gate arithmetic stays
+     * at full accuracy. This has no effect on sparse state vectors. The current state is converted in place.
+     */
+    virtual void SetStoragePrecision(QStoragePrecision precision);
+    virtual QStoragePrecision GetStoragePrecision() { return storagePrecision; }
+
+    /**
+     * Keep the state vector in a memory-mapped temporary file, (see StateVectorMapped,) which is slower, but can exceed
+     * RAM. This has no effect on sparse or narrow storage, or on Windows. The current state is moved over in place.
+     */
+    virtual void SetMappedStateVec(bool doMap);
+    virtual bool GetMappedStateVec() { return isMapped; }
+
+    /**
+     * Switch between sparse and dense state vectors as the fraction of nonzero amplitudes changes. A sparse state
+     * vector becomes dense once more than "denseAbove" of its amplitudes are nonzero, (checked before every gate, for
+     * free,) and a dense one becomes sparse once fewer than "sparseBelow" are, (counted by measurement and state
+     * preparation, which already pass over every amplitude). "sparseBelow" must be less than "denseAbove," so that
+     * the two don't thrash.
+     */
+    virtual void SetSparseSwitching(bool doSwitch, real1 denseAbove = 0.25f, real1 sparseBelow = 1.0f / 64.0f);
+    virtual bool GetSparseSwitching() { return isSparseSwitching; }
+    /// Whether the state vector is currently sparse, (once queued gates have run, and any due switch is made)
+    virtual bool IsSparseStateVec()
+    {
+        Finish();
+        UpdateSparsity();
+        return isSparse;
+    }
+
     virtual void Finish()
     {
+        FlushFusedGates();
 #if ENABLE_QUNIT_CPU_PARALLEL
         dispatchQueue.finish();
 #endif
@@ -64,6 +166,9 @@ public:
 
     virtual bool isFinished()
     {
+        if (fusedMask || fusedDiagonal.size()) {
+            return false;
+        }
 #if ENABLE_QUNIT_CPU_PARALLEL
         return dispatchQueue.isFinished();
 #else
@@ -73,6 +178,9 @@ public:
 
     virtual void Dump()
     {
+        fusedMask = 0;
+        fusedDiagonalMask = 0;
+        fusedDiagonal.clear();
 #if ENABLE_QUNIT_CPU_PARALLEL
         dispatchQueue.dump();
 #endif
@@ -86,6 +194,29 @@ public:
 
     virtual void FreeStateVec(complex* sv = NULL) { stateVec.reset(); }
 
+    /**
+     * Clone() shares its state vector with the original, until either engine writes to it. Call this before writing the
+     * state vector in place, to take a private copy if it is still shared. If "isOverwrite," the caller is about to
+     * replace every amplitude, so nothing is copied.
+     */
+    void UnshareStateVec(bool isOverwrite = false)
+    {
+        if (!stateVec || (stateVec.use_count() <= 1)) {
+            return;
+        }
+
+#if ENABLE_QUNIT_CPU_PARALLEL
+        // (Nothing queued should be running on the old state vector while it's replaced.)
+        dispatchQueue.finish();
+#endif
+
+        StateVectorPtr nStateVec = AllocStateVec(maxQPower);
+        if (!isOverwrite) {
+            nStateVec->copy(stateVec);
+        }
+        stateVec = nStateVec;
+    }
+
     virtual void GetAmplitudePage(complex* pagePtr, const bitCapInt offset, const bitCapInt length)
     {
         Finish();
@@ -105,6 +236,7 @@ public:
             stateVec->clear();
         }
 
+        UnshareStateVec();
         stateVec->copy_in(pagePtr, offset, length);
 
         runningNorm = ONE_R1;
@@ -113,11 +245,12 @@ public:
         QEnginePtr pageEnginePtr, const bitCapInt srcOffset, const bitCapInt dstOffset, const bitCapInt length)
     {
         QEngineCPUPtr pageEngineCpuPtr = std::dynamic_pointer_cast<QEngineCPU>(pageEnginePtr);
-        StateVectorPtr oStateVec = pageEngineCpuPtr->stateVec;
 
         Finish();
         pageEngineCpuPtr->Finish();
 
+        StateVectorPtr oStateVec = pageEngineCpuPtr->stateVec;
+
         if (!stateVec && !oStateVec) {
             return;
         }
@@ -127,6 +260,7 @@ public:
             stateVec->clear();
         }
 
+        UnshareStateVec();
         stateVec->copy_in(oStateVec, srcOffset, dstOffset, length);
 
         runningNorm = ONE_R1;
@@ -152,6 +286,8 @@ public:
             engineCpu->stateVec->clear();
         }
 
+        UnshareStateVec();
+        engineCpu->UnshareStateVec();
         stateVec->shuffle(engineCpu->stateVec);
 
         runningNorm = ONE_R1;
@@ -163,24 +299,28 @@ public:
         Finish();
         src->Finish();
 
-        complex* sv;
-        if (isSparse) {
-            sv = new complex[(bitCapIntOcl)maxQPower];
-        } else {
-            sv = std::dynamic_pointer_cast<StateVectorArray>(stateVec)->amplitudes;
-        }
-
-        src->GetQuantumState(sv);
+        UnshareStateVec(true);
 
-        if (isSparse) {
-            SetQuantumState(sv);
-            delete[] sv;
+        // Only a full precision array can be written in place. Sparse or narrow storage goes through a copy.
+        StateVectorArrayPtr arrayVec = std::dynamic_pointer_cast<StateVectorArray>(stateVec);
+        if (arrayVec) {
+            src->GetQuantumState(arrayVec->amplitudes);
+            return;
         }
+
+        std::unique_ptr<complex[]> sv(new complex[(bitCapIntOcl)maxQPower]);
+        src->GetQuantumState(sv.get());
+        SetQuantumState(sv.get());
     }
 
+    virtual void ApplySingleBit(const complex* mtrx, bitLenInt qubit);
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen);
+    virtual void ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count);
+
     virtual void SetQuantumState(const complex* inputState);
     virtual void GetQuantumState(complex* outputState);
     virtual void GetProbs(real1* outputProbs);
+    virtual QStateViewPtr LockStateView(bool isWritable = false);
     virtual complex GetAmplitude(bitCapInt perm);
     virtual void SetAmplitude(bitCapInt perm, complex amp);
 
@@ -256,6 +396,9 @@ public:
     virtual void UniformParityRZ(const bitCapInt& mask, const real1& angle);
     virtual void CUniformParityRZ(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
 
     /** @} */
 
@@ -269,7 +412,9 @@ public:
     virtual real1 ProbAll(bitCapInt fullRegister);
     virtual real1 ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation);
     virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
+    virtual void ProbMaskAll(const bitCapInt& mask, real1* probsArray);
     virtual real1 ProbParity(const bitCapInt& mask);
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
     virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true);
     virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG);
     virtual bool ApproxCompare(QInterfacePtr toCompare)
@@ -285,28 +430,96 @@ protected:
     virtual StateVectorPtr AllocStateVec(bitCapInt elemCount);
     virtual void ResetStateVec(StateVectorPtr sv);
 
-    typedef std::function<void(void)> DispatchFn;
-    virtual void Dispatch(DispatchFn fn)
+    virtual bool IsRunningNormTracked() { return isLazyNorm && doNormalize; }
+
+    /// Apply any pending fused gates on the qubits in "mask" to the state vector, (with all diagonal terms, if any)
+    virtual void FlushFusedGates(bitCapInt mask);
+    virtual void FlushFusedGates()
     {
+        FlushFusedMatrices(fusedMask);
+        FlushFusedDiagonal();
+    }
+    /// Apply only the pending fused single qubit gates on the qubits in "mask"
+    void FlushFusedMatrices(bitCapInt mask);
+    /// Apply 2x2 matrices, (4 entries each, in "mtrxs,") in order, to "qubits," all below the tile width, tile by tile
+    void ApplyTiled2x2(const std::vector<bitLenInt>& qubits, const std::vector<complex>& mtrxs);
+    /**
+     * True if "outerCount" independent register transforms, each costing about "weight" par_for() items, are enough
+     * to keep busy every thread that the grain would give their total work, (so that each thread can take whole
+     * registers,) or if that work runs on one thread anyway
+     */
+    bool IsRegisterParallel(const bitCapIntOcl& outerCount, const bitCapIntOcl& weight);
+    /// Apply every pending diagonal term, in one pass over the state vector
+    void FlushFusedDiagonal();
+    /// Buffer a diagonal term, (merging it into a pending term on the same basis states, if there is one)
+    void FuseDiagonal(const bitCapInt& mask, const bitCapInt& perm, const bitCapInt& parityMask,
+        const complex& phase0, const complex& phase1);
+
+    /**
+     * Queue "fn" on this engine's own dispatch thread, at any width, so that gates on separate engines, (like the
+     * shards of a QUnit,) run concurrently. Within a gate, par_for() still shares the one thread pool with every other
+     * engine. Anything that reads the state, or depends on another engine, calls Finish() first.
+     */
+    template <typename Fn> void Dispatch(Fn&& fn)
+    {
+        // (Every dispatched operation writes the state vector.)
+        UpdateSparsity();
+        UnshareStateVec();
 #if ENABLE_QUNIT_CPU_PARALLEL
-        const bitCapInt Stride = pow2(PSTRIDEPOW);
-        if (maxQPower < Stride) {
-            dispatchQueue.dispatch(fn);
-        } else {
-            Finish();
-            fn();
-        }
+        dispatchQueue.dispatch(std::forward<Fn>(fn));
 #else
         fn();
 #endif
     }
+    /**
+     * With sparse switching on, change representation if the fraction of nonzero amplitudes is past a threshold. This
+     * only replaces the state vector from the calling thread, (once the queue is idle,) never from the queue itself.
+     */
+    void UpdateSparsity();
+    /// Whether fewer than the "sparseBelow" fraction of the amplitudes in a dense state vector are nonzero
+    bool IsSparseEnough();
+    /// Convert the state vector to sparse or dense
+    void ConvertStateVec(bool toSparse);
+
+    /**
+     * Apply QFT(), or, if "inverse," IQFT(), to the register as a fast Fourier transform, rather than gate by gate.
+     * With enough states of the other qubits to occupy every thread, each thread gathers the register's amplitudes for
+     * one such state into a buffer, and transforms it there, so the state vector is traversed once. Otherwise, the
+     * state vector is traversed once per qubit of the register, by radix-2 butterflies.
+     */
+    void RegisterFourier(bitLenInt start, bitLenInt length, bool inverse);
 
     void DecomposeDispose(bitLenInt start, bitLenInt length, QEngineCPUPtr dest);
     virtual void Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
         const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh = REAL1_DEFAULT_ARG);
+    /// Run one Apply2x2() kernel over every pair of amplitudes it touches, (inlined into the loop over each chunk)
+    template <typename Fn>
+    void Apply2x2Pairs(const bitCapInt& offset1, const bitCapInt& offset2, const bitCapInt* qPowersSorted,
+        const bitLenInt& bitCount, Fn&& fn);
+    /// Apply2x2() body for a dense state vector, in contiguous runs of amplitudes, with the wide SIMD kernels
+    void Apply2x2Runs(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
+        const bitCapInt* qPowersSorted);
+    /**
+     * True if a loop that skips bits from "lowPower" up can use the wide SIMD kernels on runs of amplitudes. (A sparse
+     * state vector that has filled in reports is_sparse() false, but it still has no array of amplitudes.)
+     */
+    bool IsWideSimdRun(const bitCapInt& lowPower)
+    {
+        return (lowPower >= WIDE_SIMD_WIDTH) && IsWideSimdSupported() &&
+            (std::dynamic_pointer_cast<StateVectorArray>(stateVec) != NULL);
+    }
     virtual void UpdateRunningNorm(real1 norm_thresh = REAL1_DEFAULT_ARG);
     virtual void ApplyM(bitCapInt mask, bitCapInt result, complex nrm);
 
+    /**
+     * Permute a dense state vector in place, by the involution "partnerFn" of the values of the register at
+     * "start," (masked by "regMask,") swapping each pair of amplitudes once, on permutations where every control is
+     * set. Any rotation of the register's values or bits is two such passes, so it needs no second state vector.
+     */
+    template <typename Fn>
+    void SwapRegPairs(const bitCapInt& regMask, const bitLenInt& start, const bitCapInt* controlPowers,
+        const bitLenInt& controlLen, const bitCapInt& controlMask, Fn&& partnerFn);
+
     virtual void INCDECC(
         bitCapInt toMod, const bitLenInt& inOutStart, const bitLenInt& length, const bitLenInt& carryIndex);
     virtual void INCDECSC(
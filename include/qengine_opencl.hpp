@@ -25,6 +25,8 @@
 #define BCI_ARG_LEN 10
 #define CMPLX_NORM_LEN 6
 #define REAL_ARG_LEN 2
+// Most gates in one launch of the tiled kernel, (whose gate list is in constant memory)
+#define QRACK_OCL_TILE_MAX_GATES 256U
 
 namespace Qrack {
 
@@ -42,13 +44,17 @@ struct QueueItem {
     size_t localGroupSize;
     std::vector<BufferPtr> buffers;
     size_t localBuffSize;
+    // A specialized kernel, dispatched in place of the kernel of "api_call," if set
+    OCLSpecializedKernelPtr spec;
 
-    QueueItem(OCLAPI ac, size_t wic, size_t lgs, std::vector<BufferPtr> b, size_t lbs)
+    QueueItem(OCLAPI ac, size_t wic, size_t lgs, std::vector<BufferPtr> b, size_t lbs,
+        OCLSpecializedKernelPtr s = nullptr)
         : api_call(ac)
         , workItemCount(wic)
         , localGroupSize(lgs)
         , buffers(b)
         , localBuffSize(lbs)
+        , spec(s)
     {
     }
 };
@@ -58,19 +64,58 @@ struct PoolItem {
     BufferPtr realBuffer;
     BufferPtr ulongBuffer;
 
+    // Host-side copies of the arguments above, in pinned memory that stays mapped for the life of the item. A pool item
+    // isn't reused until its kernel completes, so uploads from here never need the host to wait on them.
+    complex* cmplxStaging;
+    bitCapIntOcl* ulongStaging;
+    real1* realStaging;
+
     std::shared_ptr<real1> probArray;
     std::shared_ptr<real1> angleArray;
     complex* otherStateVec;
 
-    PoolItem(cl::Context& context)
+    PoolItem(cl::Context& context, cl::CommandQueue& queue)
         : probArray(NULL)
         , angleArray(NULL)
         , otherStateVec(NULL)
+        , stagingQueue(queue)
     {
         cmplxBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_ONLY, sizeof(complex) * CMPLX_NORM_LEN);
         realBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_ONLY, sizeof(real1) * REAL_ARG_LEN);
         ulongBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_ONLY, sizeof(bitCapIntOcl) * BCI_ARG_LEN);
+
+        size_t stagingSize =
+            sizeof(complex) * CMPLX_NORM_LEN + sizeof(bitCapIntOcl) * BCI_ARG_LEN + sizeof(real1) * REAL_ARG_LEN;
+        cl_int error;
+        void* staging = NULL;
+        stagingBuffer = cl::Buffer(context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, stagingSize, NULL, &error);
+        if (error == CL_SUCCESS) {
+            staging =
+                stagingQueue.enqueueMapBuffer(stagingBuffer, CL_TRUE, CL_MAP_WRITE, 0, stagingSize, NULL, NULL, &error);
+        }
+        if ((error != CL_SUCCESS) || !staging) {
+            // Pinned memory only makes the uploads faster. Any host memory that lives as long as the item is correct.
+            stagingBuffer = cl::Buffer();
+            unpinnedStaging.reset(new char[stagingSize]);
+            staging = unpinnedStaging.get();
+        }
+
+        cmplxStaging = (complex*)staging;
+        ulongStaging = (bitCapIntOcl*)(cmplxStaging + CMPLX_NORM_LEN);
+        realStaging = (real1*)(ulongStaging + BCI_ARG_LEN);
+    }
+
+    ~PoolItem()
+    {
+        if (stagingBuffer()) {
+            stagingQueue.enqueueUnmapMemObject(stagingBuffer, cmplxStaging);
+        }
     }
+
+protected:
+    cl::CommandQueue stagingQueue;
+    cl::Buffer stagingBuffer;
+    std::unique_ptr<char[]> unpinnedStaging;
 };
 
 typedef std::shared_ptr<PoolItem> PoolItemPtr;
@@ -107,6 +152,9 @@ protected:
     // stateBuffer is allocated as a shared_ptr, because it's the only buffer that will be acted on outside of
     // QEngineOCL itself, specifically by QEngineOCLMulti.
     BufferPtr stateBuffer;
+    // Clone() shares a device RAM stateBuffer until either engine writes to it. Every sharer holds a copy of this
+    // handle, (which records the buffer it was shared for,) so its use count is the number of sharers.
+    std::shared_ptr<cl::Buffer*> stateBufferShare;
     BufferPtr nrmBuffer;
     BufferPtr powersBuffer;
     std::vector<PoolItemPtr> poolItems;
@@ -117,6 +165,8 @@ protected:
     size_t maxMem;
     size_t maxAlloc;
     unsigned int procElemCount;
+    // Amplitudes in a tile of the state vector that fits in a work group's local memory, (as a power of 2)
+    bitLenInt tileQubits;
     bool unlockHostMem;
     cl_int lockSyncFlags;
     bool usingHostRam;
@@ -208,12 +258,18 @@ public:
     virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
     virtual real1 ProbAll(bitCapInt fullRegister);
 
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen);
+    virtual void ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count);
+
     virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
         bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
         const bitCapInt& mtrxSkipValueMask);
     virtual void UniformParityRZ(const bitCapInt& mask, const real1& angle);
     virtual void CUniformParityRZ(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
 
     /* Operations that have an improved implementation. */
     using QEngine::X;
@@ -275,7 +331,10 @@ public:
     virtual void ProbRegAll(const bitLenInt& start, const bitLenInt& length, real1* probsArray);
     virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
     virtual void ProbMaskAll(const bitCapInt& mask, real1* probsArray);
+    virtual std::map<bitCapInt, int> MultiShotMeasureMask(
+        const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots);
     virtual real1 ProbParity(const bitCapInt& mask);
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
     virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true);
 
     virtual void PhaseFlip();
@@ -289,6 +348,7 @@ public:
     virtual void SetQuantumState(const complex* inputState);
     virtual void GetQuantumState(complex* outputState);
     virtual void GetProbs(real1* outputProbs);
+    virtual QStateViewPtr LockStateView(bool isWritable = false);
     virtual complex GetAmplitude(bitCapInt perm);
     virtual void SetAmplitude(bitCapInt perm, complex amp);
 
@@ -313,7 +373,14 @@ protected:
     virtual void ResetStateVec(complex* sv);
     virtual void ResetStateBuffer(BufferPtr nStateBuffer);
     virtual BufferPtr MakeStateVecBuffer(complex* nStateVec);
+    /// Copy the state vector from "oldBuffer," on another context's "oldQueue," into stateBuffer
+    virtual void MigrateStateBuffer(BufferPtr oldBuffer, cl::CommandQueue oldQueue);
     virtual void ReinitBuffer();
+    /**
+     * Take a private copy of stateBuffer, if Clone() still shares it, before writing to it. If "isOverwrite," the
+     * caller is about to replace every amplitude, so nothing is copied.
+     */
+    void UnshareStateBuffer(bool isOverwrite = false);
 
     virtual void Compose(OCLAPI apiCall, bitCapIntOcl* bciArgs, QEngineOCLPtr toCopy);
 
@@ -331,6 +398,13 @@ protected:
 
     real1 ParSum(real1* toSum, bitCapIntOcl maxI);
 
+    /// Queue QFT(), or, if "inverse," IQFT(), on the register as a fast Fourier transform, in radix-4 butterfly passes
+    void RegisterFourier(bitLenInt start, bitLenInt length, bool inverse);
+    /// Queue the ProbMaskAll() kernel, to fill a device buffer with the probability of every masked permutation
+    void QueueProbMaskAll(const bitCapInt& mask, BufferPtr probsBuffer);
+    /// Queue an in-place, inclusive prefix sum of "count" probabilities, on the device
+    void QueueProbCdf(BufferPtr probsBuffer, bitCapIntOcl count);
+
     /**
      * Locks synchronization between the state vector buffer and general RAM, so the state vector can be directly read
      * and/or written to.
@@ -375,6 +449,9 @@ protected:
         bitCapIntOcl valuesLength = 0);
     void CArithmeticCall(OCLAPI api_call, bitCapIntOcl (&bciArgs)[BCI_ARG_LEN], bitCapIntOcl* controlPowers,
         const bitLenInt controlLen, unsigned char* values = NULL, bitCapIntOcl valuesLength = 0);
+    /// Run one in-place pass of swaps, (as for rol, inc, and cinc,) without a second state vector
+    void SwapCall(OCLAPI api_call, bitCapIntOcl (&bciArgs)[BCI_ARG_LEN], bitCapIntOcl* controlPowers = NULL,
+        const bitLenInt controlLen = 0);
 
     using QEngine::Apply2x2;
     virtual void Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
@@ -390,7 +467,7 @@ protected:
 
     /* Utility functions used by the operations above. */
     void QueueCall(OCLAPI api_call, size_t workItemCount, size_t localGroupSize, std::vector<BufferPtr> args,
-        size_t localBuffSize = 0);
+        size_t localBuffSize = 0, OCLSpecializedKernelPtr spec = nullptr);
     void WaitCall(OCLAPI api_call, size_t workItemCount, size_t localGroupSize, std::vector<BufferPtr> args,
         size_t localBuffSize = 0);
     EventVecPtr ResetWaitEvents(bool waitQueue = true);
@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include "qengine_opencl.hpp"
+
+namespace Qrack {
+
+class QEngineOCLBatch;
+typedef std::shared_ptr<QEngineOCLBatch> QEngineOCLBatchPtr;
+
+/**
+ * Many independent, equally wide registers, run side by side in one OpenCL state vector, for parameter sweeps over
+ * circuits too small to occupy a GPU on their own.
+ *
+ * The "copyCount" registers of "copyQubitCount" qubits each are held as the equal superposition, (over a "copy index"
+ * in the high qubits of the buffer,) of every register's own state, so every copy keeps the norm 1 / copyCount, (up to
+ * padding of the copy count to a power of 2). A gate inherited from QEngineOCL, such as H() or CNOT(), on qubits below
+ * GetCopyQubitCount() acts identically on every copy, in one kernel launch. The "Each" methods act on every copy in one
+ * launch as well, but take one matrix, angle, or result per copy. Qubits at or above GetCopyQubitCount() hold the copy
+ * index, and must not be operated on directly.
+ */
+class QEngineOCLBatch : public QEngineOCL {
+protected:
+    bitLenInt copyQubitCount;
+    bitCapIntOcl copyCount;
+    // The copy count, padded to a power of 2
+    bitCapIntOcl copyCapacity;
+
+    void CheckCopyQubit(bitLenInt qubit);
+    void CheckCopy(bitCapIntOcl copy);
+
+public:
+    /**
+     * Initialize "copies" registers of "qubitsPerCopy" qubits each, every one in the permutation "initState." The
+     * remaining arguments are as for QEngineOCL.
+     */
+    QEngineOCLBatch(bitLenInt qubitsPerCopy, bitCapIntOcl copies, bitCapInt initState = 0,
+        qrack_rand_gen_ptr rgp = nullptr, bool useHostMem = false, int devID = -1, bool useHardwareRNG = true);
+
+    /// Width of each register in the batch
+    bitLenInt GetCopyQubitCount() { return copyQubitCount; }
+    /// Number of registers in the batch
+    bitCapIntOcl GetCopyCount() { return copyCount; }
+
+    /// Set every register in the batch to the permutation "perm"
+    virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
+
+    /// Apply a 2x2 unitary to "target" of each register, with "mtrxs" holding 4 * GetCopyCount() entries, (one matrix
+    /// per register, in order)
+    void ApplyEach(const complex* mtrxs, bitLenInt target);
+    /// Apply a controlled 2x2 unitary to "target" of each register, with "mtrxs" as for ApplyEach()
+    void ApplyControlledEach(const bitLenInt* controls, bitLenInt controlLen, bitLenInt target, const complex* mtrxs);
+
+    /// Rotate "target" of each register around the Pauli X axis, by the angle "radians" of the same index
+    void RXEach(const real1* radians, bitLenInt target);
+    /// Rotate "target" of each register around the Pauli Y axis, by the angle "radians" of the same index
+    void RYEach(const real1* radians, bitLenInt target);
+    /// Rotate "target" of each register around the Pauli Z axis, by the angle "radians" of the same index
+    void RZEach(const real1* radians, bitLenInt target);
+
+    /// Fill "probs" with the probability of "qubit" being |1>, in each register
+    void ProbEach(bitLenInt qubit, real1* probs);
+    /// Measure "qubit" of each register, independently, filling "results" with the outcome of each
+    void MEach(bitLenInt qubit, bool* results);
+
+    /// Copy the 2^GetCopyQubitCount() amplitudes of register "copy" into "outputState"
+    void GetCopyState(bitCapIntOcl copy, complex* outputState);
+    /// Set register "copy" to the normalized state "inputState," leaving the other registers as they are
+    void SetCopyState(bitCapIntOcl copy, const complex* inputState);
+};
+} // namespace Qrack
@@ -13,6 +13,7 @@
 #pragma once
 
 #include "qengine_cpu.hpp"
+#include "qpager.hpp"
 #include "qstabilizerhybrid.hpp"
 
 #if ENABLE_OPENCL
@@ -23,6 +24,10 @@
 #include "qunit.hpp"
 #endif
 
+#if ENABLE_MPI
+#include "qmpipager.hpp"
+#endif
+
 namespace Qrack {
 
 /** Factory method to create specific engine implementations. */
@@ -39,6 +44,12 @@ QInterfacePtr CreateQuantumInterface(
 #endif
     case QINTERFACE_STABILIZER_HYBRID:
         return std::make_shared<QStabilizerHybrid>(subengine1, subengine2, args...);
+    case QINTERFACE_QPAGER:
+        return std::make_shared<QPager>(subengine1, args...);
+#if ENABLE_MPI
+    case QINTERFACE_MPI:
+        return std::make_shared<QMPIPager>(subengine1, args...);
+#endif
     case QINTERFACE_QUNIT:
         return std::make_shared<QUnit>(subengine1, subengine2, args...);
 #if ENABLE_OPENCL
@@ -64,6 +75,12 @@ QInterfacePtr CreateQuantumInterface(QInterfaceEngine engine, QInterfaceEngine s
 #endif
     case QINTERFACE_STABILIZER_HYBRID:
         return std::make_shared<QStabilizerHybrid>(subengine, args...);
+    case QINTERFACE_QPAGER:
+        return std::make_shared<QPager>(subengine, args...);
+#if ENABLE_MPI
+    case QINTERFACE_MPI:
+        return std::make_shared<QMPIPager>(subengine, args...);
+#endif
     case QINTERFACE_QUNIT:
         return std::make_shared<QUnit>(subengine, args...);
 #if ENABLE_OPENCL
@@ -95,4 +112,19 @@ template <typename... Ts> QInterfacePtr CreateQuantumInterface(QInterfaceEngine
     }
 }
 
+/**
+ * Factory method that also picks the amplitude storage precision, (see QStoragePrecision,) per instance. Precision is
+ * a property of QEngineCPU storage, so it applies when "engine" is QINTERFACE_CPU, and is ignored otherwise.
+ */
+template <typename... Ts>
+QInterfacePtr CreateQuantumInterface(QStoragePrecision precision, QInterfaceEngine engine, Ts... args)
+{
+    QInterfacePtr toRet = CreateQuantumInterface(engine, args...);
+    QEngineCPUPtr engineCpu = std::dynamic_pointer_cast<QEngineCPU>(toRet);
+    if (engineCpu) {
+        engineCpu->SetStoragePrecision(precision);
+    }
+    return toRet;
+}
+
 } // namespace Qrack
@@ -11,10 +11,62 @@
 // for details.
 #pragma once
 
+#include <iostream>
+
 #include "qengine.hpp"
 
+// Range of widths, (in qubits,) over which QHybrid times QEngineCPU against QEngineOCL, and timed repetitions per width
+#define QRACK_HYBRID_CALIBRATE_MIN_QB 4
+#define QRACK_HYBRID_CALIBRATE_MAX_QB 20
+#define QRACK_HYBRID_CALIBRATE_REPS 5
+
 namespace Qrack {
 
+/// Classes of gate that QHybrid finds a separate CPU/GPU crossover for
+enum QHybridGateClass {
+    /// Single bit gates, (timed as a layer of H gates)
+    HYBRID_GATE_SINGLE = 0,
+    /// Controlled gates, (timed as a chain of CNOT gates)
+    HYBRID_GATE_CONTROLLED,
+    /// Whole register arithmetic, (timed as INC over the full width)
+    HYBRID_GATE_ARITHMETIC,
+
+    HYBRID_GATE_CLASS_COUNT
+};
+
+/**
+ * Measured CPU/GPU crossover for one OpenCL device. For each QHybridGateClass, this holds the narrowest width from
+ * which QEngineOCL ran that class of gate faster than QEngineCPU. It also holds the count of gates over which QEngineOCL
+ * saves enough time to pay for copying the state vector to it.
+ */
+struct QHybridCalibration {
+    bitLenInt crossoverQb[HYBRID_GATE_CLASS_COUNT];
+    real1 amortizeGates[HYBRID_GATE_CLASS_COUNT];
+
+    QHybridCalibration();
+
+    /**
+     * Get the calibration of device "devID," (-1 for the default device).
+     *
+     * Each device is calibrated once per process, the first time a QHybrid is created for it without an explicit qubit
+     * threshold. The result is also saved alongside the OpenCL binary cache, (see OCLEngine::GetDefaultBinaryPath(),)
+     * keyed on the device, its driver, and the host, and later processes load it from there. Set the
+     * QRACK_HYBRID_NO_CALIBRATION_CACHE environment variable to always recalibrate.
+     */
+    static QHybridCalibration Get(int devID);
+
+    /**
+     * Given per gate times on CPU and GPU, at consecutive widths starting from "minQb," return the narrowest width
+     * from which the GPU is faster at every measured width. If the GPU is never faster, this is one past the widest
+     * measured width.
+     */
+    static bitLenInt FindCrossover(const std::vector<real1>& cpuNs, const std::vector<real1>& gpuNs, bitLenInt minQb);
+
+    void Write(std::ostream& os) const;
+    /// Returns false, (and leaves this unchanged,) if the stream doesn't hold a complete calibration.
+    bool Read(std::istream& is);
+};
+
 class QHybrid;
 typedef std::shared_ptr<QHybrid> QHybridPtr;
 
@@ -34,6 +86,10 @@ protected:
     uint32_t concurrency;
     bitLenInt thresholdQubits;
     bool isGpu;
+    bool isThresholdCalibrated;
+    QHybridGateClass gateClass;
+    QHybridCalibration calibration;
+    bitCapInt expectedDepth;
 
 public:
     QHybrid(bitLenInt qBitCount, bitCapInt initState = 0, qrack_rand_gen_ptr rgp = nullptr,
@@ -45,6 +101,28 @@ public:
 
     virtual bool IsOpencl() { return isGpu; }
 
+    /**
+     * Set the class of gate that dominates the circuit, which picks the calibrated width at which this switches to
+     * OpenCL. (This has no effect if the constructor was given an explicit qubit threshold.)
+     */
+    virtual void SetGateClass(QHybridGateClass gc)
+    {
+        gateClass = gc;
+        if (isThresholdCalibrated) {
+            thresholdQubits = calibration.crossoverQb[gateClass];
+        }
+    }
+    virtual QHybridGateClass GetGateClass() { return gateClass; }
+
+    /**
+     * Set the number of gates expected to remain in the circuit, (0, the default, if unknown). When a change in width
+     * crosses the threshold, switching to OpenCL copies the state vector, so with a known depth and a calibrated
+     * threshold, the switch is only made if the remaining gates run faster on the GPU by more than that copy costs.
+     */
+    virtual void SetExpectedDepth(bitCapInt depth) { expectedDepth = depth; }
+    virtual bitCapInt GetExpectedDepth() { return expectedDepth; }
+    virtual bitLenInt GetThresholdQubits() { return thresholdQubits; }
+
     virtual void SetConcurrency(uint32_t threadCount)
     {
         concurrency = threadCount;
@@ -71,11 +149,23 @@ public:
         isGpu = useGpu;
     }
 
+    /// Pick the mode for a width of "nQubitCount," (see SetExpectedDepth()).
+    virtual bool IsGpuBetter(bitLenInt nQubitCount)
+    {
+        if (nQubitCount < thresholdQubits) {
+            return false;
+        }
+
+        // Moving down to the CPU is cheap, at these widths, but moving up has to pay for itself.
+        return isGpu || !expectedDepth || !isThresholdCalibrated ||
+            ((real1)expectedDepth >= calibration.amortizeGates[gateClass]);
+    }
+
     using QInterface::Compose;
     virtual bitLenInt Compose(QHybridPtr toCopy)
     {
         bitLenInt nQubitCount = qubitCount + toCopy->qubitCount;
-        SwitchModes(nQubitCount >= thresholdQubits);
+        SwitchModes(IsGpuBetter(nQubitCount));
         toCopy->SwitchModes(isGpu);
         SetQubitCount(nQubitCount);
         return engine->Compose(toCopy->engine);
@@ -84,7 +174,7 @@ public:
     virtual bitLenInt Compose(QHybridPtr toCopy, bitLenInt start)
     {
         bitLenInt nQubitCount = qubitCount + toCopy->qubitCount;
-        SwitchModes(nQubitCount >= thresholdQubits);
+        SwitchModes(IsGpuBetter(nQubitCount));
         toCopy->SwitchModes(isGpu);
         SetQubitCount(nQubitCount);
         return engine->Compose(toCopy->engine, start);
@@ -100,7 +190,7 @@ public:
     virtual void Decompose(bitLenInt start, QHybridPtr dest)
     {
         bitLenInt nQubitCount = qubitCount - dest->GetQubitCount();
-        SwitchModes(nQubitCount >= thresholdQubits);
+        SwitchModes(IsGpuBetter(nQubitCount));
         dest->SwitchModes(isGpu);
         SetQubitCount(nQubitCount);
         return engine->Decompose(start, dest->engine);
@@ -108,20 +198,23 @@ public:
     virtual void Dispose(bitLenInt start, bitLenInt length)
     {
         bitLenInt nQubitCount = qubitCount - length;
-        SwitchModes(nQubitCount >= thresholdQubits);
+        SwitchModes(IsGpuBetter(nQubitCount));
         SetQubitCount(nQubitCount);
         return engine->Dispose(start, length);
     }
     virtual void Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm)
     {
         bitLenInt nQubitCount = qubitCount - length;
-        SwitchModes(nQubitCount >= thresholdQubits);
+        SwitchModes(IsGpuBetter(nQubitCount));
         SetQubitCount(nQubitCount);
         return engine->Dispose(start, length, disposedPerm);
     }
 
     virtual void SetQuantumState(const complex* inputState) { engine->SetQuantumState(inputState); }
     virtual void GetQuantumState(complex* outputState) { engine->GetQuantumState(outputState); }
+    virtual QStateViewPtr LockStateView(bool isWritable = false) { return engine->LockStateView(isWritable); }
+    virtual void WriteCheckpoint(QCheckpointWriter& writer) { engine->WriteCheckpoint(writer); }
+    virtual void ReadCheckpoint(QCheckpointReader& reader) { engine->ReadCheckpoint(reader); }
     virtual void GetProbs(real1* outputProbs) { engine->GetProbs(outputProbs); }
     virtual complex GetAmplitude(bitCapInt perm) { return engine->GetAmplitude(perm); }
     virtual void SetAmplitude(bitCapInt perm, complex amp) { engine->SetAmplitude(perm, amp); }
@@ -131,6 +224,14 @@ public:
     }
 
     virtual void ApplySingleBit(const complex* mtrx, bitLenInt qubitIndex) { engine->ApplySingleBit(mtrx, qubitIndex); }
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen)
+    {
+        engine->ApplyNxN(mtrx, targets, targetLen);
+    }
+    virtual void ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count)
+    {
+        engine->ApplySingleBitBatch(mtrxs, qubits, count);
+    }
     virtual void ApplySinglePhase(const complex topLeft, const complex bottomRight, bitLenInt qubitIndex)
     {
         engine->ApplySinglePhase(topLeft, bottomRight, qubitIndex);
@@ -317,6 +418,15 @@ public:
         return engine->IndexedSBC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
     }
     virtual void Hash(bitLenInt start, bitLenInt length, unsigned char* values) { engine->Hash(start, length, values); }
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false)
+    {
+        engine->QFT(start, length, trySeparate);
+    }
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false)
+    {
+        engine->IQFT(start, length, trySeparate);
+    }
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length) { engine->GroverDiffusion(start, length); }
 
     virtual void Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2) { engine->Swap(qubitIndex1, qubitIndex2); }
     virtual void ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2) { engine->ISwap(qubitIndex1, qubitIndex2); }
@@ -337,6 +447,10 @@ public:
         return engine->ProbMask(mask, permutation);
     }
     virtual real1 ProbParity(const bitCapInt& mask) { return engine->ProbParity(mask); }
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+    {
+        engine->ExpectationPauliStrings(terms, termCount, expectations);
+    }
     virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true)
     {
         return engine->ForceMParity(mask, result, doForce);
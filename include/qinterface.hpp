@@ -14,15 +14,18 @@
 #define _USE_MATH_DEFINES
 
 #include <ctime>
+#include <functional>
 #include <map>
 #include <math.h>
 #include <memory>
+#include <stdexcept>
 #include <vector>
 
 #if ENABLE_UINT128
 #include <ostream>
 #endif
 
+#include "common/checkpoint.hpp"
 #include "common/parallel_for.hpp"
 #include "common/qrack_types.hpp"
 #include "common/rdrandwrapper.hpp"
@@ -74,6 +77,69 @@ inline bool isPowerOfTwo(const bitCapInt& x) { return ((x != 0U) && !(x & (x - O
 class QInterface;
 typedef std::shared_ptr<QInterface> QInterfacePtr;
 
+class QStateView;
+typedef std::unique_ptr<QStateView> QStateViewPtr;
+
+/**
+ * A view of the whole state vector of a QInterface, in permutation basis, from QInterface::LockStateView().
+ *
+ * Where an engine holds its amplitudes in one array, (or in a mappable OpenCL buffer,) the view points into that
+ * array, without copying it. Otherwise, the view holds a copy, written back on release if the view is writable. The
+ * QInterface must not be used while the view exists, and destroying the view releases the state to it.
+ */
+class QStateView {
+protected:
+    complex* amplitudes;
+    bitCapIntOcl length;
+    bool isWritable;
+    std::function<void()> release;
+
+public:
+    QStateView(complex* amps, bitCapIntOcl len, bool writable, std::function<void()> rel)
+        : amplitudes(amps)
+        , length(len)
+        , isWritable(writable)
+        , release(rel)
+    {
+    }
+
+    QStateView(const QStateView&) = delete;
+    QStateView& operator=(const QStateView&) = delete;
+
+    ~QStateView()
+    {
+        if (release) {
+            release();
+        }
+    }
+
+    /// Get the count of amplitudes, (which is the QInterface's GetMaxQPower())
+    bitCapIntOcl GetLength() { return length; }
+    bool IsWritable() { return isWritable; }
+    /// Get the amplitudes, to read
+    const complex* GetAmplitudes() { return amplitudes; }
+    /// Get the amplitudes, to read or write, (which throws, if the view was not locked as writable)
+    complex* GetWritableAmplitudes()
+    {
+        if (!isWritable) {
+            throw std::invalid_argument("QStateView was not locked as writable.");
+        }
+        return amplitudes;
+    }
+};
+
+/**
+ * One term of an observable: "coefficient" times a tensor product of Pauli operators.
+ *
+ * Bit i of "xMask" and "zMask" selects the Pauli operator on qubit i: identity (neither set), X (only xMask), Z (only
+ * zMask), or Y (both).
+ */
+struct PauliTerm {
+    bitCapInt xMask;
+    bitCapInt zMask;
+    real1 coefficient;
+};
+
 /**
  * Enumerated list of supported engines.
  *
@@ -116,6 +182,18 @@ enum QInterfaceEngine {
      */
     QINTERFACE_QUNIT_MULTI,
 
+    /**
+     * Create a QPager, which splits a single coherent QEngine register into "pages" of contiguous amplitudes, possibly
+     * across multiple OpenCL devices.
+     */
+    QINTERFACE_QPAGER,
+
+    /**
+     * Create a QMPIPager, which splits a single coherent QEngine register across the ranks of an MPI job, (if built
+     * with ENABLE_MPI).
+     */
+    QINTERFACE_MPI,
+
     QINTERFACE_FIRST = QINTERFACE_CPU,
 
     QINTERFACE_OPTIMAL = QINTERFACE_STABILIZER_HYBRID,
@@ -248,6 +326,19 @@ public:
         }
     }
 
+    /** Fill "values" with "count" random real numbers between 0 and 1, (as "count" calls to Rand() would) */
+    void FillRand(real1* values, size_t count)
+    {
+        if (hardware_rand_generator != NULL) {
+            hardware_rand_generator->FillRandom(values, count);
+            return;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            values[i] = rand_distribution(*rand_generator);
+        }
+    }
+
     /** Set an arbitrary pure quantum state representation
      *
      * \warning PSEUDO-QUANTUM
@@ -266,6 +357,16 @@ public:
      */
     virtual void GetProbs(real1* outputProbs) = 0;
 
+    /** Lock a view of the pure quantum state representation, (for reading, or for writing, if "isWritable")
+     *
+     * Engines that hold their state in one array return a view of it, without a second copy of the state. Other
+     * layers return a view of a copy from GetQuantumState(), which is passed back to SetQuantumState() when a writable
+     * view is released. No other method of this QInterface may be called while the view exists.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual QStateViewPtr LockStateView(bool isWritable = false);
+
     /** Get the representational amplitude of a full permutation
      *
      * \warning PSEUDO-QUANTUM
@@ -461,6 +562,26 @@ public:
      */
     virtual void ApplyAntiControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
         const bitLenInt& target, const complex topRight, const complex bottomLeft);
+
+    /**
+     * Apply an arbitrary unitary transformation to 1 to 4 target bits, as one dense block.
+     *
+     * "mtrx" is a flat, row-major 2^n x 2^n complex matrix, for n = "targetLen." The first bit index in the "targets"
+     * array is the least significant bit of the matrix row and column indices, proceeding to the most significant bit.
+     * (For one target, this is the same as Qrack::ApplySingleBit.) Engines with a native kernel apply the whole block
+     * in a single pass over the state vector.
+     */
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen);
+
+    /**
+     * Apply a sequence of arbitrary single bit gates, in order: "mtrxs" holds 4 components per gate, (as for
+     * Qrack::ApplySingleBit,) and "qubits" holds each gate's target, (which may repeat.)
+     *
+     * Engines with a tiled kernel apply a run of gates on low qubits in one pass over the state vector, rather than
+     * one pass per gate. Otherwise, this is the same as calling Qrack::ApplySingleBit for each gate.
+     */
+    virtual void ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count);
+
     /**
      * Apply a "uniformly controlled" arbitrary single bit unitary transformation. (See
      * https://arxiv.org/abs/quant-ph/0312218)
@@ -1801,6 +1922,13 @@ public:
      */
     virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
 
+    /**
+     * Grover diffusion - Reflect the register about its uniform superposition, as H(), ZeroPhaseFlip(), and H() again
+     * on the register would, (including the global phase of -1 that those gates give). Engines apply it in two passes
+     * over the state, one to sum the amplitudes of the register and one to subtract twice their mean.
+     */
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
+
     /** Reverse the phase of the state where the register equals zero. */
     virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length) = 0;
 
@@ -2056,6 +2184,50 @@ public:
     /** Overall probability of any odd permutation of the masked set of bits */
     virtual real1 ProbParity(const bitCapInt& mask) = 0;
 
+    /**
+     * Expectation values of a batch of Pauli strings, (see PauliTerm,) written to "expectations," (ignoring the terms'
+     * coefficients,) without collapsing or copying the state where the engine can avoid it
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
+
+    /**
+     * Expectation value of a single Pauli string, with X on the bits of "xMask," Z on the bits of "zMask," and Y where
+     * both are set
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    real1 ExpectationPauliString(const bitCapInt& xMask, const bitCapInt& zMask)
+    {
+        const PauliTerm term = { xMask, zMask, ONE_R1 };
+        real1 expectation;
+        ExpectationPauliStrings(&term, 1U, &expectation);
+        return expectation;
+    }
+
+    /**
+     * Expectation value of an observable, given as a sum of (coefficient times) Pauli strings, in one batch
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    real1 ExpectationObservable(const std::vector<PauliTerm>& terms)
+    {
+        if (!terms.size()) {
+            return ZERO_R1;
+        }
+
+        std::vector<real1> expectations(terms.size());
+        ExpectationPauliStrings(&(terms[0]), terms.size(), &(expectations[0]));
+
+        real1 toRet = ZERO_R1;
+        for (size_t i = 0; i < terms.size(); i++) {
+            toRet += terms[i].coefficient * expectations[i];
+        }
+
+        return toRet;
+    }
+
     /**
      * Statistical measure of masked permutation probability
      *
@@ -2147,6 +2319,43 @@ public:
      */
     virtual QInterfacePtr Clone() = 0;
 
+    /**
+     * Write a checkpoint of this register to "os," which LoadCheckpoint() can restore into a register of the same width
+     * and layer types. State vectors are streamed out in chunks, (compressed with zlib, if "doCompress" and Qrack was
+     * built with ENABLE_ZLIB,) rather than copied out whole. QUnit keeps its shard layout and buffered phase gates, and
+     * QStabilizerHybrid keeps its tableau, so neither is flushed to save it.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    void SaveCheckpoint(std::ostream& os, bool doCompress = false)
+    {
+        QCheckpointWriter writer(os, doCompress);
+        writer.WriteHeader();
+        WriteCheckpoint(writer);
+    }
+
+    /**
+     * Replace the state of this register with a checkpoint written by SaveCheckpoint(). State vectors are streamed into
+     * the existing register in chunks, so restoring doesn't need room for a second copy of the state. If the checkpoint
+     * doesn't match the width or layer types of this register, this throws std::invalid_argument.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    void LoadCheckpoint(std::istream& is)
+    {
+        QCheckpointReader reader(is);
+        reader.ReadHeader();
+        ReadCheckpoint(reader);
+    }
+
+    /**
+     * Write this layer's checkpoint record, (nested in a SaveCheckpoint() stream). By default, this copies out the
+     * whole state vector with GetQuantumState(), so layers that can stream their state override it.
+     */
+    virtual void WriteCheckpoint(QCheckpointWriter& writer);
+    /// Read this layer's checkpoint record, as written by WriteCheckpoint()
+    virtual void ReadCheckpoint(QCheckpointReader& reader);
+
     /**
      *  Set the device index, if more than one device is available.
      */
@@ -0,0 +1,248 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <functional>
+
+#include <mpi.h>
+
+#include "qengine.hpp"
+
+// Fewest qubits local to each rank, (by default,) below which a register is replicated on every rank instead of split
+#define QRACK_MPI_MIN_PAGE_QB 10U
+// Amplitudes per message of a pairwise exchange, (so that one chunk is in flight while the last one is applied)
+#define QRACK_MPI_CHUNK_AMPS (1U << 20U)
+
+namespace Qrack {
+
+class QMPIPager;
+typedef std::shared_ptr<QMPIPager> QMPIPagerPtr;
+
+/**
+ * A "Qrack::QMPIPager" splits a single coherent register across the ranks of an MPI job, by its highest qubits, as
+ * QPager splits one across pages.
+ *
+ * Each rank holds one page of contiguous amplitudes, in a QEngineCPU or QEngineOCL, and the high "meta-" qubits
+ * select the rank. A gate acting only on the low qubits is applied to each rank's page, independently, and controls
+ * on meta-qubits just select which ranks take part. A phase gate on a meta-qubit scales whole pages. Any other gate on
+ * a meta-qubit pairs each rank with the one that differs in that qubit, and both ranks exchange their pages in chunks,
+ * applying each chunk as the next one is in flight. Operations with no efficient distributed form briefly gather the
+ * whole register on every rank.
+ *
+ * This is an SPMD interface: every rank must construct the same registers, and make the same calls on them, in the
+ * same order. (The random number generator is seeded identically on every rank, so measurement results agree.) The
+ * count of ranks must be a power of 2. Registers too small to give every rank "qubitThreshold" qubits are replicated
+ * on every rank, instead. MPI is initialized on first use, (and finalized at exit,) if the program hasn't done it.
+ */
+class QMPIPager : public QInterface {
+protected:
+    QInterfaceEngine engine;
+    int devID;
+    complex phaseFactor;
+    bool useHostRam;
+    bool isSparse;
+    uint32_t concurrency;
+    std::vector<int> deviceIDs;
+    bitLenInt minQubitsPerPage;
+    MPI_Comm comm;
+    int rank;
+    int rankCount;
+    bitLenInt rankPower;
+    bitLenInt metaQubits;
+    bitLenInt qubitsPerPage;
+    QEnginePtr qPage;
+
+    static MPI_Comm GetComm();
+
+    QEnginePtr MakeEngine(bitLenInt length, bitCapInt perm, bool doNorm = false);
+
+    bitCapIntOcl pagePower() { return pow2Ocl(qubitsPerPage); }
+    bitCapIntOcl pageCount() { return pow2Ocl(metaQubits); }
+    bitCapIntOcl pageIndex() { return (bitCapIntOcl)rank & (pageCount() - ONE_BCI); }
+
+    /// Choose how many of the high qubits select the rank, for the current qubit count
+    void SetLayout();
+    /// Sum a value over the pages, (counting replicated pages once)
+    real1 SumPages(real1 localValue);
+    /// Broadcast page "page" from the rank that holds it, in chunks, handing each chunk and its offset to "sink"
+    void BcastPage(bitCapIntOcl page, std::function<void(const complex*, bitCapIntOcl, bitCapIntOcl)> sink);
+    /// Trade whole pages with rank "partner"
+    void ExchangePages(int partner);
+    /// Apply "mtrx" to meta-qubit "metaTarget," by a chunked pairwise exchange, where local "controls" are satisfied
+    void ExchangeAndApply(bitLenInt metaTarget, const complex* mtrx, const std::vector<bitLenInt>& controls, bool isAnti);
+    void ScalePage(complex scale);
+    real1 PageNorm();
+
+    /// Gather the full register into one engine, on every rank
+    QEnginePtr CombineEngines();
+    /// Keep only this rank's page of a full register engine
+    void SeparateEngines(QEnginePtr combined);
+    /// Act on the full register as one engine, when an operation has no efficient distributed form
+    void CombineAndOp(std::function<void(QEnginePtr)> fn);
+
+    void ApplyDistributedControlled(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target,
+        const complex* mtrx, bool isAnti);
+    bool IsLocalRange(bitLenInt start, bitLenInt length) { return (start + length) <= qubitsPerPage; }
+
+public:
+    QMPIPager(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState = 0, qrack_rand_gen_ptr rgp = nullptr,
+        complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = false, bool randomGlobalPhase = true,
+        bool useHostMem = false, int deviceId = -1, bool useHardwareRNG = true, bool useSparseStateVec = false,
+        real1 norm_thresh = REAL1_EPSILON, std::vector<int> devList = {}, bitLenInt qubitThreshold = 0);
+
+    /** Get the count of qubits local to each rank */
+    bitLenInt GetQubitsPerPage() { return qubitsPerPage; }
+    /** Get the count of ranks the register is currently split across, (the rest holding replicas) */
+    bitCapIntOcl GetPageCount() { return pageCount(); }
+    int GetRank() { return rank; }
+    int GetRankCount() { return rankCount; }
+
+    /** Seed the random number generator of every rank with rank 0's "seed" */
+    virtual void SetRandomSeed(uint32_t seed);
+
+    virtual void SetConcurrency(uint32_t threadCount)
+    {
+        concurrency = threadCount;
+        qPage->SetConcurrency(concurrency);
+    }
+
+    virtual void SetQuantumState(const complex* inputState);
+    virtual void GetQuantumState(complex* outputState);
+    virtual void GetProbs(real1* outputProbs);
+    virtual complex GetAmplitude(bitCapInt perm);
+    virtual void SetAmplitude(bitCapInt perm, complex amp);
+    virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
+
+    using QInterface::Compose;
+    virtual bitLenInt Compose(QMPIPagerPtr toCopy);
+    virtual bitLenInt Compose(QInterfacePtr toCopy) { return Compose(std::dynamic_pointer_cast<QMPIPager>(toCopy)); }
+    virtual bitLenInt Compose(QMPIPagerPtr toCopy, bitLenInt start);
+    virtual bitLenInt Compose(QInterfacePtr toCopy, bitLenInt start)
+    {
+        return Compose(std::dynamic_pointer_cast<QMPIPager>(toCopy), start);
+    }
+    virtual void Decompose(bitLenInt start, QInterfacePtr dest)
+    {
+        Decompose(start, std::dynamic_pointer_cast<QMPIPager>(dest));
+    }
+    virtual void Decompose(bitLenInt start, QMPIPagerPtr dest);
+    virtual void Dispose(bitLenInt start, bitLenInt length);
+    virtual void Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm);
+
+    virtual void ApplySingleBit(const complex* mtrx, bitLenInt qubitIndex);
+    virtual void ApplyControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyAntiControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+        bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+        const bitCapInt& mtrxSkipValueMask);
+    virtual void UniformParityRZ(const bitCapInt& mask, const real1& angle);
+    virtual void CUniformParityRZ(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle);
+
+    virtual void CSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+
+    virtual bool ForceM(bitLenInt qubit, bool result, bool doForce = true, bool doApply = true);
+
+    virtual void INC(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void CINC(
+        bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen);
+    virtual void INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex);
+    virtual void INCSC(
+        bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECSC(
+        bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+
+    virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
+    virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
+    virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
+    virtual void PhaseFlip();
+
+    virtual bitCapInt IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, unsigned char* values, bool resetValue = true);
+    virtual bitCapInt IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual bitCapInt IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual void Hash(bitLenInt start, bitLenInt length, unsigned char* values);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
+
+    virtual void Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+
+    virtual real1 Prob(bitLenInt qubitIndex);
+    virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
+    virtual real1 ProbParity(const bitCapInt& mask);
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
+    virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true);
+
+    virtual bool ApproxCompare(QInterfacePtr toCompare);
+    virtual void UpdateRunningNorm(real1 norm_thresh = REAL1_DEFAULT_ARG);
+    virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG);
+
+    virtual void Finish() { qPage->Finish(); };
+
+    virtual bool isFinished() { return qPage->isFinished(); };
+
+    virtual QInterfacePtr Clone();
+
+    virtual void SetDevice(const int& dID, const bool& forceReInit = false)
+    {
+        devID = dID;
+        deviceIDs = { dID };
+        qPage->SetDevice(dID, forceReInit);
+    }
+
+    virtual int GetDeviceID() { return devID; }
+};
+} // namespace Qrack
@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <thread>
+
 #include "qinterface.hpp"
 
 namespace Qrack {
@@ -106,6 +108,30 @@ public:
         return prob;
     }
 
+    /** Predict for each of "count" permutations of the whole register, in "inputs," writing to "outputs"
+     *
+     * Each result is what Predict(expected) would return after "qReg->SetPermutation(inputs[i])," but "qReg" is left
+     * untouched. With the inputs in a permutation basis state, the uniformly controlled rotation acts as a single RY()
+     * by the angle of that permutation on the reset output bit, so every sample is independent and is evaluated in
+     * parallel. */
+    void PredictBatch(const bitCapInt* inputs, const bitCapIntOcl& count, real1* outputs, bool expected = true)
+    {
+        ParallelFor pf;
+        pf.SetConcurrencyLevel(std::thread::hardware_concurrency());
+        pf.par_for(0, count, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapInt input = inputs[(bitCapIntOcl)lcv];
+            bitCapIntOcl perm = 0;
+            for (bitLenInt i = 0; i < inputCount; i++) {
+                if (input & pow2(inputIndices[i])) {
+                    perm |= pow2Ocl(i);
+                }
+            }
+            // RY(angle) after RY(Pi/2), from |0>, leaves sin^2(Pi/4 + angle/2) probability of |1>.
+            const real1 prob = (ONE_R1 + (real1)sin(angles[perm])) / 2;
+            outputs[(bitCapIntOcl)lcv] = expected ? prob : (ONE_R1 - prob);
+        });
+    }
+
     /** "Uncompute" the Predict() method */
     real1 Unpredict(bool expected = true)
     {
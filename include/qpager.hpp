@@ -0,0 +1,247 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// QPager breaks a QEngine instance into pages of contiguous amplitudes.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <functional>
+
+#include "qengine.hpp"
+
+namespace Qrack {
+
+class QPager;
+typedef std::shared_ptr<QPager> QPagerPtr;
+
+/**
+ * A "Qrack::QPager" splits a "Qrack::QEngine" implementation into equal-length "pages." This helps both optimization
+ * and distribution of a single coherent quantum register across multiple devices, or across allocations smaller than
+ * the maximum single buffer size of one device.
+ *
+ * The low "qubitsPerPage" qubits are local to every page. A gate acting only on these is simply applied to each page,
+ * independently. A gate whose target is one of the high "meta-" qubits pairs up pages, swaps amplitudes between the
+ * halves of each pair with ShuffleBuffers(), and acts on the highest local qubit instead. Operations with no efficient
+ * paged form briefly combine all pages into a single engine.
+ */
+class QPager : public QInterface {
+protected:
+    QInterfaceEngine engine;
+    int devID;
+    complex phaseFactor;
+    bool useHostRam;
+    bool useRDRAND;
+    bool isSparse;
+    uint32_t concurrency;
+    std::vector<QEnginePtr> qPages;
+    std::vector<int> deviceIDs;
+    bitLenInt baseQubitsPerPage;
+    bitLenInt qubitsPerPage;
+
+    QEnginePtr MakeEngine(bitLenInt length, bitCapInt perm, int deviceId, bool doNorm = false);
+
+    bitCapIntOcl pagePower() { return pow2Ocl(qubitsPerPage); }
+    bitCapIntOcl pageCount() { return (bitCapIntOcl)qPages.size(); }
+
+    /// Copy a range of amplitudes between two pages, (staging through host memory if they live on different devices)
+    void CopyPage(QEnginePtr src, bitCapIntOcl srcOffset, QEnginePtr dest, bitCapIntOcl destOffset,
+        bitCapIntOcl length);
+    /// Swap the high half of one page with the low half of another
+    void ShufflePages(QEnginePtr low, QEnginePtr high);
+    /// Multiply every amplitude in a page by a (not necessarily unit modulus) scalar
+    void ScalePage(QEnginePtr page, complex scale);
+    real1 PageNorm(QEnginePtr page);
+
+    /// Merge all pages into a single engine spanning the full register
+    void CombineEngines();
+    /// Split a single combined engine back into pages of (at most) baseQubitsPerPage qubits
+    void SeparateEngines();
+    /// Act on the full register as one engine, when a gate has no efficient paged form
+    void CombineAndOp(std::function<void(QEnginePtr)> fn);
+
+    void ApplyPagedControlled(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target,
+        const complex* mtrx, bool isAnti);
+    bool IsLocalRange(bitLenInt start, bitLenInt length) { return (start + length) <= qubitsPerPage; }
+
+public:
+    QPager(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState = 0, qrack_rand_gen_ptr rgp = nullptr,
+        complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = false, bool randomGlobalPhase = true,
+        bool useHostMem = false, int deviceId = -1, bool useHardwareRNG = true, bool useSparseStateVec = false,
+        real1 norm_thresh = REAL1_EPSILON, std::vector<int> devList = {}, bitLenInt qubitThreshold = 0);
+
+    /** Get the count of qubits local to each page */
+    bitLenInt GetQubitsPerPage() { return qubitsPerPage; }
+    /** Get the count of pages the register is currently split into */
+    bitCapIntOcl GetPageCount() { return pageCount(); }
+
+    virtual void SetConcurrency(uint32_t threadCount)
+    {
+        concurrency = threadCount;
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            qPages[i]->SetConcurrency(concurrency);
+        }
+    }
+
+    virtual void SetQuantumState(const complex* inputState);
+    virtual void GetQuantumState(complex* outputState);
+    virtual QStateViewPtr LockStateView(bool isWritable = false)
+    {
+        // A single page is the whole state vector.
+        if (qPages.size() == 1U) {
+            return qPages[0]->LockStateView(isWritable);
+        }
+        return QInterface::LockStateView(isWritable);
+    }
+    virtual void WriteCheckpoint(QCheckpointWriter& writer);
+    virtual void ReadCheckpoint(QCheckpointReader& reader);
+    virtual void GetProbs(real1* outputProbs);
+    virtual complex GetAmplitude(bitCapInt perm);
+    virtual void SetAmplitude(bitCapInt perm, complex amp);
+    virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
+
+    using QInterface::Compose;
+    virtual bitLenInt Compose(QPagerPtr toCopy);
+    virtual bitLenInt Compose(QInterfacePtr toCopy) { return Compose(std::dynamic_pointer_cast<QPager>(toCopy)); }
+    virtual bitLenInt Compose(QPagerPtr toCopy, bitLenInt start);
+    virtual bitLenInt Compose(QInterfacePtr toCopy, bitLenInt start)
+    {
+        return Compose(std::dynamic_pointer_cast<QPager>(toCopy), start);
+    }
+    virtual void Decompose(bitLenInt start, QInterfacePtr dest)
+    {
+        Decompose(start, std::dynamic_pointer_cast<QPager>(dest));
+    }
+    virtual void Decompose(bitLenInt start, QPagerPtr dest);
+    virtual void Dispose(bitLenInt start, bitLenInt length);
+    virtual void Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm);
+
+    virtual void ApplySingleBit(const complex* mtrx, bitLenInt qubitIndex);
+    virtual void ApplySinglePhase(const complex topLeft, const complex bottomRight, bitLenInt qubitIndex);
+    virtual void ApplySingleInvert(const complex topRight, const complex bottomLeft, bitLenInt qubitIndex);
+    virtual void ApplyControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyAntiControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+        bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+        const bitCapInt& mtrxSkipValueMask);
+    virtual void UniformParityRZ(const bitCapInt& mask, const real1& angle);
+    virtual void CUniformParityRZ(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle);
+
+    virtual void CSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+
+    virtual bool ForceM(bitLenInt qubit, bool result, bool doForce = true, bool doApply = true);
+
+    virtual void INC(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void CINC(
+        bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen);
+    virtual void INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex);
+    virtual void INCSC(
+        bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECSC(
+        bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+
+    virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
+    virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
+    virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
+    virtual void PhaseFlip();
+
+    virtual bitCapInt IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, unsigned char* values, bool resetValue = true);
+    virtual bitCapInt IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual bitCapInt IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual void Hash(bitLenInt start, bitLenInt length, unsigned char* values);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
+
+    virtual void Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+
+    virtual real1 Prob(bitLenInt qubitIndex);
+    virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
+    virtual real1 ProbParity(const bitCapInt& mask);
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
+    virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true);
+
+    virtual bool ApproxCompare(QInterfacePtr toCompare);
+    virtual void UpdateRunningNorm(real1 norm_thresh = REAL1_DEFAULT_ARG);
+    virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG);
+
+    virtual void Finish()
+    {
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            qPages[i]->Finish();
+        }
+    };
+
+    virtual bool isFinished()
+    {
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            if (!qPages[i]->isFinished()) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    virtual QInterfacePtr Clone();
+
+    virtual void SetDevice(const int& dID, const bool& forceReInit = false)
+    {
+        devID = dID;
+        deviceIDs = { dID };
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            qPages[i]->SetDevice(dID, forceReInit);
+        }
+    }
+
+    virtual int GetDeviceID() { return devID; }
+};
+} // namespace Qrack
@@ -0,0 +1,200 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "qengine.hpp"
+
+// The parameter index of a uniformly controlled rotation's block that is left as identity
+#define QPARAM_IDENTITY ((bitCapIntOcl)-1)
+// Widest block, (in qubits,) that adjacent fixed gates are fused into when a circuit is compiled, (at most 4)
+#define QPARAM_FUSE_MAX_QB 3U
+// Gates ahead of each high-stride gate that are counted, to decide whether to remap its target to a low position
+#define QPARAM_REMAP_WINDOW 32U
+// Gates that a remapping swap, (and the swap back, at the end,) cost against the gates it moves to a low position
+#define QPARAM_REMAP_SWAP_COST 2U
+
+namespace Qrack {
+
+class QParamCircuit;
+typedef std::shared_ptr<QParamCircuit> QParamCircuitPtr;
+
+/**
+ * A recorded circuit of fixed gates and parameterized rotations, with gradients by the adjoint method.
+ *
+ * Gates are recorded, rather than applied, and refer to a shared list of real parameters. Gradient() runs the circuit
+ * forward once, on a QEngineCPU or QEngineOCL, and applies the observable to the final state. It then sweeps the
+ * circuit backward, undoing each gate on host copies of both states, (read back once, and updated in place,) and
+ * reads off the derivative with respect to every parameter of each rotation along the way. All gradients together
+ * cost one pass over the two states per gate, rather than a full run of the circuit per parameter, as finite
+ * differences or parameter shifts do.
+ *
+ * Rotations follow QInterface::RX(), RY(), and RZ(): a parameter "theta" rotates as e^(-i * theta / 2 * P) around
+ * Pauli axis P.
+ *
+ * For running one template many times, with different parameters, the recorded gates are optimized once, by
+ * Compile(), and the compiled circuit is replayed by Run(), or by Replay(), onto any QInterface, binding only the
+ * current parameter values.
+ */
+class QParamCircuit : public ParallelFor {
+public:
+    /// (PARAM_SWAP occurs only in compiled circuits, which remap qubits with it.)
+    enum ParamGateType { PARAM_FIXED = 0, PARAM_RX, PARAM_RY, PARAM_RZ, PARAM_SWAP };
+
+protected:
+    struct ParamGate {
+        ParamGateType type;
+        bitLenInt target;
+        std::vector<bitLenInt> controls;
+        // For a rotation, the parameter index of each control permutation's block, (or QPARAM_IDENTITY)
+        std::vector<bitCapIntOcl> params;
+        // For a fixed gate, the 2x2 matrix of each control permutation's block
+        std::vector<complex> mtrxs;
+    };
+
+    /// A gate of the compiled circuit, (see Compile())
+    struct CompiledGate {
+        ParamGateType type;
+        // A fused block acts densely on all of its targets, and has no controls.
+        std::vector<bitLenInt> targets;
+        std::vector<bitLenInt> controls;
+        // For a rotation, the parameters summed into the angle of each control permutation's block
+        std::vector<std::vector<bitCapIntOcl>> params;
+        // For a fixed gate, the 2x2 matrix of each control permutation's block, (or the dense matrix of a fused block)
+        std::vector<complex> mtrxs;
+    };
+
+    bitLenInt qubitCount;
+    QInterfaceEngine engineType;
+    std::vector<real1> parameters;
+    std::vector<ParamGate> gates;
+    std::vector<CompiledGate> compiled;
+    bool isCompiled;
+    qrack_rand_gen_ptr rand_generator;
+
+    void CheckQubits(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target);
+    void AddFixed(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    /// Write the block matrices of "gate," (or of its inverse,) at the current parameter values
+    void GetMatrices(const ParamGate& gate, const bool& isInverse, complex* mtrxs);
+    QEnginePtr MakeEngine(const bitCapInt& perm);
+    void Invalidate()
+    {
+        compiled.clear();
+        isCompiled = false;
+    }
+
+    static void RotationMatrix(const ParamGateType& axis, const real1& theta, complex* out);
+    static bool IsDiagonal(const CompiledGate& gate);
+    /// Whether "gate" acts diagonally on "qubit," (as a control, or as a diagonal gate's target)
+    static bool IsDiagonalOn(const CompiledGate& gate, const bitLenInt& qubit);
+    static bool IsCommuting(const CompiledGate& gate1, const CompiledGate& gate2);
+    /// Fold "gate" into "prior," if they act on the same qubits the same way, returning whether it did
+    static bool TryMerge(CompiledGate& prior, const CompiledGate& gate);
+    static bool IsIdentity(const CompiledGate& gate);
+    /// Multiply "gate" into the dense matrix of a fused block over "targets," from the left
+    static void FuseInto(const CompiledGate& gate, const std::vector<bitLenInt>& targets, std::vector<complex>& block);
+    /// Relabel "merged" from logical to physical qubits, swapping frequently used targets into the low "lowWidth"
+    std::vector<CompiledGate> Remap(const std::vector<CompiledGate>& merged, const bitLenInt& lowWidth);
+
+public:
+    QParamCircuit(bitLenInt n, QInterfaceEngine eng = QINTERFACE_CPU, qrack_rand_gen_ptr rgp = nullptr);
+
+    bitLenInt GetQubitCount() { return qubitCount; }
+    size_t GetGateCount() { return gates.size(); }
+    /// Gates in the compiled circuit, (compiling it first, if need be)
+    size_t GetCompiledGateCount()
+    {
+        if (!isCompiled) {
+            Compile();
+        }
+        return compiled.size();
+    }
+    bitCapIntOcl GetParameterCount() { return parameters.size(); }
+
+    /// Add a real parameter, with an initial value, and return its index
+    bitCapIntOcl AddParameter(const real1& value = ZERO_R1)
+    {
+        parameters.push_back(value);
+        return parameters.size() - 1U;
+    }
+    real1 GetParameter(const bitCapIntOcl& i) { return parameters[i]; }
+    void SetParameter(const bitCapIntOcl& i, const real1& value) { parameters[i] = value; }
+    void GetParameters(real1* values) { std::copy(parameters.begin(), parameters.end(), values); }
+    void SetParameters(const real1* values) { std::copy(values, values + parameters.size(), parameters.begin()); }
+
+    /// Record an arbitrary (fixed) single bit gate
+    void ApplySingleBit(const complex* mtrx, bitLenInt target) { AddFixed(NULL, 0, target, mtrx); }
+    /// Record an arbitrary (fixed) single bit gate, with arbitrary control bits
+    void ApplyControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+    {
+        AddFixed(controls, controlLen, target, mtrx);
+    }
+    void H(bitLenInt target);
+    void X(bitLenInt target);
+    void Y(bitLenInt target);
+    void Z(bitLenInt target);
+    void CNOT(bitLenInt control, bitLenInt target);
+    void CZ(bitLenInt control, bitLenInt target);
+
+    /**
+     * Record a rotation around "axis," with a parameter for each permutation of the control bits, from "params," which
+     * has 2^controlLen entries. (An entry of QPARAM_IDENTITY leaves its block as identity.)
+     */
+    void UniformlyControlledRotation(const ParamGateType& axis, const bitLenInt* controls, const bitLenInt& controlLen,
+        const bitLenInt& target, const bitCapIntOcl* params);
+    void UniformlyControlledRY(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const bitCapIntOcl* params)
+    {
+        UniformlyControlledRotation(PARAM_RY, controls, controlLen, target, params);
+    }
+    void RX(bitCapIntOcl param, bitLenInt target) { UniformlyControlledRotation(PARAM_RX, NULL, 0, target, &param); }
+    void RY(bitCapIntOcl param, bitLenInt target) { UniformlyControlledRotation(PARAM_RY, NULL, 0, target, &param); }
+    void RZ(bitCapIntOcl param, bitLenInt target) { UniformlyControlledRotation(PARAM_RZ, NULL, 0, target, &param); }
+    /// Record a rotation around Pauli Y, acted only if all control bits are true
+    void CRY(const bitLenInt* controls, const bitLenInt& controlLen, bitCapIntOcl param, bitLenInt target);
+
+    /**
+     * Optimize the recorded gates, once, for repeated runs.
+     *
+     * Each gate is moved back past the gates it commutes with, (which include any two gates that are both diagonal on
+     * every qubit they share,) to fold into an earlier gate on the same target and controls. Fixed gates are
+     * multiplied together, and dropped if they cancel to identity, and rotations around the same axis sum their
+     * parameters. Runs of fixed gates that overlap on at most "fuseWidth" qubits are then fused into single dense
+     * blocks, for QInterface::ApplyNxN(). (A "fuseWidth" of 1 fuses nothing, which suits QUnit better, since a block
+     * entangles all of its qubits.)
+     *
+     * If "lowWidth" is nonzero, qubits are also remapped, so that the targets of non-diagonal gates sit in the lowest
+     * "lowWidth" positions of the state vector, where the amplitudes they pair are close together, (and where
+     * QEngineCPU and QEngineOCL can apply batches of single bit gates tile by tile). Before each gate on a higher
+     * position, the gates in the next QPARAM_REMAP_WINDOW are counted per qubit, and its target is swapped with the
+     * least used qubit in a low position, if it is used more often by over QPARAM_REMAP_SWAP_COST gates. The compiled
+     * circuit swaps every qubit back to its logical position at the end. (A good "lowWidth" is the engine's tile
+     * width, like QEngineCPU::GetTileQubits().)
+     *
+     * Recording another gate discards the compiled circuit, and the next run compiles again, at the default widths.
+     */
+    void Compile(bitLenInt fuseWidth = QPARAM_FUSE_MAX_QB, bitLenInt lowWidth = 0);
+    /// Apply the compiled circuit to "qReg," at the current parameter values
+    void Replay(QInterfacePtr qReg);
+    /// Run the compiled circuit from permutation "perm," at the current parameter values, and return the final state
+    QInterfacePtr Run(const bitCapInt& perm = 0);
+
+    /**
+     * Run the circuit from permutation "perm," and return the expectation value of "observable" in the final state,
+     * writing its gradient with respect to every parameter to "gradients"
+     */
+    real1 Gradient(const std::vector<PauliTerm>& observable, real1* gradients, const bitCapInt& perm = 0);
+};
+} // namespace Qrack
@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "qstabilizer.hpp"
+
+namespace Qrack {
+
+class QPauliFrameSampler;
+typedef std::shared_ptr<QPauliFrameSampler> QPauliFrameSamplerPtr;
+
+/**
+ * A many-shot sampler for Clifford circuits with Pauli noise.
+ *
+ * Gates, measurements, and noise channels are recorded, rather than applied. On the first call to Sample(), one
+ * noiseless reference shot of the circuit is run on a QStabilizer. Every other shot is then represented only by its
+ * Pauli "frame," (the difference between that shot and the reference,) and frames are propagated through the circuit
+ * 64 shots at a time, one bit per shot, in a 64-bit word per qubit. A Clifford gate costs a few word operations per 64
+ * shots, regardless of qubit count.
+ */
+class QPauliFrameSampler : public ParallelFor {
+public:
+    enum FrameOpType {
+        FRAME_H = 0,
+        FRAME_S,
+        FRAME_IS,
+        FRAME_X,
+        FRAME_Y,
+        FRAME_Z,
+        FRAME_CNOT,
+        FRAME_CZ,
+        FRAME_M,
+        FRAME_RESET,
+        FRAME_X_ERROR,
+        FRAME_Y_ERROR,
+        FRAME_Z_ERROR,
+        FRAME_DEPOLARIZE
+    };
+
+protected:
+    struct FrameOp {
+        FrameOpType type;
+        bitLenInt q1;
+        bitLenInt q2;
+        real1 prob;
+    };
+
+    bitLenInt qubitCount;
+    bitCapInt initPerm;
+    std::vector<FrameOp> ops;
+    bitCapIntOcl measurementCount;
+
+    bool isReferenceValid;
+    // One bit per measurement, of the noiseless reference shot
+    std::vector<bool> reference;
+
+    qrack_rand_gen_ptr rand_generator;
+
+    void AddOp(const FrameOpType& type, const bitLenInt& q1, const bitLenInt& q2 = 0, const real1& prob = ZERO_R1);
+    void RunReference();
+    /// Propagate one batch of (up to) 64 shots, writing bit "shot" of measurement m to record[m * stride + word]
+    void RunFrames(qrack_rand_gen& gen, uint64_t* record, const bitCapIntOcl& stride, const bitCapIntOcl& word,
+        const uint64_t& shotMask);
+
+public:
+    QPauliFrameSampler(const bitLenInt& n, const bitCapInt& perm = 0, qrack_rand_gen_ptr rgp = nullptr);
+
+    bitLenInt GetQubitCount() { return qubitCount; }
+    /// Get the count of measurements recorded so far, (which is the count of bits per shot in the sample record)
+    bitCapIntOcl GetMeasurementCount() { return measurementCount; }
+
+    void SetRandomSeed(uint32_t seed) { rand_generator->seed(seed); }
+
+    /// Apply a CNOT gate with control and target
+    void CNOT(const bitLenInt& control, const bitLenInt& target) { AddOp(FRAME_CNOT, control, target); }
+    /// Apply a Hadamard gate to target
+    void H(const bitLenInt& target) { AddOp(FRAME_H, target); }
+    /// Apply a phase gate (|0>->|0>, |1>->i|1>, or "S") to qubit b
+    void S(const bitLenInt& target) { AddOp(FRAME_S, target); }
+    /// Apply an inverse phase gate to qubit b
+    void IS(const bitLenInt& target) { AddOp(FRAME_IS, target); }
+    void X(const bitLenInt& target) { AddOp(FRAME_X, target); }
+    void Y(const bitLenInt& target) { AddOp(FRAME_Y, target); }
+    void Z(const bitLenInt& target) { AddOp(FRAME_Z, target); }
+    void CZ(const bitLenInt& control, const bitLenInt& target) { AddOp(FRAME_CZ, control, target); }
+    void Swap(const bitLenInt& qubit1, const bitLenInt& qubit2)
+    {
+        if (qubit1 == qubit2) {
+            return;
+        }
+
+        CNOT(qubit1, qubit2);
+        CNOT(qubit2, qubit1);
+        CNOT(qubit1, qubit2);
+    }
+
+    /// Measure the target qubit in the Z basis, appending one bit to every shot's record, and return its index
+    bitCapIntOcl M(const bitLenInt& target);
+    /// Measure and discard the target qubit, leaving it in |0>
+    void Reset(const bitLenInt& target) { AddOp(FRAME_RESET, target); }
+
+    /// In each shot, independently with probability "prob," apply an X to the target
+    void XError(const bitLenInt& target, const real1& prob) { AddOp(FRAME_X_ERROR, target, 0, prob); }
+    /// In each shot, independently with probability "prob," apply a Y to the target
+    void YError(const bitLenInt& target, const real1& prob) { AddOp(FRAME_Y_ERROR, target, 0, prob); }
+    /// In each shot, independently with probability "prob," apply a Z to the target
+    void ZError(const bitLenInt& target, const real1& prob) { AddOp(FRAME_Z_ERROR, target, 0, prob); }
+    /// In each shot, independently with probability "prob," apply one of X, Y, or Z to the target, uniformly
+    void Depolarize(const bitLenInt& target, const real1& prob) { AddOp(FRAME_DEPOLARIZE, target, 0, prob); }
+
+    /**
+     * Sample "shots" runs of the circuit recorded so far.
+     *
+     * The record is packed measurement-major: with W = (shots + 63) / 64 words per measurement, bit (s % 64) of
+     * record[m * W + s / 64] is the result of measurement m in shot s. Padding bits of the last word are 0.
+     */
+    std::vector<uint64_t> Sample(const bitCapIntOcl& shots);
+};
+} // namespace Qrack
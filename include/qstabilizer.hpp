@@ -1,281 +1,331 @@
-//////////////////////////////////////////////////////////////////////////////////////
-//
-// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
-//
-// Adapted from:
-//
-// CHP: CNOT-Hadamard-Phase
-// Stabilizer Quantum Computer Simulator
-// by Scott Aaronson
-// Last modified June 30, 2004
-//
-// Thanks to Simon Anders and Andrew Cross for bugfixes
-//
-// https://www.scottaaronson.com/chp/
-//
-// Daniel Strano and the Qrack contributers appreciate Scott Aaronson's open sharing of the CHP code, and we hope that
-// vm6502q/qrack is one satisfactory framework by which CHP could be adapted to enter the C++ STL. Our project
-// philosophy aims to raise the floor of decentralized quantum computing technology access across all modern platforms,
-// for all people, not commercialization.
-//
-// Licensed under the GNU Lesser General Public License V3.
-// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
-// for details.
-
-#pragma once
-
-#include <cstdint>
-
-#include "common/qrack_types.hpp"
-#include "common/rdrandwrapper.hpp"
-
-#if ENABLE_QUNIT_CPU_PARALLEL
-#include "common/dispatchqueue.hpp"
-#endif
-
-namespace Qrack {
-
-class QStabilizer;
-typedef std::shared_ptr<QStabilizer> QStabilizerPtr;
-
-class QStabilizer {
-protected:
-    // # of qubits
-    bitLenInt qubitCount;
-    // (2n+1)*n matrix for stabilizer/destabilizer x bits (there's one "scratch row" at the bottom)
-    std::vector<std::vector<bool>> x;
-    // (2n+1)*n matrix for z bits
-    std::vector<std::vector<bool>> z;
-    // Phase bits: 0 for +1, 1 for i, 2 for -1, 3 for -i.  Normally either 0 or 2.
-    std::vector<uint8_t> r;
-
-    uint32_t randomSeed;
-    qrack_rand_gen_ptr rand_generator;
-    std::uniform_real_distribution<real1> rand_distribution;
-    std::shared_ptr<RdRandom> hardware_rand_generator;
-
-#if ENABLE_QUNIT_CPU_PARALLEL
-    DispatchQueue dispatchQueue;
-#endif
-
-    typedef std::function<void(void)> DispatchFn;
-    void Dispatch(DispatchFn fn)
-    {
-#if ENABLE_QUNIT_CPU_PARALLEL
-        dispatchQueue.dispatch(fn);
-#else
-        fn();
-#endif
-    }
-
-    void Dump()
-    {
-#if ENABLE_QUNIT_CPU_PARALLEL
-        dispatchQueue.dump();
-#endif
-    }
-
-    bitCapIntOcl pow2Ocl(const bitLenInt& qubit) { return ONE_BCI << (bitCapIntOcl)qubit; }
-
-public:
-    QStabilizer(
-        const bitLenInt& n, const bitCapInt& perm = 0, bool useHardwareRNG = true, qrack_rand_gen_ptr rgp = nullptr);
-
-    QStabilizer(QStabilizer& s)
-    {
-        s.Finish();
-
-        qubitCount = s.qubitCount;
-        x = s.x;
-        z = s.z;
-        r = s.r;
-        randomSeed = s.randomSeed;
-        rand_generator = s.rand_generator;
-        rand_distribution = s.rand_distribution;
-        hardware_rand_generator = s.hardware_rand_generator;
-    }
-
-    virtual ~QStabilizer() { Dump(); }
-
-    void Finish()
-    {
-#if ENABLE_QUNIT_CPU_PARALLEL
-        dispatchQueue.finish();
-#endif
-    }
-
-    bool isFinished()
-    {
-#if ENABLE_QUNIT_CPU_PARALLEL
-        return dispatchQueue.isFinished();
-#else
-        return true;
-#endif
-    }
-
-    bitLenInt GetQubitCount() { return qubitCount; }
-
-    bitCapIntOcl GetMaxQPower() { return pow2Ocl(qubitCount); }
-
-    void SetPermutation(const bitCapInt& perm);
-
-    void SetRandomSeed(uint32_t seed)
-    {
-        if (rand_generator != NULL) {
-            rand_generator->seed(seed);
-        }
-    }
-
-    bool Rand()
-    {
-        if (hardware_rand_generator != NULL) {
-            return hardware_rand_generator->Next() < (ONE_R1 / 2U);
-        } else {
-            return rand_distribution(*rand_generator) < (ONE_R1 / 2U);
-        }
-    }
-
-protected:
-    /// Sets row i equal to row k
-    void rowcopy(const bitLenInt& i, const bitLenInt& k);
-    /// Swaps row i and row k
-    void rowswap(const bitLenInt& i, const bitLenInt& k);
-    /// Sets row i equal to the bth observable (X_1,...X_n,Z_1,...,Z_n)
-    void rowset(const bitLenInt& i, bitLenInt b);
-    /// Return the phase (0,1,2,3) when row i is LEFT-multiplied by row k
-    uint8_t clifford(const bitLenInt& i, const bitLenInt& k);
-    /// Left-multiply row i by row k
-    void rowmult(const bitLenInt& i, const bitLenInt& k);
-
-    /**
-     * Do Gaussian elimination to put the stabilizer generators in the following form:
-     * At the top, a minimal set of generators containing X's and Y's, in "quasi-upper-triangular" form.
-     * (Return value = number of such generators = log_2 of number of nonzero basis states)
-     * At the bottom, generators containing Z's only in quasi-upper-triangular form.
-     */
-    bitLenInt gaussian();
-
-    /**
-     * Finds a Pauli operator P such that the basis state P|0...0> occurs with nonzero amplitude in q, and
-     * writes P to the scratch space of q.  For this to work, Gaussian elimination must already have been
-     * performed on q.  g is the return value from gaussian(q).
-     */
-    void seed(const bitLenInt& g);
-
-    /// Returns the result of applying the Pauli operator in the "scratch space" of q to |0...0>
-    void setBasisState(const real1& nrm, complex* stateVec);
-
-    void DecomposeDispose(const bitLenInt start, const bitLenInt length, QStabilizerPtr toCopy);
-
-public:
-    /// Apply a CNOT gate with control and target
-    void CNOT(const bitLenInt& control, const bitLenInt& target);
-    /// Apply a Hadamard gate to target
-    void H(const bitLenInt& target);
-    /// Apply a phase gate (|0>->|0>, |1>->i|1>, or "S") to qubit b
-    void S(const bitLenInt& target);
-
-    // TODO: Custom implementations for decompositions:
-    virtual void Z(const bitLenInt& target)
-    {
-        S(target);
-        S(target);
-    }
-
-    virtual void IS(const bitLenInt& target)
-    {
-        Z(target);
-        S(target);
-    }
-
-    virtual void X(const bitLenInt& target)
-    {
-        H(target);
-        Z(target);
-        H(target);
-    }
-
-    virtual void Y(const bitLenInt& target)
-    {
-        IS(target);
-        X(target);
-        S(target);
-    }
-
-    virtual void CZ(const bitLenInt& control, const bitLenInt& target)
-    {
-        H(target);
-        CNOT(control, target);
-        H(target);
-    }
-
-    virtual void Swap(const bitLenInt& qubit1, const bitLenInt& qubit2)
-    {
-        if (qubit1 == qubit2) {
-            return;
-        }
-
-        CNOT(qubit1, qubit2);
-        CNOT(qubit2, qubit1);
-        CNOT(qubit1, qubit2);
-    }
-
-    virtual void ISwap(const bitLenInt& qubit1, const bitLenInt& qubit2)
-    {
-        if (qubit1 == qubit2) {
-            return;
-        }
-
-        S(qubit1);
-        S(qubit2);
-        H(qubit1);
-        CNOT(qubit1, qubit2);
-        CNOT(qubit2, qubit1);
-        H(qubit2);
-    }
-
-    /**
-     * Measure qubit b
-     */
-    bool M(const bitLenInt& t, bool result = false, const bool& doForce = false, const bool& doApply = true);
-
-    /// Convert the state to ket notation
-    void GetQuantumState(complex* stateVec);
-
-    /**
-     * Returns "true" if target qubit is a Z basis eigenstate
-     */
-    bool IsSeparableZ(const bitLenInt& target);
-    /**
-     * Returns "true" if target qubit is an X basis eigenstate
-     */
-    bool IsSeparableX(const bitLenInt& target);
-    /**
-     * Returns "true" if target qubit is a Y basis eigenstate
-     */
-    bool IsSeparableY(const bitLenInt& target);
-    /**
-     * Returns:
-     * 0 if target qubit is not separable
-     * 1 if target qubit is a Z basis eigenstate
-     * 2 if target qubit is an X basis eigenstate
-     * 3 if target qubit is a Y basis eigenstate
-     */
-    uint8_t IsSeparable(const bitLenInt& target);
-
-    bitLenInt Compose(QStabilizerPtr toCopy) { return Compose(toCopy, qubitCount); }
-    bitLenInt Compose(QStabilizerPtr toCopy, const bitLenInt start);
-    void Decompose(const bitLenInt& start, QStabilizerPtr destination)
-    {
-        DecomposeDispose(start, destination->qubitCount, destination);
-    }
-
-    void Dispose(const bitLenInt& start, const bitLenInt& length)
-    {
-        DecomposeDispose(start, length, (QStabilizerPtr)NULL);
-    }
-    bool CanDecomposeDispose(const bitLenInt start, const bitLenInt length);
-
-    bool ApproxCompare(QStabilizerPtr o);
-};
-} // namespace Qrack
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// Adapted from:
+//
+// CHP: CNOT-Hadamard-Phase
+// Stabilizer Quantum Computer Simulator
+// by Scott Aaronson
+// Last modified June 30, 2004
+//
+// Thanks to Simon Anders and Andrew Cross for bugfixes
+//
+// https://www.scottaaronson.com/chp/
+//
+// Daniel Strano and the Qrack contributers appreciate Scott Aaronson's open sharing of the CHP code, and we hope that
+// vm6502q/qrack is one satisfactory framework by which CHP could be adapted to enter the C++ STL. Our project
+// philosophy aims to raise the floor of decentralized quantum computing technology access across all modern platforms,
+// for all people, not commercialization.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <cstdint>
+
+#include "common/checkpoint.hpp"
+#include "common/parallel_for.hpp"
+#include "common/qrack_types.hpp"
+#include "common/rdrandwrapper.hpp"
+
+#if ENABLE_QUNIT_CPU_PARALLEL
+#include "common/dispatchqueue.hpp"
+#endif
+
+namespace Qrack {
+
+class QStabilizer;
+typedef std::shared_ptr<QStabilizer> QStabilizerPtr;
+
+class QStabilizer : public ParallelFor {
+protected:
+    // # of qubits
+    bitLenInt qubitCount;
+    // 64-bit words per tableau row, (the padding bits past the last qubit are always 0)
+    bitCapIntOcl wordCount;
+    // (2n+1)*n matrix for stabilizer/destabilizer x bits (there's one "scratch row" at the bottom), packed row-major,
+    // 64 columns to a word, so that row operations are word-wide
+    std::vector<uint64_t> x;
+    // (2n+1)*n matrix for z bits, packed like "x"
+    std::vector<uint64_t> z;
+    // Phase bits: 0 for +1, 1 for i, 2 for -1, 3 for -i.  Normally either 0 or 2.
+    std::vector<uint8_t> r;
+
+    uint32_t randomSeed;
+    qrack_rand_gen_ptr rand_generator;
+    std::uniform_real_distribution<real1> rand_distribution;
+    std::shared_ptr<RdRandom> hardware_rand_generator;
+
+#if ENABLE_QUNIT_CPU_PARALLEL
+    DispatchQueue dispatchQueue;
+#endif
+
+    template <typename Fn> void Dispatch(Fn&& fn)
+    {
+#if ENABLE_QUNIT_CPU_PARALLEL
+        dispatchQueue.dispatch(std::forward<Fn>(fn));
+#else
+        fn();
+#endif
+    }
+
+    void Dump()
+    {
+#if ENABLE_QUNIT_CPU_PARALLEL
+        dispatchQueue.dump();
+#endif
+    }
+
+    bitCapIntOcl pow2Ocl(const bitLenInt& qubit) { return ONE_BCI << (bitCapIntOcl)qubit; }
+
+    static bitCapIntOcl WordsPerRow(const bitLenInt& n) { return ((bitCapIntOcl)n + 63U) >> 6U; }
+    static uint64_t BitMask(const bitLenInt& j) { return 1ULL << (j & 63U); }
+
+    uint64_t* xRow(const bitCapIntOcl& i) { return x.data() + i * wordCount; }
+    uint64_t* zRow(const bitCapIntOcl& i) { return z.data() + i * wordCount; }
+    bool getX(const bitCapIntOcl& i, const bitLenInt& j) { return x[i * wordCount + (j >> 6U)] & BitMask(j); }
+    bool getZ(const bitCapIntOcl& i, const bitLenInt& j) { return z[i * wordCount + (j >> 6U)] & BitMask(j); }
+    void flipX(const bitCapIntOcl& i, const bitLenInt& j) { x[i * wordCount + (j >> 6U)] ^= BitMask(j); }
+    void flipZ(const bitCapIntOcl& i, const bitLenInt& j) { z[i * wordCount + (j >> 6U)] ^= BitMask(j); }
+
+    static int PopCount(uint64_t w)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(w);
+#else
+        w = w - ((w >> 1U) & 0x5555555555555555ULL);
+        w = (w & 0x3333333333333333ULL) + ((w >> 2U) & 0x3333333333333333ULL);
+        w = (w + (w >> 4U)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (int)((w * 0x0101010101010101ULL) >> 56U);
+#endif
+    }
+
+    /// Return the phase (0,1,2,3) when the Pauli row (xi, zi, ri) is LEFT-multiplied by the row (xk, zk, rk)
+    static uint8_t CliffordPhase(const uint64_t* xi, const uint64_t* zi, const uint8_t& ri, const uint64_t* xk,
+        const uint64_t* zk, const uint8_t& rk, const bitCapIntOcl& words);
+    /// Left-multiply the Pauli row (xi, zi, ri) by the row (xk, zk, rk)
+    static void MultiplyRow(uint64_t* xi, uint64_t* zi, uint8_t& ri, const uint64_t* xk, const uint64_t* zk,
+        const uint8_t& rk, const bitCapIntOcl& words);
+
+    /// Copy "length" bits, starting at bit "srcStart" of row "src," to bit "dstStart" of row "dst"
+    static void CopyBits(const uint64_t* src, const bitLenInt& srcStart, uint64_t* dst, const bitLenInt& dstStart,
+        const bitLenInt& length);
+
+public:
+    QStabilizer(
+        const bitLenInt& n, const bitCapInt& perm = 0, bool useHardwareRNG = true, qrack_rand_gen_ptr rgp = nullptr);
+
+    QStabilizer(QStabilizer& s)
+    {
+        s.Finish();
+
+        qubitCount = s.qubitCount;
+        wordCount = s.wordCount;
+        x = s.x;
+        z = s.z;
+        r = s.r;
+        randomSeed = s.randomSeed;
+        rand_generator = s.rand_generator;
+        rand_distribution = s.rand_distribution;
+        hardware_rand_generator = s.hardware_rand_generator;
+        SetConcurrencyLevel(s.GetConcurrencyLevel());
+    }
+
+    virtual ~QStabilizer() { Dump(); }
+
+    void Finish()
+    {
+#if ENABLE_QUNIT_CPU_PARALLEL
+        dispatchQueue.finish();
+#endif
+    }
+
+    bool isFinished()
+    {
+#if ENABLE_QUNIT_CPU_PARALLEL
+        return dispatchQueue.isFinished();
+#else
+        return true;
+#endif
+    }
+
+    bitLenInt GetQubitCount() { return qubitCount; }
+
+    bitCapIntOcl GetMaxQPower() { return pow2Ocl(qubitCount); }
+
+    void SetPermutation(const bitCapInt& perm);
+
+    /// Write the tableau to a checkpoint, (see QInterface::SaveCheckpoint())
+    void WriteCheckpoint(QCheckpointWriter& writer);
+    /// Replace the tableau with one read from a checkpoint
+    void ReadCheckpoint(QCheckpointReader& reader);
+
+    void SetRandomSeed(uint32_t seed)
+    {
+        if (rand_generator != NULL) {
+            rand_generator->seed(seed);
+        }
+    }
+
+    bool Rand()
+    {
+        if (hardware_rand_generator != NULL) {
+            return hardware_rand_generator->Next() < (ONE_R1 / 2U);
+        } else {
+            return rand_distribution(*rand_generator) < (ONE_R1 / 2U);
+        }
+    }
+
+protected:
+    /// Sets row i equal to row k
+    void rowcopy(const bitLenInt& i, const bitLenInt& k);
+    /// Swaps row i and row k
+    void rowswap(const bitLenInt& i, const bitLenInt& k);
+    /// Sets row i equal to the bth observable (X_1,...X_n,Z_1,...,Z_n)
+    void rowset(const bitLenInt& i, bitLenInt b);
+    /// Return the phase (0,1,2,3) when row i is LEFT-multiplied by row k
+    uint8_t clifford(const bitLenInt& i, const bitLenInt& k);
+    /// Left-multiply row i by row k
+    void rowmult(const bitLenInt& i, const bitLenInt& k);
+    /// Left-multiply row i by every row in "ks," (which must all commute with each other, so that order is irrelevant)
+    void rowmultAll(const bitLenInt& i, const std::vector<bitLenInt>& ks);
+
+    /// Gaussian elimination step: clear column j, (of z if "isZ," or else of x,) from the stabilizer rows below row i
+    void eliminate(const bitLenInt& i, const bitLenInt& j, const bool& isZ);
+
+    /**
+     * Do Gaussian elimination to put the stabilizer generators in the following form:
+     * At the top, a minimal set of generators containing X's and Y's, in "quasi-upper-triangular" form.
+     * (Return value = number of such generators = log_2 of number of nonzero basis states)
+     * At the bottom, generators containing Z's only in quasi-upper-triangular form.
+     */
+    bitLenInt gaussian();
+
+    /**
+     * Finds a Pauli operator P such that the basis state P|0...0> occurs with nonzero amplitude in q, and
+     * writes P to the scratch space of q.  For this to work, Gaussian elimination must already have been
+     * performed on q.  g is the return value from gaussian(q).
+     */
+    void seed(const bitLenInt& g);
+
+    /// Writes the result of applying the Pauli operator (xs, zs, rs) to |0...0>, times "nrm," to the state vector
+    void setBasisState(
+        const real1& nrm, complex* stateVec, const uint64_t* xs, const uint64_t* zs, const uint8_t& rs);
+
+    void DecomposeDispose(const bitLenInt start, const bitLenInt length, QStabilizerPtr toCopy);
+
+public:
+    /// Apply a CNOT gate with control and target
+    void CNOT(const bitLenInt& control, const bitLenInt& target);
+    /// Apply a Hadamard gate to target
+    void H(const bitLenInt& target);
+    /// Apply a phase gate (|0>->|0>, |1>->i|1>, or "S") to qubit b
+    void S(const bitLenInt& target);
+
+    // TODO: Custom implementations for decompositions:
+    virtual void Z(const bitLenInt& target)
+    {
+        S(target);
+        S(target);
+    }
+
+    virtual void IS(const bitLenInt& target)
+    {
+        Z(target);
+        S(target);
+    }
+
+    virtual void X(const bitLenInt& target)
+    {
+        H(target);
+        Z(target);
+        H(target);
+    }
+
+    virtual void Y(const bitLenInt& target)
+    {
+        IS(target);
+        X(target);
+        S(target);
+    }
+
+    virtual void CZ(const bitLenInt& control, const bitLenInt& target)
+    {
+        H(target);
+        CNOT(control, target);
+        H(target);
+    }
+
+    virtual void Swap(const bitLenInt& qubit1, const bitLenInt& qubit2)
+    {
+        if (qubit1 == qubit2) {
+            return;
+        }
+
+        CNOT(qubit1, qubit2);
+        CNOT(qubit2, qubit1);
+        CNOT(qubit1, qubit2);
+    }
+
+    virtual void ISwap(const bitLenInt& qubit1, const bitLenInt& qubit2)
+    {
+        if (qubit1 == qubit2) {
+            return;
+        }
+
+        S(qubit1);
+        S(qubit2);
+        H(qubit1);
+        CNOT(qubit1, qubit2);
+        CNOT(qubit2, qubit1);
+        H(qubit2);
+    }
+
+    /**
+     * Measure qubit b
+     */
+    bool M(const bitLenInt& t, bool result = false, const bool& doForce = false, const bool& doApply = true);
+
+    /// Convert the state to ket notation
+    void GetQuantumState(complex* stateVec);
+
+    /**
+     * Returns "true" if target qubit is a Z basis eigenstate
+     */
+    bool IsSeparableZ(const bitLenInt& target);
+    /**
+     * Returns "true" if target qubit is an X basis eigenstate
+     */
+    bool IsSeparableX(const bitLenInt& target);
+    /**
+     * Returns "true" if target qubit is a Y basis eigenstate
+     */
+    bool IsSeparableY(const bitLenInt& target);
+    /**
+     * Returns:
+     * 0 if target qubit is not separable
+     * 1 if target qubit is a Z basis eigenstate
+     * 2 if target qubit is an X basis eigenstate
+     * 3 if target qubit is a Y basis eigenstate
+     */
+    uint8_t IsSeparable(const bitLenInt& target);
+
+    bitLenInt Compose(QStabilizerPtr toCopy) { return Compose(toCopy, qubitCount); }
+    bitLenInt Compose(QStabilizerPtr toCopy, const bitLenInt start);
+    void Decompose(const bitLenInt& start, QStabilizerPtr destination)
+    {
+        DecomposeDispose(start, destination->qubitCount, destination);
+    }
+
+    void Dispose(const bitLenInt& start, const bitLenInt& length)
+    {
+        DecomposeDispose(start, length, (QStabilizerPtr)NULL);
+    }
+    bool CanDecomposeDispose(const bitLenInt start, const bitLenInt length);
+
+    bool ApproxCompare(QStabilizerPtr o);
+};
+} // namespace Qrack
@@ -41,9 +41,37 @@ protected:
     bool isSparse;
     uint32_t concurrency;
     bitLenInt thresholdQubits;
+    // Non-Clifford diagonal phase gates, not yet applied: qubit i carries diag(1, phaseBuffer[i]) after the tableau.
+    std::vector<complex> phaseBuffer;
 
     QStabilizerPtr MakeStabilizer(const bitCapInt& perm = 0);
     QInterfacePtr MakeEngine(const bitCapInt& perm = 0);
+    /// Pass the single qubit Clifford eigenstates that the tableau can see on to a new QUnit engine
+    void SetQUnitSeparability();
+
+    bool IsBuffered(const bitLenInt& target)
+    {
+        return stabilizer && (norm(phaseBuffer[target] - ONE_CMPLX) > amplitudeFloor);
+    }
+    void ClearBuffers() { std::fill(phaseBuffer.begin(), phaseBuffer.end(), ONE_CMPLX); }
+    /**
+     * Resolve the buffered phase on "target," before a gate that doesn't commute with it. If the qubit is in a Z
+     * eigenstate, the phase is global and is dropped; otherwise, the whole register is switched to the engine.
+     */
+    void FlushBuffer(const bitLenInt& target);
+    void FlushBuffers()
+    {
+        for (bitLenInt i = 0; i < qubitCount; i++) {
+            FlushBuffer(i);
+        }
+    }
+    /// A bit flip (or any anti-diagonal gate) on "target" passes through diag(1, p) as diag(p, 1), or diag(1, 1/p)
+    void InvertBuffer(const bitLenInt& target)
+    {
+        if (IsBuffered(target)) {
+            phaseBuffer[target] = conj(phaseBuffer[target]);
+        }
+    }
 
 public:
     QStabilizerHybrid(QInterfaceEngine eng, QInterfaceEngine subEng, bitLenInt qBitCount, bitCapInt initState = 0,
@@ -76,8 +104,11 @@ public:
     virtual void SetConcurrency(uint32_t threadCount)
     {
         concurrency = threadCount;
+        if (stabilizer) {
+            stabilizer->SetConcurrencyLevel(concurrency);
+        }
         if (engine) {
-            SetConcurrency(concurrency);
+            engine->SetConcurrency(concurrency);
         }
     }
 
@@ -93,6 +124,7 @@ public:
     /// Apply a CNOT gate with control and target
     virtual void CNOT(bitLenInt control, bitLenInt target)
     {
+        FlushBuffer(target);
         if (stabilizer) {
             stabilizer->CNOT(control, target);
         } else {
@@ -105,6 +137,7 @@ public:
     /// Apply a Hadamard gate to target
     virtual void H(bitLenInt target)
     {
+        FlushBuffer(target);
         if (stabilizer) {
             stabilizer->H(target);
         } else {
@@ -150,6 +183,7 @@ public:
     virtual void X(bitLenInt target)
     {
         if (stabilizer) {
+            InvertBuffer(target);
             stabilizer->X(target);
         } else {
             engine->X(target);
@@ -159,6 +193,7 @@ public:
     virtual void Y(bitLenInt target)
     {
         if (stabilizer) {
+            InvertBuffer(target);
             stabilizer->Y(target);
         } else {
             engine->Y(target);
@@ -183,6 +218,7 @@ public:
         }
 
         if (stabilizer) {
+            std::swap(phaseBuffer[qubit1], phaseBuffer[qubit2]);
             stabilizer->Swap(qubit1, qubit2);
         } else {
             engine->Swap(qubit1, qubit2);
@@ -195,7 +231,9 @@ public:
             return;
         }
 
+        // ISwap is a Swap times a diagonal gate, so the buffered phases just trade places.
         if (stabilizer) {
+            std::swap(phaseBuffer[qubit1], phaseBuffer[qubit2]);
             stabilizer->ISwap(qubit1, qubit2);
         } else {
             engine->ISwap(qubit1, qubit2);
@@ -217,6 +255,7 @@ public:
             toRet = stabilizer->Compose(toCopy->stabilizer);
         }
 
+        phaseBuffer.insert(phaseBuffer.begin() + toRet, toCopy->phaseBuffer.begin(), toCopy->phaseBuffer.end());
         SetQubitCount(qubitCount + toCopy->qubitCount);
 
         return toRet;
@@ -239,6 +278,7 @@ public:
             toRet = stabilizer->Compose(toCopy->stabilizer, start);
         }
 
+        phaseBuffer.insert(phaseBuffer.begin() + start, toCopy->phaseBuffer.begin(), toCopy->phaseBuffer.end());
         SetQubitCount(qubitCount + toCopy->qubitCount);
 
         return toRet;
@@ -256,14 +296,16 @@ public:
     virtual void Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm);
 
     virtual void SetQuantumState(const complex* inputState);
-    virtual void GetQuantumState(complex* outputState)
+    virtual void GetQuantumState(complex* outputState);
+    virtual QStateViewPtr LockStateView(bool isWritable = false)
     {
-        if (stabilizer) {
-            stabilizer->GetQuantumState(outputState);
-        } else {
-            engine->GetQuantumState(outputState);
+        if (engine) {
+            return engine->LockStateView(isWritable);
         }
+        return QInterface::LockStateView(isWritable);
     }
+    virtual void WriteCheckpoint(QCheckpointWriter& writer);
+    virtual void ReadCheckpoint(QCheckpointReader& reader);
     virtual void GetProbs(real1* outputProbs);
     virtual complex GetAmplitude(bitCapInt perm)
     {
@@ -277,6 +319,7 @@ public:
     }
     virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG)
     {
+        ClearBuffers();
         if (stabilizer) {
             stabilizer->SetPermutation(perm);
         } else {
@@ -299,6 +342,17 @@ public:
     virtual void ApplyControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
         const bitLenInt& target, const complex topRight, const complex bottomLeft);
 
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen)
+    {
+        if (targetLen == 1U) {
+            ApplySingleBit(mtrx, targets[0]);
+            return;
+        }
+
+        SwitchToEngine();
+        engine->ApplyNxN(mtrx, targets, targetLen);
+    }
+
     virtual void ApplyAntiControlledSingleBit(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
 
@@ -390,6 +444,10 @@ public:
         if (stabilizer &&
             (stabilizer->IsSeparableZ(qubit) ||
                 ((engineType == QINTERFACE_QUNIT) || (engineType == QINTERFACE_QUNIT_MULTI)))) {
+            // Measurement commutes with the buffered phase, which is global once the qubit is collapsed.
+            if (doApply) {
+                phaseBuffer[qubit] = ONE_CMPLX;
+            }
             return stabilizer->M(qubit, result, doForce, doApply);
         }
 
@@ -530,6 +588,11 @@ public:
         SwitchToEngine();
         engine->ZeroPhaseFlip(start, length);
     }
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length)
+    {
+        SwitchToEngine();
+        engine->GroverDiffusion(start, length);
+    }
     virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex)
     {
         SwitchToEngine();
@@ -623,6 +686,7 @@ public:
         SwitchToEngine();
         return engine->ProbParity(mask);
     }
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
     virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true)
     {
         // If no bits in mask:
@@ -646,8 +710,13 @@ public:
 
     virtual bool ApproxCompare(QStabilizerHybridPtr toCompare)
     {
+        FlushBuffers();
+        toCompare->FlushBuffers();
+
+        // Flushing can leave only one side in the engine, though both had the same state.
         if (!stabilizer == !(toCompare->engine)) {
-            return false;
+            SwitchToEngine();
+            toCompare->SwitchToEngine();
         }
 
         if (stabilizer) {
@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "qinterface.hpp"
+
+// Most consecutive amplitude damping channels, (on distinct qubits,) whose Kraus branches are drawn from one reduction
+#define QTRAJ_FUSE_MAX_QB 6U
+// Trajectories run side by side in one QEngineOCLBatch, by default
+#define QTRAJ_OCL_BATCH_COPIES 1024U
+
+namespace Qrack {
+
+class QTrajectorySampler;
+typedef std::shared_ptr<QTrajectorySampler> QTrajectorySamplerPtr;
+
+/**
+ * A many-shot sampler for noisy circuits, by stochastic (quantum trajectory) unraveling of the noise channels.
+ *
+ * Gates, measurements, and noise channels are recorded, rather than applied. Each shot runs the circuit on its own
+ * state vector, drawing one Kraus operator of every noise channel with the probability that it has in that state, so
+ * that the statistics over shots are those of the density matrix, at the cost of a pure state per shot. Shots run in
+ * parallel, one per core, or, with SampleOCLBatch(), all at once, as the registers of a QEngineOCLBatch.
+ *
+ * Depolarizing noise is a mixture of unitaries, drawn without looking at the state. Amplitude damping needs the |1>
+ * probability of its qubit, and a run of consecutive damping channels, on up to QTRAJ_FUSE_MAX_QB distinct qubits,
+ * draws all of its branches jointly from one QInterface::ProbMaskAll() reduction. Readout error flips the recorded
+ * result of a measurement, without touching the state.
+ */
+class QTrajectorySampler : public ParallelFor {
+public:
+    enum TrajOpType { TRAJ_GATE = 0, TRAJ_M, TRAJ_RESET, TRAJ_DEPOLARIZE, TRAJ_AMPLITUDE_DAMPING };
+
+protected:
+    struct TrajOp {
+        TrajOpType type;
+        bitLenInt target;
+        std::vector<bitLenInt> controls;
+        complex mtrx[4];
+        // The error probability of a channel, or the readout flip probability of a measurement
+        real1 prob;
+    };
+
+    bitLenInt qubitCount;
+    bitCapInt initPerm;
+    QInterfaceEngine engineType;
+    std::vector<TrajOp> ops;
+    bitCapIntOcl measurementCount;
+
+    qrack_rand_gen_ptr rand_generator;
+
+    void CheckQubit(const bitLenInt& qubit);
+    void AddOp(const TrajOpType& type, const bitLenInt& target, const real1& prob = ZERO_R1);
+    /// Run one shot on "qReg," writing its measurement results to "results"
+    void RunTrajectory(QInterfacePtr qReg, qrack_rand_gen& gen, uint8_t* results);
+    /// Draw and apply the Kraus branches of the damping channels ops[start] to ops[end - 1], all on distinct qubits
+    void ApplyDamping(QInterfacePtr qReg, qrack_rand_gen& gen, const size_t& start, const size_t& end);
+    /// Pack "shots" rows of per-shot results, as Sample() returns them
+    std::vector<uint64_t> Pack(const std::vector<uint8_t>& results, const bitCapIntOcl& shots);
+
+public:
+    /**
+     * Sample circuits on "n" qubits, starting in permutation "perm," with one "eng" register per shot. The engine has
+     * to hold a single state vector, (such as QINTERFACE_CPU, QINTERFACE_OPENCL, or QINTERFACE_HYBRID,) since
+     * amplitude damping applies non-unitary Kraus operators to it.
+     */
+    QTrajectorySampler(const bitLenInt& n, const bitCapInt& perm = 0, QInterfaceEngine eng = QINTERFACE_CPU,
+        qrack_rand_gen_ptr rgp = nullptr);
+
+    bitLenInt GetQubitCount() { return qubitCount; }
+    /// Get the count of measurements recorded so far, (which is the count of bits per shot in the sample record)
+    bitCapIntOcl GetMeasurementCount() { return measurementCount; }
+
+    void SetRandomSeed(uint32_t seed) { rand_generator->seed(seed); }
+
+    /// Record an arbitrary single bit gate
+    void ApplySingleBit(const complex* mtrx, const bitLenInt& target)
+    {
+        ApplyControlledSingleBit(NULL, 0, target, mtrx);
+    }
+    /// Record an arbitrary single bit gate, with arbitrary control bits
+    void ApplyControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    void H(const bitLenInt& target);
+    void X(const bitLenInt& target);
+    void Y(const bitLenInt& target);
+    void Z(const bitLenInt& target);
+    void S(const bitLenInt& target);
+    void T(const bitLenInt& target);
+    void RX(const real1& radians, const bitLenInt& target);
+    void RY(const real1& radians, const bitLenInt& target);
+    void RZ(const real1& radians, const bitLenInt& target);
+    void CNOT(const bitLenInt& control, const bitLenInt& target);
+    void CZ(const bitLenInt& control, const bitLenInt& target);
+
+    /**
+     * Measure the target qubit in the Z basis, appending one bit to every shot's record, and return its index. The
+     * recorded bit is flipped with probability "readoutError," (but the state collapses to the true outcome).
+     */
+    bitCapIntOcl M(const bitLenInt& target, const real1& readoutError = ZERO_R1);
+    /// Measure and discard the target qubit, leaving it in |0>
+    void Reset(const bitLenInt& target) { AddOp(TRAJ_RESET, target); }
+
+    /// In each shot, independently with probability "prob," apply one of X, Y, or Z to the target, uniformly
+    void Depolarize(const bitLenInt& target, const real1& prob) { AddOp(TRAJ_DEPOLARIZE, target, prob); }
+    /// Relax the target toward |0>, with Kraus operators {{1, 0}, {0, sqrt(1 - gamma)}} and {{0, sqrt(gamma)}, {0, 0}}
+    void AmplitudeDamping(const bitLenInt& target, const real1& gamma)
+    {
+        AddOp(TRAJ_AMPLITUDE_DAMPING, target, gamma);
+    }
+
+    /**
+     * Sample "shots" runs of the circuit recorded so far.
+     *
+     * The record is packed measurement-major: with W = (shots + 63) / 64 words per measurement, bit (s % 64) of
+     * record[m * W + s / 64] is the result of measurement m in shot s. Padding bits of the last word are 0.
+     */
+    std::vector<uint64_t> Sample(const bitCapIntOcl& shots);
+
+#if ENABLE_OPENCL
+    /**
+     * Sample as Sample() does, but run up to "copiesPerBatch" shots at once, as the registers of a QEngineOCLBatch.
+     * Every gate is one kernel launch for the whole batch, and the Kraus branch probabilities of a channel, for every
+     * shot, are one reduction. (Damping channels aren't fused across qubits, in this mode.)
+     */
+    std::vector<uint64_t> SampleOCLBatch(
+        const bitCapIntOcl& shots, const bitCapIntOcl& copiesPerBatch = QTRAJ_OCL_BATCH_COPIES);
+#endif
+};
+} // namespace Qrack
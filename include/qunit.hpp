@@ -12,9 +12,15 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cfloat>
+#include <functional>
+#include <map>
+#include <new>
 #include <random>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "qinterface.hpp"
 
@@ -46,6 +52,70 @@ struct PhaseShard {
     }
 };
 
+// Most freed PhaseShard blocks each thread keeps for reuse
+#define QRACK_PHASE_SHARD_POOL 1024U
+
+/**
+ * Allocates PhaseShard buffers, (with their shared_ptr control blocks,) from a per-thread free list of released blocks,
+ * so that buffering and flushing controlled phase gates doesn't usually touch the heap
+ */
+template <typename T> struct PhaseShardAllocator {
+    typedef T value_type;
+
+    PhaseShardAllocator() {}
+    template <typename U> PhaseShardAllocator(const PhaseShardAllocator<U>& rhs) {}
+
+    T* allocate(size_t n)
+    {
+        FreeList& pool = Pool();
+        if ((n == 1U) && pool.blocks.size()) {
+            T* toRet = (T*)pool.blocks.back();
+            pool.blocks.pop_back();
+            return toRet;
+        }
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        // (The pool might already have been destroyed, if this is a static object released at thread exit.)
+        if ((n == 1U) && IsPoolAlive() && (Pool().blocks.size() < QRACK_PHASE_SHARD_POOL)) {
+            Pool().blocks.push_back(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U> bool operator==(const PhaseShardAllocator<U>& rhs) const { return true; }
+    template <typename U> bool operator!=(const PhaseShardAllocator<U>& rhs) const { return false; }
+
+private:
+    struct FreeList {
+        std::vector<void*> blocks;
+
+        FreeList() { IsPoolAlive() = true; }
+        ~FreeList()
+        {
+            IsPoolAlive() = false;
+            for (size_t i = 0; i < blocks.size(); i++) {
+                ::operator delete(blocks[i]);
+            }
+        }
+    };
+
+    static FreeList& Pool()
+    {
+        static thread_local FreeList pool;
+        return pool;
+    }
+
+    static bool& IsPoolAlive()
+    {
+        static thread_local bool isAlive = false;
+        return isAlive;
+    }
+};
+
 #define IS_SAME(c1, c2) (norm((c1) - (c2)) <= amplitudeFloor)
 #define IS_OPPOSITE(c1, c2) (norm((c1) + (c2)) <= amplitudeFloor)
 #define IS_ARG_0(c) IS_SAME(c, ONE_CMPLX)
@@ -54,7 +124,78 @@ struct PhaseShard {
 class QEngineShard;
 typedef QEngineShard* QEngineShardPtr;
 typedef std::shared_ptr<PhaseShard> PhaseShardPtr;
-typedef std::map<QEngineShardPtr, PhaseShardPtr> ShardToPhaseMap;
+
+inline PhaseShardPtr MakePhaseShard() { return std::allocate_shared<PhaseShard>(PhaseShardAllocator<PhaseShard>()); }
+
+/**
+ * Maps partner shards to phase buffers, as a vector of pairs sorted by partner, (since each qubit usually buffers gates
+ * with only a few others,) with the subset of the std::map interface that QEngineShard uses
+ *
+ * Like std::map, iteration is in order of partner, but insertion and erasure invalidate iterators. To keep walking a
+ * map that the loop body might change, resume from upper_bound() of the partner that was just visited.
+ */
+class ShardToPhaseMap {
+public:
+    typedef std::pair<QEngineShardPtr, PhaseShardPtr> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+
+protected:
+    std::vector<value_type> entries;
+
+    static bool IsKeyLess(const value_type& entry, const QEngineShardPtr& key)
+    {
+        return std::less<QEngineShardPtr>()(entry.first, key);
+    }
+    static bool IsLessKey(const QEngineShardPtr& key, const value_type& entry)
+    {
+        return std::less<QEngineShardPtr>()(key, entry.first);
+    }
+
+public:
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void clear() { entries.clear(); }
+
+    iterator lower_bound(const QEngineShardPtr& key)
+    {
+        return std::lower_bound(entries.begin(), entries.end(), key, IsKeyLess);
+    }
+    iterator upper_bound(const QEngineShardPtr& key)
+    {
+        return std::upper_bound(entries.begin(), entries.end(), key, IsLessKey);
+    }
+
+    iterator find(const QEngineShardPtr& key)
+    {
+        iterator toRet = lower_bound(key);
+        return ((toRet == entries.end()) || (toRet->first != key)) ? entries.end() : toRet;
+    }
+
+    PhaseShardPtr& operator[](const QEngineShardPtr& key)
+    {
+        iterator toRet = lower_bound(key);
+        if ((toRet == entries.end()) || (toRet->first != key)) {
+            toRet = entries.insert(toRet, value_type(key, PhaseShardPtr()));
+        }
+        return toRet->second;
+    }
+
+    iterator erase(iterator toErase) { return entries.erase(toErase); }
+    size_t erase(const QEngineShardPtr& key)
+    {
+        iterator toErase = find(key);
+        if (toErase == entries.end()) {
+            return 0U;
+        }
+        entries.erase(toErase);
+        return 1U;
+    }
+};
 
 /** Associates a QInterface object with a set of bits. */
 class QEngineShard {
@@ -71,6 +212,8 @@ public:
     real1 amplitudeFloor;
     bool isProbDirty;
     bool isPhaseDirty;
+    // QUnit::TrySeparate() failed on this shard, and no gate or measurement has dirtied it since
+    bool didFailSeparate;
     complex amp0;
     complex amp1;
     bool isPlusMinus;
@@ -99,6 +242,7 @@ public:
         , amplitudeFloor(amp_thresh)
         , isProbDirty(false)
         , isPhaseDirty(false)
+        , didFailSeparate(false)
         , amp0(ONE_CMPLX)
         , amp1(ZERO_CMPLX)
         , isPlusMinus(false)
@@ -116,6 +260,7 @@ public:
         , amplitudeFloor(amp_thresh)
         , isProbDirty(false)
         , isPhaseDirty(false)
+        , didFailSeparate(false)
         , isPlusMinus(false)
         , controlsShards()
         , antiControlsShards()
@@ -134,6 +279,7 @@ public:
         , amplitudeFloor(amp_thresh)
         , isProbDirty(true)
         , isPhaseDirty(true)
+        , didFailSeparate(false)
         , amp0(ONE_CMPLX)
         , amp1(ZERO_CMPLX)
         , isPlusMinus(false)
@@ -149,6 +295,13 @@ public:
     {
         isProbDirty = true;
         isPhaseDirty = true;
+        didFailSeparate = false;
+    }
+
+    void MakePhaseDirty()
+    {
+        isPhaseDirty = true;
+        didFailSeparate = false;
     }
 
     bool ClampAmps(real1 norm_thresh)
@@ -248,7 +401,7 @@ protected:
     void AddBuffer(QEngineShardPtr p, ShardToPhaseMap& localMap, GetBufferFn remoteFn)
     {
         if (p && (localMap.find(p) == localMap.end())) {
-            PhaseShardPtr ps = std::make_shared<PhaseShard>();
+            PhaseShardPtr ps = MakePhaseShard();
             localMap[p] = ps;
             ((*p).*remoteFn)()[this] = ps;
         }
@@ -321,25 +474,27 @@ protected:
         PhaseShardPtr buffer;
         QEngineShardPtr partner;
 
-        ShardToPhaseMap::iterator phaseShard;
-        ShardToPhaseMap tempLocalMap = localMap;
+        ShardToPhaseMap::iterator phaseShard = localMap.begin();
 
-        for (phaseShard = tempLocalMap.begin(); phaseShard != tempLocalMap.end(); phaseShard++) {
+        while (phaseShard != localMap.end()) {
             buffer = phaseShard->second;
             partner = phaseShard->first;
 
             if (buffer->isInvert || !IS_ARG_0(buffer->cmplxDiff)) {
+                phaseShard++;
                 continue;
             }
 
-            ((*phaseShard->first).*remoteMapGet)().erase(this);
-            localMap.erase(partner);
+            ((*partner).*remoteMapGet)().erase(this);
+            localMap.erase(phaseShard);
 
             if (makeThisControl) {
                 ((*partner).*phaseFn)(this, ONE_CMPLX, buffer->cmplxSame);
             } else {
                 ((*this).*phaseFn)(partner, ONE_CMPLX, buffer->cmplxSame);
             }
+
+            phaseShard = localMap.upper_bound(partner);
         }
     }
 
@@ -368,46 +523,50 @@ public:
         PhaseShardPtr buffer;
         QEngineShardPtr partner;
 
-        ShardToPhaseMap::iterator phaseShard;
-
-        ShardToPhaseMap tempLocalMap = targetOfShards;
-        for (phaseShard = tempLocalMap.begin(); phaseShard != tempLocalMap.end(); phaseShard++) {
+        ShardToPhaseMap::iterator phaseShard = targetOfShards.begin();
+        while (phaseShard != targetOfShards.end()) {
             buffer = phaseShard->second;
             partner = phaseShard->first;
 
             if (buffer->isInvert) {
+                phaseShard++;
                 continue;
             }
 
             if (IS_ARG_0(buffer->cmplxDiff)) {
-                phaseShard->first->GetControlsShards().erase(this);
-                targetOfShards.erase(partner);
+                partner->GetControlsShards().erase(this);
+                targetOfShards.erase(phaseShard);
                 partner->AddPhaseAngles(this, ONE_CMPLX, buffer->cmplxSame);
             } else if (IS_ARG_0(buffer->cmplxSame)) {
-                phaseShard->first->GetControlsShards().erase(this);
-                targetOfShards.erase(partner);
+                partner->GetControlsShards().erase(this);
+                targetOfShards.erase(phaseShard);
                 partner->AddAntiPhaseAngles(this, buffer->cmplxDiff, ONE_CMPLX);
             }
+
+            phaseShard = targetOfShards.upper_bound(partner);
         }
 
-        tempLocalMap = antiTargetOfShards;
-        for (phaseShard = tempLocalMap.begin(); phaseShard != tempLocalMap.end(); phaseShard++) {
+        phaseShard = antiTargetOfShards.begin();
+        while (phaseShard != antiTargetOfShards.end()) {
             buffer = phaseShard->second;
             partner = phaseShard->first;
 
             if (buffer->isInvert) {
+                phaseShard++;
                 continue;
             }
 
             if (IS_ARG_0(buffer->cmplxDiff)) {
-                phaseShard->first->GetAntiControlsShards().erase(this);
-                antiTargetOfShards.erase(partner);
+                partner->GetAntiControlsShards().erase(this);
+                antiTargetOfShards.erase(phaseShard);
                 partner->AddAntiPhaseAngles(this, ONE_CMPLX, buffer->cmplxSame);
             } else if (IS_ARG_0(buffer->cmplxSame)) {
-                phaseShard->first->GetAntiControlsShards().erase(this);
-                antiTargetOfShards.erase(partner);
+                partner->GetAntiControlsShards().erase(this);
+                antiTargetOfShards.erase(phaseShard);
                 partner->AddPhaseAngles(this, buffer->cmplxDiff, ONE_CMPLX);
             }
+
+            phaseShard = antiTargetOfShards.upper_bound(partner);
         }
     }
 
@@ -418,15 +577,16 @@ protected:
         ShardToPhaseMap::iterator partnerShard;
         QEngineShardPtr partner;
 
-        ShardToPhaseMap::iterator phaseShard;
-        ShardToPhaseMap tempControls = ((*this).*controlMapGet)();
-        ShardToPhaseMap tempTargets = ((*this).*targetMapGet)();
+        ShardToPhaseMap& localControls = ((*this).*controlMapGet)();
+        ShardToPhaseMap& localTargets = ((*this).*targetMapGet)();
+        ShardToPhaseMap::iterator phaseShard = localControls.begin();
 
-        for (phaseShard = tempControls.begin(); phaseShard != tempControls.end(); phaseShard++) {
+        while (phaseShard != localControls.end()) {
             partner = phaseShard->first;
 
-            partnerShard = tempTargets.find(partner);
-            if (partnerShard == tempTargets.end()) {
+            partnerShard = localTargets.find(partner);
+            if (partnerShard == localTargets.end()) {
+                phaseShard++;
                 continue;
             }
 
@@ -442,6 +602,8 @@ protected:
                 ((*this).*targetMapGet)().erase(partner);
                 ((*partner).*angleFn)(this, ONE_CMPLX, buffer2->cmplxSame);
             }
+
+            phaseShard = localControls.upper_bound(partner);
         }
     }
 
@@ -539,7 +701,7 @@ protected:
             if (!buffer->isInvert && IS_ARG_0(buffer->cmplxDiff) && IS_ARG_0(buffer->cmplxSame)) {
                 // The buffer is equal to the identity operator, and it can be removed.
                 ((*phaseShard->first).*remoteMapGet)().erase(this);
-                localMap.erase(phaseShard);
+                phaseShard = localMap.erase(phaseShard);
             } else {
                 phaseShard++;
             }
@@ -675,6 +837,18 @@ public:
     }
 };
 
+// Widest subsystem, (in qubits,) whose basis state probabilities QUnit keeps between gates
+#define QRACK_QUNIT_PROB_CACHE_QB 16U
+
+/// Basis state probabilities of one QUnit subsystem, (in its engine's qubit order,) kept until a gate touches it
+struct UnitProbCache {
+    std::weak_ptr<QInterface> unit;
+    std::vector<real1> probs;
+    // Earlier results, by engine mask, (and permutation,) so that repeated queries don't even rescan "probs"
+    std::map<bitCapInt, real1> parities;
+    std::map<std::pair<bitCapInt, bitCapInt>, real1> maskProbs;
+};
+
 class QUnit;
 typedef std::shared_ptr<QUnit> QUnitPtr;
 
@@ -693,6 +867,7 @@ protected:
     bool freezeBasis2Qb;
     bitLenInt thresholdQubits;
     bool doSkipBuffer;
+    std::map<QInterface*, UnitProbCache> probCache;
 
     QInterfacePtr MakeEngine(bitLenInt length, bitCapInt perm);
 
@@ -725,6 +900,8 @@ public:
 
     virtual void SetQuantumState(const complex* inputState);
     virtual void GetQuantumState(complex* outputState);
+    virtual void WriteCheckpoint(QCheckpointWriter& writer);
+    virtual void ReadCheckpoint(QCheckpointReader& reader);
     virtual void GetProbs(real1* outputProbs);
     virtual complex GetAmplitude(bitCapInt perm);
     virtual void SetAmplitude(bitCapInt perm, complex amp);
@@ -786,6 +963,7 @@ public:
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
     virtual void ApplyAntiControlledSingleBit(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen);
     using QInterface::UniformlyControlledSingleBit;
     virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
         bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
@@ -860,6 +1038,7 @@ public:
      */
 
     virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
+    virtual void GroverDiffusion(bitLenInt start, bitLenInt length);
     virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
     virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
     virtual void PhaseFlip();
@@ -887,7 +1066,9 @@ public:
 
     virtual real1 Prob(bitLenInt qubit);
     virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
     virtual real1 ProbParity(const bitCapInt& mask);
+    virtual void ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations);
     virtual bool ForceMParity(const bitCapInt& mask, bool result, bool doForce = true);
     virtual bool ApproxCompare(QInterfacePtr toCompare)
     {
@@ -1016,7 +1197,7 @@ protected:
     enum RevertAnti { CTRL_AND_ANTI = 0, ONLY_CTRL = 1, ONLY_ANTI = 2 };
 
     void ApplyBuffer(PhaseShardPtr phaseShard, const bitLenInt& control, const bitLenInt& target, const bool& isAnti);
-    void ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap bufferMap, const RevertExclusivity& exclusivity,
+    void ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap& bufferMap, const RevertExclusivity& exclusivity,
         const bool& isControl, const bool& isAnti, std::set<bitLenInt> exceptPartners, const bool& dumpSkipped);
     void RevertBasis2Qb(const bitLenInt& i, const RevertExclusivity& exclusivity = INVERT_AND_PHASE,
         const RevertControl& controlExclusivity = CONTROLS_AND_TARGETS,
@@ -1100,7 +1281,7 @@ protected:
     void DirtyShardRangePhase(bitLenInt start, bitLenInt length)
     {
         for (bitLenInt i = 0; i < length; i++) {
-            shards[start + i].isPhaseDirty = true;
+            shards[start + i].MakePhaseDirty();
         }
     }
 
@@ -1140,6 +1321,19 @@ protected:
         }
     }
 
+    /// Drop the cached probabilities of "unit," (before a gate changes them)
+    void InvalidateProbCache(const QInterfacePtr& unit)
+    {
+        if (unit && probCache.size()) {
+            probCache.erase(unit.get());
+        }
+    }
+
+    /// The cached basis state probabilities of "unit," (filled, if need be,) or NULL, if the unit is too wide to cache
+    UnitProbCache* GetProbCache(const QInterfacePtr& unit);
+    real1 UnitProbMask(const QInterfacePtr& unit, const bitCapInt& mask, const bitCapInt& permutation);
+    real1 UnitProbParity(const QInterfacePtr& unit, const bitCapInt& mask);
+
     void EndAllEmulation()
     {
         for (bitLenInt i = 0; i < qubitCount; i++) {
@@ -53,6 +53,10 @@ struct QEngineInfo {
 struct DeviceInfo {
     int id;
     bitCapInt maxSize;
+    // Benchmarked costs, in nanoseconds per amplitude, of a single bit gate, and of reading or writing the state vector
+    real1 gateNs;
+    real1 readNs;
+    real1 writeNs;
 
     bool operator<(const DeviceInfo& other) const { return maxSize < other.maxSize; }
     bool operator>(const DeviceInfo& other) const { return maxSize > other.maxSize; }
@@ -110,6 +114,11 @@ protected:
     }
     virtual void Detach(bitLenInt start, bitLenInt length, QUnitMultiPtr dest);
 
+    /**
+     * Place each shard, largest first, on the device where one more gate would finish soonest, given each device's
+     * benchmarked throughput and its outstanding work. A shard only migrates when the time that saves, over the next
+     * SCHEDULER_GATE_HORIZON gates, exceeds the cost of copying it between devices.
+     */
     virtual void RedistributeQEngines();
 
     virtual QInterfacePtr EntangleInCurrentBasis(
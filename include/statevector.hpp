@@ -14,12 +14,16 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <future>
 #include <mutex>
 #include <set>
 
 #include "common/parallel_for.hpp"
 #include "common/qrack_types.hpp"
+#include "common/statevecpool.hpp"
 
 #if ENABLE_UINT128
 #if BOOST_AVAILABLE
@@ -38,17 +42,54 @@
 #define SparseStateVecMap std::unordered_map<bitCapInt, complex>
 #endif
 
+// Shards of a sparse state vector, (a power of 2,) each with its own lock
+#define QRACK_SPARSE_SHARD_POW 6U
+#define QRACK_SPARSE_SHARDS (1U << QRACK_SPARSE_SHARD_POW)
+
+#if defined(__linux__)
+// Transparent huge page size on x86_64, and the usual default elsewhere
+#define QRACK_HUGE_PAGE_SIZE (1U << 21U)
+#endif
+
 namespace Qrack {
 
 class StateVectorArray : public StateVector {
 public:
     complex* amplitudes;
 
+    /// Freed buffers, kept for reuse by the next allocation of the same size on the same NUMA node
+    static StateVecPool<complex*>* GetPool();
+
 protected:
+    int numaNode;
+
     static real1 normHelper(const complex& c) { return norm(c); }
 
-    complex* Alloc(bitCapInt elemCount)
+    static void FreeAligned(complex*& amps)
     {
+#if defined(_WIN32)
+        _aligned_free(amps);
+#else
+        free(amps);
+#endif
+    }
+
+#if defined(__linux__)
+    /**
+     * Allocate a buffer of at least one huge page, aligned to huge page boundaries, and set its NUMA policy before
+     * anything touches it. If "numaNode" is a valid node, pages prefer that node. Otherwise, on multi-socket hosts,
+     * pages are interleaved round-robin over all nodes, since ParallelFor hands chunks to whichever thread is free.
+     */
+    static complex* AllocLarge(size_t size, int numaNode);
+#endif
+
+    complex* Alloc(bitCapInt elemCount, int node = -1)
+    {
+        complex* pooled;
+        if (GetPool()->Acquire(node, sizeof(complex) * (bitCapIntOcl)elemCount, pooled)) {
+            return pooled;
+        }
+
 // elemCount is always a power of two, but might be smaller than QRACK_ALIGN_SIZE
 #if defined(__APPLE__)
         void* toRet;
@@ -65,6 +106,11 @@ protected:
 #elif defined(__ANDROID__)
         return (complex*)malloc(sizeof(complex) * (bitCapIntOcl)elemCount);
 #else
+#if defined(__linux__)
+        if ((sizeof(complex) * (bitCapIntOcl)elemCount) >= QRACK_HUGE_PAGE_SIZE) {
+            return AllocLarge(sizeof(complex) * (bitCapIntOcl)elemCount, node);
+        }
+#endif
         return (complex*)aligned_alloc(QRACK_ALIGN_SIZE,
             ((sizeof(complex) * (bitCapIntOcl)elemCount) < QRACK_ALIGN_SIZE)
                 ? QRACK_ALIGN_SIZE
@@ -74,21 +120,27 @@ protected:
 
     virtual void Free()
     {
-        if (amplitudes) {
-#if defined(_WIN32)
-            _aligned_free(amplitudes);
-#else
-            free(amplitudes);
-#endif
+        if (amplitudes && !GetPool()->Release(numaNode, sizeof(complex) * (bitCapIntOcl)capacity, amplitudes)) {
+            FreeAligned(amplitudes);
         }
         amplitudes = NULL;
     }
 
+    /// For subclasses that provide their own storage
+    StateVectorArray(bitCapInt cap, complex* amps)
+        : StateVector(cap)
+        , amplitudes(amps)
+        , numaNode(-1)
+    {
+    }
+
 public:
-    StateVectorArray(bitCapInt cap)
+    /// "numaNode" is only a placement hint, for large allocations on Linux. (-1 interleaves over all nodes.)
+    StateVectorArray(bitCapInt cap, int node = -1)
         : StateVector(cap)
+        , numaNode(node)
     {
-        amplitudes = Alloc(capacity);
+        amplitudes = Alloc(capacity, numaNode);
     }
 
     virtual ~StateVectorArray() { Free(); }
@@ -119,16 +171,22 @@ public:
         if (copyIn) {
             std::copy(copyIn, copyIn + (bitCapIntOcl)length, amplitudes + (bitCapIntOcl)offset);
         } else {
-            std::fill(amplitudes, amplitudes + (bitCapIntOcl)length, ZERO_CMPLX);
+            std::fill(amplitudes + (bitCapIntOcl)offset, amplitudes + (bitCapIntOcl)offset + (bitCapIntOcl)length,
+                ZERO_CMPLX);
         }
     }
 
     void copy_in(StateVectorPtr copyInSv, const bitCapInt srcOffset, const bitCapInt dstOffset, const bitCapInt length)
     {
-        if (copyInSv) {
-            const complex* copyIn =
-                std::dynamic_pointer_cast<StateVectorArray>(copyInSv)->amplitudes + (bitCapIntOcl)srcOffset;
+        StateVectorArrayPtr copyInArray = std::dynamic_pointer_cast<StateVectorArray>(copyInSv);
+        if (copyInArray) {
+            const complex* copyIn = copyInArray->amplitudes + (bitCapIntOcl)srcOffset;
             std::copy(copyIn, copyIn + (bitCapIntOcl)length, amplitudes + (bitCapIntOcl)dstOffset);
+        } else if (copyInSv) {
+            // (Another kind of storage, like StateVectorNarrow, converts amplitude by amplitude.)
+            for (bitCapIntOcl i = 0; i < (bitCapIntOcl)length; i++) {
+                amplitudes[(bitCapIntOcl)dstOffset + i] = copyInSv->read(srcOffset + i);
+            }
         } else {
             std::fill(amplitudes + (bitCapIntOcl)dstOffset, amplitudes + (bitCapIntOcl)dstOffset + (bitCapIntOcl)length,
                 ZERO_CMPLX);
@@ -139,18 +197,39 @@ public:
 
     void copy_out(complex* copyOut, const bitCapInt offset, const bitCapInt length)
     {
-        std::copy(
-            amplitudes + (bitCapIntOcl)offset, amplitudes + (bitCapIntOcl)offset + (bitCapIntOcl)capacity, copyOut);
+        std::copy(amplitudes + (bitCapIntOcl)offset, amplitudes + (bitCapIntOcl)offset + (bitCapIntOcl)length, copyOut);
     }
 
-    void copy(StateVectorPtr toCopy) { copy(std::dynamic_pointer_cast<StateVectorArray>(toCopy)); }
+    void copy(StateVectorPtr toCopy)
+    {
+        StateVectorArrayPtr toCopyArray = std::dynamic_pointer_cast<StateVectorArray>(toCopy);
+        if (toCopyArray) {
+            copy(toCopyArray);
+        } else {
+            copy_in(toCopy, 0, 0, capacity);
+        }
+    }
 
     void copy(StateVectorArrayPtr toCopy)
     {
         std::copy(toCopy->amplitudes, toCopy->amplitudes + (bitCapIntOcl)capacity, amplitudes);
     }
 
-    void shuffle(StateVectorPtr svp) { shuffle(std::dynamic_pointer_cast<StateVectorArray>(svp)); }
+    void shuffle(StateVectorPtr svp)
+    {
+        StateVectorArrayPtr svpArray = std::dynamic_pointer_cast<StateVectorArray>(svp);
+        if (svpArray) {
+            shuffle(svpArray);
+            return;
+        }
+
+        const bitCapIntOcl halfCap = ((bitCapIntOcl)capacity) >> ONE_BCI;
+        for (bitCapIntOcl i = 0; i < halfCap; i++) {
+            complex amp = amplitudes[halfCap + i];
+            amplitudes[halfCap + i] = svp->read(i);
+            svp->write(i, amp);
+        }
+    }
 
     void shuffle(StateVectorArrayPtr svp)
     {
@@ -166,91 +245,126 @@ public:
     bool is_sparse() { return false; }
 };
 
-class StateVectorSparse : public StateVector, public ParallelFor {
+#if !defined(_WIN32)
+/**
+ * A dense state vector in a memory-mapped, (already unlinked,) temporary file, so that the operating system can page
+ * it to and from disk, (ideally NVMe,) for registers that don't fit in RAM. The file goes in the directory named by
+ * the QRACK_STATEVEC_PATH environment variable, or "/tmp" by default.
+ */
+class StateVectorMapped : public StateVectorArray {
 protected:
-    SparseStateVecMap amplitudes;
-    std::mutex mtx;
+    static complex* Map(bitCapInt elemCount);
+    static size_t MappedSize(bitCapInt elemCount);
 
-    complex readUnlocked(const bitCapInt& i)
+    virtual void Free();
+
+public:
+    StateVectorMapped(bitCapInt cap)
+        : StateVectorArray(cap, Map(cap))
     {
-        auto it = amplitudes.find(i);
-        return (it == amplitudes.end()) ? ZERO_CMPLX : it->second;
     }
 
-    complex readLocked(const bitCapInt& i)
+    virtual ~StateVectorMapped() { Free(); }
+};
+#endif
+
+/// Amplitude storage precision, chosen per QEngineCPU instance
+enum QStoragePrecision {
+    /// "complex," as built, (float, with ENABLE_COMPLEX8, or otherwise double)
+    STORAGE_NATIVE = 0,
+    /// Pairs of 32 bit float
+    STORAGE_FLOAT,
+    /// Pairs of bfloat16, (see bfloat16)
+    STORAGE_BF16
+};
+
+/// The high half of an IEEE float: float's exponent range, with about 3 significant digits
+struct bfloat16 {
+    uint16_t bits;
+};
+
+/// Conversion between "real1" and a narrower storage type, for StateVectorNarrow
+template <typename Narrow> struct NarrowReal;
+
+template <> struct NarrowReal<float> {
+    static float Encode(const real1& r) { return (float)r; }
+    static real1 Decode(const float& f) { return (real1)f; }
+};
+
+template <> struct NarrowReal<bfloat16> {
+    static bfloat16 Encode(const real1& r)
     {
-        mtx.lock();
-        auto it = amplitudes.find(i);
-        bool isFound = (it != amplitudes.end());
-        mtx.unlock();
-        return isFound ? it->second : ZERO_CMPLX;
+        float f = (float)r;
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(float));
+        bfloat16 h;
+        if ((bits & 0x7FFFFFFFU) > 0x7F800000U) {
+            // NaN stays NaN, (rather than rounding to infinity).
+            h.bits = (uint16_t)((bits >> 16U) | 0x40U);
+            return h;
+        }
+        // Round to nearest, ties to even
+        bits += 0x7FFFU + ((bits >> 16U) & 1U);
+        h.bits = (uint16_t)(bits >> 16U);
+        return h;
     }
-
-public:
-    StateVectorSparse(bitCapInt cap)
-        : StateVector(cap)
-        , amplitudes()
+    static real1 Decode(const bfloat16& h)
     {
+        uint32_t bits = ((uint32_t)h.bits) << 16U;
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        return (real1)f;
     }
+};
 
-    complex read(const bitCapInt& i) { return isReadLocked ? readLocked(i) : readUnlocked(i); }
+/**
+ * A dense state vector that stores each amplitude as a pair of "Narrow" values, (float, or bfloat16,) for a fraction
+ * of the footprint and memory traffic of "complex." Reads and writes convert to and from "complex," so gates still do
+ * their arithmetic at full accuracy, and only rounding at storage is lost, which normalization keeps from accumulating
+ * in the norm. (bfloat16 keeps float's exponent range, where IEEE half precision would flush the amplitudes of large
+ * registers to zero.)
+ */
+template <typename Narrow> class StateVectorNarrow : public StateVector {
+protected:
+    std::unique_ptr<Narrow[]> amplitudes;
 
-    void write(const bitCapInt& i, const complex& c)
+    complex readOcl(const bitCapIntOcl& i)
     {
-        bool isCSet = (c != ZERO_CMPLX);
-
-        mtx.lock();
-
-        auto it = amplitudes.find(i);
-        bool isFound = (it != amplitudes.end());
-        if (isCSet == isFound) {
-            mtx.unlock();
-            if (isCSet) {
-                it->second = c;
-            }
-        } else {
-            if (isCSet) {
-                amplitudes[i] = c;
-            } else {
-                amplitudes.erase(it);
-            }
-            mtx.unlock();
-        }
+        return complex(
+            NarrowReal<Narrow>::Decode(amplitudes[i << 1U]), NarrowReal<Narrow>::Decode(amplitudes[(i << 1U) | 1U]));
     }
 
-    void write2(const bitCapInt& i1, const complex& c1, const bitCapInt& i2, const complex& c2)
+    void writeOcl(const bitCapIntOcl& i, const complex& c)
     {
-        bool isC1Set = (c1 != ZERO_CMPLX);
-        bool isC2Set = (c2 != ZERO_CMPLX);
-        if (!(isC1Set || isC2Set)) {
-            return;
-        }
+        amplitudes[i << 1U] = NarrowReal<Narrow>::Encode(real(c));
+        amplitudes[(i << 1U) | 1U] = NarrowReal<Narrow>::Encode(imag(c));
+    }
 
-        if (isC1Set && isC2Set) {
-            mtx.lock();
-            amplitudes[i1] = c1;
-            amplitudes[i2] = c2;
-            mtx.unlock();
-        } else if (isC1Set) {
-            mtx.lock();
-            amplitudes.erase(i2);
-            amplitudes[i1] = c1;
-            mtx.unlock();
-        } else {
-            mtx.lock();
-            amplitudes.erase(i1);
-            amplitudes[i2] = c2;
-            mtx.unlock();
-        }
+    void fillZero(const bitCapIntOcl& offset, const bitCapIntOcl& length)
+    {
+        std::fill(amplitudes.get() + (offset << 1U), amplitudes.get() + ((offset + length) << 1U),
+            NarrowReal<Narrow>::Encode(ZERO_R1));
     }
 
-    void clear()
+public:
+    StateVectorNarrow(bitCapInt cap)
+        : StateVector(cap)
+        , amplitudes(new Narrow[((bitCapIntOcl)cap) << 1U])
     {
-        mtx.lock();
-        amplitudes.clear();
-        mtx.unlock();
     }
 
+    complex read(const bitCapInt& i) { return readOcl((bitCapIntOcl)i); };
+
+    void write(const bitCapInt& i, const complex& c) { writeOcl((bitCapIntOcl)i, c); };
+
+    void write2(const bitCapInt& i1, const complex& c1, const bitCapInt& i2, const complex& c2)
+    {
+        writeOcl((bitCapIntOcl)i1, c1);
+        writeOcl((bitCapIntOcl)i2, c2);
+    };
+
+    void clear() { fillZero(0, (bitCapIntOcl)capacity); }
+
     void copy_in(const complex* copyIn)
     {
         if (!copyIn) {
@@ -258,243 +372,404 @@ public:
             return;
         }
 
-        mtx.lock();
-        for (bitCapInt i = 0; i < capacity; i++) {
-            if (copyIn[(bitCapIntOcl)i] == ZERO_CMPLX) {
-                amplitudes.erase(i);
-            } else {
-                amplitudes[i] = copyIn[(bitCapIntOcl)i];
-            }
+        for (bitCapIntOcl i = 0; i < (bitCapIntOcl)capacity; i++) {
+            writeOcl(i, copyIn[i]);
         }
-        mtx.unlock();
     }
 
     void copy_in(const complex* copyIn, const bitCapInt offset, const bitCapInt length)
     {
         if (!copyIn) {
-            mtx.lock();
-            for (bitCapInt i = 0; i < length; i++) {
-                amplitudes.erase(i);
-            }
-            mtx.unlock();
+            fillZero((bitCapIntOcl)offset, (bitCapIntOcl)length);
             return;
         }
 
-        mtx.lock();
-        for (bitCapInt i = 0; i < length; i++) {
-            if (copyIn[(bitCapIntOcl)i] == ZERO_CMPLX) {
-                amplitudes.erase(i);
-            } else {
-                amplitudes[i + offset] = copyIn[(bitCapIntOcl)i];
-            }
+        for (bitCapIntOcl i = 0; i < (bitCapIntOcl)length; i++) {
+            writeOcl((bitCapIntOcl)offset + i, copyIn[i]);
         }
-        mtx.unlock();
     }
 
     void copy_in(StateVectorPtr copyInSv, const bitCapInt srcOffset, const bitCapInt dstOffset, const bitCapInt length)
     {
-        StateVectorSparsePtr copyIn = std::dynamic_pointer_cast<StateVectorSparse>(copyInSv);
-
-        if (!copyIn) {
-            mtx.lock();
-            for (bitCapInt i = 0; i < length; i++) {
-                amplitudes.erase(i + srcOffset);
-            }
-            mtx.unlock();
+        if (!copyInSv) {
+            fillZero((bitCapIntOcl)dstOffset, (bitCapIntOcl)length);
             return;
         }
 
-        complex amp;
-
-        mtx.lock();
-        for (bitCapInt i = 0; i < length; i++) {
-            amp = copyIn->read(i + srcOffset);
-            if (amp == ZERO_CMPLX) {
-                amplitudes.erase(i + srcOffset);
-            } else {
-                amplitudes[i + dstOffset] = amp;
-            }
+        std::shared_ptr<StateVectorNarrow> copyInNarrow = std::dynamic_pointer_cast<StateVectorNarrow>(copyInSv);
+        if (copyInNarrow) {
+            const Narrow* copyIn = copyInNarrow->amplitudes.get() + (((bitCapIntOcl)srcOffset) << 1U);
+            std::copy(copyIn, copyIn + (((bitCapIntOcl)length) << 1U),
+                amplitudes.get() + (((bitCapIntOcl)dstOffset) << 1U));
+            return;
         }
-        mtx.unlock();
-    }
 
-    void copy_out(complex* copyOut)
-    {
-        for (bitCapInt i = 0; i < capacity; i++) {
-            copyOut[(bitCapIntOcl)i] = read(i);
+        for (bitCapIntOcl i = 0; i < (bitCapIntOcl)length; i++) {
+            writeOcl((bitCapIntOcl)dstOffset + i, copyInSv->read(srcOffset + i));
         }
     }
 
+    void copy_out(complex* copyOut) { copy_out(copyOut, 0, capacity); }
+
     void copy_out(complex* copyOut, const bitCapInt offset, const bitCapInt length)
     {
-        for (bitCapInt i = 0; i < length; i++) {
-            copyOut[(bitCapIntOcl)i] = read(i + offset);
+        for (bitCapIntOcl i = 0; i < (bitCapIntOcl)length; i++) {
+            copyOut[i] = readOcl((bitCapIntOcl)offset + i);
         }
     }
 
-    void copy(const StateVectorPtr toCopy) { copy(std::dynamic_pointer_cast<StateVectorSparse>(toCopy)); }
+    void copy(StateVectorPtr toCopy) { copy_in(toCopy, 0, 0, capacity); }
 
-    void copy(StateVectorSparsePtr toCopy)
+    void shuffle(StateVectorPtr svp)
     {
-        mtx.lock();
-        amplitudes = toCopy->amplitudes;
-        mtx.unlock();
-    }
+        const bitCapIntOcl halfCap = ((bitCapIntOcl)capacity) >> ONE_BCI;
 
-    void shuffle(StateVectorPtr svp) { shuffle(std::dynamic_pointer_cast<StateVectorSparse>(svp)); }
+        std::shared_ptr<StateVectorNarrow> svpNarrow = std::dynamic_pointer_cast<StateVectorNarrow>(svp);
+        if (svpNarrow) {
+            std::swap_ranges(amplitudes.get() + (halfCap << 1U), amplitudes.get() + (((bitCapIntOcl)capacity) << 1U),
+                svpNarrow->amplitudes.get());
+            return;
+        }
 
-    void shuffle(StateVectorSparsePtr svp)
-    {
-        complex amp;
-        size_t halfCap = (size_t)(capacity >> ONE_BCI);
-        mtx.lock();
-        for (bitCapInt i = 0; i < halfCap; i++) {
-            amp = svp->read(i);
-            svp->write(i, read(i + halfCap));
-            write(i + halfCap, amp);
+        for (bitCapIntOcl i = 0; i < halfCap; i++) {
+            complex amp = readOcl(halfCap + i);
+            writeOcl(halfCap + i, svp->read(i));
+            svp->write(i, amp);
         }
-        mtx.unlock();
     }
 
     void get_probs(real1* outArray)
     {
-        for (bitCapInt i = 0; i < capacity; i++) {
-            outArray[(bitCapIntOcl)i] = norm(read(i));
+        for (bitCapIntOcl i = 0; i < (bitCapIntOcl)capacity; i++) {
+            outArray[i] = norm(readOcl(i));
         }
     }
 
-    bool is_sparse() { return (amplitudes.size() < (capacity >> ONE_BCI)); }
+    bool is_sparse() { return false; }
+};
 
-    std::vector<bitCapInt> iterable()
-    {
-        int32_t i, combineCount;
+typedef StateVectorNarrow<float> StateVectorFloat;
+typedef StateVectorNarrow<bfloat16> StateVectorBf16;
 
-        int32_t threadCount = GetConcurrencyLevel();
-        std::vector<std::vector<bitCapInt>> toRet(threadCount);
-        std::vector<std::vector<bitCapInt>>::iterator toRetIt;
+/**
+ * A sparse state vector, holding only nonzero amplitudes. The amplitudes are split over QRACK_SPARSE_SHARDS hash
+ * maps, by a hash of their index, and each map has its own lock, so concurrent writers only contend when they land in
+ * the same shard.
+ */
+class StateVectorSparse : public StateVector, public ParallelFor {
+protected:
+    struct Shard {
+        SparseStateVecMap amplitudes;
+        std::mutex mtx;
+    };
 
-        mtx.lock();
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<size_t> ampCount;
 
-        par_for(0, amplitudes.size(), [&](const bitCapInt lcv, const int cpu) {
-            auto it = amplitudes.begin();
-            std::advance(it, lcv);
-            toRet[cpu].push_back(it->first);
-        });
+    static size_t ShardOf(const bitCapInt& i)
+    {
+#if bitsInCap > 64
+        uint64_t h = 0U;
+        for (bitCapInt j = i; j != 0U; j >>= 64U) {
+            h ^= (uint64_t)(j & (bitCapInt)0xFFFFFFFFFFFFFFFFULL);
+        }
+#else
+        uint64_t h = (uint64_t)i;
+#endif
+        // (Fibonacci hashing, so that indices that differ only in high bits still spread over shards)
+        h *= 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h >> (64U - QRACK_SPARSE_SHARD_POW));
+    }
 
-        mtx.unlock();
+    complex readUnlocked(Shard& shard, const bitCapInt& i)
+    {
+        auto it = shard.amplitudes.find(i);
+        return (it == shard.amplitudes.end()) ? ZERO_CMPLX : it->second;
+    }
 
-        for (i = (toRet.size() - 1); i >= 0; i--) {
-            if (toRet[i].size() == 0) {
-                toRetIt = toRet.begin();
-                std::advance(toRetIt, i);
-                toRet.erase(toRetIt);
-            }
+    complex readLocked(Shard& shard, const bitCapInt& i)
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        return readUnlocked(shard, i);
+    }
+
+    /// Set an amplitude, with its shard already locked
+    void writeUnlocked(Shard& shard, const bitCapInt& i, const complex& c)
+    {
+        if (c == ZERO_CMPLX) {
+            ampCount -= shard.amplitudes.erase(i);
+            return;
         }
 
-        if (toRet.size() == 0) {
-            return {};
+        auto it = shard.amplitudes.find(i);
+        if (it != shard.amplitudes.end()) {
+            it->second = c;
+        } else {
+            shard.amplitudes[i] = c;
+            ampCount++;
         }
+    }
 
-        while (toRet.size() > 1U) {
-            // Work odd unit into collapse sequence:
-            if (toRet.size() & 1U) {
-                toRet[toRet.size() - 2U].insert(
-                    toRet[toRet.size() - 2U].end(), toRet[toRet.size() - 1U].begin(), toRet[toRet.size() - 1U].end());
-                toRet.pop_back();
+    /// Call "fn" on every nonzero amplitude, in parallel over shards, each locked while it is visited
+    template <typename Fn> void par_for_shards(Fn&& fn)
+    {
+        par_for(0, QRACK_SPARSE_SHARDS, [&](const bitCapInt& lcv, const int& cpu) {
+            Shard& shard = shards[(size_t)lcv];
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            for (auto it = shard.amplitudes.begin(); it != shard.amplitudes.end(); it++) {
+                fn(it->first, it->second, cpu);
             }
+        });
+    }
 
-            combineCount = toRet.size() / 2U;
-            std::vector<std::future<void>> futures(combineCount);
-            for (i = (combineCount - 1U); i >= 0; i--) {
-                futures[i] = std::async(std::launch::async, [i, combineCount, &toRet]() {
-                    toRet[i].insert(toRet[i].end(), toRet[i + combineCount].begin(), toRet[i + combineCount].end());
-                    toRet[i + combineCount].clear();
-                });
+    /// Zero the amplitudes from "offset" to "offset + length"
+    void clearRange(const bitCapInt& offset, const bitCapInt& length)
+    {
+        bitCapInt end = offset + length;
+        par_for(0, QRACK_SPARSE_SHARDS, [&](const bitCapInt& lcv, const int& cpu) {
+            Shard& shard = shards[(size_t)lcv];
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            for (auto it = shard.amplitudes.begin(); it != shard.amplitudes.end();) {
+                if ((it->first >= offset) && (it->first < end)) {
+                    it = shard.amplitudes.erase(it);
+                    ampCount--;
+                } else {
+                    it++;
+                }
             }
+        });
+    }
 
-            for (i = (combineCount - 1U); i >= 0; i--) {
-                futures[i].get();
-                toRet.pop_back();
+    /// Gather transformed indices of the nonzero amplitudes, (with "fn" returning false to skip one,) one vector per
+    /// thread
+    template <typename Fn> std::vector<bitCapInt> gather(Fn&& fn)
+    {
+        std::vector<std::vector<bitCapInt>> perThread(GetConcurrencyLevel());
+        par_for_shards([&](const bitCapInt& i, const complex& amp, const int& cpu) {
+            bitCapInt toAdd;
+            if (fn(i, toAdd)) {
+                perThread[cpu].push_back(toAdd);
             }
+        });
+
+        size_t total = 0U;
+        for (size_t i = 0U; i < perThread.size(); i++) {
+            total += perThread[i].size();
+        }
+
+        std::vector<bitCapInt> toRet;
+        toRet.reserve(total);
+        for (size_t i = 0U; i < perThread.size(); i++) {
+            toRet.insert(toRet.end(), perThread[i].begin(), perThread[i].end());
         }
 
-        return toRet[0];
+        return toRet;
     }
 
-    /// Returns empty if iteration should be over full set, otherwise just the iterable elements:
-    std::set<bitCapInt> iterable(
-        const bitCapInt& setMask, const bitCapInt& filterMask = 0, const bitCapInt& filterValues = 0)
+public:
+    StateVectorSparse(bitCapInt cap)
+        : StateVector(cap)
+        , shards(new Shard[QRACK_SPARSE_SHARDS])
+        , ampCount(0U)
     {
-        if ((filterMask == 0) && (filterValues != 0)) {
-            return {};
+    }
+
+    complex read(const bitCapInt& i)
+    {
+        Shard& shard = shards[ShardOf(i)];
+        return isReadLocked ? readLocked(shard, i) : readUnlocked(shard, i);
+    }
+
+    void write(const bitCapInt& i, const complex& c)
+    {
+        Shard& shard = shards[ShardOf(i)];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        writeUnlocked(shard, i, c);
+    }
+
+    void write2(const bitCapInt& i1, const complex& c1, const bitCapInt& i2, const complex& c2)
+    {
+        if ((c1 == ZERO_CMPLX) && (c2 == ZERO_CMPLX)) {
+            return;
         }
 
-        int32_t i, combineCount;
+        write(i1, c1);
+        write(i2, c2);
+    }
 
-        bitCapInt unsetMask = ~setMask;
+    void clear()
+    {
+        for (size_t i = 0U; i < QRACK_SPARSE_SHARDS; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mtx);
+            shards[i].amplitudes.clear();
+        }
+        ampCount = 0U;
+    }
 
-        int32_t threadCount = GetConcurrencyLevel();
-        std::vector<std::set<bitCapInt>> toRet(threadCount);
-        std::vector<std::set<bitCapInt>>::iterator toRetIt;
+    void copy_in(const complex* copyIn)
+    {
+        if (!copyIn) {
+            clear();
+            return;
+        }
 
-        mtx.lock();
+        par_for(0, capacity, [&](const bitCapInt& lcv, const int& cpu) { write(lcv, copyIn[(bitCapIntOcl)lcv]); });
+    }
 
-        if ((filterMask == 0) && (filterValues == 0)) {
-            par_for(0, amplitudes.size(), [&](const bitCapInt lcv, const int cpu) {
-                auto it = amplitudes.begin();
-                std::advance(it, lcv);
-                toRet[cpu].insert(it->first & unsetMask);
-            });
-        } else {
-            bitCapInt unfilterMask = ~filterMask;
+    void copy_in(const complex* copyIn, const bitCapInt offset, const bitCapInt length)
+    {
+        if (!copyIn) {
+            clearRange(offset, length);
+            return;
+        }
 
-            par_for(0, amplitudes.size(), [&](const bitCapInt lcv, const int cpu) {
-                auto it = amplitudes.begin();
-                std::advance(it, lcv);
-                if ((it->first & filterMask) == filterValues) {
-                    toRet[cpu].insert(it->first & unsetMask & unfilterMask);
-                }
+        par_for(0, length,
+            [&](const bitCapInt& lcv, const int& cpu) { write(lcv + offset, copyIn[(bitCapIntOcl)lcv]); });
+    }
+
+    void copy_in(StateVectorPtr copyInSv, const bitCapInt srcOffset, const bitCapInt dstOffset, const bitCapInt length)
+    {
+        StateVectorSparsePtr copyIn = std::dynamic_pointer_cast<StateVectorSparse>(copyInSv);
+
+        if (copyInSv && !copyIn) {
+            par_for(0, length, [&](const bitCapInt& lcv, const int& cpu) {
+                write(lcv + dstOffset, copyInSv->read(lcv + srcOffset));
             });
+            return;
         }
 
-        mtx.unlock();
+        clearRange(dstOffset, length);
+        if (!copyIn) {
+            return;
+        }
 
-        for (i = (toRet.size() - 1); i >= 0; i--) {
-            if (toRet[i].size() == 0) {
-                toRetIt = toRet.begin();
-                std::advance(toRetIt, i);
-                toRet.erase(toRetIt);
+        // Only the source's nonzero amplitudes in range need to be visited.
+        bitCapInt srcEnd = srcOffset + length;
+        copyIn->par_for_shards([&](const bitCapInt& i, const complex& amp, const int& cpu) {
+            if ((i >= srcOffset) && (i < srcEnd)) {
+                write(i - srcOffset + dstOffset, amp);
             }
+        });
+    }
+
+    void copy_out(complex* copyOut) { copy_out(copyOut, 0, capacity); }
+
+    void copy_out(complex* copyOut, const bitCapInt offset, const bitCapInt length)
+    {
+        std::fill(copyOut, copyOut + (bitCapIntOcl)length, ZERO_CMPLX);
+        bitCapInt end = offset + length;
+        par_for_shards([&](const bitCapInt& i, const complex& amp, const int& cpu) {
+            if ((i >= offset) && (i < end)) {
+                copyOut[(bitCapIntOcl)(i - offset)] = amp;
+            }
+        });
+    }
+
+    void copy(const StateVectorPtr toCopy)
+    {
+        StateVectorSparsePtr toCopySparse = std::dynamic_pointer_cast<StateVectorSparse>(toCopy);
+        if (toCopySparse) {
+            copy(toCopySparse);
+        } else {
+            copy_in(toCopy, 0, 0, capacity);
         }
+    }
 
-        if (toRet.size() == 0) {
-            mtx.unlock();
-            return {};
+    void copy(StateVectorSparsePtr toCopy)
+    {
+        // Both vectors shard an index alike, so shards copy one to one.
+        for (size_t i = 0U; i < QRACK_SPARSE_SHARDS; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mtx);
+            std::lock_guard<std::mutex> oLock(toCopy->shards[i].mtx);
+            shards[i].amplitudes = toCopy->shards[i].amplitudes;
         }
+        ampCount = toCopy->ampCount.load();
+    }
 
-        while (toRet.size() > 1U) {
-            // Work odd unit into collapse sequence:
-            if (toRet.size() & 1U) {
-                toRet[toRet.size() - 2U].insert(toRet[toRet.size() - 1U].begin(), toRet[toRet.size() - 1U].end());
-                toRet.pop_back();
+    void shuffle(StateVectorPtr svp)
+    {
+        StateVectorSparsePtr svpSparse = std::dynamic_pointer_cast<StateVectorSparse>(svp);
+        const bitCapInt halfCap = capacity >> ONE_BCI;
+
+        if (!svpSparse) {
+            for (bitCapInt i = 0; i < halfCap; i++) {
+                complex amp = svp->read(i);
+                svp->write(i, read(i + halfCap));
+                write(i + halfCap, amp);
             }
+            return;
+        }
 
-            combineCount = toRet.size() / 2U;
-            std::vector<std::future<void>> futures(combineCount);
-            for (i = (combineCount - 1U); i >= 0; i--) {
-                futures[i] = std::async(std::launch::async, [i, combineCount, &toRet]() {
-                    toRet[i].insert(toRet[i + combineCount].begin(), toRet[i + combineCount].end());
-                    toRet[i + combineCount].clear();
-                });
+        // Only nonzero amplitudes move: this vector's high half and the other's low half trade places.
+        std::vector<std::pair<bitCapInt, complex>> highAmps, lowAmps;
+        std::mutex gatherMtx;
+        par_for_shards([&](const bitCapInt& i, const complex& amp, const int& cpu) {
+            if (i >= halfCap) {
+                std::lock_guard<std::mutex> lock(gatherMtx);
+                highAmps.push_back(std::make_pair(i - halfCap, amp));
             }
-
-            for (i = (combineCount - 1U); i >= 0; i--) {
-                futures[i].get();
-                toRet.pop_back();
+        });
+        svpSparse->par_for_shards([&](const bitCapInt& i, const complex& amp, const int& cpu) {
+            if (i < halfCap) {
+                std::lock_guard<std::mutex> lock(gatherMtx);
+                lowAmps.push_back(std::make_pair(i + halfCap, amp));
             }
+        });
+
+        clearRange(halfCap, halfCap);
+        svpSparse->clearRange(0, halfCap);
+        for (size_t i = 0U; i < lowAmps.size(); i++) {
+            write(lowAmps[i].first, lowAmps[i].second);
         }
+        for (size_t i = 0U; i < highAmps.size(); i++) {
+            svpSparse->write(highAmps[i].first, highAmps[i].second);
+        }
+    }
+
+    void get_probs(real1* outArray)
+    {
+        std::fill(outArray, outArray + (bitCapIntOcl)capacity, ZERO_R1);
+        par_for_shards(
+            [&](const bitCapInt& i, const complex& amp, const int& cpu) { outArray[(bitCapIntOcl)i] = norm(amp); });
+    }
+
+    bool is_sparse() { return (ampCount < (capacity >> ONE_BCI)); }
+
+    /// The count of nonzero amplitudes
+    size_t size() { return ampCount; }
+
+    /// The indices of all nonzero amplitudes, in no particular order
+    std::vector<bitCapInt> iterable()
+    {
+        return gather([](const bitCapInt& i, bitCapInt& toAdd) {
+            toAdd = i;
+            return true;
+        });
+    }
+
+    /// Returns empty if iteration should be over full set, otherwise just the iterable elements, sorted and unique:
+    std::vector<bitCapInt> iterable(
+        const bitCapInt& setMask, const bitCapInt& filterMask = 0, const bitCapInt& filterValues = 0)
+    {
+        if ((filterMask == 0) && (filterValues != 0)) {
+            return {};
+        }
+
+        bitCapInt unsetMask = ~setMask;
+        bitCapInt unfilterMask = ~filterMask;
+
+        std::vector<bitCapInt> toRet = gather([&](const bitCapInt& i, bitCapInt& toAdd) {
+            if ((i & filterMask) != filterValues) {
+                return false;
+            }
+            toAdd = i & unsetMask & unfilterMask;
+            return true;
+        });
+
+        std::sort(toRet.begin(), toRet.end());
+        toRet.erase(std::unique(toRet.begin(), toRet.end()), toRet.end());
 
-        return toRet[0];
+        return toRet;
     }
 };
 
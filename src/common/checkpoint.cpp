@@ -0,0 +1,347 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "checkpoint.hpp"
+#include "threadpool.hpp"
+
+#if ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace Qrack {
+
+// One chunk of a state vector, both as amplitudes and as it's stored in the stream
+struct CheckpointChunk {
+    std::vector<complex> amps;
+    std::vector<uint8_t> packed;
+};
+
+static int32_t CheckpointThreads()
+{
+    int32_t threadCount = (int32_t)std::thread::hardware_concurrency();
+    return (threadCount < 1) ? 1 : threadCount;
+}
+
+QCheckpointWriter::QCheckpointWriter(std::ostream& stream, bool compress)
+    : os(stream)
+#if ENABLE_ZLIB
+    , doCompress(compress)
+#else
+    , doCompress(false)
+#endif
+    , threadCount(doCompress ? CheckpointThreads() : 1)
+{
+    if (doCompress) {
+        ThreadPool::Instance()->Reserve(threadCount);
+    }
+}
+
+void QCheckpointWriter::WriteBytes(const void* data, size_t length)
+{
+    os.write((const char*)data, length);
+    if (!os) {
+        throw std::runtime_error("Failed to write checkpoint stream.");
+    }
+}
+
+void QCheckpointWriter::WriteHeader()
+{
+    Write((uint64_t)QRACK_CHECKPOINT_MAGIC);
+    Write((uint8_t)QRACK_CHECKPOINT_VERSION);
+}
+
+void QCheckpointWriter::Write(const complex& value)
+{
+    const real1 parts[2] = { real(value), imag(value) };
+    WriteBytes(parts, sizeof(parts));
+}
+
+void QCheckpointWriter::Write(const std::vector<uint64_t>& values)
+{
+    Write((uint64_t)values.size());
+    if (values.size()) {
+        WriteBytes(&(values[0]), values.size() * sizeof(uint64_t));
+    }
+}
+
+void QCheckpointWriter::Write(const std::vector<uint8_t>& values)
+{
+    Write((uint64_t)values.size());
+    if (values.size()) {
+        WriteBytes(&(values[0]), values.size());
+    }
+}
+
+void QCheckpointWriter::WriteAmplitudes(const bitLenInt& qubitCount, GetPageFn getPage)
+{
+    const bitCapIntOcl maxQPower = (bitCapIntOcl)1U << (bitCapIntOcl)qubitCount;
+    const bitCapIntOcl chunkAmps = std::min(maxQPower, (bitCapIntOcl)QRACK_CHECKPOINT_CHUNK_AMPS);
+    const bitCapIntOcl chunkCount = maxQPower / chunkAmps;
+    const size_t chunkBytes = chunkAmps * sizeof(complex);
+
+    WriteRecord(CHECKPOINT_AMPLITUDES, qubitCount);
+    Write((uint8_t)sizeof(real1));
+    Write(doCompress);
+    Write((uint64_t)chunkAmps);
+
+    // Two batches of chunks: one is written to the stream, while the other is read from the register and compressed.
+    const bitCapIntOcl batchSize = std::min((bitCapIntOcl)threadCount, chunkCount);
+    std::vector<CheckpointChunk> batches[2];
+    for (int i = 0; i < 2; i++) {
+        batches[i].resize(batchSize);
+        for (bitCapIntOcl j = 0; j < batchSize; j++) {
+            batches[i][j].amps.resize(chunkAmps);
+        }
+    }
+
+    std::future<void> writing;
+    int parity = 0;
+    for (bitCapIntOcl base = 0; base < chunkCount; base += batchSize) {
+        std::vector<CheckpointChunk>& batch = batches[parity];
+        const bitCapIntOcl count = std::min(batchSize, chunkCount - base);
+
+        for (bitCapIntOcl j = 0; j < count; j++) {
+            getPage(&(batch[j].amps[0]), (base + j) * chunkAmps, chunkAmps);
+        }
+
+#if ENABLE_ZLIB
+        if (doCompress) {
+            ThreadPool::Instance()->RunAll((int32_t)count, [&](const int32_t j) {
+                std::vector<uint8_t>& packed = batch[j].packed;
+                uLongf packedBytes = compressBound(chunkBytes);
+                packed.resize(packedBytes);
+                compress2(&(packed[0]), &packedBytes, (const Bytef*)&(batch[j].amps[0]), chunkBytes, Z_BEST_SPEED);
+                packed.resize(packedBytes);
+            });
+        }
+#endif
+
+        if (writing.valid()) {
+            writing.get();
+        }
+        writing = std::async(std::launch::async, [this, &batch, count, chunkBytes]() {
+            for (bitCapIntOcl j = 0; j < count; j++) {
+                if (doCompress) {
+                    Write(batch[j].packed);
+                } else {
+                    WriteBytes(&(batch[j].amps[0]), chunkBytes);
+                }
+            }
+        });
+
+        parity ^= 1;
+    }
+
+    if (writing.valid()) {
+        writing.get();
+    }
+}
+
+QCheckpointReader::QCheckpointReader(std::istream& stream)
+    : is(stream)
+    , threadCount(CheckpointThreads())
+{
+    ThreadPool::Instance()->Reserve(threadCount);
+}
+
+void QCheckpointReader::ReadBytes(void* data, size_t length)
+{
+    is.read((char*)data, length);
+    if (!is) {
+        throw std::runtime_error("Failed to read checkpoint stream.");
+    }
+}
+
+void QCheckpointReader::ReadHeader()
+{
+    uint64_t magic;
+    uint8_t version;
+    Read(magic);
+    Read(version);
+    if ((magic != QRACK_CHECKPOINT_MAGIC) || (version != QRACK_CHECKPOINT_VERSION)) {
+        throw std::invalid_argument("Stream is not a Qrack checkpoint, or is from an unsupported version.");
+    }
+}
+
+void QCheckpointReader::Read(bool& value)
+{
+    uint8_t byte;
+    Read(byte);
+    value = (byte != 0U);
+}
+
+void QCheckpointReader::Read(complex& value)
+{
+    real1 parts[2];
+    ReadBytes(parts, sizeof(parts));
+    value = complex(parts[0], parts[1]);
+}
+
+void QCheckpointReader::Read(std::vector<uint64_t>& values, const size_t& length)
+{
+    uint64_t size;
+    Read(size);
+    if (size != length) {
+        throw std::invalid_argument("Checkpoint vector length doesn't match the register restoring it.");
+    }
+    values.resize(size);
+    if (size) {
+        ReadBytes(&(values[0]), size * sizeof(uint64_t));
+    }
+}
+
+void QCheckpointReader::Read(std::vector<uint8_t>& values, const size_t& length)
+{
+    uint64_t size;
+    Read(size);
+    if (size != length) {
+        throw std::invalid_argument("Checkpoint vector length doesn't match the register restoring it.");
+    }
+    values.resize(size);
+    if (size) {
+        ReadBytes(&(values[0]), size);
+    }
+}
+
+void QCheckpointReader::ReadPacked(std::vector<uint8_t>& values, const size_t& maxLength)
+{
+    uint64_t size;
+    Read(size);
+    if (size > maxLength) {
+        throw std::invalid_argument("Checkpoint amplitude chunk is corrupt.");
+    }
+    values.resize(size);
+    if (size) {
+        ReadBytes(&(values[0]), size);
+    }
+}
+
+void QCheckpointReader::ReadRecord(const QCheckpointRecord& tag, const bitLenInt& qubitCount)
+{
+    uint8_t rTag;
+    uint64_t rQubitCount;
+    Read(rTag);
+    Read(rQubitCount);
+    if (rTag != (uint8_t)tag) {
+        throw std::invalid_argument("Checkpoint record doesn't match the type of register restoring it.");
+    }
+    if (rQubitCount != qubitCount) {
+        throw std::invalid_argument("Checkpoint record doesn't match the width of register restoring it.");
+    }
+}
+
+void QCheckpointReader::ReadAmplitudes(const bitLenInt& qubitCount, SetPageFn setPage)
+{
+    ReadRecord(CHECKPOINT_AMPLITUDES, qubitCount);
+
+    uint8_t realBytes;
+    bool isCompressed;
+    uint64_t rChunkAmps;
+    Read(realBytes);
+    Read(isCompressed);
+    Read(rChunkAmps);
+
+    const bitCapIntOcl maxQPower = (bitCapIntOcl)1U << (bitCapIntOcl)qubitCount;
+    const bitCapIntOcl chunkAmps = (bitCapIntOcl)rChunkAmps;
+    if (realBytes != sizeof(real1)) {
+        throw std::invalid_argument("Checkpoint amplitudes were written at a different floating point precision.");
+    }
+    if (!chunkAmps || (chunkAmps > maxQPower) || (maxQPower % chunkAmps)) {
+        throw std::invalid_argument("Checkpoint amplitude chunk size is invalid.");
+    }
+#if !ENABLE_ZLIB
+    if (isCompressed) {
+        throw std::invalid_argument("Checkpoint is compressed, but Qrack was built without zlib.");
+    }
+#endif
+
+    const bitCapIntOcl chunkCount = maxQPower / chunkAmps;
+    const size_t chunkBytes = chunkAmps * sizeof(complex);
+
+    // Two batches of chunks: the next is read from the stream, while the other is inflated and copied to the register.
+    const bitCapIntOcl batchSize = std::min((bitCapIntOcl)(isCompressed ? threadCount : 1), chunkCount);
+    std::vector<CheckpointChunk> batches[2];
+    for (int i = 0; i < 2; i++) {
+        batches[i].resize(batchSize);
+        for (bitCapIntOcl j = 0; j < batchSize; j++) {
+            batches[i][j].amps.resize(chunkAmps);
+        }
+    }
+
+#if ENABLE_ZLIB
+    const size_t maxPackedBytes = compressBound(chunkBytes);
+#else
+    const size_t maxPackedBytes = 0U;
+#endif
+    auto readBatch = [this, isCompressed, chunkBytes, maxPackedBytes](
+                         std::vector<CheckpointChunk>& batch, bitCapIntOcl count) {
+        for (bitCapIntOcl j = 0; j < count; j++) {
+            if (isCompressed) {
+                ReadPacked(batch[j].packed, maxPackedBytes);
+            } else {
+                ReadBytes(&(batch[j].amps[0]), chunkBytes);
+            }
+        }
+    };
+
+    readBatch(batches[0], std::min(batchSize, chunkCount));
+    int parity = 0;
+    for (bitCapIntOcl base = 0; base < chunkCount; base += batchSize) {
+        std::vector<CheckpointChunk>& batch = batches[parity];
+        const bitCapIntOcl count = std::min(batchSize, chunkCount - base);
+
+        std::future<void> reading;
+        const bitCapIntOcl nBase = base + batchSize;
+        if (nBase < chunkCount) {
+            std::vector<CheckpointChunk>& nBatch = batches[parity ^ 1];
+            const bitCapIntOcl nCount = std::min(batchSize, chunkCount - nBase);
+            reading = std::async(std::launch::async, [&readBatch, &nBatch, nCount]() { readBatch(nBatch, nCount); });
+        }
+
+#if ENABLE_ZLIB
+        if (isCompressed) {
+            std::atomic<bool> isCorrupt(false);
+            ThreadPool::Instance()->RunAll((int32_t)count, [&](const int32_t j) {
+                uLongf ampBytes = chunkBytes;
+                const std::vector<uint8_t>& packed = batch[j].packed;
+                if ((uncompress((Bytef*)&(batch[j].amps[0]), &ampBytes, &(packed[0]), packed.size()) != Z_OK) ||
+                    (ampBytes != chunkBytes)) {
+                    isCorrupt = true;
+                }
+            });
+            if (isCorrupt) {
+                if (reading.valid()) {
+                    reading.wait();
+                }
+                throw std::invalid_argument("Checkpoint amplitude chunk is corrupt.");
+            }
+        }
+#endif
+
+        for (bitCapIntOcl j = 0; j < count; j++) {
+            setPage(&(batch[j].amps[0]), (base + j) * chunkAmps, chunkAmps);
+        }
+
+        if (reading.valid()) {
+            reading.get();
+        }
+
+        parity ^= 1;
+    }
+}
+} // namespace Qrack
@@ -10,9 +10,7 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
-// From https://github.com/embeddedartistry/embedded-resources/blob/master/examples/cpp/dispatch.cpp
-
-#include <chrono>
+// Originally from https://github.com/embeddedartistry/embedded-resources/blob/master/examples/cpp/dispatch.cpp
 
 #include "config.h"
 #include "dispatchqueue.hpp"
@@ -20,8 +18,12 @@
 namespace Qrack {
 
 DispatchQueue::DispatchQueue()
-    : quit_(false)
-    , isFinished_(true)
+    : tail_(0U)
+    , dumpTo_(0U)
+    , head_(0U)
+    , quit_(false)
+    , isConsumerParked_(false)
+    , isProducerParked_(false)
     , isStarted_(false)
 {
 }
@@ -32,100 +34,127 @@ DispatchQueue::~DispatchQueue()
         return;
     }
 
-    std::unique_lock<std::mutex> lock(lock_);
-    quit_ = true;
-    lock.unlock();
-    cv_.notify_all();
+    // Anything still queued is released without running, then the thread exits.
+    dumpTo_.store(tail_.load(std::memory_order_relaxed));
+    {
+        std::lock_guard<std::mutex> lock(parkLock_);
+        quit_.store(true);
+    }
+    consumerCv_.notify_one();
 
     // Wait for thread to finish before we exit
     thread_.get();
-
-    isFinished_ = true;
-    cvFinished_.notify_all();
 }
 
-void DispatchQueue::finish()
+DispatchQueue::Slot& DispatchQueue::AcquireSlot()
 {
     if (!isStarted_) {
-        return;
+        isStarted_ = true;
+        ring_.reset(new Slot[QRACK_DISPATCH_RING_SIZE]);
+        thread_ = std::async(std::launch::async, [this] { dispatch_thread_handler(); });
+    }
+
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if ((tail - head_.load(std::memory_order_acquire)) >= QRACK_DISPATCH_RING_SIZE) {
+        // The ring is full, so wait for the oldest slot.
+        WaitForHead(tail + 1U - QRACK_DISPATCH_RING_SIZE);
     }
 
-    std::unique_lock<std::mutex> lock(lock_);
-    cvFinished_.wait(lock, [this] { return isFinished_; });
+    return ring_[tail & (QRACK_DISPATCH_RING_SIZE - 1U)];
 }
 
-void DispatchQueue::dump()
+void DispatchQueue::Publish()
 {
-    if (!isStarted_) {
-        return;
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1U);
+
+    // (Sequentially consistent, against the consumer's store of this flag and its load of tail_)
+    if (isConsumerParked_.load()) {
+        {
+            std::lock_guard<std::mutex> lock(parkLock_);
+        }
+        consumerCv_.notify_one();
+    }
+}
+
+void DispatchQueue::WaitForHead(const uint64_t& count)
+{
+    for (uint32_t i = 0; i < QRACK_DISPATCH_SPIN_COUNT; i++) {
+        if (head_.load(std::memory_order_acquire) >= count) {
+            return;
+        }
     }
 
-    std::unique_lock<std::mutex> lock(lock_);
-    std::queue<fp_t> empty;
-    std::swap(q_, empty);
-    isFinished_ = true;
-    lock.unlock();
-    cvFinished_.notify_all();
+    std::unique_lock<std::mutex> lock(parkLock_);
+    isProducerParked_.store(true);
+    producerCv_.wait(lock, [this, &count] { return head_.load() >= count; });
+    isProducerParked_.store(false);
 }
 
-void DispatchQueue::dispatch(const fp_t& op)
+void DispatchQueue::finish()
 {
-    std::unique_lock<std::mutex> lock(lock_);
-    q_.push(op);
-    isFinished_ = false;
     if (!isStarted_) {
-        isStarted_ = true;
-        thread_ = std::async(std::launch::async, [this] { dispatch_thread_handler(); });
+        return;
     }
 
-    // Manual unlocking is done before notifying, to avoid waking up
-    // the waiting thread only to block again (see notify_one for details)
-    lock.unlock();
-    cv_.notify_one();
+    WaitForHead(tail_.load(std::memory_order_relaxed));
 }
 
-void DispatchQueue::dispatch(fp_t&& op)
+void DispatchQueue::dump()
 {
-    std::unique_lock<std::mutex> lock(lock_);
-    q_.push(std::move(op));
-    isFinished_ = false;
     if (!isStarted_) {
-        isStarted_ = true;
-        thread_ = std::async(std::launch::async, [this] { dispatch_thread_handler(); });
+        return;
     }
 
-    // Manual unlocking is done before notifying, to avoid waking up
-    // the waiting thread only to block again (see notify_one for details)
-    lock.unlock();
-    cv_.notify_one();
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    dumpTo_.store(tail);
+    WaitForHead(tail);
 }
 
 void DispatchQueue::dispatch_thread_handler(void)
 {
-    std::unique_lock<std::mutex> lock(lock_);
-
-    do {
-        // Wait until we have data or a quit signal
-        cv_.wait(lock, [this] { return (q_.size() || quit_); });
-
-        // after wait, we own the lock
-        if (!quit_ && q_.size()) {
-            auto op = std::move(q_.front());
-            q_.pop();
-
-            // unlock now that we're done messing with the queue
-            lock.unlock();
+    uint64_t head = head_.load(std::memory_order_relaxed);
+
+    while (true) {
+        if (head == tail_.load(std::memory_order_acquire)) {
+            bool isReady = false;
+            for (uint32_t i = 0; i < QRACK_DISPATCH_SPIN_COUNT; i++) {
+                if ((head != tail_.load(std::memory_order_acquire)) || quit_.load(std::memory_order_relaxed)) {
+                    isReady = true;
+                    break;
+                }
+            }
 
-            op();
+            if (!isReady) {
+                std::unique_lock<std::mutex> lock(parkLock_);
+                isConsumerParked_.store(true);
+                consumerCv_.wait(lock, [this, &head] { return (head != tail_.load()) || quit_.load(); });
+                isConsumerParked_.store(false);
+            }
 
-            lock.lock();
+            if (head == tail_.load(std::memory_order_acquire)) {
+                if (quit_.load()) {
+                    return;
+                }
+                continue;
+            }
+        }
 
-            if (!q_.size()) {
-                isFinished_ = true;
-                cvFinished_.notify_all();
+        Slot& slot = ring_[head & (QRACK_DISPATCH_RING_SIZE - 1U)];
+        if (head >= dumpTo_.load(std::memory_order_acquire)) {
+            slot.invoke(slot.storage);
+        }
+        slot.destroy(slot.storage);
+
+        head++;
+        // (Sequentially consistent, against the producer's store of its parked flag and its load of head_)
+        head_.store(head);
+        if (isProducerParked_.load()) {
+            {
+                std::lock_guard<std::mutex> lock(parkLock_);
             }
+            producerCv_.notify_one();
         }
-    } while (!quit_);
+    }
 }
 
 } // namespace Qrack
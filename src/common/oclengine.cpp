@@ -10,10 +10,23 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "oclengine.hpp"
+#include "qprofiler.hpp"
 
 #if ENABLE_PURE32
 #include "qheader32cl.hpp"
@@ -24,9 +37,91 @@
 #endif
 
 #include "qenginecl.hpp"
+#include "qspecializecl.hpp"
 
 namespace Qrack {
 
+static const char* oclBuildOptions = "-cl-denorms-are-zero -cl-fast-relaxed-math";
+
+OCLSpecializedKernelPtr OCLDeviceContext::GetSpecialized(const std::string& kernelName, const std::string& defines)
+{
+    if (!isSpecializing) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(specMutex);
+
+    const std::string key = kernelName + "\n" + defines;
+    auto found = specializations.find(key);
+    if (found == specializations.end()) {
+        if (specializations.size() >= QRACK_OCL_SPEC_MAX_KEYS) {
+            return nullptr;
+        }
+        found = specializations.emplace(key, std::make_shared<OCLSpecializedKernel>(kernelName, defines)).first;
+    }
+
+    OCLSpecializedKernelPtr spec = found->second;
+    if (!spec->isBuilt.valid()) {
+        spec->useCount++;
+        if ((spec->useCount >= QRACK_OCL_SPEC_HOT_COUNT) && (specBuildCount < QRACK_OCL_SPEC_MAX_KERNELS)) {
+            specBuildCount++;
+            spec->isBuilt = std::async(std::launch::async, [this, spec]() { return BuildSpecialized(spec); }).share();
+        }
+        return nullptr;
+    }
+
+    if (spec->isBuilt.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return nullptr;
+    }
+
+    return spec->isBuilt.get() ? spec : nullptr;
+}
+
+bool OCLDeviceContext::BuildSpecialized(OCLSpecializedKernelPtr spec)
+{
+    cl::Program::Sources sources;
+#if ENABLE_PURE32
+    sources.push_back({ (const char*)qheader32_cl, (long unsigned int)qheader32_cl_len });
+#elif ENABLE_COMPLEX8
+    sources.push_back({ (const char*)qheader_float_cl, (long unsigned int)qheader_float_cl_len });
+#else
+    sources.push_back({ (const char*)qheader_double_cl, (long unsigned int)qheader_double_cl_len });
+#endif
+    sources.push_back({ spec->defines.c_str(), (long unsigned int)spec->defines.size() });
+    sources.push_back({ (const char*)qspecialize_cl, (long unsigned int)qspecialize_cl_len });
+
+    // These programs are small, and keyed on exact matrix entries, so they aren't added to the binary cache.
+    cl::Program program(context, sources);
+    if (program.build({ device }, oclBuildOptions) != CL_SUCCESS) {
+        return false;
+    }
+
+    cl_int error;
+    cl::Kernel kernel(program, spec->kernelName.c_str(), &error);
+    if (error != CL_SUCCESS) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(spec->mutex);
+    spec->program = program;
+    spec->kernel = kernel;
+
+    return true;
+}
+
+std::shared_ptr<cl::Buffer> OCLLookupTable::GetBuffer(DeviceContextPtr devCntxt)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    std::shared_ptr<cl::Buffer>& buffer = buffers[devCntxt->context_id];
+    if (!buffer) {
+        buffer = std::make_shared<cl::Buffer>(
+            devCntxt->context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, size, (void*)values);
+    }
+
+    return buffer;
+}
+
 /// "Qrack::OCLEngine" manages the single OpenCL context
 
 // Public singleton methods to get pointers to various methods
@@ -51,6 +146,9 @@ const std::vector<OCLKernelHandle> OCLEngine::kernelHandles = {
     OCLKernelHandle(OCL_API_APPLY2X2_SINGLE_WIDE, "apply2x2singlewide"),
     OCLKernelHandle(OCL_API_APPLY2X2_NORM_SINGLE_WIDE, "apply2x2normsinglewide"),
     OCLKernelHandle(OCL_API_APPLY2X2_DOUBLE_WIDE, "apply2x2doublewide"),
+    OCLKernelHandle(OCL_API_APPLYNXN, "applynxn"),
+    OCLKernelHandle(OCL_API_APPLY2X2_TILED, "apply2x2tiled"),
+    OCLKernelHandle(OCL_API_APPLY2X2_EACH, "apply2x2each"),
     OCLKernelHandle(OCL_API_PHASE_SINGLE, "phasesingle"),
     OCLKernelHandle(OCL_API_PHASE_SINGLE_WIDE, "phasesinglewide"),
     OCLKernelHandle(OCL_API_INVERT_SINGLE, "invertsingle"),
@@ -59,6 +157,10 @@ const std::vector<OCLKernelHandle> OCLEngine::kernelHandles = {
     OCLKernelHandle(OCL_API_UNIFORMPARITYRZ, "uniformparityrz"),
     OCLKernelHandle(OCL_API_UNIFORMPARITYRZ_NORM, "uniformparityrznorm"),
     OCLKernelHandle(OCL_API_CUNIFORMPARITYRZ, "cuniformparityrz"),
+    OCLKernelHandle(OCL_API_QFT_RADIX2, "qftradix2"),
+    OCLKernelHandle(OCL_API_QFT_RADIX4, "qftradix4"),
+    OCLKernelHandle(OCL_API_GROVER_DIFFUSION_SUM, "groverdiffusionsum"),
+    OCLKernelHandle(OCL_API_GROVER_DIFFUSION, "groverdiffusion"),
     OCLKernelHandle(OCL_API_X_SINGLE, "xsingle"),
     OCLKernelHandle(OCL_API_X_SINGLE_WIDE, "xsinglewide"),
     OCLKernelHandle(OCL_API_Z_SINGLE, "zsingle"),
@@ -74,8 +176,12 @@ const std::vector<OCLKernelHandle> OCLEngine::kernelHandles = {
     OCLKernelHandle(OCL_API_PROBREGALL, "probregall"),
     OCLKernelHandle(OCL_API_PROBMASK, "probmask"),
     OCLKernelHandle(OCL_API_PROBMASKALL, "probmaskall"),
+    OCLKernelHandle(OCL_API_PROBCDF, "probcdf"),
+    OCLKernelHandle(OCL_API_PROBCDFADD, "probcdfadd"),
+    OCLKernelHandle(OCL_API_SAMPLECDF, "samplecdf"),
     OCLKernelHandle(OCL_API_PROBPARITY, "probparity"),
     OCLKernelHandle(OCL_API_FORCEMPARITY, "forcemparity"),
+    OCLKernelHandle(OCL_API_EXPECTATIONPAULI, "expectationpauli"),
     OCLKernelHandle(OCL_API_ROL, "rol"),
     OCLKernelHandle(OCL_API_INC, "inc"),
     OCLKernelHandle(OCL_API_CINC, "cinc"),
@@ -129,50 +235,105 @@ void OCLEngine::SetDeviceContextPtrVector(std::vector<DeviceContextPtr> vec, Dev
 
 void OCLEngine::SetDefaultDeviceContext(DeviceContextPtr dcp) { default_device_context = dcp; }
 
+OCLLookupTablePtr OCLEngine::RegisterTable(const unsigned char* values, size_t size)
+{
+    std::lock_guard<std::mutex> guard(tablesMutex);
+
+    // Entries of handles that have since been released are pruned here.
+    for (auto it = tables.begin(); it != tables.end();) {
+        if (it->second.expired()) {
+            it = tables.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    OCLLookupTablePtr table = tables[values].lock();
+    if (!table || (table->GetSize() != size)) {
+        table = std::make_shared<OCLLookupTable>(values, size);
+        tables[values] = table;
+    }
+
+    return table;
+}
+
+OCLLookupTablePtr OCLEngine::GetTable(const unsigned char* values, size_t size)
+{
+    std::lock_guard<std::mutex> guard(tablesMutex);
+
+    auto it = tables.find(values);
+    if (it == tables.end()) {
+        return nullptr;
+    }
+
+    OCLLookupTablePtr table = it->second.lock();
+    if (!table || (table->GetSize() < size)) {
+        return nullptr;
+    }
+
+    return table;
+}
+
 OCLEngine::OCLEngine(OCLEngine const&) {}
 OCLEngine& OCLEngine::operator=(OCLEngine const& rhs) { return *this; }
 
-cl::Program OCLEngine::MakeProgram(
-    bool buildFromSource, cl::Program::Sources sources, std::string path, std::shared_ptr<OCLDeviceContext> devCntxt)
+cl::Program OCLEngine::MakeProgram(bool buildFromSource, cl::Program::Sources sources, std::vector<std::string> paths,
+    std::shared_ptr<OCLDeviceContext> devCntxt, bool& isBinary)
 {
     FILE* clBinFile;
     cl::Program program;
     cl_int buildError = -1;
     std::vector<int> binaryStatus;
-    if (!buildFromSource && (clBinFile = fopen(path.c_str(), "r"))) {
+    for (size_t i = 0; !buildFromSource && (buildError != CL_SUCCESS) && (i < paths.size()); i++) {
+        std::string path = paths[i];
+        if (!(clBinFile = fopen(path.c_str(), "rb"))) {
+            continue;
+        }
+
         struct stat statSize;
         if (fstat(fileno(clBinFile), &statSize)) {
+            fclose(clBinFile);
             std::cout << "Binary error: Invalid file fstat result. (Falling back to JIT.)" << std::endl;
-        } else {
-            unsigned long lSize = statSize.st_size;
-            unsigned long lSizeResult;
+            continue;
+        }
 
-            std::vector<unsigned char> buffer(lSize);
-            lSizeResult = fread(&buffer[0], sizeof(unsigned char), lSize, clBinFile);
-            fclose(clBinFile);
+        unsigned long lSize = statSize.st_size;
+        unsigned long lSizeResult;
 
-            if (lSizeResult != lSize) {
-                std::cout << "Binary warning: Binary file size and read result length do not match. (Attempting to "
-                             "build anyway.)"
-                          << std::endl;
-            }
+        std::vector<unsigned char> buffer(lSize);
+        lSizeResult = lSize ? fread(&buffer[0], sizeof(unsigned char), lSize, clBinFile) : 0;
+        fclose(clBinFile);
+
+        if (!lSize) {
+            std::cout << "Binary error: Empty binary file. (Falling back to JIT.)" << std::endl;
+            continue;
+        }
 
+        if (lSizeResult != lSize) {
+            std::cout << "Binary warning: Binary file size and read result length do not match. (Attempting to "
+                         "build anyway.)"
+                      << std::endl;
+        }
+
+        binaryStatus.clear();
 #if defined(__APPLE__) || (defined(_WIN32) && !defined(__CYGWIN__)) || ENABLE_SNUCL
-            program = cl::Program(devCntxt->context, { devCntxt->device },
-                { std::pair<const void*, unsigned long>(&buffer[0], buffer.size()) }, &binaryStatus, &buildError);
+        program = cl::Program(devCntxt->context, { devCntxt->device },
+            { std::pair<const void*, unsigned long>(&buffer[0], buffer.size()) }, &binaryStatus, &buildError);
 #else
-            program = cl::Program(devCntxt->context, { devCntxt->device }, { buffer }, &binaryStatus, &buildError);
+        program = cl::Program(devCntxt->context, { devCntxt->device }, { buffer }, &binaryStatus, &buildError);
 #endif
 
-            if ((buildError != CL_SUCCESS) || (binaryStatus[0] != CL_SUCCESS)) {
-                std::cout << "Binary error: " << buildError << ", " << binaryStatus[0] << " (Falling back to JIT.)"
-                          << std::endl;
-            } else {
-                std::cout << "Loaded binary from: " << path << std::endl;
-            }
+        if ((buildError != CL_SUCCESS) || (binaryStatus[0] != CL_SUCCESS)) {
+            std::cout << "Binary error: " << buildError << ", " << binaryStatus[0] << " (Falling back to JIT.)"
+                      << std::endl;
+            buildError = -1;
+        } else {
+            std::cout << "Loaded binary from: " << path << std::endl;
         }
     }
 
+    isBinary = (buildError == CL_SUCCESS);
+
     // If, either, there are no cached binaries, or binary loading failed, then fall back to JIT.
     if (buildError != CL_SUCCESS) {
         program = cl::Program(devCntxt->context, sources);
@@ -207,17 +368,201 @@ void OCLEngine::SaveBinary(cl::Program program, std::string path, std::string fi
         std::cout << "Making directory: " << path << std::endl;
     }
 
-    FILE* clBinFile = fopen((path + fileName).c_str(), "w");
+    // Several short-lived workers might start, and cache, at the same time, so write to a file private to this process,
+    // then move it into place, so that no reader ever sees a partial binary.
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    std::string tempName = path + fileName + ".tmp" + std::to_string(_getpid());
+#else
+    std::string tempName = path + fileName + ".tmp" + std::to_string(getpid());
+#endif
+    FILE* clBinFile = fopen(tempName.c_str(), "wb");
+    if (!clBinFile) {
+        std::cout << "Binary error: Could not open " << tempName << " for writing. (Binary not saved.)" << std::endl;
+        return;
+    }
 #if defined(__APPLE__) || (defined(_WIN32) && !defined(__CYGWIN__)) || ENABLE_SNUCL
     std::vector<char*> clBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
     char* clBinary = clBinaries[clBinIndex];
-    fwrite(clBinary, clBinSize, sizeof(char), clBinFile);
+    size_t written = fwrite(clBinary, sizeof(char), clBinSize, clBinFile);
 #else
     std::vector<std::vector<unsigned char>> clBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
     std::vector<unsigned char> clBinary = clBinaries[clBinIndex];
-    fwrite(&clBinary[0], clBinSize, sizeof(unsigned char), clBinFile);
+    size_t written = fwrite(&clBinary[0], sizeof(unsigned char), clBinSize, clBinFile);
 #endif
     fclose(clBinFile);
+
+    if (written != clBinSize) {
+        std::cout << "Binary error: Short write to " << tempName << ". (Binary not saved.)" << std::endl;
+        remove(tempName.c_str());
+        return;
+    }
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    // Windows won't rename over an existing file.
+    remove((path + fileName).c_str());
+#endif
+    if (rename(tempName.c_str(), (path + fileName).c_str())) {
+        remove(tempName.c_str());
+    }
+}
+
+std::string OCLEngine::GetBinaryCacheFileName(cl::Platform platform, cl::Device device, std::string buildOptions)
+{
+    // 64-bit FNV-1a is plenty to tell apart the handful of source, driver, and flag combinations a host sees.
+    uint64_t hash = 14695981039346656037ULL;
+    auto hashBytes = [&hash](const unsigned char* bytes, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    auto hashString = [&hashBytes](std::string str) {
+        // Include the terminator, so that adjacent fields can't run together.
+        hashBytes((const unsigned char*)str.c_str(), str.size() + 1U);
+    };
+
+#if ENABLE_PURE32
+    hashBytes(qheader32_cl, qheader32_cl_len);
+    hashString("PURE32");
+#elif ENABLE_COMPLEX8
+    hashBytes(qheader_float_cl, qheader_float_cl_len);
+    hashString("COMPLEX8");
+#else
+    hashBytes(qheader_double_cl, qheader_double_cl_len);
+    hashString("COMPLEX16");
+#endif
+    hashBytes(qengine_cl, qengine_cl_len);
+    hashString(buildOptions);
+    hashString(platform.getInfo<CL_PLATFORM_NAME>());
+    hashString(platform.getInfo<CL_PLATFORM_VERSION>());
+    hashString(device.getInfo<CL_DEVICE_VENDOR>());
+    hashString(device.getInfo<CL_DEVICE_NAME>());
+    hashString(device.getInfo<CL_DEVICE_VERSION>());
+    hashString(device.getInfo<CL_DRIVER_VERSION>());
+
+    std::stringstream name;
+    name << binary_file_prefix << std::hex << std::setw(16) << std::setfill('0') << hash << binary_file_ext;
+
+    return name.str();
+}
+
+bool OCLEngine::BuildProgram(DeviceContextPtr devCntxt)
+{
+    // create the programs that we want to execute on the devices
+    cl::Program::Sources sources;
+
+#if ENABLE_PURE32
+    sources.push_back({ (const char*)qheader32_cl, (long unsigned int)qheader32_cl_len });
+#elif ENABLE_COMPLEX8
+    sources.push_back({ (const char*)qheader_float_cl, (long unsigned int)qheader_float_cl_len });
+#else
+    sources.push_back({ (const char*)qheader_double_cl, (long unsigned int)qheader_double_cl_len });
+#endif
+    sources.push_back({ (const char*)qengine_cl, (long unsigned int)qengine_cl_len });
+
+    const std::string buildOptions(oclBuildOptions);
+    bool isCaching = !getenv("QRACK_OCL_NO_BINARY_CACHE");
+    const int i = devCntxt->device_id;
+
+    std::string fileName = binary_file_prefix + std::to_string(i) + binary_file_ext;
+    // (Device info can only be queried once the context of the device exists, for VirtualCL.)
+    std::string cacheFileName =
+        isCaching ? GetBinaryCacheFileName(devCntxt->platform, devCntxt->device, buildOptions) : std::string();
+
+    // A binary keyed on this exact build is preferred over one saved by device index, (which might be stale).
+    std::vector<std::string> clBinNames;
+    if (isCaching) {
+        clBinNames.push_back(binaryHome + cacheFileName);
+    }
+    clBinNames.push_back(binaryHome + fileName);
+
+    std::cout << "Device #" << i << ", ";
+    bool isBinary = false;
+    cl::Program program = MakeProgram(isBuildingFromSource, sources, clBinNames, devCntxt, isBinary);
+
+    cl_int buildError = program.build({ devCntxt->device }, buildOptions.c_str());
+    if ((buildError != CL_SUCCESS) && isBinary) {
+        std::cout << "Binary error: " << buildError << " (Falling back to JIT.)" << std::endl;
+        program = MakeProgram(true, sources, clBinNames, devCntxt, isBinary);
+        buildError = program.build({ devCntxt->device }, buildOptions.c_str());
+    }
+    if (buildError != CL_SUCCESS) {
+        std::cout << "Error building for device #" << i << ": " << buildError << ", "
+                  << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devCntxt->device)
+                  << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devCntxt->device) << std::endl;
+
+        return false;
+    }
+
+    for (unsigned int j = 0; j < kernelHandles.size(); j++) {
+        devCntxt->calls[kernelHandles[j].oclapi] = cl::Kernel(program, kernelHandles[j].kernelname.c_str());
+        devCntxt->mutexes.emplace(kernelHandles[j].oclapi, new std::mutex);
+        QProfiler::SetKernelName(kernelHandles[j].oclapi, kernelHandles[j].kernelname);
+    }
+
+    if (isSavingBinaries) {
+        std::cout << "OpenCL program #" << i << ", ";
+        SaveBinary(program, binaryHome, fileName);
+    }
+
+    if (isCaching && !isBinary) {
+        std::cout << "OpenCL program #" << i << " cache, ";
+        SaveBinary(program, binaryHome, cacheFileName);
+    }
+
+    return true;
+}
+
+bool OCLEngine::InitDeviceContext(DeviceContextPtr devCntxt)
+{
+    std::lock_guard<std::mutex> guard(devCntxt->initMutex);
+
+    if (devCntxt->isInitialized || devCntxt->isBuildFailed) {
+        return devCntxt->isInitialized;
+    }
+
+    // a context is like a "runtime link" to the device and platform;
+    // i.e. communication is possible
+    {
+        std::lock_guard<std::mutex> contextsGuard(contextsMutex);
+        auto found = platformContexts.find(devCntxt->context_id);
+        if (found == platformContexts.end()) {
+            // Every device of the platform shares its context, so that buffers can move between them.
+            found = platformContexts
+                        .emplace(devCntxt->context_id, cl::Context(platformDevices[devCntxt->context_id]))
+                        .first;
+        }
+        devCntxt->context = found->second;
+    }
+    devCntxt->MakeQueue();
+
+    devCntxt->isInitialized = BuildProgram(devCntxt);
+    devCntxt->isBuildFailed = !devCntxt->isInitialized;
+
+    return devCntxt->isInitialized;
+}
+
+DeviceContextPtr OCLEngine::GetBuiltDeviceContextPtr(const int& dev)
+{
+    DeviceContextPtr devCntxt = GetDeviceContextPtr(dev);
+    if (InitDeviceContext(devCntxt)) {
+        return devCntxt;
+    }
+
+    if (dev != -1) {
+        throw std::invalid_argument("OpenCL programs could not be built for the requested device.");
+    }
+
+    // The default device is usually the last device in the list. If we can't compile for it, we use the first device
+    // that we can compile for. If there is none, then the environment needs to be fixed by the user.
+    for (size_t i = 0; i < all_device_contexts.size(); i++) {
+        if (InitDeviceContext(all_device_contexts[i])) {
+            SetDefaultDeviceContext(all_device_contexts[i]);
+            return all_device_contexts[i];
+        }
+    }
+
+    throw std::invalid_argument("OpenCL programs could not be built for any device.");
 }
 
 void OCLEngine::InitOCL(bool buildFromSource, bool saveBinaries, std::string home)
@@ -233,10 +578,7 @@ void OCLEngine::InitOCL(bool buildFromSource, bool saveBinaries, std::string hom
     std::vector<cl::Platform> all_platforms;
     std::vector<cl::Device> all_devices;
     std::vector<int> device_platform_id;
-    cl::Platform default_platform;
-    cl::Device default_device;
     std::vector<DeviceContextPtr> all_dev_contexts;
-    DeviceContextPtr default_dev_context;
 
     cl::Platform::get(&all_platforms);
 
@@ -281,88 +623,58 @@ void OCLEngine::InitOCL(bool buildFromSource, bool saveBinaries, std::string hom
         }
     }
 
-    // create the programs that we want to execute on the devices
-    cl::Program::Sources sources;
-
-#if ENABLE_PURE32
-    sources.push_back({ (const char*)qheader32_cl, (long unsigned int)qheader32_cl_len });
-#elif ENABLE_COMPLEX8
-    sources.push_back({ (const char*)qheader_float_cl, (long unsigned int)qheader_float_cl_len });
-#else
-    sources.push_back({ (const char*)qheader_double_cl, (long unsigned int)qheader_double_cl_len });
-#endif
-    sources.push_back({ (const char*)qengine_cl, (long unsigned int)qengine_cl_len });
-
-    int plat_id = -1;
-    std::vector<cl::Context> all_contexts;
-    for (int i = 0; i < deviceCount; i++) {
-        // a context is like a "runtime link" to the device and platform;
-        // i.e. communication is possible
-        if (device_platform_id[i] != plat_id) {
-            plat_id = device_platform_id[i];
-            all_contexts.push_back(cl::Context(all_platforms_devices[plat_id]));
-        }
-        std::shared_ptr<OCLDeviceContext> devCntxt = std::make_shared<OCLDeviceContext>(
-            devPlatVec[i], all_devices[i], all_contexts[all_contexts.size() - 1], i, plat_id);
-
-        std::string fileName = binary_file_prefix + std::to_string(i) + binary_file_ext;
-        std::string clBinName = home + fileName;
-
-        std::cout << "Device #" << i << ", ";
-        cl::Program program = MakeProgram(buildFromSource, sources, clBinName, devCntxt);
-
-        cl_int buildError = program.build({ all_devices[i] }, "-cl-denorms-are-zero -cl-fast-relaxed-math");
-        if (buildError != CL_SUCCESS) {
-            std::cout << "Error building for device #" << i << ": " << buildError << ", "
-                      << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(all_devices[i])
-                      << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(all_devices[i]) << std::endl;
-
-            // The default device was set above to be the last device in the list. If we can't compile for it, we
-            // use the first device. If the default is the first device, and we can't compile for it, then we don't
-            // have any devices that can compile at all, and the environment needs to be fixed by the user.
-            if (i == dev) {
-                default_dev_context = all_dev_contexts[0];
-                default_platform = all_platforms[0];
-                default_device = all_devices[0];
-            }
+    if (!m_pInstance) {
+        m_pInstance = new OCLEngine();
+    }
 
-            continue;
+    // Contexts and programs are made as each device is first used, with these parameters.
+    m_pInstance->isBuildingFromSource = buildFromSource;
+    m_pInstance->isSavingBinaries = saveBinaries;
+    m_pInstance->binaryHome = home;
+    {
+        std::lock_guard<std::mutex> contextsGuard(m_pInstance->contextsMutex);
+        m_pInstance->platformContexts.clear();
+        m_pInstance->platformDevices.clear();
+        for (size_t i = 0; i < all_platforms_devices.size(); i++) {
+            m_pInstance->platformDevices[i] = all_platforms_devices[i];
         }
+    }
 
-        all_dev_contexts.push_back(devCntxt);
+    for (int i = 0; i < deviceCount; i++) {
+        all_dev_contexts.push_back(
+            std::make_shared<OCLDeviceContext>(devPlatVec[i], all_devices[i], i, device_platform_id[i]));
+    }
 
-        for (unsigned int j = 0; j < kernelHandles.size(); j++) {
-            all_dev_contexts[i]->calls[kernelHandles[j].oclapi] =
-                cl::Kernel(program, kernelHandles[j].kernelname.c_str());
-            all_dev_contexts[i]->mutexes.emplace(kernelHandles[j].oclapi, new std::mutex);
-        }
+    m_pInstance->SetDeviceContextPtrVector(all_dev_contexts, all_dev_contexts[dev]);
 
-        if (saveBinaries) {
-            std::cout << "OpenCL program #" << i << ", ";
-            SaveBinary(program, home, fileName);
+    // Saving binaries, (as for qrack_cl_precompile,) needs every program built now.
+    if (saveBinaries || getenv("QRACK_OCL_EAGER_INIT")) {
+        for (i = 0; i < deviceCount; i++) {
+            m_pInstance->InitDeviceContext(all_dev_contexts[i]);
         }
-
-        if (i == dev) {
-            default_dev_context = all_dev_contexts[i];
-            default_platform = all_platforms[plat_id];
-            default_device = all_devices[i];
+        if (!all_dev_contexts[dev]->IsInitialized()) {
+            for (i = 0; i < deviceCount; i++) {
+                if (all_dev_contexts[i]->IsInitialized()) {
+                    m_pInstance->SetDefaultDeviceContext(all_dev_contexts[i]);
+                    break;
+                }
+            }
         }
     }
 
-    if (!m_pInstance) {
-        m_pInstance = new OCLEngine();
-    }
-    m_pInstance->SetDeviceContextPtrVector(all_dev_contexts, default_dev_context);
-
-    // For VirtualCL support, the device info can only be accessed AFTER all contexts are created.
-    std::cout << "Default platform: " << default_platform.getInfo<CL_PLATFORM_NAME>() << "\n";
-    std::cout << "Default device: " << default_device.getInfo<CL_DEVICE_NAME>() << "\n";
+    // (For VirtualCL support, the device info can only be accessed AFTER all contexts are created, so VirtualCL needs
+    // QRACK_OCL_EAGER_INIT.)
+    DeviceContextPtr default_dev_context = m_pInstance->GetDeviceContextPtr(-1);
+    std::cout << "Default platform: " << default_dev_context->platform.getInfo<CL_PLATFORM_NAME>() << "\n";
+    std::cout << "Default device: " << default_dev_context->device.getInfo<CL_DEVICE_NAME>() << "\n";
     for (i = 0; i < deviceCount; i++) {
         std::cout << "OpenCL device #" << i << ": " << all_devices[i].getInfo<CL_DEVICE_NAME>() << "\n";
     }
 }
 
 OCLEngine::OCLEngine()
+    : isBuildingFromSource(false)
+    , isSavingBinaries(false)
 {
     // Intentionally left blank;
 }
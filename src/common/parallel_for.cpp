@@ -12,8 +12,9 @@
 
 #define _USE_MATH_DEFINES
 
+#include <algorithm>
 #include <atomic>
-#include <future>
+#include <chrono>
 #include <math.h>
 
 #if ENABLE_UINT128
@@ -21,91 +22,193 @@
 #endif
 
 #include "common/parallel_for.hpp"
+#include "common/threadpool.hpp"
+#include "common/widesimd.hpp"
+#include "statevector.hpp"
 
 #if ENABLE_UINT128
 #define DECLARE_ATOMIC_BITCAPINT()                                                                                     \
     std::mutex idxLock;                                                                                                \
     bitCapInt idx;
-#define ATOMIC_ASYNC(...)                                                                                              \
-    std::async(std::launch::async, [__VA_ARGS__, &idxLock]()
 #define ATOMIC_INC()                                                                                                   \
     idxLock.lock();                                                                                                    \
     i = idx++;                                                                                                         \
     idxLock.unlock();
 #else
 #define DECLARE_ATOMIC_BITCAPINT() std::atomic<bitCapIntOcl> idx;
-#define ATOMIC_ASYNC(...)                                                                                              \
-    std::async(std::launch::async, [__VA_ARGS__]()
 #define ATOMIC_INC() i = idx++;
 #endif
 
+// Each thread should run at least this many times as long as it takes to hand it its task.
+#define GRAIN_OVERHEAD_FACTOR 2
+// Chunks per thread, for load balancing. (Fewer, larger chunks are friendlier to caches and NUMA.)
+#define GRAIN_CHUNKS_PER_THREAD 8
+#define CALIBRATION_ITEMS (1U << 14U)
+#define CALIBRATION_REPS 32
+
 namespace Qrack {
 
+struct ParallelCalibration {
+    real1 dispatchNs;
+    real1 itemNs[2];
+};
+
+template <typename Fn> static real1 MedianNs(Fn fn)
+{
+    std::vector<real1> times(CALIBRATION_REPS);
+    for (int i = 0; i < CALIBRATION_REPS; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        times[i] = (real1)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    std::sort(times.begin(), times.end());
+
+    return times[CALIBRATION_REPS / 2];
+}
+
 /*
- * Iterate through the permutations a maximum of end-begin times, allowing the
- * caller to control the incrementation offset through 'inc'.
+ * Time the fixed cost of a ThreadPool batch, and the per-item cost of the cheapest kernel of each class, once per
+ * process. Real kernels cost more per item than these, so the crossover this implies errs toward parallelism.
  */
-void ParallelFor::par_for_inc(const bitCapInt begin, const bitCapInt itemCount, IncrementFunc inc, ParallelFunc fn)
+static ParallelCalibration Calibrate()
 {
-    const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
+    ParallelCalibration calibration;
+    ThreadPool* pool = ThreadPool::Instance();
+    int32_t threadCount = pool->GetWorkerCount() + 1;
+
+    calibration.dispatchNs = MedianNs([&]() { pool->RunAll(threadCount, [](const int32_t cpu) {}); });
+
+    std::vector<bitCapIntOcl> sink(1, 0);
+    IncrementFunc inc = [](const bitCapInt i, int cpu) { return i; };
+    ParallelFunc fn = [&sink](const bitCapInt i, int cpu) { sink[0] += (bitCapIntOcl)i; };
+    calibration.itemNs[ParallelFor::PAR_KERNEL_FOR] = MedianNs([&]() {
+        for (bitCapIntOcl i = 0; i < CALIBRATION_ITEMS; i++) {
+            fn(inc(i, 0), 0);
+        }
+    });
 
-    if ((itemCount / Stride) < (bitCapInt)numCores) {
-        bitCapInt maxLcv = begin + itemCount;
-        for (bitCapInt j = begin; j < maxLcv; j++) {
-            fn(inc(j, 0), 0);
+    std::vector<complex> amps(CALIBRATION_ITEMS, complex(ONE_R1, ZERO_R1));
+    std::vector<real1> nrmSink(1, ZERO_R1);
+    calibration.itemNs[ParallelFor::PAR_KERNEL_NORM] = MedianNs([&]() {
+        for (bitCapIntOcl i = 0; i < CALIBRATION_ITEMS; i++) {
+            nrmSink[0] += norm(amps[i]);
         }
+    });
+
+    for (int i = 0; i < 2; i++) {
+        calibration.itemNs[i] = std::max(calibration.itemNs[i] / CALIBRATION_ITEMS, (real1)(0.1f));
+    }
+
+    return calibration;
+}
+
+static const ParallelCalibration& GetCalibration()
+{
+    static const ParallelCalibration calibration = Calibrate();
+    return calibration;
+}
+
+void ParallelFor::GetGrain(
+    const bitCapInt itemCount, const ParallelKernel kernel, bitCapIntOcl& stride, int32_t& threads)
+{
+    const bitCapIntOcl minStride = ONE_BCI << (bitCapIntOcl)PSTRIDEPOW;
+
+    stride = minStride;
+    threads = 1;
+
+    if ((numCores <= 1) || ((itemCount / minStride) < 2U)) {
         return;
     }
 
-    DECLARE_ATOMIC_BITCAPINT();
-    idx = 0;
-    std::vector<std::future<void>> futures(numCores);
-    for (int cpu = 0; cpu < numCores; cpu++) {
-        futures[cpu] = ATOMIC_ASYNC(cpu, &idx, begin, itemCount, inc, fn)
-        {
-            const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
+    const ParallelCalibration& calibration = GetCalibration();
+    bitCapInt minItems = (bitCapIntOcl)(GRAIN_OVERHEAD_FACTOR * calibration.dispatchNs / calibration.itemNs[kernel]);
+    if (minItems < minStride) {
+        minItems = minStride;
+    }
 
-            bitCapInt i, j, l;
-            bitCapInt k = 0;
-            for (;;) {
-                ATOMIC_INC();
-                l = i * Stride;
-                for (j = 0; j < Stride; j++) {
-                    k = j + l;
-                    /* Easiest to clamp on end. */
-                    if (k >= itemCount) {
-                        break;
-                    }
-                    fn(inc(begin + k, cpu), cpu);
-                }
-                if (k >= itemCount) {
-                    break;
-                }
-            }
-        });
+    bitCapInt maxThreads = itemCount / minItems;
+    threads = (maxThreads < (bitCapInt)numCores) ? (int32_t)maxThreads : numCores;
+    if (threads <= 1) {
+        threads = 1;
+        return;
     }
 
-    for (int cpu = 0; cpu < numCores; cpu++) {
-        futures[cpu].get();
+    bitCapInt chunk = itemCount / (bitCapInt)(threads * GRAIN_CHUNKS_PER_THREAD);
+    while ((bitCapInt)(stride << ONE_BCI) <= chunk) {
+        stride <<= ONE_BCI;
     }
 }
 
-void ParallelFor::par_for(const bitCapInt begin, const bitCapInt end, ParallelFunc fn)
+void ParallelFor::SetConcurrencyLevel(int32_t num)
 {
-    par_for_inc(
-        begin, end - begin, [](const bitCapInt i, int cpu) { return i; }, fn);
+    numCores = num;
+    ThreadPool::Instance()->Reserve(num);
+}
+
+void ParallelFor::par_chunks(const bitCapInt itemCount, const bitCapIntOcl stride, const int32_t threads,
+    std::function<void(const bitCapInt, const bitCapInt, const int)> fn)
+{
+    DECLARE_ATOMIC_BITCAPINT();
+    idx = 0;
+    ThreadPool::Instance()->RunAll(threads, [&](const int32_t cpu) {
+        bitCapInt i, l;
+        for (;;) {
+            ATOMIC_INC();
+            l = i * stride;
+            /* Easiest to clamp on end. */
+            if (l >= itemCount) {
+                break;
+            }
+            fn(l, ((itemCount - l) < stride) ? itemCount : (l + stride), cpu);
+        }
+    });
+}
+
+void ParallelFor::par_for_weighted(
+    const bitCapInt begin, const bitCapInt end, const bitCapIntOcl weight, ParallelFunc fn)
+{
+    const bitCapIntOcl itemCount = (bitCapIntOcl)(end - begin);
+    const bitCapIntOcl itemWeight = weight ? weight : ONE_BCI;
+
+    bitCapIntOcl Stride;
+    int32_t threads;
+    GetGrain(itemCount * itemWeight, PAR_KERNEL_FOR, Stride, threads);
+
+    if (threads <= 1) {
+        for (bitCapIntOcl j = 0; j < itemCount; j++) {
+            fn(begin + j, 0);
+        }
+        return;
+    }
+
+    // The grain is in units of par_for() items, so scale it back down to calls.
+    Stride /= itemWeight;
+    if (!Stride) {
+        Stride = ONE_BCI;
+    }
+
+    DECLARE_ATOMIC_BITCAPINT();
+    idx = 0;
+    ThreadPool::Instance()->RunAll(threads, [&](const int32_t cpu) {
+        bitCapIntOcl i, j, l;
+        for (;;) {
+            ATOMIC_INC();
+            l = i * Stride;
+            if (l >= itemCount) {
+                break;
+            }
+            for (j = 0; (j < Stride) && ((l + j) < itemCount); j++) {
+                fn(begin + l + j, cpu);
+            }
+        }
+    });
 }
 
 void ParallelFor::par_for_set(const std::set<bitCapInt>& sparseSet, ParallelFunc fn)
 {
-    par_for_inc(
-        0, sparseSet.size(),
-        [&sparseSet](const bitCapInt i, int cpu) {
-            auto it = sparseSet.begin();
-            std::advance(it, i);
-            return *it;
-        },
-        fn);
+    // (Advancing a set iterator takes linear time, so this indexes a copy.)
+    par_for_set(std::vector<bitCapInt>(sparseSet.begin(), sparseSet.end()), fn);
 }
 
 void ParallelFor::par_for_set(const std::vector<bitCapInt>& sparseSet, ParallelFunc fn)
@@ -140,41 +243,8 @@ void ParallelFor::par_for_sparse_compose(const std::vector<bitCapInt>& lowSet, c
         fn);
 }
 
-void ParallelFor::par_for_skip(
-    const bitCapInt begin, const bitCapInt end, const bitCapInt skipMask, const bitLenInt maskWidth, ParallelFunc fn)
-{
-    /*
-     * Add maskWidth bits by shifting the incrementor up that number of
-     * bits, filling with 0's.
-     *
-     * For example, if the skipMask is 0x8, then the lowMask will be 0x7
-     * and the high mask will be ~(0x7 + 0x8) ==> ~0xf, shifted by the
-     * number of extra bits to add.
-     */
-
-    if ((skipMask << maskWidth) >= end) {
-        // If we're skipping trailing bits, this is much cheaper:
-        par_for(begin, skipMask, fn);
-        return;
-    }
-
-    bitCapInt lowMask = skipMask - ONE_BCI;
-    bitCapInt highMask = ~lowMask;
-
-    IncrementFunc incFn;
-    if (lowMask == 0) {
-        // If we're skipping leading bits, this is much cheaper:
-        incFn = [maskWidth](bitCapInt i, int cpu) { return (i << maskWidth); };
-    } else {
-        incFn = [lowMask, highMask, maskWidth](
-                    bitCapInt i, int cpu) { return ((i & lowMask) | ((i & highMask) << maskWidth)); };
-    }
-
-    par_for_inc(begin, (end - begin) >> maskWidth, incFn, fn);
-}
-
-void ParallelFor::par_for_mask(
-    const bitCapInt begin, const bitCapInt end, const bitCapInt* maskArray, const bitLenInt maskLen, ParallelFunc fn)
+bool ParallelFor::GetSkipMasks(
+    const bitCapInt end, const bitCapInt* maskArray, const bitLenInt maskLen, std::vector<bitCapInt>& masks)
 {
     for (bitLenInt i = 1; i < maskLen; i++) {
         if (maskArray[i] < maskArray[i - 1]) {
@@ -182,40 +252,18 @@ void ParallelFor::par_for_mask(
         }
     }
 
-    /* Pre-calculate the masks to simplify the increment function later. */
-    bitCapInt** masks = new bitCapInt*[maskLen];
-    for (bitLenInt i = 0; i < maskLen; i++) {
-        masks[i] = new bitCapInt[2];
-    }
+    masks.resize(maskLen << 1U);
 
     bool onlyLow = true;
     for (bitLenInt i = 0; i < maskLen; i++) {
-        masks[i][0] = maskArray[i] - 1; // low mask
-        masks[i][1] = (~(masks[i][0] + maskArray[i])); // high mask
+        masks[i << 1U] = maskArray[i] - 1; // low mask
+        masks[(i << 1U) + 1U] = (~(masks[i << 1U] + maskArray[i])); // high mask
         if (maskArray[maskLen - i - 1] != (end >> (i + 1))) {
             onlyLow = false;
         }
     }
 
-    IncrementFunc incFn;
-    if (onlyLow) {
-        par_for(begin, end >> maskLen, fn);
-    } else {
-        incFn = [&masks, maskLen](bitCapInt i, int cpu) {
-            /* Push i apart, one mask at a time. */
-            for (bitLenInt m = 0; m < maskLen; m++) {
-                i = ((i << ONE_BCI) & masks[m][1]) | (i & masks[m][0]);
-            }
-            return i;
-        };
-
-        par_for_inc(begin, (end - begin) >> maskLen, incFn, fn);
-    }
-
-    for (bitLenInt i = 0; i < maskLen; i++) {
-        delete[] masks[i];
-    }
-    delete[] masks;
+    return onlyLow;
 }
 
 real1 ParallelFor::par_norm(const bitCapInt maxQPower, const StateVectorPtr stateArray, real1 norm_thresh)
@@ -224,10 +272,17 @@ real1 ParallelFor::par_norm(const bitCapInt maxQPower, const StateVectorPtr stat
         return par_norm_exact(maxQPower, stateArray);
     }
 
-    const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
+    StateVectorArrayPtr denseArray = std::dynamic_pointer_cast<StateVectorArray>(stateArray);
+    if (denseArray && IsWideSimdSupported()) {
+        return par_norm_runs(maxQPower, denseArray->amplitudes, norm_thresh);
+    }
+
+    bitCapIntOcl Stride;
+    int32_t threads;
+    GetGrain(maxQPower, PAR_KERNEL_NORM, Stride, threads);
 
     real1 nrmSqr = 0;
-    if ((maxQPower / Stride) < (bitCapInt)numCores) {
+    if (threads <= 1) {
         real1 nrm;
         for (bitCapInt j = 0; j < maxQPower; j++) {
             nrm = norm(stateArray->read(j));
@@ -238,37 +293,32 @@ real1 ParallelFor::par_norm(const bitCapInt maxQPower, const StateVectorPtr stat
     } else {
         DECLARE_ATOMIC_BITCAPINT();
         idx = 0;
-        std::vector<std::future<real1>> futures(numCores);
-        for (int cpu = 0; cpu != numCores; ++cpu) {
-            futures[cpu] = ATOMIC_ASYNC(&idx, maxQPower, stateArray, &norm_thresh)
-            {
-                const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
-
-                real1 sqrNorm = ZERO_R1;
-                real1 nrm;
-                bitCapInt i, j;
-                bitCapInt k = 0;
-                for (;;) {
-                    ATOMIC_INC();
-                    for (j = 0; j < Stride; j++) {
-                        k = i * Stride + j;
-                        if (k >= maxQPower)
-                            break;
-
-                        nrm = norm(stateArray->read(k));
-                        if (nrm >= norm_thresh) {
-                            sqrNorm += nrm;
-                        }
-                    }
+        std::vector<real1> sqrNorms(threads, ZERO_R1);
+        ThreadPool::Instance()->RunAll(threads, [&](const int32_t cpu) {
+            real1 sqrNorm = ZERO_R1;
+            real1 nrm;
+            bitCapInt i, j;
+            bitCapInt k = 0;
+            for (;;) {
+                ATOMIC_INC();
+                for (j = 0; j < Stride; j++) {
+                    k = i * Stride + j;
                     if (k >= maxQPower)
                         break;
+
+                    nrm = norm(stateArray->read(k));
+                    if (nrm >= norm_thresh) {
+                        sqrNorm += nrm;
+                    }
                 }
-                return sqrNorm;
-            });
-        }
+                if (k >= maxQPower)
+                    break;
+            }
+            sqrNorms[cpu] = sqrNorm;
+        });
 
-        for (int32_t cpu = 0; cpu != numCores; ++cpu) {
-            nrmSqr += futures[cpu].get();
+        for (int32_t cpu = 0; cpu != threads; ++cpu) {
+            nrmSqr += sqrNorms[cpu];
         }
     }
 
@@ -277,10 +327,17 @@ real1 ParallelFor::par_norm(const bitCapInt maxQPower, const StateVectorPtr stat
 
 real1 ParallelFor::par_norm_exact(const bitCapInt maxQPower, const StateVectorPtr stateArray)
 {
-    const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
+    StateVectorArrayPtr denseArray = std::dynamic_pointer_cast<StateVectorArray>(stateArray);
+    if (denseArray && IsWideSimdSupported()) {
+        return par_norm_runs(maxQPower, denseArray->amplitudes, ZERO_R1);
+    }
+
+    bitCapIntOcl Stride;
+    int32_t threads;
+    GetGrain(maxQPower, PAR_KERNEL_NORM, Stride, threads);
 
     real1 nrmSqr = 0;
-    if ((maxQPower / Stride) < (bitCapInt)numCores) {
+    if (threads <= 1) {
         for (bitCapInt j = 0; j < maxQPower; j++) {
             nrmSqr += norm(stateArray->read(j));
         }
@@ -289,33 +346,65 @@ real1 ParallelFor::par_norm_exact(const bitCapInt maxQPower, const StateVectorPt
     }
     DECLARE_ATOMIC_BITCAPINT();
     idx = 0;
-    std::vector<std::future<real1>> futures(numCores);
-    for (int cpu = 0; cpu != numCores; ++cpu) {
-        futures[cpu] = ATOMIC_ASYNC(&idx, maxQPower, stateArray)
-        {
-            const bitCapIntOcl Stride = (ONE_BCI << (bitCapIntOcl)PSTRIDEPOW);
-
-            real1 sqrNorm = ZERO_R1;
-            bitCapInt i, j;
-            bitCapInt k = 0;
-            for (;;) {
-                ATOMIC_INC();
-                for (j = 0; j < Stride; j++) {
-                    k = i * Stride + j;
-                    if (k >= maxQPower)
-                        break;
-
-                    sqrNorm += norm(stateArray->read(k));
-                }
+    std::vector<real1> sqrNorms(threads, ZERO_R1);
+    ThreadPool::Instance()->RunAll(threads, [&](const int32_t cpu) {
+        real1 sqrNorm = ZERO_R1;
+        bitCapInt i, j;
+        bitCapInt k = 0;
+        for (;;) {
+            ATOMIC_INC();
+            for (j = 0; j < Stride; j++) {
+                k = i * Stride + j;
                 if (k >= maxQPower)
                     break;
+
+                sqrNorm += norm(stateArray->read(k));
             }
-            return sqrNorm;
-        });
+            if (k >= maxQPower)
+                break;
+        }
+        sqrNorms[cpu] = sqrNorm;
+    });
+
+    for (int32_t cpu = 0; cpu != threads; ++cpu) {
+        nrmSqr += sqrNorms[cpu];
+    }
+
+    return nrmSqr;
+}
+
+real1 ParallelFor::par_norm_runs(const bitCapInt maxQPower, const complex* amplitudes, real1 norm_thresh)
+{
+    bitCapIntOcl Stride;
+    int32_t threads;
+    GetGrain(maxQPower, PAR_KERNEL_NORM, Stride, threads);
+
+    const bitCapIntOcl itemCount = (bitCapIntOcl)maxQPower;
+    if (threads <= 1) {
+        return NormRun(amplitudes, itemCount, norm_thresh);
     }
 
-    for (int32_t cpu = 0; cpu != numCores; ++cpu) {
-        nrmSqr += futures[cpu].get();
+    DECLARE_ATOMIC_BITCAPINT();
+    idx = 0;
+    std::vector<real1> sqrNorms(threads, ZERO_R1);
+    ThreadPool::Instance()->RunAll(threads, [&](const int32_t cpu) {
+        real1 sqrNorm = ZERO_R1;
+        bitCapInt i;
+        bitCapIntOcl k;
+        for (;;) {
+            ATOMIC_INC();
+            k = (bitCapIntOcl)(i * Stride);
+            if (k >= itemCount) {
+                break;
+            }
+            sqrNorm += NormRun(amplitudes + k, ((itemCount - k) < Stride) ? (itemCount - k) : Stride, norm_thresh);
+        }
+        sqrNorms[cpu] = sqrNorm;
+    });
+
+    real1 nrmSqr = ZERO_R1;
+    for (int32_t cpu = 0; cpu != threads; ++cpu) {
+        nrmSqr += sqrNorms[cpu];
     }
 
     return nrmSqr;
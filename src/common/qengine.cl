@@ -223,6 +223,111 @@ void kernel apply2x2doublewide(global cmplx* stateVec, constant real1* cmplxPtr,
     APPLY_AND_OUT();
 }
 
+void kernel applynxn(global cmplx* stateVec, constant cmplx* mtrx, constant bitCapIntOcl* bitCapIntOclPtr,
+    constant bitCapIntOcl* qPowers)
+{
+    bitCapIntOcl Nthreads = get_global_size(0);
+
+    bitCapIntOcl maxI = bitCapIntOclPtr[0];
+    bitCapIntOcl targetLen = bitCapIntOclPtr[1];
+    bitCapIntOcl nPower = bitCapIntOclPtr[2];
+
+    // The first "targetLen" powers are sorted, for inserting the target bits. The rest are the per-basis offsets.
+    constant bitCapIntOcl* offsets = qPowers + targetLen;
+
+    cmplx amps[16];
+    cmplx amp;
+    bitCapIntOcl lcv, i, iLow, iHigh, j, k, p;
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        iHigh = lcv;
+        i = 0U;
+        for (p = 0U; p < targetLen; p++) {
+            iLow = iHigh & (qPowers[p] - ONE_BCI);
+            i |= iLow;
+            iHigh = (iHigh ^ iLow) << ONE_BCI;
+        }
+        i |= iHigh;
+
+        for (j = 0U; j < nPower; j++) {
+            amps[j] = stateVec[i | offsets[j]];
+        }
+
+        for (j = 0U; j < nPower; j++) {
+            amp = (cmplx)(ZERO_R1, ZERO_R1);
+            for (k = 0U; k < nPower; k++) {
+                amp += zmul(mtrx[(j * nPower) + k], amps[k]);
+            }
+            stateVec[i | offsets[j]] = amp;
+        }
+    }
+}
+
+void kernel apply2x2tiled(global cmplx* stateVec, constant cmplx* mtrxs, constant bitCapIntOcl* bitCapIntOclPtr,
+    constant bitCapIntOcl* qPowers, local cmplx* tile)
+{
+    bitCapIntOcl tileCount = bitCapIntOclPtr[0];
+    bitCapIntOcl tileSize = bitCapIntOclPtr[1];
+    bitCapIntOcl gateCount = bitCapIntOclPtr[2];
+    bitCapIntOcl halfTile = tileSize >> ONE_BCI;
+    bitCapIntOcl lid = get_local_id(0);
+    bitCapIntOcl localSize = get_local_size(0);
+    bitCapIntOcl groupCount = get_num_groups(0);
+
+    bitCapIntOcl t, offset, g, i, j, qPower;
+    cmplx amp0, amp1;
+
+    // Each work group loads a whole tile into local memory, applies every gate to it in turn, and writes it back once.
+    for (t = get_group_id(0); t < tileCount; t += groupCount) {
+        offset = t * tileSize;
+        for (j = lid; j < tileSize; j += localSize) {
+            tile[j] = stateVec[offset | j];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (g = 0U; g < gateCount; g++) {
+            qPower = qPowers[g];
+            for (j = lid; j < halfTile; j += localSize) {
+                i = ((j & ~(qPower - ONE_BCI)) << ONE_BCI) | (j & (qPower - ONE_BCI));
+                amp0 = tile[i];
+                amp1 = tile[i | qPower];
+                tile[i] = zmul(mtrxs[4U * g], amp0) + zmul(mtrxs[4U * g + 1U], amp1);
+                tile[i | qPower] = zmul(mtrxs[4U * g + 2U], amp0) + zmul(mtrxs[4U * g + 3U], amp1);
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        for (j = lid; j < tileSize; j += localSize) {
+            stateVec[offset | j] = tile[j];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+void kernel apply2x2each(global cmplx* stateVec, global cmplx4* mtrxs, constant bitCapIntOcl* bitCapIntOclPtr,
+    constant bitCapIntOcl* qPowersSorted)
+{
+    bitCapIntOcl lcv, i, iLow, iHigh;
+    bitLenInt p;
+    bitCapIntOcl Nthreads = get_global_size(0);
+    bitCapIntOcl copyShift = bitCapIntOclPtr[4];
+
+    cmplx2 mulRes;
+
+    // The high bits of the state vector index select one of many independent registers, each with its own matrix.
+    for (lcv = ID; lcv < MAXI_ARG; lcv += Nthreads) {
+        PUSH_APART_GEN();
+
+        mulRes.lo = stateVec[i | OFFSET1_ARG];
+        mulRes.hi = stateVec[i | OFFSET2_ARG];
+
+        mulRes = zmatrixmul(ONE_R1, mtrxs[i >> copyShift], mulRes);
+
+        stateVec[i | OFFSET1_ARG] = mulRes.lo;
+        stateVec[i | OFFSET2_ARG] = mulRes.hi;
+    }
+}
+
 void kernel apply2x2normsingle(global cmplx* stateVec, constant real1* cmplxPtr, constant bitCapIntOcl* bitCapIntOclPtr,
     global real1* nrmParts, local real1* lProbBuffer)
 {
@@ -515,6 +620,156 @@ void kernel cuniformparityrz(global cmplx* stateVec, constant bitCapIntOcl* bitC
     }
 }
 
+// One radix-2 stage of QFT(), (decimation in frequency,) or of IQFT(), (decimation in time,) on the register that
+// starts at bit "start," pairing amplitudes across the register bit of power "h." (QFT() twiddle factors are
+// exp(-pi * i * k / h), as the controlled phase gates of QInterface::QFT() give.)
+void kernel qftradix2(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr)
+{
+    bitCapIntOcl Nthreads, lcv, i, k;
+
+    Nthreads = get_global_size(0);
+    bitCapIntOcl maxI = bitCapIntOclPtr[0];
+    bitCapIntOcl start = bitCapIntOclPtr[1];
+    bitCapIntOcl h = bitCapIntOclPtr[2];
+    bool isInverse = (bitCapIntOclPtr[3] != 0U);
+    bitCapIntOcl pairPower = h << start;
+    bitCapIntOcl qMask = pairPower - ONE_BCI;
+    real1 sgn = isInverse ? ONE_R1 : -ONE_R1;
+    real1 nrm = ONE_R1 / sqrt(ONE_R1 + ONE_R1);
+    real1 frac;
+    cmplx w, y0, y1;
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        i = lcv & qMask;
+        i |= (lcv ^ i) << ONE_BCI;
+
+        k = (i >> start) & (h - ONE_BCI);
+        frac = (real1)k / (real1)h;
+        w = (cmplx)(cospi(frac), sgn * sinpi(frac));
+
+        y0 = stateVec[i];
+        y1 = stateVec[i | pairPower];
+        if (isInverse) {
+            y1 = zmul(y1, w);
+            stateVec[i] = nrm * (y0 + y1);
+            stateVec[i | pairPower] = nrm * (y0 - y1);
+        } else {
+            stateVec[i] = nrm * (y0 + y1);
+            stateVec[i | pairPower] = nrm * zmul(y0 - y1, w);
+        }
+    }
+}
+
+// Two consecutive radix-2 stages of QFT() or IQFT(), on the register bits of powers "h" and "h / 2," in one pass
+void kernel qftradix4(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr)
+{
+    bitCapIntOcl Nthreads, lcv, i, iLow, k;
+
+    Nthreads = get_global_size(0);
+    bitCapIntOcl maxI = bitCapIntOclPtr[0];
+    bitCapIntOcl start = bitCapIntOclPtr[1];
+    bitCapIntOcl h = bitCapIntOclPtr[2];
+    bool isInverse = (bitCapIntOclPtr[3] != 0U);
+    bitCapIntOcl power2 = h << start;
+    bitCapIntOcl power1 = power2 >> ONE_BCI;
+    real1 sgn = isInverse ? ONE_R1 : -ONE_R1;
+    real1 nrm = ONE_R1 / (ONE_R1 + ONE_R1);
+    real1 frac;
+    cmplx w1, w2, iw1, x0, x1, x2, x3, y0, y1, y2, y3;
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        i = lcv & (power1 - ONE_BCI);
+        i |= (lcv ^ i) << ONE_BCI;
+        iLow = i & (power2 - ONE_BCI);
+        i = iLow | ((i ^ iLow) << ONE_BCI);
+
+        // The stage on "h" takes the twiddle factor w1 for the "k"-th pair, (and i * w1 for the pair h / 2 later,) and
+        // the stage on "h / 2" takes w2 = w1^2.
+        k = (i >> start) & ((h >> ONE_BCI) - ONE_BCI);
+        frac = (real1)k / (real1)h;
+        w1 = (cmplx)(cospi(frac), sgn * sinpi(frac));
+        w2 = (cmplx)(cospi(2 * frac), sgn * sinpi(2 * frac));
+        iw1 = (cmplx)(-sgn * w1.y, sgn * w1.x);
+
+        x0 = stateVec[i];
+        x1 = stateVec[i | power1];
+        x2 = stateVec[i | power2];
+        x3 = stateVec[i | power1 | power2];
+
+        if (isInverse) {
+            x1 = zmul(x1, w2);
+            x3 = zmul(x3, w2);
+            y0 = x0 + x1;
+            y1 = x0 - x1;
+            y2 = zmul(x2 + x3, w1);
+            y3 = zmul(x2 - x3, iw1);
+
+            stateVec[i] = nrm * (y0 + y2);
+            stateVec[i | power1] = nrm * (y1 + y3);
+            stateVec[i | power2] = nrm * (y0 - y2);
+            stateVec[i | power1 | power2] = nrm * (y1 - y3);
+        } else {
+            y0 = x0 + x2;
+            y2 = zmul(x0 - x2, w1);
+            y1 = x1 + x3;
+            y3 = zmul(x1 - x3, iw1);
+
+            stateVec[i] = nrm * (y0 + y1);
+            stateVec[i | power1] = nrm * zmul(y0 - y1, w2);
+            stateVec[i | power2] = nrm * (y2 + y3);
+            stateVec[i | power1 | power2] = nrm * zmul(y2 - y3, w2);
+        }
+    }
+}
+
+// Partial sums of the amplitudes of the register of "length" bits at "start," for GroverDiffusion(). Each of the
+// "outerCount" values of the other bits gets "itemsPerOuter" consecutive partial sums, each over the register
+// permutations that are congruent to its slot, modulo "itemsPerOuter."
+void kernel groverdiffusionsum(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* sums)
+{
+    bitCapIntOcl Nthreads, lcv, outer, low, base, j;
+
+    Nthreads = get_global_size(0);
+    bitCapIntOcl maxI = bitCapIntOclPtr[0];
+    bitCapIntOcl start = bitCapIntOclPtr[1];
+    bitCapIntOcl length = bitCapIntOclPtr[2];
+    bitCapIntOcl itemsPerOuter = bitCapIntOclPtr[3];
+    bitCapIntOcl regPower = ONE_BCI << length;
+    bitCapIntOcl lowMask = (ONE_BCI << start) - ONE_BCI;
+    cmplx partSum;
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        outer = lcv / itemsPerOuter;
+        low = outer & lowMask;
+        base = low | ((outer ^ low) << length);
+
+        partSum = (cmplx)(ZERO_R1, ZERO_R1);
+        for (j = lcv & (itemsPerOuter - ONE_BCI); j < regPower; j += itemsPerOuter) {
+            partSum += stateVec[base | (j << start)];
+        }
+        sums[lcv] = partSum;
+    }
+}
+
+// The reflection of GroverDiffusion(): every amplitude loses twice the mean amplitude of its register, from the "sums"
+// over the register, by value of the other bits.
+void kernel groverdiffusion(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* sums)
+{
+    bitCapIntOcl Nthreads, lcv, low;
+
+    Nthreads = get_global_size(0);
+    bitCapIntOcl maxI = bitCapIntOclPtr[0];
+    bitCapIntOcl start = bitCapIntOclPtr[1];
+    bitCapIntOcl length = bitCapIntOclPtr[2];
+    bitCapIntOcl lowMask = (ONE_BCI << start) - ONE_BCI;
+    real1 nrm = (ONE_R1 + ONE_R1) / (real1)(ONE_BCI << length);
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        low = lcv & lowMask;
+        stateVec[lcv] -= nrm * sums[low | ((lcv >> (start + length)) << start)];
+    }
+}
+
 void kernel compose(
     global cmplx* stateVec1, global cmplx* stateVec2, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* nStateVec)
 {
@@ -882,6 +1137,96 @@ void kernel probmaskall(global cmplx* stateVec, constant bitCapIntOcl* bitCapInt
     }
 }
 
+// First pass of the prefix sum (CDF) of a probability table: each work item scans contiguous chunks in place, and
+// writes out each chunk's total. The chunk totals are scanned the same way, and then added back with probcdfadd. The
+// whole scan is O(n) work.
+void kernel probcdf(global real1* probs, constant bitCapIntOcl* bitCapIntOclPtr, global real1* chunkSums)
+{
+    bitCapIntOcl Nthreads, lcv, i, offset;
+
+    Nthreads = get_global_size(0);
+
+    bitCapIntOcl2 args = vload2(0, bitCapIntOclPtr);
+    bitCapIntOcl chunkCount = args.x;
+    bitCapIntOcl chunkSize = args.y;
+
+    real1 partial;
+
+    for (lcv = ID; lcv < chunkCount; lcv += Nthreads) {
+        offset = lcv * chunkSize;
+        partial = ZERO_R1;
+        for (i = 0U; i < chunkSize; i++) {
+            partial += probs[offset + i];
+            probs[offset + i] = partial;
+        }
+        chunkSums[lcv] = partial;
+    }
+}
+
+// Offset every chunk, after the first, by the (already scanned) total of all chunks before it.
+void kernel probcdfadd(global real1* probs, constant bitCapIntOcl* bitCapIntOclPtr, global real1* chunkSums)
+{
+    bitCapIntOcl Nthreads, lcv;
+
+    Nthreads = get_global_size(0);
+
+    bitCapIntOcl2 args = vload2(0, bitCapIntOclPtr);
+    bitCapIntOcl maxI = args.x;
+    bitCapIntOcl chunkPow = args.y;
+
+    for (lcv = ID + (ONE_BCI << chunkPow); lcv < maxI; lcv += Nthreads) {
+        probs[lcv] += chunkSums[(lcv >> chunkPow) - ONE_BCI];
+    }
+}
+
+// Binary search a CDF table for each uniform random sample, so that only the sampled indices have to be read back.
+void kernel samplecdf(global real1* cdf, constant bitCapIntOcl* bitCapIntOclPtr, global real1* rands,
+    global bitCapIntOcl* samples)
+{
+    bitCapIntOcl Nthreads, lcv, lo, hi, mid;
+
+    Nthreads = get_global_size(0);
+
+    bitCapIntOcl2 args = vload2(0, bitCapIntOclPtr);
+    bitCapIntOcl maxI = args.x;
+    bitCapIntOcl shots = args.y;
+
+    real1 totProb = cdf[maxI - ONE_BCI];
+    real1 target;
+
+    for (lcv = ID; lcv < shots; lcv += Nthreads) {
+        target = rands[lcv] * totProb;
+
+        // Find the first entry greater than the target.
+        lo = 0U;
+        hi = maxI;
+        while (lo < hi) {
+            mid = (lo + hi) >> ONE_BCI;
+            if (cdf[mid] <= target) {
+                lo = mid + ONE_BCI;
+            } else {
+                hi = mid;
+            }
+        }
+
+        // If rounding pushes a sample to the very top, it belongs to the first entry that reaches the total.
+        if (lo == maxI) {
+            lo = 0U;
+            hi = maxI - ONE_BCI;
+            while (lo < hi) {
+                mid = (lo + hi) >> ONE_BCI;
+                if (cdf[mid] < totProb) {
+                    lo = mid + ONE_BCI;
+                } else {
+                    hi = mid;
+                }
+            }
+        }
+
+        samples[lcv] = lo;
+    }
+}
+
 void kernel probparity(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global real1* oneChanceBuffer,
     local real1* lProbBuffer)
 {
@@ -928,6 +1273,56 @@ void kernel probparity(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntO
     }
 }
 
+void kernel expectationpauli(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr,
+    global real1* expectationBuffer, local real1* lProbBuffer)
+{
+    bitCapIntOcl Nthreads, lcv, locID, locNthreads;
+
+    Nthreads = get_global_size(0);
+
+    bitCapIntOcl4 args = vload4(0, bitCapIntOclPtr);
+    bitCapIntOcl maxI = args.x;
+    bitCapIntOcl xMask = args.y;
+    bitCapIntOcl zMask = args.z;
+    bool isImag = args.w;
+
+    real1 expectationPart = ZERO_R1;
+    real1 part;
+    cmplx amp, partner;
+    bitCapIntOcl v;
+    bool parity;
+
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        parity = false;
+        v = lcv & zMask;
+        while (v) {
+            parity = !parity;
+            v = v & (v - ONE_BCI);
+        }
+
+        // The real (or imaginary) part of conj(partner) * amp:
+        amp = stateVec[lcv];
+        partner = stateVec[lcv ^ xMask];
+        part = isImag ? ((partner.x * amp.y) - (partner.y * amp.x)) : dot(partner, amp);
+        expectationPart += parity ? -part : part;
+    }
+
+    locID = get_local_id(0);
+    locNthreads = get_local_size(0);
+    lProbBuffer[locID] = expectationPart;
+
+    for (lcv = (locNthreads >> ONE_BCI); lcv > 0U; lcv >>= ONE_BCI) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (locID < lcv) {
+            lProbBuffer[locID] += lProbBuffer[locID + lcv];
+        }
+    }
+
+    if (locID == 0U) {
+        expectationBuffer[get_group_id(0)] = lProbBuffer[0];
+    }
+}
+
 void kernel forcemparity(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global real1* oneChanceBuffer,
     local real1* lProbBuffer)
 {
@@ -977,7 +1372,14 @@ void kernel forcemparity(global cmplx* stateVec, constant bitCapIntOcl* bitCapIn
     }
 }
 
-void kernel rol(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* nStateVec)
+/*
+ * rol, inc, and cinc permute the state vector in place, each as two calls of the same kernel. Each call is an
+ * involution of the register's value, so every work item swaps its amplitude with its partner's, if its partner is
+ * larger. A rotation of the register's bits reverses all of them, then the low "split" bits and the rest, separately.
+ * Adding to the register reverses all of its values, then those below "split" and the rest, separately.
+ */
+
+void kernel rol(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr)
 {
     bitCapIntOcl Nthreads, lcv;
 
@@ -985,39 +1387,60 @@ void kernel rol(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr,
     bitCapIntOcl maxI = bitCapIntOclPtr[0];
     bitCapIntOcl regMask = bitCapIntOclPtr[1];
     bitCapIntOcl otherMask = bitCapIntOclPtr[2];
-    bitCapIntOcl lengthMask = bitCapIntOclPtr[3] - ONE_BCI;
-    bitCapIntOcl start = bitCapIntOclPtr[4];
-    bitCapIntOcl shift = bitCapIntOclPtr[5];
-    bitCapIntOcl length = bitCapIntOclPtr[6];
-    bitCapIntOcl otherRes, regRes, regInt, inInt;
+    bitCapIntOcl start = bitCapIntOclPtr[3];
+    bitCapIntOcl length = bitCapIntOclPtr[4];
+    bitCapIntOcl split = bitCapIntOclPtr[5];
+    bitCapIntOcl regInt, partner, j;
+    bitCapIntOcl p;
+    cmplx amp;
     for (lcv = ID; lcv < maxI; lcv += Nthreads) {
-        otherRes = (lcv & otherMask);
-        regRes = (lcv & regMask);
-        regInt = regRes >> start;
-        inInt = ((regInt >> shift) | (regInt << (length - shift))) & lengthMask;
-        nStateVec[lcv] = stateVec[(inInt << start) | otherRes];
+        regInt = (lcv & regMask) >> start;
+        partner = 0U;
+        for (p = 0U; p < split; p++) {
+            partner |= ((regInt >> p) & ONE_BCI) << (split - ONE_BCI - p);
+        }
+        for (p = split; p < length; p++) {
+            partner |= ((regInt >> p) & ONE_BCI) << (length - ONE_BCI - p + split);
+        }
+        if (partner <= regInt) {
+            continue;
+        }
+
+        j = (lcv & otherMask) | (partner << start);
+        amp = stateVec[lcv];
+        stateVec[lcv] = stateVec[j];
+        stateVec[j] = amp;
     }
 }
 
-void kernel inc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* nStateVec)
+void kernel inc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr)
 {
-    bitCapIntOcl Nthreads, i;
+    bitCapIntOcl Nthreads, lcv;
 
     Nthreads = get_global_size(0);
     bitCapIntOcl maxI = bitCapIntOclPtr[0];
     bitCapIntOcl inOutMask = bitCapIntOclPtr[1];
     bitCapIntOcl otherMask = bitCapIntOclPtr[2];
-    bitCapIntOcl lengthMask = bitCapIntOclPtr[3] - ONE_BCI;
-    bitCapIntOcl inOutStart = bitCapIntOclPtr[4];
-    bitCapIntOcl toAdd = bitCapIntOclPtr[5];
-    for (i = ID; i < maxI; i += Nthreads) {
-        nStateVec[(((((i & inOutMask) >> inOutStart) + toAdd) & lengthMask) << inOutStart) | (i & otherMask)] =
-            stateVec[i];
+    bitCapIntOcl inOutStart = bitCapIntOclPtr[3];
+    bitCapIntOcl lengthMask = bitCapIntOclPtr[4];
+    bitCapIntOcl split = bitCapIntOclPtr[5];
+    bitCapIntOcl regInt, partner, j;
+    cmplx amp;
+    for (lcv = ID; lcv < maxI; lcv += Nthreads) {
+        regInt = (lcv & inOutMask) >> inOutStart;
+        partner = (regInt < split) ? (split - ONE_BCI - regInt) : (split + lengthMask - regInt);
+        if (partner <= regInt) {
+            continue;
+        }
+
+        j = (lcv & otherMask) | (partner << inOutStart);
+        amp = stateVec[lcv];
+        stateVec[lcv] = stateVec[j];
+        stateVec[j] = amp;
     }
 }
 
-void kernel cinc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, global cmplx* nStateVec,
-    constant bitCapIntOcl* controlPowers)
+void kernel cinc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr, constant bitCapIntOcl* controlPowers)
 {
     bitCapIntOcl Nthreads, i, lcv;
 
@@ -1025,14 +1448,15 @@ void kernel cinc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr,
     bitCapIntOcl maxI = bitCapIntOclPtr[0];
     bitCapIntOcl inOutMask = bitCapIntOclPtr[1];
     bitCapIntOcl otherMask = bitCapIntOclPtr[2];
-    bitCapIntOcl lengthMask = bitCapIntOclPtr[3] - ONE_BCI;
-    bitCapIntOcl inOutStart = bitCapIntOclPtr[4];
-    bitCapIntOcl toAdd = bitCapIntOclPtr[5];
+    bitCapIntOcl inOutStart = bitCapIntOclPtr[3];
+    bitCapIntOcl lengthMask = bitCapIntOclPtr[4];
+    bitCapIntOcl split = bitCapIntOclPtr[5];
     bitCapIntOcl controlLen = bitCapIntOclPtr[6];
     bitCapIntOcl controlMask = bitCapIntOclPtr[7];
-    bitCapIntOcl otherRes;
+    bitCapIntOcl regInt, partner, j;
     bitCapIntOcl iHigh, iLow;
     bitLenInt p;
+    cmplx amp;
     for (lcv = ID; lcv < maxI; lcv += Nthreads) {
         iHigh = lcv;
         i = 0U;
@@ -1041,11 +1465,18 @@ void kernel cinc(global cmplx* stateVec, constant bitCapIntOcl* bitCapIntOclPtr,
             i |= iLow;
             iHigh = (iHigh ^ iLow) << ONE_BCI;
         }
-        i |= iHigh;
+        i |= iHigh | controlMask;
 
-        otherRes = i & otherMask;
-        nStateVec[(((((i & inOutMask) >> inOutStart) + toAdd) & lengthMask) << inOutStart) | otherRes | controlMask] =
-            stateVec[i | controlMask];
+        regInt = (i & inOutMask) >> inOutStart;
+        partner = (regInt < split) ? (split - ONE_BCI - regInt) : (split + lengthMask - regInt);
+        if (partner <= regInt) {
+            continue;
+        }
+
+        j = (i & otherMask) | (partner << inOutStart);
+        amp = stateVec[i];
+        stateVec[i] = stateVec[j];
+        stateVec[j] = amp;
     }
 }
 
@@ -0,0 +1,262 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qprofiler.hpp"
+
+namespace Qrack {
+
+namespace {
+
+struct TraceEvent {
+    QProfileOp op;
+    uint64_t startNs;
+    uint64_t durationNs;
+    uint64_t bytes;
+    size_t threadId;
+};
+
+const char* profileOpNames[PROFILE_OP_COUNT] = { "Apply2x2", "QUnit::Compose", "QUnit::Decompose",
+    "QEngineOCL::Upload", "QEngineOCL::Readback", "QStabilizerHybrid::SwitchToEngine", "QUnit::TrySeparate" };
+
+// Zero initialized, as static storage, before any constructor runs
+std::atomic<uint64_t> profileCounts[PROFILE_OP_COUNT];
+std::atomic<uint64_t> profileNanoseconds[PROFILE_OP_COUNT];
+std::atomic<uint64_t> profileBytes[PROFILE_OP_COUNT];
+std::atomic<uint64_t> profileHistograms[PROFILE_OP_COUNT][QRACK_PROFILE_HISTOGRAM_BINS];
+std::atomic<uint64_t> droppedTraceEvents;
+std::atomic<uint64_t> kernelCounts[QRACK_PROFILE_MAX_KERNELS];
+std::atomic<uint64_t> kernelNanoseconds[QRACK_PROFILE_MAX_KERNELS];
+
+std::string& KernelName(unsigned kernel)
+{
+    static std::string kernelNames[QRACK_PROFILE_MAX_KERNELS];
+    return kernelNames[kernel];
+}
+
+void WriteTraceEvents(std::ostream& os, const std::vector<TraceEvent>& events)
+{
+    // Complete ("X") events, with microsecond timestamps, as the format expects
+    os << "{\"traceEvents\":[";
+    std::ios::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0U; i < events.size(); i++) {
+        const TraceEvent& e = events[i];
+        os << (i ? "," : "") << "\n{\"name\":\"" << profileOpNames[e.op] << "\",\"cat\":\"qrack\",\"ph\":\"X\""
+           << ",\"ts\":" << (e.startNs / 1000.0) << ",\"dur\":" << (e.durationNs / 1000.0) << ",\"pid\":1"
+           << ",\"tid\":" << (e.threadId & 0xFFFFFFFFU) << ",\"args\":{\"bytes\":" << e.bytes << "}}";
+    }
+    os.flags(flags);
+    os << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":" << droppedTraceEvents.load();
+
+    // Device kernel totals, (which have no host timestamps to place them on the timeline)
+    os << ",\"kernels\":{";
+    bool isFirst = true;
+    for (unsigned i = 0U; i < QRACK_PROFILE_MAX_KERNELS; i++) {
+        if (!kernelCounts[i].load()) {
+            continue;
+        }
+        os << (isFirst ? "" : ",") << "\"" << (KernelName(i).size() ? KernelName(i) : std::to_string(i))
+           << "\":{\"count\":" << kernelCounts[i].load() << ",\"ns\":" << kernelNanoseconds[i].load() << "}";
+        isFirst = false;
+    }
+    os << "}}}\n";
+}
+
+bool IsEnvSet(const char* name) { return getenv(name) && (std::string(getenv(name)) != "0"); }
+
+// The trace, (and the file it is written to at exit, if any)
+struct TraceLog {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    std::string exitFileName;
+
+    TraceLog()
+    {
+        if (IsEnvSet("QRACK_PROFILE_TRACE")) {
+            exitFileName = getenv("QRACK_PROFILE_TRACE");
+        }
+    }
+
+    ~TraceLog()
+    {
+        if (exitFileName.size()) {
+            std::ofstream ofs(exitFileName.c_str());
+            WriteTraceEvents(ofs, events);
+        }
+    }
+};
+
+TraceLog& GetTraceLog()
+{
+    static TraceLog traceLog;
+    return traceLog;
+}
+
+unsigned HistogramBin(uint64_t durationNs)
+{
+    unsigned bin = 0U;
+    while (durationNs && (bin < (QRACK_PROFILE_HISTOGRAM_BINS - 1U))) {
+        durationNs >>= 1U;
+        bin++;
+    }
+    return bin;
+}
+
+} // namespace
+
+std::atomic<bool> QProfiler::isEnabled(
+    IsEnvSet("QRACK_PROFILE") || IsEnvSet("QRACK_PROFILE_TRACE") || IsEnvSet("QRACK_OCL_PROFILE"));
+std::atomic<bool> QProfiler::isTracing(IsEnvSet("QRACK_PROFILE_TRACE"));
+
+void QProfiler::SetEnabled(bool enable)
+{
+    isEnabled.store(enable);
+    if (!enable) {
+        isTracing.store(false);
+    }
+}
+
+void QProfiler::SetTracing(bool enable)
+{
+    if (enable) {
+        isEnabled.store(true);
+    }
+    isTracing.store(enable);
+}
+
+void QProfiler::Reset()
+{
+    for (unsigned i = 0U; i < PROFILE_OP_COUNT; i++) {
+        profileCounts[i].store(0U);
+        profileNanoseconds[i].store(0U);
+        profileBytes[i].store(0U);
+        for (unsigned j = 0U; j < QRACK_PROFILE_HISTOGRAM_BINS; j++) {
+            profileHistograms[i][j].store(0U);
+        }
+    }
+    droppedTraceEvents.store(0U);
+    for (unsigned i = 0U; i < QRACK_PROFILE_MAX_KERNELS; i++) {
+        kernelCounts[i].store(0U);
+        kernelNanoseconds[i].store(0U);
+    }
+
+    TraceLog& traceLog = GetTraceLog();
+    std::lock_guard<std::mutex> lock(traceLog.mutex);
+    traceLog.events.clear();
+}
+
+uint64_t QProfiler::Now()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    // (Offset by 1, so that a started timer is never 0)
+    return 1U +
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch)
+            .count();
+}
+
+void QProfiler::Record(QProfileOp op, uint64_t startNs, uint64_t durationNs, uint64_t bytes)
+{
+    profileCounts[op].fetch_add(1U, std::memory_order_relaxed);
+    profileNanoseconds[op].fetch_add(durationNs, std::memory_order_relaxed);
+    profileBytes[op].fetch_add(bytes, std::memory_order_relaxed);
+    profileHistograms[op][HistogramBin(durationNs)].fetch_add(1U, std::memory_order_relaxed);
+
+    if (!IsTracing()) {
+        return;
+    }
+
+    TraceLog& traceLog = GetTraceLog();
+    std::lock_guard<std::mutex> lock(traceLog.mutex);
+    if (traceLog.events.size() >= QRACK_PROFILE_TRACE_MAX_EVENTS) {
+        droppedTraceEvents.fetch_add(1U, std::memory_order_relaxed);
+        return;
+    }
+    traceLog.events.push_back(
+        TraceEvent{ op, startNs, durationNs, bytes, std::hash<std::thread::id>()(std::this_thread::get_id()) });
+}
+
+uint64_t QProfiler::GetCount(QProfileOp op) { return profileCounts[op].load(); }
+uint64_t QProfiler::GetNanoseconds(QProfileOp op) { return profileNanoseconds[op].load(); }
+uint64_t QProfiler::GetBytes(QProfileOp op) { return profileBytes[op].load(); }
+uint64_t QProfiler::GetDroppedTraceEvents() { return droppedTraceEvents.load(); }
+
+uint64_t QProfiler::GetHistogram(QProfileOp op, unsigned bin)
+{
+    return (bin < QRACK_PROFILE_HISTOGRAM_BINS) ? profileHistograms[op][bin].load() : 0U;
+}
+
+const char* QProfiler::GetName(QProfileOp op) { return (op < PROFILE_OP_COUNT) ? profileOpNames[op] : "unknown"; }
+
+void QProfiler::SetKernelName(unsigned kernel, const std::string& name)
+{
+    if (kernel >= QRACK_PROFILE_MAX_KERNELS) {
+        return;
+    }
+
+    TraceLog& traceLog = GetTraceLog();
+    std::lock_guard<std::mutex> lock(traceLog.mutex);
+    KernelName(kernel) = name;
+}
+
+void QProfiler::RecordKernel(unsigned kernel, uint64_t durationNs)
+{
+    if (kernel >= QRACK_PROFILE_MAX_KERNELS) {
+        return;
+    }
+
+    kernelCounts[kernel].fetch_add(1U, std::memory_order_relaxed);
+    kernelNanoseconds[kernel].fetch_add(durationNs, std::memory_order_relaxed);
+}
+
+uint64_t QProfiler::GetKernelCount(unsigned kernel)
+{
+    return (kernel < QRACK_PROFILE_MAX_KERNELS) ? kernelCounts[kernel].load() : 0U;
+}
+
+uint64_t QProfiler::GetKernelNanoseconds(unsigned kernel)
+{
+    return (kernel < QRACK_PROFILE_MAX_KERNELS) ? kernelNanoseconds[kernel].load() : 0U;
+}
+
+const char* QProfiler::GetKernelName(unsigned kernel)
+{
+    return (kernel < QRACK_PROFILE_MAX_KERNELS) ? KernelName(kernel).c_str() : "";
+}
+
+void QProfiler::WriteTrace(std::ostream& os)
+{
+    TraceLog& traceLog = GetTraceLog();
+    std::lock_guard<std::mutex> lock(traceLog.mutex);
+    WriteTraceEvents(os, traceLog.events);
+}
+
+bool QProfiler::WriteTrace(const char* fileName)
+{
+    std::ofstream ofs(fileName);
+    if (!ofs) {
+        return false;
+    }
+    WriteTrace(ofs);
+    return (bool)ofs;
+}
+
+} // namespace Qrack
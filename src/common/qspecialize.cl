@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// Gate kernels that take no arguments but the state vector. Each program built from this file is specialized on one
+// gate, by #define lines prepended to it, (see OCLDeviceContext::GetSpecialized()):
+//
+// SPEC_MAXI: the count of amplitude pairs to iterate over
+// SPEC_QMASK: (for apply2x2singlespec) one less than the target bit power
+// SPEC_QMASK1, SPEC_QMASK2: (for apply2x2doublespec) one less than each of the two sorted bit powers
+// SPEC_OFFSET1, SPEC_OFFSET2: the offsets of the pair of amplitudes to mix, from the pushed-apart index
+// SPEC_MTRX: the 8 real components of the 2x2 matrix, in row-major order
+//
+// With every mask and matrix entry a literal, the compiler folds the index arithmetic, and, (under
+// -cl-fast-relaxed-math,) drops the products with matrix entries of 0 or 1, so that X, Z, CNOT, and the like reduce to
+// bare swaps and sign flips.
+
+inline cmplx2 zmatrixmulspec(const cmplx4 lhs, const cmplx2 rhs)
+{
+    return (cmplx2)((lhs.lo.x * rhs.x) - (lhs.lo.y * rhs.y) + (lhs.lo.z * rhs.z) - (lhs.lo.w * rhs.w),
+        (lhs.lo.x * rhs.y) + (lhs.lo.y * rhs.x) + (lhs.lo.z * rhs.w) + (lhs.lo.w * rhs.z),
+        (lhs.hi.x * rhs.x) - (lhs.hi.y * rhs.y) + (lhs.hi.z * rhs.z) - (lhs.hi.w * rhs.w),
+        (lhs.hi.x * rhs.y) + (lhs.hi.y * rhs.x) + (lhs.hi.z * rhs.w) + (lhs.hi.w * rhs.z));
+}
+
+#define APPLY_AND_OUT_SPEC()                                                                                           \
+    mulRes.lo = stateVec[i | SPEC_OFFSET1];                                                                            \
+    mulRes.hi = stateVec[i | SPEC_OFFSET2];                                                                            \
+                                                                                                                       \
+    mulRes = zmatrixmulspec(mtrx, mulRes);                                                                             \
+                                                                                                                       \
+    stateVec[i | SPEC_OFFSET1] = mulRes.lo;                                                                            \
+    stateVec[i | SPEC_OFFSET2] = mulRes.hi;
+
+#ifdef SPEC_QMASK
+void kernel apply2x2singlespec(global cmplx* stateVec)
+{
+    const cmplx4 mtrx = (cmplx4)(SPEC_MTRX);
+    bitCapIntOcl lcv, i;
+    cmplx2 mulRes;
+
+    for (lcv = get_global_id(0); lcv < SPEC_MAXI; lcv += get_global_size(0)) {
+        i = lcv & SPEC_QMASK;
+        i |= (lcv ^ i) << ONE_BCI;
+        APPLY_AND_OUT_SPEC();
+    }
+}
+#endif
+
+#ifdef SPEC_QMASK1
+void kernel apply2x2doublespec(global cmplx* stateVec)
+{
+    const cmplx4 mtrx = (cmplx4)(SPEC_MTRX);
+    bitCapIntOcl lcv, i, iLow, iHigh;
+    cmplx2 mulRes;
+
+    for (lcv = get_global_id(0); lcv < SPEC_MAXI; lcv += get_global_size(0)) {
+        i = lcv & SPEC_QMASK1;
+        iHigh = (lcv ^ i) << ONE_BCI;
+        iLow = iHigh & SPEC_QMASK2;
+        i |= iLow | ((iHigh ^ iLow) << ONE_BCI);
+        APPLY_AND_OUT_SPEC();
+    }
+}
+#endif
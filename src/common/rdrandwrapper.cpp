@@ -20,6 +20,10 @@
 #include <sys/types.h>
 #endif
 
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
 #include "rdrandwrapper.hpp"
 
 namespace Qrack {
@@ -36,6 +40,85 @@ bool getRdRand(unsigned int* pv)
     return false;
 }
 
+size_t getRdRandBulk(unsigned int* pv, size_t count)
+{
+#if ENABLE_RDRAND
+    // RDRAND almost never underflows, so only a failed step pays for the retry loop.
+    for (size_t i = 0; i < count; i++) {
+        if (!_rdrand32_step(pv + i) && !getRdRand(pv + i)) {
+            return i;
+        }
+    }
+    return count;
+#else
+    return 0U;
+#endif
+}
+
+#if ENABLE_RDRAND
+static bool SupportsRDSEED()
+{
+    const unsigned int flag_RDSEED = (1 << 18);
+
+#if _MSC_VER
+    int ex[4];
+    __cpuid(ex, 0);
+    if (ex[0] < 7) {
+        return false;
+    }
+    __cpuidex(ex, 7, 0);
+
+    return ((ex[1] & flag_RDSEED) == flag_RDSEED);
+#else
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    return ((ebx & flag_RDSEED) == flag_RDSEED);
+#endif
+}
+#endif
+
+bool getRdSeed(uint64_t* pv)
+{
+#if ENABLE_RDRAND
+    static const bool isRdSeed = SupportsRDSEED();
+
+    unsigned int halves[2];
+    for (int h = 0; h < 2; h++) {
+        bool isDone = false;
+        if (isRdSeed) {
+            // RDSEED draws on the entropy source directly, so it underflows far more often than RDRAND.
+            const int max_rdseed_tries = 100;
+            for (int i = 0; (i < max_rdseed_tries) && !isDone; ++i) {
+                isDone = _rdseed32_step(halves + h);
+                if (!isDone) {
+                    _mm_pause();
+                }
+            }
+        }
+        if (!isDone && !getRdRand(halves + h)) {
+            return false;
+        }
+    }
+    *pv = ((uint64_t)halves[1] << 32U) | halves[0];
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The most significant bits of "v" that fit in the mantissa of real1, scaled to [0, 1), (so the result can't round up
+// to 1)
+static real1 WordToReal(unsigned int v)
+{
+    const int bits = std::min(32, std::numeric_limits<real1>::digits);
+    return (real1)(v >> (32 - bits)) * (ONE_R1 / (real1)(1ULL << bits));
+}
+
 #if ENABLE_RNDFILE
 // From http://www.cplusplus.com/forum/unices/3548/
 std::vector<std::string> _readDirectoryFileNames(const std::string& path)
@@ -117,6 +200,63 @@ bool _readNextRandDataFile(size_t fileOffset, std::vector<char>& data)
 }
 #endif
 
+RdRandom::RdRandom()
+    : bufferOffset(QRACK_RDRAND_BUFFER_SIZE)
+    , isCounterPrng(getenv("QRACK_RDRAND_PRNG") != NULL)
+    , prngKey(0)
+    , prngCounter(QRACK_RDRAND_PRNG_RESEED)
+#if ENABLE_RNDFILE
+    , didInit(false)
+    , isPageTwo(false)
+    , data1()
+    , data2()
+    , dataOffset(0)
+    , fileOffset(0)
+#endif
+{
+}
+
+void RdRandom::SetCounterPrng(bool isPrng)
+{
+    isCounterPrng = isPrng;
+    // Discard anything buffered from the other source.
+    bufferOffset = QRACK_RDRAND_BUFFER_SIZE;
+}
+
+void RdRandom::Rekey()
+{
+    if (!getRdSeed(&prngKey)) {
+        throw "Failed to get hardware RNG number.";
+    }
+    prngCounter = 0;
+}
+
+void RdRandom::Refill()
+{
+    if (!isCounterPrng) {
+        if (getRdRandBulk(buffer, QRACK_RDRAND_BUFFER_SIZE) < QRACK_RDRAND_BUFFER_SIZE) {
+            throw "Failed to get hardware RNG number.";
+        }
+        bufferOffset = 0;
+        return;
+    }
+
+    // SplitMix64, as a counter-based generator: each output is a mix of the key and the count of outputs so far.
+    for (size_t i = 0; i < QRACK_RDRAND_BUFFER_SIZE; i += 2U) {
+        if (prngCounter >= QRACK_RDRAND_PRNG_RESEED) {
+            Rekey();
+        }
+        prngCounter++;
+        uint64_t z = prngKey + prngCounter * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27U)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31U;
+        buffer[i] = (unsigned int)z;
+        buffer[i + 1U] = (unsigned int)(z >> 32U);
+    }
+    bufferOffset = 0;
+}
+
 bool RdRandom::SupportsRDRAND()
 {
 #if ENABLE_RDRAND
@@ -143,8 +283,8 @@ bool RdRandom::SupportsRDRAND()
 real1 RdRandom::Next()
 {
     real1 res = 0;
-    real1 part = 1;
 #if ENABLE_RNDFILE
+    real1 part = 1;
     if (!didInit) {
         while ((data1.size() - dataOffset) < 4) {
             if (_readNextRandDataFile(fileOffset, data1)) {
@@ -184,19 +324,31 @@ real1 RdRandom::Next()
     dataOffset += 4;
     return res;
 #else
-    unsigned int v;
-    if (!getRdRand(&v)) {
-        throw "Failed to get hardware RNG number.";
+    res = WordToReal(NextWord());
+#endif
+    return res;
+}
+
+void RdRandom::FillRandom(real1* values, size_t count)
+{
+#if ENABLE_RNDFILE
+    for (size_t i = 0; i < count; i++) {
+        values[i] = Next();
     }
-    v &= 0x7fffffff;
-    for (int i = 0; i < 31; i++) {
-        part /= 2;
-        if (v & (1U << i)) {
-            res += part;
+#else
+    size_t i = 0;
+    while (i < count) {
+        if (bufferOffset == QRACK_RDRAND_BUFFER_SIZE) {
+            Refill();
         }
+        const size_t batch = std::min(count - i, (size_t)(QRACK_RDRAND_BUFFER_SIZE - bufferOffset));
+        for (size_t j = 0; j < batch; j++) {
+            values[i + j] = WordToReal(buffer[bufferOffset + j]);
+        }
+        bufferOffset += batch;
+        i += batch;
     }
 #endif
-    return res;
 }
 
 } // namespace Qrack
@@ -0,0 +1,190 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+#define WORKER_SPIN_COUNT 256
+
+namespace Qrack {
+
+ThreadPool* ThreadPool::Instance()
+{
+    static ThreadPool instance;
+    return &instance;
+}
+
+ThreadPool::ThreadPool()
+    : workerCount(0)
+    , pendingCount(0)
+    , nextWorker(0)
+    , quit(false)
+{
+    // Oversubscription has no benefit past a small multiple of the hardware thread count.
+    int32_t maxWorkers = std::max((int32_t)(2U * std::thread::hardware_concurrency()), 8);
+    for (int32_t i = 0; i < maxWorkers; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    std::unique_lock<std::mutex> lock(sleepLock);
+    quit = true;
+    lock.unlock();
+    sleepCv.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+void ThreadPool::Reserve(int32_t threadCount)
+{
+    // The calling thread always works on its own batch, so it counts as one of the threads.
+    int32_t nWorkerCount = std::min(threadCount - 1, (int32_t)workers.size());
+    if (nWorkerCount <= workerCount) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(reserveLock);
+    for (int32_t i = workerCount; i < nWorkerCount; i++) {
+        threads.push_back(std::thread([this, i] { WorkerLoop(i); }));
+        workerCount++;
+    }
+}
+
+void ThreadPool::RunAll(int32_t taskCount, const fp_t& fn)
+{
+    int32_t nWorkers = workerCount;
+
+    if ((taskCount <= 1) || (nWorkers == 0)) {
+        for (int32_t i = 0; i < taskCount; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.fn = &fn;
+    batch.remaining = taskCount;
+
+    // Task 0 is kept for the calling thread. The rest are dealt out, round-robin, starting from a rotating offset so
+    // that concurrent callers don't all pile onto the same worker.
+    uint32_t offset = nextWorker++;
+    for (int32_t i = 1; i < taskCount; i++) {
+        Worker* worker = workers[(offset + i) % nWorkers].get();
+        std::lock_guard<std::mutex> guard(worker->lock);
+        worker->tasks.push_back(Task{ &batch, i });
+    }
+    pendingCount += taskCount - 1;
+
+    // Taking and releasing the lock orders the count update before any sleeping worker's predicate check.
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+    }
+    sleepCv.notify_all();
+
+    RunTask(&batch, 0);
+
+    // Even if a task has thrown, the batch lives on this stack, so every task has to finish before it is rethrown.
+    while (batch.remaining > 0) {
+        if (!TryRunOne(-1)) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (batch.error) {
+        std::rethrow_exception(batch.error);
+    }
+}
+
+void ThreadPool::RunTask(Batch* batch, int32_t index)
+{
+    try {
+        (*(batch->fn))(index);
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(batch->errorLock);
+        if (!batch->error) {
+            batch->error = std::current_exception();
+        }
+    }
+    batch->remaining--;
+}
+
+bool ThreadPool::TryRunOne(int32_t home)
+{
+    Task task = { NULL, 0 };
+    bool isFound = false;
+    int32_t nWorkers = workerCount;
+
+    if (home >= 0) {
+        Worker* worker = workers[home].get();
+        std::lock_guard<std::mutex> guard(worker->lock);
+        if (worker->tasks.size()) {
+            task = worker->tasks.back();
+            worker->tasks.pop_back();
+            isFound = true;
+        }
+    }
+
+    for (int32_t i = 1; !isFound && (i <= nWorkers); i++) {
+        int32_t victim = (home + i) % nWorkers;
+        if (victim < 0) {
+            victim += nWorkers;
+        }
+        Worker* worker = workers[victim].get();
+        std::lock_guard<std::mutex> guard(worker->lock);
+        if (worker->tasks.size()) {
+            task = worker->tasks.front();
+            worker->tasks.pop_front();
+            isFound = true;
+        }
+    }
+
+    if (!isFound) {
+        return false;
+    }
+
+    pendingCount--;
+    RunTask(task.batch, task.index);
+
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int32_t home)
+{
+    int32_t idleCount = 0;
+    for (;;) {
+        if (TryRunOne(home)) {
+            idleCount = 0;
+            continue;
+        }
+
+        // Gates tend to arrive back-to-back, so stay awake briefly before paying for a condition variable wake-up.
+        if (idleCount < WORKER_SPIN_COUNT) {
+            idleCount++;
+            std::this_thread::yield();
+            continue;
+        }
+        idleCount = 0;
+
+        std::unique_lock<std::mutex> lock(sleepLock);
+        sleepCv.wait(lock, [this] { return quit || (pendingCount > 0); });
+        if (quit) {
+            return;
+        }
+    }
+}
+
+} // namespace Qrack
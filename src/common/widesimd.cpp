@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include "common/widesimd.hpp"
+
+namespace Qrack {
+
+#if ENABLE_COMPLEX_X4
+// Defined in widesimd_x4.cpp, which is the only translation unit compiled with the wider instruction set.
+void Apply2x2RunX4(complex* amps0, complex* amps1, const bitCapIntOcl& count, const complex* mtrx);
+real1 NormRunX4(const complex* amps, const bitCapIntOcl& count, const real1& norm_thresh);
+
+static bool CheckWideSimd()
+{
+    __builtin_cpu_init();
+#if ENABLE_COMPLEX8
+    return __builtin_cpu_supports("avx");
+#else
+    return __builtin_cpu_supports("avx512f");
+#endif
+}
+#endif
+
+bool IsWideSimdSupported()
+{
+#if ENABLE_COMPLEX_X4
+    static const bool isSupported = CheckWideSimd();
+    return isSupported;
+#else
+    return false;
+#endif
+}
+
+void Apply2x2Run(complex* amps0, complex* amps1, const bitCapIntOcl& count, const complex* mtrx)
+{
+#if ENABLE_COMPLEX_X4
+    if (IsWideSimdSupported()) {
+        Apply2x2RunX4(amps0, amps1, count, mtrx);
+        return;
+    }
+#endif
+
+    complex Y0;
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        Y0 = amps0[i];
+        amps0[i] = (mtrx[0] * Y0) + (mtrx[1] * amps1[i]);
+        amps1[i] = (mtrx[2] * Y0) + (mtrx[3] * amps1[i]);
+    }
+}
+
+real1 NormRun(const complex* amps, const bitCapIntOcl& count, const real1& norm_thresh)
+{
+#if ENABLE_COMPLEX_X4
+    if (IsWideSimdSupported()) {
+        return NormRunX4(amps, count, norm_thresh);
+    }
+#endif
+
+    real1 nrmSqr = ZERO_R1;
+    real1 nrm;
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        nrm = norm(amps[i]);
+        if (nrm >= norm_thresh) {
+            nrmSqr += nrm;
+        }
+    }
+
+    return nrmSqr;
+}
+
+} // namespace Qrack
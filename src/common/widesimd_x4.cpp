@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// This file is compiled with AVX, (or AVX-512, for double precision,) enabled. Nothing in it may be called unless
+// IsWideSimdSupported() returns true.
+
+#include "common/widesimd.hpp"
+
+#if ENABLE_COMPLEX8
+#include "common/complex8x4simd.hpp"
+#define complex4 Complex8x4Simd
+#else
+#include "common/complex16x4simd.hpp"
+#define complex4 Complex16x4Simd
+#endif
+
+namespace Qrack {
+
+void Apply2x2RunX4(complex* amps0, complex* amps1, const bitCapIntOcl& count, const complex* mtrx)
+{
+    const complex4 m00(mtrx[0]);
+    const complex4 m01(mtrx[1]);
+    const complex4 m10(mtrx[2]);
+    const complex4 m11(mtrx[3]);
+
+    bitCapIntOcl i = 0;
+    for (; (i + WIDE_SIMD_WIDTH) <= count; i += WIDE_SIMD_WIDTH) {
+        complex4 Y0(amps0 + i);
+        complex4 Y1(amps1 + i);
+        ((m00 * Y0) + (m01 * Y1)).store(amps0 + i);
+        ((m10 * Y0) + (m11 * Y1)).store(amps1 + i);
+    }
+
+    complex Y0;
+    for (; i < count; i++) {
+        Y0 = amps0[i];
+        amps0[i] = (mtrx[0] * Y0) + (mtrx[1] * amps1[i]);
+        amps1[i] = (mtrx[2] * Y0) + (mtrx[3] * amps1[i]);
+    }
+}
+
+real1 NormRunX4(const complex* amps, const bitCapIntOcl& count, const real1& norm_thresh)
+{
+    bitCapIntOcl i = 0;
+    real1 nrmSqr;
+
+#if ENABLE_COMPLEX8
+    const __m256 thresh = _mm256_set1_ps(norm_thresh);
+    __m256 sum = _mm256_setzero_ps();
+    for (; (i + WIDE_SIMD_WIDTH) <= count; i += WIDE_SIMD_WIDTH) {
+        __m256 nrms = norms(complex4(amps + i));
+        sum = _mm256_add_ps(sum, _mm256_and_ps(nrms, _mm256_cmp_ps(nrms, thresh, _CMP_GE_OQ)));
+    }
+    // Every norm was summed twice, once in each lane of its complex number.
+    float sums[8];
+    _mm256_storeu_ps(sums, sum);
+    nrmSqr = ((sums[0] + sums[1]) + (sums[2] + sums[3]) + (sums[4] + sums[5]) + (sums[6] + sums[7])) / 2;
+#else
+    const __m512d thresh = _mm512_set1_pd(norm_thresh);
+    __m512d sum = _mm512_setzero_pd();
+    for (; (i + WIDE_SIMD_WIDTH) <= count; i += WIDE_SIMD_WIDTH) {
+        __m512d nrms = norms(complex4(amps + i));
+        sum = _mm512_mask_add_pd(sum, _mm512_cmp_pd_mask(nrms, thresh, _CMP_GE_OQ), sum, nrms);
+    }
+    // Every norm was summed twice, once in each lane of its complex number.
+    nrmSqr = _mm512_reduce_add_pd(sum) / 2;
+#endif
+
+    real1 nrm;
+    for (; i < count; i++) {
+        nrm = norm(amps[i]);
+        if (nrm >= norm_thresh) {
+            nrmSqr += nrm;
+        }
+    }
+
+    return nrmSqr;
+}
+
+} // namespace Qrack
@@ -0,0 +1,190 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <cmath>
+#include <stdexcept>
+
+#include "qinterface.hpp"
+
+namespace Qrack {
+
+CompiledHamiltonian::CompiledHamiltonian(const Hamiltonian& h, const real1& timeDiff, const int& o)
+    : hamiltonian(h)
+    , timeStep(timeDiff)
+    , order(o)
+{
+    if ((order != 1) && (order != 2) && (order != 4)) {
+        throw std::invalid_argument("CompiledHamiltonian order must be 1, 2, or 4.");
+    }
+
+    Compile();
+}
+
+bool CompiledHamiltonian::IsSameGate(const HamiltonianOp& a, const HamiltonianOp& b)
+{
+    if ((a.uniform != b.uniform) || (a.targetBit != b.targetBit) || (a.controlLen != b.controlLen)) {
+        return false;
+    }
+
+    if (!a.uniform && (a.controlLen != 0) && (a.anti != b.anti)) {
+        return false;
+    }
+
+    for (bitLenInt i = 0; i < a.controlLen; i++) {
+        if (a.controls[i] != b.controls[i]) {
+            return false;
+        }
+        if ((a.toggles && a.toggles[i]) != (b.toggles && b.toggles[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CompiledHamiltonian::IsDisjoint(const HamiltonianOp& a, const HamiltonianOp& b)
+{
+    if (a.targetBit == b.targetBit) {
+        return false;
+    }
+
+    for (bitLenInt i = 0; i < a.controlLen; i++) {
+        if (a.controls[i] == b.targetBit) {
+            return false;
+        }
+        for (bitLenInt j = 0; j < b.controlLen; j++) {
+            if (a.controls[i] == b.controls[j]) {
+                return false;
+            }
+        }
+    }
+
+    for (bitLenInt j = 0; j < b.controlLen; j++) {
+        if (b.controls[j] == a.targetBit) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CompiledHamiltonian::AppendStrangStep(std::vector<std::pair<size_t, real1>>& seq, const real1& fraction)
+{
+    const real1 half = fraction / 2;
+    for (size_t i = 0; i < hamiltonian.size(); i++) {
+        seq.push_back(std::make_pair(i, half));
+    }
+    for (size_t i = hamiltonian.size(); i > 0; i--) {
+        seq.push_back(std::make_pair(i - 1U, half));
+    }
+}
+
+void CompiledHamiltonian::Compile()
+{
+    std::vector<std::pair<size_t, real1>> seq;
+    if (order == 1) {
+        for (size_t i = 0; i < hamiltonian.size(); i++) {
+            seq.push_back(std::make_pair(i, ONE_R1));
+        }
+    } else if (order == 2) {
+        AppendStrangStep(seq, ONE_R1);
+    } else {
+        // Suzuki's recursion: S4(t) = S2(p t)^2 S2((1 - 4p) t) S2(p t)^2, with p = 1 / (4 - 4^(1/3))
+        const real1 p = (real1)(1.0 / (4.0 - std::cbrt(4.0)));
+        AppendStrangStep(seq, p);
+        AppendStrangStep(seq, p);
+        AppendStrangStep(seq, ONE_R1 - 4 * p);
+        AppendStrangStep(seq, p);
+        AppendStrangStep(seq, p);
+    }
+
+    fused.clear();
+    for (size_t i = 0; i < seq.size(); i++) {
+        HamiltonianOpPtr op = hamiltonian[seq[i].first];
+        const real1 t = timeStep * seq[i].second;
+        const complex* opMtrx = op->matrix.get();
+        const bitCapIntOcl blockCount = op->uniform ? pow2Ocl(op->controlLen) : 1U;
+
+        // As TimeEvolve() always has, a uniformly controlled op's blocks are exponentiated as given, "e^(-H t)," while
+        // any other op is exponentiated as "e^(-i H t)."
+        const complex factor = op->uniform ? complex(-t, ZERO_R1) : complex(ZERO_R1, -t);
+        BitOp expMtrx(new complex[blockCount * 4U], std::default_delete<complex[]>());
+        complex mtrx[4];
+        for (bitCapIntOcl j = 0; j < blockCount; j++) {
+            for (bitLenInt k = 0; k < 4U; k++) {
+                mtrx[k] = opMtrx[(j * 4U) + k] * factor;
+            }
+            exp2x2(mtrx, expMtrx.get() + (j * 4U));
+        }
+
+        // Look back, past ops that commute with this one, for an op with the same gate structure to fuse into.
+        bool isFused = false;
+        for (size_t k = fused.size(); k > 0; k--) {
+            FusedOp& prior = fused[k - 1U];
+            if (IsSameGate(*(prior.op), *op)) {
+                complex* priorMtrx = prior.mtrx.get();
+                for (bitCapIntOcl j = 0; j < blockCount; j++) {
+                    // The later exponential left-multiplies.
+                    std::copy(priorMtrx + (j * 4U), priorMtrx + (j * 4U) + 4U, mtrx);
+                    mul2x2(expMtrx.get() + (j * 4U), mtrx, priorMtrx + (j * 4U));
+                }
+                isFused = true;
+                break;
+            }
+            if (!IsDisjoint(*(prior.op), *op)) {
+                break;
+            }
+        }
+
+        if (!isFused) {
+            fused.push_back(FusedOp{ op, expMtrx });
+        }
+    }
+}
+
+void CompiledHamiltonian::Evolve(QInterface& qReg, const bitCapIntOcl& steps)
+{
+    for (bitCapIntOcl s = 0; s < steps; s++) {
+        for (size_t i = 0; i < fused.size(); i++) {
+            const HamiltonianOp& op = *(fused[i].op);
+            const complex* mtrx = fused[i].mtrx.get();
+
+            if (op.toggles) {
+                for (bitLenInt j = 0; j < op.controlLen; j++) {
+                    if (op.toggles[j]) {
+                        qReg.X(op.controls[j]);
+                    }
+                }
+            }
+
+            if (op.uniform) {
+                qReg.UniformlyControlledSingleBit(op.controls, op.controlLen, op.targetBit, mtrx);
+            } else if (op.controlLen == 0) {
+                qReg.ApplySingleBit(mtrx, op.targetBit);
+            } else if (op.anti) {
+                qReg.ApplyAntiControlledSingleBit(op.controls, op.controlLen, op.targetBit, mtrx);
+            } else {
+                qReg.ApplyControlledSingleBit(op.controls, op.controlLen, op.targetBit, mtrx);
+            }
+
+            if (op.toggles) {
+                for (bitLenInt j = 0; j < op.controlLen; j++) {
+                    if (op.toggles[j]) {
+                        qReg.X(op.controls[j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace Qrack
@@ -11,19 +11,97 @@
 
 // for details.
 
-#include <map>
+#include <condition_variable>
 #include <mutex>
 #include <vector>
 
 // "qfactory.hpp" pulls in all headers needed to create any type of "Qrack::QInterface."
 #include "qfactory.hpp"
 
-std::mutex metaOperationMutex;
+#include "common/qprofiler.hpp"
 
-#define META_LOCK_GUARD() const std::lock_guard<std::mutex> metaLock(metaOperationMutex);
-// TODO: By design, Qrack should be able to support per-simulator lock guards, in a multithreaded OCL environment. This
-// feature might not yet be fully realized.
-#define SIMULATOR_LOCK_GUARD(sid) const std::lock_guard<std::mutex> metaLock(metaOperationMutex);
+/**
+ * A reader-writer lock for the simulator tables, (since std::shared_timed_mutex needs C++14). Waiting writers block
+ * new readers, so that a stream of gates on other simulators can't starve init() or destroy().
+ */
+class TableMutex {
+protected:
+    std::mutex mtx;
+    std::condition_variable cv;
+    unsigned readers;
+    unsigned writersWaiting;
+    bool isWriting;
+
+public:
+    TableMutex()
+        : readers(0)
+        , writersWaiting(0)
+        , isWriting(false)
+    {
+    }
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        writersWaiting++;
+        cv.wait(lk, [this] { return !isWriting && !readers; });
+        writersWaiting--;
+        isWriting = true;
+    }
+
+    void unlock()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            isWriting = false;
+        }
+        cv.notify_all();
+    }
+
+    void lock_shared()
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [this] { return !isWriting && !writersWaiting; });
+        readers++;
+    }
+
+    void unlock_shared()
+    {
+        bool isLast;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            readers--;
+            isLast = !readers;
+        }
+        if (isLast) {
+            cv.notify_all();
+        }
+    }
+};
+
+class TableReadLock {
+protected:
+    TableMutex& tableMutex;
+
+public:
+    TableReadLock(TableMutex& m)
+        : tableMutex(m)
+    {
+        tableMutex.lock_shared();
+    }
+    ~TableReadLock() { tableMutex.unlock_shared(); }
+};
+
+// Guards the "simulators," "simulatorReservations," "simulatorMutexes," "simulatorRngs," "shards," and
+// "simulatorHamiltonians" tables themselves, (as opposed to the simulators in them).
+TableMutex metaOperationMutex;
+
+// Exclusive access to the tables, and so to every simulator: for adding or removing simulator IDs
+#define META_LOCK_GUARD() const std::lock_guard<TableMutex> metaLock(metaOperationMutex);
+// Shared access to the tables, and exclusive access to one simulator: independent simulators can run concurrently.
+#define SIMULATOR_LOCK_GUARD(sid)                                                                                      \
+    const TableReadLock metaLock(metaOperationMutex);                                                                  \
+    const std::lock_guard<std::mutex> simulatorLock(*(simulatorMutexes[sid]));
 
 using namespace Qrack;
 
@@ -41,18 +119,28 @@ enum Pauli {
 qrack_rand_gen_ptr rng = std::make_shared<qrack_rand_gen>(time(0));
 std::vector<QInterfacePtr> simulators;
 std::vector<bool> simulatorReservations;
-std::map<QInterfacePtr, std::map<unsigned, bitLenInt>> shards;
-
-void TransformPauliBasis(QInterfacePtr simulator, unsigned len, int* bases, unsigned* qubitIds)
+std::vector<std::shared_ptr<std::mutex>> simulatorMutexes;
+// Each simulator draws from its own generator, (seeded from "rng,") so that simulators on different threads don't race.
+std::vector<qrack_rand_gen_ptr> simulatorRngs;
+// Per simulator ID, the engine qubit index of each qubit ID, or UNMAPPED_QUBIT, (trimmed after the highest mapped ID)
+std::vector<std::vector<bitLenInt>> shards;
+// Per simulator ID, the last Hamiltonian passed to TimeEvolve(), compiled, and the raw arguments it was compiled from
+std::vector<CompiledHamiltonianPtr> simulatorHamiltonians;
+std::vector<std::vector<double>> simulatorHamiltonianKeys;
+
+#define UNMAPPED_QUBIT ((bitLenInt)-1)
+
+void TransformPauliBasis(unsigned sid, unsigned len, int* bases, unsigned* qubitIds)
 {
+    QInterfacePtr simulator = simulators[sid];
     for (unsigned i = 0; i < len; i++) {
         switch (bases[i]) {
         case PauliX:
-            simulator->H(shards[simulator][qubitIds[i]]);
+            simulator->H(shards[sid][qubitIds[i]]);
             break;
         case PauliY:
-            simulator->IS(shards[simulator][qubitIds[i]]);
-            simulator->H(shards[simulator][qubitIds[i]]);
+            simulator->IS(shards[sid][qubitIds[i]]);
+            simulator->H(shards[sid][qubitIds[i]]);
             break;
         case PauliZ:
         case PauliI:
@@ -62,16 +150,17 @@ void TransformPauliBasis(QInterfacePtr simulator, unsigned len, int* bases, unsi
     }
 }
 
-void RevertPauliBasis(QInterfacePtr simulator, unsigned len, int* bases, unsigned* qubitIds)
+void RevertPauliBasis(unsigned sid, unsigned len, int* bases, unsigned* qubitIds)
 {
+    QInterfacePtr simulator = simulators[sid];
     for (unsigned i = 0; i < len; i++) {
         switch (bases[i]) {
         case PauliX:
-            simulator->H(shards[simulator][qubitIds[i]]);
+            simulator->H(shards[sid][qubitIds[i]]);
             break;
         case PauliY:
-            simulator->H(shards[simulator][qubitIds[i]]);
-            simulator->S(shards[simulator][qubitIds[i]]);
+            simulator->H(shards[sid][qubitIds[i]]);
+            simulator->S(shards[sid][qubitIds[i]]);
             break;
         case PauliZ:
         case PauliI:
@@ -94,44 +183,36 @@ void removeIdentities(std::vector<int>* b, std::vector<bitLenInt>* qs)
     }
 }
 
-void RHelper(unsigned sid, unsigned b, double phi, unsigned q)
+void ApplyR(QInterfacePtr simulator, unsigned b, double phi, bitLenInt q)
 {
-    QInterfacePtr simulator = simulators[sid];
-
     switch (b) {
     case PauliI: {
         // This is a global phase factor, with no measurable physical effect.
         // However, the underlying QInterface will not execute the gate
         // UNLESS it is specifically "keeping book" for non-measurable phase effects.
         complex phaseFac = std::exp(complex(ZERO_R1, phi / 4));
-        simulator->ApplySinglePhase(phaseFac, phaseFac, shards[simulator][q]);
+        simulator->ApplySinglePhase(phaseFac, phaseFac, q);
         break;
     }
     case PauliX:
-        simulator->RX(phi, shards[simulator][q]);
+        simulator->RX(phi, q);
         break;
     case PauliY:
-        simulator->RY(phi, shards[simulator][q]);
+        simulator->RY(phi, q);
         break;
     case PauliZ:
-        simulator->RZ(phi, shards[simulator][q]);
+        simulator->RZ(phi, q);
         break;
     default:
         break;
     }
 }
 
-void MCRHelper(unsigned sid, unsigned b, double phi, unsigned n, unsigned* c, unsigned q)
+void ApplyMCR(QInterfacePtr simulator, unsigned b, double phi, unsigned n, const bitLenInt* ctrlsArray, bitLenInt q)
 {
-    QInterfacePtr simulator = simulators[sid];
-    bitLenInt* ctrlsArray = new bitLenInt[n];
-    for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
-    }
-
     if (b == PauliI) {
         complex phaseFac = std::exp(complex(ZERO_R1, phi / 4));
-        simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[simulator][q], phaseFac, phaseFac);
+        simulator->ApplyControlledSinglePhase(ctrlsArray, n, q, phaseFac, phaseFac);
         return;
     }
 
@@ -145,23 +226,39 @@ void MCRHelper(unsigned sid, unsigned b, double phi, unsigned n, unsigned* c, un
         pauliR[1] = complex(ZERO_R1, -sine);
         pauliR[2] = complex(ZERO_R1, -sine);
         pauliR[3] = complex(cosine, ZERO_R1);
-        simulator->ApplyControlledSingleBit(ctrlsArray, n, shards[simulator][q], pauliR);
+        simulator->ApplyControlledSingleBit(ctrlsArray, n, q, pauliR);
         break;
     case PauliY:
         pauliR[0] = complex(cosine, ZERO_R1);
         pauliR[1] = complex(-sine, ZERO_R1);
         pauliR[2] = complex(sine, ZERO_R1);
         pauliR[3] = complex(cosine, ZERO_R1);
-        simulator->ApplyControlledSingleBit(ctrlsArray, n, shards[simulator][q], pauliR);
+        simulator->ApplyControlledSingleBit(ctrlsArray, n, q, pauliR);
         break;
     case PauliZ:
-        simulator->ApplyControlledSinglePhase(
-            ctrlsArray, n, shards[simulator][q], complex(cosine, -sine), complex(cosine, sine));
+        simulator->ApplyControlledSinglePhase(ctrlsArray, n, q, complex(cosine, -sine), complex(cosine, sine));
         break;
     case PauliI:
     default:
         break;
     }
+}
+
+void RHelper(unsigned sid, unsigned b, double phi, unsigned q)
+{
+    QInterfacePtr simulator = simulators[sid];
+    ApplyR(simulator, b, phi, shards[sid][q]);
+}
+
+void MCRHelper(unsigned sid, unsigned b, double phi, unsigned n, unsigned* c, unsigned q)
+{
+    QInterfacePtr simulator = simulators[sid];
+    bitLenInt* ctrlsArray = new bitLenInt[n];
+    for (unsigned i = 0; i < n; i++) {
+        ctrlsArray[i] = shards[sid][c[i]];
+    }
+
+    ApplyMCR(simulator, b, phi, n, ctrlsArray, shards[sid][q]);
 
     delete[] ctrlsArray;
 }
@@ -275,22 +372,26 @@ MICROSOFT_QUANTUM_DECL unsigned init_count(_In_ unsigned q)
         }
     }
 
-    QInterfacePtr simulator = q ? CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_OPTIMAL, q, 0, rng) : NULL;
+    qrack_rand_gen_ptr simulatorRng = std::make_shared<qrack_rand_gen>((*rng)());
+    QInterfacePtr simulator =
+        q ? CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_OPTIMAL, q, 0, simulatorRng) : NULL;
     if (sid == simulators.size()) {
         simulatorReservations.push_back(true);
         simulators.push_back(simulator);
+        simulatorMutexes.push_back(std::make_shared<std::mutex>());
+        simulatorRngs.push_back(simulatorRng);
+        shards.push_back(std::vector<bitLenInt>());
+        simulatorHamiltonians.push_back(NULL);
+        simulatorHamiltonianKeys.push_back(std::vector<double>());
     } else {
         simulatorReservations[sid] = true;
         simulators[sid] = simulator;
+        simulatorRngs[sid] = simulatorRng;
     }
 
-    if (!q) {
-        return sid;
-    }
-
-    shards[simulator] = {};
+    shards[sid].resize(q);
     for (unsigned i = 0; i < q; i++) {
-        shards[simulator][i] = (bitLenInt)i;
+        shards[sid][i] = (bitLenInt)i;
     }
 
     return sid;
@@ -302,9 +403,10 @@ MICROSOFT_QUANTUM_DECL unsigned init_count(_In_ unsigned q)
 MICROSOFT_QUANTUM_DECL void destroy(_In_ unsigned sid)
 {
     META_LOCK_GUARD()
-    // SIMULATOR_LOCK_GUARD(sid)
 
-    shards.erase(simulators[sid]);
+    shards[sid].clear();
+    simulatorHamiltonians[sid] = NULL;
+    simulatorHamiltonianKeys[sid].clear();
     simulators[sid] = NULL;
     simulatorReservations[sid] = false;
 }
@@ -316,6 +418,7 @@ MICROSOFT_QUANTUM_DECL void seed(_In_ unsigned sid, _In_ unsigned s)
 {
     SIMULATOR_LOCK_GUARD(sid)
 
+    simulatorRngs[sid]->seed(s);
     if (simulators[sid] != NULL) {
         simulators[sid]->SetRandomSeed(s);
     }
@@ -333,6 +436,100 @@ MICROSOFT_QUANTUM_DECL void set_concurrency(_In_ unsigned sid, _In_ unsigned p)
     }
 }
 
+/**
+ * (External API) Turn the process-wide profiling counters, and optionally the trace of every profiled call, on or off
+ */
+MICROSOFT_QUANTUM_DECL void set_profiling(_In_ bool enable, _In_ bool trace)
+{
+    QProfiler::SetEnabled(enable);
+    QProfiler::SetTracing(enable && trace);
+}
+
+/**
+ * (External API) Zero the profiling counters and histograms, and clear the trace
+ */
+MICROSOFT_QUANTUM_DECL void reset_profile() { QProfiler::Reset(); }
+
+/**
+ * (External API) Number of profiled operations, (whose IDs run from 0 to this, exclusive)
+ */
+MICROSOFT_QUANTUM_DECL unsigned profile_op_count() { return PROFILE_OP_COUNT; }
+
+MICROSOFT_QUANTUM_DECL const char* profile_op_name(_In_ unsigned op) { return QProfiler::GetName((QProfileOp)op); }
+
+/**
+ * (External API) Calls of a profiled operation since the last reset
+ */
+MICROSOFT_QUANTUM_DECL unsigned long long profile_count(_In_ unsigned op)
+{
+    return (op < PROFILE_OP_COUNT) ? QProfiler::GetCount((QProfileOp)op) : 0U;
+}
+
+/**
+ * (External API) Total nanoseconds spent in a profiled operation since the last reset
+ */
+MICROSOFT_QUANTUM_DECL unsigned long long profile_ns(_In_ unsigned op)
+{
+    return (op < PROFILE_OP_COUNT) ? QProfiler::GetNanoseconds((QProfileOp)op) : 0U;
+}
+
+/**
+ * (External API) Total bytes moved by a profiled operation since the last reset
+ */
+MICROSOFT_QUANTUM_DECL unsigned long long profile_bytes(_In_ unsigned op)
+{
+    return (op < PROFILE_OP_COUNT) ? QProfiler::GetBytes((QProfileOp)op) : 0U;
+}
+
+/**
+ * (External API) Copy up to "n" bins of a profiled operation's duration histogram, (bin "i" counting calls that took
+ * less than 2^i nanoseconds, and no less than 2^(i-1)) and return the number of bins copied
+ */
+MICROSOFT_QUANTUM_DECL unsigned profile_histogram(
+    _In_ unsigned op, _In_ unsigned n, _In_reads_(n) unsigned long long* bins)
+{
+    if (op >= PROFILE_OP_COUNT) {
+        return 0U;
+    }
+
+    if (n > QRACK_PROFILE_HISTOGRAM_BINS) {
+        n = QRACK_PROFILE_HISTOGRAM_BINS;
+    }
+    for (unsigned i = 0U; i < n; i++) {
+        bins[i] = QProfiler::GetHistogram((QProfileOp)op, i);
+    }
+
+    return n;
+}
+
+/**
+ * (External API) Write the trace of profiled calls to a file, in Chrome's trace event format, (which Perfetto reads)
+ */
+MICROSOFT_QUANTUM_DECL bool write_profile_trace(_In_ const char* fileName) { return QProfiler::WriteTrace(fileName); }
+
+/**
+ * (External API) Number of device kernel IDs, (some of which might be unused, with empty names)
+ */
+MICROSOFT_QUANTUM_DECL unsigned profile_kernel_count() { return QRACK_PROFILE_MAX_KERNELS; }
+
+MICROSOFT_QUANTUM_DECL const char* profile_kernel_name(_In_ unsigned kernel) { return QProfiler::GetKernelName(kernel); }
+
+/**
+ * (External API) Runs of a device kernel since the last reset
+ */
+MICROSOFT_QUANTUM_DECL unsigned long long profile_kernel_calls(_In_ unsigned kernel)
+{
+    return QProfiler::GetKernelCount(kernel);
+}
+
+/**
+ * (External API) Total device nanoseconds spent in a kernel since the last reset
+ */
+MICROSOFT_QUANTUM_DECL unsigned long long profile_kernel_ns(_In_ unsigned kernel)
+{
+    return QProfiler::GetKernelNanoseconds(kernel);
+}
+
 /**
  * (External API) "Dump" all IDs from the selected simulator ID into the callback
  */
@@ -341,10 +538,15 @@ MICROSOFT_QUANTUM_DECL void DumpIds(_In_ unsigned sid, _In_ IdCallback callback)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    std::map<unsigned, bitLenInt>::iterator it;
+    if (simulator == NULL) {
+        return;
+    }
 
-    for (it = shards[simulator].begin(); it != shards[simulator].end(); it++) {
-        callback(it->first);
+    const std::vector<bitLenInt>& simShards = shards[sid];
+    for (unsigned i = 0; i < simShards.size(); i++) {
+        if (simShards[i] != UNMAPPED_QUBIT) {
+            callback(i);
+        }
     }
 }
 
@@ -356,15 +558,15 @@ MICROSOFT_QUANTUM_DECL void Dump(_In_ unsigned sid, _In_ ProbAmpCallback callbac
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    bitCapIntOcl wfnl = (bitCapIntOcl)simulator->GetMaxQPower();
-    complex* wfn = new complex[wfnl];
-    simulator->GetQuantumState(wfn);
+    // Engines stream their own state vector, rather than a copy of it.
+    QStateViewPtr view = simulator->LockStateView();
+    const complex* wfn = view->GetAmplitudes();
+    bitCapIntOcl wfnl = view->GetLength();
     for (size_t i = 0; i < wfnl; i++) {
         if (!callback(i, real(wfn[i]), imag(wfn[i]))) {
             break;
         }
     }
-    delete[] wfn;
 }
 
 /**
@@ -372,12 +574,15 @@ MICROSOFT_QUANTUM_DECL void Dump(_In_ unsigned sid, _In_ ProbAmpCallback callbac
  */
 MICROSOFT_QUANTUM_DECL std::size_t random_choice(_In_ unsigned sid, _In_ std::size_t n, _In_reads_(n) double* p)
 {
+    SIMULATOR_LOCK_GUARD(sid)
+
     std::discrete_distribution<std::size_t> dist(p, p + n);
-    return dist(*rng.get());
+    return dist(*(simulatorRngs[sid]));
 }
 
-double _JointEnsembleProbabilityHelper(QInterfacePtr simulator, unsigned n, int* b, unsigned* q, bool doMeasure)
+double _JointEnsembleProbabilityHelper(unsigned sid, unsigned n, int* b, unsigned* q, bool doMeasure)
 {
+    QInterfacePtr simulator = simulators[sid];
 
     if (n == 0) {
         return 0.0;
@@ -395,7 +600,7 @@ double _JointEnsembleProbabilityHelper(QInterfacePtr simulator, unsigned n, int*
 
     bitCapInt mask = 0;
     for (bitLenInt i = 0; i < n; i++) {
-        bitCapInt bit = pow2(shards[simulator][qVec[i]]);
+        bitCapInt bit = pow2(shards[sid][qVec[i]]);
         mask |= bit;
     }
 
@@ -412,11 +617,11 @@ MICROSOFT_QUANTUM_DECL double JointEnsembleProbability(
 
     QInterfacePtr simulator = simulators[sid];
 
-    TransformPauliBasis(simulator, n, b, q);
+    TransformPauliBasis(sid, n, b, q);
 
-    double jointProb = _JointEnsembleProbabilityHelper(simulator, n, b, q, false);
+    double jointProb = _JointEnsembleProbabilityHelper(sid, n, b, q, false);
 
-    RevertPauliBasis(simulator, n, b, q);
+    RevertPauliBasis(sid, n, b, q);
 
     return jointProb;
 }
@@ -428,14 +633,17 @@ MICROSOFT_QUANTUM_DECL void allocateQubit(_In_ unsigned sid, _In_ unsigned qid)
 {
     SIMULATOR_LOCK_GUARD(sid)
 
-    QInterfacePtr nQubit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_OPTIMAL, 1, 0, rng);
+    QInterfacePtr nQubit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_OPTIMAL, 1, 0, simulatorRngs[sid]);
     if (simulators[sid] == NULL) {
         simulators[sid] = nQubit;
-        shards[simulators[sid]] = {};
     } else {
         simulators[sid]->Compose(nQubit);
     }
-    shards[simulators[sid]][qid] = (simulators[sid]->GetQubitCount() - 1U);
+
+    if (qid >= shards[sid].size()) {
+        shards[sid].resize(qid + 1U, UNMAPPED_QUBIT);
+    }
+    shards[sid][qid] = (simulators[sid]->GetQubitCount() - 1U);
 }
 
 /**
@@ -443,24 +651,32 @@ MICROSOFT_QUANTUM_DECL void allocateQubit(_In_ unsigned sid, _In_ unsigned qid)
  */
 MICROSOFT_QUANTUM_DECL bool release(_In_ unsigned sid, _In_ unsigned q)
 {
+    SIMULATOR_LOCK_GUARD(sid)
+
     QInterfacePtr simulator = simulators[sid];
+    std::vector<bitLenInt>& simShards = shards[sid];
 
     // Check that the qubit is in the |0> state, to within a small tolerance.
-    bool toRet = simulator->Prob(shards[simulator][q]) < (ONE_R1 / 100);
+    bool toRet = simulator->Prob(simShards[q]) < (ONE_R1 / 100);
 
     if (simulator->GetQubitCount() == 1U) {
-        shards.erase(simulator);
+        simShards.clear();
         simulators[sid] = NULL;
-    } else {
-        SIMULATOR_LOCK_GUARD(sid)
-        bitLenInt oIndex = shards[simulator][q];
-        simulator->Dispose(oIndex, 1U);
-        for (unsigned i = 0; i < shards[simulator].size(); i++) {
-            if (shards[simulator][i] > oIndex) {
-                shards[simulator][i]--;
-            }
+        return toRet;
+    }
+
+    bitLenInt oIndex = simShards[q];
+    simulator->Dispose(oIndex, 1U);
+    for (unsigned i = 0; i < simShards.size(); i++) {
+        if ((simShards[i] != UNMAPPED_QUBIT) && (simShards[i] > oIndex)) {
+            simShards[i]--;
         }
-        shards[simulator].erase(q);
+    }
+    simShards[q] = UNMAPPED_QUBIT;
+
+    // Keep the map compact, so that a long-running program's ID churn doesn't leave it sparse.
+    while (simShards.size() && (simShards.back() == UNMAPPED_QUBIT)) {
+        simShards.pop_back();
     }
 
     return toRet;
@@ -485,7 +701,7 @@ MICROSOFT_QUANTUM_DECL void X(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->X(shards[simulator][q]);
+    simulator->X(shards[sid][q]);
 }
 
 /**
@@ -496,7 +712,7 @@ MICROSOFT_QUANTUM_DECL void Y(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->Y(shards[simulator][q]);
+    simulator->Y(shards[sid][q]);
 }
 
 /**
@@ -507,7 +723,7 @@ MICROSOFT_QUANTUM_DECL void Z(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->Z(shards[simulator][q]);
+    simulator->Z(shards[sid][q]);
 }
 
 /**
@@ -518,7 +734,7 @@ MICROSOFT_QUANTUM_DECL void H(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->H(shards[simulator][q]);
+    simulator->H(shards[sid][q]);
 }
 
 /**
@@ -529,7 +745,7 @@ MICROSOFT_QUANTUM_DECL void S(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->S(shards[simulator][q]);
+    simulator->S(shards[sid][q]);
 }
 
 /**
@@ -540,7 +756,7 @@ MICROSOFT_QUANTUM_DECL void T(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->T(shards[simulator][q]);
+    simulator->T(shards[sid][q]);
 }
 
 /**
@@ -551,7 +767,7 @@ MICROSOFT_QUANTUM_DECL void AdjS(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->IS(shards[simulator][q]);
+    simulator->IS(shards[sid][q]);
 }
 
 /**
@@ -562,7 +778,7 @@ MICROSOFT_QUANTUM_DECL void AdjT(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->IT(shards[simulator][q]);
+    simulator->IT(shards[sid][q]);
 }
 
 /**
@@ -574,7 +790,7 @@ MICROSOFT_QUANTUM_DECL void U(
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->U(shards[simulator][q], theta, phi, lambda);
+    simulator->U(shards[sid][q], theta, phi, lambda);
 }
 
 /**
@@ -587,10 +803,10 @@ MICROSOFT_QUANTUM_DECL void MCX(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->ApplyControlledSingleInvert(ctrlsArray, n, shards[simulator][q], ONE_CMPLX, ONE_CMPLX);
+    simulator->ApplyControlledSingleInvert(ctrlsArray, n, shards[sid][q], ONE_CMPLX, ONE_CMPLX);
 
     delete[] ctrlsArray;
 }
@@ -605,10 +821,10 @@ MICROSOFT_QUANTUM_DECL void MCY(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->ApplyControlledSingleInvert(ctrlsArray, n, shards[simulator][q], -I_CMPLX, I_CMPLX);
+    simulator->ApplyControlledSingleInvert(ctrlsArray, n, shards[sid][q], -I_CMPLX, I_CMPLX);
 
     delete[] ctrlsArray;
 }
@@ -623,10 +839,10 @@ MICROSOFT_QUANTUM_DECL void MCZ(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[simulator][q], ONE_CMPLX, -ONE_CMPLX);
+    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[sid][q], ONE_CMPLX, -ONE_CMPLX);
 
     delete[] ctrlsArray;
 }
@@ -641,13 +857,13 @@ MICROSOFT_QUANTUM_DECL void MCH(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
     const complex hGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1),
         complex(-M_SQRT1_2, ZERO_R1) };
 
-    simulator->ApplyControlledSingleBit(ctrlsArray, n, shards[simulator][q], hGate);
+    simulator->ApplyControlledSingleBit(ctrlsArray, n, shards[sid][q], hGate);
 
     delete[] ctrlsArray;
 }
@@ -662,10 +878,10 @@ MICROSOFT_QUANTUM_DECL void MCS(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[simulator][q], ONE_CMPLX, I_CMPLX);
+    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[sid][q], ONE_CMPLX, I_CMPLX);
 
     delete[] ctrlsArray;
 }
@@ -680,11 +896,11 @@ MICROSOFT_QUANTUM_DECL void MCT(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
     simulator->ApplyControlledSinglePhase(
-        ctrlsArray, n, shards[simulator][q], ONE_CMPLX, complex(M_SQRT1_2, M_SQRT1_2));
+        ctrlsArray, n, shards[sid][q], ONE_CMPLX, complex(M_SQRT1_2, M_SQRT1_2));
 
     delete[] ctrlsArray;
 }
@@ -699,10 +915,10 @@ MICROSOFT_QUANTUM_DECL void MCAdjS(_In_ unsigned sid, _In_ unsigned n, _In_reads
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[simulator][q], ONE_CMPLX, -I_CMPLX);
+    simulator->ApplyControlledSinglePhase(ctrlsArray, n, shards[sid][q], ONE_CMPLX, -I_CMPLX);
 
     delete[] ctrlsArray;
 }
@@ -717,11 +933,11 @@ MICROSOFT_QUANTUM_DECL void MCAdjT(_In_ unsigned sid, _In_ unsigned n, _In_reads
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
     simulator->ApplyControlledSinglePhase(
-        ctrlsArray, n, shards[simulator][q], ONE_CMPLX, complex(M_SQRT1_2, -M_SQRT1_2));
+        ctrlsArray, n, shards[sid][q], ONE_CMPLX, complex(M_SQRT1_2, -M_SQRT1_2));
 
     delete[] ctrlsArray;
 }
@@ -737,10 +953,10 @@ MICROSOFT_QUANTUM_DECL void MCU(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->CU(ctrlsArray, n, shards[simulator][q], theta, phi, lambda);
+    simulator->CU(ctrlsArray, n, shards[sid][q], theta, phi, lambda);
 
     delete[] ctrlsArray;
 }
@@ -792,12 +1008,12 @@ MICROSOFT_QUANTUM_DECL void Exp(
     } else {
         QInterfacePtr simulator = simulators[sid];
 
-        TransformPauliBasis(simulator, n, b, q);
+        TransformPauliBasis(sid, n, b, q);
 
         std::size_t mask = make_mask(qVec);
         simulator->UniformParityRZ(mask, -phi);
 
-        RevertPauliBasis(simulator, n, b, q);
+        RevertPauliBasis(sid, n, b, q);
     }
 }
 
@@ -828,12 +1044,12 @@ MICROSOFT_QUANTUM_DECL void MCExp(_In_ unsigned sid, _In_ unsigned n, _In_reads_
         QInterfacePtr simulator = simulators[sid];
         std::vector<bitLenInt> csVec(cs, cs + nc);
 
-        TransformPauliBasis(simulator, n, b, q);
+        TransformPauliBasis(sid, n, b, q);
 
         std::size_t mask = make_mask(qVec);
         simulator->CUniformParityRZ(&(csVec[0]), csVec.size(), mask, -phi);
 
-        RevertPauliBasis(simulator, n, b, q);
+        RevertPauliBasis(sid, n, b, q);
     }
 }
 
@@ -845,7 +1061,7 @@ MICROSOFT_QUANTUM_DECL unsigned M(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    return simulator->M(shards[simulator][q]) ? 1U : 0U;
+    return simulator->M(shards[sid][q]) ? 1U : 0U;
 }
 
 /**
@@ -861,13 +1077,13 @@ MICROSOFT_QUANTUM_DECL unsigned Measure(
     std::vector<unsigned> bVec;
     std::vector<unsigned> qVec;
 
-    TransformPauliBasis(simulator, n, b, q);
+    TransformPauliBasis(sid, n, b, q);
 
-    double jointProb = _JointEnsembleProbabilityHelper(simulator, n, b, q, true);
+    double jointProb = _JointEnsembleProbabilityHelper(sid, n, b, q, true);
 
     unsigned toRet = (jointProb < (ONE_R1 / 2)) ? 0U : 1U;
 
-    RevertPauliBasis(simulator, n, b, q);
+    RevertPauliBasis(sid, n, b, q);
 
     return toRet;
 }
@@ -877,7 +1093,7 @@ MICROSOFT_QUANTUM_DECL void SWAP(_In_ unsigned sid, _In_ unsigned qi1, _In_ unsi
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    simulator->Swap(qi1, qi2);
+    simulator->Swap(shards[sid][qi1], shards[sid][qi2]);
 }
 
 MICROSOFT_QUANTUM_DECL void CSWAP(
@@ -888,10 +1104,10 @@ MICROSOFT_QUANTUM_DECL void CSWAP(
     QInterfacePtr simulator = simulators[sid];
     bitLenInt* ctrlsArray = new bitLenInt[n];
     for (unsigned i = 0; i < n; i++) {
-        ctrlsArray[i] = shards[simulator][c[i]];
+        ctrlsArray[i] = shards[sid][c[i]];
     }
 
-    simulator->CSwap(ctrlsArray, n, qi1, qi2);
+    simulator->CSwap(ctrlsArray, n, shards[sid][qi1], shards[sid][qi2]);
 
     delete[] ctrlsArray;
 }
@@ -1000,7 +1216,164 @@ MICROSOFT_QUANTUM_DECL double Prob(_In_ unsigned sid, _In_ unsigned q)
     SIMULATOR_LOCK_GUARD(sid)
 
     QInterfacePtr simulator = simulators[sid];
-    return simulator->Prob(shards[simulator][q]);
+    return simulator->Prob(shards[sid][q]);
+}
+
+/**
+ * (External API) Run a packed program of "n" gates and measurements, resolving every qubit ID and taking the simulator
+ * lock only once. Measurement results are written to "results," in program order, and their count is returned.
+ * Execution stops at the first op with an unrecognized opcode, a qubit ID that is out of range or released, or more
+ * than 32 controls.
+ */
+MICROSOFT_QUANTUM_DECL unsigned run_program(
+    _In_ unsigned sid, _In_ unsigned n, _In_reads_(n) _QrackProgramOp* ops, unsigned* results)
+{
+    SIMULATOR_LOCK_GUARD(sid)
+
+    QInterfacePtr simulator = simulators[sid];
+    const std::vector<bitLenInt>& simShards = shards[sid];
+
+    // Resolve the qubit map for the whole program, up front, as far as the first op that would stop execution.
+    auto isMapped = [&simShards](unsigned qid) {
+        return (qid < simShards.size()) && (simShards[qid] != UNMAPPED_QUBIT);
+    };
+    const unsigned maxControls = sizeof(ops[0].controls) / sizeof(ops[0].controls[0]);
+    std::vector<bitLenInt> targets(n);
+    std::vector<bitLenInt> args(n);
+    std::vector<std::vector<bitLenInt>> controls(n);
+    unsigned opCount = 0;
+    for (; opCount < n; opCount++) {
+        const _QrackProgramOp& op = ops[opCount];
+        if ((op.op > QRACK_PROGRAM_M) || !isMapped(op.target)) {
+            break;
+        }
+        targets[opCount] = simShards[op.target];
+
+        if (op.op == QRACK_PROGRAM_SWAP) {
+            if (!isMapped(op.arg)) {
+                break;
+            }
+            args[opCount] = simShards[op.arg];
+        }
+
+        // (Measurement ignores its controls.)
+        if (op.op == QRACK_PROGRAM_M) {
+            continue;
+        }
+
+        if (op.controlLen > maxControls) {
+            break;
+        }
+        unsigned j;
+        for (j = 0; j < op.controlLen; j++) {
+            if (!isMapped(op.controls[j])) {
+                break;
+            }
+            controls[opCount].push_back(simShards[op.controls[j]]);
+        }
+        if (j < op.controlLen) {
+            break;
+        }
+    }
+
+    const complex hGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1),
+        complex(-M_SQRT1_2, ZERO_R1) };
+
+    unsigned resultCount = 0;
+    for (unsigned i = 0; i < opCount; i++) {
+        const _QrackProgramOp& op = ops[i];
+        const bitLenInt q = targets[i];
+        const bitLenInt nc = (bitLenInt)op.controlLen;
+        bitLenInt* c = controls[i].data();
+
+        switch (op.op) {
+        case QRACK_PROGRAM_X:
+            if (nc) {
+                simulator->ApplyControlledSingleInvert(c, nc, q, ONE_CMPLX, ONE_CMPLX);
+            } else {
+                simulator->X(q);
+            }
+            break;
+        case QRACK_PROGRAM_Y:
+            if (nc) {
+                simulator->ApplyControlledSingleInvert(c, nc, q, -I_CMPLX, I_CMPLX);
+            } else {
+                simulator->Y(q);
+            }
+            break;
+        case QRACK_PROGRAM_Z:
+            if (nc) {
+                simulator->ApplyControlledSinglePhase(c, nc, q, ONE_CMPLX, -ONE_CMPLX);
+            } else {
+                simulator->Z(q);
+            }
+            break;
+        case QRACK_PROGRAM_H:
+            if (nc) {
+                simulator->ApplyControlledSingleBit(c, nc, q, hGate);
+            } else {
+                simulator->H(q);
+            }
+            break;
+        case QRACK_PROGRAM_S:
+            if (nc) {
+                simulator->ApplyControlledSinglePhase(c, nc, q, ONE_CMPLX, I_CMPLX);
+            } else {
+                simulator->S(q);
+            }
+            break;
+        case QRACK_PROGRAM_T:
+            if (nc) {
+                simulator->ApplyControlledSinglePhase(c, nc, q, ONE_CMPLX, complex(M_SQRT1_2, M_SQRT1_2));
+            } else {
+                simulator->T(q);
+            }
+            break;
+        case QRACK_PROGRAM_ADJS:
+            if (nc) {
+                simulator->ApplyControlledSinglePhase(c, nc, q, ONE_CMPLX, -I_CMPLX);
+            } else {
+                simulator->IS(q);
+            }
+            break;
+        case QRACK_PROGRAM_ADJT:
+            if (nc) {
+                simulator->ApplyControlledSinglePhase(c, nc, q, ONE_CMPLX, complex(M_SQRT1_2, -M_SQRT1_2));
+            } else {
+                simulator->IT(q);
+            }
+            break;
+        case QRACK_PROGRAM_U:
+            if (nc) {
+                simulator->CU(c, nc, q, op.params[0], op.params[1], op.params[2]);
+            } else {
+                simulator->U(q, op.params[0], op.params[1], op.params[2]);
+            }
+            break;
+        case QRACK_PROGRAM_R:
+            if (nc) {
+                ApplyMCR(simulator, op.arg, op.params[0], nc, c, q);
+            } else {
+                ApplyR(simulator, op.arg, op.params[0], q);
+            }
+            break;
+        case QRACK_PROGRAM_SWAP:
+            if (nc) {
+                simulator->CSwap(c, nc, q, args[i]);
+            } else {
+                simulator->Swap(q, args[i]);
+            }
+            break;
+        case QRACK_PROGRAM_M:
+            results[resultCount] = simulator->M(q) ? 1U : 0U;
+            resultCount++;
+            break;
+        default:
+            return resultCount;
+        }
+    }
+
+    return resultCount;
 }
 
 #if !ENABLE_PURE32
@@ -1010,17 +1383,33 @@ MICROSOFT_QUANTUM_DECL double Prob(_In_ unsigned sid, _In_ unsigned q)
 MICROSOFT_QUANTUM_DECL void TimeEvolve(_In_ unsigned sid, _In_ double t, _In_ unsigned n,
     _In_reads_(n) _QrackTimeEvolveOpHeader* teos, unsigned mn, _In_reads_(mn) double* mtrx)
 {
+    // Repeated calls usually pass the same Hamiltonian and time step, so the compiled exponentials are kept, keyed by
+    // the raw arguments.
+    std::vector<double> key(1U, t);
     bitCapIntOcl mtrxOffset = 0;
-    Hamiltonian h(n);
     for (unsigned i = 0; i < n; i++) {
-        h[i] = std::make_shared<UniformHamiltonianOp>(teos[i], mtrx + mtrxOffset);
-        mtrxOffset += pow2Ocl(teos[i].controlLen) * 8U;
+        key.push_back(teos[i].target);
+        key.push_back(teos[i].controlLen);
+        key.insert(key.end(), teos[i].controls, teos[i].controls + teos[i].controlLen);
+        const bitCapIntOcl mtrxLen = pow2Ocl(teos[i].controlLen) * 8U;
+        key.insert(key.end(), mtrx + mtrxOffset, mtrx + mtrxOffset + mtrxLen);
+        mtrxOffset += mtrxLen;
     }
 
     SIMULATOR_LOCK_GUARD(sid)
 
-    QInterfacePtr simulator = simulators[sid];
-    simulator->TimeEvolve(h, (real1)t);
+    if (!simulatorHamiltonians[sid] || (key != simulatorHamiltonianKeys[sid])) {
+        mtrxOffset = 0;
+        Hamiltonian h(n);
+        for (unsigned i = 0; i < n; i++) {
+            h[i] = std::make_shared<UniformHamiltonianOp>(teos[i], mtrx + mtrxOffset);
+            mtrxOffset += pow2Ocl(teos[i].controlLen) * 8U;
+        }
+        simulatorHamiltonians[sid] = std::make_shared<CompiledHamiltonian>(h, (real1)t);
+        simulatorHamiltonianKeys[sid] = key;
+    }
+
+    simulatorHamiltonians[sid]->Evolve(*(simulators[sid]));
 }
 #endif
 }
@@ -19,6 +19,39 @@
 
 namespace Qrack {
 
+/// Reverse the order of the low "length" bits of "x"
+static bitCapInt ReverseBits(bitCapInt x, const bitLenInt& length)
+{
+    bitCapInt reversed = 0;
+    for (bitLenInt i = 0; i < length; i++) {
+        reversed = (reversed << ONE_BCI) | (x & ONE_BCI);
+        x >>= ONE_BCI;
+    }
+    return reversed;
+}
+
+template <typename Fn>
+void QEngineCPU::SwapRegPairs(const bitCapInt& regMask, const bitLenInt& start, const bitCapInt* controlPowers,
+    const bitLenInt& controlLen, const bitCapInt& controlMask, Fn&& partnerFn)
+{
+    const bitCapInt otherMask = (maxQPower - ONE_BCI) ^ regMask;
+
+    UnshareStateVec();
+
+    par_for_mask(0, maxQPower, controlPowers, controlLen, [&](const bitCapInt& lcv, const int& cpu) {
+        const bitCapInt i = lcv | controlMask;
+        const bitCapInt regInt = (i & regMask) >> start;
+        const bitCapInt partner = partnerFn(regInt);
+        if (partner <= regInt) {
+            return;
+        }
+
+        const bitCapInt j = (i & otherMask) | (partner << start);
+        const complex amp = stateVec->read(i);
+        stateVec->write2(i, stateVec->read(j), j, amp);
+    });
+}
+
 /// "Circular shift left" - shift bits left, and carry last bits.
 void QEngineCPU::ROL(bitLenInt shift, bitLenInt start, bitLenInt length)
 {
@@ -40,21 +73,25 @@ void QEngineCPU::ROL(bitLenInt shift, bitLenInt start, bitLenInt length)
 
     Finish();
 
+    if (!stateVec->is_sparse()) {
+        // Rotating the register's bits is reversing all of them, then reversing the low "shift" bits and the rest.
+        const bitCapInt lowMask = pow2Mask(shift);
+        SwapRegPairs(regMask, start, NULL, 0, 0, [&](const bitCapInt& regInt) { return ReverseBits(regInt, length); });
+        SwapRegPairs(regMask, start, NULL, 0, 0, [&](const bitCapInt& regInt) {
+            return ReverseBits(regInt & lowMask, shift) | (ReverseBits(regInt >> shift, length - shift) << shift);
+        });
+        return;
+    }
+
     StateVectorPtr nStateVec = AllocStateVec(maxQPower);
     stateVec->isReadLocked = false;
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    par_for_set(CastStateVecSparse()->iterable(), [&](const bitCapInt lcv, const int cpu) {
         bitCapInt otherRes = lcv & otherMask;
         bitCapInt regInt = (lcv & regMask) >> start;
         bitCapInt outInt = (regInt >> (length - shift)) | ((regInt << shift) & lengthMask);
         nStateVec->write((outInt << start) | otherRes, stateVec->read(lcv));
-    };
-
-    if (stateVec->is_sparse()) {
-        par_for_set(CastStateVecSparse()->iterable(), fn);
-    } else {
-        par_for(0, maxQPower, fn);
-    }
+    });
 
     ResetStateVec(nStateVec);
 }
@@ -79,21 +116,25 @@ void QEngineCPU::INC(bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length)
 
     Finish();
 
+    if (!stateVec->is_sparse()) {
+        // Adding "toAdd" rotates the register's values, which is reversing all of them, then reversing those below
+        // "toAdd" and the rest.
+        SwapRegPairs(inOutMask, inOutStart, NULL, 0, 0, [&](const bitCapInt& regInt) { return lengthMask ^ regInt; });
+        SwapRegPairs(inOutMask, inOutStart, NULL, 0, 0, [&](const bitCapInt& regInt) {
+            return (regInt < toAdd) ? (toAdd - ONE_BCI - regInt) : (toAdd + lengthMask - regInt);
+        });
+        return;
+    }
+
     StateVectorPtr nStateVec = AllocStateVec(maxQPower);
     stateVec->isReadLocked = false;
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    par_for_set(CastStateVecSparse()->iterable(), [&](const bitCapInt lcv, const int cpu) {
         bitCapInt otherRes = lcv & otherMask;
         bitCapInt inOutInt = (lcv & inOutMask) >> inOutStart;
         bitCapInt outInt = (inOutInt + toAdd) & lengthMask;
         nStateVec->write((outInt << inOutStart) | otherRes, stateVec->read(lcv));
-    };
-
-    if (stateVec->is_sparse()) {
-        par_for_set(CastStateVecSparse()->iterable(), fn);
-    } else {
-        par_for(0, maxQPower, fn);
-    }
+    });
 
     ResetStateVec(nStateVec);
 }
@@ -133,6 +174,17 @@ void QEngineCPU::CINC(
 
     Finish();
 
+    if (!stateVec->is_sparse()) {
+        // (As in INC(), on only the permutations where every control is set)
+        SwapRegPairs(inOutMask, inOutStart, controlPowers, controlLen, controlMask,
+            [&](const bitCapInt& regInt) { return lengthMask ^ regInt; });
+        SwapRegPairs(inOutMask, inOutStart, controlPowers, controlLen, controlMask, [&](const bitCapInt& regInt) {
+            return (regInt < toAdd) ? (toAdd - ONE_BCI - regInt) : (toAdd + lengthMask - regInt);
+        });
+        delete[] controlPowers;
+        return;
+    }
+
     StateVectorPtr nStateVec = AllocStateVec(maxQPower);
     nStateVec->copy(stateVec);
     stateVec->isReadLocked = false;
@@ -1149,6 +1201,7 @@ void QEngineCPU::FullAdd(bitLenInt inputBit1, bitLenInt inputBit2, bitLenInt car
     std::sort(qPowers, qPowers + 2);
 
     Finish();
+    UnshareStateVec();
 
     par_for_mask(0, maxQPower, qPowers, 2, [&](const bitCapInt lcv, const int cpu) {
         // Carry-in, sum bit in
@@ -1217,6 +1270,7 @@ void QEngineCPU::IFullAdd(bitLenInt inputBit1, bitLenInt inputBit2, bitLenInt ca
     std::sort(qPowers, qPowers + 2);
 
     Finish();
+    UnshareStateVec();
 
     par_for_mask(0, maxQPower, qPowers, 2, [&](const bitCapInt lcv, const int cpu) {
         // Carry-in, sum bit out
@@ -10,11 +10,16 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <sstream>
 
 #include "oclengine.hpp"
 #include "qengine_opencl.hpp"
 #include "qfactory.hpp"
+#include "qprofiler.hpp"
+#include "statevecpool.hpp"
 
 namespace Qrack {
 
@@ -29,26 +34,52 @@ namespace Qrack {
 #define APPLY2X2_PHASE 0x40
 #define APPLY2X2_INVERT 0x80
 
+// Entries of a probability table scanned serially by one work item, per level of the prefix sum, (as a power of 2)
+#define OCL_CDF_CHUNK_POW 8U
+// Bytes per chunk of a state vector copied between contexts through host staging, (with two chunks in flight)
+#define OCL_MIGRATE_CHUNK_BYTES (1U << 24U)
+
+// Counts the bytes of an asynchronous transfer. With a profiling queue, its time is taken from the device, once the
+// transfer completes, (and otherwise it isn't measured, since the host doesn't wait on it).
+#define RECORD_OCL_TRANSFER(op, clEvent, size)                                                                         \
+    if (QProfiler::IsEnabled()) {                                                                                      \
+        if (device_context->IsProfiling()) {                                                                           \
+            (clEvent).setCallback(CL_COMPLETE, _RecordTransfer<op>, (void*)(size_t)(size));                            \
+        } else {                                                                                                       \
+            QProfiler::Record(op, QProfiler::Now(), 0U, size);                                                         \
+        }                                                                                                              \
+    }
+
 // These are commonly used emplace patterns, for OpenCL buffer I/O.
 #define DISPATCH_TEMP_WRITE(waitVec, buff, size, array, clEvent)                                                       \
     queue.enqueueWriteBuffer(buff, CL_FALSE, 0, size, array, waitVec.get(), &clEvent);                                 \
+    RECORD_OCL_TRANSFER(PROFILE_OCL_UPLOAD, clEvent, size);                                                            \
     queue.flush();
 
 #define DISPATCH_LOC_WRITE(buff, size, array, clEvent)                                                                 \
     queue.enqueueWriteBuffer(buff, CL_FALSE, 0, size, array, NULL, &clEvent);                                          \
+    RECORD_OCL_TRANSFER(PROFILE_OCL_UPLOAD, clEvent, size);                                                            \
     queue.flush();
 
 #define DISPATCH_WRITE(waitVec, buff, size, array)                                                                     \
     device_context->LockWaitEvents();                                                                                  \
     device_context->wait_events->emplace_back();                                                                       \
     queue.enqueueWriteBuffer(buff, CL_FALSE, 0, size, array, waitVec.get(), &(device_context->wait_events->back()));   \
+    RECORD_OCL_TRANSFER(PROFILE_OCL_UPLOAD, device_context->wait_events->back(), size);                                \
     device_context->UnlockWaitEvents();                                                                                \
     queue.flush()
 
+// Arguments are copied into the pool item's own staging memory, which outlives the upload, so the host doesn't wait on
+// it. The upload joins the device's pending events, which the pool item's kernel waits on before it runs.
+#define DISPATCH_ARGS_WRITE(waitVec, buff, size, array, staging)                                                       \
+    std::memcpy(staging, array, size);                                                                                 \
+    DISPATCH_WRITE(waitVec, buff, size, staging)
+
 #define DISPATCH_READ(waitVec, buff, size, array)                                                                      \
     device_context->LockWaitEvents();                                                                                  \
     device_context->wait_events->emplace_back();                                                                       \
     queue.enqueueReadBuffer(buff, CL_FALSE, 0, size, array, waitVec.get(), &(device_context->wait_events->back()));    \
+    RECORD_OCL_TRANSFER(PROFILE_OCL_READBACK, device_context->wait_events->back(), size);                              \
     device_context->UnlockWaitEvents();                                                                                \
     queue.flush()
 
@@ -61,7 +92,10 @@ namespace Qrack {
 
 #define WAIT_REAL1_SUM(buff, size, array, sumPtr)                                                                      \
     clFinish();                                                                                                        \
-    queue.enqueueReadBuffer(buff, CL_TRUE, 0, sizeof(real1) * size, array, NULL, NULL);                                \
+    {                                                                                                                  \
+        QProfileScope readbackProfileScope(PROFILE_OCL_READBACK, sizeof(real1) * size);                                \
+        queue.enqueueReadBuffer(buff, CL_TRUE, 0, sizeof(real1) * size, array, NULL, NULL);                            \
+    }                                                                                                                  \
     *(sumPtr) = ParSum(array, size);
 
 #define CHECK_ZERO_SKIP()                                                                                              \
@@ -69,6 +103,28 @@ namespace Qrack {
         return;                                                                                                        \
     }
 
+// Device nanoseconds from the start to the end of a command, on a profiling queue, (or 0, if unavailable)
+static uint64_t GetEventNanoseconds(cl_event event)
+{
+    cl_ulong start = 0U;
+    cl_ulong end = 0U;
+    if ((clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) != CL_SUCCESS) ||
+        (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) != CL_SUCCESS) ||
+        (end < start)) {
+        return 0U;
+    }
+
+    return (uint64_t)(end - start);
+}
+
+// ("user_data" is the size of the transfer, in bytes.)
+template <QProfileOp op> static void CL_CALLBACK _RecordTransfer(cl_event event, cl_int type, void* user_data)
+{
+    const uint64_t durationNs = GetEventNanoseconds(event);
+    const uint64_t now = QProfiler::Now();
+    QProfiler::Record(op, (now > durationNs) ? (now - durationNs) : now, durationNs, (uint64_t)(size_t)user_data);
+}
+
 QEngineOCL::QEngineOCL(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp, complex phaseFac, bool doNorm,
     bool randomGlobalPhase, bool useHostMem, int devID, bool useHardwareRNG, bool ignored, real1 norm_thresh,
     std::vector<int> devList, bitLenInt qubitThreshold)
@@ -78,6 +134,7 @@ QEngineOCL::QEngineOCL(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_
     , wait_refs()
     , nrmArray(NULL)
     , nrmGroupSize(0)
+    , tileQubits(0)
     , unlockHostMem(false)
 {
     maxQPowerOcl = pow2Ocl(qubitCount);
@@ -94,6 +151,7 @@ void QEngineOCL::GetAmplitudePage(complex* pagePtr, const bitCapInt offset, cons
     }
 
     EventVecPtr waitVec = ResetWaitEvents();
+    QProfileScope profileScope(PROFILE_OCL_READBACK, sizeof(complex) * (bitCapIntOcl)length);
     queue.enqueueReadBuffer(*stateBuffer, CL_TRUE, sizeof(complex) * (bitCapIntOcl)offset,
         sizeof(complex) * (bitCapIntOcl)length, pagePtr, waitVec.get());
 }
@@ -104,7 +162,10 @@ void QEngineOCL::SetAmplitudePage(const complex* pagePtr, const bitCapInt offset
         ReinitBuffer();
     }
 
+    UnshareStateBuffer();
+
     EventVecPtr waitVec = ResetWaitEvents();
+    QProfileScope profileScope(PROFILE_OCL_UPLOAD, sizeof(complex) * (bitCapIntOcl)length);
     queue.enqueueWriteBuffer(*stateBuffer, CL_TRUE, sizeof(complex) * (bitCapIntOcl)offset,
         sizeof(complex) * (bitCapIntOcl)length, pagePtr, waitVec.get());
 
@@ -131,6 +192,7 @@ void QEngineOCL::SetAmplitudePage(
         ClearBuffer(stateBuffer, 0, maxQPowerOcl, ResetWaitEvents());
     }
 
+    UnshareStateBuffer();
     clFinish();
     pageEngineOclPtr->clFinish();
 
@@ -163,6 +225,8 @@ void QEngineOCL::ShuffleBuffers(QEnginePtr engine)
     size_t halfSize = sizeof(complex) * (maxQPowerOcl >> ONE_BCI);
     cl::Buffer tempBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, halfSize);
 
+    UnshareStateBuffer();
+    engineOcl->UnshareStateBuffer();
     engineOcl->clFinish();
     clFinish();
 
@@ -178,6 +242,10 @@ void QEngineOCL::ShuffleBuffers(QEnginePtr engine)
 
 void QEngineOCL::LockSync(cl_int flags)
 {
+    if (flags & CL_MAP_WRITE) {
+        UnshareStateBuffer();
+    }
+
     lockSyncFlags = flags;
     clFinish();
 
@@ -188,6 +256,7 @@ void QEngineOCL::LockSync(cl_int flags)
         unlockHostMem = false;
         stateVec = AllocStateVec(maxQPowerOcl, true);
         if (lockSyncFlags & CL_MAP_READ) {
+            QProfileScope profileScope(PROFILE_OCL_READBACK, sizeof(complex) * maxQPowerOcl);
             queue.enqueueReadBuffer(*stateBuffer, CL_TRUE, 0, sizeof(complex) * maxQPowerOcl, stateVec, NULL);
         }
     }
@@ -204,6 +273,7 @@ void QEngineOCL::UnlockSync()
         wait_refs.clear();
     } else {
         if (lockSyncFlags & CL_MAP_WRITE) {
+            QProfileScope profileScope(PROFILE_OCL_UPLOAD, sizeof(complex) * maxQPowerOcl);
             queue.enqueueWriteBuffer(*stateBuffer, CL_TRUE, 0, sizeof(complex) * maxQPowerOcl, stateVec, NULL);
         }
         FreeStateVec();
@@ -280,7 +350,7 @@ PoolItemPtr QEngineOCL::GetFreePoolItem()
     std::lock_guard<std::mutex> lock(queue_mutex);
 
     while (wait_queue_items.size() >= poolItems.size()) {
-        poolItems.push_back(std::make_shared<PoolItem>(context));
+        poolItems.push_back(std::make_shared<PoolItem>(context, queue));
     }
 
     return poolItems[wait_queue_items.size()];
@@ -299,6 +369,30 @@ EventVecPtr QEngineOCL::ResetWaitEvents(bool waitQueue)
     return wait_refs.back();
 }
 
+/// Whether a kernel only reads its "stateVec" arguments, (writing any result to other buffers)
+static bool IsStateReadOnlyApi(OCLAPI api_call)
+{
+    switch (api_call) {
+    case OCL_API_COMPOSE:
+    case OCL_API_COMPOSE_WIDE:
+    case OCL_API_COMPOSE_MID:
+    case OCL_API_DECOMPOSEPROB:
+    case OCL_API_DISPOSE:
+    case OCL_API_PROB:
+    case OCL_API_PROBREG:
+    case OCL_API_PROBREGALL:
+    case OCL_API_PROBMASK:
+    case OCL_API_PROBMASKALL:
+    case OCL_API_PROBPARITY:
+    case OCL_API_EXPECTATIONPAULI:
+    case OCL_API_APPROXCOMPARE:
+    case OCL_API_UPDATENORM:
+        return true;
+    default:
+        return false;
+    }
+}
+
 void QEngineOCL::WaitCall(
     OCLAPI api_call, size_t workItemCount, size_t localGroupSize, std::vector<BufferPtr> args, size_t localBuffSize)
 {
@@ -306,10 +400,18 @@ void QEngineOCL::WaitCall(
     clFinish();
 }
 
-void QEngineOCL::QueueCall(
-    OCLAPI api_call, size_t workItemCount, size_t localGroupSize, std::vector<BufferPtr> args, size_t localBuffSize)
+void QEngineOCL::QueueCall(OCLAPI api_call, size_t workItemCount, size_t localGroupSize, std::vector<BufferPtr> args,
+    size_t localBuffSize, OCLSpecializedKernelPtr spec)
 {
-    QueueItem item(api_call, workItemCount, localGroupSize, args, localBuffSize);
+    // A kernel that might write a state vector shared by Clone() gets a private copy, in place of the shared buffer.
+    if (stateBufferShare && !IsStateReadOnlyApi(api_call) &&
+        (std::find(args.begin(), args.end(), stateBuffer) != args.end())) {
+        BufferPtr oStateBuffer = stateBuffer;
+        UnshareStateBuffer();
+        std::replace(args.begin(), args.end(), oStateBuffer, stateBuffer);
+    }
+
+    QueueItem item(api_call, workItemCount, localGroupSize, args, localBuffSize, spec);
 
     queue_mutex.lock();
     bool isBase = (wait_queue_items.size() == 0);
@@ -330,6 +432,9 @@ void QEngineOCL::PopQueue(cl_event event, cl_int type)
 {
     queue_mutex.lock();
 
+    if (device_context->IsProfiling() && QProfiler::IsEnabled()) {
+        QProfiler::RecordKernel(wait_queue_items.front().api_call, GetEventNanoseconds(event));
+    }
     wait_queue_items.pop_front();
 
     poolItems.front()->probArray = NULL;
@@ -361,7 +466,7 @@ void QEngineOCL::DispatchQueue(cl_event event, cl_int type)
 
     // We have to reserve the kernel, because its argument hooks are unique. The same kernel therefore can't be used by
     // other QEngineOCL instances, until we're done queueing it.
-    OCLDeviceCall ocl = device_context->Reserve(item.api_call);
+    OCLDeviceCall ocl = device_context->Reserve(item.api_call, item.spec);
 
     // Load the arguments.
     for (unsigned int i = 0; i < args.size(); i++) {
@@ -413,11 +518,14 @@ real1 QEngineOCL::ProbAll(bitCapInt fullRegister)
 void QEngineOCL::SetDevice(const int& dID, const bool& forceReInit)
 {
     bool didInit = (nrmArray != NULL);
+    BufferPtr oldStateBuffer = NULL;
+    cl::CommandQueue oldQueue;
 
     clFinish();
 
     int oldContextId = device_context ? device_context->context_id : 0;
-    device_context = OCLEngine::Instance()->GetDeviceContextPtr(dID);
+    // The context and kernels of a device are made with the first engine that uses it.
+    device_context = OCLEngine::Instance()->GetBuiltDeviceContextPtr(dID);
 
     if (didInit) {
         // If we're "switching" to the device we already have, don't reinitialize.
@@ -426,12 +534,30 @@ void QEngineOCL::SetDevice(const int& dID, const bool& forceReInit)
             context = device_context->context;
             queue = device_context->queue;
 
+#if defined(CL_VERSION_1_2)
+            if (stateBuffer && !stateVec) {
+                // Buffers are shared within a context, so the state only has to move to the new device. That starts
+                // now, rather than on the next kernel, and the next kernel waits on it.
+                device_context->LockWaitEvents();
+                device_context->wait_events->emplace_back();
+                queue.enqueueMigrateMemObjects({ *stateBuffer }, 0, NULL, &(device_context->wait_events->back()));
+                device_context->UnlockWaitEvents();
+                queue.flush();
+            }
+#endif
+
             return;
         }
 
         if (stateBuffer) {
-            // This copies the contents of stateBuffer to host memory, to load into a buffer in the new context.
-            LockSync();
+            if (stateVec) {
+                // This syncs stateBuffer with its host memory, to load into a buffer in the new context.
+                LockSync();
+            } else {
+                // The state is only on the old device, and is copied straight to the new one, below.
+                oldStateBuffer = stateBuffer;
+                oldQueue = queue;
+            }
         }
     }
 
@@ -445,6 +571,11 @@ void QEngineOCL::SetDevice(const int& dID, const bool& forceReInit)
     nrmGroupSize = ocl.call.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device_context->device);
     procElemCount = device_context->device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
     maxWorkItems = device_context->device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0];
+    const size_t localMemSize = device_context->device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    tileQubits = 0;
+    while (((size_t)2U << tileQubits) * sizeof(complex) <= localMemSize) {
+        tileQubits++;
+    }
 
     // constrain to a power of two
     size_t groupSizePow = ONE_BCI;
@@ -506,7 +637,15 @@ void QEngineOCL::SetDevice(const int& dID, const bool& forceReInit)
     if (didInit) {
         if (stateBuffer) {
             if (usingHostRam) {
+                if (oldStateBuffer) {
+                    stateVec = AllocStateVec(maxQPowerOcl, true);
+                    oldQueue.enqueueReadBuffer(
+                        *oldStateBuffer, CL_TRUE, 0, sizeof(complex) * maxQPowerOcl, stateVec, NULL);
+                }
                 ResetStateBuffer(MakeStateVecBuffer(stateVec));
+            } else if (oldStateBuffer) {
+                ResetStateBuffer(MakeStateVecBuffer(NULL));
+                MigrateStateBuffer(oldStateBuffer, oldQueue);
             } else {
                 ResetStateBuffer(MakeStateVecBuffer(NULL));
                 // In this branch, the QEngineOCL was previously allocated, and now we need to copy its memory to a
@@ -527,7 +666,7 @@ void QEngineOCL::SetDevice(const int& dID, const bool& forceReInit)
     }
 
     poolItems.clear();
-    poolItems.push_back(std::make_shared<PoolItem>(context));
+    poolItems.push_back(std::make_shared<PoolItem>(context, queue));
     powersBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_ONLY, sizeof(bitCapIntOcl) * pow2Ocl(QBCAPPOW));
 }
 
@@ -552,11 +691,72 @@ void QEngineOCL::ResetStateVec(complex* nStateVec)
     }
 }
 
-void QEngineOCL::ResetStateBuffer(BufferPtr nStateBuffer) { stateBuffer = nStateBuffer; }
+void QEngineOCL::ResetStateBuffer(BufferPtr nStateBuffer)
+{
+    stateBuffer = nStateBuffer;
+    stateBufferShare = NULL;
+}
+
+void QEngineOCL::MigrateStateBuffer(BufferPtr oldBuffer, cl::CommandQueue oldQueue)
+{
+    const size_t size = sizeof(complex) * maxQPowerOcl;
+    const size_t chunkSize = (size < OCL_MIGRATE_CHUNK_BYTES) ? size : OCL_MIGRATE_CHUNK_BYTES;
+    const size_t chunkCount = size / chunkSize;
+
+    // Two chunks of staging, pinned in the new context, so that the read of one chunk from the old device overlaps the
+    // write of the one before it to the new device. Together, that costs about one transfer of the state vector.
+    cl_int error;
+    char* staging = NULL;
+    std::unique_ptr<char[]> unpinnedStaging;
+    cl::Buffer stagingBuffer(context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, 2U * chunkSize, NULL, &error);
+    if (error == CL_SUCCESS) {
+        staging = (char*)queue.enqueueMapBuffer(
+            stagingBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, 2U * chunkSize, NULL, NULL, &error);
+    }
+    if ((error != CL_SUCCESS) || !staging) {
+        // Pinned memory only makes the copies faster.
+        stagingBuffer = cl::Buffer();
+        unpinnedStaging.reset(new char[2U * chunkSize]);
+        staging = unpinnedStaging.get();
+    }
+
+    // Events can't be waited on across contexts, so the host hands off each chunk from one queue to the other.
+    std::vector<cl::Event> reads(chunkCount);
+    std::vector<cl::Event> writes(chunkCount);
+    oldQueue.enqueueReadBuffer(*oldBuffer, CL_FALSE, 0, chunkSize, staging, NULL, &(reads[0]));
+    oldQueue.flush();
+    for (size_t i = 0; i < chunkCount; i++) {
+        reads[i].wait();
+
+        if ((i + 1U) < chunkCount) {
+            // The next chunk goes in the half that the last write used.
+            if (i > 0) {
+                writes[i - 1U].wait();
+            }
+            oldQueue.enqueueReadBuffer(*oldBuffer, CL_FALSE, (i + 1U) * chunkSize, chunkSize,
+                staging + ((i + 1U) & 1U) * chunkSize, NULL, &(reads[i + 1U]));
+            oldQueue.flush();
+        }
+
+        queue.enqueueWriteBuffer(
+            *stateBuffer, CL_FALSE, i * chunkSize, chunkSize, staging + (i & 1U) * chunkSize, NULL, &(writes[i]));
+        queue.flush();
+    }
+
+    // The staging memory has to outlive the last writes.
+    cl::Event::waitForEvents(writes);
+
+    if (stagingBuffer()) {
+        cl::Event unmapEvent;
+        queue.enqueueUnmapMemObject(stagingBuffer, staging, NULL, &unmapEvent);
+        unmapEvent.wait();
+    }
+}
 
 void QEngineOCL::SetPermutation(bitCapInt perm, complex phaseFac)
 {
     clDump();
+    UnshareStateBuffer(true);
 
     if (!stateBuffer) {
         ReinitBuffer();
@@ -629,8 +829,14 @@ void QEngineOCL::CArithmeticCall(OCLAPI api_call, bitCapIntOcl (&bciArgs)[BCI_AR
 
     BufferPtr loadBuffer;
     if (values) {
-        loadBuffer = std::make_shared<cl::Buffer>(
-            context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(unsigned char) * valuesPower, values);
+        // A table registered with OCLEngine::RegisterTable() is already resident on the device.
+        OCLLookupTablePtr table = OCLEngine::Instance()->GetTable(values, sizeof(unsigned char) * valuesPower);
+        if (table) {
+            loadBuffer = table->GetBuffer(device_context);
+        } else {
+            loadBuffer = std::make_shared<cl::Buffer>(
+                context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(unsigned char) * valuesPower, values);
+        }
         oclArgs.push_back(loadBuffer);
     }
     if (controlLen > 0) {
@@ -643,6 +849,29 @@ void QEngineOCL::CArithmeticCall(OCLAPI api_call, bitCapIntOcl (&bciArgs)[BCI_AR
     ResetStateBuffer(nStateBuffer);
 }
 
+void QEngineOCL::SwapCall(OCLAPI api_call, bitCapIntOcl (&bciArgs)[BCI_ARG_LEN], bitCapIntOcl* controlPowers,
+    const bitLenInt controlLen)
+{
+    CHECK_ZERO_SKIP();
+
+    EventVecPtr waitVec = ResetWaitEvents();
+    PoolItemPtr poolItem = GetFreePoolItem();
+
+    DISPATCH_ARGS_WRITE(
+        waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * BCI_ARG_LEN, bciArgs, poolItem->ulongStaging);
+
+    size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    std::vector<BufferPtr> oclArgs = { stateBuffer, poolItem->ulongBuffer };
+    if (controlLen > 0) {
+        oclArgs.push_back(std::make_shared<cl::Buffer>(
+            context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(bitCapIntOcl) * controlLen, controlPowers));
+    }
+
+    QueueCall(api_call, ngc, ngs, oclArgs);
+}
+
 /// NOT gate, which is also Pauli x matrix
 void QEngineOCL::X(bitLenInt qubit)
 {
@@ -691,11 +920,44 @@ void QEngineOCL::ApplySinglePhase(const complex topLeft, const complex bottomRig
     Apply2x2(0U, qPowers[0], pauliZ, 1U, qPowers, false, SPECIAL_2X2::PHASE);
 }
 
+// The #define lines that specialize the apply2x2 kernels of qspecialize.cl on one single or double bit gate
+static std::string Apply2x2SpecDefines(bitCapIntOcl offset1, bitCapIntOcl offset2, const complex* mtrx,
+    bitLenInt bitCount, const bitCapInt* qPowersSorted, bitCapIntOcl maxI)
+{
+    std::ostringstream defines;
+    defines << "#define SPEC_MAXI ((bitCapIntOcl)" << maxI << ")\n";
+    if (bitCount == 1U) {
+        defines << "#define SPEC_QMASK ((bitCapIntOcl)" << (bitCapIntOcl)(qPowersSorted[0] - 1U) << ")\n";
+    } else {
+        defines << "#define SPEC_QMASK1 ((bitCapIntOcl)" << (bitCapIntOcl)(qPowersSorted[0] - 1U) << ")\n";
+        defines << "#define SPEC_QMASK2 ((bitCapIntOcl)" << (bitCapIntOcl)(qPowersSorted[1] - 1U) << ")\n";
+    }
+    defines << "#define SPEC_OFFSET1 ((bitCapIntOcl)" << offset1 << ")\n";
+    defines << "#define SPEC_OFFSET2 ((bitCapIntOcl)" << offset2 << ")\n";
+
+    // Hexadecimal literals reproduce the matrix entries exactly.
+#if ENABLE_COMPLEX8
+    const char* suffix = "f";
+#else
+    const char* suffix = "";
+#endif
+    defines << "#define SPEC_MTRX " << std::hexfloat;
+    for (int i = 0; i < 4; i++) {
+        defines << (i ? ", " : "") << real(mtrx[i]) << suffix << ", " << imag(mtrx[i]) << suffix;
+    }
+    defines << "\n";
+
+    return defines.str();
+}
+
 void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
     const bitCapInt* qPowersSorted, bool doCalcNorm, SPECIAL_2X2 special, real1 norm_thresh)
 {
     CHECK_ZERO_SKIP();
 
+    // (This times the enqueueing of the kernel, not the kernel itself.)
+    QProfileScope profileScope(PROFILE_APPLY_2X2);
+
     bool skipNorm = !doNormalize || (runningNorm == ONE_R1);
     bool isXGate = skipNorm && (special == SPECIAL_2X2::PAULIX);
     bool isZGate = skipNorm && (special == SPECIAL_2X2::PAULIZ);
@@ -713,8 +975,6 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         waitVec = ResetWaitEvents();
     }
 
-    PoolItemPtr poolItem = GetFreePoolItem();
-
     // Arguments are concatenated into buffers by primitive type, such as integer or complex number.
 
     // Load the integer kernel arguments buffer.
@@ -726,6 +986,26 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
     size_t ngc = FixWorkItemCount(maxI, nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
+    // A single or double bit gate that recurs often enough gets a kernel compiled with all of its arguments as
+    // literals, which takes nothing but the state vector.
+    if ((bitCount <= 2U) && !doCalcNorm) {
+        const std::string defines =
+            Apply2x2SpecDefines((bitCapIntOcl)offset1, (bitCapIntOcl)offset2, mtrx, bitCount, qPowersSorted, maxI);
+        OCLSpecializedKernelPtr spec =
+            device_context->GetSpecialized((bitCount == 1U) ? "apply2x2singlespec" : "apply2x2doublespec", defines);
+        if (spec) {
+            OCLAPI api_call = (bitCount == 1U) ? OCL_API_APPLY2X2_SINGLE : OCL_API_APPLY2X2_DOUBLE;
+            QueueCall(api_call, ngc, ngs, { stateBuffer }, 0, spec);
+            if ((runningNorm == ZERO_R1) ||
+                ((bitCount == 1) && !isXGate && !isZGate && !isInvertGate && !isPhaseGate)) {
+                runningNorm = ONE_R1;
+            }
+            return;
+        }
+    }
+
+    PoolItemPtr poolItem = GetFreePoolItem();
+
     // In an efficient OpenCL kernel, every single byte loaded comes at a significant execution time premium.
     // We handle single and double bit gates as special cases, for many reasons. Given that we have already separated
     // these out as special cases, since we know the bit count, we can eliminate the qPowersSorted buffer, by loading
@@ -749,8 +1029,8 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         bciArgs[3] = (bitCapIntOcl)(qPowersSorted[0] - 1U);
         bciArgs[4] = (bitCapIntOcl)(qPowersSorted[1] - 1U);
     }
-    cl::Event writeArgsEvent;
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * bciArgsSize, bciArgs, writeArgsEvent);
+    DISPATCH_ARGS_WRITE(
+        waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * bciArgsSize, bciArgs, poolItem->ulongStaging);
 
     // Load the 2x2 complex matrix and the normalization factor into the complex arguments buffer.
     complex cmplx[CMPLX_NORM_LEN];
@@ -762,9 +1042,9 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
     cmplx[5] = norm_thresh;
 
     BufferPtr locCmplxBuffer;
-    cl::Event writeGateEvent;
     if (!isXGate && !isZGate) {
-        DISPATCH_TEMP_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * CMPLX_NORM_LEN, cmplx, writeGateEvent);
+        DISPATCH_ARGS_WRITE(
+            waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * CMPLX_NORM_LEN, cmplx, poolItem->cmplxStaging);
     }
 
     // Load a buffer with the powers of 2 of each bit index involved in the operation.
@@ -866,11 +1146,7 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         throw("Invalid APPLY2X2 kernel selected!");
     }
 
-    // Wait for buffer write from limited lifetime objects
-    writeArgsEvent.wait();
-    if (!isXGate && !isZGate) {
-        writeGateEvent.wait();
-    }
+    // Wait for buffer write from limited lifetime objects, (since the caller owns qPowersSorted)
     if (bitCount > 2) {
         writeControlsEvent.wait();
         if (sizeof(bitCapInt) != sizeof(bitCapIntOcl)) {
@@ -910,6 +1186,138 @@ void QEngineOCL::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
     }
 }
 
+void QEngineOCL::ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    if ((targetLen < 2U) || (targetLen > 4U)) {
+        throw std::invalid_argument("ApplyNxN() requires between 1 and 4 target qubits.");
+    }
+
+    CHECK_ZERO_SKIP();
+
+    bitCapIntOcl nPower = pow2Ocl(targetLen);
+
+    // The kernel takes the sorted target powers, followed by the state vector offset of each matrix basis index.
+    bitCapIntOcl targetMask = 0;
+    bitCapIntOcl* qPowers = new bitCapIntOcl[targetLen + nPower]();
+    bitCapIntOcl* offsets = qPowers + targetLen;
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        qPowers[i] = pow2Ocl(targets[i]);
+        if (targetMask & qPowers[i]) {
+            delete[] qPowers;
+            throw std::invalid_argument("ApplyNxN() target qubits must be unique.");
+        }
+        targetMask |= qPowers[i];
+        for (bitCapIntOcl j = 0; j < nPower; j++) {
+            if ((j >> i) & 1U) {
+                offsets[j] |= qPowers[i];
+            }
+        }
+    }
+    std::sort(qPowers, qPowers + targetLen);
+
+    bitCapIntOcl maxI = maxQPowerOcl >> targetLen;
+    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxI, targetLen, nPower, 0, 0, 0, 0, 0, 0, 0 };
+
+    EventVecPtr waitVec = ResetWaitEvents();
+    PoolItemPtr poolItem = GetFreePoolItem();
+
+    cl::Event writeArgsEvent;
+    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 3, bciArgs, writeArgsEvent);
+
+    BufferPtr mtrxBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(complex) * nPower * nPower, (void*)mtrx);
+    BufferPtr qPowersBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(bitCapIntOcl) * (targetLen + nPower), qPowers);
+
+    delete[] qPowers;
+
+    size_t ngc = FixWorkItemCount(maxI, nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    // Wait for buffer write from limited lifetime objects
+    writeArgsEvent.wait();
+    wait_refs.clear();
+
+    QueueCall(OCL_API_APPLYNXN, ngc, ngs, { stateBuffer, mtrxBuffer, poolItem->ulongBuffer, qPowersBuffer });
+
+    if (doNormalize) {
+        UpdateRunningNorm();
+    }
+}
+
+void QEngineOCL::ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count)
+{
+    CHECK_ZERO_SKIP();
+
+    std::vector<bitCapIntOcl> lowGates;
+    if (qubitCount > tileQubits) {
+        for (bitCapIntOcl i = 0; i < count; i++) {
+            if (qubits[i] < tileQubits) {
+                lowGates.push_back(i);
+            }
+        }
+    }
+
+    if (lowGates.size() < 2U) {
+        QEngine::ApplySingleBitBatch(mtrxs, qubits, count);
+        return;
+    }
+
+    // Gates on distinct qubits commute, so the gates on higher qubits can go first, (each qubit's own in order).
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        if (qubits[i] >= tileQubits) {
+            ApplySingleBit(mtrxs + 4U * i, qubits[i]);
+        }
+    }
+
+    const bitCapIntOcl tileCount = maxQPowerOcl >> (bitCapIntOcl)tileQubits;
+    const size_t ngs = nrmGroupSize;
+    const size_t ngc = ngs * std::min((size_t)tileCount, nrmGroupCount / nrmGroupSize);
+
+    for (size_t start = 0; start < lowGates.size(); start += QRACK_OCL_TILE_MAX_GATES) {
+        const size_t gateCount = std::min((size_t)QRACK_OCL_TILE_MAX_GATES, lowGates.size() - start);
+        std::vector<complex> gateMtrxs(4U * gateCount);
+        std::vector<bitCapIntOcl> qPowers(gateCount);
+        for (size_t i = 0; i < gateCount; i++) {
+            const bitCapIntOcl gate = lowGates[start + i];
+            std::copy(mtrxs + 4U * gate, mtrxs + 4U * (gate + 1U), gateMtrxs.begin() + 4U * i);
+            qPowers[i] = pow2Ocl(qubits[gate]);
+        }
+
+        bitCapIntOcl bciArgs[BCI_ARG_LEN] = { tileCount, pow2Ocl(tileQubits), (bitCapIntOcl)gateCount, 0, 0, 0, 0, 0,
+            0, 0 };
+
+        EventVecPtr waitVec = ResetWaitEvents();
+        PoolItemPtr poolItem = GetFreePoolItem();
+
+        cl::Event writeArgsEvent;
+        DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 3, bciArgs, writeArgsEvent);
+
+        BufferPtr mtrxBuffer = std::make_shared<cl::Buffer>(
+            context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(complex) * 4U * gateCount, &(gateMtrxs[0]));
+        BufferPtr qPowersBuffer = std::make_shared<cl::Buffer>(
+            context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(bitCapIntOcl) * gateCount, &(qPowers[0]));
+
+        // Wait for buffer write from limited lifetime objects
+        writeArgsEvent.wait();
+        wait_refs.clear();
+
+        // The last argument is the tile, in local memory.
+        QueueCall(OCL_API_APPLY2X2_TILED, ngc, ngs, { stateBuffer, mtrxBuffer, poolItem->ulongBuffer, qPowersBuffer },
+            sizeof(complex) << (size_t)tileQubits);
+    }
+
+    // As for ApplyNxN(), any pending normalization is left to the running norm.
+    if (doNormalize) {
+        UpdateRunningNorm();
+    }
+}
+
 void QEngineOCL::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
     bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
     const bitCapInt& mtrxSkipValueMask)
@@ -983,16 +1391,12 @@ void QEngineOCL::UniformParityRZ(const bitCapInt& mask, const real1& angle)
     EventVecPtr waitVec = ResetWaitEvents();
     PoolItemPtr poolItem = GetFreePoolItem();
 
-    cl::Event writeArgsEvent, writeNormEvent;
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 2, bciArgs, writeArgsEvent);
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * 3, &phaseFacs, writeNormEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 2, bciArgs, poolItem->ulongStaging);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * 3, phaseFacs, poolItem->cmplxStaging);
 
     size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
-    // Wait for buffer write from limited lifetime objects
-    writeArgsEvent.wait();
-    writeNormEvent.wait();
     wait_refs.clear();
 
     QueueCall((runningNorm == ONE_R1) ? OCL_API_UNIFORMPARITYRZ : OCL_API_UNIFORMPARITYRZ_NORM, ngc, ngs,
@@ -1030,16 +1434,12 @@ void QEngineOCL::CUniformParityRZ(
     EventVecPtr waitVec = ResetWaitEvents();
     PoolItemPtr poolItem = GetFreePoolItem();
 
-    cl::Event writeArgsEvent, writeNormEvent;
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs, writeArgsEvent);
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * 2, &phaseFacs, writeNormEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs, poolItem->ulongStaging);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex) * 2, phaseFacs, poolItem->cmplxStaging);
 
     size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
-    // Wait for buffer write from limited lifetime objects
-    writeArgsEvent.wait();
-    writeNormEvent.wait();
     wait_refs.clear();
 
     QueueCall(OCL_API_CUNIFORMPARITYRZ, ngc, ngs,
@@ -1048,6 +1448,121 @@ void QEngineOCL::CUniformParityRZ(
     runningNorm = ONE_R1;
 }
 
+void QEngineOCL::QFT(bitLenInt start, bitLenInt length, bool trySeparate) { RegisterFourier(start, length, false); }
+
+void QEngineOCL::IQFT(bitLenInt start, bitLenInt length, bool trySeparate) { RegisterFourier(start, length, true); }
+
+void QEngineOCL::RegisterFourier(bitLenInt start, bitLenInt length, bool inverse)
+{
+    if (!length) {
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    // QFT() pairs the register bits from the top down, as (length - 1, length - 2), (length - 3, length - 4), and so
+    // on, for radix-4 passes, with a radix-2 pass on bit 0 left over if "length" is odd. IQFT() undoes these passes in
+    // reverse order.
+    std::vector<std::pair<bitLenInt, bool>> stages;
+    int bit;
+    for (bit = (int)length - 1; bit > 0; bit -= 2) {
+        stages.push_back(std::make_pair((bitLenInt)bit, true));
+    }
+    if (!bit) {
+        stages.push_back(std::make_pair((bitLenInt)0U, false));
+    }
+    if (inverse) {
+        std::reverse(stages.begin(), stages.end());
+    }
+
+    for (size_t i = 0; i < stages.size(); i++) {
+        const bool isRadix4 = stages[i].second;
+        bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl >> (isRadix4 ? 2U : 1U), start, pow2Ocl(stages[i].first),
+            inverse ? 1U : 0U, 0, 0, 0, 0, 0, 0 };
+
+        EventVecPtr waitVec = ResetWaitEvents();
+        PoolItemPtr poolItem = GetFreePoolItem();
+
+        DISPATCH_ARGS_WRITE(
+            waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs, poolItem->ulongStaging);
+
+        size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
+        size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+        wait_refs.clear();
+
+        QueueCall(isRadix4 ? OCL_API_QFT_RADIX4 : OCL_API_QFT_RADIX2, ngc, ngs, { stateBuffer, poolItem->ulongBuffer });
+    }
+}
+
+void QEngineOCL::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    if (!length) {
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    // Each value of the bits outside the register gets "itemsPerOuter" partial sums, enough to fill the device if the
+    // register is most of the state.
+    const bitCapIntOcl regPower = pow2Ocl(length);
+    const bitCapIntOcl outerCount = maxQPowerOcl >> length;
+    bitCapIntOcl itemsPerOuter = 1U;
+    while ((itemsPerOuter < regPower) && ((outerCount * (itemsPerOuter << ONE_BCI)) <= nrmGroupCount)) {
+        itemsPerOuter <<= ONE_BCI;
+    }
+    const bitCapIntOcl partialCount = outerCount * itemsPerOuter;
+
+    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { partialCount, start, length, itemsPerOuter, 0, 0, 0, 0, 0, 0 };
+
+    EventVecPtr waitVec = ResetWaitEvents();
+    PoolItemPtr poolItem = GetFreePoolItem();
+
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs, poolItem->ulongStaging);
+
+    BufferPtr sumsBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_WRITE, sizeof(complex) * partialCount);
+
+    size_t ngc = FixWorkItemCount(partialCount, nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    wait_refs.clear();
+
+    QueueCall(OCL_API_GROVER_DIFFUSION_SUM, ngc, ngs, { stateBuffer, poolItem->ulongBuffer, sumsBuffer });
+
+    if (itemsPerOuter > 1U) {
+        // There are no more partial sums than work items, so they're totaled on the host.
+        std::unique_ptr<complex[]> sums(new complex[partialCount]);
+        waitVec = ResetWaitEvents();
+        queue.enqueueReadBuffer(*sumsBuffer, CL_TRUE, 0, sizeof(complex) * partialCount, sums.get(), waitVec.get());
+        wait_refs.clear();
+
+        for (bitCapIntOcl i = 0; i < outerCount; i++) {
+            complex sum = ZERO_CMPLX;
+            for (bitCapIntOcl j = 0; j < itemsPerOuter; j++) {
+                sum += sums[i * itemsPerOuter + j];
+            }
+            sums[i] = sum;
+        }
+
+        sumsBuffer = std::make_shared<cl::Buffer>(
+            context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(complex) * outerCount, sums.get());
+    }
+
+    bciArgs[0] = maxQPowerOcl;
+
+    waitVec = ResetWaitEvents();
+    poolItem = GetFreePoolItem();
+
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 3, bciArgs, poolItem->ulongStaging);
+
+    ngc = FixWorkItemCount(maxQPowerOcl, nrmGroupCount);
+    ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    wait_refs.clear();
+
+    QueueCall(OCL_API_GROVER_DIFFUSION, ngc, ngs, { stateBuffer, poolItem->ulongBuffer, sumsBuffer });
+}
+
 void QEngineOCL::ApplyMx(OCLAPI api_call, bitCapIntOcl* bciArgs, complex nrm)
 {
     CHECK_ZERO_SKIP();
@@ -1056,18 +1571,12 @@ void QEngineOCL::ApplyMx(OCLAPI api_call, bitCapIntOcl* bciArgs, complex nrm)
     EventVecPtr waitVec;
     PoolItemPtr poolItem = GetFreePoolItem();
 
-    cl::Event writeArgsEvent, writeNormEvent;
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 3, bciArgs, writeArgsEvent);
-    BufferPtr locCmplxBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_ONLY, sizeof(complex));
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex), &nrm, writeNormEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 3, bciArgs, poolItem->ulongStaging);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->cmplxBuffer), sizeof(complex), &nrm, poolItem->cmplxStaging);
 
     size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
-    // Wait for buffer write from limited lifetime objects
-    writeArgsEvent.wait();
-    writeNormEvent.wait();
-
     QueueCall(api_call, ngc, ngs, { stateBuffer, poolItem->ulongBuffer, poolItem->cmplxBuffer });
 
     runningNorm = ONE_R1;
@@ -1203,12 +1712,13 @@ void QEngineOCL::DecomposeDispose(bitLenInt start, bitLenInt length, QEngineOCLP
         if (destination != NULL) {
             destination->ResetStateVec(stateVec);
             destination->stateBuffer = stateBuffer;
+            destination->stateBufferShare = stateBufferShare;
             stateVec = NULL;
             // destination->SetDevice(destinationDevID);
         }
         // This will be cleared by the destructor:
         ResetStateVec(AllocStateVec(2));
-        stateBuffer = MakeStateVecBuffer(stateVec);
+        ResetStateBuffer(MakeStateVecBuffer(stateVec));
         SetQubitCount(1);
         return;
     }
@@ -1274,7 +1784,7 @@ void QEngineOCL::DecomposeDispose(bitLenInt start, bitLenInt length, QEngineOCLP
             copyEvent.wait();
             wait_refs.clear();
 
-            destination->stateBuffer = nSB;
+            destination->ResetStateBuffer(nSB);
             FreeAligned(destination->stateVec);
             destination->stateVec = NULL;
         }
@@ -1324,7 +1834,7 @@ void QEngineOCL::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPe
     if (length == qubitCount) {
         // This will be cleared by the destructor:
         ResetStateVec(AllocStateVec(2));
-        stateBuffer = MakeStateVecBuffer(stateVec);
+        ResetStateBuffer(MakeStateVecBuffer(stateVec));
         SetQubitCount(1);
         return;
     }
@@ -1518,7 +2028,6 @@ void QEngineOCL::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
     }
 
     bitCapIntOcl lengthPower = pow2Ocl(length);
-    bitCapIntOcl maxJ = maxQPowerOcl >> length;
 
     if (!stateBuffer) {
         std::fill(probsArray, probsArray + lengthPower, ZERO_R1);
@@ -1532,6 +2041,30 @@ void QEngineOCL::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
         return;
     }
 
+    BufferPtr probsBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_WRITE, sizeof(real1) * lengthPower);
+    QueueProbMaskAll(mask, probsBuffer);
+
+    EventVecPtr waitVec = ResetWaitEvents();
+
+    queue.enqueueReadBuffer(*probsBuffer, CL_TRUE, 0, sizeof(real1) * lengthPower, probsArray, waitVec.get());
+    wait_refs.clear();
+}
+
+void QEngineOCL::QueueProbMaskAll(const bitCapInt& mask, BufferPtr probsBuffer)
+{
+    bitCapIntOcl v = (bitCapIntOcl)mask; // count the number of bits set in v
+    bitCapIntOcl oldV;
+    bitLenInt length;
+    std::vector<bitCapIntOcl> powersVec;
+    for (length = 0; v; length++) {
+        oldV = v;
+        v &= v - ONE_BCI; // clear the least significant bit set
+        powersVec.push_back((v ^ oldV) & oldV);
+    }
+
+    bitCapIntOcl lengthPower = pow2Ocl(length);
+    bitCapIntOcl maxJ = maxQPowerOcl >> length;
+
     v = (~(bitCapIntOcl)mask) & (maxQPowerOcl - ONE_BCI); // count the number of bits set in v
     bitCapIntOcl skipPower;
     bitLenInt skipLength = 0; // c accumulates the total bits set in v
@@ -1545,12 +2078,10 @@ void QEngineOCL::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
 
     bitCapIntOcl bciArgs[BCI_ARG_LEN] = { lengthPower, maxJ, length, skipLength, 0, 0, 0, 0, 0, 0 };
 
-    EventVecPtr waitVec = ResetWaitEvents();
     PoolItemPtr poolItem = GetFreePoolItem();
 
-    DISPATCH_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs);
-
-    BufferPtr probsBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_WRITE_ONLY, sizeof(real1) * lengthPower);
+    cl::Event writeArgsEvent;
+    DISPATCH_LOC_WRITE(*(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs, writeArgsEvent);
 
     bitCapIntOcl* powers = new bitCapIntOcl[length];
     std::copy(powersVec.begin(), powersVec.end(), powers);
@@ -1567,16 +2098,148 @@ void QEngineOCL::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
     size_t ngc = FixWorkItemCount(lengthPower, nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
+    // Wait for buffer write from limited lifetime objects
+    writeArgsEvent.wait();
+
     QueueCall(OCL_API_PROBMASKALL, ngc, ngs,
         { stateBuffer, poolItem->ulongBuffer, probsBuffer, qPowersBuffer, qSkipPowersBuffer });
 
-    EventVecPtr waitVec2 = ResetWaitEvents();
+    delete[] powers;
+    delete[] skipPowers;
+}
 
-    queue.enqueueReadBuffer(*probsBuffer, CL_TRUE, 0, sizeof(real1) * lengthPower, probsArray, waitVec2.get());
+void QEngineOCL::QueueProbCdf(BufferPtr probsBuffer, bitCapIntOcl count)
+{
+    // Scan each level's chunks in place, collecting chunk totals into the next level, until one chunk covers a level.
+    // Then, walking back down, add each level's scanned totals into the level below.
+    std::vector<BufferPtr> levels(1, probsBuffer);
+    std::vector<bitCapIntOcl> counts(1, count);
+    bitCapIntOcl chunkCount, chunkSize;
+
+    for (;;) {
+        chunkSize = (counts.back() > pow2Ocl(OCL_CDF_CHUNK_POW)) ? pow2Ocl(OCL_CDF_CHUNK_POW) : counts.back();
+        chunkCount = counts.back() / chunkSize;
+
+        BufferPtr sumsBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_WRITE, sizeof(real1) * chunkCount);
+        bitCapIntOcl bciArgs[2] = { chunkCount, chunkSize };
+        PoolItemPtr poolItem = GetFreePoolItem();
+        cl::Event writeArgsEvent;
+        DISPATCH_LOC_WRITE(*(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 2, bciArgs, writeArgsEvent);
+
+        size_t ngc = FixWorkItemCount(chunkCount, nrmGroupCount);
+        size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+        // Wait for buffer write from limited lifetime objects
+        writeArgsEvent.wait();
+
+        QueueCall(OCL_API_PROBCDF, ngc, ngs, { levels.back(), poolItem->ulongBuffer, sumsBuffer });
+
+        if (chunkCount == 1U) {
+            break;
+        }
+
+        levels.push_back(sumsBuffer);
+        counts.push_back(chunkCount);
+    }
+
+    for (size_t level = levels.size() - 1U; level > 0U; level--) {
+        bitCapIntOcl bciArgs[2] = { counts[level - 1U], OCL_CDF_CHUNK_POW };
+        PoolItemPtr poolItem = GetFreePoolItem();
+        cl::Event writeArgsEvent;
+        DISPATCH_LOC_WRITE(*(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 2, bciArgs, writeArgsEvent);
+
+        size_t ngc = FixWorkItemCount(counts[level - 1U], nrmGroupCount);
+        size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+        // Wait for buffer write from limited lifetime objects
+        writeArgsEvent.wait();
+
+        QueueCall(OCL_API_PROBCDFADD, ngc, ngs, { levels[level - 1U], poolItem->ulongBuffer, levels[level] });
+    }
+}
+
+std::map<bitCapInt, int> QEngineOCL::MultiShotMeasureMask(
+    const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots)
+{
+    bitCapIntOcl lengthPower = pow2Ocl(qPowerCount);
+
+    // Once there are as many shots as table entries, reading back the table is no more expensive than reading back
+    // the samples, and the host can use an alias table. Small tables aren't worth the extra kernel launches, either.
+    if (!stateBuffer || !shots || ((bitCapIntOcl)shots >= lengthPower) ||
+        ((lengthPower * lengthPower) < nrmGroupCount)) {
+        return QInterface::MultiShotMeasureMask(qPowers, qPowerCount, shots);
+    }
+
+    if (doNormalize) {
+        NormalizeState();
+    }
+
+    bitLenInt i;
+    bitCapInt mask = 0U;
+    for (i = 0; i < qPowerCount; i++) {
+        mask |= qPowers[i];
+    }
+
+    // ProbMaskAll orders its output by ascending mask bit, which need not be the order the caller asked for.
+    std::vector<bitCapInt> qPowersSorted(qPowers, qPowers + qPowerCount);
+    std::sort(qPowersSorted.begin(), qPowersSorted.end());
+    std::vector<bitCapInt> maskMap(qPowerCount);
+    for (bitLenInt k = 0; k < qPowerCount; k++) {
+        for (i = 0; i < qPowerCount; i++) {
+            if (qPowersSorted[k] == qPowers[i]) {
+                maskMap[k] = pow2(i);
+                break;
+            }
+        }
+    }
+
+    // The table is built, scanned, and searched on the device. Only the random draws and sampled indices cross the bus.
+    BufferPtr probsBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_READ_WRITE, sizeof(real1) * lengthPower);
+    QueueProbMaskAll(mask, probsBuffer);
+    QueueProbCdf(probsBuffer, lengthPower);
+
+    std::unique_ptr<real1[]> rands(new real1[shots]);
+    FillRand(rands.get(), shots);
+    BufferPtr randsBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(real1) * shots, rands.get());
+    BufferPtr samplesBuffer = std::make_shared<cl::Buffer>(context, CL_MEM_WRITE_ONLY, sizeof(bitCapIntOcl) * shots);
+
+    bitCapIntOcl bciArgs[2] = { lengthPower, (bitCapIntOcl)shots };
+    PoolItemPtr poolItem = GetFreePoolItem();
+    cl::Event writeArgsEvent;
+    DISPATCH_LOC_WRITE(*(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 2, bciArgs, writeArgsEvent);
+
+    size_t ngc = FixWorkItemCount(shots, nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    // Wait for buffer write from limited lifetime objects
+    writeArgsEvent.wait();
+
+    QueueCall(OCL_API_SAMPLECDF, ngc, ngs, { probsBuffer, poolItem->ulongBuffer, randsBuffer, samplesBuffer });
+
+    std::unique_ptr<bitCapIntOcl[]> samples(new bitCapIntOcl[shots]);
+    EventVecPtr waitVec = ResetWaitEvents();
+    queue.enqueueReadBuffer(*samplesBuffer, CL_TRUE, 0, sizeof(bitCapIntOcl) * shots, samples.get(), waitVec.get());
     wait_refs.clear();
 
-    delete[] powers;
-    delete[] skipPowers;
+    std::map<bitCapIntOcl, int> subsetResults;
+    for (unsigned int shot = 0; shot < shots; shot++) {
+        subsetResults[samples[shot]]++;
+    }
+
+    std::map<bitCapInt, int> results;
+    bitCapInt key;
+    for (auto it = subsetResults.begin(); it != subsetResults.end(); it++) {
+        key = 0;
+        for (i = 0; i < qPowerCount; i++) {
+            if (it->first & pow2Ocl(i)) {
+                key |= maskMap[i];
+            }
+        }
+        results[key] = it->second;
+    }
+
+    return results;
 }
 
 real1 QEngineOCL::ProbParity(const bitCapInt& mask)
@@ -1596,6 +2259,53 @@ real1 QEngineOCL::ProbParity(const bitCapInt& mask)
     return Probx(OCL_API_PROBPARITY, bciArgs);
 }
 
+void QEngineOCL::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    if (doNormalize) {
+        NormalizeState();
+    }
+
+    if (!stateBuffer) {
+        std::fill(expectations, expectations + termCount, ZERO_R1);
+        return;
+    }
+
+    size_t ngc = FixWorkItemCount(maxQPowerOcl, nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        const bitCapIntOcl xMask = (bitCapIntOcl)terms[i].xMask;
+        const bitCapIntOcl zMask = (bitCapIntOcl)terms[i].zMask;
+
+        // Y = i * X * Z, so each Y contributes a factor of i, and the kernel sums whichever part of
+        // conj(psi[k ^ x]) * (-1)^|k & z| * psi[k] survives multiplication by i^(Y count).
+        bitLenInt yCount = 0;
+        for (bitCapIntOcl v = xMask & zMask; v; v &= v - ONE_BCI) {
+            yCount++;
+        }
+
+        bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl, xMask, zMask, (bitCapIntOcl)(yCount & 1U), 0, 0, 0, 0, 0,
+            0 };
+
+        EventVecPtr waitVec = ResetWaitEvents();
+        PoolItemPtr poolItem = GetFreePoolItem();
+
+        DISPATCH_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 4, bciArgs);
+
+        QueueCall(OCL_API_EXPECTATIONPAULI, ngc, ngs, { stateBuffer, poolItem->ulongBuffer, nrmBuffer },
+            sizeof(real1) * ngs);
+
+        real1 expectation;
+        WAIT_REAL1_SUM(*nrmBuffer, ngc / ngs, nrmArray, &expectation);
+
+        // i^0 and i^3 keep the sign of the (real or imaginary) part; i^1 and i^2 flip it.
+        if (((yCount & 3U) == 1U) || ((yCount & 3U) == 2U)) {
+            expectation = -expectation;
+        }
+        expectations[i] = (expectation > ONE_R1) ? ONE_R1 : ((expectation < -ONE_R1) ? -ONE_R1 : expectation);
+    }
+}
+
 bool QEngineOCL::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
 {
     // If no bits in mask:
@@ -1637,10 +2347,12 @@ void QEngineOCL::ROx(OCLAPI api_call, bitLenInt shift, bitLenInt start, bitLenIn
     bitCapIntOcl lengthPower = pow2Ocl(length);
     bitCapIntOcl regMask = (lengthPower - ONE_BCI) << start;
     bitCapIntOcl otherMask = (maxQPowerOcl - ONE_BCI) & (~regMask);
-    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl, regMask, otherMask, lengthPower, start, shift, length, 0, 0,
-        0 };
 
-    ArithmeticCall(api_call, bciArgs);
+    // Reverse all of the register's bits, then the low "shift" bits and the rest.
+    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl, regMask, otherMask, start, length, length, 0, 0, 0, 0 };
+    SwapCall(api_call, bciArgs);
+    bciArgs[5] = shift;
+    SwapCall(api_call, bciArgs);
 }
 
 /// "Circular shift left" - shift bits left, and carry last bits.
@@ -1663,9 +2375,11 @@ void QEngineOCL::INT(OCLAPI api_call, bitCapIntOcl toMod, const bitLenInt start,
     bitCapIntOcl regMask = lengthMask << start;
     bitCapIntOcl otherMask = (maxQPowerOcl - ONE_BCI) & ~(regMask);
 
-    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl, regMask, otherMask, lengthPower, start, toMod, 0, 0, 0, 0 };
-
-    ArithmeticCall(api_call, bciArgs);
+    // Reverse all of the register's values, then those below "toMod" and the rest.
+    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl, regMask, otherMask, start, lengthMask, 0, 0, 0, 0, 0 };
+    SwapCall(api_call, bciArgs);
+    bciArgs[5] = toMod;
+    SwapCall(api_call, bciArgs);
 }
 
 /// Add or Subtract integer (without sign or carry, with controls)
@@ -1693,12 +2407,14 @@ void QEngineOCL::CINT(OCLAPI api_call, bitCapIntOcl toMod, const bitLenInt start
     }
     std::sort(controlPowers, controlPowers + controlLen);
 
-    bitCapIntOcl otherMask = (maxQPowerOcl - ONE_BCI) ^ (regMask | controlMask);
+    bitCapIntOcl otherMask = (maxQPowerOcl - ONE_BCI) ^ regMask;
 
-    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl >> controlLen, regMask, otherMask, lengthPower, start, toMod,
+    // (As in INT(), on only the permutations where every control is set)
+    bitCapIntOcl bciArgs[BCI_ARG_LEN] = { maxQPowerOcl >> controlLen, regMask, otherMask, start, lengthMask, 0,
         controlLen, controlMask, 0, 0 };
-
-    CArithmeticCall(api_call, bciArgs, controlPowers, controlLen);
+    SwapCall(api_call, bciArgs, controlPowers, controlLen);
+    bciArgs[5] = toMod;
+    SwapCall(api_call, bciArgs, controlPowers, controlLen);
 
     delete[] controlPowers;
 }
@@ -2324,15 +3040,11 @@ void QEngineOCL::PhaseFlipX(OCLAPI api_call, bitCapIntOcl* bciArgs)
     EventVecPtr waitVec;
     PoolItemPtr poolItem = GetFreePoolItem();
 
-    cl::Event writeArgsEvent;
-    DISPATCH_TEMP_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 5, bciArgs, writeArgsEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl) * 5, bciArgs, poolItem->ulongStaging);
 
     size_t ngc = FixWorkItemCount(bciArgs[0], nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
-    // Wait for buffer write from limited lifetime objects
-    writeArgsEvent.wait();
-
     QueueCall(api_call, ngc, ngs, { stateBuffer, poolItem->ulongBuffer });
 }
 
@@ -2375,12 +3087,14 @@ void QEngineOCL::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenI
 void QEngineOCL::SetQuantumState(const complex* inputState)
 {
     clDump();
+    UnshareStateBuffer(true);
 
     if (!stateBuffer) {
         ReinitBuffer();
     }
 
     EventVecPtr waitVec = ResetWaitEvents();
+    QProfileScope profileScope(PROFILE_OCL_UPLOAD, sizeof(complex) * maxQPowerOcl);
     queue.enqueueWriteBuffer(*stateBuffer, CL_TRUE, 0, sizeof(complex) * maxQPowerOcl, inputState, waitVec.get());
 
     UpdateRunningNorm();
@@ -2420,6 +3134,8 @@ void QEngineOCL::SetAmplitude(bitCapInt perm, complex amp)
         ClearBuffer(stateBuffer, 0, maxQPowerOcl, ResetWaitEvents());
     }
 
+    UnshareStateBuffer();
+
     // "permutationAmp" might be in use, so we clFinish(), first, to guarantee it is not.
     clFinish();
     permutationAmp = amp;
@@ -2446,6 +3162,7 @@ void QEngineOCL::GetQuantumState(complex* outputState)
     }
 
     EventVecPtr waitVec = ResetWaitEvents();
+    QProfileScope profileScope(PROFILE_OCL_READBACK, sizeof(complex) * maxQPowerOcl);
     queue.enqueueReadBuffer(*stateBuffer, CL_TRUE, 0, sizeof(complex) * maxQPowerOcl, outputState, waitVec.get());
     queue.flush();
     clFinish();
@@ -2454,6 +3171,27 @@ void QEngineOCL::GetQuantumState(complex* outputState)
 /// Get all probabilities, in unsigned int permutation basis
 void QEngineOCL::GetProbs(real1* outputProbs) { ProbRegAll(0, qubitCount, outputProbs); }
 
+/// Lock a view of the state buffer, mapped in place if it's in host memory, (or else read into host memory)
+QStateViewPtr QEngineOCL::LockStateView(bool isWritable)
+{
+    if (doNormalize) {
+        NormalizeState();
+    }
+
+    if (!stateBuffer) {
+        return QInterface::LockStateView(isWritable);
+    }
+
+    LockSync(isWritable ? (CL_MAP_READ | CL_MAP_WRITE) : CL_MAP_READ);
+
+    return QStateViewPtr(new QStateView(stateVec, maxQPowerOcl, isWritable, [this, isWritable] {
+        UnlockSync();
+        if (isWritable) {
+            UpdateRunningNorm();
+        }
+    }));
+}
+
 bool QEngineOCL::ApproxCompare(QEngineOCLPtr toCompare)
 {
     // If the qubit counts are unequal, these can't be approximately equal objects.
@@ -2489,6 +3227,28 @@ bool QEngineOCL::ApproxCompare(QEngineOCLPtr toCompare)
 
 QInterfacePtr QEngineOCL::Clone()
 {
+    Finish();
+
+    // A state vector in device RAM is shared with the clone, and only copied by the first engine to write to it. (A
+    // buffer that wraps host RAM belongs to its engine's allocation, so that is copied, as before.)
+    if (stateBuffer && !stateVec) {
+        // (The clone starts as a single qubit, and then grows into the shared buffer, as Compose() does.)
+        QEngineOCLPtr copyPtr = std::make_shared<QEngineOCL>(1, 0, rand_generator, ONE_CMPLX, doNormalize,
+            randGlobalPhase, useHostRam, deviceID, hardware_rand_generator != NULL, false, amplitudeFloor);
+
+        copyPtr->Finish();
+        copyPtr->SetQubitCount(qubitCount);
+        copyPtr->ResetStateBuffer(stateBuffer);
+        copyPtr->runningNorm = runningNorm;
+
+        if (!stateBufferShare || (*stateBufferShare != stateBuffer.get())) {
+            stateBufferShare = std::make_shared<cl::Buffer*>(stateBuffer.get());
+        }
+        copyPtr->stateBufferShare = stateBufferShare;
+
+        return copyPtr;
+    }
+
     QEngineOCLPtr copyPtr = std::make_shared<QEngineOCL>(qubitCount, 0, rand_generator, ONE_CMPLX, doNormalize,
         randGlobalPhase, useHostRam, deviceID, hardware_rand_generator != NULL, false, amplitudeFloor);
 
@@ -2520,20 +3280,18 @@ void QEngineOCL::NormalizeState(real1 nrm, real1 norm_thresh)
 
     PoolItemPtr poolItem = GetFreePoolItem();
 
+    // We don't actually have to wait, so this is empty:
+    EventVecPtr waitVec;
+
     real1 r1_args[2] = { norm_thresh, (real1)ONE_R1 / std::sqrt(nrm) };
-    cl::Event writeRealArgsEvent;
-    DISPATCH_LOC_WRITE(*(poolItem->realBuffer), sizeof(real1) * 2, r1_args, writeRealArgsEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->realBuffer), sizeof(real1) * 2, r1_args, poolItem->realStaging);
 
     bitCapIntOcl bciArgs[1] = { maxQPowerOcl };
-    cl::Event writeBCIArgsEvent;
-    DISPATCH_LOC_WRITE(*(poolItem->ulongBuffer), sizeof(bitCapIntOcl), bciArgs, writeBCIArgsEvent);
+    DISPATCH_ARGS_WRITE(waitVec, *(poolItem->ulongBuffer), sizeof(bitCapIntOcl), bciArgs, poolItem->ulongStaging);
 
     size_t ngc = FixWorkItemCount(maxQPowerOcl, nrmGroupCount);
     size_t ngs = FixGroupSize(ngc, nrmGroupSize);
 
-    // Wait for buffer write from limited lifetime objects
-    writeRealArgsEvent.wait();
-    writeBCIArgsEvent.wait();
     wait_refs.clear();
 
     OCLAPI api_call;
@@ -2613,14 +3371,49 @@ complex* QEngineOCL::AllocStateVec(bitCapInt elemCount, bool doForceAlloc)
 #endif
 }
 
+// A freed device-only state buffer, with a marker for the completion of any device work enqueued before it was freed
+struct PooledStateBuffer {
+    cl::Buffer buffer;
+    cl::Event marker;
+};
+
+static void DestroyPooledStateBuffer(PooledStateBuffer& pooled) { pooled = PooledStateBuffer(); }
+
+static StateVecPool<PooledStateBuffer>* GetStateBufferPool()
+{
+    static StateVecPool<PooledStateBuffer> pool(DestroyPooledStateBuffer);
+    return &pool;
+}
+
 BufferPtr QEngineOCL::MakeStateVecBuffer(complex* nStateVec)
 {
+    size_t size = sizeof(complex) * maxQPowerOcl;
+
+    // A buffer that wraps host memory is tied to that allocation, so only device-only buffers are pooled.
     if (nStateVec) {
-        return std::make_shared<cl::Buffer>(
-            context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_WRITE, sizeof(complex) * maxQPowerOcl, nStateVec);
+        return std::make_shared<cl::Buffer>(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_WRITE, size, nStateVec);
+    }
+
+    int devKey = device_context->device_id;
+    PooledStateBuffer pooled;
+    if (GetStateBufferPool()->Acquire(devKey, size, pooled)) {
+        pooled.marker.wait();
     } else {
-        return std::make_shared<cl::Buffer>(context, CL_MEM_READ_WRITE, sizeof(complex) * maxQPowerOcl);
+        pooled.buffer = cl::Buffer(context, CL_MEM_READ_WRITE, size);
     }
+
+    // Items in the wait queue hold references to their buffer arguments until their kernels complete, so the last
+    // reference is only dropped once this engine is done with the buffer. Kernels that only took the raw buffer, (like
+    // copies,) might still be in flight on the out-of-order queue, so the next user waits on a marker for all of them.
+    DeviceContextPtr devContext = device_context;
+    return BufferPtr(new cl::Buffer(pooled.buffer), [devContext, devKey, size](cl::Buffer* buffer) {
+        PooledStateBuffer toPool;
+        toPool.buffer = *buffer;
+        delete buffer;
+        devContext->queue.enqueueMarkerWithWaitList(NULL, &(toPool.marker));
+        devContext->queue.flush();
+        GetStateBufferPool()->Release(devKey, size, toPool);
+    });
 }
 
 void QEngineOCL::ReinitBuffer()
@@ -2629,6 +3422,29 @@ void QEngineOCL::ReinitBuffer()
     ResetStateBuffer(MakeStateVecBuffer(stateVec));
 }
 
+void QEngineOCL::UnshareStateBuffer(bool isOverwrite)
+{
+    if (!stateBufferShare) {
+        return;
+    }
+
+    // (If stateBuffer was replaced since it was shared, the handle is stale, and the buffer is already private.)
+    if ((stateBufferShare.use_count() > 1) && (*stateBufferShare == stateBuffer.get())) {
+        BufferPtr nStateBuffer = MakeStateVecBuffer(NULL);
+        if (!isOverwrite) {
+            // Everything already queued only reads the shared buffer, but the copy has to land before any write.
+            clFinish();
+            cl::Event copyEvent;
+            queue.enqueueCopyBuffer(
+                *stateBuffer, *nStateBuffer, 0, 0, sizeof(complex) * maxQPowerOcl, NULL, &copyEvent);
+            copyEvent.wait();
+        }
+        stateBuffer = nStateBuffer;
+    }
+
+    stateBufferShare = NULL;
+}
+
 void QEngineOCL::ClearBuffer(BufferPtr buff, bitCapIntOcl offset, bitCapIntOcl size, EventVecPtr waitVec)
 {
     PoolItemPtr poolItem = GetFreePoolItem();
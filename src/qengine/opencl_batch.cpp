@@ -0,0 +1,233 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "qengine_opencl_batch.hpp"
+
+namespace Qrack {
+
+// Qubits of copy index needed for "copies" registers, (rounding up to a power of 2)
+static bitLenInt BatchQubitCount(bitCapIntOcl copies)
+{
+    if (!copies) {
+        throw std::invalid_argument("QEngineOCLBatch needs at least one register.");
+    }
+
+    bitLenInt qubits = 0;
+    while (pow2Ocl(qubits) < copies) {
+        qubits++;
+    }
+    return qubits;
+}
+
+QEngineOCLBatch::QEngineOCLBatch(bitLenInt qubitsPerCopy, bitCapIntOcl copies, bitCapInt initState,
+    qrack_rand_gen_ptr rgp, bool useHostMem, int devID, bool useHardwareRNG)
+    : QEngine(qubitsPerCopy + BatchQubitCount(copies), rgp, false, false, useHostMem, useHardwareRNG)
+    , QEngineOCL(qubitsPerCopy + BatchQubitCount(copies), 0, rgp, ONE_CMPLX, false, false, useHostMem, devID,
+          useHardwareRNG)
+    , copyQubitCount(qubitsPerCopy)
+    , copyCount(copies)
+    , copyCapacity(pow2Ocl(BatchQubitCount(copies)))
+{
+    SetPermutation(initState);
+}
+
+void QEngineOCLBatch::CheckCopyQubit(bitLenInt qubit)
+{
+    if (qubit >= copyQubitCount) {
+        throw std::invalid_argument("QEngineOCLBatch qubit index is out of range of a register in the batch.");
+    }
+}
+
+void QEngineOCLBatch::CheckCopy(bitCapIntOcl copy)
+{
+    if (copy >= copyCount) {
+        throw std::invalid_argument("QEngineOCLBatch register index is out of range of the batch.");
+    }
+}
+
+void QEngineOCLBatch::SetPermutation(bitCapInt perm, complex phaseFac)
+{
+    if (perm >= pow2(copyQubitCount)) {
+        throw std::invalid_argument("QEngineOCLBatch permutation is out of range of a register in the batch.");
+    }
+
+    // Copy 0 is set, then spread over every copy index in equal superposition.
+    QEngineOCL::SetPermutation(perm, phaseFac);
+    for (bitLenInt i = copyQubitCount; i < qubitCount; i++) {
+        H(i);
+    }
+}
+
+void QEngineOCLBatch::ApplyEach(const complex* mtrxs, bitLenInt target)
+{
+    ApplyControlledEach(NULL, 0, target, mtrxs);
+}
+
+void QEngineOCLBatch::ApplyControlledEach(
+    const bitLenInt* controls, bitLenInt controlLen, bitLenInt target, const complex* mtrxs)
+{
+    CheckCopyQubit(target);
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        CheckCopyQubit(controls[i]);
+    }
+
+    if (!stateBuffer) {
+        return;
+    }
+
+    const bitLenInt bitCount = controlLen + 1U;
+    std::unique_ptr<bitCapIntOcl[]> qPowersSorted(new bitCapIntOcl[bitCount]);
+    bitCapIntOcl controlMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        qPowersSorted[i] = pow2Ocl(controls[i]);
+        controlMask |= qPowersSorted[i];
+    }
+    qPowersSorted[controlLen] = pow2Ocl(target);
+    std::sort(qPowersSorted.get(), qPowersSorted.get() + bitCount);
+
+    // Padding copies, past copyCount, are left as they are.
+    std::unique_ptr<complex[]> allMtrxs(new complex[4U * copyCapacity]);
+    std::copy(mtrxs, mtrxs + 4U * copyCount, allMtrxs.get());
+    for (bitCapIntOcl i = copyCount; i < copyCapacity; i++) {
+        allMtrxs[4U * i] = ONE_CMPLX;
+        allMtrxs[4U * i + 1U] = ZERO_CMPLX;
+        allMtrxs[4U * i + 2U] = ZERO_CMPLX;
+        allMtrxs[4U * i + 3U] = ONE_CMPLX;
+    }
+
+    const bitCapIntOcl maxI = maxQPowerOcl >> bitCount;
+    bitCapIntOcl bciArgs[5] = { controlMask | pow2Ocl(target), controlMask, maxI, bitCount, copyQubitCount };
+
+    // The host copies are made as the buffers are created, so nothing here waits on the device. The queue item holds
+    // the buffers until the kernel completes.
+    BufferPtr mtrxsBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(complex) * 4U * copyCapacity, allMtrxs.get());
+    BufferPtr argsBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(bitCapIntOcl) * 5U, bciArgs);
+    BufferPtr locPowersBuffer = std::make_shared<cl::Buffer>(
+        context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(bitCapIntOcl) * bitCount, qPowersSorted.get());
+
+    size_t ngc = FixWorkItemCount(maxI, nrmGroupCount);
+    size_t ngs = FixGroupSize(ngc, nrmGroupSize);
+
+    QueueCall(OCL_API_APPLY2X2_EACH, ngc, ngs, { stateBuffer, mtrxsBuffer, argsBuffer, locPowersBuffer });
+}
+
+void QEngineOCLBatch::RXEach(const real1* radians, bitLenInt target)
+{
+    std::unique_ptr<complex[]> mtrxs(new complex[4U * copyCount]);
+    for (bitCapIntOcl i = 0; i < copyCount; i++) {
+        real1 cosine = cos(radians[i] / 2.0);
+        real1 sine = sin(radians[i] / 2.0);
+        mtrxs[4U * i] = complex(cosine, ZERO_R1);
+        mtrxs[4U * i + 1U] = complex(ZERO_R1, -sine);
+        mtrxs[4U * i + 2U] = complex(ZERO_R1, -sine);
+        mtrxs[4U * i + 3U] = complex(cosine, ZERO_R1);
+    }
+    ApplyEach(mtrxs.get(), target);
+}
+
+void QEngineOCLBatch::RYEach(const real1* radians, bitLenInt target)
+{
+    std::unique_ptr<complex[]> mtrxs(new complex[4U * copyCount]);
+    for (bitCapIntOcl i = 0; i < copyCount; i++) {
+        real1 cosine = cos(radians[i] / 2.0);
+        real1 sine = sin(radians[i] / 2.0);
+        mtrxs[4U * i] = complex(cosine, ZERO_R1);
+        mtrxs[4U * i + 1U] = complex(-sine, ZERO_R1);
+        mtrxs[4U * i + 2U] = complex(sine, ZERO_R1);
+        mtrxs[4U * i + 3U] = complex(cosine, ZERO_R1);
+    }
+    ApplyEach(mtrxs.get(), target);
+}
+
+void QEngineOCLBatch::RZEach(const real1* radians, bitLenInt target)
+{
+    std::unique_ptr<complex[]> mtrxs(new complex[4U * copyCount]);
+    for (bitCapIntOcl i = 0; i < copyCount; i++) {
+        real1 cosine = cos(radians[i] / 2.0);
+        real1 sine = sin(radians[i] / 2.0);
+        mtrxs[4U * i] = complex(cosine, -sine);
+        mtrxs[4U * i + 1U] = ZERO_CMPLX;
+        mtrxs[4U * i + 2U] = ZERO_CMPLX;
+        mtrxs[4U * i + 3U] = complex(cosine, sine);
+    }
+    ApplyEach(mtrxs.get(), target);
+}
+
+void QEngineOCLBatch::ProbEach(bitLenInt qubit, real1* probs)
+{
+    CheckCopyQubit(qubit);
+
+    // One reduction gives the |0> and |1> weight of "qubit" in every copy, (in the low bit of each index).
+    std::unique_ptr<real1[]> weights(new real1[2U * copyCapacity]);
+    ProbMaskAll(pow2Ocl(qubit) | ((copyCapacity - ONE_BCI) << copyQubitCount), weights.get());
+
+    for (bitCapIntOcl i = 0; i < copyCount; i++) {
+        real1 copyNorm = weights[2U * i] + weights[2U * i + 1U];
+        probs[i] = (copyNorm > ZERO_R1) ? (weights[2U * i + 1U] / copyNorm) : ZERO_R1;
+    }
+}
+
+void QEngineOCLBatch::MEach(bitLenInt qubit, bool* results)
+{
+    std::unique_ptr<real1[]> probs(new real1[copyCount]);
+    ProbEach(qubit, probs.get());
+
+    std::unique_ptr<real1[]> rands(new real1[copyCount]);
+    FillRand(rands.get(), copyCount);
+
+    // Each copy is projected on its own outcome, and renormalized to its own share of the batch.
+    std::unique_ptr<complex[]> mtrxs(new complex[4U * copyCount]);
+    for (bitCapIntOcl i = 0; i < copyCount; i++) {
+        results[i] = (rands[i] < probs[i]);
+        real1 prob = results[i] ? probs[i] : (ONE_R1 - probs[i]);
+        complex nrm = (prob > ZERO_R1) ? complex(ONE_R1 / (real1)sqrt(prob), ZERO_R1) : ZERO_CMPLX;
+        mtrxs[4U * i] = results[i] ? ZERO_CMPLX : nrm;
+        mtrxs[4U * i + 1U] = ZERO_CMPLX;
+        mtrxs[4U * i + 2U] = ZERO_CMPLX;
+        mtrxs[4U * i + 3U] = results[i] ? nrm : ZERO_CMPLX;
+    }
+    ApplyEach(mtrxs.get(), qubit);
+}
+
+void QEngineOCLBatch::GetCopyState(bitCapIntOcl copy, complex* outputState)
+{
+    CheckCopy(copy);
+
+    const bitCapIntOcl copyPower = pow2Ocl(copyQubitCount);
+    GetAmplitudePage(outputState, copy * copyPower, copyPower);
+
+    const real1 nrm = (real1)sqrt((real1)copyCapacity);
+    for (bitCapIntOcl i = 0; i < copyPower; i++) {
+        outputState[i] *= nrm;
+    }
+}
+
+void QEngineOCLBatch::SetCopyState(bitCapIntOcl copy, const complex* inputState)
+{
+    CheckCopy(copy);
+
+    const bitCapIntOcl copyPower = pow2Ocl(copyQubitCount);
+    const real1 nrm = ONE_R1 / (real1)sqrt((real1)copyCapacity);
+    std::unique_ptr<complex[]> page(new complex[copyPower]);
+    for (bitCapIntOcl i = 0; i < copyPower; i++) {
+        page[i] = inputState[i] * nrm;
+    }
+
+    SetAmplitudePage(page.get(), copy * copyPower, copyPower);
+}
+} // namespace Qrack
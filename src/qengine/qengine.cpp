@@ -190,7 +190,7 @@ void QEngine::ApplyControlledSingleBit(
         !(((norm(mtrx[1]) == 0) && (norm(mtrx[2]) == 0)) || ((norm(mtrx[0]) == 0) && (norm(mtrx[3]) == 0)));
 
     ApplyControlled2x2(controls, controlLen, target, mtrx);
-    if (doCalcNorm) {
+    if (doCalcNorm && !IsRunningNormTracked()) {
         UpdateRunningNorm();
     }
 }
@@ -211,7 +211,7 @@ void QEngine::ApplyAntiControlledSingleBit(
         !(((norm(mtrx[1]) == 0) && (norm(mtrx[2]) == 0)) || ((norm(mtrx[0]) == 0) && (norm(mtrx[3]) == 0)));
 
     ApplyAntiControlled2x2(controls, controlLen, target, mtrx);
-    if (doCalcNorm) {
+    if (doCalcNorm && !IsRunningNormTracked()) {
         UpdateRunningNorm();
     }
 }
@@ -662,4 +662,19 @@ void QEngine::DECBCDC(bitCapInt toSub, bitLenInt inOutStart, bitLenInt length, b
     INCDECBCDC(invToSub, inOutStart, length, carryIndex);
 }
 
+void QEngine::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    writer.WriteAmplitudes(qubitCount, [this](complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+        GetAmplitudePage(pagePtr, offset, length);
+    });
+}
+
+void QEngine::ReadCheckpoint(QCheckpointReader& reader)
+{
+    reader.ReadAmplitudes(
+        qubitCount, [this](const complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+            SetAmplitudePage(pagePtr, offset, length);
+        });
+}
+
 } // namespace Qrack
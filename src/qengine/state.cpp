@@ -11,8 +11,10 @@
 // for details.
 
 #include <chrono>
+#include <string>
 #include <thread>
 
+#include "common/qprofiler.hpp"
 #include "qengine_cpu.hpp"
 
 #if ENABLE_COMPLEX_X2
@@ -25,6 +27,11 @@
 #endif
 #endif
 
+// Longest run of amplitudes, (as a power of 2,) that one wide SIMD kernel call covers
+#define WIDE_SIMD_RUN_POW 6U
+// Fewest whole registers per thread, for transforms of each register to be dealt out to threads whole
+#define REGISTER_PAR_ITEMS_PER_THREAD 4U
+
 #define CHECK_ZERO_SKIP()                                                                                              \
     if (!stateVec) {                                                                                                   \
         return;                                                                                                        \
@@ -47,6 +54,18 @@ QEngineCPU::QEngineCPU(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_
     real1 norm_thresh, std::vector<int> devList, bitLenInt qubitThreshold)
     : QEngine(qBitCount, rgp, doNorm, randomGlobalPhase, true, useHardwareRNG, norm_thresh)
     , isSparse(useSparseStateVec)
+    , isSparseSwitching(false)
+    , isSparseDue(false)
+    , denseFill(ONE_R1 / 4)
+    , sparseFill(ONE_R1 / 64)
+    , isMapped(false)
+    , storagePrecision(STORAGE_NATIVE)
+    , isFusing(false)
+    , isLazyNorm(false)
+    , numaNode(deviceID)
+    , fusedMask(0)
+    , fusedDiagonalMask(0)
+    , tileQubits(getenv("QRACK_CPU_TILE_QB") ? (bitLenInt)std::stoi(getenv("QRACK_CPU_TILE_QB")) : QRACK_CPU_TILE_QB)
 {
     SetConcurrency(std::thread::hardware_concurrency());
 
@@ -83,6 +102,11 @@ void QEngineCPU::SetAmplitude(bitCapInt perm, complex amp)
         Finish();
     }
 
+    if (!stateVec) {
+        ResetStateVec(AllocStateVec(maxQPower));
+        stateVec->clear();
+    }
+
     runningNorm -= norm(stateVec->read(perm));
     runningNorm += norm(amp);
 
@@ -91,11 +115,7 @@ void QEngineCPU::SetAmplitude(bitCapInt perm, complex amp)
         return;
     }
 
-    if (!stateVec) {
-        ResetStateVec(AllocStateVec(maxQPower));
-        stateVec->clear();
-    }
-
+    UnshareStateVec();
     stateVec->write(perm, amp);
 }
 
@@ -103,10 +123,17 @@ void QEngineCPU::SetPermutation(bitCapInt perm, complex phaseFac)
 {
     Dump();
 
+    if (isSparseSwitching && !isSparse) {
+        // A permutation is as sparse as a state gets.
+        isSparse = true;
+        ResetStateVec(AllocStateVec(maxQPower));
+    }
+
     if (!stateVec) {
         ResetStateVec(AllocStateVec(maxQPower));
     }
 
+    UnshareStateVec(true);
     stateVec->clear();
 
     if (phaseFac == complex(-999.0, -999.0)) {
@@ -135,9 +162,13 @@ void QEngineCPU::SetQuantumState(const complex* inputState)
         ResetStateVec(AllocStateVec(maxQPower));
     }
 
+    UnshareStateVec(true);
     stateVec->copy_in(inputState);
     runningNorm = ONE_R1;
 
+    if (isSparseSwitching && !isSparse && IsSparseEnough()) {
+        ConvertStateVec(true);
+    }
     UpdateRunningNorm();
 }
 
@@ -175,6 +206,257 @@ void QEngineCPU::GetProbs(real1* outputProbs)
     stateVec->get_probs(outputProbs);
 }
 
+/// Lock a view of the state vector array, (or of a copy, if the state vector is sparse or narrow)
+QStateViewPtr QEngineCPU::LockStateView(bool isWritable)
+{
+    StateVectorArrayPtr arrayVec = std::dynamic_pointer_cast<StateVectorArray>(stateVec);
+    if (!arrayVec) {
+        return QInterface::LockStateView(isWritable);
+    }
+
+    if (doNormalize) {
+        NormalizeState();
+    } else {
+        Finish();
+    }
+
+    if (!isWritable) {
+        return QStateViewPtr(new QStateView(arrayVec->amplitudes, (bitCapIntOcl)maxQPower, false, [] {}));
+    }
+
+    UnshareStateVec();
+    arrayVec = std::dynamic_pointer_cast<StateVectorArray>(stateVec);
+
+    return QStateViewPtr(
+        new QStateView(arrayVec->amplitudes, (bitCapIntOcl)maxQPower, true, [this] { UpdateRunningNorm(); }));
+}
+
+/// True if "mtrx" is diagonal or anti-diagonal, (which QEngine::ApplyControlledSingleBit() treats as norm-preserving)
+static inline bool IsPhaseOrInvert(const complex* mtrx)
+{
+    return ((norm(mtrx[1]) == ZERO_R1) && (norm(mtrx[2]) == ZERO_R1)) ||
+        ((norm(mtrx[0]) == ZERO_R1) && (norm(mtrx[3]) == ZERO_R1));
+}
+
+/// True if "mtrx" is diagonal, with unit modulus entries, (so that it changes neither probabilities nor the norm)
+static inline bool IsUnitDiagonal(const complex* mtrx)
+{
+    return (norm(mtrx[1]) == ZERO_R1) && (norm(mtrx[2]) == ZERO_R1) &&
+        (std::abs(norm(mtrx[0]) - ONE_R1) <= REAL1_EPSILON) && (std::abs(norm(mtrx[3]) - ONE_R1) <= REAL1_EPSILON);
+}
+
+void QEngineCPU::ApplySingleBit(const complex* mtrx, bitLenInt qubit)
+{
+    if (!isFusing) {
+        QEngine::ApplySingleBit(mtrx, qubit);
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    bitCapInt qPower = pow2(qubit);
+    if (!(fusedMask & qPower) && IsUnitDiagonal(mtrx)) {
+        // Without a pending matrix to fold into, a phase gate joins the diagonal terms, (by way of Apply2x2()).
+        QEngine::ApplySingleBit(mtrx, qubit);
+        return;
+    }
+
+    // Pending diagonal terms on this qubit act before this gate.
+    if (fusedDiagonalMask & qPower) {
+        FlushFusedDiagonal();
+    }
+
+    if (fusedMtrxs.size() < (4U * qubitCount)) {
+        fusedMtrxs.resize(4U * qubitCount);
+    }
+
+    complex* fusedMtrx = &(fusedMtrxs[4U * qubit]);
+    if (fusedMask & qPower) {
+        // The new gate acts after the pending one, so it multiplies from the left.
+        complex left[4];
+        complex right[4];
+        std::copy(mtrx, mtrx + 4, left);
+        std::copy(fusedMtrx, fusedMtrx + 4, right);
+        mul2x2(left, right, fusedMtrx);
+    } else {
+        std::copy(mtrx, mtrx + 4, fusedMtrx);
+        fusedMask |= qPower;
+    }
+}
+
+void QEngineCPU::FlushFusedGates(bitCapInt mask)
+{
+    // Diagonal terms are only ever pending on qubits without pending matrices, so the two commute. (Matrices go first,
+    // since a pending matrix that has multiplied out diagonal becomes a diagonal term as it is flushed.)
+    FlushFusedMatrices(mask);
+    if (mask & fusedDiagonalMask) {
+        FlushFusedDiagonal();
+    }
+}
+
+void QEngineCPU::FlushFusedMatrices(bitCapInt mask)
+{
+    bitCapInt toFlush = fusedMask & mask;
+    if (!toFlush) {
+        return;
+    }
+
+    // Clear the flushed bits first, so that the Apply2x2() calls below don't try to flush them again.
+    fusedMask ^= toFlush;
+
+    // Matrices on distinct qubits commute, so those below the tile width can all be applied in one tiled sweep.
+    UpdateSparsity();
+    const bitCapInt lowMask = toFlush & (pow2(tileQubits) - ONE_BCI);
+    if (stateVec && !isSparse && (qubitCount > tileQubits) && (lowMask & (lowMask - ONE_BCI))) {
+        std::vector<bitLenInt> qubits;
+        std::vector<complex> mtrxs;
+        for (bitLenInt i = 0; i < tileQubits; i++) {
+            if ((lowMask >> (bitCapIntOcl)i) & ONE_BCI) {
+                qubits.push_back(i);
+                mtrxs.insert(mtrxs.end(), fusedMtrxs.begin() + 4U * i, fusedMtrxs.begin() + 4U * (i + 1U));
+            }
+        }
+        ApplyTiled2x2(qubits, mtrxs);
+        toFlush ^= lowMask;
+    }
+
+    for (bitLenInt i = 0; toFlush; i++) {
+        bitCapInt qPower = pow2(i);
+        if (toFlush & qPower) {
+            toFlush ^= qPower;
+            QEngine::ApplySingleBit(&(fusedMtrxs[4U * i]), i);
+        }
+    }
+}
+
+void QEngineCPU::ApplyTiled2x2(const std::vector<bitLenInt>& qubits, const std::vector<complex>& mtrxs)
+{
+    // As Apply2x2() would for each gate in turn: rescale by any pending norm, and floor and renormalize, if need be
+    bool isNormChanged = false;
+    for (size_t i = 0; i < mtrxs.size(); i += 4U) {
+        isNormChanged |= !IsPhaseOrInvert(&(mtrxs[i]));
+    }
+
+    Dispatch([this, qubits, mtrxs, isNormChanged] {
+        QProfileScope profileScope(PROFILE_APPLY_2X2);
+        // (Gates queued ahead of this one can change the pending norm, so it's read here, in order.)
+        const bool doCalcNorm = doNormalize && (isNormChanged || (runningNorm != ONE_R1));
+        const real1 nrm = (doCalcNorm && (runningNorm > ZERO_R1)) ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
+        const bitCapIntOcl tileSize = pow2Ocl(tileQubits);
+        const int numCores = GetConcurrencyLevel();
+        std::unique_ptr<complex[]> tiles(new complex[tileSize * numCores]);
+        std::unique_ptr<real1[]> rngNrm(new real1[numCores]());
+
+        par_for(0, maxQPower >> (bitCapIntOcl)tileQubits, [&](const bitCapInt lcv, const int cpu) {
+            complex* tile = tiles.get() + tileSize * cpu;
+            const bitCapIntOcl offset = (bitCapIntOcl)lcv << (bitCapIntOcl)tileQubits;
+            for (bitCapIntOcl i = 0; i < tileSize; i++) {
+                tile[i] = nrm * stateVec->read(offset + i);
+            }
+
+            for (size_t j = 0; j < qubits.size(); j++) {
+                const complex* mtrx = &(mtrxs[4U * j]);
+                const bitCapIntOcl qPower = pow2Ocl(qubits[j]);
+                for (bitCapIntOcl i = 0; i < tileSize; i++) {
+                    if (i & qPower) {
+                        continue;
+                    }
+                    const complex amp0 = tile[i];
+                    const complex amp1 = tile[i | qPower];
+                    tile[i] = mtrx[0] * amp0 + mtrx[1] * amp1;
+                    tile[i | qPower] = mtrx[2] * amp0 + mtrx[3] * amp1;
+                }
+            }
+
+            for (bitCapIntOcl i = 0; i < tileSize; i++) {
+                if (doCalcNorm) {
+                    const real1 dotMulRes = norm(tile[i]);
+                    if (dotMulRes < amplitudeFloor) {
+                        tile[i] = ZERO_CMPLX;
+                    } else {
+                        rngNrm[cpu] += dotMulRes;
+                    }
+                }
+                stateVec->write(offset + i, tile[i]);
+            }
+        });
+
+        if (doCalcNorm) {
+            runningNorm = ZERO_R1;
+            for (int i = 0; i < numCores; i++) {
+                runningNorm += rngNrm[i];
+            }
+        }
+    });
+}
+
+void QEngineCPU::FuseDiagonal(const bitCapInt& mask, const bitCapInt& perm, const bitCapInt& parityMask,
+    const complex& phase0, const complex& phase1)
+{
+    if ((phase0 == ONE_CMPLX) && (phase1 == ONE_CMPLX)) {
+        return;
+    }
+
+    for (size_t i = 0; i < fusedDiagonal.size(); i++) {
+        DiagonalTerm& term = fusedDiagonal[i];
+        if ((term.mask == mask) && (term.perm == perm) && (term.parityMask == parityMask)) {
+            term.phases[0] *= phase0;
+            term.phases[1] *= phase1;
+            return;
+        }
+    }
+
+    if (fusedDiagonal.size() >= QRACK_FUSED_DIAGONAL_TERMS) {
+        FlushFusedDiagonal();
+    }
+
+    fusedDiagonal.push_back(DiagonalTerm{ mask, perm, parityMask, { phase0, phase1 } });
+    fusedDiagonalMask |= mask | parityMask;
+}
+
+void QEngineCPU::FlushFusedDiagonal()
+{
+    if (!fusedDiagonal.size()) {
+        return;
+    }
+
+    std::vector<DiagonalTerm>* terms = new std::vector<DiagonalTerm>();
+    terms->swap(fusedDiagonal);
+    fusedDiagonalMask = 0;
+
+    Dispatch([this, terms] {
+        auto fn = [&](const bitCapInt lcv, const int cpu) {
+            complex phase = ONE_CMPLX;
+            for (size_t i = 0; i < terms->size(); i++) {
+                const DiagonalTerm& term = (*terms)[i];
+                if ((lcv & term.mask) != term.perm) {
+                    continue;
+                }
+                bool isOdd = false;
+                for (bitCapInt v = lcv & term.parityMask; v; v &= v - ONE_BCI) {
+                    isOdd = !isOdd;
+                }
+                phase *= term.phases[isOdd ? 1U : 0U];
+            }
+            stateVec->write(lcv, phase * stateVec->read(lcv));
+        };
+
+        if (stateVec->is_sparse()) {
+            par_for_set(CastStateVecSparse()->iterable(), fn);
+        } else {
+            par_for(0, maxQPower, fn);
+        }
+
+        delete terms;
+    });
+}
+
+static inline real1 FlooredNorm(const complex& c, const real1& norm_thresh)
+{
+    real1 nrm = norm(c);
+    return (nrm < norm_thresh) ? ZERO_R1 : nrm;
+}
+
 /**
  * Apply a 2x2 matrix to the state vector
  *
@@ -195,25 +477,78 @@ union ComplexUnion {
     }
 };
 
+template <typename Fn>
+void QEngineCPU::Apply2x2Pairs(const bitCapInt& offset1, const bitCapInt& offset2, const bitCapInt* qPowersSorted,
+    const bitLenInt& bitCount, Fn&& fn)
+{
+    if (!stateVec->is_sparse()) {
+        par_for_mask(0, maxQPower, qPowersSorted, bitCount, fn);
+        return;
+    }
+
+    bitCapInt setMask = offset1 ^ offset2;
+    bitCapInt filterMask = 0;
+    for (bitLenInt i = 0; i < bitCount; i++) {
+        filterMask |= (qPowersSorted[i] & ~setMask);
+    }
+    bitCapInt filterValues = filterMask & offset1 & offset2;
+    par_for_set(CastStateVecSparse()->iterable(setMask, filterMask, filterValues), fn);
+}
+
 void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* matrix, const bitLenInt bitCount,
     const bitCapInt* qPowsSorted, bool doCalcNorm, real1 nrm_thresh)
 {
     CHECK_ZERO_SKIP();
 
+    // A phase-only gate is buffered, (unless this pass would also have to renormalize, which depends on the gates queued
+    // ahead of it).
+    const bool isFusable = isFusing && IsUnitDiagonal(matrix);
+    if (isFusable && doNormalize) {
+        Finish();
+    }
+    if (isFusable && !(doNormalize && (runningNorm != ONE_R1))) {
+        bitCapInt qMask = 0;
+        for (bitLenInt i = 0; i < bitCount; i++) {
+            qMask |= qPowsSorted[i];
+        }
+        // Pending matrices on these qubits act first.
+        FlushFusedMatrices(qMask);
+
+        const bitCapInt targetMask = offset1 ^ offset2;
+        if (!(targetMask & (targetMask - ONE_BCI))) {
+            const bool isSwapped = (offset1 & targetMask) != 0;
+            FuseDiagonal(qMask & ~targetMask, offset1 & ~targetMask, targetMask, isSwapped ? matrix[3] : matrix[0],
+                isSwapped ? matrix[0] : matrix[3]);
+        } else {
+            FuseDiagonal(qMask, offset1, 0, matrix[0], matrix[0]);
+            FuseDiagonal(qMask, offset2, 0, matrix[3], matrix[3]);
+        }
+        return;
+    }
+
     complex* mtrx = new complex[4];
     std::copy(matrix, matrix + 4, mtrx);
 
     bitCapInt* qPowersSorted = new bitCapInt[bitCount];
     std::copy(qPowsSorted, qPowsSorted + bitCount, qPowersSorted);
 
-    doCalcNorm = (doCalcNorm || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
-
-    if (doCalcNorm) {
-        runningNorm = ONE_R1;
+    // Pending fused gates on any other qubits commute with this operation, so we only flush the qubits it touches.
+    bitCapInt touchedMask = 0;
+    for (bitLenInt i = 0; i < bitCount; i++) {
+        touchedMask |= qPowersSorted[i];
     }
+    FlushFusedGates(touchedMask);
+
+    const bool isNormCalcAsked = doCalcNorm;
 
-    Dispatch([this, mtrx, qPowersSorted, offset1, offset2, bitCount, doCalcNorm, nrm_thresh] {
-        real1 nrm = doNormalize ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
+    // A controlled gate only touches part of the state vector, so it can only add its change in norm.
+    bool doTrackNorm = IsRunningNormTracked() && (bitCount > 1) && !IsPhaseOrInvert(mtrx);
+
+    Dispatch([this, mtrx, qPowersSorted, offset1, offset2, bitCount, isNormCalcAsked, doTrackNorm, nrm_thresh] {
+        QProfileScope profileScope(PROFILE_APPLY_2X2);
+        // (Gates queued ahead of this one can change the pending norm, so it's read here, in order.)
+        const bool doCalcNorm = (isNormCalcAsked || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
+        real1 nrm = (doCalcNorm && (runningNorm > ZERO_R1)) ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
         real1 norm_thresh = (nrm_thresh < ZERO_R1) ? amplitudeFloor : nrm_thresh;
         int numCores = GetConcurrencyLevel();
 
@@ -221,12 +556,11 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         ComplexUnion mtrxCol2(mtrx[1], mtrx[3]);
 
         real1* rngNrm = NULL;
-        ParallelFunc fn;
         if (doCalcNorm) {
             rngNrm = new real1[numCores]();
             if (nrm != ONE_R1) {
                 if (norm_thresh > ZERO_R1) {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
 
                         qubit.cmplx2 = matrixMul(nrm, mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
@@ -252,8 +586,9 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
                         stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
 #endif
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 } else {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
 
                         qubit.cmplx2 = matrixMul(nrm, mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
@@ -267,10 +602,11 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
                         stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
 #endif
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 }
             } else {
                 if (norm_thresh > ZERO_R1) {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
 
                         qubit.cmplx2 = matrixMul(mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
@@ -296,8 +632,9 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
                         stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
 #endif
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 } else {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
 
                         qubit.cmplx2 = matrixMul(mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
@@ -311,10 +648,11 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
                         stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
 #endif
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 }
             }
         } else {
-            fn = [&](const bitCapInt& lcv, const int& cpu) {
+            auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                 ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
 
                 qubit.cmplx2 = matrixMul(mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
@@ -325,29 +663,32 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
                 stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
 #endif
             };
-        }
 
-        if (stateVec->is_sparse()) {
-            bitCapInt setMask = offset1 ^ offset2;
-            bitCapInt filterMask = 0;
-            for (bitLenInt i = 0; i < bitCount; i++) {
-                filterMask |= (qPowersSorted[i] & ~setMask);
+            if (doTrackNorm) {
+                rngNrm = new real1[numCores]();
+                Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, [&](const bitCapInt& lcv, const int& cpu) {
+                    real1 before = FlooredNorm(stateVec->read(lcv + offset1), norm_thresh) +
+                        FlooredNorm(stateVec->read(lcv + offset2), norm_thresh);
+                    fn(lcv, cpu);
+                    rngNrm[cpu] += FlooredNorm(stateVec->read(lcv + offset1), norm_thresh) +
+                        FlooredNorm(stateVec->read(lcv + offset2), norm_thresh) - before;
+                });
+            } else if (!stateVec->is_sparse() && IsWideSimdRun(qPowersSorted[0])) {
+                Apply2x2Runs(offset1, offset2, mtrx, bitCount, qPowersSorted);
+            } else {
+                Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
             }
-            bitCapInt filterValues = filterMask & offset1 & offset2;
-            par_for_set(CastStateVecSparse()->iterable(setMask, filterMask, filterValues), fn);
-        } else {
-            par_for_mask(0, maxQPower, qPowersSorted, bitCount, fn);
         }
 
         delete[] mtrx;
         delete[] qPowersSorted;
 
-        if (doCalcNorm) {
+        if (doCalcNorm || doTrackNorm) {
             real1 rNrm = ZERO_R1;
             for (int i = 0; i < numCores; i++) {
                 rNrm += rngNrm[i];
             }
-            runningNorm = rNrm;
+            runningNorm = doCalcNorm ? rNrm : (runningNorm + rNrm);
             delete[] rngNrm;
         }
     });
@@ -364,25 +705,33 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
     bitCapInt* qPowersSorted = new bitCapInt[bitCount];
     std::copy(qPowsSorted, qPowsSorted + bitCount, qPowersSorted);
 
-    doCalcNorm = (doCalcNorm || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
-
-    if (doCalcNorm) {
-        runningNorm = ONE_R1;
+    // Pending fused gates on any other qubits commute with this operation, so we only flush the qubits it touches.
+    bitCapInt touchedMask = 0;
+    for (bitLenInt i = 0; i < bitCount; i++) {
+        touchedMask |= qPowersSorted[i];
     }
+    FlushFusedGates(touchedMask);
+
+    const bool isNormCalcAsked = doCalcNorm;
+
+    // A controlled gate only touches part of the state vector, so it can only add its change in norm.
+    bool doTrackNorm = IsRunningNormTracked() && (bitCount > 1) && !IsPhaseOrInvert(mtrx);
 
-    Dispatch([this, mtrx, qPowersSorted, offset1, offset2, bitCount, doCalcNorm, nrm_thresh] {
-        real1 nrm = doNormalize ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
+    Dispatch([this, mtrx, qPowersSorted, offset1, offset2, bitCount, isNormCalcAsked, doTrackNorm, nrm_thresh] {
+        QProfileScope profileScope(PROFILE_APPLY_2X2);
+        // (Gates queued ahead of this one can change the pending norm, so it's read here, in order.)
+        const bool doCalcNorm = (isNormCalcAsked || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
+        real1 nrm = (doCalcNorm && (runningNorm > ZERO_R1)) ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
         real1 norm_thresh = (nrm_thresh < ZERO_R1) ? amplitudeFloor : nrm_thresh;
         int numCores = GetConcurrencyLevel();
 
         real1* rngNrm = NULL;
-        ParallelFunc fn;
         if (doCalcNorm) {
             rngNrm = new real1[numCores]();
 
             if (nrm != ONE_R1) {
                 if (norm_thresh > ZERO_R1) {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         complex qubit[2];
 
                         complex Y0 = stateVec->read(lcv + offset1);
@@ -407,8 +756,9 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
 
                         stateVec->write2(lcv + offset1, qubit[0], lcv + offset2, qubit[1]);
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 } else {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         complex qubit[2];
 
                         complex Y0 = stateVec->read(lcv + offset1);
@@ -421,10 +771,11 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
 
                         stateVec->write2(lcv + offset1, qubit[0], lcv + offset2, qubit[1]);
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 }
             } else {
                 if (norm_thresh > ZERO_R1) {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         complex qubit[2];
 
                         complex Y0 = stateVec->read(lcv + offset1);
@@ -449,8 +800,9 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
 
                         stateVec->write2(lcv + offset1, qubit[0], lcv + offset2, qubit[1]);
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 } else {
-                    fn = [&](const bitCapInt& lcv, const int& cpu) {
+                    auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                         complex qubit[2];
 
                         complex Y0 = stateVec->read(lcv + offset1);
@@ -463,10 +815,11 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
 
                         stateVec->write2(lcv + offset1, qubit[0], lcv + offset2, qubit[1]);
                     };
+                    Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
                 }
             }
         } else {
-            fn = [&](const bitCapInt& lcv, const int& cpu) {
+            auto fn = [&](const bitCapInt& lcv, const int& cpu) {
                 complex qubit[2];
 
                 complex Y0 = stateVec->read(lcv + offset1);
@@ -477,22 +830,225 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
 
                 stateVec->write2(lcv + offset1, qubit[0], lcv + offset2, qubit[1]);
             };
+
+            if (doTrackNorm) {
+                rngNrm = new real1[numCores]();
+                Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, [&](const bitCapInt& lcv, const int& cpu) {
+                    real1 before = FlooredNorm(stateVec->read(lcv + offset1), norm_thresh) +
+                        FlooredNorm(stateVec->read(lcv + offset2), norm_thresh);
+                    fn(lcv, cpu);
+                    rngNrm[cpu] += FlooredNorm(stateVec->read(lcv + offset1), norm_thresh) +
+                        FlooredNorm(stateVec->read(lcv + offset2), norm_thresh) - before;
+                });
+            } else if (!stateVec->is_sparse() && IsWideSimdRun(qPowersSorted[0])) {
+                Apply2x2Runs(offset1, offset2, mtrx, bitCount, qPowersSorted);
+            } else {
+                Apply2x2Pairs(offset1, offset2, qPowersSorted, bitCount, fn);
+            }
         }
 
-        if (stateVec->is_sparse()) {
-            bitCapInt setMask = offset1 ^ offset2;
-            bitCapInt filterMask = 0;
-            for (bitLenInt i = 0; i < bitCount; i++) {
-                filterMask |= (qPowersSorted[i] & ~setMask);
+        delete[] mtrx;
+        delete[] qPowersSorted;
+
+        if (doCalcNorm || doTrackNorm) {
+            real1 rNrm = ZERO_R1;
+            for (int i = 0; i < numCores; i++) {
+                rNrm += rngNrm[i];
             }
-            bitCapInt filterValues = filterMask & offset1 & offset2;
-            par_for_set(CastStateVecSparse()->iterable(setMask, filterMask, filterValues), fn);
-        } else {
-            par_for_mask(0, maxQPower, qPowersSorted, bitCount, fn);
+            runningNorm = doCalcNorm ? rNrm : (runningNorm + rNrm);
+            delete[] rngNrm;
+        }
+    });
+}
+#endif
+
+void QEngineCPU::Apply2x2Runs(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
+    const bitCapInt* qPowersSorted)
+{
+    // Every skipped bit is at or above the lowest skip power, so all amplitudes in a run below it are updated alike.
+    bitLenInt runPow = log2(qPowersSorted[0]);
+    if (runPow > WIDE_SIMD_RUN_POW) {
+        runPow = WIDE_SIMD_RUN_POW;
+    }
+    const bitCapIntOcl runLength = pow2Ocl(runPow);
+
+    bitCapInt* runPowersSorted = new bitCapInt[bitCount];
+    for (bitLenInt i = 0; i < bitCount; i++) {
+        runPowersSorted[i] = qPowersSorted[i] >> runPow;
+    }
+
+    complex* amplitudes = std::dynamic_pointer_cast<StateVectorArray>(stateVec)->amplitudes;
+    par_for_mask(0, maxQPower >> runPow, runPowersSorted, bitCount, [&](const bitCapInt& lcv, const int& cpu) {
+        bitCapIntOcl i = (bitCapIntOcl)(lcv << runPow);
+        Apply2x2Run(amplitudes + i + (bitCapIntOcl)offset1, amplitudes + i + (bitCapIntOcl)offset2, runLength, mtrx);
+    });
+
+    delete[] runPowersSorted;
+}
+
+/// Apply a sequence of single bit gates, with runs on qubits below tileQubits in one tiled pass
+void QEngineCPU::ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count)
+{
+    // With fusion on, the gates are buffered, (and tiled once flushed,) as usual.
+    if (isFusing) {
+        QEngine::ApplySingleBitBatch(mtrxs, qubits, count);
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    UpdateSparsity();
+    std::vector<bitLenInt> lowQubits;
+    std::vector<complex> lowMtrxs;
+    if (!isSparse && (qubitCount > tileQubits)) {
+        for (bitCapIntOcl i = 0; i < count; i++) {
+            if (qubits[i] < tileQubits) {
+                lowQubits.push_back(qubits[i]);
+                lowMtrxs.insert(lowMtrxs.end(), mtrxs + 4U * i, mtrxs + 4U * (i + 1U));
+            }
+        }
+    }
+
+    if (lowQubits.size() < 2U) {
+        QEngine::ApplySingleBitBatch(mtrxs, qubits, count);
+        return;
+    }
+
+    // Gates on distinct qubits commute, so the gates on higher qubits can go first, (each qubit's own in order).
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        if (qubits[i] >= tileQubits) {
+            ApplySingleBit(mtrxs + 4U * i, qubits[i]);
+        }
+    }
+    ApplyTiled2x2(lowQubits, lowMtrxs);
+}
+
+/**
+ * Apply a dense 2^n x 2^n matrix to n (2 to 4) target qubits, in a single pass over the state vector
+ */
+void QEngineCPU::ApplyNxN(const complex* matrix, const bitLenInt* targets, const bitLenInt& targetLen)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(matrix, targets[0]);
+        return;
+    }
+
+    if ((targetLen < 2U) || (targetLen > 4U)) {
+        throw std::invalid_argument("ApplyNxN() requires between 1 and 4 target qubits.");
+    }
+
+    CHECK_ZERO_SKIP();
+
+    const bitCapIntOcl nPower = pow2Ocl(targetLen);
+
+    complex* mtrx = new complex[nPower * nPower];
+    std::copy(matrix, matrix + (nPower * nPower), mtrx);
+
+    bitCapInt targetMask = 0;
+    bitCapInt* qPowersSorted = new bitCapInt[targetLen];
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        qPowersSorted[i] = pow2(targets[i]);
+        if (targetMask & qPowersSorted[i]) {
+            delete[] mtrx;
+            delete[] qPowersSorted;
+            throw std::invalid_argument("ApplyNxN() target qubits must be unique.");
         }
+        targetMask |= qPowersSorted[i];
+    }
+
+    // Offset of each matrix basis index into the state vector, with targets[0] as the least significant bit
+    bitCapInt* offsets = new bitCapInt[nPower]();
+    for (bitCapIntOcl j = 0; j < nPower; j++) {
+        for (bitLenInt i = 0; i < targetLen; i++) {
+            if ((j >> i) & 1U) {
+                offsets[j] |= qPowersSorted[i];
+            }
+        }
+    }
+    std::sort(qPowersSorted, qPowersSorted + targetLen);
+
+    FlushFusedGates(targetMask);
+
+    bool doCalcNorm = doNormalize;
+
+    Dispatch([this, mtrx, qPowersSorted, offsets, nPower, targetLen, doCalcNorm] {
+        real1 norm_thresh = amplitudeFloor;
+        int numCores = GetConcurrencyLevel();
+
+        real1* rngNrm = NULL;
+        if (doCalcNorm) {
+            rngNrm = new real1[numCores]();
+        }
+
+#if ENABLE_COMPLEX_X2
+        // Pack the matrix as column pairs of 2x2 blocks, so that each block multiplies 2 amplitudes at a time.
+        const bitCapIntOcl halfPower = nPower >> 1U;
+        ComplexUnion blockCols[128];
+        for (bitCapIntOcl r = 0; r < halfPower; r++) {
+            for (bitCapIntOcl c = 0; c < halfPower; c++) {
+                bitCapIntOcl row = r << 1U;
+                bitCapIntOcl col = c << 1U;
+                bitCapIntOcl b = ((r * halfPower) + c) << 1U;
+                blockCols[b] = ComplexUnion(mtrx[(row * nPower) + col], mtrx[((row + 1U) * nPower) + col]);
+                blockCols[b + 1U] =
+                    ComplexUnion(mtrx[(row * nPower) + col + 1U], mtrx[((row + 1U) * nPower) + col + 1U]);
+            }
+        }
+#endif
+
+        par_for_mask(0, maxQPower, qPowersSorted, targetLen, [&](const bitCapInt lcv, const int cpu) {
+            bitCapIntOcl j;
+#if ENABLE_COMPLEX_X2
+            ComplexUnion amps[8];
+            ComplexUnion outs[8];
+            complex out[16];
+            for (j = 0; j < halfPower; j++) {
+                amps[j] = ComplexUnion(
+                    stateVec->read(lcv | offsets[j << 1U]), stateVec->read(lcv | offsets[(j << 1U) | 1U]));
+            }
+
+            for (bitCapIntOcl r = 0; r < halfPower; r++) {
+                bitCapIntOcl b = (r * halfPower) << 1U;
+                outs[r].cmplx2 = matrixMul(blockCols[b].cmplx2, blockCols[b + 1U].cmplx2, amps[0].cmplx2);
+                for (bitCapIntOcl c = 1U; c < halfPower; c++) {
+                    b += 2U;
+                    outs[r].cmplx2 += matrixMul(blockCols[b].cmplx2, blockCols[b + 1U].cmplx2, amps[c].cmplx2);
+                }
+                out[r << 1U] = outs[r].cmplx[0];
+                out[(r << 1U) | 1U] = outs[r].cmplx[1];
+            }
+#else
+            complex amps[16];
+            complex out[16];
+            for (j = 0; j < nPower; j++) {
+                amps[j] = stateVec->read(lcv | offsets[j]);
+            }
+
+            for (bitCapIntOcl r = 0; r < nPower; r++) {
+                const complex* row = mtrx + (r * nPower);
+                out[r] = ZERO_CMPLX;
+                for (bitCapIntOcl c = 0; c < nPower; c++) {
+                    out[r] += row[c] * amps[c];
+                }
+            }
+#endif
+
+            for (j = 0; j < nPower; j++) {
+                if (doCalcNorm) {
+                    real1 nrm = norm(out[j]);
+                    if (nrm < norm_thresh) {
+                        out[j] = ZERO_CMPLX;
+                    } else {
+                        rngNrm[cpu] += nrm;
+                    }
+                }
+                stateVec->write(lcv | offsets[j], out[j]);
+            }
+        });
 
         delete[] mtrx;
         delete[] qPowersSorted;
+        delete[] offsets;
 
         if (doCalcNorm) {
             real1 rNrm = ZERO_R1;
@@ -504,7 +1060,6 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         }
     });
 }
-#endif
 
 void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
     bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
@@ -520,8 +1075,6 @@ void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const b
 
     bitCapInt targetPower = pow2(qubitIndex);
 
-    real1 nrm = ONE_R1 / std::sqrt(runningNorm);
-
     bitCapInt* qPowers = new bitCapInt[controlLen];
     for (bitLenInt i = 0; i < controlLen; i++) {
         qPowers[i] = pow2(controls[i]);
@@ -532,6 +1085,9 @@ void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const b
     std::fill(rngNrm, rngNrm + numCores, ZERO_R1);
 
     Finish();
+    UnshareStateVec();
+
+    const real1 nrm = ONE_R1 / std::sqrt(runningNorm);
 
     par_for_skip(0, maxQPower, targetPower, 1, [&](const bitCapInt lcv, const int cpu) {
         bitCapIntOcl offset = 0;
@@ -584,12 +1140,20 @@ void QEngineCPU::UniformParityRZ(const bitCapInt& mask, const real1& angle)
 {
     CHECK_ZERO_SKIP();
 
+    if (isFusing) {
+        FlushFusedMatrices(mask);
+        FuseDiagonal(0, 0, mask, complex(cos(angle), -sin(angle)), complex(cos(angle), sin(angle)));
+        return;
+    }
+
+    FlushFusedGates(mask);
+
     Dispatch([this, mask, angle] {
         real1 cosine = cos(angle);
         real1 sine = sin(angle);
         complex phaseFac(cosine, sine);
         complex phaseFacAdj(cosine, -sine);
-        ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        auto fn = [&](const bitCapInt lcv, const int cpu) {
             bitCapInt perm = lcv & mask;
             // From https://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetNaive
             // c accumulates the total bits set in v
@@ -621,6 +1185,22 @@ void QEngineCPU::CUniformParityRZ(
     std::vector<bitLenInt> controls(cControls, cControls + controlLen);
     std::sort(controls.begin(), controls.end());
 
+    bitCapInt controlMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        controlMask |= pow2(controls[i]);
+    }
+    bitCapInt touchedMask = mask | controlMask;
+
+    if (isFusing) {
+        // (Control bits don't count toward the parity.)
+        FlushFusedMatrices(touchedMask);
+        FuseDiagonal(controlMask, controlMask, mask & ~controlMask, complex(cos(angle), -sin(angle)),
+            complex(cos(angle), sin(angle)));
+        return;
+    }
+
+    FlushFusedGates(touchedMask);
+
     Dispatch([this, controls, mask, angle] {
         bitCapInt controlMask = 0;
         bitCapInt* controlPowers = new bitCapInt[controls.size()];
@@ -634,7 +1214,7 @@ void QEngineCPU::CUniformParityRZ(
         complex phaseFac(cosine, sine);
         complex phaseFacAdj(cosine, -sine);
 
-        ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        auto fn = [&](const bitCapInt lcv, const int cpu) {
             bitCapInt perm = lcv & mask;
             // From https://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetNaive
             // c accumulates the total bits set in v
@@ -652,6 +1232,184 @@ void QEngineCPU::CUniformParityRZ(
     });
 }
 
+bool QEngineCPU::IsRegisterParallel(const bitCapIntOcl& outerCount, const bitCapIntOcl& weight)
+{
+    bitCapIntOcl stride;
+    int32_t threads;
+    GetGrain((bitCapInt)outerCount * weight, PAR_KERNEL_FOR, stride, threads);
+
+    // With only a register or two per thread, the last round would leave most threads idle.
+    return (threads <= 1) || (outerCount >= (REGISTER_PAR_ITEMS_PER_THREAD * (bitCapIntOcl)threads));
+}
+
+void QEngineCPU::QFT(bitLenInt start, bitLenInt length, bool trySeparate) { RegisterFourier(start, length, false); }
+
+void QEngineCPU::IQFT(bitLenInt start, bitLenInt length, bool trySeparate) { RegisterFourier(start, length, true); }
+
+void QEngineCPU::RegisterFourier(bitLenInt start, bitLenInt length, bool inverse)
+{
+    if (!length) {
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    FlushFusedGates(bitRegMask(start, length));
+
+    Dispatch([this, start, length, inverse] {
+        const bitCapIntOcl regPower = pow2Ocl(length);
+        const bitCapIntOcl halfPower = regPower >> ONE_BCI;
+        const bitCapIntOcl outerCount = (bitCapIntOcl)(maxQPower >> length);
+
+        // QFT() leaves the register in bit-reversed order, as a decimation-in-frequency transform does, with the
+        // twiddle factor exp(-2 * pi * i * k / 2^length) for "k," (as the controlled phase gates of QInterface::QFT()
+        // give,) and IQFT() is its inverse, by decimation in time with the conjugate twiddle factors.
+        std::unique_ptr<complex[]> twiddles(new complex[halfPower]);
+        for (bitCapIntOcl k = 0; k < halfPower; k++) {
+            const double angle = (inverse ? 2 : -2) * M_PI * k / regPower;
+            twiddles[k] = complex((real1)cos(angle), (real1)sin(angle));
+        }
+
+        // Each transform costs about regPower * length par_for() items.
+        const bitCapIntOcl weight = regPower * length;
+        if (IsRegisterParallel(outerCount, weight)) {
+            const real1 nrm = (real1)(ONE_R1 / sqrt((real1)regPower));
+            const bitCapInt lowMask = pow2Mask(start);
+            std::vector<std::unique_ptr<complex[]>> buffers(GetConcurrencyLevel());
+            for (auto&& buffer : buffers) {
+                buffer.reset(new complex[regPower]);
+            }
+
+            par_for_weighted(0, outerCount, weight, [&](const bitCapInt lcv, const int cpu) {
+                const bitCapInt base = (lcv & lowMask) | ((lcv & ~lowMask) << length);
+                complex* amps = buffers[cpu].get();
+                bitCapIntOcl j, k, b, h, stride;
+                for (j = 0; j < regPower; j++) {
+                    amps[j] = stateVec->read(base | ((bitCapInt)j << start));
+                }
+
+                if (!inverse) {
+                    for (h = halfPower, stride = 1U; h; h >>= ONE_BCI, stride <<= ONE_BCI) {
+                        for (b = 0; b < regPower; b += (h << ONE_BCI)) {
+                            for (k = 0; k < h; k++) {
+                                const complex y0 = amps[b + k];
+                                const complex y1 = amps[b + k + h];
+                                amps[b + k] = y0 + y1;
+                                amps[b + k + h] = (y0 - y1) * twiddles[k * stride];
+                            }
+                        }
+                    }
+                } else {
+                    for (h = 1U, stride = halfPower; h < regPower; h <<= ONE_BCI, stride >>= ONE_BCI) {
+                        for (b = 0; b < regPower; b += (h << ONE_BCI)) {
+                            for (k = 0; k < h; k++) {
+                                const complex y0 = amps[b + k];
+                                const complex y1 = amps[b + k + h] * twiddles[k * stride];
+                                amps[b + k] = y0 + y1;
+                                amps[b + k + h] = y0 - y1;
+                            }
+                        }
+                    }
+                }
+
+                for (j = 0; j < regPower; j++) {
+                    stateVec->write(base | ((bitCapInt)j << start), nrm * amps[j]);
+                }
+            });
+
+            return;
+        }
+
+        // Too few transforms to go around, so each radix-2 stage is spread over every thread, instead.
+        const real1 nrm = (real1)M_SQRT1_2;
+        for (bitLenInt s = 0; s < length; s++) {
+            // QFT() runs from the highest bit of the register down, and IQFT() from the lowest bit up.
+            const bitLenInt bit = inverse ? s : ((length - 1U) - s);
+            const bitCapIntOcl h = pow2Ocl(bit);
+            const bitCapIntOcl stride = halfPower >> bit;
+            const bitCapInt pairPower = pow2(start + bit);
+            const bitCapInt lowMask = pairPower - ONE_BCI;
+
+            par_for(0, maxQPower >> ONE_BCI, [&](const bitCapInt lcv, const int cpu) {
+                bitCapInt i = lcv & lowMask;
+                i |= (lcv ^ i) << ONE_BCI;
+                const complex twiddle = twiddles[((bitCapIntOcl)(i >> start) & (h - 1U)) * stride];
+                const complex y0 = stateVec->read(i);
+                const complex y1 = stateVec->read(i | pairPower);
+                if (!inverse) {
+                    stateVec->write2(i, nrm * (y0 + y1), i | pairPower, nrm * (y0 - y1) * twiddle);
+                } else {
+                    stateVec->write2(i, nrm * (y0 + y1 * twiddle), i | pairPower, nrm * (y0 - y1 * twiddle));
+                }
+            });
+        }
+    });
+}
+
+void QEngineCPU::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    if (!length) {
+        return;
+    }
+
+    CHECK_ZERO_SKIP();
+
+    FlushFusedGates(bitRegMask(start, length));
+
+    Dispatch([this, start, length] {
+        const bitCapIntOcl regPower = pow2Ocl(length);
+        const bitCapIntOcl outerCount = (bitCapIntOcl)(maxQPower >> length);
+        const bitCapInt lowMask = pow2Mask(start);
+        // H, ZeroPhaseFlip(), and H on the register take twice the mean amplitude of the register, (for each value of
+        // the other bits,) from each of its amplitudes.
+        const real1 nrm = (real1)(2 * ONE_R1 / regPower);
+
+        // Each register is read twice and written once, (about 2 * regPower par_for() items).
+        const bitCapIntOcl weight = regPower << ONE_BCI;
+        if (IsRegisterParallel(outerCount, weight)) {
+            par_for_weighted(0, outerCount, weight, [&](const bitCapInt lcv, const int cpu) {
+                const bitCapInt base = (lcv & lowMask) | ((lcv & ~lowMask) << length);
+                bitCapIntOcl j;
+                complex sum = ZERO_CMPLX;
+                for (j = 0; j < regPower; j++) {
+                    sum += stateVec->read(base | ((bitCapInt)j << start));
+                }
+
+                const complex twiceMean = nrm * sum;
+                for (j = 0; j < regPower; j++) {
+                    const bitCapInt i = base | ((bitCapInt)j << start);
+                    stateVec->write(i, stateVec->read(i) - twiceMean);
+                }
+            });
+
+            return;
+        }
+
+        // Too few registers to go around, so every thread sums its share of each, and then reflects its share of the
+        // whole state.
+        const int numCores = GetConcurrencyLevel();
+        std::unique_ptr<complex[]> sums(new complex[numCores * outerCount]);
+        std::fill(sums.get(), sums.get() + numCores * outerCount, ZERO_CMPLX);
+
+        par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl outer = (bitCapIntOcl)((lcv & lowMask) | ((lcv >> (start + length)) << start));
+            sums[cpu * outerCount + outer] += stateVec->read(lcv);
+        });
+
+        for (bitCapIntOcl i = 0; i < outerCount; i++) {
+            for (int cpu = 1; cpu < numCores; cpu++) {
+                sums[i] += sums[cpu * outerCount + i];
+            }
+            sums[i] *= nrm;
+        }
+
+        par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl outer = (bitCapIntOcl)((lcv & lowMask) | ((lcv >> (start + length)) << start));
+            stateVec->write(lcv, stateVec->read(lcv) - sums[outer]);
+        });
+    });
+}
+
 /**
  * Combine (a copy of) another QEngineCPU with this one, after the last bit
  * index of this one. (If the programmer doesn't want to "cheat," it is left up
@@ -675,17 +1433,18 @@ bitLenInt QEngineCPU::Compose(QEngineCPUPtr toCopy)
     StateVectorPtr nStateVec = AllocStateVec(nMaxQPower);
     stateVec->isReadLocked = false;
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
         nStateVec->write(lcv, stateVec->read(lcv & startMask) * toCopy->stateVec->read((lcv & endMask) >> qubitCount));
     };
 
-    if ((toCopy->doNormalize) && (toCopy->runningNorm != ONE_R1)) {
+    if (toCopy->doNormalize) {
         toCopy->NormalizeState();
     } else {
         toCopy->Finish();
     }
 
-    if (stateVec->is_sparse() || toCopy->stateVec->is_sparse()) {
+    // (Only if both are sparse state vectors, which might differ, with sparse switching)
+    if (isSparse && toCopy->isSparse && (stateVec->is_sparse() || toCopy->stateVec->is_sparse())) {
         par_for_sparse_compose(
             CastStateVecSparse()->iterable(), toCopy->CastStateVecSparse()->iterable(), qubitCount, fn);
     } else {
@@ -718,7 +1477,7 @@ bitLenInt QEngineCPU::Compose(QEngineCPUPtr toCopy, bitLenInt start)
         Finish();
     }
 
-    if ((toCopy->doNormalize) && (toCopy->runningNorm != ONE_R1)) {
+    if (toCopy->doNormalize) {
         toCopy->NormalizeState();
     } else {
         toCopy->Finish();
@@ -769,7 +1528,7 @@ std::map<QInterfacePtr, bitLenInt> QEngineCPU::Compose(std::vector<QInterfacePtr
 
     for (i = 0; i < toComposeCount; i++) {
         QEngineCPUPtr src = std::dynamic_pointer_cast<Qrack::QEngineCPU>(toCopy[i]);
-        if ((src->doNormalize) && (src->runningNorm != ONE_R1)) {
+        if (src->doNormalize) {
             src->NormalizeState();
         } else {
             src->Finish();
@@ -886,6 +1645,7 @@ void QEngineCPU::DecomposeDispose(bitLenInt start, bitLenInt length, QEngineCPUP
 
     if (destination != nullptr) {
         destination->Dump();
+        destination->UnshareStateVec(true);
 
         par_for(0, partPower, [&](const bitCapInt lcv, const int cpu) {
             destination->stateVec->write(lcv,
@@ -981,7 +1741,7 @@ real1 QEngineCPU::Prob(bitLenInt qubit)
     int numCores = GetConcurrencyLevel();
     real1* oneChanceBuff = new real1[numCores]();
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
         oneChanceBuff[cpu] += norm(stateVec->read(lcv | qPower));
     };
 
@@ -994,6 +1754,12 @@ real1 QEngineCPU::Prob(bitLenInt qubit)
     stateVec->isReadLocked = false;
     if (stateVec->is_sparse()) {
         par_for_set(CastStateVecSparse()->iterable(qPower, qPower, qPower), fn);
+    } else if (IsWideSimdRun(qPower)) {
+        bitLenInt runPow = (qubit > WIDE_SIMD_RUN_POW) ? WIDE_SIMD_RUN_POW : qubit;
+        complex* amplitudes = std::dynamic_pointer_cast<StateVectorArray>(stateVec)->amplitudes;
+        par_for_skip(0, maxQPower >> runPow, qPower >> runPow, 1U, [&](const bitCapInt lcv, const int cpu) {
+            oneChanceBuff[cpu] += NormRun(amplitudes + (bitCapIntOcl)((lcv << runPow) | qPower), pow2Ocl(runPow));
+        });
     } else {
         par_for_skip(0, maxQPower, qPower, 1U, fn);
     }
@@ -1036,7 +1802,7 @@ real1 QEngineCPU::ProbReg(const bitLenInt& start, const bitLenInt& length, const
 
     bitCapInt perm = permutation << start;
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | perm)); };
+    auto fn = [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | perm)); };
 
     if (doNormalize) {
         NormalizeState();
@@ -1047,6 +1813,12 @@ real1 QEngineCPU::ProbReg(const bitLenInt& start, const bitLenInt& length, const
     stateVec->isReadLocked = false;
     if (stateVec->is_sparse()) {
         par_for_set(CastStateVecSparse()->iterable(0, bitRegMask(start, length), perm), fn);
+    } else if (IsWideSimdRun(pow2(start))) {
+        bitLenInt runPow = (start > WIDE_SIMD_RUN_POW) ? WIDE_SIMD_RUN_POW : start;
+        complex* amplitudes = std::dynamic_pointer_cast<StateVectorArray>(stateVec)->amplitudes;
+        par_for_skip(0, maxQPower >> runPow, pow2(start) >> runPow, length, [&](const bitCapInt lcv, const int cpu) {
+            probs[cpu] += NormRun(amplitudes + (bitCapIntOcl)((lcv << runPow) | perm), pow2Ocl(runPow));
+        });
     } else {
         par_for_skip(0, maxQPower, pow2(start), length, fn);
     }
@@ -1108,6 +1880,81 @@ real1 QEngineCPU::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
     return clampProb(prob);
 }
 
+void QEngineCPU::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
+{
+    bitCapInt v = mask; // count the number of bits set in v
+    bitCapInt oldV;
+    bitLenInt length;
+    std::vector<bitCapInt> powersVec;
+    for (length = 0; v; length++) {
+        oldV = v;
+        v &= v - ONE_BCI; // clear the least significant bit set
+        powersVec.push_back((v ^ oldV) & oldV);
+    }
+
+    bitCapIntOcl lengthPower = pow2Ocl(length);
+    std::fill(probsArray, probsArray + lengthPower, ZERO_R1);
+
+    if (!stateVec) {
+        return;
+    }
+
+    if (doNormalize) {
+        NormalizeState();
+    } else {
+        Finish();
+    }
+
+    // Unlike ProbMask() for every masked permutation, this takes one pass over the state vector, binning every
+    // amplitude's probability by its masked bits. Each thread gets its own bins, unless that would take more memory than
+    // the state vector itself, in which case the pass is serial.
+    int numCores = GetConcurrencyLevel();
+    bool isParallel = ((bitCapInt)lengthPower * (bitCapInt)numCores) <= maxQPower;
+    real1* bins = isParallel ? new real1[lengthPower * numCores]() : probsArray;
+
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
+        bitCapIntOcl j = 0;
+        for (bitLenInt p = 0; p < length; p++) {
+            if (lcv & powersVec[p]) {
+                j |= pow2Ocl(p);
+            }
+        }
+        bins[(bitCapIntOcl)cpu * lengthPower + j] += norm(stateVec->read(lcv));
+    };
+
+    stateVec->isReadLocked = false;
+    if (!isParallel) {
+        std::vector<bitCapInt> perms;
+        if (stateVec->is_sparse()) {
+            perms = CastStateVecSparse()->iterable();
+            for (bitCapIntOcl i = 0; i < perms.size(); i++) {
+                fn(perms[i], 0);
+            }
+        } else {
+            for (bitCapInt lcv = 0; lcv < maxQPower; lcv++) {
+                fn(lcv, 0);
+            }
+        }
+    } else if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(), fn);
+    } else {
+        par_for(0, maxQPower, fn);
+    }
+    stateVec->isReadLocked = true;
+
+    if (!isParallel) {
+        return;
+    }
+
+    for (int thrd = 0; thrd < numCores; thrd++) {
+        for (bitCapIntOcl j = 0; j < lengthPower; j++) {
+            probsArray[j] += bins[(bitCapIntOcl)thrd * lengthPower + j];
+        }
+    }
+
+    delete[] bins;
+}
+
 real1 QEngineCPU::ProbParity(const bitCapInt& mask)
 {
     if (!stateVec || !mask) {
@@ -1119,7 +1966,7 @@ real1 QEngineCPU::ProbParity(const bitCapInt& mask)
     int numCores = GetConcurrencyLevel();
     real1* oddChanceBuff = new real1[numCores]();
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
         bool parity = false;
         bitCapInt v = lcv & mask;
         while (v) {
@@ -1155,6 +2002,70 @@ real1 QEngineCPU::ProbParity(const bitCapInt& mask)
     return clampProb(oddChance);
 }
 
+void QEngineCPU::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    if (!stateVec) {
+        std::fill(expectations, expectations + termCount, ZERO_R1);
+        return;
+    }
+
+    if (!termCount) {
+        return;
+    }
+
+    // <psi|X^x Z^z|psi> is the sum over permutations "k" of conj(psi[k ^ x]) * (-1)^|k & z| * psi[k]. Every term is
+    // accumulated in the same pass over the amplitudes, with one row of partial sums per thread.
+    int numCores = GetConcurrencyLevel();
+    std::vector<complex> partials((bitCapIntOcl)numCores * termCount, ZERO_CMPLX);
+
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
+        const complex amp = stateVec->read(lcv);
+        complex* partial = &(partials[(bitCapIntOcl)cpu * termCount]);
+        for (bitCapIntOcl i = 0; i < termCount; i++) {
+            bool parity = false;
+            bitCapInt v = lcv & terms[i].zMask;
+            while (v) {
+                parity = !parity;
+                v = v & (v - ONE_BCI);
+            }
+
+            const complex prod = conj(stateVec->read(lcv ^ terms[i].xMask)) * amp;
+            partial[i] += parity ? -prod : prod;
+        }
+    };
+
+    if (doNormalize) {
+        NormalizeState();
+    } else {
+        Finish();
+    }
+
+    stateVec->isReadLocked = false;
+    if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(), fn);
+    } else {
+        par_for(0, maxQPower, fn);
+    }
+    stateVec->isReadLocked = true;
+
+    // Y = i * X * Z, so each Y contributes a factor of i.
+    const complex iPowers[4] = { ONE_CMPLX, I_CMPLX, -ONE_CMPLX, -I_CMPLX };
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        complex sum = ZERO_CMPLX;
+        for (int j = 0; j < numCores; j++) {
+            sum += partials[(bitCapIntOcl)j * termCount + i];
+        }
+
+        bitLenInt yCount = 0;
+        for (bitCapInt v = terms[i].xMask & terms[i].zMask; v; v &= v - ONE_BCI) {
+            yCount++;
+        }
+
+        real1 expectation = real(iPowers[yCount & 3U] * sum);
+        expectations[i] = (expectation > ONE_R1) ? ONE_R1 : ((expectation < -ONE_R1) ? -ONE_R1 : expectation);
+    }
+}
+
 bool QEngineCPU::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
 {
     if (!stateVec || !mask) {
@@ -1163,14 +2074,18 @@ bool QEngineCPU::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
 
     if (!doForce) {
         result = (Rand() <= ProbParity(mask));
+    } else {
+        Finish();
     }
 
+    UnshareStateVec();
+
     real1 oddChance = 0;
 
     int numCores = GetConcurrencyLevel();
     real1* oddChanceBuff = new real1[numCores]();
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+    auto fn = [&](const bitCapInt lcv, const int cpu) {
         bool parity = false;
         bitCapInt v = lcv & mask;
         while (v) {
@@ -1222,7 +2137,7 @@ bool QEngineCPU::ApproxCompare(QEngineCPUPtr toCompare)
         Finish();
     }
 
-    if (toCompare->doNormalize && (toCompare->runningNorm != ONE_R1)) {
+    if (toCompare->doNormalize) {
         toCompare->NormalizeState();
     } else {
         toCompare->Finish();
@@ -1278,7 +2193,7 @@ void QEngineCPU::PhaseFlip()
     }
 
     Dispatch([this] {
-        ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) { stateVec->write(lcv, -stateVec->read(lcv)); };
+        auto fn = [&](const bitCapInt lcv, const int cpu) { stateVec->write(lcv, -stateVec->read(lcv)); };
 
         if (stateVec->is_sparse()) {
             par_for_set(CastStateVecSparse()->iterable(), fn);
@@ -1293,6 +2208,8 @@ void QEngineCPU::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
 {
     CHECK_ZERO_SKIP();
 
+    FlushFusedGates(bitRegMask(start, length));
+
     Dispatch([this, start, length] {
         par_for_skip(0, maxQPower, pow2(start), length,
             [&](const bitCapInt lcv, const int cpu) { stateVec->write(lcv, -stateVec->read(lcv)); });
@@ -1304,6 +2221,8 @@ void QEngineCPU::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLen
 {
     CHECK_ZERO_SKIP();
 
+    FlushFusedGates(bitRegMask(start, length) | pow2(flagIndex));
+
     Dispatch([this, greaterPerm, start, length, flagIndex] {
         bitCapInt regMask = bitRegMask(start, length);
         bitCapInt flagMask = pow2(flagIndex);
@@ -1320,6 +2239,8 @@ void QEngineCPU::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenI
 {
     CHECK_ZERO_SKIP();
 
+    FlushFusedGates(bitRegMask(start, length));
+
     Dispatch([this, greaterPerm, start, length] {
         bitCapInt regMask = bitRegMask(start, length);
 
@@ -1334,8 +2255,10 @@ void QEngineCPU::ApplyM(bitCapInt regMask, bitCapInt result, complex nrm)
 {
     CHECK_ZERO_SKIP();
 
+    FlushFusedGates(regMask);
+
     Dispatch([this, regMask, result, nrm] {
-        ParallelFunc fn = [&](const bitCapInt i, const int cpu) {
+        auto fn = [&](const bitCapInt i, const int cpu) {
             if ((i & regMask) == result) {
                 stateVec->write(i, nrm * stateVec->read(i));
             } else {
@@ -1350,6 +2273,11 @@ void QEngineCPU::ApplyM(bitCapInt regMask, bitCapInt result, complex nrm)
         }
 
         runningNorm = ONE_R1;
+
+        // (The switch itself waits for the next operation, on the calling thread.)
+        if (isSparseSwitching && !isSparse && IsSparseEnough()) {
+            isSparseDue = true;
+        }
     });
 }
 
@@ -1372,6 +2300,8 @@ void QEngineCPU::NormalizeState(real1 nrm, real1 norm_thresh)
 
     nrm = ONE_R1 / std::sqrt(nrm);
 
+    UnshareStateVec();
+
     if (norm_thresh <= ZERO_R1) {
         par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
             complex amp = stateVec->read(lcv) * nrm;
@@ -1412,9 +2342,137 @@ StateVectorPtr QEngineCPU::AllocStateVec(bitCapInt elemCount)
 {
     if (isSparse) {
         return std::make_shared<StateVectorSparse>(elemCount);
+    }
+    if (storagePrecision == STORAGE_BF16) {
+        return std::make_shared<StateVectorBf16>(elemCount);
+    }
+#if !ENABLE_COMPLEX8
+    if (storagePrecision == STORAGE_FLOAT) {
+        return std::make_shared<StateVectorFloat>(elemCount);
+    }
+#endif
+#if !defined(_WIN32)
+    if (isMapped) {
+        return std::make_shared<StateVectorMapped>(elemCount);
+    }
+#endif
+    return std::make_shared<StateVectorArray>(elemCount, numaNode);
+}
+
+void QEngineCPU::SetStoragePrecision(QStoragePrecision precision)
+{
+    if (isSparse || (storagePrecision == precision)) {
+        return;
+    }
+
+    Finish();
+    storagePrecision = precision;
+
+    if (!stateVec) {
+        return;
+    }
+
+    StateVectorPtr nStateVec = AllocStateVec(maxQPower);
+    par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) { nStateVec->write(lcv, stateVec->read(lcv)); });
+    ResetStateVec(nStateVec);
+}
+
+void QEngineCPU::SetMappedStateVec(bool doMap)
+{
+    if (isSparse || (isMapped == doMap)) {
+        return;
+    }
+
+    Finish();
+    isMapped = doMap;
+
+    if (!stateVec) {
+        return;
+    }
+
+    StateVectorPtr nStateVec = AllocStateVec(maxQPower);
+    par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) { nStateVec->write(lcv, stateVec->read(lcv)); });
+    ResetStateVec(nStateVec);
+}
+
+void QEngineCPU::SetSparseSwitching(bool doSwitch, real1 denseAbove, real1 sparseBelow)
+{
+    if (doSwitch && (sparseBelow >= denseAbove)) {
+        throw std::invalid_argument("Sparse switching thresholds must leave a gap, (sparseBelow < denseAbove).");
+    }
+
+    Finish();
+    isSparseSwitching = doSwitch;
+    denseFill = denseAbove;
+    sparseFill = sparseBelow;
+    isSparseDue = doSwitch && stateVec && !isSparse && IsSparseEnough();
+
+    UpdateSparsity();
+}
+
+void QEngineCPU::UpdateSparsity()
+{
+    if (!isSparseSwitching || !stateVec) {
+        return;
+    }
+
+    if (isSparse) {
+        // (The count is atomic, so this can run while gates are still queued.)
+        if (((real1)CastStateVecSparse()->size() / (real1)(bitCapIntOcl)maxQPower) <= denseFill) {
+            return;
+        }
+    } else if (!isSparseDue) {
+        return;
+    }
+
+    isSparseDue = false;
+#if ENABLE_QUNIT_CPU_PARALLEL
+    dispatchQueue.finish();
+#endif
+
+    // Gates queued since the measurement might have filled the state back in.
+    if (isSparse || IsSparseEnough()) {
+        ConvertStateVec(!isSparse);
+    }
+}
+
+bool QEngineCPU::IsSparseEnough()
+{
+    std::vector<bitCapIntOcl> counts(GetConcurrencyLevel(), 0U);
+    par_for(0, maxQPower, [&](const bitCapInt& lcv, const int& cpu) {
+        if (stateVec->read(lcv) != ZERO_CMPLX) {
+            counts[cpu]++;
+        }
+    });
+
+    bitCapIntOcl count = 0U;
+    for (size_t i = 0U; i < counts.size(); i++) {
+        count += counts[i];
+    }
+
+    return ((real1)count / (real1)(bitCapIntOcl)maxQPower) < sparseFill;
+}
+
+void QEngineCPU::ConvertStateVec(bool toSparse)
+{
+    StateVectorPtr oStateVec = stateVec;
+    isSparse = toSparse;
+    StateVectorPtr nStateVec = AllocStateVec(maxQPower);
+
+    if (toSparse) {
+        par_for(0, maxQPower, [&](const bitCapInt& lcv, const int& cpu) {
+            complex amp = oStateVec->read(lcv);
+            if (amp != ZERO_CMPLX) {
+                nStateVec->write(lcv, amp);
+            }
+        });
     } else {
-        return std::make_shared<StateVectorArray>(elemCount);
+        nStateVec->clear();
+        par_for_set(std::dynamic_pointer_cast<StateVectorSparse>(oStateVec)->iterable(),
+            [&](const bitCapInt lcv, const int cpu) { nStateVec->write(lcv, oStateVec->read(lcv)); });
     }
+
+    ResetStateVec(nStateVec);
 }
 
 void QEngineCPU::ResetStateVec(StateVectorPtr sv)
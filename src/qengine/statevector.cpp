@@ -0,0 +1,154 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include "statevector.hpp"
+
+#if !defined(_WIN32)
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#endif
+
+#if defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <sys/syscall.h>
+
+// From <linux/mempolicy.h>, which isn't always installed, (and libnuma is not a dependency)
+#define QRACK_MPOL_PREFERRED 1
+#define QRACK_MPOL_INTERLEAVE 3
+#define QRACK_MASK_WORD_BITS (8U * sizeof(unsigned long))
+#endif
+
+namespace Qrack {
+
+StateVecPool<complex*>* StateVectorArray::GetPool()
+{
+    static StateVecPool<complex*> pool(FreeAligned);
+    return &pool;
+}
+
+#if defined(__linux__)
+// Parse a kernel node list, like "0-1,4", into a list of node indices.
+static std::vector<int> ReadOnlineNumaNodes()
+{
+    std::vector<int> nodes;
+    std::ifstream nodeFile("/sys/devices/system/node/online");
+    std::string range;
+    while (std::getline(nodeFile, range, ',')) {
+        std::istringstream rangeStream(range);
+        int first, last;
+        char dash;
+        if (!(rangeStream >> first)) {
+            continue;
+        }
+        last = (rangeStream >> dash >> last) ? last : first;
+        for (int i = first; i <= last; i++) {
+            nodes.push_back(i);
+        }
+    }
+
+    return nodes;
+}
+
+complex* StateVectorArray::AllocLarge(size_t size, int numaNode)
+{
+    static const std::vector<int> onlineNodes = ReadOnlineNumaNodes();
+
+    // Sizes are powers of two, at least as large as a huge page, so rounding is never needed.
+    void* toRet = aligned_alloc(QRACK_HUGE_PAGE_SIZE, size);
+    if (!toRet) {
+        return NULL;
+    }
+
+    // Everything below is a hint. On failure, the kernel falls back to its defaults, which is always correct.
+#if defined(MADV_HUGEPAGE)
+    madvise(toRet, size, MADV_HUGEPAGE);
+#endif
+
+    bool isNodeValid = std::find(onlineNodes.begin(), onlineNodes.end(), numaNode) != onlineNodes.end();
+    if (!isNodeValid && (onlineNodes.size() < 2U)) {
+        return (complex*)toRet;
+    }
+
+    std::vector<int> policyNodes = isNodeValid ? std::vector<int>(1, numaNode) : onlineNodes;
+    int maxNode = *std::max_element(policyNodes.begin(), policyNodes.end());
+    std::vector<unsigned long> nodeMask((maxNode / QRACK_MASK_WORD_BITS) + 1U, 0UL);
+    for (size_t i = 0; i < policyNodes.size(); i++) {
+        nodeMask[policyNodes[i] / QRACK_MASK_WORD_BITS] |= 1UL << (policyNodes[i] % QRACK_MASK_WORD_BITS);
+    }
+
+    // The pages are untouched, so far, so the policy determines where each one is faulted in. ("maxnode" counts one
+    // past the mask, to match the kernel's interpretation.)
+    syscall(SYS_mbind, toRet, size, isNodeValid ? QRACK_MPOL_PREFERRED : QRACK_MPOL_INTERLEAVE, &(nodeMask[0]),
+        (unsigned long)(nodeMask.size() * QRACK_MASK_WORD_BITS + 1U), 0U);
+
+    return (complex*)toRet;
+}
+#endif
+
+#if !defined(_WIN32)
+
+size_t StateVectorMapped::MappedSize(bitCapInt elemCount)
+{
+    // elemCount is always a power of two, but might be smaller than QRACK_ALIGN_SIZE
+    size_t size = sizeof(complex) * (bitCapIntOcl)elemCount;
+    return (size < QRACK_ALIGN_SIZE) ? QRACK_ALIGN_SIZE : size;
+}
+
+complex* StateVectorMapped::Map(bitCapInt elemCount)
+{
+    std::string path = std::string(getenv("QRACK_STATEVEC_PATH") ? getenv("QRACK_STATEVEC_PATH") : "/tmp") +
+        "/qrack_statevec_XXXXXX";
+    std::vector<char> pathBuffer(path.begin(), path.end());
+    pathBuffer.push_back('\0');
+
+    int fd = mkstemp(&(pathBuffer[0]));
+    if (fd < 0) {
+        throw "Error: Could not create a file for a memory-mapped state vector";
+    }
+    // The mapping keeps the file alive, until it is unmapped.
+    unlink(&(pathBuffer[0]));
+
+    size_t size = MappedSize(elemCount);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        throw "Error: Could not size the file for a memory-mapped state vector";
+    }
+
+    void* toRet = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (toRet == MAP_FAILED) {
+        throw "Error: Could not memory-map a state vector";
+    }
+
+    // Most kernels sweep the whole state vector in order, so ask for aggressive read-ahead. (These are only hints.)
+    madvise(toRet, size, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+    madvise(toRet, size, MADV_HUGEPAGE);
+#endif
+
+    return (complex*)toRet;
+}
+
+void StateVectorMapped::Free()
+{
+    if (amplitudes) {
+        munmap(amplitudes, MappedSize(capacity));
+    }
+    amplitudes = NULL;
+}
+#endif
+
+} // namespace Qrack
@@ -18,11 +18,22 @@ QInterfacePtr QEngineCPU::Clone()
 {
     Finish();
 
-    QInterfacePtr clone = CreateQuantumInterface(QINTERFACE_CPU, qubitCount, 0, rand_generator, ONE_CMPLX, doNormalize,
-        randGlobalPhase, false, 0, (hardware_rand_generator == NULL) ? false : true, isSparse);
-    if (stateVec) {
-        std::dynamic_pointer_cast<QEngineCPU>(clone)->stateVec->copy(stateVec);
-    }
+    // The clone is created with a single amplitude, then shares this state vector, (copy on write, by
+    // UnshareStateVec(),) so cloning copies nothing up front.
+    QInterfacePtr clone = CreateQuantumInterface(QINTERFACE_CPU, 0, 0, rand_generator, ONE_CMPLX, doNormalize,
+        randGlobalPhase, false, numaNode, (hardware_rand_generator == NULL) ? false : true, isSparse);
+    QEngineCPUPtr engineClone = std::dynamic_pointer_cast<QEngineCPU>(clone);
+    engineClone->storagePrecision = storagePrecision;
+    engineClone->isMapped = isMapped;
+    engineClone->isSparseSwitching = isSparseSwitching;
+    engineClone->denseFill = denseFill;
+    engineClone->sparseFill = sparseFill;
+    engineClone->SetQubitCount(qubitCount);
+    engineClone->stateVec = stateVec;
+    engineClone->runningNorm = runningNorm;
+    engineClone->SetGateFusion(isFusing);
+    engineClone->SetTileQubits(tileQubits);
+    engineClone->SetLazyNormalization(isLazyNorm);
     return clone;
 }
 
@@ -8,13 +8,279 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
 
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "qfactory.hpp"
 #include "qhybrid.hpp"
 
+#if ENABLE_OPENCL
+#include "common/oclengine.hpp"
+#endif
+
 namespace Qrack {
 
+QHybridCalibration::QHybridCalibration()
+{
+    // Until calibrated, use the old rule of thumb, of one page of work per CPU thread, for every gate class.
+    const uint32_t concurrency = std::thread::hardware_concurrency();
+    const bitLenInt guess = (concurrency <= 1) ? PSTRIDEPOW : (log2(concurrency - 1) + PSTRIDEPOW + 1);
+    for (int i = 0; i < HYBRID_GATE_CLASS_COUNT; i++) {
+        crossoverQb[i] = guess;
+        amortizeGates[i] = ZERO_R1;
+    }
+}
+
+bitLenInt QHybridCalibration::FindCrossover(
+    const std::vector<real1>& cpuNs, const std::vector<real1>& gpuNs, bitLenInt minQb)
+{
+    bitLenInt crossover = minQb + cpuNs.size();
+    for (bitLenInt i = cpuNs.size(); i > 0; i--) {
+        if (gpuNs[i - 1U] >= cpuNs[i - 1U]) {
+            break;
+        }
+        crossover = minQb + i - 1U;
+    }
+
+    return crossover;
+}
+
+void QHybridCalibration::Write(std::ostream& os) const
+{
+    std::ios::fmtflags flags = os.flags();
+    os << std::setprecision(std::numeric_limits<float>::max_digits10);
+    for (int i = 0; i < HYBRID_GATE_CLASS_COUNT; i++) {
+        os << i << " " << (int)crossoverQb[i] << " " << (float)amortizeGates[i] << std::endl;
+    }
+    os.flags(flags);
+}
+
+bool QHybridCalibration::Read(std::istream& is)
+{
+    QHybridCalibration toRet;
+    for (int i = 0; i < HYBRID_GATE_CLASS_COUNT; i++) {
+        int gateClass, crossover;
+        float amortize;
+        if (!(is >> gateClass >> crossover >> amortize) || (gateClass != i) || (crossover < 0) || (amortize < 0)) {
+            return false;
+        }
+        toRet.crossoverQb[i] = (bitLenInt)crossover;
+        toRet.amortizeGates[i] = (real1)amortize;
+    }
+
+    *this = toRet;
+    return true;
+}
+
+#if ENABLE_OPENCL
+template <typename Fn> static real1 MedianNs(Fn fn)
+{
+    std::vector<real1> times(QRACK_HYBRID_CALIBRATE_REPS);
+    for (int i = 0; i < QRACK_HYBRID_CALIBRATE_REPS; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        times[i] = (real1)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    std::sort(times.begin(), times.end());
+
+    return times[QRACK_HYBRID_CALIBRATE_REPS / 2];
+}
+
+// Time one representative gate of class "gateClass" on "qReg," including the wait for it to finish.
+static real1 GateNs(QEnginePtr qReg, QHybridGateClass gateClass)
+{
+    const bitLenInt qubitCount = qReg->GetQubitCount();
+    switch (gateClass) {
+    case HYBRID_GATE_CONTROLLED:
+        return MedianNs([&]() {
+            for (bitLenInt i = 1; i < qubitCount; i++) {
+                qReg->CNOT(i - 1U, i);
+            }
+            qReg->Finish();
+        }) / (qubitCount - 1U);
+    case HYBRID_GATE_ARITHMETIC:
+        return MedianNs([&]() {
+            qReg->INC(1U, 0, qubitCount);
+            qReg->Finish();
+        });
+    case HYBRID_GATE_SINGLE:
+    default:
+        return MedianNs([&]() {
+            for (bitLenInt i = 0; i < qubitCount; i++) {
+                qReg->H(i);
+            }
+            qReg->Finish();
+        }) / qubitCount;
+    }
+}
+
+/*
+ * Time each gate class on QEngineCPU and on QEngineOCL device "devID," widening from QRACK_HYBRID_CALIBRATE_MIN_QB
+ * until the GPU has been faster at two consecutive widths, (or QRACK_HYBRID_CALIBRATE_MAX_QB). The cost of a switch is
+ * timed as a copy of the state vector from the CPU engine to the GPU engine, at the widest width reached.
+ */
+static QHybridCalibration CalibrateDevice(int devID)
+{
+    QHybridCalibration calibration;
+
+    for (int c = 0; c < HYBRID_GATE_CLASS_COUNT; c++) {
+        const QHybridGateClass gateClass = (QHybridGateClass)c;
+        std::vector<real1> cpuNs, gpuNs;
+        real1 copyNs = ZERO_R1;
+        int gpuWins = 0;
+
+        for (bitLenInt qb = QRACK_HYBRID_CALIBRATE_MIN_QB; (qb <= QRACK_HYBRID_CALIBRATE_MAX_QB) && (gpuWins < 2); qb++) {
+            QEnginePtr cpu = std::make_shared<QEngineCPU>(qb, 0, nullptr, CMPLX_DEFAULT_ARG, false, false);
+            QEnginePtr gpu = std::make_shared<QEngineOCL>(
+                qb, 0, nullptr, CMPLX_DEFAULT_ARG, false, false, false, devID, false);
+
+            // Warm up, so that first launch and allocation costs aren't counted.
+            cpu->H(0);
+            gpu->H(0);
+            gpu->Finish();
+
+            cpuNs.push_back(GateNs(cpu, gateClass));
+            gpuNs.push_back(GateNs(gpu, gateClass));
+            gpuWins = (gpuNs.back() < cpuNs.back()) ? (gpuWins + 1) : 0;
+
+            copyNs = MedianNs([&]() {
+                gpu->CopyStateVec(cpu);
+                gpu->Finish();
+            });
+        }
+
+        calibration.crossoverQb[c] = QHybridCalibration::FindCrossover(cpuNs, gpuNs, QRACK_HYBRID_CALIBRATE_MIN_QB);
+
+        // If the GPU never came out ahead, a switch never pays for itself.
+        const real1 savedNs = cpuNs.back() - gpuNs.back();
+        calibration.amortizeGates[c] =
+            (savedNs > ZERO_R1) ? (copyNs / savedNs) : (real1)std::numeric_limits<float>::max();
+    }
+
+    return calibration;
+}
+
+// The cache file name hashes everything that the crossover depends on: the device and its driver, the host's thread
+// count, and the precision of this build.
+static std::string GetCalibrationFileName(int devID)
+{
+    DeviceContextPtr devCntxt = OCLEngine::Instance()->GetDeviceContextPtr(devID);
+
+    uint64_t hash = 14695981039346656037ULL;
+    auto hashString = [&hash](std::string str) {
+        // Include the terminator, so that adjacent fields can't run together.
+        for (size_t i = 0; i <= str.size(); i++) {
+            hash ^= (unsigned char)str.c_str()[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    hashString(devCntxt->platform.getInfo<CL_PLATFORM_NAME>());
+    hashString(devCntxt->device.getInfo<CL_DEVICE_VENDOR>());
+    hashString(devCntxt->device.getInfo<CL_DEVICE_NAME>());
+    hashString(devCntxt->device.getInfo<CL_DRIVER_VERSION>());
+    hashString(std::to_string(std::thread::hardware_concurrency()));
+    hashString(std::to_string(sizeof(complex)));
+
+    std::stringstream name;
+    name << "qrack_hybrid_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".txt";
+
+    return name.str();
+}
+
+static bool LoadCalibration(std::string path, QHybridCalibration& calibration)
+{
+    std::ifstream file(path);
+    return file.good() && calibration.Read(file);
+}
+
+static void SaveCalibration(std::string dir, std::string fileName, const QHybridCalibration& calibration)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    _mkdir(dir.c_str());
+    std::string tempName = dir + fileName + ".tmp" + std::to_string(_getpid());
+#else
+    mkdir(dir.c_str(), 0700);
+    std::string tempName = dir + fileName + ".tmp" + std::to_string(getpid());
+#endif
+
+    // (As with cached binaries, write privately, then move into place, so that no reader sees a partial file.)
+    {
+        std::ofstream file(tempName);
+        if (!file.good()) {
+            return;
+        }
+        calibration.Write(file);
+    }
+
+    std::string path = dir + fileName;
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    remove(path.c_str());
+#endif
+    if (rename(tempName.c_str(), path.c_str()) != 0) {
+        remove(tempName.c_str());
+    }
+}
+#endif
+
+QHybridCalibration QHybridCalibration::Get(int devID)
+{
+#if ENABLE_OPENCL
+    static std::mutex calibrationMutex;
+    static std::map<int, QHybridCalibration> calibrations;
+
+    if (devID < 0) {
+        devID = OCLEngine::Instance()->GetDefaultDeviceID();
+    }
+
+    std::lock_guard<std::mutex> guard(calibrationMutex);
+    auto found = calibrations.find(devID);
+    if (found != calibrations.end()) {
+        return found->second;
+    }
+
+    const bool isCaching = !getenv("QRACK_HYBRID_NO_CALIBRATION_CACHE");
+    const std::string dir = OCLEngine::GetDefaultBinaryPath();
+    const std::string fileName = GetCalibrationFileName(devID);
+
+    QHybridCalibration calibration;
+    if (!isCaching || !LoadCalibration(dir + fileName, calibration)) {
+        calibration = CalibrateDevice(devID);
+        if (isCaching) {
+            SaveCalibration(dir, fileName, calibration);
+        }
+    }
+    calibrations[devID] = calibration;
+
+    return calibration;
+#else
+    // Without OpenCL, there is no device to switch to.
+    QHybridCalibration calibration;
+    for (int i = 0; i < HYBRID_GATE_CLASS_COUNT; i++) {
+        calibration.crossoverQb[i] = QRACK_HYBRID_CALIBRATE_MAX_QB + 1U;
+        calibration.amortizeGates[i] = (real1)std::numeric_limits<float>::max();
+    }
+    return calibration;
+#endif
+}
+
 QHybrid::QHybrid(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp, complex phaseFac, bool doNorm,
     bool randomGlobalPhase, bool useHostMem, int deviceId, bool useHardwareRNG, bool useSparseStateVec,
     real1 norm_thresh, std::vector<int> ignored, bitLenInt qubitThreshold)
@@ -25,13 +291,20 @@ QHybrid::QHybrid(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rg
     , useHostRam(useHostMem)
     , useRDRAND(useHardwareRNG)
     , isSparse(useSparseStateVec)
+    , isGpu(false)
+    , isThresholdCalibrated(qubitThreshold == 0)
+    , gateClass(HYBRID_GATE_SINGLE)
+    , expectedDepth(0)
 {
     concurrency = std::thread::hardware_concurrency();
-    thresholdQubits = (qubitThreshold != 0)
-        ? qubitThreshold
-        : (concurrency == 1 ? PSTRIDEPOW : (log2(concurrency - 1) + PSTRIDEPOW + 1));
-    isGpu = (qubitCount >= thresholdQubits);
-    engine = MakeEngine(qubitCount >= thresholdQubits, initState);
+    if (isThresholdCalibrated) {
+        calibration = QHybridCalibration::Get(devID);
+        thresholdQubits = calibration.crossoverQb[gateClass];
+    } else {
+        thresholdQubits = qubitThreshold;
+    }
+    isGpu = IsGpuBetter(qubitCount);
+    engine = MakeEngine(isGpu, initState);
 }
 
 QEnginePtr QHybrid::MakeEngine(bool isOpenCL, bitCapInt initState)
@@ -47,8 +320,11 @@ QInterfacePtr QHybrid::Clone()
 {
     QHybridPtr c = std::dynamic_pointer_cast<QHybrid>(CreateQuantumInterface(QINTERFACE_HYBRID, qubitCount, 0,
         rand_generator, phaseFactor, doNormalize, randGlobalPhase, useHostRam, devID, useRDRAND, isSparse,
-        amplitudeFloor, std::vector<int>{}, thresholdQubits));
+        amplitudeFloor, std::vector<int>{}, isThresholdCalibrated ? 0 : thresholdQubits));
     c->SetConcurrency(concurrency);
+    c->SetGateClass(gateClass);
+    c->SetExpectedDepth(expectedDepth);
+    c->SwitchModes(isGpu);
     c->engine->CopyStateVec(engine);
     return c;
 }
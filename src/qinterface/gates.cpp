@@ -272,6 +272,67 @@ void QInterface::CIPhaseRootN(bitLenInt n, bitLenInt control, bitLenInt target)
     ApplyControlledSinglePhase(controls, 1, target, ONE_CMPLX, pow(-ONE_CMPLX, -ONE_R1 / (bitCapIntOcl)(pow2(n - 1U))));
 }
 
+void QInterface::ApplySingleBitBatch(const complex* mtrxs, const bitLenInt* qubits, const bitCapIntOcl& count)
+{
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        ApplySingleBit(mtrxs + 4U * i, qubits[i]);
+    }
+}
+
+void QInterface::ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    if ((targetLen < 2U) || (targetLen > 4U)) {
+        throw std::invalid_argument("ApplyNxN() requires between 1 and 4 target qubits.");
+    }
+
+    // This general implementation round-trips the full state vector, for engines without a native dense block kernel.
+    bitCapIntOcl nPower = pow2Ocl(targetLen);
+    bitCapInt targetMask = 0;
+    std::vector<bitCapIntOcl> offsets(nPower, 0);
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        bitCapInt qPower = pow2(targets[i]);
+        if (targetMask & qPower) {
+            throw std::invalid_argument("ApplyNxN() target qubits must be unique.");
+        }
+        targetMask |= qPower;
+        for (bitCapIntOcl j = 0; j < nPower; j++) {
+            if ((j >> i) & 1U) {
+                offsets[j] |= (bitCapIntOcl)qPower;
+            }
+        }
+    }
+
+    bitCapIntOcl maxQPowerOcl = (bitCapIntOcl)maxQPower;
+    complex* stateVec = new complex[maxQPowerOcl];
+    GetQuantumState(stateVec);
+
+    std::vector<complex> amps(nPower);
+    for (bitCapIntOcl lcv = 0; lcv < maxQPowerOcl; lcv++) {
+        if (lcv & (bitCapIntOcl)targetMask) {
+            continue;
+        }
+
+        for (bitCapIntOcl j = 0; j < nPower; j++) {
+            amps[j] = stateVec[lcv | offsets[j]];
+        }
+        for (bitCapIntOcl j = 0; j < nPower; j++) {
+            complex amp = ZERO_CMPLX;
+            for (bitCapIntOcl k = 0; k < nPower; k++) {
+                amp += mtrx[(j * nPower) + k] * amps[k];
+            }
+            stateVec[lcv | offsets[j]] = amp;
+        }
+    }
+
+    SetQuantumState(stateVec);
+    delete[] stateVec;
+}
+
 void QInterface::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
     bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
     const bitCapInt& mtrxSkipValueMask)
@@ -300,50 +361,7 @@ void QInterface::TimeEvolve(Hamiltonian h, real1 timeDiff)
     // Exponentiation of an arbitrary serial string of gates, each HamiltonianOp component times timeDiff, e^(-i * H *
     // t) as e^(-i * H_(N - 1) * t) * e^(-i * H_(N - 2) * t) * ... e^(-i * H_0 * t)
 
-    for (bitLenInt i = 0; i < h.size(); i++) {
-        HamiltonianOpPtr op = h[i];
-        complex* opMtrx = op->matrix.get();
-        complex* mtrx;
-
-        bitCapIntOcl maxJ = 4;
-        if (op->uniform) {
-            maxJ *= pow2Ocl(op->controlLen);
-        }
-        mtrx = new complex[maxJ];
-
-        for (bitCapIntOcl j = 0; j < maxJ; j++) {
-            mtrx[j] = opMtrx[j] * (-timeDiff);
-        }
-
-        if (op->toggles) {
-            for (bitLenInt j = 0; j < op->controlLen; j++) {
-                if (op->toggles[j]) {
-                    X(op->controls[j]);
-                }
-            }
-        }
-
-        if (op->uniform) {
-            complex* expMtrx = new complex[maxJ];
-            for (bitCapIntOcl j = 0; j < pow2(op->controlLen); j++) {
-                exp2x2(mtrx + (j * 4U), expMtrx + (j * 4U));
-            }
-            UniformlyControlledSingleBit(op->controls, op->controlLen, op->targetBit, expMtrx);
-            delete[] expMtrx;
-        } else {
-            Exp(op->controls, op->controlLen, op->targetBit, mtrx, op->anti);
-        }
-
-        if (op->toggles) {
-            for (bitLenInt j = 0; j < op->controlLen; j++) {
-                if (op->toggles[j]) {
-                    X(op->controls[j]);
-                }
-            }
-        }
-
-        delete[] mtrx;
-    }
+    CompiledHamiltonian(h, timeDiff).Evolve(*this);
 }
 
 } // namespace Qrack
@@ -103,11 +103,13 @@ void _expLog2x2(complex* matrix2x2, complex* outMatrix2x2, bool isExp)
         complex eigenvalue1 = (trace + quadraticRoot) / (real1)2.0;
         complex eigenvalue2 = (trace - quadraticRoot) / (real1)2.0;
 
-        jacobian[0] = matrix2x2[0] - eigenvalue1;
+        // By Cayley-Hamilton, (M - eigenvalue1) * (M - eigenvalue2) = 0, so the columns of (M - eigenvalue2) are
+        // eigenvectors for eigenvalue1, and vice versa.
+        jacobian[0] = matrix2x2[0] - eigenvalue2;
         jacobian[2] = matrix2x2[2];
 
         jacobian[1] = matrix2x2[1];
-        jacobian[3] = matrix2x2[3] - eigenvalue2;
+        jacobian[3] = matrix2x2[3] - eigenvalue1;
 
         expOfGate[0] = eigenvalue1;
         expOfGate[1] = complex(ZERO_R1, ZERO_R1);
@@ -10,8 +10,13 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
+
 #include "qinterface.hpp"
 
+// Random numbers that multi-shot sampling draws at a time
+#define QRACK_SHOT_RAND_BATCH 256U
+
 namespace Qrack {
 
 #define REG_GATE_1(gate)                                                                                               \
@@ -548,6 +553,32 @@ void QInterface::IQFT(bitLenInt start, bitLenInt length, bool trySeparate)
     }
 }
 
+/// Lock a view of a copy of the state, (written back on release, if writable)
+QStateViewPtr QInterface::LockStateView(bool isWritable)
+{
+    const bitCapIntOcl length = (bitCapIntOcl)maxQPower;
+    std::shared_ptr<complex> copy(new complex[length], std::default_delete<complex[]>());
+    GetQuantumState(copy.get());
+
+    if (!isWritable) {
+        return QStateViewPtr(new QStateView(copy.get(), length, false, [copy] {}));
+    }
+
+    return QStateViewPtr(new QStateView(copy.get(), length, true, [this, copy] { SetQuantumState(copy.get()); }));
+}
+
+/// Grover diffusion - Reflection about the uniform superposition of the register
+void QInterface::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    H(start, length);
+    ZeroPhaseFlip(start, length);
+    H(start, length);
+}
+
 /// Set register bits to given permutation
 void QInterface::SetReg(bitLenInt start, bitLenInt length, bitCapInt value)
 {
@@ -622,6 +653,36 @@ real1 QInterface::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
     return prob;
 }
 
+void QInterface::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    // H * S^dagger maps the Y eigenbasis to the Z eigenbasis, as H alone does for X.
+    const complex yToZ[4] = { complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, -M_SQRT1_2), complex(M_SQRT1_2, ZERO_R1),
+        complex(ZERO_R1, M_SQRT1_2) };
+
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        const bitCapInt xMask = terms[i].xMask;
+        const bitCapInt zMask = terms[i].zMask;
+
+        if (!xMask) {
+            expectations[i] = ONE_R1 - 2 * ProbParity(zMask);
+            continue;
+        }
+
+        QInterfacePtr copy = Clone();
+        for (bitLenInt j = 0; j < qubitCount; j++) {
+            if (!((xMask >> j) & ONE_BCI)) {
+                continue;
+            }
+            if ((zMask >> j) & ONE_BCI) {
+                copy->ApplySingleBit(yToZ, j);
+            } else {
+                copy->H(j);
+            }
+        }
+        expectations[i] = ONE_R1 - 2 * copy->ProbParity(xMask | zMask);
+    }
+}
+
 /// "Circular shift right" - (Uses swap-based algorithm for speed)
 void QInterface::ROL(bitLenInt shift, bitLenInt start, bitLenInt length)
 {
@@ -691,6 +752,44 @@ void QInterface::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
     }
 }
 
+// Vose's alias method: after O(n) setup, every sample costs one table column and one coin flip.
+static void BuildAliasTable(
+    const real1* probsArray, const bitCapIntOcl& count, const real1& totProb, real1* cutoffs, bitCapIntOcl* aliases)
+{
+    std::vector<bitCapIntOcl> small, large;
+    bitCapIntOcl j;
+    for (j = 0; j < count; j++) {
+        cutoffs[j] = probsArray[j] * (real1)count / totProb;
+        aliases[j] = j;
+        if (cutoffs[j] < ONE_R1) {
+            small.push_back(j);
+        } else {
+            large.push_back(j);
+        }
+    }
+
+    while (small.size() && large.size()) {
+        bitCapIntOcl lesser = small.back();
+        small.pop_back();
+        bitCapIntOcl greater = large.back();
+
+        aliases[lesser] = greater;
+        cutoffs[greater] -= ONE_R1 - cutoffs[lesser];
+        if (cutoffs[greater] < ONE_R1) {
+            large.pop_back();
+            small.push_back(greater);
+        }
+    }
+
+    // Whatever is left over is only off from 1 by rounding error.
+    for (j = 0; j < small.size(); j++) {
+        cutoffs[small[j]] = ONE_R1;
+    }
+    for (j = 0; j < large.size(); j++) {
+        cutoffs[large[j]] = ONE_R1;
+    }
+}
+
 std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
     const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots)
 {
@@ -705,7 +804,7 @@ std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
     }
 
     std::sort(qPowersSorted, qPowersSorted + qPowerCount);
-    std::map<bitLenInt, bitCapInt> maskMap;
+    std::vector<bitCapInt> maskMap(qPowerCount);
     for (bitLenInt k = 0; k < qPowerCount; k++) {
         for (i = 0; i < qPowerCount; i++) {
             if (qPowersSorted[k] == qPowers[i]) {
@@ -714,40 +813,100 @@ std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
             }
         }
     }
+    delete[] qPowersSorted;
 
+    // The state is read exactly once, here. Every shot after this only touches the table.
     bitCapIntOcl subsetCap = pow2Ocl(qPowerCount);
     real1* probsArray = new real1[subsetCap];
     ProbMaskAll(mask, probsArray);
 
-    real1 totProb = 0;
+    real1 totProb = ZERO_R1;
     for (j = 0; j < subsetCap; j++) {
         totProb += probsArray[j];
     }
 
-    std::map<bitCapInt, int> results;
-    real1 maskProb, cumProb;
-    bitCapInt key;
-    for (unsigned int shot = 0; shot < shots; shot++) {
-        maskProb = Rand();
-        cumProb = ZERO_R1;
-        for (j = 0; j < subsetCap; j++) {
-            cumProb += probsArray[j];
-            if ((maskProb < cumProb) || (cumProb >= totProb)) {
-                key = 0;
-                for (i = 0; i < qPowerCount; i++) {
-                    if (j & pow2(i)) {
-                        key |= maskMap[i];
-                    }
+    std::map<bitCapIntOcl, int> subsetResults;
+    if (totProb <= ZERO_R1) {
+        // Nothing to sample from; (this matches what a linear search of the table would return.)
+        subsetResults[0] = (int)shots;
+    } else if (shots > subsetCap) {
+        // With more shots than table entries, the O(1) alias method pays for its more expensive setup.
+        real1* cutoffs = new real1[subsetCap];
+        bitCapIntOcl* aliases = new bitCapIntOcl[subsetCap];
+        BuildAliasTable(probsArray, subsetCap, totProb, cutoffs, aliases);
+
+        // Random numbers are drawn a batch at a time, two per shot.
+        real1 rands[2U * QRACK_SHOT_RAND_BATCH];
+        for (unsigned int shot = 0; shot < shots; shot += QRACK_SHOT_RAND_BATCH) {
+            const unsigned int batch = std::min(shots - shot, (unsigned int)QRACK_SHOT_RAND_BATCH);
+            FillRand(rands, 2U * batch);
+            for (unsigned int k = 0; k < batch; k++) {
+                j = (bitCapIntOcl)(rands[2U * k] * (real1)subsetCap);
+                if (j >= subsetCap) {
+                    j = subsetCap - ONE_BCI;
                 }
-                results[key]++;
-                break;
+                subsetResults[(rands[2U * k + 1U] < cutoffs[j]) ? j : aliases[j]]++;
+            }
+        }
+
+        delete[] cutoffs;
+        delete[] aliases;
+    } else {
+        // Otherwise, binary search the cumulative distribution.
+        for (j = 1; j < subsetCap; j++) {
+            probsArray[j] += probsArray[j - 1U];
+        }
+        totProb = probsArray[subsetCap - 1U];
+        // If rounding pushes a sample to the very top, it belongs to the last permutation with nonzero probability.
+        bitCapIntOcl lastNonzero = std::lower_bound(probsArray, probsArray + subsetCap, totProb) - probsArray;
+
+        real1 rands[QRACK_SHOT_RAND_BATCH];
+        for (unsigned int shot = 0; shot < shots; shot += QRACK_SHOT_RAND_BATCH) {
+            const unsigned int batch = std::min(shots - shot, (unsigned int)QRACK_SHOT_RAND_BATCH);
+            FillRand(rands, batch);
+            for (unsigned int k = 0; k < batch; k++) {
+                j = std::upper_bound(probsArray, probsArray + subsetCap, rands[k] * totProb) - probsArray;
+                subsetResults[(j < subsetCap) ? j : lastNonzero]++;
             }
         }
     }
 
     delete[] probsArray;
 
+    std::map<bitCapInt, int> results;
+    bitCapInt key;
+    for (auto it = subsetResults.begin(); it != subsetResults.end(); it++) {
+        key = 0;
+        for (i = 0; i < qPowerCount; i++) {
+            if (it->first & pow2Ocl(i)) {
+                key |= maskMap[i];
+            }
+        }
+        results[key] = it->second;
+    }
+
     return results;
 }
 
+void QInterface::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    std::unique_ptr<complex[]> stateVec(new complex[(bitCapIntOcl)maxQPower]);
+    GetQuantumState(stateVec.get());
+
+    writer.WriteAmplitudes(qubitCount, [&](complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+        std::copy(stateVec.get() + offset, stateVec.get() + offset + length, pagePtr);
+    });
+}
+
+void QInterface::ReadCheckpoint(QCheckpointReader& reader)
+{
+    std::unique_ptr<complex[]> stateVec(new complex[(bitCapIntOcl)maxQPower]);
+
+    reader.ReadAmplitudes(
+        qubitCount, [&](const complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+            std::copy(pagePtr, pagePtr + length, stateVec.get() + offset);
+        });
+
+    SetQuantumState(stateVec.get());
+}
 } // namespace Qrack
@@ -0,0 +1,960 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// QMPIPager splits a QEngine instance into pages of contiguous amplitudes, one on each MPI rank.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+
+#include "qfactory.hpp"
+
+#define IS_NORM_0(c) (c == ZERO_CMPLX)
+
+#if ENABLE_COMPLEX8
+#define MPI_REAL1 MPI_FLOAT
+#else
+#define MPI_REAL1 MPI_DOUBLE
+#endif
+
+namespace Qrack {
+
+QMPIPager::QMPIPager(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp,
+    complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceId, bool useHardwareRNG,
+    bool useSparseStateVec, real1 norm_thresh, std::vector<int> devList, bitLenInt qubitThreshold)
+    : QInterface(qBitCount, rgp, doNorm, false, randomGlobalPhase, norm_thresh)
+    , engine(eng)
+    , devID(deviceId)
+    , phaseFactor(phaseFac)
+    , useHostRam(useHostMem)
+    , isSparse(useSparseStateVec)
+    , deviceIDs(devList)
+    , minQubitsPerPage(qubitThreshold ? qubitThreshold : QRACK_MPI_MIN_PAGE_QB)
+    , comm(GetComm())
+{
+    if ((engine != QINTERFACE_CPU) && (engine != QINTERFACE_OPENCL)) {
+        throw std::invalid_argument("QMPIPager sub-engine type must be QINTERFACE_CPU or QINTERFACE_OPENCL.");
+    }
+
+    concurrency = std::thread::hardware_concurrency();
+
+    if (deviceIDs.size() == 0) {
+        deviceIDs.push_back(devID);
+    }
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &rankCount);
+    rankPower = log2((bitCapInt)rankCount);
+    if (pow2Ocl(rankPower) != (bitCapIntOcl)rankCount) {
+        throw std::invalid_argument("QMPIPager needs a power of 2 count of MPI ranks.");
+    }
+
+    // Every rank draws the same random numbers, from rank 0's seed, (so hardware generation is never used).
+    uint32_t seed = rgp ? (uint32_t)(*rgp)() : (uint32_t)std::time(0);
+    MPI_Bcast(&seed, 1, MPI_UINT32_T, 0, comm);
+    rand_generator = std::make_shared<qrack_rand_gen>();
+    rand_generator->seed(seed);
+
+    SetPermutation(initState, phaseFactor);
+}
+
+MPI_Comm QMPIPager::GetComm()
+{
+    // All instances share one communicator, (apart from the program's own,) since every rank makes the same calls.
+    static MPI_Comm pagerComm = MPI_COMM_NULL;
+    if (pagerComm != MPI_COMM_NULL) {
+        return pagerComm;
+    }
+
+    int isInitialized;
+    MPI_Initialized(&isInitialized);
+    if (!isInitialized) {
+        int provided;
+        MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+        std::atexit([]() {
+            int isFinalized;
+            MPI_Finalized(&isFinalized);
+            if (!isFinalized) {
+                MPI_Finalize();
+            }
+        });
+    }
+
+    MPI_Comm_dup(MPI_COMM_WORLD, &pagerComm);
+    return pagerComm;
+}
+
+QEnginePtr QMPIPager::MakeEngine(bitLenInt length, bitCapInt perm, bool doNorm)
+{
+    // Page engines must never independently normalize or drop "global" phase, since neither is global to one page.
+    QEnginePtr toRet = std::dynamic_pointer_cast<QEngine>(
+        CreateQuantumInterface(engine, length, perm, rand_generator, ONE_CMPLX, doNorm, false, useHostRam,
+            deviceIDs[rank % deviceIDs.size()], false, isSparse, amplitudeFloor));
+    toRet->SetConcurrency(concurrency);
+    return toRet;
+}
+
+void QMPIPager::SetLayout()
+{
+    metaQubits = (qubitCount > minQubitsPerPage) ? (qubitCount - minQubitsPerPage) : 0U;
+    if (metaQubits > rankPower) {
+        metaQubits = rankPower;
+    }
+    qubitsPerPage = qubitCount - metaQubits;
+}
+
+real1 QMPIPager::SumPages(real1 localValue)
+{
+    if (!metaQubits) {
+        // Every rank holds the whole register.
+        return localValue;
+    }
+
+    // Only the first copy of each page counts.
+    real1 value = (rank < (int)pageCount()) ? localValue : ZERO_R1;
+    real1 total;
+    MPI_Allreduce(&value, &total, 1, MPI_REAL1, MPI_SUM, comm);
+
+    return total;
+}
+
+void QMPIPager::BcastPage(bitCapIntOcl page, std::function<void(const complex*, bitCapIntOcl, bitCapIntOcl)> sink)
+{
+    const bitCapIntOcl pagePow = pagePower();
+    const bitCapIntOcl chunk = std::min(pagePow, (bitCapIntOcl)QRACK_MPI_CHUNK_AMPS);
+    std::unique_ptr<complex[]> buffer(new complex[chunk]);
+
+    for (bitCapIntOcl offset = 0; offset < pagePow; offset += chunk) {
+        if (!metaQubits || (rank == (int)page)) {
+            qPage->GetAmplitudePage(buffer.get(), offset, chunk);
+        }
+        if (metaQubits) {
+            MPI_Bcast(buffer.get(), (int)(chunk * sizeof(complex)), MPI_BYTE, (int)page, comm);
+        }
+        sink(buffer.get(), page * pagePow + offset, chunk);
+    }
+}
+
+void QMPIPager::ExchangePages(int partner)
+{
+    const bitCapIntOcl pagePow = pagePower();
+    const bitCapIntOcl chunk = std::min(pagePow, (bitCapIntOcl)QRACK_MPI_CHUNK_AMPS);
+    std::unique_ptr<complex[]> buffer(new complex[chunk]);
+
+    for (bitCapIntOcl offset = 0; offset < pagePow; offset += chunk) {
+        qPage->GetAmplitudePage(buffer.get(), offset, chunk);
+        MPI_Sendrecv_replace(buffer.get(), (int)(chunk * sizeof(complex)), MPI_BYTE, partner, 0, partner, 0, comm,
+            MPI_STATUS_IGNORE);
+        qPage->SetAmplitudePage(buffer.get(), offset, chunk);
+    }
+}
+
+void QMPIPager::ExchangeAndApply(
+    bitLenInt metaTarget, const complex* mtrx, const std::vector<bitLenInt>& controls, bool isAnti)
+{
+    const bitCapIntOcl targetPow = pow2Ocl(metaTarget);
+    const int partner = rank ^ (int)targetPow;
+
+    // Each rank only computes its own half of the product, from its amplitudes and its partner's.
+    const bool isHigh = (pageIndex() & targetPow) != 0;
+    const complex myFactor = isHigh ? mtrx[3] : mtrx[0];
+    const complex partnerFactor = isHigh ? mtrx[2] : mtrx[1];
+
+    bitCapIntOcl controlMask = 0;
+    for (size_t i = 0; i < controls.size(); i++) {
+        controlMask |= pow2Ocl(controls[i]);
+    }
+    const bitCapIntOcl controlPerm = isAnti ? 0 : controlMask;
+
+    const bitCapIntOcl pagePow = pagePower();
+    const bitCapIntOcl chunk = std::min(pagePow, (bitCapIntOcl)QRACK_MPI_CHUNK_AMPS);
+    const bitCapIntOcl chunkCount = pagePow / chunk;
+    const int chunkBytes = (int)(chunk * sizeof(complex));
+    std::unique_ptr<complex[]> myAmps(new complex[2U * chunk]);
+    std::unique_ptr<complex[]> partnerAmps(new complex[2U * chunk]);
+    MPI_Request requests[2][2];
+
+    // Double buffered, so that chunk "c + 1" is in flight while chunk "c" is applied
+    auto post = [&](bitCapIntOcl c) {
+        const bitCapIntOcl slot = (c & 1U) * chunk;
+        qPage->GetAmplitudePage(myAmps.get() + slot, c * chunk, chunk);
+        MPI_Irecv(partnerAmps.get() + slot, chunkBytes, MPI_BYTE, partner, 0, comm, &(requests[c & 1U][0]));
+        MPI_Isend(myAmps.get() + slot, chunkBytes, MPI_BYTE, partner, 0, comm, &(requests[c & 1U][1]));
+    };
+
+    post(0);
+    for (bitCapIntOcl c = 0; c < chunkCount; c++) {
+        if ((c + 1U) < chunkCount) {
+            post(c + 1U);
+        }
+        MPI_Waitall(2, requests[c & 1U], MPI_STATUSES_IGNORE);
+
+        complex* amps = myAmps.get() + (c & 1U) * chunk;
+        const complex* partnerChunk = partnerAmps.get() + (c & 1U) * chunk;
+        const bitCapIntOcl offset = c * chunk;
+        for (bitCapIntOcl i = 0; i < chunk; i++) {
+            if (((offset + i) & controlMask) == controlPerm) {
+                amps[i] = myFactor * amps[i] + partnerFactor * partnerChunk[i];
+            }
+        }
+        qPage->SetAmplitudePage(amps, offset, chunk);
+    }
+}
+
+void QMPIPager::ScalePage(complex scale)
+{
+    if (scale == ONE_CMPLX) {
+        return;
+    }
+
+    if (IS_NORM_0(scale)) {
+        qPage->ZeroAmplitudes();
+        return;
+    }
+
+    // An empty mask selects every amplitude.
+    qPage->ApplyM((bitCapInt)0U, (bitCapInt)0U, scale);
+}
+
+real1 QMPIPager::PageNorm()
+{
+    qPage->UpdateRunningNorm();
+    return qPage->GetRunningNorm();
+}
+
+QEnginePtr QMPIPager::CombineEngines()
+{
+    if (!metaQubits) {
+        return qPage;
+    }
+
+    QEnginePtr nEngine = MakeEngine(qubitCount, 0, doNormalize);
+    for (bitCapIntOcl i = 0; i < pageCount(); i++) {
+        BcastPage(i, [&](const complex* amps, bitCapIntOcl offset, bitCapIntOcl length) {
+            nEngine->SetAmplitudePage(amps, offset, length);
+        });
+    }
+
+    if (doNormalize) {
+        // Pages don't track the norm of the whole register, so the combined engine has to measure it.
+        nEngine->UpdateRunningNorm();
+    }
+
+    return nEngine;
+}
+
+void QMPIPager::SeparateEngines(QEnginePtr combined)
+{
+    SetLayout();
+
+    if (!metaQubits) {
+        qPage = combined;
+        return;
+    }
+
+    // The combined engine might have deferred normalization, which must be settled before its norm is split up.
+    if (doNormalize) {
+        combined->NormalizeState();
+    }
+
+    qPage = MakeEngine(qubitsPerPage, 0);
+    qPage->SetAmplitudePage(combined, pageIndex() * pagePower(), 0, pagePower());
+}
+
+void QMPIPager::CombineAndOp(std::function<void(QEnginePtr)> fn)
+{
+    QEnginePtr combined = CombineEngines();
+    fn(combined);
+    SeparateEngines(combined);
+}
+
+void QMPIPager::SetRandomSeed(uint32_t seed)
+{
+    MPI_Bcast(&seed, 1, MPI_UINT32_T, 0, comm);
+    rand_generator->seed(seed);
+}
+
+void QMPIPager::SetQuantumState(const complex* inputState)
+{
+    qPage->SetAmplitudePage(inputState + pageIndex() * pagePower(), 0, pagePower());
+}
+
+void QMPIPager::GetQuantumState(complex* outputState)
+{
+    for (bitCapIntOcl i = 0; i < pageCount(); i++) {
+        BcastPage(i, [&](const complex* amps, bitCapIntOcl offset, bitCapIntOcl length) {
+            std::copy(amps, amps + length, outputState + offset);
+        });
+    }
+}
+
+void QMPIPager::GetProbs(real1* outputProbs)
+{
+    for (bitCapIntOcl i = 0; i < pageCount(); i++) {
+        BcastPage(i, [&](const complex* amps, bitCapIntOcl offset, bitCapIntOcl length) {
+            std::transform(amps, amps + length, outputProbs + offset, normHelper);
+        });
+    }
+}
+
+complex QMPIPager::GetAmplitude(bitCapInt perm)
+{
+    if (!metaQubits) {
+        return qPage->GetAmplitude(perm);
+    }
+
+    const bitCapIntOcl pagePow = pagePower();
+    const int page = (int)((bitCapIntOcl)perm / pagePow);
+    complex amp;
+    if (rank == page) {
+        amp = qPage->GetAmplitude((bitCapIntOcl)perm & (pagePow - ONE_BCI));
+    }
+    MPI_Bcast(&amp, (int)sizeof(complex), MPI_BYTE, page, comm);
+
+    return amp;
+}
+
+void QMPIPager::SetAmplitude(bitCapInt perm, complex amp)
+{
+    const bitCapIntOcl pagePow = pagePower();
+    if (pageIndex() == ((bitCapIntOcl)perm / pagePow)) {
+        qPage->SetAmplitude((bitCapIntOcl)perm & (pagePow - ONE_BCI), amp);
+    }
+}
+
+void QMPIPager::SetPermutation(bitCapInt perm, complex phaseFac)
+{
+    if (phaseFac == CMPLX_DEFAULT_ARG) {
+        if (randGlobalPhase) {
+            real1 angle = Rand() * 2 * PI_R1;
+            phaseFac = complex(cos(angle), sin(angle));
+        } else {
+            phaseFac = ONE_CMPLX;
+        }
+    }
+
+    SetLayout();
+    const bitCapIntOcl pagePow = pagePower();
+
+    qPage = MakeEngine(qubitsPerPage, 0);
+    if (pageIndex() == ((bitCapIntOcl)perm / pagePow)) {
+        qPage->SetPermutation((bitCapIntOcl)perm & (pagePow - ONE_BCI), phaseFac);
+    } else {
+        qPage->ZeroAmplitudes();
+    }
+}
+
+bitLenInt QMPIPager::Compose(QMPIPagerPtr toCopy)
+{
+    QEnginePtr combined = CombineEngines();
+    QEnginePtr toCopyCombined = toCopy->CombineEngines();
+    bitLenInt toRet = combined->Compose(toCopyCombined);
+    SetQubitCount(qubitCount + toCopy->qubitCount);
+    SeparateEngines(combined);
+
+    return toRet;
+}
+
+bitLenInt QMPIPager::Compose(QMPIPagerPtr toCopy, bitLenInt start)
+{
+    QEnginePtr combined = CombineEngines();
+    QEnginePtr toCopyCombined = toCopy->CombineEngines();
+    bitLenInt toRet = combined->Compose(toCopyCombined, start);
+    SetQubitCount(qubitCount + toCopy->qubitCount);
+    SeparateEngines(combined);
+
+    return toRet;
+}
+
+void QMPIPager::Decompose(bitLenInt start, QMPIPagerPtr dest)
+{
+    QEnginePtr combined = CombineEngines();
+    QEnginePtr destCombined = dest->CombineEngines();
+    combined->Decompose(start, destCombined);
+    SetQubitCount(qubitCount - dest->qubitCount);
+    dest->SeparateEngines(destCombined);
+    SeparateEngines(combined);
+}
+
+void QMPIPager::Dispose(bitLenInt start, bitLenInt length)
+{
+    QEnginePtr combined = CombineEngines();
+    combined->Dispose(start, length);
+    SetQubitCount(qubitCount - length);
+    SeparateEngines(combined);
+}
+
+void QMPIPager::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm)
+{
+    QEnginePtr combined = CombineEngines();
+    combined->Dispose(start, length, disposedPerm);
+    SetQubitCount(qubitCount - length);
+    SeparateEngines(combined);
+}
+
+void QMPIPager::ApplySingleBit(const complex* mtrx, bitLenInt target)
+{
+    ApplyDistributedControlled(NULL, 0, target, mtrx, false);
+}
+
+void QMPIPager::ApplyControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    ApplyDistributedControlled(controls, controlLen, target, mtrx, false);
+}
+
+void QMPIPager::ApplyAntiControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    ApplyDistributedControlled(controls, controlLen, target, mtrx, true);
+}
+
+void QMPIPager::ApplyDistributedControlled(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex* mtrx, bool isAnti)
+{
+    // Controls on meta-qubits select which ranks take part at all, (on which a rank and its partner always agree).
+    std::vector<bitLenInt> intraControls;
+    bitCapIntOcl metaMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        if (controls[i] < qubitsPerPage) {
+            intraControls.push_back(controls[i]);
+        } else {
+            metaMask |= pow2Ocl(controls[i] - qubitsPerPage);
+        }
+    }
+    const bitCapIntOcl metaPerm = isAnti ? 0 : metaMask;
+    if ((pageIndex() & metaMask) != metaPerm) {
+        return;
+    }
+
+    if (target < qubitsPerPage) {
+        if (intraControls.size() == 0) {
+            qPage->ApplySingleBit(mtrx, target);
+        } else if (isAnti) {
+            qPage->ApplyAntiControlledSingleBit(&(intraControls[0]), intraControls.size(), target, mtrx);
+        } else {
+            qPage->ApplyControlledSingleBit(&(intraControls[0]), intraControls.size(), target, mtrx);
+        }
+        return;
+    }
+
+    const bitLenInt metaTarget = target - qubitsPerPage;
+    if (!IS_NORM_0(mtrx[1]) || !IS_NORM_0(mtrx[2])) {
+        ExchangeAndApply(metaTarget, mtrx, intraControls, isAnti);
+        return;
+    }
+
+    // A phase gate on a meta-qubit scales each page, (or is a phase gate on its last local control).
+    const complex phase = (pageIndex() & pow2Ocl(metaTarget)) ? mtrx[3] : mtrx[0];
+    if (intraControls.size() == 0) {
+        ScalePage(phase);
+        return;
+    }
+
+    const bitLenInt last = intraControls.back();
+    intraControls.pop_back();
+    const bitLenInt* others = intraControls.size() ? &(intraControls[0]) : NULL;
+    if (isAnti) {
+        qPage->ApplyAntiControlledSinglePhase(others, intraControls.size(), last, phase, ONE_CMPLX);
+    } else {
+        qPage->ApplyControlledSinglePhase(others, intraControls.size(), last, ONE_CMPLX, phase);
+    }
+}
+
+void QMPIPager::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+    bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+    const bitCapInt& mtrxSkipValueMask)
+{
+    bool isLocal = qubitIndex < qubitsPerPage;
+    for (bitLenInt i = 0; isLocal && (i < controlLen); i++) {
+        isLocal = controls[i] < qubitsPerPage;
+    }
+    for (bitLenInt i = 0; isLocal && (i < mtrxSkipLen); i++) {
+        isLocal = mtrxSkipPowers[i] < pagePower();
+    }
+
+    if (isLocal) {
+        qPage->UniformlyControlledSingleBit(
+            controls, controlLen, qubitIndex, mtrxs, mtrxSkipPowers, mtrxSkipLen, mtrxSkipValueMask);
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->UniformlyControlledSingleBit(
+            controls, controlLen, qubitIndex, mtrxs, mtrxSkipPowers, mtrxSkipLen, mtrxSkipValueMask);
+    });
+}
+
+void QMPIPager::UniformParityRZ(const bitCapInt& mask, const real1& angle)
+{
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & (pagePower() - ONE_BCI);
+    bitCapIntOcl metaParity = pageIndex() & ((bitCapIntOcl)mask >> qubitsPerPage);
+    bool isOdd = false;
+    while (metaParity) {
+        metaParity &= metaParity - ONE_BCI;
+        isOdd = !isOdd;
+    }
+
+    if (intraMask) {
+        // Odd meta-qubit parity reverses the sense of the local parity.
+        qPage->UniformParityRZ(intraMask, isOdd ? -angle : angle);
+    } else {
+        ScalePage(isOdd ? complex(cos(angle), sin(angle)) : complex(cos(angle), -sin(angle)));
+    }
+}
+
+void QMPIPager::CUniformParityRZ(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CUniformParityRZ(controls, controlLen, mask, angle); });
+}
+
+void QMPIPager::CSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QMPIPager::AntiCSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QMPIPager::CSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CSqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QMPIPager::AntiCSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCSqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QMPIPager::CISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CISqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QMPIPager::AntiCISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCISqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+bool QMPIPager::ForceM(bitLenInt qubit, bool result, bool doForce, bool doApply)
+{
+    real1 oneChance = Prob(qubit);
+    if (!doForce) {
+        if (oneChance >= ONE_R1) {
+            result = true;
+        } else if (oneChance <= ZERO_R1) {
+            result = false;
+        } else {
+            result = (Rand() <= oneChance);
+        }
+
+        if (metaQubits) {
+            // The summed chance might not round the same way on every rank, so rank 0 decides.
+            int resultInt = result ? 1 : 0;
+            MPI_Bcast(&resultInt, 1, MPI_INT, 0, comm);
+            result = (resultInt != 0);
+        }
+    }
+
+    real1 nrmlzr = result ? oneChance : (ONE_R1 - oneChance);
+    if (nrmlzr <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
+    }
+
+    if (!doApply) {
+        return result;
+    }
+
+    complex nrm = ONE_CMPLX;
+    if (randGlobalPhase) {
+        real1 angle = Rand() * 2 * PI_R1;
+        nrm = complex(cos(angle), sin(angle));
+    }
+    nrm /= (real1)(std::sqrt(nrmlzr));
+
+    if (qubit < qubitsPerPage) {
+        qPage->ApplyM(pow2(qubit), result, nrm);
+    } else if (((pageIndex() & pow2Ocl(qubit - qubitsPerPage)) != 0) == result) {
+        ScalePage(nrm);
+    } else {
+        qPage->ZeroAmplitudes();
+    }
+
+    return result;
+}
+
+void QMPIPager::INC(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    if (IsLocalRange(start, length)) {
+        qPage->INC(toAdd, start, length);
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) { engine->INC(toAdd, start, length); });
+}
+void QMPIPager::CINC(
+    bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CINC(toAdd, inOutStart, length, controls, controlLen); });
+}
+void QMPIPager::INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCC(toAdd, start, length, carryIndex); });
+}
+void QMPIPager::INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCS(toAdd, start, length, overflowIndex); });
+}
+void QMPIPager::INCSC(
+    bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCSC(toAdd, start, length, overflowIndex, carryIndex); });
+}
+void QMPIPager::INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCSC(toAdd, start, length, carryIndex); });
+}
+void QMPIPager::INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCBCD(toAdd, start, length); });
+}
+void QMPIPager::INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCBCDC(toAdd, start, length, carryIndex); });
+}
+void QMPIPager::DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECC(toSub, start, length, carryIndex); });
+}
+void QMPIPager::DECSC(
+    bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECSC(toSub, start, length, overflowIndex, carryIndex); });
+}
+void QMPIPager::DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECSC(toSub, start, length, carryIndex); });
+}
+void QMPIPager::DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECBCDC(toSub, start, length, carryIndex); });
+}
+void QMPIPager::MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->MUL(toMul, inOutStart, carryStart, length); });
+}
+void QMPIPager::DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DIV(toDiv, inOutStart, carryStart, length); });
+}
+void QMPIPager::MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->MULModNOut(toMul, modN, inStart, outStart, length); });
+}
+void QMPIPager::IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->IMULModNOut(toMul, modN, inStart, outStart, length); });
+}
+void QMPIPager::POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->POWModNOut(base, modN, inStart, outStart, length); });
+}
+void QMPIPager::CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp(
+        [&](QEnginePtr engine) { engine->CMUL(toMul, inOutStart, carryStart, length, controls, controlLen); });
+}
+void QMPIPager::CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp(
+        [&](QEnginePtr engine) { engine->CDIV(toDiv, inOutStart, carryStart, length, controls, controlLen); });
+}
+void QMPIPager::CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart,
+    bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+void QMPIPager::CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart,
+    bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CIMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+void QMPIPager::CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart,
+    bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CPOWModNOut(base, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+
+void QMPIPager::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ZeroPhaseFlip(start, length); });
+}
+void QMPIPager::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CPhaseFlipIfLess(greaterPerm, start, length, flagIndex); });
+}
+void QMPIPager::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->PhaseFlipIfLess(greaterPerm, start, length); });
+}
+void QMPIPager::PhaseFlip()
+{
+    // As in QEngine implementations, this is only "book-keeping" if global phase is not randomized.
+    if (randGlobalPhase) {
+        return;
+    }
+
+    qPage->PhaseFlip();
+}
+
+bitCapInt QMPIPager::IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, unsigned char* values, bool resetValue)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedLDA(indexStart, indexLength, valueStart, valueLength, values, resetValue);
+    });
+
+    return toRet;
+}
+
+bitCapInt QMPIPager::IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedADC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+    });
+
+    return toRet;
+}
+
+bitCapInt QMPIPager::IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedSBC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+    });
+
+    return toRet;
+}
+
+void QMPIPager::Hash(bitLenInt start, bitLenInt length, unsigned char* values)
+{
+    if (IsLocalRange(start, length)) {
+        qPage->Hash(start, length, values);
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) { engine->Hash(start, length, values); });
+}
+
+void QMPIPager::QFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    // A register within the local page is transformed in place on every rank, and otherwise, gate by gate.
+    if (!IsLocalRange(start, length)) {
+        QInterface::QFT(start, length, trySeparate);
+        return;
+    }
+
+    qPage->QFT(start, length, trySeparate);
+}
+
+void QMPIPager::IQFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    if (!IsLocalRange(start, length)) {
+        QInterface::IQFT(start, length, trySeparate);
+        return;
+    }
+
+    qPage->IQFT(start, length, trySeparate);
+}
+
+void QMPIPager::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    // A register within the local page is reflected in place on every rank, and otherwise, gate by gate.
+    if (!IsLocalRange(start, length)) {
+        QInterface::GroverDiffusion(start, length);
+        return;
+    }
+
+    qPage->GroverDiffusion(start, length);
+}
+
+void QMPIPager::Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    if (qubitIndex1 == qubitIndex2) {
+        return;
+    }
+
+    if ((qubitIndex1 < qubitsPerPage) && (qubitIndex2 < qubitsPerPage)) {
+        qPage->Swap(qubitIndex1, qubitIndex2);
+        return;
+    }
+
+    if ((qubitIndex1 >= qubitsPerPage) && (qubitIndex2 >= qubitsPerPage)) {
+        // Swapping two meta-qubits only trades pages between ranks that differ in both.
+        bitCapIntOcl qPower1 = pow2Ocl(qubitIndex1 - qubitsPerPage);
+        bitCapIntOcl qPower2 = pow2Ocl(qubitIndex2 - qubitsPerPage);
+        if (((pageIndex() & qPower1) != 0) != ((pageIndex() & qPower2) != 0)) {
+            ExchangePages(rank ^ (int)(qPower1 | qPower2));
+        }
+        return;
+    }
+
+    // Of the three CNOT gates, only the one that targets the meta-qubit exchanges amplitudes.
+    const complex pauliX[4] = { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX };
+    ApplyDistributedControlled(&qubitIndex1, 1U, qubitIndex2, pauliX, false);
+    ApplyDistributedControlled(&qubitIndex2, 1U, qubitIndex1, pauliX, false);
+    ApplyDistributedControlled(&qubitIndex1, 1U, qubitIndex2, pauliX, false);
+}
+void QMPIPager::ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ISwap(qubitIndex1, qubitIndex2); });
+}
+void QMPIPager::SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->SqrtSwap(qubitIndex1, qubitIndex2); });
+}
+void QMPIPager::ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ISqrtSwap(qubitIndex1, qubitIndex2); });
+}
+void QMPIPager::FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->FSim(theta, phi, qubitIndex1, qubitIndex2); });
+}
+
+real1 QMPIPager::Prob(bitLenInt qubitIndex)
+{
+    real1 oneChance;
+    if (qubitIndex < qubitsPerPage) {
+        oneChance = qPage->Prob(qubitIndex);
+    } else {
+        oneChance = (pageIndex() & pow2Ocl(qubitIndex - qubitsPerPage)) ? PageNorm() : ZERO_R1;
+    }
+
+    return clampProb(SumPages(oneChance));
+}
+
+real1 QMPIPager::ProbAll(bitCapInt fullRegister)
+{
+    if (!metaQubits) {
+        return qPage->ProbAll(fullRegister);
+    }
+
+    const bitCapIntOcl pagePow = pagePower();
+    const int page = (int)((bitCapIntOcl)fullRegister / pagePow);
+    real1 prob;
+    if (rank == page) {
+        prob = qPage->ProbAll((bitCapIntOcl)fullRegister & (pagePow - ONE_BCI));
+    }
+    MPI_Bcast(&prob, 1, MPI_REAL1, page, comm);
+
+    return prob;
+}
+
+real1 QMPIPager::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
+{
+    bitCapIntOcl pageMask = pagePower() - ONE_BCI;
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & pageMask;
+    bitCapIntOcl intraPerm = (bitCapIntOcl)permutation & pageMask;
+    bitCapIntOcl metaMask = (bitCapIntOcl)mask >> qubitsPerPage;
+    bitCapIntOcl metaPerm = (bitCapIntOcl)permutation >> qubitsPerPage;
+
+    real1 maskChance = ZERO_R1;
+    if ((pageIndex() & metaMask) == metaPerm) {
+        maskChance = intraMask ? qPage->ProbMask(intraMask, intraPerm) : PageNorm();
+    }
+
+    return clampProb(SumPages(maskChance));
+}
+
+real1 QMPIPager::ProbParity(const bitCapInt& mask)
+{
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & (pagePower() - ONE_BCI);
+    bitCapIntOcl metaParity = pageIndex() & ((bitCapIntOcl)mask >> qubitsPerPage);
+    bool isOdd = false;
+    while (metaParity) {
+        metaParity &= metaParity - ONE_BCI;
+        isOdd = !isOdd;
+    }
+
+    real1 oddChance = intraMask ? qPage->ProbParity(intraMask) : ZERO_R1;
+    if (isOdd) {
+        oddChance = PageNorm() - oddChance;
+    }
+
+    return clampProb(SumPages(oddChance));
+}
+
+void QMPIPager::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    // (Nothing changes, so the combined engine is just dropped afterward.)
+    CombineEngines()->ExpectationPauliStrings(terms, termCount, expectations);
+}
+
+bool QMPIPager::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
+{
+    bool toRet;
+    CombineAndOp([&](QEnginePtr engine) { toRet = engine->ForceMParity(mask, result, doForce); });
+
+    return toRet;
+}
+
+bool QMPIPager::ApproxCompare(QInterfacePtr toCompare)
+{
+    QMPIPagerPtr toComparePager = std::dynamic_pointer_cast<QMPIPager>(toCompare);
+    return CombineEngines()->ApproxCompare(toComparePager->CombineEngines());
+}
+
+void QMPIPager::UpdateRunningNorm(real1 norm_thresh) { qPage->UpdateRunningNorm(norm_thresh); }
+
+void QMPIPager::NormalizeState(real1 nrm, real1 norm_thresh)
+{
+    if (nrm < ZERO_R1) {
+        nrm = SumPages(PageNorm());
+    }
+
+    if ((nrm <= ZERO_R1) || (nrm == ONE_R1)) {
+        return;
+    }
+
+    // Every page is scaled against the norm of the whole register, rather than its own.
+    qPage->NormalizeState(nrm, norm_thresh);
+}
+
+QInterfacePtr QMPIPager::Clone()
+{
+    QMPIPagerPtr clone = std::make_shared<QMPIPager>(engine, qubitCount, 0, rand_generator, ONE_CMPLX, doNormalize,
+        randGlobalPhase, useHostRam, devID, false, isSparse, amplitudeFloor, deviceIDs, minQubitsPerPage);
+    clone->SetConcurrency(concurrency);
+    clone->qPage->SetAmplitudePage(qPage, 0, 0, pagePower());
+
+    return clone;
+}
+} // namespace Qrack
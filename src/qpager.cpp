@@ -0,0 +1,999 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// QPager breaks a QEngine instance into pages of contiguous amplitudes.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <thread>
+
+#include "qfactory.hpp"
+#include "qpager.hpp"
+
+#define IS_NORM_0(c) (c == ZERO_CMPLX)
+
+namespace Qrack {
+
+QPager::QPager(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp,
+    complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceId, bool useHardwareRNG,
+    bool useSparseStateVec, real1 norm_thresh, std::vector<int> devList, bitLenInt qubitThreshold)
+    : QInterface(qBitCount, rgp, doNorm, useHardwareRNG, randomGlobalPhase, norm_thresh)
+    , engine(eng)
+    , devID(deviceId)
+    , phaseFactor(phaseFac)
+    , useHostRam(useHostMem)
+    , useRDRAND(useHardwareRNG)
+    , isSparse(useSparseStateVec)
+    , deviceIDs(devList)
+{
+    if ((engine != QINTERFACE_CPU) && (engine != QINTERFACE_OPENCL)) {
+        throw std::invalid_argument("QPager sub-engine type must be QINTERFACE_CPU or QINTERFACE_OPENCL.");
+    }
+
+    concurrency = std::thread::hardware_concurrency();
+
+    if (deviceIDs.size() == 0) {
+        deviceIDs.push_back(devID);
+    }
+
+    if (qubitThreshold != 0) {
+        baseQubitsPerPage = qubitThreshold;
+    } else {
+        // By default, split the register evenly across the requested devices.
+        bitLenInt devPow = log2((bitCapInt)deviceIDs.size());
+        baseQubitsPerPage = (qubitCount > devPow) ? (qubitCount - devPow) : 1U;
+#if ENABLE_OPENCL
+        if (engine == QINTERFACE_OPENCL) {
+            // No page may exceed the maximum single allocation size of the smallest device.
+            for (bitCapIntOcl i = 0; i < deviceIDs.size(); i++) {
+                DeviceContextPtr devContext = OCLEngine::Instance()->GetDeviceContextPtr(deviceIDs[i]);
+                bitCapIntOcl maxAllocAmps =
+                    devContext->device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / sizeof(complex);
+                bitLenInt maxAllocPow = log2(maxAllocAmps);
+                if (maxAllocPow < baseQubitsPerPage) {
+                    baseQubitsPerPage = maxAllocPow;
+                }
+            }
+        }
+#endif
+    }
+
+    if (baseQubitsPerPage < 1U) {
+        throw std::invalid_argument("QPager must have at least 1 qubit per page.");
+    }
+
+    SetPermutation(initState, phaseFactor);
+}
+
+QEnginePtr QPager::MakeEngine(bitLenInt length, bitCapInt perm, int deviceId, bool doNorm)
+{
+    // Page engines must never independently normalize or drop "global" phase, since neither is global to one page.
+    QEnginePtr toRet = std::dynamic_pointer_cast<QEngine>(CreateQuantumInterface(engine, length, perm, rand_generator,
+        ONE_CMPLX, doNorm, false, useHostRam, deviceId, useRDRAND, isSparse, amplitudeFloor));
+    toRet->SetConcurrency(concurrency);
+    return toRet;
+}
+
+void QPager::CopyPage(
+    QEnginePtr src, bitCapIntOcl srcOffset, QEnginePtr dest, bitCapIntOcl destOffset, bitCapIntOcl length)
+{
+    if (src->GetDeviceID() == dest->GetDeviceID()) {
+        dest->SetAmplitudePage(src, srcOffset, destOffset, length);
+        return;
+    }
+
+    complex* buffer = new complex[length];
+    src->GetAmplitudePage(buffer, srcOffset, length);
+    dest->SetAmplitudePage(buffer, destOffset, length);
+    delete[] buffer;
+}
+
+void QPager::ShufflePages(QEnginePtr low, QEnginePtr high)
+{
+    if (low->GetDeviceID() == high->GetDeviceID()) {
+        low->ShuffleBuffers(high);
+        return;
+    }
+
+    bitCapIntOcl halfPower = pagePower() >> ONE_BCI;
+    complex* lowBuffer = new complex[halfPower];
+    complex* highBuffer = new complex[halfPower];
+    low->GetAmplitudePage(lowBuffer, halfPower, halfPower);
+    high->GetAmplitudePage(highBuffer, 0, halfPower);
+    low->SetAmplitudePage(highBuffer, halfPower, halfPower);
+    high->SetAmplitudePage(lowBuffer, 0, halfPower);
+    delete[] lowBuffer;
+    delete[] highBuffer;
+}
+
+void QPager::ScalePage(QEnginePtr page, complex scale)
+{
+    if (scale == ONE_CMPLX) {
+        return;
+    }
+
+    if (IS_NORM_0(scale)) {
+        page->ZeroAmplitudes();
+        return;
+    }
+
+    // An empty mask selects every amplitude.
+    page->ApplyM((bitCapInt)0U, (bitCapInt)0U, scale);
+}
+
+real1 QPager::PageNorm(QEnginePtr page)
+{
+    page->UpdateRunningNorm();
+    return page->GetRunningNorm();
+}
+
+void QPager::CombineEngines()
+{
+    if (qPages.size() == 1U) {
+        return;
+    }
+
+    QEnginePtr nEngine = MakeEngine(qubitCount, 0, deviceIDs[0], doNormalize);
+    bitCapIntOcl pagePow = pagePower();
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        CopyPage(qPages[i], 0, nEngine, i * pagePow, pagePow);
+    }
+
+    if (doNormalize) {
+        // Pages don't track the norm of the whole register, so the combined engine has to measure it.
+        nEngine->UpdateRunningNorm();
+    }
+
+    qPages.clear();
+    qPages.push_back(nEngine);
+    qubitsPerPage = qubitCount;
+}
+
+void QPager::SeparateEngines()
+{
+    bitLenInt nQubitsPerPage = (qubitCount < baseQubitsPerPage) ? qubitCount : baseQubitsPerPage;
+
+    if (nQubitsPerPage == qubitCount) {
+        qubitsPerPage = qubitCount;
+        if (qPages[0]->GetQubitCount() == qubitCount) {
+            return;
+        }
+    }
+
+    CombineEngines();
+
+    // The combined engine might have deferred normalization, which must be settled before its norm is split up.
+    if (doNormalize) {
+        qPages[0]->NormalizeState();
+    }
+
+    bitCapIntOcl nPageCount = pow2Ocl(qubitCount - nQubitsPerPage);
+    bitCapIntOcl nPagePow = pow2Ocl(nQubitsPerPage);
+    std::vector<QEnginePtr> nPages;
+    for (bitCapIntOcl i = 0; i < nPageCount; i++) {
+        nPages.push_back(MakeEngine(nQubitsPerPage, 0, deviceIDs[i % deviceIDs.size()]));
+        CopyPage(qPages[0], i * nPagePow, nPages[i], 0, nPagePow);
+    }
+
+    qPages = nPages;
+    qubitsPerPage = nQubitsPerPage;
+}
+
+void QPager::CombineAndOp(std::function<void(QEnginePtr)> fn)
+{
+    CombineEngines();
+    fn(qPages[0]);
+    SeparateEngines();
+}
+
+void QPager::SetQuantumState(const complex* inputState)
+{
+    bitCapIntOcl pagePow = pagePower();
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->SetAmplitudePage(inputState + i * pagePow, 0, pagePow);
+    }
+}
+
+void QPager::GetQuantumState(complex* outputState)
+{
+    bitCapIntOcl pagePow = pagePower();
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->GetAmplitudePage(outputState + i * pagePow, 0, pagePow);
+    }
+}
+
+// Checkpoint chunks are the same layout as a whole state vector, so they're read out of and written into each page that
+// they span, (which is several pages, if pages are narrower than a chunk).
+void QPager::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    bitCapIntOcl pagePow = pagePower();
+    writer.WriteAmplitudes(qubitCount, [&](complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+        bitCapIntOcl partLength;
+        for (bitCapIntOcl i = 0; i < length; i += partLength) {
+            bitCapIntOcl pageOffset = (offset + i) & (pagePow - ONE_BCI);
+            partLength = std::min(length - i, pagePow - pageOffset);
+            qPages[(offset + i) / pagePow]->GetAmplitudePage(pagePtr + i, pageOffset, partLength);
+        }
+    });
+}
+
+void QPager::ReadCheckpoint(QCheckpointReader& reader)
+{
+    bitCapIntOcl pagePow = pagePower();
+    reader.ReadAmplitudes(
+        qubitCount, [&](const complex* pagePtr, const bitCapIntOcl offset, const bitCapIntOcl length) {
+            bitCapIntOcl partLength;
+            for (bitCapIntOcl i = 0; i < length; i += partLength) {
+                bitCapIntOcl pageOffset = (offset + i) & (pagePow - ONE_BCI);
+                partLength = std::min(length - i, pagePow - pageOffset);
+                qPages[(offset + i) / pagePow]->SetAmplitudePage(pagePtr + i, pageOffset, partLength);
+            }
+        });
+}
+
+void QPager::GetProbs(real1* outputProbs)
+{
+    bitCapIntOcl pagePow = pagePower();
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->GetProbs(outputProbs + i * pagePow);
+    }
+}
+
+complex QPager::GetAmplitude(bitCapInt perm)
+{
+    bitCapIntOcl pagePow = pagePower();
+    return qPages[(bitCapIntOcl)perm / pagePow]->GetAmplitude((bitCapIntOcl)perm & (pagePow - ONE_BCI));
+}
+
+void QPager::SetAmplitude(bitCapInt perm, complex amp)
+{
+    bitCapIntOcl pagePow = pagePower();
+    qPages[(bitCapIntOcl)perm / pagePow]->SetAmplitude((bitCapIntOcl)perm & (pagePow - ONE_BCI), amp);
+}
+
+void QPager::SetPermutation(bitCapInt perm, complex phaseFac)
+{
+    if (phaseFac == CMPLX_DEFAULT_ARG) {
+        if (randGlobalPhase) {
+            real1 angle = Rand() * 2 * PI_R1;
+            phaseFac = complex(cos(angle), sin(angle));
+        } else {
+            phaseFac = ONE_CMPLX;
+        }
+    }
+
+    qubitsPerPage = (qubitCount < baseQubitsPerPage) ? qubitCount : baseQubitsPerPage;
+    bitCapIntOcl nPageCount = pow2Ocl(qubitCount - qubitsPerPage);
+    bitCapIntOcl pagePow = pagePower();
+    bitCapIntOcl permPage = (bitCapIntOcl)perm / pagePow;
+
+    qPages.clear();
+    for (bitCapIntOcl i = 0; i < nPageCount; i++) {
+        qPages.push_back(MakeEngine(qubitsPerPage, 0, deviceIDs[i % deviceIDs.size()]));
+        if (i == permPage) {
+            qPages[i]->SetPermutation((bitCapIntOcl)perm & (pagePow - ONE_BCI), phaseFac);
+        } else {
+            qPages[i]->ZeroAmplitudes();
+        }
+    }
+}
+
+bitLenInt QPager::Compose(QPagerPtr toCopy)
+{
+    CombineEngines();
+    toCopy->CombineEngines();
+    bitLenInt toRet = qPages[0]->Compose(toCopy->qPages[0]);
+    SetQubitCount(qubitCount + toCopy->qubitCount);
+    toCopy->SeparateEngines();
+    SeparateEngines();
+
+    return toRet;
+}
+
+bitLenInt QPager::Compose(QPagerPtr toCopy, bitLenInt start)
+{
+    CombineEngines();
+    toCopy->CombineEngines();
+    bitLenInt toRet = qPages[0]->Compose(toCopy->qPages[0], start);
+    SetQubitCount(qubitCount + toCopy->qubitCount);
+    toCopy->SeparateEngines();
+    SeparateEngines();
+
+    return toRet;
+}
+
+void QPager::Decompose(bitLenInt start, QPagerPtr dest)
+{
+    CombineEngines();
+    dest->CombineEngines();
+    qPages[0]->Decompose(start, dest->qPages[0]);
+    SetQubitCount(qubitCount - dest->qubitCount);
+    dest->SeparateEngines();
+    SeparateEngines();
+}
+
+void QPager::Dispose(bitLenInt start, bitLenInt length)
+{
+    CombineEngines();
+    qPages[0]->Dispose(start, length);
+    SetQubitCount(qubitCount - length);
+    SeparateEngines();
+}
+
+void QPager::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm)
+{
+    CombineEngines();
+    qPages[0]->Dispose(start, length, disposedPerm);
+    SetQubitCount(qubitCount - length);
+    SeparateEngines();
+}
+
+void QPager::ApplySingleBit(const complex* mtrx, bitLenInt target)
+{
+    if (IS_NORM_0(mtrx[1]) && IS_NORM_0(mtrx[2])) {
+        ApplySinglePhase(mtrx[0], mtrx[3], target);
+        return;
+    }
+
+    if (IS_NORM_0(mtrx[0]) && IS_NORM_0(mtrx[3])) {
+        ApplySingleInvert(mtrx[1], mtrx[2], target);
+        return;
+    }
+
+    ApplyPagedControlled(NULL, 0, target, mtrx, false);
+}
+
+void QPager::ApplySinglePhase(const complex topLeft, const complex bottomRight, bitLenInt target)
+{
+    bitCapIntOcl i;
+
+    if (target < qubitsPerPage) {
+        for (i = 0; i < qPages.size(); i++) {
+            qPages[i]->ApplySinglePhase(topLeft, bottomRight, target);
+        }
+        return;
+    }
+
+    // A phase gate on a meta-qubit is a scalar multiplication of each page.
+    bitCapIntOcl targetPow = pow2Ocl(target - qubitsPerPage);
+    for (i = 0; i < qPages.size(); i++) {
+        ScalePage(qPages[i], (i & targetPow) ? bottomRight : topLeft);
+    }
+}
+
+void QPager::ApplySingleInvert(const complex topRight, const complex bottomLeft, bitLenInt target)
+{
+    bitCapIntOcl i;
+
+    if (target < qubitsPerPage) {
+        for (i = 0; i < qPages.size(); i++) {
+            qPages[i]->ApplySingleInvert(topRight, bottomLeft, target);
+        }
+        return;
+    }
+
+    // An inversion on a meta-qubit just exchanges which pages hold which amplitudes.
+    bitCapIntOcl targetPow = pow2Ocl(target - qubitsPerPage);
+    for (i = 0; i < qPages.size(); i++) {
+        if (i & targetPow) {
+            continue;
+        }
+        std::swap(qPages[i], qPages[i | targetPow]);
+        ScalePage(qPages[i], topRight);
+        ScalePage(qPages[i | targetPow], bottomLeft);
+    }
+}
+
+void QPager::ApplyControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    if (controlLen == 0) {
+        ApplySingleBit(mtrx, target);
+        return;
+    }
+
+    ApplyPagedControlled(controls, controlLen, target, mtrx, false);
+}
+
+void QPager::ApplyAntiControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    if (controlLen == 0) {
+        ApplySingleBit(mtrx, target);
+        return;
+    }
+
+    ApplyPagedControlled(controls, controlLen, target, mtrx, true);
+}
+
+void QPager::ApplyPagedControlled(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target,
+    const complex* mtrx, bool isAnti)
+{
+    bitCapIntOcl i;
+
+    // Controls on meta-qubits select which pages (or pairs of pages) participate at all.
+    std::vector<bitLenInt> intraControls;
+    bitCapIntOcl metaMask = 0;
+    for (i = 0; i < controlLen; i++) {
+        if (controls[i] < qubitsPerPage) {
+            intraControls.push_back(controls[i]);
+        } else {
+            metaMask |= pow2Ocl(controls[i] - qubitsPerPage);
+        }
+    }
+    bitCapIntOcl metaPerm = isAnti ? 0 : metaMask;
+
+    auto applyLocal = [&](QEnginePtr page, bitLenInt localTarget) {
+        if (intraControls.size() == 0) {
+            page->ApplySingleBit(mtrx, localTarget);
+        } else if (isAnti) {
+            page->ApplyAntiControlledSingleBit(&(intraControls[0]), intraControls.size(), localTarget, mtrx);
+        } else {
+            page->ApplyControlledSingleBit(&(intraControls[0]), intraControls.size(), localTarget, mtrx);
+        }
+    };
+
+    if (target < qubitsPerPage) {
+        for (i = 0; i < qPages.size(); i++) {
+            if ((i & metaMask) == metaPerm) {
+                applyLocal(qPages[i], target);
+            }
+        }
+        return;
+    }
+
+    // After ShufflePages(), the highest local qubit of each page in a pair stands in for the meta-qubit target.
+    bitLenInt sqi = qubitsPerPage - 1U;
+    if (std::find(intraControls.begin(), intraControls.end(), sqi) != intraControls.end()) {
+        std::vector<bitLenInt> allControls(controls, controls + controlLen);
+        CombineAndOp([&](QEnginePtr e) {
+            if (isAnti) {
+                e->ApplyAntiControlledSingleBit(&(allControls[0]), controlLen, target, mtrx);
+            } else {
+                e->ApplyControlledSingleBit(&(allControls[0]), controlLen, target, mtrx);
+            }
+        });
+        return;
+    }
+
+    bitCapIntOcl targetPow = pow2Ocl(target - qubitsPerPage);
+    for (i = 0; i < qPages.size(); i++) {
+        if ((i & targetPow) || ((i & metaMask) != metaPerm)) {
+            continue;
+        }
+
+        QEnginePtr engine1 = qPages[i];
+        QEnginePtr engine2 = qPages[i | targetPow];
+
+        ShufflePages(engine1, engine2);
+        applyLocal(engine1, sqi);
+        applyLocal(engine2, sqi);
+        ShufflePages(engine1, engine2);
+    }
+}
+
+void QPager::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+    bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+    const bitCapInt& mtrxSkipValueMask)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->UniformlyControlledSingleBit(
+            controls, controlLen, qubitIndex, mtrxs, mtrxSkipPowers, mtrxSkipLen, mtrxSkipValueMask);
+    });
+}
+
+void QPager::UniformParityRZ(const bitCapInt& mask, const real1& angle)
+{
+    bitCapIntOcl pageMask = pagePower() - ONE_BCI;
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & pageMask;
+    bitCapIntOcl metaMask = (bitCapIntOcl)mask >> qubitsPerPage;
+    complex phaseFac(cos(angle), sin(angle));
+    complex phaseFacAdj(cos(angle), -sin(angle));
+
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        bitCapIntOcl metaParity = i & metaMask;
+        bool isOdd = false;
+        while (metaParity) {
+            metaParity &= metaParity - ONE_BCI;
+            isOdd = !isOdd;
+        }
+
+        if (intraMask) {
+            // Odd meta-qubit parity reverses the sense of the local parity.
+            qPages[i]->UniformParityRZ(intraMask, isOdd ? -angle : angle);
+        } else {
+            ScalePage(qPages[i], isOdd ? phaseFac : phaseFacAdj);
+        }
+    }
+}
+
+void QPager::CUniformParityRZ(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CUniformParityRZ(controls, controlLen, mask, angle); });
+}
+
+void QPager::CSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QPager::AntiCSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QPager::CSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CSqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QPager::AntiCSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCSqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QPager::CISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CISqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+void QPager::AntiCISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->AntiCISqrtSwap(controls, controlLen, qubit1, qubit2); });
+}
+
+bool QPager::ForceM(bitLenInt qubit, bool result, bool doForce, bool doApply)
+{
+    real1 oneChance = Prob(qubit);
+    if (!doForce) {
+        if (oneChance >= ONE_R1) {
+            result = true;
+        } else if (oneChance <= ZERO_R1) {
+            result = false;
+        } else {
+            result = (Rand() <= oneChance);
+        }
+    }
+
+    real1 nrmlzr = result ? oneChance : (ONE_R1 - oneChance);
+    if (nrmlzr <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
+    }
+
+    if (!doApply) {
+        return result;
+    }
+
+    complex nrm = ONE_CMPLX;
+    if (randGlobalPhase) {
+        real1 angle = Rand() * 2 * PI_R1;
+        nrm = complex(cos(angle), sin(angle));
+    }
+    nrm /= (real1)(std::sqrt(nrmlzr));
+
+    bitCapIntOcl i;
+    if (qubit < qubitsPerPage) {
+        bitCapInt qPower = pow2(qubit);
+        for (i = 0; i < qPages.size(); i++) {
+            qPages[i]->ApplyM(qPower, result, nrm);
+        }
+    } else {
+        bitCapIntOcl qPower = pow2Ocl(qubit - qubitsPerPage);
+        for (i = 0; i < qPages.size(); i++) {
+            if (((i & qPower) != 0) == result) {
+                ScalePage(qPages[i], nrm);
+            } else {
+                qPages[i]->ZeroAmplitudes();
+            }
+        }
+    }
+
+    return result;
+}
+
+void QPager::INC(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    if (IsLocalRange(start, length)) {
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            qPages[i]->INC(toAdd, start, length);
+        }
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) { engine->INC(toAdd, start, length); });
+}
+void QPager::CINC(bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CINC(toAdd, inOutStart, length, controls, controlLen); });
+}
+void QPager::INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCC(toAdd, start, length, carryIndex); });
+}
+void QPager::INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCS(toAdd, start, length, overflowIndex); });
+}
+void QPager::INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCSC(toAdd, start, length, overflowIndex, carryIndex); });
+}
+void QPager::INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCSC(toAdd, start, length, carryIndex); });
+}
+void QPager::INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCBCD(toAdd, start, length); });
+}
+void QPager::INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->INCBCDC(toAdd, start, length, carryIndex); });
+}
+void QPager::DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECC(toSub, start, length, carryIndex); });
+}
+void QPager::DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECSC(toSub, start, length, overflowIndex, carryIndex); });
+}
+void QPager::DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECSC(toSub, start, length, carryIndex); });
+}
+void QPager::DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DECBCDC(toSub, start, length, carryIndex); });
+}
+void QPager::MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->MUL(toMul, inOutStart, carryStart, length); });
+}
+void QPager::DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->DIV(toDiv, inOutStart, carryStart, length); });
+}
+void QPager::MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->MULModNOut(toMul, modN, inStart, outStart, length); });
+}
+void QPager::IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->IMULModNOut(toMul, modN, inStart, outStart, length); });
+}
+void QPager::POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->POWModNOut(base, modN, inStart, outStart, length); });
+}
+void QPager::CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length, bitLenInt* controls,
+    bitLenInt controlLen)
+{
+    CombineAndOp(
+        [&](QEnginePtr engine) { engine->CMUL(toMul, inOutStart, carryStart, length, controls, controlLen); });
+}
+void QPager::CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length, bitLenInt* controls,
+    bitLenInt controlLen)
+{
+    CombineAndOp(
+        [&](QEnginePtr engine) { engine->CDIV(toDiv, inOutStart, carryStart, length, controls, controlLen); });
+}
+void QPager::CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+void QPager::CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CIMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+void QPager::CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    CombineAndOp([&](QEnginePtr engine) {
+        engine->CPOWModNOut(base, modN, inStart, outStart, length, controls, controlLen);
+    });
+}
+
+void QPager::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ZeroPhaseFlip(start, length); });
+}
+void QPager::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->CPhaseFlipIfLess(greaterPerm, start, length, flagIndex); });
+}
+void QPager::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->PhaseFlipIfLess(greaterPerm, start, length); });
+}
+void QPager::PhaseFlip()
+{
+    // As in QEngine implementations, this is only "book-keeping" if global phase is not randomized.
+    if (randGlobalPhase) {
+        return;
+    }
+
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->PhaseFlip();
+    }
+}
+
+bitCapInt QPager::IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, unsigned char* values, bool resetValue)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedLDA(indexStart, indexLength, valueStart, valueLength, values, resetValue);
+    });
+
+    return toRet;
+}
+
+bitCapInt QPager::IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedADC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+    });
+
+    return toRet;
+}
+
+bitCapInt QPager::IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    bitCapInt toRet;
+    CombineAndOp([&](QEnginePtr engine) {
+        toRet = engine->IndexedSBC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+    });
+
+    return toRet;
+}
+
+void QPager::Hash(bitLenInt start, bitLenInt length, unsigned char* values)
+{
+    if (IsLocalRange(start, length)) {
+        for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+            qPages[i]->Hash(start, length, values);
+        }
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) { engine->Hash(start, length, values); });
+}
+
+void QPager::QFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    // A register within every page is transformed independently in each, and otherwise, gate by gate.
+    if (!IsLocalRange(start, length)) {
+        QInterface::QFT(start, length, trySeparate);
+        return;
+    }
+
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->QFT(start, length, trySeparate);
+    }
+}
+
+void QPager::IQFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    if (!IsLocalRange(start, length)) {
+        QInterface::IQFT(start, length, trySeparate);
+        return;
+    }
+
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->IQFT(start, length, trySeparate);
+    }
+}
+
+void QPager::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    // The register sums of a register within every page are independent in each.
+    if (!IsLocalRange(start, length)) {
+        CombineAndOp([&](QEnginePtr engine) { engine->GroverDiffusion(start, length); });
+        return;
+    }
+
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->GroverDiffusion(start, length);
+    }
+}
+
+void QPager::Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    if (qubitIndex1 == qubitIndex2) {
+        return;
+    }
+
+    bitCapIntOcl i;
+
+    if ((qubitIndex1 < qubitsPerPage) && (qubitIndex2 < qubitsPerPage)) {
+        for (i = 0; i < qPages.size(); i++) {
+            qPages[i]->Swap(qubitIndex1, qubitIndex2);
+        }
+        return;
+    }
+
+    if ((qubitIndex1 >= qubitsPerPage) && (qubitIndex2 >= qubitsPerPage)) {
+        // Swapping two meta-qubits only relabels pages.
+        bitCapIntOcl qPower1 = pow2Ocl(qubitIndex1 - qubitsPerPage);
+        bitCapIntOcl qPower2 = pow2Ocl(qubitIndex2 - qubitsPerPage);
+        for (i = 0; i < qPages.size(); i++) {
+            if ((i & qPower1) && !(i & qPower2)) {
+                std::swap(qPages[i], qPages[(i ^ qPower1) | qPower2]);
+            }
+        }
+        return;
+    }
+
+    CombineAndOp([&](QEnginePtr engine) { engine->Swap(qubitIndex1, qubitIndex2); });
+}
+void QPager::ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ISwap(qubitIndex1, qubitIndex2); });
+}
+void QPager::SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->SqrtSwap(qubitIndex1, qubitIndex2); });
+}
+void QPager::ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ISqrtSwap(qubitIndex1, qubitIndex2); });
+}
+void QPager::FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->FSim(theta, phi, qubitIndex1, qubitIndex2); });
+}
+
+real1 QPager::Prob(bitLenInt qubitIndex)
+{
+    real1 oneChance = ZERO_R1;
+    bitCapIntOcl i;
+
+    if (qubitIndex < qubitsPerPage) {
+        for (i = 0; i < qPages.size(); i++) {
+            oneChance += qPages[i]->Prob(qubitIndex);
+        }
+    } else {
+        bitCapIntOcl qPower = pow2Ocl(qubitIndex - qubitsPerPage);
+        for (i = 0; i < qPages.size(); i++) {
+            if (i & qPower) {
+                oneChance += PageNorm(qPages[i]);
+            }
+        }
+    }
+
+    return clampProb(oneChance);
+}
+
+real1 QPager::ProbAll(bitCapInt fullRegister)
+{
+    bitCapIntOcl pagePow = pagePower();
+    return qPages[(bitCapIntOcl)fullRegister / pagePow]->ProbAll((bitCapIntOcl)fullRegister & (pagePow - ONE_BCI));
+}
+
+real1 QPager::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
+{
+    bitCapIntOcl pageMask = pagePower() - ONE_BCI;
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & pageMask;
+    bitCapIntOcl intraPerm = (bitCapIntOcl)permutation & pageMask;
+    bitCapIntOcl metaMask = (bitCapIntOcl)mask >> qubitsPerPage;
+    bitCapIntOcl metaPerm = (bitCapIntOcl)permutation >> qubitsPerPage;
+
+    real1 maskChance = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        if ((i & metaMask) != metaPerm) {
+            continue;
+        }
+        maskChance += intraMask ? qPages[i]->ProbMask(intraMask, intraPerm) : PageNorm(qPages[i]);
+    }
+
+    return clampProb(maskChance);
+}
+
+real1 QPager::ProbParity(const bitCapInt& mask)
+{
+    bitCapIntOcl intraMask = (bitCapIntOcl)mask & (pagePower() - ONE_BCI);
+    bitCapIntOcl metaMask = (bitCapIntOcl)mask >> qubitsPerPage;
+
+    real1 oddChance = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        bitCapIntOcl metaParity = i & metaMask;
+        bool isOdd = false;
+        while (metaParity) {
+            metaParity &= metaParity - ONE_BCI;
+            isOdd = !isOdd;
+        }
+
+        real1 localOddChance = intraMask ? qPages[i]->ProbParity(intraMask) : ZERO_R1;
+        oddChance += isOdd ? (PageNorm(qPages[i]) - localOddChance) : localOddChance;
+    }
+
+    return clampProb(oddChance);
+}
+
+void QPager::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    CombineAndOp([&](QEnginePtr engine) { engine->ExpectationPauliStrings(terms, termCount, expectations); });
+}
+
+bool QPager::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
+{
+    bool toRet;
+    CombineAndOp([&](QEnginePtr engine) { toRet = engine->ForceMParity(mask, result, doForce); });
+
+    return toRet;
+}
+
+bool QPager::ApproxCompare(QInterfacePtr toCompare)
+{
+    QPagerPtr toComparePager = std::dynamic_pointer_cast<QPager>(toCompare);
+    CombineEngines();
+    toComparePager->CombineEngines();
+    bool toRet = qPages[0]->ApproxCompare(toComparePager->qPages[0]);
+    toComparePager->SeparateEngines();
+    SeparateEngines();
+
+    return toRet;
+}
+
+void QPager::UpdateRunningNorm(real1 norm_thresh)
+{
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        qPages[i]->UpdateRunningNorm(norm_thresh);
+    }
+}
+
+void QPager::NormalizeState(real1 nrm, real1 norm_thresh)
+{
+    bitCapIntOcl i;
+
+    if (nrm < ZERO_R1) {
+        nrm = ZERO_R1;
+        for (i = 0; i < qPages.size(); i++) {
+            nrm += PageNorm(qPages[i]);
+        }
+    }
+
+    if ((nrm <= ZERO_R1) || (nrm == ONE_R1)) {
+        return;
+    }
+
+    // Every page is scaled against the norm of the whole register, rather than its own.
+    for (i = 0; i < qPages.size(); i++) {
+        qPages[i]->NormalizeState(nrm, norm_thresh);
+    }
+}
+
+QInterfacePtr QPager::Clone()
+{
+    QPagerPtr clone = std::make_shared<QPager>(engine, qubitCount, 0, rand_generator, ONE_CMPLX, doNormalize,
+        randGlobalPhase, useHostRam, devID, useRDRAND, isSparse, amplitudeFloor, deviceIDs, baseQubitsPerPage);
+    clone->SetConcurrency(concurrency);
+
+    bitCapIntOcl pagePow = pagePower();
+    for (bitCapIntOcl i = 0; i < qPages.size(); i++) {
+        CopyPage(qPages[i], 0, clone->qPages[i], 0, pagePow);
+    }
+
+    return clone;
+}
+} // namespace Qrack
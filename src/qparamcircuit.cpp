@@ -0,0 +1,732 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#include "qfactory.hpp"
+#include "qparamcircuit.hpp"
+
+#define IS_NORM_0(c) (norm(c) <= REAL1_EPSILON)
+
+namespace Qrack {
+
+QParamCircuit::QParamCircuit(bitLenInt n, QInterfaceEngine eng, qrack_rand_gen_ptr rgp)
+    : qubitCount(n)
+    , engineType(eng)
+    , isCompiled(false)
+    , rand_generator(rgp)
+{
+    if ((engineType != QINTERFACE_CPU) && (engineType != QINTERFACE_OPENCL)) {
+        throw std::invalid_argument("QParamCircuit engine must be QINTERFACE_CPU or QINTERFACE_OPENCL.");
+    }
+
+    if (rand_generator == NULL) {
+        rand_generator = std::make_shared<qrack_rand_gen>();
+        rand_generator->seed((uint32_t)std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    SetConcurrencyLevel(std::thread::hardware_concurrency());
+}
+
+void QParamCircuit::CheckQubits(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target)
+{
+    if (target >= qubitCount) {
+        throw std::invalid_argument("QParamCircuit qubit index out of range.");
+    }
+
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        if (controls[i] >= qubitCount) {
+            throw std::invalid_argument("QParamCircuit qubit index out of range.");
+        }
+        if (controls[i] == target) {
+            throw std::invalid_argument("QParamCircuit control and target must differ.");
+        }
+    }
+}
+
+void QParamCircuit::AddFixed(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    CheckQubits(controls, controlLen, target);
+
+    // A controlled gate is a uniformly controlled gate that is identity except in the last block.
+    const bitCapIntOcl blockCount = pow2Ocl(controlLen);
+    ParamGate gate;
+    gate.type = PARAM_FIXED;
+    gate.target = target;
+    gate.controls = std::vector<bitLenInt>(controls, controls + controlLen);
+    gate.mtrxs.resize(4U * blockCount);
+    for (bitCapIntOcl i = 0; i < (blockCount - 1U); i++) {
+        gate.mtrxs[4U * i] = ONE_CMPLX;
+        gate.mtrxs[4U * i + 1U] = ZERO_CMPLX;
+        gate.mtrxs[4U * i + 2U] = ZERO_CMPLX;
+        gate.mtrxs[4U * i + 3U] = ONE_CMPLX;
+    }
+    std::copy(mtrx, mtrx + 4U, gate.mtrxs.begin() + 4U * (blockCount - 1U));
+
+    gates.push_back(gate);
+    Invalidate();
+}
+
+void QParamCircuit::H(bitLenInt target)
+{
+    const complex mtrx[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1),
+        complex(-M_SQRT1_2, ZERO_R1) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QParamCircuit::X(bitLenInt target)
+{
+    const complex mtrx[4] = { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX };
+    ApplySingleBit(mtrx, target);
+}
+
+void QParamCircuit::Y(bitLenInt target)
+{
+    const complex mtrx[4] = { ZERO_CMPLX, -I_CMPLX, I_CMPLX, ZERO_CMPLX };
+    ApplySingleBit(mtrx, target);
+}
+
+void QParamCircuit::Z(bitLenInt target)
+{
+    const complex mtrx[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, -ONE_CMPLX };
+    ApplySingleBit(mtrx, target);
+}
+
+void QParamCircuit::CNOT(bitLenInt control, bitLenInt target)
+{
+    const complex mtrx[4] = { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX };
+    ApplyControlledSingleBit(&control, 1U, target, mtrx);
+}
+
+void QParamCircuit::CZ(bitLenInt control, bitLenInt target)
+{
+    const complex mtrx[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, -ONE_CMPLX };
+    ApplyControlledSingleBit(&control, 1U, target, mtrx);
+}
+
+void QParamCircuit::UniformlyControlledRotation(const ParamGateType& axis, const bitLenInt* controls,
+    const bitLenInt& controlLen, const bitLenInt& target, const bitCapIntOcl* params)
+{
+    if ((axis != PARAM_RX) && (axis != PARAM_RY) && (axis != PARAM_RZ)) {
+        throw std::invalid_argument("QParamCircuit rotation axis must be PARAM_RX, PARAM_RY, or PARAM_RZ.");
+    }
+
+    CheckQubits(controls, controlLen, target);
+
+    const bitCapIntOcl blockCount = pow2Ocl(controlLen);
+    for (bitCapIntOcl i = 0; i < blockCount; i++) {
+        if ((params[i] != QPARAM_IDENTITY) && (params[i] >= parameters.size())) {
+            throw std::invalid_argument("QParamCircuit parameter index out of range.");
+        }
+    }
+
+    ParamGate gate;
+    gate.type = axis;
+    gate.target = target;
+    gate.controls = std::vector<bitLenInt>(controls, controls + controlLen);
+    gate.params = std::vector<bitCapIntOcl>(params, params + blockCount);
+
+    gates.push_back(gate);
+    Invalidate();
+}
+
+void QParamCircuit::CRY(const bitLenInt* controls, const bitLenInt& controlLen, bitCapIntOcl param, bitLenInt target)
+{
+    std::vector<bitCapIntOcl> params(pow2Ocl(controlLen), QPARAM_IDENTITY);
+    params.back() = param;
+    UniformlyControlledRotation(PARAM_RY, controls, controlLen, target, &(params[0]));
+}
+
+void QParamCircuit::GetMatrices(const ParamGate& gate, const bool& isInverse, complex* mtrxs)
+{
+    const bitCapIntOcl blockCount = pow2Ocl(gate.controls.size());
+
+    if (gate.type == PARAM_FIXED) {
+        for (bitCapIntOcl i = 0; i < blockCount; i++) {
+            const complex* mtrx = &(gate.mtrxs[4U * i]);
+            complex* out = mtrxs + 4U * i;
+            if (isInverse) {
+                out[0] = conj(mtrx[0]);
+                out[1] = conj(mtrx[2]);
+                out[2] = conj(mtrx[1]);
+                out[3] = conj(mtrx[3]);
+            } else {
+                std::copy(mtrx, mtrx + 4U, out);
+            }
+        }
+        return;
+    }
+
+    for (bitCapIntOcl i = 0; i < blockCount; i++) {
+        const bitCapIntOcl param = gate.params[i];
+        const real1 theta = (param == QPARAM_IDENTITY) ? ZERO_R1 : (isInverse ? -parameters[param] : parameters[param]);
+        RotationMatrix(gate.type, theta, mtrxs + 4U * i);
+    }
+}
+
+void QParamCircuit::RotationMatrix(const ParamGateType& axis, const real1& theta, complex* out)
+{
+    const real1 cosine = (real1)cos(theta / 2);
+    const real1 sine = (real1)sin(theta / 2);
+
+    switch (axis) {
+    case PARAM_RX:
+        out[0] = complex(cosine, ZERO_R1);
+        out[1] = complex(ZERO_R1, -sine);
+        out[2] = complex(ZERO_R1, -sine);
+        out[3] = complex(cosine, ZERO_R1);
+        break;
+    case PARAM_RY:
+        out[0] = complex(cosine, ZERO_R1);
+        out[1] = complex(-sine, ZERO_R1);
+        out[2] = complex(sine, ZERO_R1);
+        out[3] = complex(cosine, ZERO_R1);
+        break;
+    default:
+        out[0] = complex(cosine, -sine);
+        out[1] = ZERO_CMPLX;
+        out[2] = ZERO_CMPLX;
+        out[3] = complex(cosine, sine);
+        break;
+    }
+}
+
+QEnginePtr QParamCircuit::MakeEngine(const bitCapInt& perm)
+{
+    // Without normalization or a random global phase, so that the two states' inner products are exact.
+    return std::dynamic_pointer_cast<QEngine>(
+        CreateQuantumInterface(engineType, qubitCount, perm, rand_generator, ONE_CMPLX, false, false));
+}
+
+bool QParamCircuit::IsDiagonal(const CompiledGate& gate)
+{
+    if (gate.type == PARAM_RZ) {
+        return true;
+    }
+    if ((gate.type != PARAM_FIXED) || (gate.targets.size() != 1U)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < gate.mtrxs.size(); i += 4U) {
+        if (!IS_NORM_0(gate.mtrxs[i + 1U]) || !IS_NORM_0(gate.mtrxs[i + 2U])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QParamCircuit::IsDiagonalOn(const CompiledGate& gate, const bitLenInt& qubit)
+{
+    if (std::find(gate.targets.begin(), gate.targets.end(), qubit) != gate.targets.end()) {
+        return IsDiagonal(gate);
+    }
+
+    return true;
+}
+
+bool QParamCircuit::IsCommuting(const CompiledGate& gate1, const CompiledGate& gate2)
+{
+    // Gates that are both diagonal on every qubit they share are block diagonal in the same basis, with blocks that
+    // act on disjoint qubits.
+    std::vector<bitLenInt> qubits(gate1.targets);
+    qubits.insert(qubits.end(), gate1.controls.begin(), gate1.controls.end());
+    for (size_t i = 0; i < qubits.size(); i++) {
+        const bool isShared =
+            (std::find(gate2.targets.begin(), gate2.targets.end(), qubits[i]) != gate2.targets.end()) ||
+            (std::find(gate2.controls.begin(), gate2.controls.end(), qubits[i]) != gate2.controls.end());
+        if (isShared && (!IsDiagonalOn(gate1, qubits[i]) || !IsDiagonalOn(gate2, qubits[i]))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QParamCircuit::TryMerge(CompiledGate& prior, const CompiledGate& gate)
+{
+    if ((prior.type != gate.type) || (prior.targets != gate.targets) || (prior.controls != gate.controls)) {
+        return false;
+    }
+
+    if (gate.type != PARAM_FIXED) {
+        for (size_t i = 0; i < gate.params.size(); i++) {
+            prior.params[i].insert(prior.params[i].end(), gate.params[i].begin(), gate.params[i].end());
+        }
+        return true;
+    }
+
+    // The later gate multiplies from the left, block by block.
+    for (size_t i = 0; i < gate.mtrxs.size(); i += 4U) {
+        const complex* g = &(gate.mtrxs[i]);
+        complex* p = &(prior.mtrxs[i]);
+        const complex p0 = p[0], p1 = p[1], p2 = p[2], p3 = p[3];
+        p[0] = g[0] * p0 + g[1] * p2;
+        p[1] = g[0] * p1 + g[1] * p3;
+        p[2] = g[2] * p0 + g[3] * p2;
+        p[3] = g[2] * p1 + g[3] * p3;
+    }
+
+    return true;
+}
+
+bool QParamCircuit::IsIdentity(const CompiledGate& gate)
+{
+    if (gate.type != PARAM_FIXED) {
+        for (size_t i = 0; i < gate.params.size(); i++) {
+            if (gate.params[i].size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // (Even a global phase is kept, since it is only global if the gate has no controls.)
+    for (size_t i = 0; i < gate.mtrxs.size(); i += 4U) {
+        if (!IS_NORM_0(gate.mtrxs[i] - ONE_CMPLX) || !IS_NORM_0(gate.mtrxs[i + 1U]) ||
+            !IS_NORM_0(gate.mtrxs[i + 2U]) || !IS_NORM_0(gate.mtrxs[i + 3U] - ONE_CMPLX)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void QParamCircuit::FuseInto(
+    const CompiledGate& gate, const std::vector<bitLenInt>& targets, std::vector<complex>& block)
+{
+    const bitCapIntOcl dim = pow2Ocl(targets.size());
+    const bitCapIntOcl targetPower =
+        pow2Ocl(std::find(targets.begin(), targets.end(), gate.targets[0]) - targets.begin());
+    std::vector<bitCapIntOcl> controlPowers(gate.controls.size());
+    for (size_t i = 0; i < gate.controls.size(); i++) {
+        controlPowers[i] = pow2Ocl(std::find(targets.begin(), targets.end(), gate.controls[i]) - targets.begin());
+    }
+
+    // Each column of the block is a state of its qubits, which the gate acts on as it would on a state vector.
+    for (bitCapIntOcl row = 0; row < dim; row++) {
+        if (row & targetPower) {
+            continue;
+        }
+
+        bitCapIntOcl blockIndex = 0;
+        for (size_t i = 0; i < controlPowers.size(); i++) {
+            if (row & controlPowers[i]) {
+                blockIndex |= pow2Ocl(i);
+            }
+        }
+        const complex* mtrx = &(gate.mtrxs[4U * blockIndex]);
+
+        complex* row0 = &(block[row * dim]);
+        complex* row1 = &(block[(row | targetPower) * dim]);
+        for (bitCapIntOcl col = 0; col < dim; col++) {
+            const complex v0 = row0[col];
+            const complex v1 = row1[col];
+            row0[col] = mtrx[0] * v0 + mtrx[1] * v1;
+            row1[col] = mtrx[2] * v0 + mtrx[3] * v1;
+        }
+    }
+}
+
+std::vector<QParamCircuit::CompiledGate> QParamCircuit::Remap(
+    const std::vector<CompiledGate>& merged, const bitLenInt& lowWidth)
+{
+    std::vector<bitLenInt> logToPhys(qubitCount);
+    std::vector<bitLenInt> physToLog(qubitCount);
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        logToPhys[i] = i;
+        physToLog[i] = i;
+    }
+
+    std::vector<CompiledGate> remapped;
+    auto swap = [&](bitLenInt phys1, bitLenInt phys2) {
+        CompiledGate swapGate;
+        swapGate.type = PARAM_SWAP;
+        swapGate.targets.push_back(phys1);
+        swapGate.targets.push_back(phys2);
+        remapped.push_back(swapGate);
+
+        std::swap(physToLog[phys1], physToLog[phys2]);
+        logToPhys[physToLog[phys1]] = phys1;
+        logToPhys[physToLog[phys2]] = phys2;
+    };
+
+    // Only non-diagonal gates pair amplitudes, at the stride of their target, (and diagonal ones act elementwise).
+    std::vector<size_t> uses(qubitCount);
+    for (size_t i = 0; i < merged.size(); i++) {
+        const CompiledGate& gate = merged[i];
+        const bitLenInt target = gate.targets[0];
+
+        if ((logToPhys[target] >= lowWidth) && !IsDiagonal(gate)) {
+            std::fill(uses.begin(), uses.end(), 0U);
+            const size_t end = std::min(merged.size(), i + QPARAM_REMAP_WINDOW);
+            for (size_t j = i; j < end; j++) {
+                if (!IsDiagonal(merged[j])) {
+                    uses[merged[j].targets[0]]++;
+                }
+            }
+
+            bitLenInt coldest = 0;
+            for (bitLenInt phys = 1; phys < lowWidth; phys++) {
+                if (uses[physToLog[phys]] < uses[physToLog[coldest]]) {
+                    coldest = phys;
+                }
+            }
+
+            if (uses[target] > (uses[physToLog[coldest]] + QPARAM_REMAP_SWAP_COST)) {
+                swap(coldest, logToPhys[target]);
+            }
+        }
+
+        CompiledGate pGate(gate);
+        for (size_t j = 0; j < pGate.targets.size(); j++) {
+            pGate.targets[j] = logToPhys[pGate.targets[j]];
+        }
+        for (size_t j = 0; j < pGate.controls.size(); j++) {
+            pGate.controls[j] = logToPhys[pGate.controls[j]];
+        }
+        remapped.push_back(pGate);
+    }
+
+    // Put every qubit back in its logical position.
+    for (bitLenInt phys = 0; phys < qubitCount; phys++) {
+        if (physToLog[phys] != phys) {
+            swap(phys, logToPhys[phys]);
+        }
+    }
+
+    return remapped;
+}
+
+void QParamCircuit::Compile(bitLenInt fuseWidth, bitLenInt lowWidth)
+{
+    if (fuseWidth > 4U) {
+        throw std::invalid_argument("QParamCircuit::Compile() fuse width must be at most 4 qubits.");
+    }
+
+    // Fold each gate into the latest earlier gate it can merge with, past any gates it commutes with.
+    std::vector<CompiledGate> merged;
+    for (size_t i = 0; i < gates.size(); i++) {
+        const ParamGate& gate = gates[i];
+        CompiledGate cGate;
+        cGate.type = gate.type;
+        cGate.targets.push_back(gate.target);
+        cGate.controls = gate.controls;
+        if (gate.type == PARAM_FIXED) {
+            cGate.mtrxs = gate.mtrxs;
+        } else {
+            cGate.params.resize(gate.params.size());
+            for (size_t j = 0; j < gate.params.size(); j++) {
+                if (gate.params[j] != QPARAM_IDENTITY) {
+                    cGate.params[j].push_back(gate.params[j]);
+                }
+            }
+        }
+
+        if (IsIdentity(cGate)) {
+            continue;
+        }
+
+        bool isMerged = false;
+        for (size_t j = merged.size(); j > 0; j--) {
+            if (TryMerge(merged[j - 1U], cGate)) {
+                if (IsIdentity(merged[j - 1U])) {
+                    merged.erase(merged.begin() + (j - 1U));
+                }
+                isMerged = true;
+                break;
+            }
+            if (!IsCommuting(merged[j - 1U], cGate)) {
+                break;
+            }
+        }
+
+        if (!isMerged) {
+            merged.push_back(cGate);
+        }
+    }
+
+    if (lowWidth && (lowWidth < qubitCount)) {
+        merged = Remap(merged, lowWidth);
+    }
+
+    // Fuse runs of fixed gates that each overlap the qubits of the run so far, up to "fuseWidth" qubits in all.
+    compiled.clear();
+    size_t i = 0;
+    while (i < merged.size()) {
+        std::vector<bitLenInt> targets(merged[i].targets);
+        targets.insert(targets.end(), merged[i].controls.begin(), merged[i].controls.end());
+
+        size_t end = i + 1U;
+        if ((merged[i].type == PARAM_FIXED) && (targets.size() <= fuseWidth)) {
+            while ((end < merged.size()) && (merged[end].type == PARAM_FIXED)) {
+                std::vector<bitLenInt> qubits(merged[end].targets);
+                qubits.insert(qubits.end(), merged[end].controls.begin(), merged[end].controls.end());
+
+                std::vector<bitLenInt> nTargets(targets);
+                bool isOverlapping = false;
+                for (size_t j = 0; j < qubits.size(); j++) {
+                    if (std::find(targets.begin(), targets.end(), qubits[j]) != targets.end()) {
+                        isOverlapping = true;
+                    } else {
+                        nTargets.push_back(qubits[j]);
+                    }
+                }
+                if (!isOverlapping || (nTargets.size() > fuseWidth)) {
+                    break;
+                }
+
+                targets = nTargets;
+                end++;
+            }
+        }
+
+        if (end == (i + 1U)) {
+            compiled.push_back(merged[i]);
+            i++;
+            continue;
+        }
+
+        const bitCapIntOcl dim = pow2Ocl(targets.size());
+        CompiledGate fused;
+        fused.type = PARAM_FIXED;
+        fused.targets = targets;
+        fused.mtrxs.resize(dim * dim, ZERO_CMPLX);
+        for (bitCapIntOcl j = 0; j < dim; j++) {
+            fused.mtrxs[j * dim + j] = ONE_CMPLX;
+        }
+        for (; i < end; i++) {
+            FuseInto(merged[i], targets, fused.mtrxs);
+        }
+
+        compiled.push_back(fused);
+    }
+
+    isCompiled = true;
+}
+
+void QParamCircuit::Replay(QInterfacePtr qReg)
+{
+    if (qReg->GetQubitCount() < qubitCount) {
+        throw std::invalid_argument("QParamCircuit::Replay() register is narrower than the circuit.");
+    }
+
+    if (!isCompiled) {
+        Compile();
+    }
+
+    // Runs of uncontrolled single bit gates go to the engine as one batch, (which it might apply in one tiled pass).
+    std::vector<complex> batchMtrxs;
+    std::vector<bitLenInt> batchQubits;
+    auto flushBatch = [&]() {
+        if (batchQubits.size() == 1U) {
+            qReg->ApplySingleBit(&(batchMtrxs[0]), batchQubits[0]);
+        } else if (batchQubits.size()) {
+            qReg->ApplySingleBitBatch(&(batchMtrxs[0]), &(batchQubits[0]), batchQubits.size());
+        }
+        batchMtrxs.clear();
+        batchQubits.clear();
+    };
+
+    std::vector<complex> mtrxs;
+    for (size_t i = 0; i < compiled.size(); i++) {
+        const CompiledGate& gate = compiled[i];
+        const bitLenInt controlLen = gate.controls.size();
+
+        if (gate.type == PARAM_SWAP) {
+            flushBatch();
+            qReg->Swap(gate.targets[0], gate.targets[1]);
+            continue;
+        }
+
+        if (gate.targets.size() > 1U) {
+            flushBatch();
+            qReg->ApplyNxN(&(gate.mtrxs[0]), &(gate.targets[0]), gate.targets.size());
+            continue;
+        }
+
+        // (Rotation gates carry no matrices of their own, only parameters.)
+        const complex* gateMtrxs;
+        if (gate.type == PARAM_FIXED) {
+            gateMtrxs = gate.mtrxs.data();
+        } else {
+            mtrxs.resize(4U * gate.params.size());
+            for (size_t j = 0; j < gate.params.size(); j++) {
+                real1 theta = ZERO_R1;
+                for (size_t k = 0; k < gate.params[j].size(); k++) {
+                    theta += parameters[gate.params[j][k]];
+                }
+                RotationMatrix(gate.type, theta, &(mtrxs[4U * j]));
+            }
+            gateMtrxs = &(mtrxs[0]);
+        }
+
+        if (controlLen == 0) {
+            batchMtrxs.insert(batchMtrxs.end(), gateMtrxs, gateMtrxs + 4U);
+            batchQubits.push_back(gate.targets[0]);
+            continue;
+        }
+        flushBatch();
+
+        // A gate that is identity in all but its last block is an ordinary controlled gate.
+        const size_t last = 4U * (pow2Ocl(controlLen) - 1U);
+        bool isControlled = true;
+        for (size_t j = 0; j < last; j += 4U) {
+            if ((gateMtrxs[j] != ONE_CMPLX) || (gateMtrxs[j + 1U] != ZERO_CMPLX) ||
+                (gateMtrxs[j + 2U] != ZERO_CMPLX) || (gateMtrxs[j + 3U] != ONE_CMPLX)) {
+                isControlled = false;
+                break;
+            }
+        }
+
+        if (isControlled) {
+            qReg->ApplyControlledSingleBit(&(gate.controls[0]), controlLen, gate.targets[0], gateMtrxs + last);
+        } else {
+            qReg->UniformlyControlledSingleBit(&(gate.controls[0]), controlLen, gate.targets[0], gateMtrxs);
+        }
+    }
+    flushBatch();
+}
+
+QInterfacePtr QParamCircuit::Run(const bitCapInt& perm)
+{
+    QEnginePtr qReg = MakeEngine(perm);
+    Replay(qReg);
+
+    return qReg;
+}
+
+real1 QParamCircuit::Gradient(const std::vector<PauliTerm>& observable, real1* gradients, const bitCapInt& perm)
+{
+    std::fill(gradients, gradients + parameters.size(), ZERO_R1);
+
+    QEnginePtr psi = std::dynamic_pointer_cast<QEngine>(Run(perm));
+    const bitCapIntOcl maxQPower = pow2Ocl(qubitCount);
+    std::unique_ptr<complex[]> psiVec(new complex[maxQPower]);
+    std::unique_ptr<complex[]> lambdaVec(new complex[maxQPower]);
+    psi->GetQuantumState(psiVec.get());
+    std::fill(lambdaVec.get(), lambdaVec.get() + maxQPower, ZERO_CMPLX);
+
+    // |lambda> = O |psi>, where X^x Z^z |k> = (-1)^|k & z| |k ^ x>, and Y = i * X * Z.
+    const complex iPowers[4] = { ONE_CMPLX, I_CMPLX, -ONE_CMPLX, -I_CMPLX };
+    for (size_t i = 0; i < observable.size(); i++) {
+        const bitCapIntOcl xMask = (bitCapIntOcl)observable[i].xMask & (maxQPower - ONE_BCI);
+        const bitCapIntOcl zMask = (bitCapIntOcl)observable[i].zMask & (maxQPower - ONE_BCI);
+        bitLenInt yCount = 0;
+        for (bitCapIntOcl v = xMask & zMask; v; v &= v - ONE_BCI) {
+            yCount++;
+        }
+        const complex coeff = observable[i].coefficient * iPowers[yCount & 3U];
+
+        // Each "k" maps to a distinct "k ^ x," so the writes don't collide.
+        par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            bool parity = false;
+            for (bitCapIntOcl v = (bitCapIntOcl)lcv & zMask; v; v &= v - ONE_BCI) {
+                parity = !parity;
+            }
+            const complex amp = coeff * psiVec[(bitCapIntOcl)lcv];
+            lambdaVec[(bitCapIntOcl)lcv ^ xMask] += parity ? -amp : amp;
+        });
+    }
+
+    real1 expectation = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < maxQPower; i++) {
+        expectation += real(conj(psiVec[i]) * lambdaVec[i]);
+    }
+
+    // The backward sweep stays on these two host copies, so that no gate costs a readback of either state. Each gate
+    // takes one pass over both, which bins the derivative terms of a rotation, from the amplitudes just after it, as
+    // it undoes the gate.
+    const int numCores = GetConcurrencyLevel();
+    std::vector<complex> bins;
+    std::unique_ptr<complex[]> mtrxs;
+    for (size_t g = gates.size(); g > 0; g--) {
+        const ParamGate& gate = gates[g - 1U];
+        const bitLenInt controlLen = gate.controls.size();
+        const bitCapIntOcl blockCount = pow2Ocl(controlLen);
+        const bitCapIntOcl targetPower = pow2Ocl(gate.target);
+        const bitCapIntOcl lowMask = targetPower - ONE_BCI;
+        const bool isRotation = (gate.type != PARAM_FIXED);
+
+        mtrxs.reset(new complex[4U * blockCount]);
+        GetMatrices(gate, true, mtrxs.get());
+        if (isRotation) {
+            bins.assign((bitCapIntOcl)numCores * blockCount, ZERO_CMPLX);
+        }
+
+        // With generator G = |j><j|_controls (x) P, for each control permutation "j," the derivative of the
+        // expectation value is 2 * Re(<lambda| (-i / 2) G |psi>) = Im(<lambda| G |psi>).
+        par_for(0, maxQPower >> ONE_BCI, [&](const bitCapInt lcv, const int cpu) {
+            bitCapIntOcl k0 = (bitCapIntOcl)lcv & lowMask;
+            k0 |= ((bitCapIntOcl)lcv ^ k0) << ONE_BCI;
+            const bitCapIntOcl k1 = k0 | targetPower;
+
+            bitCapIntOcl block = 0;
+            for (bitLenInt j = 0; j < controlLen; j++) {
+                if (k0 & pow2Ocl(gate.controls[j])) {
+                    block |= pow2Ocl(j);
+                }
+            }
+
+            const complex psi0 = psiVec[k0];
+            const complex psi1 = psiVec[k1];
+            const complex lambda0 = lambdaVec[k0];
+            const complex lambda1 = lambdaVec[k1];
+
+            if (isRotation && (gate.params[block] != QPARAM_IDENTITY)) {
+                complex term;
+                switch (gate.type) {
+                case PARAM_RX:
+                    term = conj(lambda0) * psi1 + conj(lambda1) * psi0;
+                    break;
+                case PARAM_RY:
+                    term = I_CMPLX * (conj(lambda1) * psi0 - conj(lambda0) * psi1);
+                    break;
+                default:
+                    term = conj(lambda0) * psi0 - conj(lambda1) * psi1;
+                    break;
+                }
+                bins[(bitCapIntOcl)cpu * blockCount + block] += term;
+            }
+
+            const complex* mtrx = mtrxs.get() + 4U * block;
+            psiVec[k0] = mtrx[0] * psi0 + mtrx[1] * psi1;
+            psiVec[k1] = mtrx[2] * psi0 + mtrx[3] * psi1;
+            lambdaVec[k0] = mtrx[0] * lambda0 + mtrx[1] * lambda1;
+            lambdaVec[k1] = mtrx[2] * lambda0 + mtrx[3] * lambda1;
+        });
+
+        if (!isRotation) {
+            continue;
+        }
+
+        for (bitCapIntOcl j = 0; j < blockCount; j++) {
+            if (gate.params[j] == QPARAM_IDENTITY) {
+                continue;
+            }
+            complex sum = ZERO_CMPLX;
+            for (int c = 0; c < numCores; c++) {
+                sum += bins[(bitCapIntOcl)c * blockCount + j];
+            }
+            gradients[gate.params[j]] += imag(sum);
+        }
+    }
+
+    return expectation;
+}
+
+} // namespace Qrack
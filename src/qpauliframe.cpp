@@ -0,0 +1,255 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#include "qpauliframe.hpp"
+
+// Below this error probability, Bernoulli masks are drawn by skipping geometrically distributed gaps between errors,
+// rather than bit by bit.
+#define FRAME_SPARSE_PROB ((real1)0.25f)
+
+namespace Qrack {
+
+/// Draw 64 independent Bernoulli("prob") bits
+static uint64_t BernoulliMask(qrack_rand_gen& gen, const real1& prob)
+{
+    if (prob <= ZERO_R1) {
+        return 0U;
+    }
+    if (prob >= ONE_R1) {
+        return ~0ULL;
+    }
+
+    std::uniform_real_distribution<real1> dist(ZERO_R1, ONE_R1);
+    uint64_t mask = 0U;
+
+    if (prob > FRAME_SPARSE_PROB) {
+        for (bitLenInt i = 0; i < 64U; i++) {
+            if (dist(gen) < prob) {
+                mask |= 1ULL << i;
+            }
+        }
+        return mask;
+    }
+
+    const real1 logQ = std::log(ONE_R1 - prob);
+    real1 pos = -ONE_R1;
+    for (;;) {
+        // (1 - u) is in (0, 1], so the logarithm is finite.
+        pos += ONE_R1 + std::floor(std::log(ONE_R1 - dist(gen)) / logQ);
+        if (pos >= (real1)64U) {
+            break;
+        }
+        mask |= 1ULL << (bitLenInt)pos;
+    }
+
+    return mask;
+}
+
+QPauliFrameSampler::QPauliFrameSampler(const bitLenInt& n, const bitCapInt& perm, qrack_rand_gen_ptr rgp)
+    : qubitCount(n)
+    , initPerm(perm)
+    , measurementCount(0)
+    , isReferenceValid(false)
+    , rand_generator(rgp)
+{
+    if (rand_generator == NULL) {
+        rand_generator = std::make_shared<qrack_rand_gen>();
+        SetRandomSeed((uint32_t)std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    SetConcurrencyLevel(std::thread::hardware_concurrency());
+}
+
+void QPauliFrameSampler::AddOp(const FrameOpType& type, const bitLenInt& q1, const bitLenInt& q2, const real1& prob)
+{
+    if ((q1 >= qubitCount) || (q2 >= qubitCount)) {
+        throw std::invalid_argument("QPauliFrameSampler qubit index out of range.");
+    }
+    if (((type == FRAME_CNOT) || (type == FRAME_CZ)) && (q1 == q2)) {
+        throw std::invalid_argument("QPauliFrameSampler control and target must differ.");
+    }
+
+    ops.push_back(FrameOp{ type, q1, q2, prob });
+    isReferenceValid = false;
+}
+
+bitCapIntOcl QPauliFrameSampler::M(const bitLenInt& target)
+{
+    AddOp(FRAME_M, target);
+    return measurementCount++;
+}
+
+void QPauliFrameSampler::RunReference()
+{
+    QStabilizerPtr stabilizer = std::make_shared<QStabilizer>(qubitCount, initPerm, false, rand_generator);
+
+    reference.clear();
+    reference.reserve(measurementCount);
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        const FrameOp& op = ops[i];
+        switch (op.type) {
+        case FRAME_H:
+            stabilizer->H(op.q1);
+            break;
+        case FRAME_S:
+            stabilizer->S(op.q1);
+            break;
+        case FRAME_IS:
+            stabilizer->IS(op.q1);
+            break;
+        case FRAME_X:
+            stabilizer->X(op.q1);
+            break;
+        case FRAME_Y:
+            stabilizer->Y(op.q1);
+            break;
+        case FRAME_Z:
+            stabilizer->Z(op.q1);
+            break;
+        case FRAME_CNOT:
+            stabilizer->CNOT(op.q1, op.q2);
+            break;
+        case FRAME_CZ:
+            stabilizer->CZ(op.q1, op.q2);
+            break;
+        case FRAME_M:
+            reference.push_back(stabilizer->M(op.q1));
+            break;
+        case FRAME_RESET:
+            if (stabilizer->M(op.q1)) {
+                stabilizer->X(op.q1);
+            }
+            break;
+        default:
+            // The reference shot is noiseless; noise only lives in the frames.
+            break;
+        }
+    }
+
+    isReferenceValid = true;
+}
+
+void QPauliFrameSampler::RunFrames(qrack_rand_gen& gen, uint64_t* record, const bitCapIntOcl& stride,
+    const bitCapIntOcl& word, const uint64_t& shotMask)
+{
+    std::vector<uint64_t> x(qubitCount, 0U);
+    std::vector<uint64_t> z(qubitCount);
+
+    // A random Z frame on |0> changes nothing physical, but it is what randomizes outcomes that are random.
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        z[i] = gen();
+    }
+
+    bitCapIntOcl m = 0;
+    uint64_t mask;
+    for (size_t i = 0; i < ops.size(); i++) {
+        const FrameOp& op = ops[i];
+        const bitLenInt q1 = op.q1;
+        const bitLenInt q2 = op.q2;
+        switch (op.type) {
+        case FRAME_H:
+            std::swap(x[q1], z[q1]);
+            break;
+        case FRAME_S:
+        case FRAME_IS:
+            z[q1] ^= x[q1];
+            break;
+        case FRAME_CNOT:
+            x[q2] ^= x[q1];
+            z[q1] ^= z[q2];
+            break;
+        case FRAME_CZ:
+            z[q1] ^= x[q2];
+            z[q2] ^= x[q1];
+            break;
+        case FRAME_M:
+            record[m * stride + word] = (reference[m] ? ~x[q1] : x[q1]) & shotMask;
+            m++;
+            // Collapse: the post-measurement Z frame is arbitrary.
+            z[q1] = gen();
+            break;
+        case FRAME_RESET:
+            x[q1] = 0U;
+            z[q1] = gen();
+            break;
+        case FRAME_X_ERROR:
+            x[q1] ^= BernoulliMask(gen, op.prob);
+            break;
+        case FRAME_Y_ERROR:
+            mask = BernoulliMask(gen, op.prob);
+            x[q1] ^= mask;
+            z[q1] ^= mask;
+            break;
+        case FRAME_Z_ERROR:
+            z[q1] ^= BernoulliMask(gen, op.prob);
+            break;
+        case FRAME_DEPOLARIZE:
+            mask = BernoulliMask(gen, op.prob);
+            while (mask) {
+                const uint64_t bit = mask & (~mask + 1U);
+                mask ^= bit;
+                // 1 is X, 2 is Z, and 3 is Y.
+                const uint64_t pauli = (gen() % 3U) + 1U;
+                if (pauli & 1U) {
+                    x[q1] ^= bit;
+                }
+                if (pauli & 2U) {
+                    z[q1] ^= bit;
+                }
+            }
+            break;
+        default:
+            // Pauli gates only change signs, which frames don't track.
+            break;
+        }
+    }
+}
+
+std::vector<uint64_t> QPauliFrameSampler::Sample(const bitCapIntOcl& shots)
+{
+    if (!isReferenceValid) {
+        RunReference();
+    }
+
+    const bitCapIntOcl wordCount = (shots + 63U) >> 6U;
+    std::vector<uint64_t> record(measurementCount * wordCount, 0U);
+
+    if (!wordCount) {
+        return record;
+    }
+
+    // Every batch gets its own generator, seeded up front, so that the result doesn't depend on thread scheduling.
+    std::vector<uint64_t> seeds(wordCount);
+    for (bitCapIntOcl i = 0; i < wordCount; i++) {
+        seeds[i] = (*rand_generator)();
+    }
+
+    const bitCapIntOcl lastShots = shots & 63U;
+    const uint64_t lastMask = lastShots ? ((1ULL << lastShots) - 1U) : ~0ULL;
+
+    par_for_weighted(0, wordCount, ops.size() + qubitCount, [&](const bitCapInt lcv, const int cpu) {
+        const bitCapIntOcl word = (bitCapIntOcl)lcv;
+        qrack_rand_gen gen(seeds[word]);
+        RunFrames(gen, record.data(), wordCount, word, (word == (wordCount - 1U)) ? lastMask : ~0ULL);
+    });
+
+    return record;
+}
+
+} // namespace Qrack
@@ -1,739 +1,893 @@
-//////////////////////////////////////////////////////////////////////////////////////
-//
-// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
-//
-// Adapted from:
-//
-// CHP: CNOT-Hadamard-Phase
-// Stabilizer Quantum Computer Simulator
-// by Scott Aaronson
-// Last modified June 30, 2004
-//
-// Thanks to Simon Anders and Andrew Cross for bugfixes
-//
-// https://www.scottaaronson.com/chp/
-//
-// Daniel Strano and the Qrack contributers appreciate Scott Aaronson's open sharing of the CHP code, and we hope that
-// vm6502q/qrack is one satisfactory framework by which CHP could be adapted to enter the C++ STL. Our project
-// philosophy aims to raise the floor of decentralized quantum computing technology access across all modern platforms,
-// for all people, not commercialization.
-//
-// Licensed under the GNU Lesser General Public License V3.
-// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
-// for details.
-
-#include <chrono>
-
-#include "qstabilizer.hpp"
-
-namespace Qrack {
-
-QStabilizer::QStabilizer(const bitLenInt& n, const bitCapInt& perm, bool useHardwareRNG, qrack_rand_gen_ptr rgp)
-    : qubitCount(n)
-    , x((n << 1U) + 1U, std::vector<bool>(n))
-    , z((n << 1U) + 1U, std::vector<bool>(n))
-    , r((n << 1U) + 1U)
-    , rand_distribution(0.0, 1.0)
-    , hardware_rand_generator(NULL)
-{
-#if !ENABLE_RDRAND
-    useHardwareRNG = false;
-#endif
-
-    if (useHardwareRNG) {
-        hardware_rand_generator = std::make_shared<RdRandom>();
-#if !ENABLE_RNDFILE
-        if (!(hardware_rand_generator->SupportsRDRAND())) {
-            hardware_rand_generator = NULL;
-        }
-#endif
-    }
-
-    if ((rgp == NULL) && (hardware_rand_generator == NULL)) {
-        rand_generator = std::make_shared<qrack_rand_gen>();
-        randomSeed = time(0);
-        SetRandomSeed(randomSeed);
-    } else {
-        rand_generator = rgp;
-    }
-
-    SetPermutation(perm);
-}
-
-void QStabilizer::SetPermutation(const bitCapInt& perm)
-{
-    Dump();
-
-    bitLenInt j;
-
-    bitLenInt rowCount = (qubitCount << 1U) + 1U;
-
-    std::fill(r.begin(), r.end(), 0);
-
-    for (bitLenInt i = 0; i < rowCount; i++) {
-        std::fill(x[i].begin(), x[i].end(), 0);
-        std::fill(z[i].begin(), z[i].end(), 0);
-
-        if (i < qubitCount) {
-            x[i][i] = true;
-        } else if (i < (qubitCount << 1U)) {
-            j = i - qubitCount;
-            z[i][j] = true;
-        }
-    }
-
-    if (!perm) {
-        return;
-    }
-
-    for (j = 0; j < qubitCount; j++) {
-        if (perm & pow2Ocl(j)) {
-            X(j);
-        }
-    }
-}
-
-/// Sets row i equal to row k
-void QStabilizer::rowcopy(const bitLenInt& i, const bitLenInt& k)
-{
-    if (i == k) {
-        return;
-    }
-
-    for (bitLenInt j = 0; j < qubitCount; j++) {
-        x[i][j] = x[k][j];
-        z[i][j] = z[k][j];
-    }
-    r[i] = r[k];
-}
-
-/// Swaps row i and row k
-void QStabilizer::rowswap(const bitLenInt& i, const bitLenInt& k)
-{
-    if (i == k) {
-        return;
-    }
-
-    rowcopy(qubitCount << 1U, k);
-    rowcopy(k, i);
-    rowcopy(i, qubitCount << 1U);
-}
-
-/// Sets row i equal to the bth observable (X_1,...X_n,Z_1,...,Z_n)
-void QStabilizer::rowset(const bitLenInt& i, bitLenInt b)
-{
-    r[i] = 0;
-    std::fill(x[i].begin(), x[i].end(), 0);
-    std::fill(z[i].begin(), z[i].end(), 0);
-
-    if (b < qubitCount) {
-        z[i][b] = true;
-    } else {
-        b -= qubitCount;
-        x[i][b] = true;
-    }
-}
-
-/// Return the phase (0,1,2,3) when row i is LEFT-multiplied by row k
-uint8_t QStabilizer::clifford(const bitLenInt& i, const bitLenInt& k)
-{
-    // Power to which i is raised
-    bitLenInt e = 0U;
-
-    for (bitLenInt j = 0; j < qubitCount; j++) {
-        // X
-        if (x[k][j] && !z[k][j]) {
-            // XY=iZ
-            e += x[i][j] && z[i][j];
-            // XZ=-iY
-            e -= !x[i][j] && z[i][j];
-        }
-        // Y
-        if (x[k][j] && z[k][j]) {
-            // YZ=iX
-            e += !x[i][j] && z[i][j];
-            // YX=-iZ
-            e -= x[i][j] && !z[i][j];
-        }
-        // Z
-        if (!x[k][j] && z[k][j]) {
-            // ZX=iY
-            e += x[i][j] && !z[i][j];
-            // ZY=-iX
-            e -= x[i][j] && z[i][j];
-        }
-    }
-
-    e = (e + r[i] + r[k]) & 0x3;
-
-    return (uint8_t)((e < 0) ? (e + 4U) : e);
-}
-
-/// Left-multiply row i by row k
-void QStabilizer::rowmult(const bitLenInt& i, const bitLenInt& k)
-{
-    r[i] = clifford(i, k);
-    for (bitLenInt j = 0; j < qubitCount; j++) {
-        x[i][j] = x[i][j] ^ x[k][j];
-        z[i][j] = z[i][j] ^ z[k][j];
-    }
-}
-
-/**
- * Do Gaussian elimination to put the stabilizer generators in the following form:
- * At the top, a minimal set of generators containing X's and Y's, in "quasi-upper-triangular" form.
- * (Return value = number of such generators = log_2 of number of nonzero basis states)
- * At the bottom, generators containing Z's only in quasi-upper-triangular form.
- */
-bitLenInt QStabilizer::gaussian()
-{
-    // For brevity:
-    bitLenInt n = qubitCount;
-    bitLenInt maxLcv = n << 1U;
-    bitLenInt i = n;
-    bitLenInt j;
-    bitLenInt k, k2;
-
-    for (j = 0; j < n; j++) {
-
-        // Find a generator containing X in jth column
-        for (k = i; k < maxLcv; k++) {
-            if (x[k][j]) {
-                break;
-            }
-        }
-
-        if (k < maxLcv) {
-            rowswap(i, k);
-            rowswap(i - n, k - n);
-            for (k2 = i + 1U; k2 < maxLcv; k2++) {
-                if (x[k2][j]) {
-                    // Gaussian elimination step:
-                    rowmult(k2, i);
-                    rowmult(i - n, k2 - n);
-                }
-            }
-            i++;
-        }
-    }
-
-    bitLenInt g = i - n;
-
-    for (j = 0; j < n; j++) {
-
-        // Find a generator containing Z in jth column
-        for (k = i; k < maxLcv; k++) {
-            if (z[k][j]) {
-                break;
-            }
-        }
-
-        if (k < maxLcv) {
-            rowswap(i, k);
-            rowswap(i - n, k - n);
-            for (k2 = i + 1U; k2 < maxLcv; k2++) {
-                if (z[k2][j]) {
-                    rowmult(k2, i);
-                    rowmult(i - n, k2 - n);
-                }
-            }
-            i++;
-        }
-    }
-
-    return g;
-}
-
-/**
- * Finds a Pauli operator P such that the basis state P|0...0> occurs with nonzero amplitude in q, and
- * writes P to the scratch space of q.  For this to work, Gaussian elimination must already have been
- * performed on q.  g is the return value from gaussian(q).
- */
-void QStabilizer::seed(const bitLenInt& g)
-{
-    bitLenInt elemCount = qubitCount << 1U;
-    int j;
-    int f;
-    int min = 0;
-
-    // Wipe the scratch space clean
-    r[elemCount] = 0;
-    std::fill(x[elemCount].begin(), x[elemCount].end(), 0);
-    std::fill(z[elemCount].begin(), z[elemCount].end(), 0);
-
-    for (int i = elemCount - 1; i >= qubitCount + g; i--) {
-        f = r[i];
-        for (j = qubitCount - 1; j >= 0; j--) {
-            if (z[i][j]) {
-                min = j;
-                if (x[elemCount][j]) {
-                    f = (f + 2) & 0x3;
-                }
-            }
-        }
-
-        if (f == 2) {
-            j = min;
-            // Make the seed consistent with the ith equation
-            x[elemCount][j] = !x[elemCount][j];
-        }
-    }
-}
-
-/// Returns the result of applying the Pauli operator in the "scratch space" of q to |0...0>
-void QStabilizer::setBasisState(const real1& nrm, complex* stateVec)
-{
-    bitLenInt elemCount = qubitCount << 1U;
-    bitLenInt j;
-    uint8_t e = r[elemCount];
-
-    for (j = 0; j < qubitCount; j++) {
-        // Pauli operator is "Y"
-        if (x[elemCount][j] && z[elemCount][j]) {
-            e = (e + 1) & 0x3;
-        }
-    }
-
-    complex amp = nrm;
-    if (e & 1) {
-        amp *= I_CMPLX;
-    }
-    if (e & 2) {
-        amp *= -ONE_CMPLX;
-    }
-
-    bitCapIntOcl perm = 0;
-    for (j = 0; j < qubitCount; j++) {
-        if (x[elemCount][j]) {
-            perm |= pow2Ocl(j);
-        }
-    }
-
-    stateVec[perm] = amp;
-}
-
-#define C_SQRT1_2 complex(M_SQRT1_2, ZERO_R1)
-#define C_I_SQRT1_2 complex(ZERO_R1, M_SQRT1_2)
-
-/// Convert the state to ket notation (warning: could be huge!)
-void QStabilizer::GetQuantumState(complex* stateVec)
-{
-    Finish();
-
-    bitCapIntOcl t;
-    bitCapIntOcl t2;
-    bitLenInt i;
-
-    // log_2 of number of nonzero basis states
-    bitLenInt g = gaussian();
-    bitCapIntOcl permCount = pow2Ocl(g);
-    bitCapIntOcl permCountMin1 = permCount - ONE_BCI;
-    bitLenInt elemCount = qubitCount << 1U;
-    real1 nrm = sqrt(ONE_R1 / permCount);
-
-    seed(g);
-
-    // init stateVec as all 0 values
-    std::fill(stateVec, stateVec + pow2Ocl(qubitCount), ZERO_CMPLX);
-
-    setBasisState(nrm, stateVec);
-    for (t = 0; t < permCountMin1; t++) {
-        t2 = t ^ (t + 1);
-        for (i = 0; i < g; i++) {
-            if (t2 & pow2Ocl(i)) {
-                rowmult(elemCount, qubitCount + i);
-            }
-        }
-        setBasisState(nrm, stateVec);
-    }
-}
-
-/// Apply a CNOT gate with control and target
-void QStabilizer::CNOT(const bitLenInt& c, const bitLenInt& t)
-{
-    Dispatch([this, c, t] {
-        bitLenInt maxLcv = qubitCount << 1U;
-
-        for (bitLenInt i = 0; i < maxLcv; i++) {
-            if (x[i][c]) {
-                x[i][t] = !x[i][t];
-            }
-
-            if (z[i][t]) {
-                z[i][c] = !z[i][c];
-            }
-
-            if (x[i][c] && z[i][t] && (x[i][t] == z[i][c])) {
-                r[i] = (r[i] + 2) & 0x3;
-            }
-        }
-    });
-}
-
-/// Apply a Hadamard gate to target
-void QStabilizer::H(const bitLenInt& t)
-{
-    Dispatch([this, t] {
-        bool tmp;
-
-        bitLenInt maxLcv = qubitCount << 1U;
-
-        for (bitLenInt i = 0; i < maxLcv; i++) {
-            tmp = x[i][t];
-            x[i][t] = x[i][t] ^ (x[i][t] ^ z[i][t]);
-            z[i][t] = z[i][t] ^ (z[i][t] ^ tmp);
-            if (x[i][t] && z[i][t]) {
-                r[i] = (r[i] + 2) & 0x3;
-            }
-        }
-    });
-}
-
-/// Apply a phase gate (|0>->|0>, |1>->i|1>, or "S") to qubit b
-void QStabilizer::S(const bitLenInt& t)
-{
-    Dispatch([this, t] {
-        bitLenInt maxLcv = qubitCount << 1U;
-
-        for (bitLenInt i = 0; i < maxLcv; i++) {
-            if (x[i][t] && z[i][t]) {
-                r[i] = (r[i] + 2) & 0x3;
-            }
-            z[i][t] = z[i][t] ^ x[i][t];
-        }
-    });
-}
-
-/**
- * Returns "true" if target qubit is a Z basis eigenstate
- */
-bool QStabilizer::IsSeparableZ(const bitLenInt& t)
-{
-    Finish();
-
-    // for brevity
-    bitLenInt n = qubitCount;
-
-    // loop over stabilizer generators
-    for (bitLenInt p = 0; p < n; p++) {
-        // if a Zbar does NOT commute with Z_b (the operator being measured), then outcome is random
-        if (x[p + n][t]) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
-/**
- * Returns "true" if target qubit is an X basis eigenstate
- */
-bool QStabilizer::IsSeparableX(const bitLenInt& t)
-{
-    H(t);
-    bool isSeparable = IsSeparableZ(t);
-    H(t);
-
-    return isSeparable;
-}
-
-/**
- * Returns "true" if target qubit is a Y basis eigenstate
- */
-bool QStabilizer::IsSeparableY(const bitLenInt& t)
-{
-    H(t);
-    S(t);
-    bool isSeparable = IsSeparableZ(t);
-    IS(t);
-    H(t);
-
-    return isSeparable;
-}
-
-/**
- * Returns:
- * 0 if target qubit is not separable
- * 1 if target qubit is a Z basis eigenstate
- * 2 if target qubit is an X basis eigenstate
- * 3 if target qubit is a Y basis eigenstate
- */
-uint8_t QStabilizer::IsSeparable(const bitLenInt& t)
-{
-    if (IsSeparableZ(t)) {
-        return 1;
-    }
-
-    H(t);
-
-    if (IsSeparableZ(t)) {
-        H(t);
-        return 2;
-    }
-
-    S(t);
-
-    if (IsSeparableZ(t)) {
-        IS(t);
-        H(t);
-        return 3;
-    }
-
-    return 0;
-}
-
-/**
- * Measure qubit b
- */
-bool QStabilizer::M(const bitLenInt& t, bool result, const bool& doForce, const bool& doApply)
-{
-    if (doForce && !doApply) {
-        return result;
-    }
-
-    Finish();
-
-    bitLenInt elemCount = qubitCount << 1U;
-
-    // pivot row in stabilizer
-    bitLenInt p;
-    // pivot row in destabilizer
-    bitLenInt m;
-
-    // for brevity
-    bitLenInt n = qubitCount;
-
-    // loop over stabilizer generators
-    for (p = 0; p < n; p++) {
-        // if a Zbar does NOT commute with Z_b (the operator being measured), then outcome is random
-        if (x[p + n][t]) {
-            // The outcome is random
-            break;
-        }
-    }
-
-    // If outcome is indeterminate
-    if (p < n) {
-        // moment of quantum randomness
-        if (!doForce) {
-            result = Rand();
-        }
-
-        if (!doApply) {
-            return result;
-        }
-
-        // Set Xbar_p := Zbar_p
-        rowcopy(p, p + n);
-        // Set Zbar_p := Z_b
-        rowset(p + n, t + n);
-
-        r[p + n] = result ? 2 : 0;
-        // Now update the Xbar's and Zbar's that don't commute with Z_b
-        for (bitLenInt i = 0; i < elemCount; i++) {
-            if ((i != p) && x[i][t]) {
-                rowmult(i, p);
-            }
-        }
-
-        return result;
-    }
-
-    // If outcome is determinate
-
-    // Before, we were checking if stabilizer generators commute with Z_b; now, we're checking destabilizer
-    // generators
-    for (m = 0; m < n; m++) {
-        if (x[m][t]) {
-            break;
-        }
-    }
-
-    if (m >= n) {
-        // TODO: Repeating deterministic measurement to the exhaustion of this check might fix Decompose()/Dispose()
-        // separability issues.
-        return r[elemCount];
-    }
-
-    rowcopy(elemCount, m + n);
-    for (bitLenInt i = m + 1U; i < n; i++) {
-        if (x[i][t]) {
-            rowmult(elemCount, i + n);
-        }
-    }
-
-    return r[elemCount];
-}
-
-bitLenInt QStabilizer::Compose(QStabilizerPtr toCopy, const bitLenInt start)
-{
-    // We simply insert the (elsewhere initialized and valid) "toCopy" stabilizers and destabilizers in corresponding
-    // position, and we set the new padding to 0. This is immediately a valid state, if the two original QStablizer
-    // instances are valid.
-
-    Finish();
-    toCopy->Finish();
-
-    bitLenInt i, j;
-
-    bitLenInt rowCount = (qubitCount << 1U) + 1U;
-
-    bitLenInt length = toCopy->qubitCount;
-    bitLenInt nQubitCount = qubitCount + length;
-    bitLenInt secondStart = nQubitCount + start;
-    const std::vector<bool> row(length, 0);
-
-    for (i = 0; i < rowCount; i++) {
-        x[i].insert(x[i].begin() + start, row.begin(), row.end());
-        z[i].insert(z[i].begin() + start, row.begin(), row.end());
-    }
-
-    i = qubitCount;
-
-    std::vector<std::vector<bool>> xGroup(length, std::vector<bool>(nQubitCount, 0));
-    std::vector<std::vector<bool>> zGroup(length, std::vector<bool>(nQubitCount, 0));
-    for (i = 0; i < length; i++) {
-        std::copy(toCopy->x[i].begin(), toCopy->x[i].end(), xGroup[i].begin() + start);
-        std::copy(toCopy->z[i].begin(), toCopy->z[i].end(), zGroup[i].begin() + start);
-    }
-    x.insert(x.begin() + start, xGroup.begin(), xGroup.end());
-    z.insert(z.begin() + start, zGroup.begin(), zGroup.end());
-    r.insert(r.begin() + start, toCopy->r.begin(), toCopy->r.begin() + length);
-
-    std::vector<std::vector<bool>> xGroup2(length, std::vector<bool>(nQubitCount, 0));
-    std::vector<std::vector<bool>> zGroup2(length, std::vector<bool>(nQubitCount, 0));
-    for (i = 0; i < length; i++) {
-        j = length + i;
-        std::copy(toCopy->x[j].begin(), toCopy->x[j].end(), xGroup2[i].begin() + start);
-        std::copy(toCopy->z[j].begin(), toCopy->z[j].end(), zGroup2[i].begin() + start);
-    }
-    x.insert(x.begin() + secondStart, xGroup2.begin(), xGroup2.end());
-    z.insert(z.begin() + secondStart, zGroup2.begin(), zGroup2.end());
-    r.insert(r.begin() + secondStart, toCopy->r.begin() + length, toCopy->r.begin() + (length << 1U));
-
-    qubitCount = nQubitCount;
-
-    return start;
-}
-
-bool QStabilizer::CanDecomposeDispose(const bitLenInt start, const bitLenInt length)
-{
-    bitLenInt i, j;
-    bitLenInt end = start + length;
-
-    for (i = 0; i < start; i++) {
-        for (j = 0; j < start; j++) {
-            if (x[i][j] || z[i][j]) {
-                return false;
-            }
-        }
-    }
-
-    for (i = 0; i < start; i++) {
-        for (j = end; j < qubitCount; j++) {
-            if (x[i][j] || z[i][j]) {
-                return false;
-            }
-        }
-    }
-
-    for (i = end; i < qubitCount; i++) {
-        for (j = 0; j < start; j++) {
-            if (x[i][j] || z[i][j]) {
-                return false;
-            }
-        }
-    }
-
-    for (i = end; i < qubitCount; i++) {
-        for (j = end; j < qubitCount; j++) {
-            if (x[i][j] || z[i][j]) {
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
-void QStabilizer::DecomposeDispose(const bitLenInt start, const bitLenInt length, QStabilizerPtr dest)
-{
-    if (length == 0) {
-        return;
-    }
-
-    Finish();
-
-    // We assume that the bits to "decompose" the representation of already have 0 cross-terms in their generators
-    // outside inter- "dest" cross terms. (Usually, we're "decomposing" the representation of a just-measured single
-    // qubit.)
-
-    bitLenInt i, j;
-
-    bitLenInt end = start + length;
-    bitLenInt nQubitCount = qubitCount - length;
-    bitLenInt secondStart = nQubitCount + start;
-    bitLenInt secondEnd = nQubitCount + end;
-
-    if (dest) {
-        dest->Finish();
-
-        for (i = 0; i < length; i++) {
-            j = start + i;
-            std::copy(x[j].begin() + start, x[j].begin() + end, dest->x[i].begin());
-            std::copy(z[j].begin() + start, z[j].begin() + end, dest->z[i].begin());
-
-            j = qubitCount + start + i;
-            std::copy(x[j].begin() + start, x[j].begin() + end, dest->x[i + length].begin());
-            std::copy(z[j].begin() + start, z[j].begin() + end, dest->z[i + length].begin());
-        }
-        j = start;
-        std::copy(r.begin() + j, r.begin() + j + length, dest->r.begin());
-        j = qubitCount + start;
-        std::copy(r.begin() + j, r.begin() + j + length, dest->r.begin() + length);
-    }
-
-    x.erase(x.begin() + start, x.begin() + end);
-    z.erase(z.begin() + start, z.begin() + end);
-    r.erase(r.begin() + start, r.begin() + end);
-    x.erase(x.begin() + secondStart, x.begin() + secondEnd);
-    z.erase(z.begin() + secondStart, z.begin() + secondEnd);
-    r.erase(r.begin() + secondStart, r.begin() + secondEnd);
-
-    qubitCount = nQubitCount;
-
-    bitLenInt rowCount = (qubitCount << 1U) + 1U;
-
-    for (i = 0; i < rowCount; i++) {
-        x[i].erase(x[i].begin() + start, x[i].begin() + end);
-        z[i].erase(z[i].begin() + start, z[i].begin() + end);
-    }
-}
-
-bool QStabilizer::ApproxCompare(QStabilizerPtr o)
-{
-    if (qubitCount != o->qubitCount) {
-        return false;
-    }
-
-    Finish();
-    o->Finish();
-
-    if (r != o->r) {
-        return false;
-    }
-
-    bitLenInt rowCount = (qubitCount << 1U) + 1U;
-
-    for (bitLenInt i = 0; i < rowCount; i++) {
-        if (x[i] != o->x[i]) {
-            return false;
-        }
-        if (z[i] != o->z[i]) {
-            return false;
-        }
-    }
-
-    return true;
-}
-} // namespace Qrack
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// Adapted from:
+//
+// CHP: CNOT-Hadamard-Phase
+// Stabilizer Quantum Computer Simulator
+// by Scott Aaronson
+// Last modified June 30, 2004
+//
+// Thanks to Simon Anders and Andrew Cross for bugfixes
+//
+// https://www.scottaaronson.com/chp/
+//
+// Daniel Strano and the Qrack contributers appreciate Scott Aaronson's open sharing of the CHP code, and we hope that
+// vm6502q/qrack is one satisfactory framework by which CHP could be adapted to enter the C++ STL. Our project
+// philosophy aims to raise the floor of decentralized quantum computing technology access across all modern platforms,
+// for all people, not commercialization.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "qstabilizer.hpp"
+
+namespace Qrack {
+
+QStabilizer::QStabilizer(const bitLenInt& n, const bitCapInt& perm, bool useHardwareRNG, qrack_rand_gen_ptr rgp)
+    : qubitCount(n)
+    , wordCount(WordsPerRow(n))
+    , x((((bitCapIntOcl)n << 1U) + 1U) * wordCount)
+    , z((((bitCapIntOcl)n << 1U) + 1U) * wordCount)
+    , r((n << 1U) + 1U)
+    , rand_distribution(0.0, 1.0)
+    , hardware_rand_generator(NULL)
+{
+#if !ENABLE_RDRAND
+    useHardwareRNG = false;
+#endif
+
+    if (useHardwareRNG) {
+        hardware_rand_generator = std::make_shared<RdRandom>();
+#if !ENABLE_RNDFILE
+        if (!(hardware_rand_generator->SupportsRDRAND())) {
+            hardware_rand_generator = NULL;
+        }
+#endif
+    }
+
+    SetConcurrencyLevel(std::thread::hardware_concurrency());
+
+    if ((rgp == NULL) && (hardware_rand_generator == NULL)) {
+        rand_generator = std::make_shared<qrack_rand_gen>();
+        randomSeed = time(0);
+        SetRandomSeed(randomSeed);
+    } else {
+        rand_generator = rgp;
+    }
+
+    SetPermutation(perm);
+}
+
+void QStabilizer::SetPermutation(const bitCapInt& perm)
+{
+    Dump();
+
+    bitLenInt j;
+
+    bitLenInt rowCount = (qubitCount << 1U) + 1U;
+
+    std::fill(r.begin(), r.end(), 0);
+    std::fill(x.begin(), x.end(), 0);
+    std::fill(z.begin(), z.end(), 0);
+
+    for (bitLenInt i = 0; i < rowCount; i++) {
+        if (i < qubitCount) {
+            flipX(i, i);
+        } else if (i < (qubitCount << 1U)) {
+            j = i - qubitCount;
+            flipZ(i, j);
+        }
+    }
+
+    if (!perm) {
+        return;
+    }
+
+    for (j = 0; j < qubitCount; j++) {
+        if (perm & pow2Ocl(j)) {
+            X(j);
+        }
+    }
+}
+
+void QStabilizer::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    Finish();
+
+    writer.WriteRecord(CHECKPOINT_STABILIZER, qubitCount);
+    writer.Write(x);
+    writer.Write(z);
+    writer.Write(r);
+}
+
+void QStabilizer::ReadCheckpoint(QCheckpointReader& reader)
+{
+    reader.ReadRecord(CHECKPOINT_STABILIZER, qubitCount);
+
+    // The tableau is read aside, so that this register and its queued gates are left as they were if the checkpoint
+    // is malformed.
+    const bitCapIntOcl rowCount = ((bitCapIntOcl)qubitCount << 1U) + 1U;
+    std::vector<uint64_t> nX, nZ;
+    std::vector<uint8_t> nR;
+    reader.Read(nX, rowCount * WordsPerRow(qubitCount));
+    reader.Read(nZ, rowCount * WordsPerRow(qubitCount));
+    reader.Read(nR, rowCount);
+
+    Dump();
+    x.swap(nX);
+    z.swap(nZ);
+    r.swap(nR);
+}
+
+/// Sets row i equal to row k
+void QStabilizer::rowcopy(const bitLenInt& i, const bitLenInt& k)
+{
+    if (i == k) {
+        return;
+    }
+
+    std::copy(xRow(k), xRow(k) + wordCount, xRow(i));
+    std::copy(zRow(k), zRow(k) + wordCount, zRow(i));
+    r[i] = r[k];
+}
+
+/// Swaps row i and row k
+void QStabilizer::rowswap(const bitLenInt& i, const bitLenInt& k)
+{
+    if (i == k) {
+        return;
+    }
+
+    std::swap_ranges(xRow(k), xRow(k) + wordCount, xRow(i));
+    std::swap_ranges(zRow(k), zRow(k) + wordCount, zRow(i));
+    std::swap(r[i], r[k]);
+}
+
+/// Sets row i equal to the bth observable (X_1,...X_n,Z_1,...,Z_n)
+void QStabilizer::rowset(const bitLenInt& i, bitLenInt b)
+{
+    r[i] = 0;
+    std::fill(xRow(i), xRow(i) + wordCount, 0);
+    std::fill(zRow(i), zRow(i) + wordCount, 0);
+
+    if (b < qubitCount) {
+        flipX(i, b);
+    } else {
+        b -= qubitCount;
+        flipZ(i, b);
+    }
+}
+
+uint8_t QStabilizer::CliffordPhase(const uint64_t* xi, const uint64_t* zi, const uint8_t& ri, const uint64_t* xk,
+    const uint64_t* zk, const uint8_t& rk, const bitCapIntOcl& words)
+{
+    // Power to which i is raised
+    int e = 0;
+
+    for (bitCapIntOcl w = 0; w < words; w++) {
+        const uint64_t x1 = xk[w];
+        const uint64_t z1 = zk[w];
+        const uint64_t x2 = xi[w];
+        const uint64_t z2 = zi[w];
+
+        // XY=iZ, YZ=iX, ZX=iY
+        const uint64_t plus = (x1 & ~z1 & x2 & z2) | (x1 & z1 & ~x2 & z2) | (~x1 & z1 & x2 & ~z2);
+        // XZ=-iY, YX=-iZ, ZY=-iX
+        const uint64_t minus = (x1 & ~z1 & ~x2 & z2) | (x1 & z1 & x2 & ~z2) | (~x1 & z1 & x2 & z2);
+
+        e += PopCount(plus) - PopCount(minus);
+    }
+
+    // (Two's complement "& 0x3" is also correct modulo 4 for negative "e.")
+    return (uint8_t)((e + ri + rk) & 0x3);
+}
+
+void QStabilizer::MultiplyRow(uint64_t* xi, uint64_t* zi, uint8_t& ri, const uint64_t* xk, const uint64_t* zk,
+    const uint8_t& rk, const bitCapIntOcl& words)
+{
+    ri = CliffordPhase(xi, zi, ri, xk, zk, rk, words);
+    for (bitCapIntOcl w = 0; w < words; w++) {
+        xi[w] ^= xk[w];
+        zi[w] ^= zk[w];
+    }
+}
+
+/// Return the phase (0,1,2,3) when row i is LEFT-multiplied by row k
+uint8_t QStabilizer::clifford(const bitLenInt& i, const bitLenInt& k)
+{
+    return CliffordPhase(xRow(i), zRow(i), r[i], xRow(k), zRow(k), r[k], wordCount);
+}
+
+/// Left-multiply row i by row k
+void QStabilizer::rowmult(const bitLenInt& i, const bitLenInt& k)
+{
+    MultiplyRow(xRow(i), zRow(i), r[i], xRow(k), zRow(k), r[k], wordCount);
+}
+
+/// Left-multiply row i by every row in "ks," (which must all commute with each other, so that order is irrelevant)
+void QStabilizer::rowmultAll(const bitLenInt& i, const std::vector<bitLenInt>& ks)
+{
+    const int32_t threads = GetConcurrencyLevel();
+    if ((threads <= 1) || (ks.size() < 2U)) {
+        for (size_t j = 0; j < ks.size(); j++) {
+            rowmult(i, ks[j]);
+        }
+        return;
+    }
+
+    // Each thread accumulates the product of the rows it is handed, starting from the identity, and the partial
+    // products are multiplied into row i at the end. (Because the factors commute, grouping doesn't change the result.)
+    std::vector<uint64_t> xPartial(threads * wordCount, 0);
+    std::vector<uint64_t> zPartial(threads * wordCount, 0);
+    std::vector<uint8_t> rPartial(threads, 0);
+    par_for_weighted(0, ks.size(), wordCount << 1U, [&](const bitCapInt lcv, const int cpu) {
+        const bitLenInt k = ks[(size_t)lcv];
+        MultiplyRow(xPartial.data() + cpu * wordCount, zPartial.data() + cpu * wordCount, rPartial[cpu], xRow(k),
+            zRow(k), r[k], wordCount);
+    });
+
+    for (int32_t cpu = 0; cpu < threads; cpu++) {
+        MultiplyRow(xRow(i), zRow(i), r[i], xPartial.data() + cpu * wordCount, zPartial.data() + cpu * wordCount,
+            rPartial[cpu], wordCount);
+    }
+}
+
+void QStabilizer::CopyBits(
+    const uint64_t* src, const bitLenInt& srcStart, uint64_t* dst, const bitLenInt& dstStart, const bitLenInt& length)
+{
+    bitCapIntOcl j, s, d;
+    for (j = 0; j < length; j++) {
+        s = srcStart + j;
+        d = dstStart + j;
+        if (src[s >> 6U] & BitMask(s)) {
+            dst[d >> 6U] |= BitMask(d);
+        } else {
+            dst[d >> 6U] &= ~BitMask(d);
+        }
+    }
+}
+
+/// Gaussian elimination step: clear column j, (of z if "isZ," or else of x,) from the stabilizer rows below row i
+void QStabilizer::eliminate(const bitLenInt& i, const bitLenInt& j, const bool& isZ)
+{
+    const bitLenInt n = qubitCount;
+    const bitLenInt maxLcv = n << 1U;
+
+    std::vector<bitLenInt> stabilizerRows;
+    std::vector<bitLenInt> destabilizerRows;
+    for (bitLenInt k = i + 1U; k < maxLcv; k++) {
+        if (isZ ? getZ(k, j) : getX(k, j)) {
+            stabilizerRows.push_back(k);
+            destabilizerRows.push_back(k - n);
+        }
+    }
+
+    // Every stabilizer row only reads the pivot row, so the rows are independent.
+    par_for_weighted(0, stabilizerRows.size(), wordCount << 1U,
+        [&](const bitCapInt lcv, const int cpu) { rowmult(stabilizerRows[(size_t)lcv], i); });
+    // Destabilizers commute with each other.
+    rowmultAll(i - n, destabilizerRows);
+}
+
+/**
+ * Do Gaussian elimination to put the stabilizer generators in the following form:
+ * At the top, a minimal set of generators containing X's and Y's, in "quasi-upper-triangular" form.
+ * (Return value = number of such generators = log_2 of number of nonzero basis states)
+ * At the bottom, generators containing Z's only in quasi-upper-triangular form.
+ */
+bitLenInt QStabilizer::gaussian()
+{
+    // For brevity:
+    bitLenInt n = qubitCount;
+    bitLenInt maxLcv = n << 1U;
+    bitLenInt i = n;
+    bitLenInt j;
+    bitLenInt k;
+
+    for (j = 0; j < n; j++) {
+
+        // Find a generator containing X in jth column
+        for (k = i; k < maxLcv; k++) {
+            if (getX(k, j)) {
+                break;
+            }
+        }
+
+        if (k < maxLcv) {
+            rowswap(i, k);
+            rowswap(i - n, k - n);
+            eliminate(i, j, false);
+            i++;
+        }
+    }
+
+    bitLenInt g = i - n;
+
+    for (j = 0; j < n; j++) {
+
+        // Find a generator containing Z in jth column
+        for (k = i; k < maxLcv; k++) {
+            if (getZ(k, j)) {
+                break;
+            }
+        }
+
+        if (k < maxLcv) {
+            rowswap(i, k);
+            rowswap(i - n, k - n);
+            eliminate(i, j, true);
+            i++;
+        }
+    }
+
+    return g;
+}
+
+/**
+ * Finds a Pauli operator P such that the basis state P|0...0> occurs with nonzero amplitude in q, and
+ * writes P to the scratch space of q.  For this to work, Gaussian elimination must already have been
+ * performed on q.  g is the return value from gaussian(q).
+ */
+void QStabilizer::seed(const bitLenInt& g)
+{
+    bitLenInt elemCount = qubitCount << 1U;
+    int f;
+    int min = 0;
+    bitCapIntOcl w;
+
+    // Wipe the scratch space clean
+    r[elemCount] = 0;
+    std::fill(xRow(elemCount), xRow(elemCount) + wordCount, 0);
+    std::fill(zRow(elemCount), zRow(elemCount) + wordCount, 0);
+
+    uint64_t* xs = xRow(elemCount);
+    for (int i = elemCount - 1; i >= qubitCount + g; i--) {
+        const uint64_t* zi = zRow(i);
+
+        f = r[i];
+        for (w = 0; w < wordCount; w++) {
+            f += PopCount(zi[w] & xs[w]) << 1U;
+        }
+        f &= 0x3;
+
+        // "min" is the lowest Z column in the ith row, (or, if there is none, it stays as it was).
+        for (w = 0; w < wordCount; w++) {
+            if (zi[w]) {
+                uint64_t word = zi[w];
+                min = (int)(w << 6U);
+                while (!(word & 1U)) {
+                    word >>= 1U;
+                    min++;
+                }
+                break;
+            }
+        }
+
+        if (f == 2) {
+            // Make the seed consistent with the ith equation
+            flipX(elemCount, min);
+        }
+    }
+}
+
+/// Writes the result of applying the Pauli operator (xs, zs, rs) to |0...0>, times "nrm," to the state vector
+void QStabilizer::setBasisState(
+    const real1& nrm, complex* stateVec, const uint64_t* xs, const uint64_t* zs, const uint8_t& rs)
+{
+    bitCapIntOcl w;
+    int e = rs;
+
+    for (w = 0; w < wordCount; w++) {
+        // Pauli operator is "Y"
+        e += PopCount(xs[w] & zs[w]);
+    }
+    e &= 0x3;
+
+    complex amp = nrm;
+    if (e & 1) {
+        amp *= I_CMPLX;
+    }
+    if (e & 2) {
+        amp *= -ONE_CMPLX;
+    }
+
+    // (A state vector can't be wider than one word.)
+    bitCapIntOcl perm = wordCount ? (bitCapIntOcl)xs[0] : 0;
+
+    stateVec[perm] = amp;
+}
+
+#define C_SQRT1_2 complex(M_SQRT1_2, ZERO_R1)
+#define C_I_SQRT1_2 complex(ZERO_R1, M_SQRT1_2)
+
+/// Convert the state to ket notation (warning: could be huge!)
+void QStabilizer::GetQuantumState(complex* stateVec)
+{
+    Finish();
+
+    // log_2 of number of nonzero basis states
+    const bitLenInt g = gaussian();
+    const bitLenInt elemCount = qubitCount << 1U;
+    const real1 nrm = sqrt(ONE_R1 / pow2Ocl(g));
+
+    seed(g);
+
+    // init stateVec as all 0 values
+    par_for(0, pow2Ocl(qubitCount), [&](const bitCapInt lcv, const int cpu) { stateVec[lcv] = ZERO_CMPLX; });
+
+    // The nonzero amplitudes are (product of a subset of the g "X" generators) * (seed) |0...0>, with one subset per
+    // basis state. The generators commute and square to the identity, so each subset can be built independently of
+    // the others. The high bits of the subset pick a chunk, and the low bits are walked in Gray code order within it,
+    // so that each state costs only a single row multiplication.
+    bitLenInt chunkPow = 0;
+    const bitCapIntOcl chunkTarget = ((bitCapIntOcl)GetConcurrencyLevel()) << 2U;
+    while ((chunkPow < g) && (pow2Ocl(chunkPow) < chunkTarget)) {
+        chunkPow++;
+    }
+    const bitLenInt walkPow = g - chunkPow;
+    const bitCapIntOcl walkCount = pow2Ocl(walkPow);
+
+    par_for_weighted(0, pow2Ocl(chunkPow), walkCount * wordCount, [&](const bitCapInt lcv, const int cpu) {
+        std::vector<uint64_t> xs(xRow(elemCount), xRow(elemCount) + wordCount);
+        std::vector<uint64_t> zs(zRow(elemCount), zRow(elemCount) + wordCount);
+        uint8_t rs = r[elemCount];
+
+        bitLenInt i;
+        const bitCapIntOcl chunk = (bitCapIntOcl)lcv;
+        for (i = 0; i < chunkPow; i++) {
+            if (chunk & pow2Ocl(i)) {
+                const bitLenInt k = qubitCount + walkPow + i;
+                MultiplyRow(xs.data(), zs.data(), rs, xRow(k), zRow(k), r[k], wordCount);
+            }
+        }
+
+        setBasisState(nrm, stateVec, xs.data(), zs.data(), rs);
+        for (bitCapIntOcl t = 1; t < walkCount; t++) {
+            // Gray code: consecutive subsets differ only in the generator at the lowest set bit of t.
+            i = 0;
+            while (!(t & pow2Ocl(i))) {
+                i++;
+            }
+            const bitLenInt k = qubitCount + i;
+            MultiplyRow(xs.data(), zs.data(), rs, xRow(k), zRow(k), r[k], wordCount);
+            setBasisState(nrm, stateVec, xs.data(), zs.data(), rs);
+        }
+    });
+}
+
+/// Apply a CNOT gate with control and target
+void QStabilizer::CNOT(const bitLenInt& c, const bitLenInt& t)
+{
+    Dispatch([this, c, t] {
+        bitLenInt maxLcv = qubitCount << 1U;
+        const bitCapIntOcl cw = c >> 6U;
+        const bitCapIntOcl tw = t >> 6U;
+        const uint64_t cm = BitMask(c);
+        const uint64_t tm = BitMask(t);
+
+        for (bitLenInt i = 0; i < maxLcv; i++) {
+            uint64_t* xi = xRow(i);
+            uint64_t* zi = zRow(i);
+
+            if (xi[cw] & cm) {
+                xi[tw] ^= tm;
+            }
+
+            if (zi[tw] & tm) {
+                zi[cw] ^= cm;
+            }
+
+            if ((xi[cw] & cm) && (zi[tw] & tm) && (!(xi[tw] & tm) == !(zi[cw] & cm))) {
+                r[i] = (r[i] + 2) & 0x3;
+            }
+        }
+    });
+}
+
+/// Apply a Hadamard gate to target
+void QStabilizer::H(const bitLenInt& t)
+{
+    Dispatch([this, t] {
+        bitLenInt maxLcv = qubitCount << 1U;
+        const bitCapIntOcl tw = t >> 6U;
+        const uint64_t tm = BitMask(t);
+
+        for (bitLenInt i = 0; i < maxLcv; i++) {
+            uint64_t& xi = xRow(i)[tw];
+            uint64_t& zi = zRow(i)[tw];
+
+            // Swap the x and z bits.
+            if (!(xi & tm) != !(zi & tm)) {
+                xi ^= tm;
+                zi ^= tm;
+            }
+
+            if ((xi & tm) && (zi & tm)) {
+                r[i] = (r[i] + 2) & 0x3;
+            }
+        }
+    });
+}
+
+/// Apply a phase gate (|0>->|0>, |1>->i|1>, or "S") to qubit b
+void QStabilizer::S(const bitLenInt& t)
+{
+    Dispatch([this, t] {
+        bitLenInt maxLcv = qubitCount << 1U;
+        const bitCapIntOcl tw = t >> 6U;
+        const uint64_t tm = BitMask(t);
+
+        for (bitLenInt i = 0; i < maxLcv; i++) {
+            uint64_t& xi = xRow(i)[tw];
+            uint64_t& zi = zRow(i)[tw];
+
+            if ((xi & tm) && (zi & tm)) {
+                r[i] = (r[i] + 2) & 0x3;
+            }
+            zi ^= xi & tm;
+        }
+    });
+}
+
+/**
+ * Returns "true" if target qubit is a Z basis eigenstate
+ */
+bool QStabilizer::IsSeparableZ(const bitLenInt& t)
+{
+    Finish();
+
+    // for brevity
+    bitLenInt n = qubitCount;
+
+    // loop over stabilizer generators
+    for (bitLenInt p = 0; p < n; p++) {
+        // if a Zbar does NOT commute with Z_b (the operator being measured), then outcome is random
+        if (getX(p + n, t)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns "true" if target qubit is an X basis eigenstate
+ */
+bool QStabilizer::IsSeparableX(const bitLenInt& t)
+{
+    H(t);
+    bool isSeparable = IsSeparableZ(t);
+    H(t);
+
+    return isSeparable;
+}
+
+/**
+ * Returns "true" if target qubit is a Y basis eigenstate
+ */
+bool QStabilizer::IsSeparableY(const bitLenInt& t)
+{
+    H(t);
+    S(t);
+    bool isSeparable = IsSeparableZ(t);
+    IS(t);
+    H(t);
+
+    return isSeparable;
+}
+
+/**
+ * Returns:
+ * 0 if target qubit is not separable
+ * 1 if target qubit is a Z basis eigenstate
+ * 2 if target qubit is an X basis eigenstate
+ * 3 if target qubit is a Y basis eigenstate
+ */
+uint8_t QStabilizer::IsSeparable(const bitLenInt& t)
+{
+    if (IsSeparableZ(t)) {
+        return 1;
+    }
+
+    H(t);
+
+    if (IsSeparableZ(t)) {
+        H(t);
+        return 2;
+    }
+
+    S(t);
+
+    if (IsSeparableZ(t)) {
+        IS(t);
+        H(t);
+        return 3;
+    }
+
+    IS(t);
+    H(t);
+
+    return 0;
+}
+
+/**
+ * Measure qubit b
+ */
+bool QStabilizer::M(const bitLenInt& t, bool result, const bool& doForce, const bool& doApply)
+{
+    if (doForce && !doApply) {
+        return result;
+    }
+
+    Finish();
+
+    bitLenInt elemCount = qubitCount << 1U;
+
+    // pivot row in stabilizer
+    bitLenInt p;
+    // pivot row in destabilizer
+    bitLenInt m;
+
+    // for brevity
+    bitLenInt n = qubitCount;
+
+    // loop over stabilizer generators
+    for (p = 0; p < n; p++) {
+        // if a Zbar does NOT commute with Z_b (the operator being measured), then outcome is random
+        if (getX(p + n, t)) {
+            // The outcome is random
+            break;
+        }
+    }
+
+    // If outcome is indeterminate
+    if (p < n) {
+        // moment of quantum randomness
+        if (!doForce) {
+            result = Rand();
+        }
+
+        if (!doApply) {
+            return result;
+        }
+
+        // Set Xbar_p := Zbar_p
+        rowcopy(p, p + n);
+        // Set Zbar_p := Z_b
+        rowset(p + n, t + n);
+
+        r[p + n] = result ? 2 : 0;
+        // Now update the Xbar's and Zbar's that don't commute with Z_b, (each of which only reads row p)
+        std::vector<bitLenInt> rows;
+        for (bitLenInt i = 0; i < elemCount; i++) {
+            if ((i != p) && getX(i, t)) {
+                rows.push_back(i);
+            }
+        }
+        par_for_weighted(0, rows.size(), wordCount << 1U,
+            [&](const bitCapInt lcv, const int cpu) { rowmult(rows[(size_t)lcv], p); });
+
+        return result;
+    }
+
+    // If outcome is determinate
+
+    // Before, we were checking if stabilizer generators commute with Z_b; now, we're checking destabilizer
+    // generators
+    for (m = 0; m < n; m++) {
+        if (getX(m, t)) {
+            break;
+        }
+    }
+
+    if (m >= n) {
+        // TODO: Repeating deterministic measurement to the exhaustion of this check might fix Decompose()/Dispose()
+        // separability issues.
+        return r[elemCount];
+    }
+
+    rowcopy(elemCount, m + n);
+    // Stabilizers commute with each other, so their product can be accumulated in parallel.
+    std::vector<bitLenInt> rows;
+    for (bitLenInt i = m + 1U; i < n; i++) {
+        if (getX(i, t)) {
+            rows.push_back(i + n);
+        }
+    }
+    rowmultAll(elemCount, rows);
+
+    return r[elemCount];
+}
+
+bitLenInt QStabilizer::Compose(QStabilizerPtr toCopy, const bitLenInt start)
+{
+    // We simply insert the (elsewhere initialized and valid) "toCopy" stabilizers and destabilizers in corresponding
+    // position, and we set the new padding to 0. This is immediately a valid state, if the two original QStablizer
+    // instances are valid.
+
+    Finish();
+    toCopy->Finish();
+
+    bitLenInt i, h;
+
+    bitLenInt length = toCopy->qubitCount;
+    bitLenInt nQubitCount = qubitCount + length;
+    bitLenInt endLength = qubitCount - start;
+    bitCapIntOcl nWordCount = WordsPerRow(nQubitCount);
+    bitCapIntOcl nRowCount = ((bitCapIntOcl)nQubitCount << 1U) + 1U;
+
+    std::vector<uint64_t> nX(nRowCount * nWordCount, 0);
+    std::vector<uint64_t> nZ(nRowCount * nWordCount, 0);
+    std::vector<uint8_t> nR(nRowCount, 0);
+
+    // Our rows keep their columns below "start," and the rest move up by "length," to make room for "toCopy."
+    auto copyOwnRow = [&](const bitCapIntOcl& from, const bitCapIntOcl& to) {
+        CopyBits(xRow(from), 0, nX.data() + to * nWordCount, 0, start);
+        CopyBits(zRow(from), 0, nZ.data() + to * nWordCount, 0, start);
+        CopyBits(xRow(from), start, nX.data() + to * nWordCount, start + length, endLength);
+        CopyBits(zRow(from), start, nZ.data() + to * nWordCount, start + length, endLength);
+        nR[to] = r[from];
+    };
+
+    // Destabilizers (h = 0) then stabilizers (h = 1); "toCopy" rows are inserted at "start" in each.
+    for (h = 0; h < 2U; h++) {
+        bitCapIntOcl offset = h ? qubitCount : 0U;
+        bitCapIntOcl nOffset = h ? nQubitCount : 0U;
+        bitCapIntOcl oOffset = h ? length : 0U;
+
+        for (i = 0; i < start; i++) {
+            copyOwnRow(offset + i, nOffset + i);
+        }
+        for (i = 0; i < length; i++) {
+            bitCapIntOcl to = nOffset + start + i;
+            CopyBits(toCopy->xRow(oOffset + i), 0, nX.data() + to * nWordCount, start, length);
+            CopyBits(toCopy->zRow(oOffset + i), 0, nZ.data() + to * nWordCount, start, length);
+            nR[to] = toCopy->r[oOffset + i];
+        }
+        for (i = 0; i < endLength; i++) {
+            copyOwnRow(offset + start + i, nOffset + start + length + i);
+        }
+    }
+    // Scratch row
+    copyOwnRow((bitCapIntOcl)qubitCount << 1U, (bitCapIntOcl)nQubitCount << 1U);
+
+    x.swap(nX);
+    z.swap(nZ);
+    r.swap(nR);
+    wordCount = nWordCount;
+    qubitCount = nQubitCount;
+
+    return start;
+}
+
+bool QStabilizer::CanDecomposeDispose(const bitLenInt start, const bitLenInt length)
+{
+    bitLenInt i, j;
+    bitLenInt end = start + length;
+
+    for (i = 0; i < start; i++) {
+        for (j = 0; j < start; j++) {
+            if (getX(i, j) || getZ(i, j)) {
+                return false;
+            }
+        }
+    }
+
+    for (i = 0; i < start; i++) {
+        for (j = end; j < qubitCount; j++) {
+            if (getX(i, j) || getZ(i, j)) {
+                return false;
+            }
+        }
+    }
+
+    for (i = end; i < qubitCount; i++) {
+        for (j = 0; j < start; j++) {
+            if (getX(i, j) || getZ(i, j)) {
+                return false;
+            }
+        }
+    }
+
+    for (i = end; i < qubitCount; i++) {
+        for (j = end; j < qubitCount; j++) {
+            if (getX(i, j) || getZ(i, j)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void QStabilizer::DecomposeDispose(const bitLenInt start, const bitLenInt length, QStabilizerPtr dest)
+{
+    if (length == 0) {
+        return;
+    }
+
+    Finish();
+
+    // We assume that the bits to "decompose" the representation of already have 0 cross-terms in their generators
+    // outside inter- "dest" cross terms. (Usually, we're "decomposing" the representation of a just-measured single
+    // qubit.)
+
+    bitLenInt i, h;
+
+    bitLenInt end = start + length;
+    bitLenInt nQubitCount = qubitCount - length;
+    bitLenInt endLength = qubitCount - end;
+    bitCapIntOcl nWordCount = WordsPerRow(nQubitCount);
+    bitCapIntOcl nRowCount = ((bitCapIntOcl)nQubitCount << 1U) + 1U;
+
+    if (dest) {
+        dest->Finish();
+
+        for (i = 0; i < length; i++) {
+            bitCapIntOcl j = start + i;
+            CopyBits(xRow(j), start, dest->xRow(i), 0, length);
+            CopyBits(zRow(j), start, dest->zRow(i), 0, length);
+            dest->r[i] = r[j];
+
+            j = qubitCount + start + i;
+            CopyBits(xRow(j), start, dest->xRow(i + length), 0, length);
+            CopyBits(zRow(j), start, dest->zRow(i + length), 0, length);
+            dest->r[i + length] = r[j];
+        }
+    }
+
+    std::vector<uint64_t> nX(nRowCount * nWordCount, 0);
+    std::vector<uint64_t> nZ(nRowCount * nWordCount, 0);
+    std::vector<uint8_t> nR(nRowCount, 0);
+
+    // Remaining rows drop the columns from "start" to "end."
+    auto copyOwnRow = [&](const bitCapIntOcl& from, const bitCapIntOcl& to) {
+        CopyBits(xRow(from), 0, nX.data() + to * nWordCount, 0, start);
+        CopyBits(zRow(from), 0, nZ.data() + to * nWordCount, 0, start);
+        CopyBits(xRow(from), end, nX.data() + to * nWordCount, start, endLength);
+        CopyBits(zRow(from), end, nZ.data() + to * nWordCount, start, endLength);
+        nR[to] = r[from];
+    };
+
+    // Destabilizers (h = 0) then stabilizers (h = 1)
+    for (h = 0; h < 2U; h++) {
+        bitCapIntOcl offset = h ? qubitCount : 0U;
+        bitCapIntOcl nOffset = h ? nQubitCount : 0U;
+
+        for (i = 0; i < start; i++) {
+            copyOwnRow(offset + i, nOffset + i);
+        }
+        for (i = 0; i < endLength; i++) {
+            copyOwnRow(offset + end + i, nOffset + start + i);
+        }
+    }
+    // Scratch row
+    copyOwnRow((bitCapIntOcl)qubitCount << 1U, (bitCapIntOcl)nQubitCount << 1U);
+
+    x.swap(nX);
+    z.swap(nZ);
+    r.swap(nR);
+    wordCount = nWordCount;
+    qubitCount = nQubitCount;
+}
+
+bool QStabilizer::ApproxCompare(QStabilizerPtr o)
+{
+    if (qubitCount != o->qubitCount) {
+        return false;
+    }
+
+    Finish();
+    o->Finish();
+
+    // Padding bits are always 0, so equal tableaux have equal words.
+    return (r == o->r) && (x == o->x) && (z == o->z);
+}
+} // namespace Qrack
@@ -10,6 +10,7 @@
 
 #include <thread>
 
+#include "common/qprofiler.hpp"
 #include "qfactory.hpp"
 #include "qstabilizerhybrid.hpp"
 
@@ -51,12 +52,15 @@ QStabilizerHybrid::QStabilizerHybrid(QInterfaceEngine eng, QInterfaceEngine subE
 
     concurrency = std::thread::hardware_concurrency();
     stabilizer = MakeStabilizer(initState);
+    phaseBuffer.resize(qubitCount, ONE_CMPLX);
     amplitudeFloor = REAL1_EPSILON;
 }
 
 QStabilizerPtr QStabilizerHybrid::MakeStabilizer(const bitCapInt& perm)
 {
-    return std::make_shared<QStabilizer>(qubitCount, perm, useRDRAND, rand_generator);
+    QStabilizerPtr toRet = std::make_shared<QStabilizer>(qubitCount, perm, useRDRAND, rand_generator);
+    toRet->SetConcurrencyLevel(concurrency);
+    return toRet;
 }
 
 QInterfacePtr QStabilizerHybrid::MakeEngine(const bitCapInt& perm)
@@ -79,6 +83,7 @@ QInterfacePtr QStabilizerHybrid::Clone()
 
     if (stabilizer) {
         c->stabilizer = std::make_shared<QStabilizer>(*stabilizer);
+        c->phaseBuffer = phaseBuffer;
     } else {
         complex* stateVec = new complex[(bitCapIntOcl)maxQPower];
         engine->GetQuantumState(stateVec);
@@ -90,12 +95,27 @@ QInterfacePtr QStabilizerHybrid::Clone()
     return c;
 }
 
+void QStabilizerHybrid::FlushBuffer(const bitLenInt& target)
+{
+    if (!IsBuffered(target)) {
+        return;
+    }
+
+    if (stabilizer->IsSeparableZ(target)) {
+        phaseBuffer[target] = ONE_CMPLX;
+        return;
+    }
+
+    SwitchToEngine();
+}
+
 void QStabilizerHybrid::SwitchToEngine()
 {
     if (engine) {
         return;
     }
 
+    QProfileScope profileScope(PROFILE_STABILIZER_TO_ENGINE, sizeof(complex) * (bitCapIntOcl)maxQPower);
     complex* stateVec = new complex[(bitCapIntOcl)maxQPower];
     stabilizer->GetQuantumState(stateVec);
 
@@ -103,11 +123,22 @@ void QStabilizerHybrid::SwitchToEngine()
     engine->SetQuantumState(stateVec);
     delete[] stateVec;
 
-    if (engineType != QINTERFACE_QUNIT) {
-        stabilizer.reset();
-        return;
+    if (engineType == QINTERFACE_QUNIT) {
+        SetQUnitSeparability();
     }
+    stabilizer.reset();
 
+    // The buffered phases come after everything the tableau has done.
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (!IS_SAME(phaseBuffer[i], ONE_CMPLX)) {
+            engine->ApplySinglePhase(ONE_CMPLX, phaseBuffer[i], i);
+        }
+    }
+    ClearBuffers();
+}
+
+void QStabilizerHybrid::SetQUnitSeparability()
+{
     for (bitLenInt i = 0; i < qubitCount; i++) {
         if (stabilizer->IsSeparableZ(i)) {
             engine->SetBit(i, stabilizer->M(i));
@@ -128,12 +159,11 @@ void QStabilizerHybrid::SwitchToEngine()
             engine->S(i);
         }
     }
-
-    stabilizer.reset();
 }
 
 void QStabilizerHybrid::CCNOT(bitLenInt control1, bitLenInt control2, bitLenInt target)
 {
+    FlushBuffer(target);
     if (stabilizer) {
         real1 prob = Prob(control1);
         if (prob == ZERO_R1) {
@@ -161,6 +191,7 @@ void QStabilizerHybrid::CCNOT(bitLenInt control1, bitLenInt control2, bitLenInt
 
 void QStabilizerHybrid::CH(bitLenInt control, bitLenInt target)
 {
+    FlushBuffer(target);
     if (stabilizer) {
         real1 prob = Prob(control);
         if (prob == ZERO_R1) {
@@ -249,15 +280,18 @@ void QStabilizerHybrid::Decompose(bitLenInt start, QStabilizerHybridPtr dest)
         stabilizer = NULL;
         dest->engine = engine;
         engine = NULL;
+        dest->phaseBuffer = phaseBuffer;
 
         SetQubitCount(1);
         stabilizer = MakeStabilizer(0);
+        phaseBuffer = std::vector<complex>(1, ONE_CMPLX);
         return;
     }
 
     if (engine) {
         dest->SwitchToEngine();
         engine->Decompose(start, dest->engine);
+        phaseBuffer.erase(phaseBuffer.begin() + start, phaseBuffer.begin() + start + length);
         SetQubitCount(qubitCount - length);
         return;
     }
@@ -267,7 +301,10 @@ void QStabilizerHybrid::Decompose(bitLenInt start, QStabilizerHybridPtr dest)
         dest->stabilizer = dest->MakeStabilizer(0);
     }
 
+    // A separable subsystem takes its own buffered phases along with it.
     stabilizer->Decompose(start, dest->stabilizer);
+    std::copy(phaseBuffer.begin() + start, phaseBuffer.begin() + start + length, dest->phaseBuffer.begin());
+    phaseBuffer.erase(phaseBuffer.begin() + start, phaseBuffer.begin() + start + length);
     SetQubitCount(qubitCount - length);
 }
 
@@ -279,6 +316,7 @@ void QStabilizerHybrid::Dispose(bitLenInt start, bitLenInt length)
 
         SetQubitCount(1);
         stabilizer = MakeStabilizer(0);
+        phaseBuffer = std::vector<complex>(1, ONE_CMPLX);
         return;
     }
 
@@ -288,6 +326,7 @@ void QStabilizerHybrid::Dispose(bitLenInt start, bitLenInt length)
         stabilizer->Dispose(start, length);
     }
 
+    phaseBuffer.erase(phaseBuffer.begin() + start, phaseBuffer.begin() + start + length);
     SetQubitCount(qubitCount - length);
 }
 
@@ -299,6 +338,7 @@ void QStabilizerHybrid::Dispose(bitLenInt start, bitLenInt length, bitCapInt dis
 
         SetQubitCount(1);
         stabilizer = MakeStabilizer(0);
+        phaseBuffer = std::vector<complex>(1, ONE_CMPLX);
         return;
     }
 
@@ -308,6 +348,7 @@ void QStabilizerHybrid::Dispose(bitLenInt start, bitLenInt length, bitCapInt dis
         stabilizer->Dispose(start, length);
     }
 
+    phaseBuffer.erase(phaseBuffer.begin() + start, phaseBuffer.begin() + start + length);
     SetQubitCount(qubitCount - length);
 }
 
@@ -344,6 +385,7 @@ void QStabilizerHybrid::SetQuantumState(const complex* inputState)
 
         if (isClifford) {
             engine.reset();
+            ClearBuffers();
             if (stabilizer) {
                 stabilizer->SetPermutation(isSet ? 1 : 0);
             } else {
@@ -363,6 +405,133 @@ void QStabilizerHybrid::SetQuantumState(const complex* inputState)
     engine->SetQuantumState(inputState);
 }
 
+void QStabilizerHybrid::ExpectationPauliStrings(
+    const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    // A buffered phase commutes with Z, (and with identity,) but not with X or Y.
+    bitCapInt xSupport = 0;
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        xSupport |= terms[i].xMask;
+    }
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if ((xSupport >> i) & ONE_BCI) {
+            FlushBuffer(i);
+        }
+    }
+
+    if (engine) {
+        engine->ExpectationPauliStrings(terms, termCount, expectations);
+        return;
+    }
+
+    // A Pauli string's expectation value in a stabilizer state is 1, -1, or 0. Rotating each factor to Z and folding
+    // the parity onto one qubit, with CNOTs, reads it off as a single-qubit probability, with Clifford gates only.
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        const bitCapInt support = (terms[i].xMask | terms[i].zMask) & (maxQPower - ONE_BCI);
+        if (!support) {
+            expectations[i] = ONE_R1;
+            continue;
+        }
+
+        QStabilizer copy(*stabilizer);
+        const bitLenInt last = log2(support);
+        for (bitLenInt j = 0; j <= last; j++) {
+            if (!((support >> j) & ONE_BCI)) {
+                continue;
+            }
+            if ((terms[i].xMask >> j) & ONE_BCI) {
+                if ((terms[i].zMask >> j) & ONE_BCI) {
+                    copy.IS(j);
+                }
+                copy.H(j);
+            }
+        }
+        for (bitLenInt j = 0; j < last; j++) {
+            if ((support >> j) & ONE_BCI) {
+                copy.CNOT(j, last);
+            }
+        }
+
+        if (!copy.IsSeparableZ(last)) {
+            expectations[i] = ZERO_R1;
+        } else {
+            expectations[i] = copy.M(last) ? -ONE_R1 : ONE_R1;
+        }
+    }
+}
+
+void QStabilizerHybrid::GetQuantumState(complex* outputState)
+{
+    if (engine) {
+        engine->GetQuantumState(outputState);
+        return;
+    }
+
+    stabilizer->GetQuantumState(outputState);
+
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (!IsBuffered(i)) {
+            continue;
+        }
+
+        const bitCapIntOcl qPower = pow2Ocl(i);
+        const complex phase = phaseBuffer[i];
+        for (bitCapIntOcl j = 0; j < maxQPower; j++) {
+            if (j & qPower) {
+                outputState[j] *= phase;
+            }
+        }
+    }
+}
+
+void QStabilizerHybrid::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    writer.WriteRecord(CHECKPOINT_STABILIZER_HYBRID, qubitCount);
+    writer.Write((bool)stabilizer);
+
+    if (!stabilizer) {
+        engine->WriteCheckpoint(writer);
+        return;
+    }
+
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        writer.Write(phaseBuffer[i]);
+    }
+    stabilizer->WriteCheckpoint(writer);
+}
+
+void QStabilizerHybrid::ReadCheckpoint(QCheckpointReader& reader)
+{
+    bool isStabilizer;
+    reader.ReadRecord(CHECKPOINT_STABILIZER_HYBRID, qubitCount);
+    reader.Read(isStabilizer);
+
+    // Either record is read into a new simulator, so that this register is left as it was if the checkpoint is
+    // malformed.
+    if (!isStabilizer) {
+        QInterfacePtr nEngine = MakeEngine();
+        nEngine->ReadCheckpoint(reader);
+
+        engine = nEngine;
+        stabilizer.reset();
+        ClearBuffers();
+        return;
+    }
+
+    std::vector<complex> nPhaseBuffer(qubitCount);
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        reader.Read(nPhaseBuffer[i]);
+    }
+
+    QStabilizerPtr nStabilizer = MakeStabilizer();
+    nStabilizer->ReadCheckpoint(reader);
+
+    stabilizer = nStabilizer;
+    engine.reset();
+    phaseBuffer = nPhaseBuffer;
+}
+
+// Buffered phases are diagonal, so they never change probabilities.
 void QStabilizerHybrid::GetProbs(real1* outputProbs)
 {
     if (stabilizer) {
@@ -424,17 +593,19 @@ void QStabilizerHybrid::ApplySinglePhase(const complex topLeft, const complex bo
         return;
     }
 
-    if (IS_SAME(topLeft, bottomRight)) {
+    // Up to global phase, the gate is diag(1, sTest). Fold it into whatever is already buffered on the target.
+    complex sTest = phaseBuffer[target] * bottomRight / topLeft;
+    phaseBuffer[target] = ONE_CMPLX;
+
+    if (IS_SAME(sTest, ONE_CMPLX)) {
         return;
     }
 
-    if (IS_SAME(topLeft, -bottomRight)) {
+    if (IS_SAME(sTest, -ONE_CMPLX)) {
         stabilizer->Z(target);
         return;
     }
 
-    complex sTest = bottomRight / topLeft;
-
     if (IS_SAME(sTest, I_CMPLX)) {
         stabilizer->S(target);
         return;
@@ -445,8 +616,8 @@ void QStabilizerHybrid::ApplySinglePhase(const complex topLeft, const complex bo
         return;
     }
 
-    SwitchToEngine();
-    engine->ApplySinglePhase(topLeft, bottomRight, target);
+    // Not Clifford: hold onto it, until a gate that doesn't commute with it reaches the target.
+    phaseBuffer[target] = sTest;
 }
 
 void QStabilizerHybrid::ApplySingleInvert(const complex topRight, const complex bottomLeft, bitLenInt target)
@@ -456,6 +627,9 @@ void QStabilizerHybrid::ApplySingleInvert(const complex topRight, const complex
         return;
     }
 
+    // Anti-diagonal gates commute past the buffered phase, inverting it.
+    InvertBuffer(target);
+
     if (IS_SAME(topRight, bottomLeft)) {
         stabilizer->X(target);
         return;
@@ -481,6 +655,8 @@ void QStabilizerHybrid::ApplySingleInvert(const complex topRight, const complex
         return;
     }
 
+    // Not Clifford: the engine takes the buffered phase as it stood before this gate.
+    InvertBuffer(target);
     SwitchToEngine();
     engine->ApplySingleInvert(topRight, bottomLeft, target);
 }
@@ -580,6 +756,8 @@ void QStabilizerHybrid::ApplyControlledSingleInvert(const bitLenInt* controls, c
         return;
     }
 
+    FlushBuffer(target);
+
     if (controlLen > 1U) {
         SwitchToEngine();
     }
@@ -704,6 +882,8 @@ void QStabilizerHybrid::ApplyAntiControlledSingleInvert(const bitLenInt* control
         return;
     }
 
+    FlushBuffer(target);
+
     // TODO: Generalize to trim all possible controls, like in QUnit.
     if (stabilizer && (controlLen == 2U) && IS_SAME(topRight, ONE_CMPLX) && IS_SAME(bottomLeft, ONE_CMPLX)) {
         real1 prob = Prob(controls[0]);
@@ -785,6 +965,7 @@ bitCapInt QStabilizerHybrid::MAll()
         for (bitLenInt i = 0; i < qubitCount; i++) {
             toRet |= ((stabilizer->M(i) ? 1 : 0) << i);
         }
+        ClearBuffers();
         return (bitCapInt)toRet;
     }
 
@@ -0,0 +1,398 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2020. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "qfactory.hpp"
+#include "qtrajectory.hpp"
+
+#if ENABLE_OPENCL
+#include "qengine_opencl_batch.hpp"
+#endif
+
+namespace Qrack {
+
+static const complex pauliMtrxs[3][4] = { { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX },
+    { ZERO_CMPLX, complex(ZERO_R1, -ONE_R1), complex(ZERO_R1, ONE_R1), ZERO_CMPLX },
+    { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, -ONE_CMPLX } };
+static const complex identityMtrx[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ONE_CMPLX };
+
+QTrajectorySampler::QTrajectorySampler(
+    const bitLenInt& n, const bitCapInt& perm, QInterfaceEngine eng, qrack_rand_gen_ptr rgp)
+    : qubitCount(n)
+    , initPerm(perm)
+    , engineType(eng)
+    , measurementCount(0)
+    , rand_generator(rgp)
+{
+    if ((engineType != QINTERFACE_CPU)
+#if ENABLE_OPENCL
+        && (engineType != QINTERFACE_OPENCL) && (engineType != QINTERFACE_HYBRID)
+#endif
+    ) {
+        throw std::invalid_argument("QTrajectorySampler needs a single state vector engine, in this build.");
+    }
+
+    if (rand_generator == NULL) {
+        rand_generator = std::make_shared<qrack_rand_gen>();
+        SetRandomSeed((uint32_t)std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    SetConcurrencyLevel(std::thread::hardware_concurrency());
+}
+
+void QTrajectorySampler::CheckQubit(const bitLenInt& qubit)
+{
+    if (qubit >= qubitCount) {
+        throw std::invalid_argument("QTrajectorySampler qubit index out of range.");
+    }
+}
+
+void QTrajectorySampler::AddOp(const TrajOpType& type, const bitLenInt& target, const real1& prob)
+{
+    CheckQubit(target);
+    if ((prob < ZERO_R1) || (prob > ONE_R1)) {
+        throw std::invalid_argument("QTrajectorySampler probabilities must be between 0 and 1.");
+    }
+
+    TrajOp op;
+    op.type = type;
+    op.target = target;
+    op.prob = prob;
+    ops.push_back(op);
+}
+
+void QTrajectorySampler::ApplyControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    CheckQubit(target);
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        CheckQubit(controls[i]);
+        if (controls[i] == target) {
+            throw std::invalid_argument("QTrajectorySampler control and target must differ.");
+        }
+    }
+
+    AddOp(TRAJ_GATE, target);
+    ops.back().controls.assign(controls, controls + controlLen);
+    std::copy(mtrx, mtrx + 4, ops.back().mtrx);
+}
+
+void QTrajectorySampler::H(const bitLenInt& target)
+{
+    const complex mtrx[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1),
+        complex(-M_SQRT1_2, ZERO_R1) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::X(const bitLenInt& target) { ApplySingleBit(pauliMtrxs[0], target); }
+void QTrajectorySampler::Y(const bitLenInt& target) { ApplySingleBit(pauliMtrxs[1], target); }
+void QTrajectorySampler::Z(const bitLenInt& target) { ApplySingleBit(pauliMtrxs[2], target); }
+
+void QTrajectorySampler::S(const bitLenInt& target)
+{
+    const complex mtrx[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, complex(ZERO_R1, ONE_R1) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::T(const bitLenInt& target)
+{
+    const complex mtrx[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, complex(M_SQRT1_2, M_SQRT1_2) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::RX(const real1& radians, const bitLenInt& target)
+{
+    real1 cosine = cos(radians / 2.0);
+    real1 sine = sin(radians / 2.0);
+    const complex mtrx[4] = { complex(cosine, ZERO_R1), complex(ZERO_R1, -sine), complex(ZERO_R1, -sine),
+        complex(cosine, ZERO_R1) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::RY(const real1& radians, const bitLenInt& target)
+{
+    real1 cosine = cos(radians / 2.0);
+    real1 sine = sin(radians / 2.0);
+    const complex mtrx[4] = { complex(cosine, ZERO_R1), complex(-sine, ZERO_R1), complex(sine, ZERO_R1),
+        complex(cosine, ZERO_R1) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::RZ(const real1& radians, const bitLenInt& target)
+{
+    real1 cosine = cos(radians / 2.0);
+    real1 sine = sin(radians / 2.0);
+    const complex mtrx[4] = { complex(cosine, -sine), ZERO_CMPLX, ZERO_CMPLX, complex(cosine, sine) };
+    ApplySingleBit(mtrx, target);
+}
+
+void QTrajectorySampler::CNOT(const bitLenInt& control, const bitLenInt& target)
+{
+    ApplyControlledSingleBit(&control, 1, target, pauliMtrxs[0]);
+}
+
+void QTrajectorySampler::CZ(const bitLenInt& control, const bitLenInt& target)
+{
+    ApplyControlledSingleBit(&control, 1, target, pauliMtrxs[2]);
+}
+
+bitCapIntOcl QTrajectorySampler::M(const bitLenInt& target, const real1& readoutError)
+{
+    AddOp(TRAJ_M, target, readoutError);
+    return measurementCount++;
+}
+
+void QTrajectorySampler::ApplyDamping(
+    QInterfacePtr qReg, qrack_rand_gen& gen, const size_t& start, const size_t& end)
+{
+    // Bit i of a branch, (or of a permutation,) is the i-th lowest of the damped qubits, as ProbMaskAll() orders them.
+    std::vector<const TrajOp*> group;
+    bitCapInt mask = 0;
+    for (size_t i = start; i < end; i++) {
+        group.push_back(&(ops[i]));
+        mask |= pow2(ops[i].target);
+    }
+    std::sort(group.begin(), group.end(), [](const TrajOp* a, const TrajOp* b) { return a->target < b->target; });
+
+    const bitLenInt k = (bitLenInt)group.size();
+    const bitCapIntOcl permCount = pow2Ocl(k);
+    std::vector<real1> probs(permCount);
+    qReg->ProbMaskAll(mask, &(probs[0]));
+
+    // The weight of a branch is the squared norm of its Kraus operators applied to the state. A qubit in |0> only
+    // takes the no-jump branch, so every branch is a subset of the |1> qubits of the permutations it draws from.
+    std::vector<real1> weights(permCount, ZERO_R1);
+    real1 totWeight = ZERO_R1;
+    for (bitCapIntOcl perm = 0; perm < permCount; perm++) {
+        if (probs[perm] <= ZERO_R1) {
+            continue;
+        }
+        bitCapIntOcl branch = perm;
+        for (;;) {
+            real1 weight = probs[perm];
+            for (bitLenInt i = 0; i < k; i++) {
+                if (perm & pow2Ocl(i)) {
+                    weight *= (branch & pow2Ocl(i)) ? group[i]->prob : (ONE_R1 - group[i]->prob);
+                }
+            }
+            weights[branch] += weight;
+            totWeight += weight;
+
+            if (!branch) {
+                break;
+            }
+            branch = (branch - 1U) & perm;
+        }
+    }
+
+    std::uniform_real_distribution<real1> dist(ZERO_R1, ONE_R1);
+    real1 r = dist(gen) * totWeight;
+    bitCapIntOcl branch = 0;
+    for (bitCapIntOcl i = 0; i < permCount; i++) {
+        if (weights[i] <= ZERO_R1) {
+            continue;
+        }
+        // (If rounding leaves "r" past the last branch, the last branch of any weight is taken.)
+        branch = i;
+        if (r < weights[i]) {
+            break;
+        }
+        r -= weights[i];
+    }
+
+    for (bitLenInt i = 0; i < k; i++) {
+        const real1 gamma = group[i]->prob;
+        if (branch & pow2Ocl(i)) {
+            const complex jump[4] = { ZERO_CMPLX, complex((real1)sqrt(gamma), ZERO_R1), ZERO_CMPLX, ZERO_CMPLX };
+            qReg->ApplySingleBit(jump, group[i]->target);
+        } else {
+            const complex noJump[4] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX,
+                complex((real1)sqrt(ONE_R1 - gamma), ZERO_R1) };
+            qReg->ApplySingleBit(noJump, group[i]->target);
+        }
+    }
+
+    // The branch weight is already known, so the state is renormalized without another reduction.
+    qReg->NormalizeState(weights[branch]);
+}
+
+void QTrajectorySampler::RunTrajectory(QInterfacePtr qReg, qrack_rand_gen& gen, uint8_t* results)
+{
+    std::uniform_real_distribution<real1> dist(ZERO_R1, ONE_R1);
+
+    bitCapIntOcl m = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        const TrajOp& op = ops[i];
+        switch (op.type) {
+        case TRAJ_GATE:
+            if (op.controls.size()) {
+                qReg->ApplyControlledSingleBit(&(op.controls[0]), op.controls.size(), op.target, op.mtrx);
+            } else {
+                qReg->ApplySingleBit(op.mtrx, op.target);
+            }
+            break;
+        case TRAJ_M:
+            results[m] = qReg->M(op.target) ? 1U : 0U;
+            if ((op.prob > ZERO_R1) && (dist(gen) < op.prob)) {
+                results[m] ^= 1U;
+            }
+            m++;
+            break;
+        case TRAJ_RESET:
+            if (qReg->M(op.target)) {
+                qReg->X(op.target);
+            }
+            break;
+        case TRAJ_DEPOLARIZE:
+            if (dist(gen) < op.prob) {
+                qReg->ApplySingleBit(pauliMtrxs[gen() % 3U], op.target);
+            }
+            break;
+        case TRAJ_AMPLITUDE_DAMPING: {
+            // Extend the run over following damping channels, as long as their qubits are distinct.
+            bitCapInt mask = pow2(op.target);
+            size_t end = i + 1U;
+            while ((end < ops.size()) && ((end - i) < QTRAJ_FUSE_MAX_QB) &&
+                (ops[end].type == TRAJ_AMPLITUDE_DAMPING) && !(mask & pow2(ops[end].target))) {
+                mask |= pow2(ops[end].target);
+                end++;
+            }
+            ApplyDamping(qReg, gen, i, end);
+            i = end - 1U;
+            break;
+        }
+        }
+    }
+}
+
+std::vector<uint64_t> QTrajectorySampler::Pack(const std::vector<uint8_t>& results, const bitCapIntOcl& shots)
+{
+    const bitCapIntOcl wordCount = (shots + 63U) >> 6U;
+    std::vector<uint64_t> record(measurementCount * wordCount, 0U);
+
+    for (bitCapIntOcl s = 0; s < shots; s++) {
+        for (bitCapIntOcl m = 0; m < measurementCount; m++) {
+            if (results[s * measurementCount + m]) {
+                record[m * wordCount + (s >> 6U)] |= 1ULL << (s & 63U);
+            }
+        }
+    }
+
+    return record;
+}
+
+std::vector<uint64_t> QTrajectorySampler::Sample(const bitCapIntOcl& shots)
+{
+    // Every shot gets its own generators, seeded up front, so that the result doesn't depend on thread scheduling.
+    std::vector<uint64_t> seeds(2U * shots);
+    for (bitCapIntOcl i = 0; i < seeds.size(); i++) {
+        seeds[i] = (*rand_generator)();
+    }
+
+    std::vector<uint8_t> results(shots * measurementCount, 0U);
+
+    // Shots are the parallel work, so each register runs serially.
+    par_for_weighted(0, shots, pow2Ocl(qubitCount) * ops.size(), [&](const bitCapInt lcv, const int cpu) {
+        const bitCapIntOcl shot = (bitCapIntOcl)lcv;
+        qrack_rand_gen gen(seeds[2U * shot]);
+        qrack_rand_gen_ptr regGen = std::make_shared<qrack_rand_gen>(seeds[2U * shot + 1U]);
+        QInterfacePtr qReg =
+            CreateQuantumInterface(engineType, qubitCount, initPerm, regGen, ONE_CMPLX, false, false, false, -1, false);
+        qReg->SetConcurrency(1);
+        RunTrajectory(qReg, gen, &(results[shot * measurementCount]));
+    });
+
+    return Pack(results, shots);
+}
+
+#if ENABLE_OPENCL
+std::vector<uint64_t> QTrajectorySampler::SampleOCLBatch(const bitCapIntOcl& shots, const bitCapIntOcl& copiesPerBatch)
+{
+    std::vector<uint8_t> results(shots * measurementCount, 0U);
+    std::uniform_real_distribution<real1> dist(ZERO_R1, ONE_R1);
+    qrack_rand_gen& gen = *rand_generator;
+
+    for (bitCapIntOcl base = 0; base < shots; base += copiesPerBatch) {
+        const bitCapIntOcl copies = std::min(copiesPerBatch, shots - base);
+        QEngineOCLBatchPtr batch = std::make_shared<QEngineOCLBatch>(
+            qubitCount, copies, initPerm, std::make_shared<qrack_rand_gen>(gen()), false, -1, false);
+
+        std::vector<complex> mtrxs(4U * copies);
+        std::vector<real1> probs(copies);
+        std::unique_ptr<bool[]> outcomes(new bool[copies]);
+
+        bitCapIntOcl m = 0;
+        for (size_t i = 0; i < ops.size(); i++) {
+            const TrajOp& op = ops[i];
+            switch (op.type) {
+            case TRAJ_GATE:
+                // The same gate on every shot is an ordinary gate on the batch.
+                if (op.controls.size()) {
+                    batch->ApplyControlledSingleBit(&(op.controls[0]), op.controls.size(), op.target, op.mtrx);
+                } else {
+                    batch->ApplySingleBit(op.mtrx, op.target);
+                }
+                break;
+            case TRAJ_M:
+                batch->MEach(op.target, outcomes.get());
+                for (bitCapIntOcl c = 0; c < copies; c++) {
+                    bool result = outcomes[c];
+                    if ((op.prob > ZERO_R1) && (dist(gen) < op.prob)) {
+                        result = !result;
+                    }
+                    results[(base + c) * measurementCount + m] = result ? 1U : 0U;
+                }
+                m++;
+                break;
+            case TRAJ_RESET:
+                batch->MEach(op.target, outcomes.get());
+                for (bitCapIntOcl c = 0; c < copies; c++) {
+                    const complex* mtrx = outcomes[c] ? pauliMtrxs[0] : identityMtrx;
+                    std::copy(mtrx, mtrx + 4, &(mtrxs[4U * c]));
+                }
+                batch->ApplyEach(&(mtrxs[0]), op.target);
+                break;
+            case TRAJ_DEPOLARIZE:
+                for (bitCapIntOcl c = 0; c < copies; c++) {
+                    const complex* mtrx = (dist(gen) < op.prob) ? pauliMtrxs[gen() % 3U] : identityMtrx;
+                    std::copy(mtrx, mtrx + 4, &(mtrxs[4U * c]));
+                }
+                batch->ApplyEach(&(mtrxs[0]), op.target);
+                break;
+            case TRAJ_AMPLITUDE_DAMPING:
+                // Each shot's Kraus operator is scaled by its own branch probability, so every register stays
+                // normalized.
+                batch->ProbEach(op.target, &(probs[0]));
+                for (bitCapIntOcl c = 0; c < copies; c++) {
+                    const real1 jumpProb = op.prob * probs[c];
+                    const bool isJump = dist(gen) < jumpProb;
+                    mtrxs[4U * c] = isJump ? ZERO_CMPLX : complex(ONE_R1 / (real1)sqrt(ONE_R1 - jumpProb), ZERO_R1);
+                    mtrxs[4U * c + 1U] = isJump ? complex(ONE_R1 / (real1)sqrt(probs[c]), ZERO_R1) : ZERO_CMPLX;
+                    mtrxs[4U * c + 2U] = ZERO_CMPLX;
+                    mtrxs[4U * c + 3U] = isJump
+                        ? ZERO_CMPLX
+                        : complex((real1)sqrt((ONE_R1 - op.prob) / (ONE_R1 - jumpProb)), ZERO_R1);
+                }
+                batch->ApplyEach(&(mtrxs[0]), op.target);
+                break;
+            }
+        }
+    }
+
+    return Pack(results, shots);
+}
+#endif
+} // namespace Qrack
@@ -25,6 +25,7 @@
 #include <initializer_list>
 #include <map>
 
+#include "common/qprofiler.hpp"
 #include "qfactory.hpp"
 #include "qunit.hpp"
 
@@ -235,6 +236,7 @@ void QUnit::Detach(bitLenInt start, bitLenInt length, QUnitPtr dest)
     QInterfacePtr unit = shards[start].unit;
     bitLenInt mapped = shards[start].mapped;
     bitLenInt unitLength = unit->GetQubitCount();
+    InvalidateProbCache(unit);
 
     if (dest) {
         for (bitLenInt i = 0; i < length; i++) {
@@ -242,8 +244,10 @@ void QUnit::Detach(bitLenInt start, bitLenInt length, QUnitPtr dest)
             dest->shards[i].unit = destEngine;
         }
 
+        QProfileScope profileScope(PROFILE_QUNIT_DECOMPOSE);
         unit->Decompose(mapped, destEngine);
     } else {
+        QProfileScope profileScope(PROFILE_QUNIT_DECOMPOSE);
         unit->Dispose(mapped, length);
     }
 
@@ -296,7 +300,12 @@ QInterfacePtr QUnit::EntangleInCurrentBasis(
         // Work odd unit into collapse sequence:
         if (units.size() & 1U) {
             QInterfacePtr consumed = units[1];
-            bitLenInt offset = unit1->Compose(consumed);
+            InvalidateProbCache(consumed);
+            bitLenInt offset;
+            {
+                QProfileScope profileScope(PROFILE_QUNIT_COMPOSE);
+                offset = unit1->Compose(consumed);
+            }
             units.erase(units.begin() + 1U);
 
             for (auto&& shard : shards) {
@@ -314,7 +323,9 @@ QInterfacePtr QUnit::EntangleInCurrentBasis(
         for (size_t i = 0; i < units.size(); i += 2) {
             QInterfacePtr retained = units[i];
             QInterfacePtr consumed = units[i + 1U];
+            InvalidateProbCache(consumed);
             nUnits.push_back(retained);
+            QProfileScope profileScope(PROFILE_QUNIT_COMPOSE);
             offsets[consumed] = retained->Compose(consumed);
             offsetPartners[consumed] = retained;
         }
@@ -336,6 +347,9 @@ QInterfacePtr QUnit::EntangleInCurrentBasis(
         **bit = shards[**bit].mapped;
     }
 
+    // Callers entangle qubits to act on them, so this unit's probabilities are about to change.
+    InvalidateProbCache(unit1);
+
     return unit1;
 }
 
@@ -365,6 +379,7 @@ QInterfacePtr QUnit::EntangleRange(bitLenInt start, bitLenInt length)
 
     if (length == 1) {
         EndEmulation(start);
+        InvalidateProbCache(shards[start].unit);
         return shards[start].unit;
     }
 
@@ -463,22 +478,46 @@ bool QUnit::TrySeparate(bitLenInt start, bitLenInt length)
             continue;
         }
 
+        QEngineShard& shard = shards[start + i];
+
+        // Whether a qubit is separable only changes with gates that act on it, (which dirty it,) or with measurement of
+        // its subsystem, (which dirties every qubit in it,) so a failed probe isn't repeated until one of those.
+        if (shard.didFailSeparate && shard.isPhaseDirty) {
+            continue;
+        }
+
+        // A stabilizer subsystem tells exactly whether the qubit is separable, (in any basis,) without a state pass.
+        if (shard.unit->isClifford() && !shard.unit->TrySeparate(shard.mapped)) {
+            shard.didFailSeparate = true;
+            continue;
+        }
+
+        QProfileScope profileScope(PROFILE_QUNIT_SEPARATE_PROBE);
+
         // We check Z basis:
         prob = ProbBase(start + i);
-        didSeparate |= (IS_ZERO_R1(prob) || IS_ONE_R1(prob));
+        if (IS_ZERO_R1(prob) || IS_ONE_R1(prob)) {
+            didSeparate = true;
+            continue;
+        }
 
         // If this is 0.5, it wasn't Z basis, but it's worth checking X basis.
         if (!IS_ZERO_R1(prob - ONE_R1 / 2)) {
+            shard.didFailSeparate = true;
             continue;
         }
 
-        QEngineShard& shard = shards[start + i];
-
         // We check X basis:
+        InvalidateProbCache(shard.unit);
         shard.unit->H(shard.mapped);
         prob = ProbBase(start + i);
-        didSeparate |= (IS_ZERO_R1(prob) || IS_ONE_R1(prob));
+        const bool isSeparable = (IS_ZERO_R1(prob) || IS_ONE_R1(prob));
+        didSeparate |= isSeparable;
         H(start + i);
+
+        if (!isSeparable && shard.unit) {
+            shard.didFailSeparate = true;
+        }
     }
 
     return didSeparate;
@@ -494,6 +533,9 @@ void QUnit::OrderContiguous(QInterfacePtr unit)
         return;
     }
 
+    // Swaps in the engine change which of its basis states each cached probability belongs to.
+    InvalidateProbCache(unit);
+
     /* Create a sortable collection of all of the bits that are in the unit. */
     std::vector<QSortEntry> bits(unit->GetQubitCount());
 
@@ -730,7 +772,169 @@ real1 QUnit::Prob(bitLenInt qubit)
     return ProbBase(qubit);
 }
 
-real1 QUnit::ProbAll(bitCapInt perm) { return clampProb(norm(GetAmplitude(perm))); }
+real1 QUnit::ProbAll(bitCapInt perm)
+{
+    ToPermBasisAll();
+
+    real1 prob = ONE_R1;
+    std::map<QInterfacePtr, bitCapInt> perms;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        QEngineShard& shard = shards[i];
+        const bool bitState = ((perm >> (bitCapIntOcl)i) & ONE_BCI) != 0;
+        if (!shard.unit) {
+            prob *= bitState ? shard.Prob() : (ONE_R1 - shard.Prob());
+            continue;
+        }
+        if (perms.find(shard.unit) == perms.end()) {
+            perms[shard.unit] = 0U;
+        }
+        if (bitState) {
+            perms[shard.unit] |= pow2(shard.mapped);
+        }
+    }
+
+    for (auto&& qi : perms) {
+        if (IS_ZERO_R1(prob)) {
+            break;
+        }
+        UnitProbCache* cache = GetProbCache(qi.first);
+        prob *= cache ? cache->probs[(bitCapIntOcl)qi.second] : qi.first->ProbAll(qi.second);
+    }
+
+    return clampProb(prob);
+}
+
+real1 QUnit::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
+{
+    if (permutation & ~mask) {
+        return ZERO_R1;
+    }
+
+    std::vector<bitLenInt> qIndices;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if ((mask >> (bitCapIntOcl)i) & ONE_BCI) {
+            qIndices.push_back(i);
+        }
+    }
+
+    // Reverting buffered gates can entangle subsystems, so every bit is reverted before any is grouped.
+    for (bitLenInt i = 0; i < qIndices.size(); i++) {
+        RevertBasis1Qb(qIndices[i]);
+    }
+    for (bitLenInt i = 0; i < qIndices.size(); i++) {
+        RevertBasis2Qb(qIndices[i]);
+    }
+
+    // Each subsystem contributes the probability of its own part of the mask, independently of the others.
+    real1 prob = ONE_R1;
+    std::map<QInterfacePtr, std::pair<bitCapInt, bitCapInt>> units;
+    for (bitLenInt j = 0; j < qIndices.size(); j++) {
+        const bitLenInt i = qIndices[j];
+        QEngineShard& shard = shards[i];
+        const bool bitState = ((permutation >> (bitCapIntOcl)i) & ONE_BCI) != 0;
+        if (!shard.unit) {
+            prob *= bitState ? shard.Prob() : (ONE_R1 - shard.Prob());
+            continue;
+        }
+        if (units.find(shard.unit) == units.end()) {
+            units[shard.unit] = std::pair<bitCapInt, bitCapInt>(0U, 0U);
+        }
+        units[shard.unit].first |= pow2(shard.mapped);
+        if (bitState) {
+            units[shard.unit].second |= pow2(shard.mapped);
+        }
+    }
+
+    for (auto&& qi : units) {
+        if (IS_ZERO_R1(prob)) {
+            break;
+        }
+        prob *= UnitProbMask(qi.first, qi.second.first, qi.second.second);
+    }
+
+    return clampProb(prob);
+}
+
+UnitProbCache* QUnit::GetProbCache(const QInterfacePtr& unit)
+{
+    if (unit->GetQubitCount() > QRACK_QUNIT_PROB_CACHE_QB) {
+        return NULL;
+    }
+
+    auto search = probCache.find(unit.get());
+    if ((search != probCache.end()) && (search->second.unit.lock() == unit)) {
+        return &(search->second);
+    }
+
+    // Entries for units that no longer exist are only pruned here, when a new entry is made.
+    for (auto it = probCache.begin(); it != probCache.end();) {
+        if (it->second.unit.expired()) {
+            it = probCache.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    UnitProbCache& cache = probCache[unit.get()];
+    cache.unit = unit;
+    cache.parities.clear();
+    cache.maskProbs.clear();
+    cache.probs.resize((bitCapIntOcl)unit->GetMaxQPower());
+    unit->GetProbs(&(cache.probs[0]));
+
+    return &cache;
+}
+
+real1 QUnit::UnitProbMask(const QInterfacePtr& unit, const bitCapInt& mask, const bitCapInt& permutation)
+{
+    UnitProbCache* cache = GetProbCache(unit);
+    if (!cache) {
+        return unit->ProbMask(mask, permutation);
+    }
+
+    const std::pair<bitCapInt, bitCapInt> key(mask, permutation);
+    auto search = cache->maskProbs.find(key);
+    if (search != cache->maskProbs.end()) {
+        return search->second;
+    }
+
+    real1 prob = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < cache->probs.size(); i++) {
+        if ((i & mask) == permutation) {
+            prob += cache->probs[i];
+        }
+    }
+    cache->maskProbs[key] = prob;
+
+    return prob;
+}
+
+real1 QUnit::UnitProbParity(const QInterfacePtr& unit, const bitCapInt& mask)
+{
+    UnitProbCache* cache = GetProbCache(unit);
+    if (!cache) {
+        return unit->ProbParity(mask);
+    }
+
+    auto search = cache->parities.find(mask);
+    if (search != cache->parities.end()) {
+        return search->second;
+    }
+
+    real1 oddChance = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < cache->probs.size(); i++) {
+        bool isOdd = false;
+        for (bitCapInt v = i & mask; v; v &= v - ONE_BCI) {
+            isOdd = !isOdd;
+        }
+        if (isOdd) {
+            oddChance += cache->probs[i];
+        }
+    }
+    cache->parities[mask] = oddChance;
+
+    return oddChance;
+}
 
 real1 QUnit::ProbParity(const bitCapInt& mask)
 {
@@ -773,13 +977,91 @@ real1 QUnit::ProbParity(const bitCapInt& mask)
 
     std::map<QInterfacePtr, bitCapInt>::iterator unit;
     for (unit = units.begin(); unit != units.end(); unit++) {
-        nOddChance = unit->first->ProbParity(unit->second);
+        nOddChance = UnitProbParity(unit->first, unit->second);
         oddChance = (oddChance * (ONE_R1 - nOddChance)) + ((ONE_R1 - oddChance) * nOddChance);
     }
 
     return oddChance;
 }
 
+void QUnit::ExpectationPauliStrings(const PauliTerm* terms, const bitCapIntOcl& termCount, real1* expectations)
+{
+    bitCapInt support = 0;
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        support |= terms[i].xMask | terms[i].zMask;
+    }
+
+    std::vector<bitLenInt> qIndices;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if ((support >> i) & ONE_BCI) {
+            qIndices.push_back(i);
+        }
+    }
+
+    // Flush every buffer first, since flushing can merge units.
+    for (bitLenInt i = 0; i < qIndices.size(); i++) {
+        RevertBasis1Qb(qIndices[i]);
+    }
+    for (bitLenInt i = 0; i < qIndices.size(); i++) {
+        RevertBasis2Qb(qIndices[i]);
+    }
+
+    // A Pauli string over separable subsystems has the product of the subsystems' expectation values, so each term is
+    // split by unit, and each unit evaluates its share of every term in one batch.
+    std::map<QInterfacePtr, std::vector<PauliTerm>> unitTerms;
+    std::map<QInterfacePtr, std::vector<bitCapIntOcl>> unitTermIndices;
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        expectations[i] = ONE_R1;
+
+        std::map<QInterfacePtr, PauliTerm> parts;
+        for (bitLenInt j = 0; j < qIndices.size(); j++) {
+            const bitLenInt q = qIndices[j];
+            const bool isX = (terms[i].xMask >> q) & ONE_BCI;
+            const bool isZ = (terms[i].zMask >> q) & ONE_BCI;
+            if (!isX && !isZ) {
+                continue;
+            }
+
+            QEngineShard& shard = shards[q];
+            if (!shard.unit) {
+                const complex offDiag = conj(shard.amp0) * shard.amp1;
+                if (isX && isZ) {
+                    expectations[i] *= 2 * imag(offDiag);
+                } else if (isX) {
+                    expectations[i] *= 2 * real(offDiag);
+                } else {
+                    expectations[i] *= norm(shard.amp0) - norm(shard.amp1);
+                }
+                continue;
+            }
+
+            if (parts.find(shard.unit) == parts.end()) {
+                parts[shard.unit] = PauliTerm{ 0U, 0U, ONE_R1 };
+            }
+            if (isX) {
+                parts[shard.unit].xMask |= pow2(shard.mapped);
+            }
+            if (isZ) {
+                parts[shard.unit].zMask |= pow2(shard.mapped);
+            }
+        }
+
+        for (auto part = parts.begin(); part != parts.end(); part++) {
+            unitTerms[part->first].push_back(part->second);
+            unitTermIndices[part->first].push_back(i);
+        }
+    }
+
+    for (auto unit = unitTerms.begin(); unit != unitTerms.end(); unit++) {
+        const std::vector<bitCapIntOcl>& indices = unitTermIndices[unit->first];
+        std::vector<real1> unitExpectations(indices.size());
+        unit->first->ExpectationPauliStrings(&(unit->second[0]), indices.size(), &(unitExpectations[0]));
+        for (size_t i = 0; i < indices.size(); i++) {
+            expectations[indices[i]] *= unitExpectations[i];
+        }
+    }
+}
+
 bool QUnit::ForceMParity(const bitCapInt& mask, bool result, bool doForce)
 {
     // If no bits in mask:
@@ -857,7 +1139,10 @@ void QUnit::SeparateBit(bool value, bitLenInt qubit, bool doDispose)
         return;
     }
 
+    InvalidateProbCache(unit);
+
     if (doDispose) {
+        QProfileScope profileScope(PROFILE_QUNIT_DECOMPOSE);
         unit->Dispose(mapped, 1, value ? ONE_BCI : 0);
     }
 
@@ -875,6 +1160,10 @@ bool QUnit::ForceM(bitLenInt qubit, bool res, bool doForce, bool doApply)
 
     QEngineShard& shard = shards[qubit];
 
+    if (doApply) {
+        InvalidateProbCache(shard.unit);
+    }
+
     bool result;
     if (!shard.isProbDirty && !shard.unit) {
         result = doForce ? res : (Rand() <= norm(shard.amp1));
@@ -1206,7 +1495,7 @@ void QUnit::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLen
     bitLenInt* mappedControls = new bitLenInt[trimmedControls.size()];
     for (i = 0; i < trimmedControls.size(); i++) {
         mappedControls[i] = shards[trimmedControls[i]].mapped;
-        shards[trimmedControls[i]].isPhaseDirty = true;
+        shards[trimmedControls[i]].MakePhaseDirty();
     }
 
     unit->UniformlyControlledSingleBit(mappedControls, trimmedControls.size(), shards[qubitIndex].mapped, mtrxs,
@@ -1217,6 +1506,41 @@ void QUnit::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLen
     delete[] mappedControls;
 }
 
+void QUnit::ApplyNxN(const complex* mtrx, const bitLenInt* targets, const bitLenInt& targetLen)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    if ((targetLen < 2U) || (targetLen > 4U)) {
+        throw std::invalid_argument("ApplyNxN() requires between 1 and 4 target qubits.");
+    }
+
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        for (bitLenInt j = i + 1U; j < targetLen; j++) {
+            if (targets[i] == targets[j]) {
+                throw std::invalid_argument("ApplyNxN() target qubits must be unique.");
+            }
+        }
+    }
+
+    QInterfacePtr unit = Entangle(std::vector<bitLenInt>(targets, targets + targetLen));
+
+    bitLenInt* mappedTargets = new bitLenInt[targetLen];
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        mappedTargets[i] = shards[targets[i]].mapped;
+    }
+
+    unit->ApplyNxN(mtrx, mappedTargets, targetLen);
+
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        shards[targets[i]].MakeDirty();
+    }
+
+    delete[] mappedTargets;
+}
+
 void QUnit::CUniformParityRZ(
     const bitLenInt* cControls, const bitLenInt& controlLen, const bitCapInt& mask, const real1& angle)
 {
@@ -1301,7 +1625,7 @@ void QUnit::CUniformParityRZ(
     }
 
     for (bitLenInt i = 0; i < eIndices.size(); i++) {
-        shards[eIndices[i]].isPhaseDirty = true;
+        shards[eIndices[i]].MakePhaseDirty();
     }
 
     QInterfacePtr unit = Entangle(eIndices);
@@ -1326,7 +1650,7 @@ void QUnit::CUniformParityRZ(
         for (bitLenInt i = 0; i < controls.size(); i++) {
             QEngineShard& cShard = shards[controls[i]];
             controlsMapped[i] = cShard.mapped;
-            cShard.isPhaseDirty = true;
+            cShard.MakePhaseDirty();
         }
 
         unit->CUniformParityRZ(&(controlsMapped[0]), controlsMapped.size(), mappedMask, flipResult ? -angle : angle);
@@ -1344,6 +1668,7 @@ void QUnit::H(bitLenInt target)
     }
 
     if (shard.unit) {
+        InvalidateProbCache(shard.unit);
         shard.unit->H(shard.mapped);
     }
     if (DIRTY(shard)) {
@@ -1364,6 +1689,7 @@ void QUnit::XBase(const bitLenInt& target)
     QEngineShard& shard = shards[target];
 
     if (shard.unit) {
+        InvalidateProbCache(shard.unit);
         shard.unit->X(shard.mapped);
     }
     if (DIRTY(shard)) {
@@ -1945,6 +2271,7 @@ void QUnit::ApplySinglePhase(const complex topLeft, const complex bottomRight, b
         TransformPhase(topLeft, bottomRight, mtrx);
 
         if (shard.unit) {
+            InvalidateProbCache(shard.unit);
             shard.unit->ApplySingleBit(mtrx, shard.mapped);
         }
         if (DIRTY(shard)) {
@@ -1984,6 +2311,7 @@ void QUnit::ApplySingleInvert(const complex topRight, const complex bottomLeft,
 
     if (!shard.isPlusMinus) {
         if (shard.unit) {
+            InvalidateProbCache(shard.unit);
             shard.unit->ApplySingleInvert(topRight, bottomLeft, shard.mapped);
         }
         if (DIRTY(shard)) {
@@ -2002,6 +2330,7 @@ void QUnit::ApplySingleInvert(const complex topRight, const complex bottomLeft,
         TransformInvert(topRight, bottomLeft, mtrx);
 
         if (shard.unit) {
+            InvalidateProbCache(shard.unit);
             shard.unit->ApplySingleBit(mtrx, shard.mapped);
         }
         if (DIRTY(shard)) {
@@ -2275,6 +2604,7 @@ void QUnit::ApplySingleBit(const complex* mtrx, bitLenInt target)
     }
 
     if (shard.unit) {
+        InvalidateProbCache(shard.unit);
         shard.unit->ApplySingleBit(trnsMtrx, shard.mapped);
     }
     if (DIRTY(shard)) {
@@ -2455,7 +2785,7 @@ void QUnit::ApplyEitherControlled(const bitLenInt* controls, const bitLenInt& co
     for (i = 0; i < controlVec.size(); i++) {
         QEngineShard& cShard = shards[controlVec[i]];
         controlsMapped[i] = cShard.mapped;
-        cShard.isPhaseDirty = true;
+        cShard.MakePhaseDirty();
     }
 
     // This is the original method with the maximum number of non-entangled controls excised, (potentially leaving a
@@ -3111,7 +3441,7 @@ QInterfacePtr QUnit::CMULEntangle(std::vector<bitLenInt> controlVec, bitLenInt s
     controlsMapped->resize(!controlVec.size() ? 1 : controlVec.size());
     for (bitLenInt i = 0; i < controlVec.size(); i++) {
         (*controlsMapped)[i] = shards[controlVec[i]].mapped;
-        shards[controlVec[i]].isPhaseDirty = true;
+        shards[controlVec[i]].MakePhaseDirty();
     }
 
     return unit;
@@ -3272,6 +3602,18 @@ void QUnit::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
     delete[] controls;
 }
 
+void QUnit::GroverDiffusion(bitLenInt start, bitLenInt length)
+{
+    if (!length) {
+        return;
+    }
+
+    DirtyShardRange(start, length);
+    DirtyShardRangePhase(start, length);
+    EntangleRange(start, length);
+    shards[start].unit->GroverDiffusion(shards[start].mapped, length);
+}
+
 void QUnit::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length)
 {
     // Keep the bits separate, if cheap to do so:
@@ -3316,7 +3658,7 @@ void QUnit::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt l
     EntangleRange(start, length, flagIndex, 1);
     shards[start].unit->CPhaseFlipIfLess(greaterPerm, shards[start].mapped, length, shards[flagIndex].mapped);
     DirtyShardRange(start, length);
-    shards[flagIndex].isPhaseDirty = true;
+    shards[flagIndex].MakePhaseDirty();
 }
 
 void QUnit::PhaseFlip()
@@ -3514,6 +3856,7 @@ void QUnit::UpdateRunningNorm(real1 norm_thresh)
 void QUnit::NormalizeState(real1 nrm, real1 norm_thresh)
 {
     EndAllEmulation();
+    probCache.clear();
     ParallelUnitApply(
         [](QInterfacePtr unit, real1 nrm, real1 norm_thresh, int32_t unused) {
             unit->NormalizeState(nrm, norm_thresh);
@@ -3532,6 +3875,7 @@ void QUnit::Finish()
 
 void QUnit::Dump()
 {
+    probCache.clear();
     ParallelUnitApply([](QInterfacePtr unit, real1 unused1, real1 unused2, int32_t unused3) {
         unit.reset();
         return true;
@@ -3594,6 +3938,142 @@ QInterfacePtr QUnit::CloneBody(QUnitPtr copyPtr)
     return copyPtr;
 }
 
+// Marks a shard with no unit, in a checkpoint
+#define QUNIT_CHECKPOINT_NO_UNIT ((uint64_t)-1)
+
+void QUnit::WriteCheckpoint(QCheckpointWriter& writer)
+{
+    writer.WriteRecord(CHECKPOINT_QUNIT, qubitCount);
+
+    std::vector<QInterfacePtr> units;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        QEngineShard& shard = shards[i];
+        uint64_t unitIndex = QUNIT_CHECKPOINT_NO_UNIT;
+        if (shard.unit) {
+            unitIndex = std::find(units.begin(), units.end(), shard.unit) - units.begin();
+            if (unitIndex == units.size()) {
+                units.push_back(shard.unit);
+            }
+        }
+
+        writer.Write(unitIndex);
+        writer.Write((uint64_t)shard.mapped);
+        writer.Write(shard.isProbDirty);
+        writer.Write(shard.isPhaseDirty);
+        writer.Write(shard.isPlusMinus);
+        writer.Write(shard.amp0);
+        writer.Write(shard.amp1);
+    }
+
+    // Each buffer is shared by its control and target shards, so it's written once, from the control's side.
+    auto writeBuffers = [&](ShardToPhaseMap& buffers) {
+        writer.Write((uint64_t)buffers.size());
+        for (ShardToPhaseMap::iterator phaseShard = buffers.begin(); phaseShard != buffers.end(); phaseShard++) {
+            writer.Write((uint64_t)(phaseShard->first - &(shards[0])));
+            writer.Write(phaseShard->second->cmplxDiff);
+            writer.Write(phaseShard->second->cmplxSame);
+            writer.Write(phaseShard->second->isInvert);
+        }
+    };
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        writeBuffers(shards[i].controlsShards);
+        writeBuffers(shards[i].antiControlsShards);
+    }
+
+    writer.Write((uint64_t)units.size());
+    for (size_t i = 0; i < units.size(); i++) {
+        writer.Write((uint64_t)units[i]->GetQubitCount());
+        units[i]->WriteCheckpoint(writer);
+    }
+}
+
+void QUnit::ReadCheckpoint(QCheckpointReader& reader)
+{
+    reader.ReadRecord(CHECKPOINT_QUNIT, qubitCount);
+
+    // The new layout is built aside, so that this register is left as it was if the checkpoint is malformed.
+    std::vector<QEngineShard> nShards(qubitCount, QEngineShard(doNormalize ? amplitudeFloor : ZERO_R1));
+    std::vector<uint64_t> unitIndices(qubitCount);
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        QEngineShard& shard = nShards[i];
+        uint64_t mapped;
+        reader.Read(unitIndices[i]);
+        reader.Read(mapped);
+        reader.Read(shard.isProbDirty);
+        reader.Read(shard.isPhaseDirty);
+        reader.Read(shard.isPlusMinus);
+        reader.Read(shard.amp0);
+        reader.Read(shard.amp1);
+        shard.mapped = (bitLenInt)mapped;
+    }
+
+    auto readBuffers = [&](QEngineShard& shard, bool isAnti) {
+        uint64_t count, partner;
+        reader.Read(count);
+        for (uint64_t j = 0; j < count; j++) {
+            reader.Read(partner);
+            if ((partner >= qubitCount) || (&(nShards[partner]) == &shard)) {
+                throw std::invalid_argument("Checkpoint QUnit phase buffer partner is invalid.");
+            }
+
+            QEngineShardPtr target = &(nShards[partner]);
+            if (isAnti) {
+                shard.MakePhaseAntiControlOf(target);
+            } else {
+                shard.MakePhaseControlOf(target);
+            }
+            PhaseShardPtr buffer = isAnti ? shard.antiControlsShards[target] : shard.controlsShards[target];
+            reader.Read(buffer->cmplxDiff);
+            reader.Read(buffer->cmplxSame);
+            reader.Read(buffer->isInvert);
+        }
+    };
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        readBuffers(nShards[i], false);
+        readBuffers(nShards[i], true);
+    }
+
+    uint64_t unitCount;
+    reader.Read(unitCount);
+    std::vector<QInterfacePtr> units(unitCount);
+    for (uint64_t i = 0; i < unitCount; i++) {
+        uint64_t unitWidth;
+        reader.Read(unitWidth);
+        if (!unitWidth || (unitWidth > qubitCount)) {
+            throw std::invalid_argument("Checkpoint QUnit unit width is invalid.");
+        }
+        units[i] = MakeEngine((bitLenInt)unitWidth, 0);
+        units[i]->ReadCheckpoint(reader);
+    }
+
+    // Each qubit of each unit must be mapped from exactly one shard.
+    std::vector<std::vector<bool>> isCovered(unitCount);
+    for (uint64_t i = 0; i < unitCount; i++) {
+        isCovered[i].resize(units[i]->GetQubitCount(), false);
+    }
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (unitIndices[i] == QUNIT_CHECKPOINT_NO_UNIT) {
+            continue;
+        }
+        if ((unitIndices[i] >= unitCount) || (nShards[i].mapped >= units[unitIndices[i]]->GetQubitCount()) ||
+            isCovered[unitIndices[i]][nShards[i].mapped]) {
+            throw std::invalid_argument("Checkpoint QUnit shard layout is invalid.");
+        }
+        isCovered[unitIndices[i]][nShards[i].mapped] = true;
+        nShards[i].unit = units[unitIndices[i]];
+    }
+    for (uint64_t i = 0; i < unitCount; i++) {
+        if (std::find(isCovered[i].begin(), isCovered[i].end(), false) != isCovered[i].end()) {
+            throw std::invalid_argument("Checkpoint QUnit shard layout is invalid.");
+        }
+    }
+
+    Dump();
+    // (Swapping vectors keeps their elements in place, so the phase buffers' shard pointers stay valid.)
+    shards.swap(nShards);
+    probCache.clear();
+}
+
 void QUnit::ApplyBuffer(PhaseShardPtr phaseShard, const bitLenInt& control, const bitLenInt& target, const bool& isAnti)
 {
     const bitLenInt controls[1] = { control };
@@ -3618,30 +4098,31 @@ void QUnit::ApplyBuffer(PhaseShardPtr phaseShard, const bitLenInt& control, cons
     freezeBasis2Qb = false;
 }
 
-void QUnit::ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap bufferMap, const RevertExclusivity& exclusivity,
+void QUnit::ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap& bufferMap, const RevertExclusivity& exclusivity,
     const bool& isControl, const bool& isAnti, std::set<bitLenInt> exceptPartners, const bool& dumpSkipped)
 {
     QEngineShard& shard = shards[bitIndex];
 
-    ShardToPhaseMap::iterator phaseShard;
+    ShardToPhaseMap::iterator phaseShard = bufferMap.begin();
+    QEngineShardPtr partner;
+    PhaseShardPtr buffer;
 
-    while (bufferMap.size() > 0) {
-        phaseShard = bufferMap.begin();
-        QEngineShardPtr partner = phaseShard->first;
+    // Buffers that are skipped stay in the map, and applying a buffer removes it, so we resume after each partner.
+    while (phaseShard != bufferMap.end()) {
+        partner = phaseShard->first;
+        buffer = phaseShard->second;
 
-        if (((exclusivity == ONLY_INVERT) && !phaseShard->second->isInvert) ||
-            ((exclusivity == ONLY_PHASE) && phaseShard->second->isInvert)) {
-            bufferMap.erase(phaseShard);
+        if (((exclusivity == ONLY_INVERT) && !buffer->isInvert) || ((exclusivity == ONLY_PHASE) && buffer->isInvert)) {
             if (dumpSkipped) {
                 shard.RemovePhaseTarget(partner);
             }
+            phaseShard = bufferMap.upper_bound(partner);
             continue;
         }
 
         bitLenInt partnerIndex = FindShardIndex(partner);
 
         if (exceptPartners.find(partnerIndex) != exceptPartners.end()) {
-            bufferMap.erase(phaseShard);
             if (dumpSkipped) {
                 if (isControl) {
                     if (isAnti) {
@@ -3657,6 +4138,7 @@ void QUnit::ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap bufferMap,
                     }
                 }
             }
+            phaseShard = bufferMap.upper_bound(partner);
             continue;
         }
 
@@ -3666,17 +4148,17 @@ void QUnit::ApplyBufferMap(const bitLenInt& bitIndex, ShardToPhaseMap bufferMap,
             } else {
                 shard.RemovePhaseTarget(partner);
             }
-            ApplyBuffer(phaseShard->second, bitIndex, partnerIndex, isAnti);
+            ApplyBuffer(buffer, bitIndex, partnerIndex, isAnti);
         } else {
             if (isAnti) {
                 shard.RemovePhaseAntiControl(partner);
             } else {
                 shard.RemovePhaseControl(partner);
             }
-            ApplyBuffer(phaseShard->second, partnerIndex, bitIndex, isAnti);
+            ApplyBuffer(buffer, partnerIndex, bitIndex, isAnti);
         }
 
-        bufferMap.erase(phaseShard);
+        phaseShard = bufferMap.upper_bound(partner);
     }
 }
 
@@ -3746,48 +4228,47 @@ void QUnit::CommuteH(const bitLenInt& bitIndex)
     PhaseShardPtr buffer;
     bitLenInt control;
 
-    ShardToPhaseMap controlsShards = shard.controlsShards;
-
-    for (phaseShard = controlsShards.begin(); phaseShard != controlsShards.end(); phaseShard++) {
+    // (Each loop body can remove the current buffer, so we resume after its partner, rather than copying the map.)
+    phaseShard = shard.controlsShards.begin();
+    while (phaseShard != shard.controlsShards.end()) {
         buffer = phaseShard->second;
         partner = phaseShard->first;
 
         polarDiff = buffer->cmplxDiff;
         polarSame = buffer->cmplxSame;
 
-        if (partner->isPlusMinus || buffer->isInvert) {
-            continue;
+        if (!partner->isPlusMinus && !buffer->isInvert) {
+            if (IS_ARG_0(polarDiff) && IS_ARG_PI(polarSame)) {
+                shard.RemovePhaseTarget(partner);
+                shard.AddPhaseAngles(partner, ONE_CMPLX, -ONE_CMPLX);
+            } else if (IS_ARG_PI(polarDiff) && IS_ARG_0(polarSame)) {
+                shard.RemovePhaseTarget(partner);
+                shard.AddAntiPhaseAngles(partner, -ONE_CMPLX, ONE_CMPLX);
+            }
         }
 
-        if (IS_ARG_0(polarDiff) && IS_ARG_PI(polarSame)) {
-            shard.RemovePhaseTarget(partner);
-            shard.AddPhaseAngles(partner, ONE_CMPLX, -ONE_CMPLX);
-        } else if (IS_ARG_PI(polarDiff) && IS_ARG_0(polarSame)) {
-            shard.RemovePhaseTarget(partner);
-            shard.AddAntiPhaseAngles(partner, -ONE_CMPLX, ONE_CMPLX);
-        }
+        phaseShard = shard.controlsShards.upper_bound(partner);
     }
 
-    controlsShards = shard.antiControlsShards;
-
-    for (phaseShard = controlsShards.begin(); phaseShard != controlsShards.end(); phaseShard++) {
+    phaseShard = shard.antiControlsShards.begin();
+    while (phaseShard != shard.antiControlsShards.end()) {
         buffer = phaseShard->second;
         partner = phaseShard->first;
 
         polarDiff = buffer->cmplxDiff;
         polarSame = buffer->cmplxSame;
 
-        if (partner->isPlusMinus || buffer->isInvert) {
-            continue;
+        if (!partner->isPlusMinus && !buffer->isInvert) {
+            if (IS_ARG_0(polarDiff) && IS_ARG_PI(polarSame)) {
+                shard.RemovePhaseAntiTarget(partner);
+                shard.AddAntiPhaseAngles(partner, ONE_CMPLX, -ONE_CMPLX);
+            } else if (IS_ARG_PI(polarDiff) && IS_ARG_0(polarSame)) {
+                shard.RemovePhaseAntiTarget(partner);
+                shard.AddPhaseAngles(partner, -ONE_CMPLX, ONE_CMPLX);
+            }
         }
 
-        if (IS_ARG_0(polarDiff) && IS_ARG_PI(polarSame)) {
-            shard.RemovePhaseAntiTarget(partner);
-            shard.AddAntiPhaseAngles(partner, ONE_CMPLX, -ONE_CMPLX);
-        } else if (IS_ARG_PI(polarDiff) && IS_ARG_0(polarSame)) {
-            shard.RemovePhaseAntiTarget(partner);
-            shard.AddPhaseAngles(partner, -ONE_CMPLX, ONE_CMPLX);
-        }
+        phaseShard = shard.antiControlsShards.upper_bound(partner);
     }
 
     RevertBasis2Qb(bitIndex, INVERT_AND_PHASE, ONLY_CONTROLS, CTRL_AND_ANTI, {}, {}, false, true);
@@ -3798,9 +4279,8 @@ void QUnit::CommuteH(const bitLenInt& bitIndex)
 
     bool isSame, isOpposite;
 
-    ShardToPhaseMap targetOfShards = shard.targetOfShards;
-
-    for (phaseShard = targetOfShards.begin(); phaseShard != targetOfShards.end(); phaseShard++) {
+    phaseShard = shard.targetOfShards.begin();
+    while (phaseShard != shard.targetOfShards.end()) {
         buffer = phaseShard->second;
 
         polarDiff = buffer->cmplxDiff;
@@ -3813,18 +4293,17 @@ void QUnit::CommuteH(const bitLenInt& bitIndex)
             (buffer->isInvert || !partner->isPlusMinus || !partner->IsInvertTarget()) && IS_SAME(polarDiff, polarSame);
         isOpposite = !buffer->isInvert && IS_OPPOSITE(polarDiff, polarSame);
 
-        if (isSame || isOpposite) {
-            continue;
+        if (!isSame && !isOpposite) {
+            control = FindShardIndex(partner);
+            ApplyBuffer(buffer, control, bitIndex, false);
+            shard.RemovePhaseControl(partner);
         }
 
-        control = FindShardIndex(partner);
-        ApplyBuffer(buffer, control, bitIndex, false);
-        shard.RemovePhaseControl(partner);
+        phaseShard = shard.targetOfShards.upper_bound(partner);
     }
 
-    targetOfShards = shard.antiTargetOfShards;
-
-    for (phaseShard = targetOfShards.begin(); phaseShard != targetOfShards.end(); phaseShard++) {
+    phaseShard = shard.antiTargetOfShards.begin();
+    while (phaseShard != shard.antiTargetOfShards.end()) {
         buffer = phaseShard->second;
 
         polarDiff = buffer->cmplxDiff;
@@ -3837,13 +4316,13 @@ void QUnit::CommuteH(const bitLenInt& bitIndex)
             (buffer->isInvert || !partner->isPlusMinus || !partner->IsInvertTarget()) && IS_SAME(polarDiff, polarSame);
         isOpposite = !buffer->isInvert && IS_OPPOSITE(polarDiff, polarSame);
 
-        if (isSame || isOpposite) {
-            continue;
+        if (!isSame && !isOpposite) {
+            control = FindShardIndex(partner);
+            ApplyBuffer(buffer, control, bitIndex, true);
+            shard.RemovePhaseAntiControl(partner);
         }
 
-        control = FindShardIndex(partner);
-        ApplyBuffer(buffer, control, bitIndex, true);
-        shard.RemovePhaseAntiControl(partner);
+        phaseShard = shard.antiTargetOfShards.upper_bound(partner);
     }
 
     shard.CommuteH();
@@ -11,12 +11,96 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <chrono>
+#include <limits>
+#include <mutex>
+
 #include "qunitmulti.hpp"
 #include "common/oclengine.hpp"
 #include "qfactory.hpp"
 
+// Width of the state vector each device is benchmarked on, and the number of timed repetitions, (taking the median)
+#define SCHEDULER_BENCH_QB 16
+#define SCHEDULER_BENCH_REPS 8
+// How many gates a migrated shard is expected to receive, to pay back the cost of the copy
+#define SCHEDULER_GATE_HORIZON 64
+
 namespace Qrack {
 
+struct DeviceBenchmark {
+    real1 gateNs;
+    real1 readNs;
+    real1 writeNs;
+};
+
+template <typename Fn> static real1 MedianNs(Fn fn)
+{
+    std::vector<real1> times(SCHEDULER_BENCH_REPS);
+    for (int i = 0; i < SCHEDULER_BENCH_REPS; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        times[i] = (real1)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    std::sort(times.begin(), times.end());
+
+    return times[SCHEDULER_BENCH_REPS / 2];
+}
+
+/*
+ * Time a layer of single bit gates, and reading and writing the state vector from and to host memory, (the two halves
+ * of a SetDevice() copy,) on device "devID," per amplitude.
+ */
+static DeviceBenchmark BenchmarkDevice(int devID)
+{
+    const bitCapIntOcl maxQPower = pow2Ocl(SCHEDULER_BENCH_QB);
+    QEngineOCL qReg(SCHEDULER_BENCH_QB, 0, nullptr, CMPLX_DEFAULT_ARG, false, false, false, devID, false);
+    std::unique_ptr<complex[]> state(new complex[maxQPower]);
+
+    // Warm up, so that first launch and allocation costs aren't counted.
+    qReg.H(0);
+    qReg.GetQuantumState(state.get());
+
+    DeviceBenchmark benchmark;
+    benchmark.gateNs = MedianNs([&]() {
+        for (bitLenInt i = 0; i < SCHEDULER_BENCH_QB; i++) {
+            qReg.H(i);
+        }
+        qReg.Finish();
+    }) / (SCHEDULER_BENCH_QB * maxQPower);
+    benchmark.readNs = MedianNs([&]() { qReg.GetQuantumState(state.get()); }) / maxQPower;
+    benchmark.writeNs = MedianNs([&]() {
+        qReg.SetQuantumState(state.get());
+        qReg.Finish();
+    }) / maxQPower;
+
+    // A zero cost (from a coarse clock) would make a device look infinitely fast.
+    const real1 minNs = ONE_R1 / maxQPower;
+    benchmark.gateNs = std::max(benchmark.gateNs, minNs);
+    benchmark.readNs = std::max(benchmark.readNs, minNs);
+    benchmark.writeNs = std::max(benchmark.writeNs, minNs);
+
+    return benchmark;
+}
+
+// Each device is benchmarked once per process, the first time a QUnitMulti uses it.
+static DeviceBenchmark GetDeviceBenchmark(int devID)
+{
+    static std::mutex benchmarkMutex;
+    static std::map<int, DeviceBenchmark> benchmarks;
+
+    std::lock_guard<std::mutex> guard(benchmarkMutex);
+    auto found = benchmarks.find(devID);
+    if (found != benchmarks.end()) {
+        return found->second;
+    }
+
+    DeviceBenchmark benchmark = BenchmarkDevice(devID);
+    benchmarks[devID] = benchmark;
+
+    return benchmark;
+}
+
 QUnitMulti::QUnitMulti(QInterfaceEngine eng, QInterfaceEngine subEng, bitLenInt qBitCount, bitCapInt initState,
     qrack_rand_gen_ptr rgp, complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceID,
     bool useHardwareRNG, bool useSparseStateVec, real1 norm_thresh, std::vector<int> devList, bitLenInt qubitThreshold)
@@ -50,6 +134,11 @@ QUnitMulti::QUnitMulti(QInterfaceEngine eng, QInterfaceEngine subEng, bitLenInt
 
     for (bitLenInt i = 0; i < deviceList.size(); i++) {
         deviceList[i].maxSize = deviceContext[deviceList[i].id]->device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+        DeviceBenchmark benchmark = GetDeviceBenchmark(deviceList[i].id);
+        deviceList[i].gateNs = benchmark.gateNs;
+        deviceList[i].readNs = benchmark.readNs;
+        deviceList[i].writeNs = benchmark.writeNs;
     }
 
     if (devList.size() == 0) {
@@ -90,12 +179,28 @@ void QUnitMulti::RedistributeQEngines()
     // Get shard sizes and devices
     std::vector<QEngineInfo> qinfos = GetQInfos();
 
-    std::vector<bitCapInt> devSizes(deviceList.size());
-    std::fill(devSizes.begin(), devSizes.end(), 0U);
-    bitCapInt sz;
-    bitLenInt devID, devIndex;
+    const bitLenInt devCount = deviceList.size();
+    std::vector<DeviceContextPtr> deviceContext = OCLEngine::Instance()->GetDeviceContextPtrVector();
     bitLenInt i, j;
 
+    // Outstanding work on each device, in nanoseconds, starts with the kernels still in its queue, each estimated as
+    // one gate on the average shard resident there.
+    std::vector<real1> devNs(devCount, ZERO_R1);
+    std::vector<real1> residentAmps(devCount, ZERO_R1);
+    std::vector<bitCapIntOcl> residentCounts(devCount, 0U);
+    for (i = 0; i < qinfos.size(); i++) {
+        if (qinfos[i].unit && (qinfos[i].deviceIndex < devCount)) {
+            residentAmps[qinfos[i].deviceIndex] += (real1)qinfos[i].unit->GetMaxQPower();
+            residentCounts[qinfos[i].deviceIndex]++;
+        }
+    }
+    for (j = 0; j < devCount; j++) {
+        if (residentCounts[j]) {
+            devNs[j] = deviceContext[deviceList[j].id]->GetPendingEventCount() * deviceList[j].gateNs *
+                residentAmps[j] / residentCounts[j];
+        }
+    }
+
     for (i = 0; i < qinfos.size(); i++) {
         // If the engine adds negligible load, we can let any given unit keep its
         // residency on this device.
@@ -106,35 +211,42 @@ void QUnitMulti::RedistributeQEngines()
             continue;
         }
 
-        // If the original OpenCL device has equal load to the least, we prefer the original.
-        devID = qinfos[i].unit->GetDeviceID();
-        devIndex = qinfos[i].deviceIndex;
-        sz = devSizes[devIndex];
-
-        // If the original device has 0 determined load, don't switch the unit.
-        if (sz > 0) {
-            // If the default OpenCL device has equal load to the least, we prefer the default.
-            if (devSizes[0] < sz) {
-                devID = deviceList[0].id;
-                devIndex = 0;
-                sz = devSizes[0];
+        const real1 amps = (real1)qinfos[i].unit->GetMaxQPower();
+        const bitLenInt origIndex = qinfos[i].deviceIndex;
+        const bool isListed = origIndex < devCount;
+
+        // Each candidate is scored by when one more gate on this shard would finish there, plus the copy to get it
+        // there, amortized over the horizon. Staying put costs no copy, (so ties keep the original device).
+        bitLenInt bestIndex = origIndex;
+        real1 bestScore = isListed ? (devNs[origIndex] + amps * deviceList[origIndex].gateNs)
+                                   : std::numeric_limits<real1>::infinity();
+
+        for (j = 0; j < devCount; j++) {
+            if ((j == origIndex) || ((amps * sizeof(complex)) > (real1)deviceList[j].maxSize)) {
+                continue;
             }
 
-            // Find the device with the lowest load.
-            for (j = 0; j < deviceList.size(); j++) {
-                if ((devSizes[j] < sz) && ((devSizes[j] + qinfos[i].unit->GetMaxQPower()) <= deviceList[j].maxSize)) {
-                    devID = deviceList[j].id;
-                    devIndex = j;
-                    sz = devSizes[j];
-                }
+            // SetDevice() overlaps reading from the old device with writing to the new one.
+            const real1 copyNs =
+                amps * std::max((isListed ? deviceList[origIndex].readNs : ZERO_R1), deviceList[j].writeNs);
+            const real1 score = devNs[j] + amps * deviceList[j].gateNs + (copyNs / SCHEDULER_GATE_HORIZON);
+            if (score < bestScore) {
+                bestIndex = j;
+                bestScore = score;
             }
+        }
+
+        if (bestIndex >= devCount) {
+            // Nothing listed can hold this unit, so leave it where it is.
+            continue;
+        }
 
-            // Add this unit to the device with the lowest load.
-            qinfos[i].unit->SetDevice(devID);
+        if (bestIndex != origIndex) {
+            qinfos[i].unit->SetDevice(deviceList[bestIndex].id);
         }
 
-        // Update the size of buffers handles by this device.
-        devSizes[devIndex] += qinfos[i].unit->GetMaxQPower();
+        // Update the outstanding work on this device.
+        devNs[bestIndex] += amps * deviceList[bestIndex].gateNs;
     }
 }
 
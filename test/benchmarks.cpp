@@ -45,6 +45,141 @@ double formatTime(double t, bool logNormal)
     }
 }
 
+std::string engineName(QInterfaceEngine engine)
+{
+    switch (engine) {
+    case QINTERFACE_CPU:
+        return "cpu";
+    case QINTERFACE_OPENCL:
+        return "opencl";
+    case QINTERFACE_HYBRID:
+        return "hybrid";
+    case QINTERFACE_STABILIZER_HYBRID:
+        return "stabilizer_hybrid";
+    case QINTERFACE_QPAGER:
+        return "qpager";
+    case QINTERFACE_MPI:
+        return "mpi";
+    case QINTERFACE_QUNIT:
+        return "qunit";
+    case QINTERFACE_QUNIT_MULTI:
+        return "qunit_multi";
+    default:
+        return "other";
+    }
+}
+
+std::string deviceName()
+{
+#if ENABLE_OPENCL
+    QInterfaceEngine engines[3] = { testEngineType, testSubEngineType, testSubSubEngineType };
+    for (int i = 0; i < 3; i++) {
+        if ((engines[i] == QINTERFACE_OPENCL) || (engines[i] == QINTERFACE_HYBRID) ||
+            (engines[i] == QINTERFACE_QUNIT_MULTI)) {
+            return OCLEngine::Instance()->GetDeviceContextPtr(device_id)->device.getInfo<CL_DEVICE_NAME>();
+        }
+    }
+#endif
+    return "host";
+}
+
+// Quantile "q" of sorted "samples," interpolating between neighbors
+double quantile(const std::vector<double>& samples, double q)
+{
+    double position = q * (samples.size() - 1U);
+    size_t lower = (size_t)position;
+    if ((lower + 1U) >= samples.size()) {
+        return samples.back();
+    }
+    return samples[lower] + (position - lower) * (samples[lower + 1U] - samples[lower]);
+}
+
+std::string jsonString(std::string str)
+{
+    std::string toRet = "\"";
+    for (size_t i = 0; i < str.size(); i++) {
+        if ((str[i] == '"') || (str[i] == '\\')) {
+            toRet += '\\';
+        }
+        toRet += str[i];
+    }
+    return toRet + "\"";
+}
+
+/*
+ * Write one record to the --report file. "trialMs" holds each sample's time, and "passes" is the number of full state
+ * vector passes that a dense engine would make per sample, (or 0, if the test doesn't estimate it). The effective
+ * bandwidth counts a read and a write of every amplitude per pass, so it's comparable across engines, even those (like
+ * QUnit) that don't actually touch a dense state vector.
+ */
+void reportBenchmark(std::vector<double> trialMs, bitLenInt numBits, double passes)
+{
+    if (!reportFileName.compare("")) {
+        return;
+    }
+
+    std::sort(trialMs.begin(), trialMs.end());
+    double mean = 0.0;
+    for (size_t i = 0; i < trialMs.size(); i++) {
+        mean += trialMs[i];
+    }
+    mean /= trialMs.size();
+    double stdDev = 0.0;
+    for (size_t i = 0; i < trialMs.size(); i++) {
+        stdDev += (trialMs[i] - mean) * (trialMs[i] - mean);
+    }
+    stdDev = sqrt(stdDev / trialMs.size());
+
+    const double medianMs = quantile(trialMs, 0.5);
+    const double ampUpdates = passes * (double)pow2(numBits);
+    const bool isRated = (passes > 0.0) && (medianMs > 0.0);
+    const double updatesPerS = isRated ? (ampUpdates / (medianMs / 1000.0)) : 0.0;
+    const double gbPerS = updatesPerS * 2.0 * sizeof(complex) / 1e9;
+
+    const std::string testName = Catch::getResultCapture().getCurrentTestName();
+    const int precisionBits = 8 * sizeof(real1);
+    const double stats[7] = { mean, stdDev, trialMs[0], quantile(trialMs, 0.25), medianMs, quantile(trialMs, 0.75),
+        trialMs.back() };
+
+    if (isJsonReport) {
+        const char* statNames[7] = { "mean_ms", "stddev_ms", "min_ms", "q1_ms", "median_ms", "q3_ms", "max_ms" };
+        reportFile << (isReportEmpty ? "" : ",") << std::endl << "  {";
+        reportFile << "\"test\": " << jsonString(testName) << ", \"qubits\": " << (int)numBits;
+        reportFile << ", \"engine\": " << jsonString(engineName(testEngineType));
+        reportFile << ", \"sub_engine\": " << jsonString(engineName(testSubEngineType));
+        reportFile << ", \"sub_sub_engine\": " << jsonString(engineName(testSubSubEngineType));
+        reportFile << ", \"device\": " << jsonString(deviceName()) << ", \"device_id\": " << device_id;
+        reportFile << ", \"precision_bits\": " << precisionBits << ", \"sparse\": " << (sparse ? "true" : "false");
+        reportFile << ", \"samples\": " << trialMs.size();
+        for (int i = 0; i < 7; i++) {
+            reportFile << ", \"" << statNames[i] << "\": " << stats[i];
+        }
+        if (isRated) {
+            reportFile << ", \"state_vector_passes\": " << passes << ", \"amplitude_updates_per_s\": " << updatesPerS
+                       << ", \"effective_gb_per_s\": " << gbPerS;
+        } else {
+            reportFile << ", \"state_vector_passes\": null, \"amplitude_updates_per_s\": null"
+                       << ", \"effective_gb_per_s\": null";
+        }
+        reportFile << "}";
+    } else {
+        reportFile << testName << "," << (int)numBits << "," << engineName(testEngineType) << ","
+                   << engineName(testSubEngineType) << "," << engineName(testSubSubEngineType) << ","
+                   << jsonString(deviceName()) << "," << device_id << "," << precisionBits << "," << (sparse ? 1 : 0)
+                   << "," << trialMs.size();
+        for (int i = 0; i < 7; i++) {
+            reportFile << "," << stats[i];
+        }
+        if (isRated) {
+            reportFile << "," << passes << "," << updatesPerS << "," << gbPerS << std::endl;
+        } else {
+            reportFile << ",,," << std::endl;
+        }
+    }
+    reportFile.flush();
+    isReportEmpty = false;
+}
+
 QInterfacePtr MakeRandQubit()
 {
     QInterfacePtr qubit = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 1U, 0, rng,
@@ -59,8 +194,13 @@ QInterfacePtr MakeRandQubit()
     return qubit;
 }
 
+/*
+ * "passes," if given, estimates how many full passes over the state vector a dense engine makes, for each call to "fn"
+ * with a given qubit count, which the --report file uses to rate bandwidth.
+ */
 void benchmarkLoopVariable(std::function<void(QInterfacePtr, bitLenInt)> fn, bitLenInt mxQbts,
-    bool resetRandomPerm = true, bool hadamardRandomBits = false, bool logNormal = false, bool qUniverse = false)
+    bool resetRandomPerm = true, bool hadamardRandomBits = false, bool logNormal = false, bool qUniverse = false,
+    std::function<double(bitLenInt)> passes = nullptr)
 {
     std::cout << std::endl;
     std::cout << ">>> '" << Catch::getResultCapture().getCurrentTestName() << "':" << std::endl;
@@ -173,6 +313,12 @@ void benchmarkLoopVariable(std::function<void(QInterfacePtr, bitLenInt)> fn, bit
         }
         stdet = sqrt(stdet / benchmarkSamples);
 
+        std::vector<double> trialMs(benchmarkSamples);
+        for (i = 0; i < benchmarkSamples; i++) {
+            trialMs[i] = formatTime(trialClocks[i], logNormal);
+        }
+        reportBenchmark(trialMs, numBits, passes ? passes(numBits) : 0.0);
+
         std::sort(trialClocks, trialClocks + benchmarkSamples);
 
         std::cout << (int)numBits << ", "; /* # of Qubits */
@@ -211,11 +357,15 @@ void benchmarkLoopVariable(std::function<void(QInterfacePtr, bitLenInt)> fn, bit
 }
 
 void benchmarkLoop(std::function<void(QInterfacePtr, bitLenInt)> fn, bool resetRandomPerm = true,
-    bool hadamardRandomBits = false, bool logNormal = false, bool qUniverse = false)
+    bool hadamardRandomBits = false, bool logNormal = false, bool qUniverse = false,
+    std::function<double(bitLenInt)> passes = nullptr)
 {
-    benchmarkLoopVariable(fn, max_qubits, resetRandomPerm, hadamardRandomBits, logNormal, qUniverse);
+    benchmarkLoopVariable(fn, max_qubits, resetRandomPerm, hadamardRandomBits, logNormal, qUniverse, passes);
 }
 
+// Single and controlled gate passes of a QFT, (which QFT() and IQFT() each make without swaps)
+double qftPasses(bitLenInt n) { return (n * (n + 1U)) / 2.0; }
+
 TEST_CASE("test_cnot_single", "[gates]")
 {
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->CNOT(0, 1); });
@@ -413,7 +563,7 @@ TEST_CASE("test_set_reg", "[aux]")
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->SetReg(0, n, 1); });
 }
 
-TEST_CASE("test_grover", "[grover]")
+TEST_CASE("test_grover", "[grover][standard]")
 {
 
     // Grover's search inverts the function of a black box subroutine.
@@ -445,7 +595,12 @@ TEST_CASE("test_grover", "[grover]")
         REQUIRE_THAT(qftReg, HasProbability(0x3));
 
         qftReg->MReg(0, n);
-    });
+    },
+        true, false, false, false,
+        [](bitLenInt n) {
+            const int optIter = M_PI / (4.0 * asin(1.0 / sqrt((real1)pow2(n))));
+            return (double)n + optIter * (4.0 + 2.0 * n);
+        });
 }
 
 TEST_CASE("test_qft_ideal_init", "[qft]")
@@ -475,14 +630,36 @@ TEST_CASE("test_qft_superposition_one_way", "[qft]")
         testEngineType == QINTERFACE_QUNIT);
 }
 
-TEST_CASE("test_qft_superposition_round_trip", "[qft]")
+TEST_CASE("test_qft_superposition_round_trip", "[qft][standard]")
 {
     benchmarkLoop(
         [](QInterfacePtr qftReg, bitLenInt n) {
             qftReg->QFT(0, n, false);
             qftReg->IQFT(0, n, false);
         },
-        true, true, testEngineType == QINTERFACE_QUNIT);
+        true, true, testEngineType == QINTERFACE_QUNIT, false, [](bitLenInt n) { return 2.0 * qftPasses(n); });
+}
+
+TEST_CASE("test_shor_modexp", "[shor][standard]")
+{
+    // The quantum part of Shor's algorithm: modular exponentiation of a superposed exponent, then an inverse QFT of it.
+    benchmarkLoop(
+        [](QInterfacePtr qftReg, bitLenInt n) {
+            const bitLenInt length = n / 2U;
+            // (An odd modulus, so that the base of 2 is coprime to it)
+            const bitCapInt modN = pow2(length) - ONE_BCI;
+            qftReg->SetPermutation(0);
+            qftReg->H(0, length);
+            qftReg->POWModNOut(2U, modN, 0, length, length);
+            qftReg->IQFT(0, length, false);
+            qftReg->MReg(0, length);
+        },
+        false, false, false, false,
+        [](bitLenInt n) {
+            // (Modular exponentiation is one controlled multiplication per exponent bit.)
+            const bitLenInt length = n / 2U;
+            return 2.0 * length + qftPasses(length);
+        });
 }
 
 bitLenInt pickRandomBit(QInterfacePtr qReg, std::set<bitLenInt>* unusedBitsPtr)
@@ -724,7 +901,7 @@ TEST_CASE("test_universal_circuit_discrete", "[supreme]")
         false, false, testEngineType == QINTERFACE_QUNIT);
 }
 
-TEST_CASE("test_universal_circuit_digital", "[supreme]")
+TEST_CASE("test_universal_circuit_digital", "[supreme][standard]")
 {
     const int GateCount1Qb = 4;
     const int GateCountMultiQb = 4;
@@ -787,7 +964,9 @@ TEST_CASE("test_universal_circuit_digital", "[supreme]")
 
             qReg->MAll();
         },
-        false, false, testEngineType == QINTERFACE_QUNIT);
+        false, false, testEngineType == QINTERFACE_QUNIT, false,
+        // (Each layer is a single bit gate per qubit, and a multi-bit gate per pair, roughly.)
+        [&](bitLenInt n) { return Depth * 1.5 * n; });
 }
 
 TEST_CASE("test_universal_circuit_analog", "[supreme]")
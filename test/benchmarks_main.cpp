@@ -37,6 +37,10 @@ std::string mOutputFileName;
 std::ofstream mOutputFile;
 bool isBinaryOutput = false;
 int benchmarkSamples = 100;
+std::string reportFileName;
+std::ofstream reportFile;
+bool isJsonReport = false;
+bool isReportEmpty = true;
 
 int main(int argc, char* argv[])
 {
@@ -54,6 +58,7 @@ int main(int argc, char* argv[])
     bool stabilizer = false;
 
     int mxQbts = 24;
+    std::string reportFormat = "csv";
 
     using namespace Catch::clara;
 
@@ -87,7 +92,11 @@ int main(int argc, char* argv[])
         Opt(single_qubit_run)["--single"]("Only run single (maximum) qubit count for tests") |
         Opt(sparse)["--sparse"](
             "(For QEngineCPU, under QUnit:) Use a state vector optimized for sparse representation and iteration.") |
-        Opt(benchmarkSamples, "samples")["--benchmark-samples"]("number of samples to collect (default: 100)");
+        Opt(benchmarkSamples, "samples")["--benchmark-samples"]("number of samples to collect (default: 100)") |
+        Opt(reportFileName, "report")["--report"](
+            "Specifies a file name for machine-readable results: one record per test, engine stack, and qubit count, "
+            "with timing statistics, effective bandwidth, the device, and the precision") |
+        Opt(reportFormat, "csv|json")["--report-format"]("Format of the --report file (default: csv)");
 
     session.cli(cli);
 
@@ -164,6 +173,25 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (reportFileName.compare("")) {
+        if (reportFormat == "json") {
+            isJsonReport = true;
+        } else if (reportFormat != "csv") {
+            std::cout << "Unknown --report-format: " << reportFormat << std::endl;
+            return 1;
+        }
+        session.config().stream() << "Benchmark report file: " << reportFileName << std::endl;
+        reportFile.open(reportFileName, std::ios::out);
+        if (isJsonReport) {
+            reportFile << "[";
+        } else {
+            reportFile << "Test,Qubits,Engine,SubEngine,SubSubEngine,Device,DeviceID,PrecisionBits,Sparse,Samples,"
+                          "MeanMs,StdDevMs,MinMs,Q1Ms,MedianMs,Q3Ms,MaxMs,StateVectorPasses,AmplitudeUpdatesPerS,"
+                          "EffectiveGBPerS"
+                       << std::endl;
+        }
+    }
+
     int num_failed = 0;
 
     if (num_failed == 0 && qengine) {
@@ -282,6 +310,13 @@ int main(int argc, char* argv[])
         mOutputFile.close();
     }
 
+    if (reportFileName.compare("")) {
+        if (isJsonReport) {
+            reportFile << std::endl << "]" << std::endl;
+        }
+        reportFile.close();
+    }
+
     return num_failed;
 }
 
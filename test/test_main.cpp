@@ -43,6 +43,8 @@ int main(int argc, char* argv[])
     bool qengine = false;
     bool qunit = false;
     bool qunit_multi = false;
+    bool qpager = false;
+    bool mpi = false;
 
     // Engines
     bool cpu = false;
@@ -58,6 +60,9 @@ int main(int argc, char* argv[])
     auto cli = session.cli() | Opt(qengine)["--layer-qengine"]("Enable Basic QEngine tests") |
         Opt(qunit)["--layer-qunit"]("Enable QUnit implementation tests") |
         Opt(qunit_multi)["--layer-qunit-multi"]("Enable QUnitMulti implementation tests") |
+        Opt(qpager)["--layer-qpager"]("Enable QPager implementation tests") |
+        Opt(mpi)["--layer-mpi"]("Enable QMPIPager implementation tests, (on every rank, under mpirun, with the same "
+                                "--rng-seed)") |
         Opt(cpu)["--proc-cpu"]("Enable the CPU-based implementation tests") |
         Opt(opencl)["--proc-opencl"]("Single (parallel) processor OpenCL tests") |
         Opt(hybrid)["--proc-hybrid"]("Enable CPU/OpenCL hybrid implementation tests") |
@@ -103,10 +108,12 @@ int main(int argc, char* argv[])
         session.config().stream() << " (Overridden by hardware generation!)" << std::endl;
     }
 
-    if (!qengine && !qunit && !qunit_multi) {
+    if (!qengine && !qunit && !qunit_multi && !qpager && !mpi) {
         qunit = true;
         qunit_multi = true;
         qengine = true;
+        qpager = true;
+        mpi = true;
     }
 
     if (!cpu && !opencl && !hybrid && !stabilizer) {
@@ -153,6 +160,44 @@ int main(int argc, char* argv[])
 #endif
     }
 
+    if (num_failed == 0 && qpager) {
+        testEngineType = QINTERFACE_QPAGER;
+        if (num_failed == 0 && cpu) {
+            session.config().stream() << "############ QPager -> QEngine -> CPU ############" << std::endl;
+            testSubEngineType = QINTERFACE_CPU;
+            num_failed = session.run();
+        }
+
+#if ENABLE_OPENCL
+        if (num_failed == 0 && opencl) {
+            session.config().stream() << "############ QPager -> QEngine -> OpenCL ############" << std::endl;
+            testSubEngineType = QINTERFACE_OPENCL;
+            CreateQuantumInterface(QINTERFACE_OPENCL, 1, 0).reset(); /* Get the OpenCL banner out of the way. */
+            num_failed = session.run();
+        }
+#endif
+    }
+
+#if ENABLE_MPI
+    if (num_failed == 0 && mpi) {
+        testEngineType = QINTERFACE_MPI;
+        if (num_failed == 0 && cpu) {
+            session.config().stream() << "############ QMPIPager -> QEngine -> CPU ############" << std::endl;
+            testSubEngineType = QINTERFACE_CPU;
+            num_failed = session.run();
+        }
+
+#if ENABLE_OPENCL
+        if (num_failed == 0 && opencl) {
+            session.config().stream() << "############ QMPIPager -> QEngine -> OpenCL ############" << std::endl;
+            testSubEngineType = QINTERFACE_OPENCL;
+            CreateQuantumInterface(QINTERFACE_OPENCL, 1, 0).reset(); /* Get the OpenCL banner out of the way. */
+            num_failed = session.run();
+        }
+#endif
+    }
+#endif
+
     if (num_failed == 0 && qunit) {
         testEngineType = QINTERFACE_QUNIT;
         if (num_failed == 0 && cpu) {
@@ -246,6 +291,13 @@ QInterfaceTestFixture::QInterfaceTestFixture()
     qrack_rand_gen_ptr rng = std::make_shared<qrack_rand_gen>();
     rng->seed(rngSeed);
 
-    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 20, 0, rng, ONE_CMPLX,
-        enable_normalization, true, false, device_id, !disable_hardware_rng, sparse);
+    if (testEngineType == QINTERFACE_QPAGER) {
+        // Split the 20 qubit register into 4 pages, so that qubits 18 and 19 are page ("meta-") qubits.
+        qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 20, 0, rng, ONE_CMPLX,
+            enable_normalization, true, false, device_id, !disable_hardware_rng, sparse, REAL1_EPSILON,
+            std::vector<int>{}, 18);
+    } else {
+        qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 20, 0, rng,
+            ONE_CMPLX, enable_normalization, true, false, device_id, !disable_hardware_rng, sparse);
+    }
 }
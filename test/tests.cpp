@@ -10,18 +10,35 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <iostream>
 #include <list>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
 
 #include "catch.hpp"
+#include "pinvoke_api.hpp"
+#include "common/dispatchqueue.hpp"
+#include "common/qprofiler.hpp"
+#include "common/threadpool.hpp"
 #include "qfactory.hpp"
+#include "qhybrid.hpp"
 #include "qneuron.hpp"
+#include "qparamcircuit.hpp"
+#include "qpauliframe.hpp"
+#include "qtrajectory.hpp"
+#include "qstabilizerhybrid.hpp"
 
 #include "tests.hpp"
 
+#if ENABLE_OPENCL
+#include "qengine_opencl_batch.hpp"
+#endif
+
 using namespace Qrack;
 
 #define EPSILON 0.001
@@ -168,6 +185,26 @@ TEST_CASE("test_qengine_cpu_par_for")
     }
 }
 
+TEST_CASE("test_qengine_cpu_par_for_function")
+{
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(1, 0);
+
+    // Enough entries to split into chunks, with a remainder to clamp
+    const bitCapIntOcl NUM_ENTRIES = (1U << 20U) + 3U;
+    std::vector<char> hit(NUM_ENTRIES << 1U, 0);
+
+    // (std::function arguments go through the same inlined templates as lambdas)
+    IncrementFunc inc = [](const bitCapInt i, const int cpu) { return i << 1U; };
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) { hit[(bitCapIntOcl)lcv]++; };
+    qengine->par_for_inc(0, NUM_ENTRIES, inc, fn);
+
+    bool isCorrect = true;
+    for (bitCapIntOcl i = 0; i < (NUM_ENTRIES << 1U); i++) {
+        isCorrect &= (hit[i] == ((i & 1U) ? 0 : 1));
+    }
+    REQUIRE(isCorrect);
+}
+
 TEST_CASE("test_qengine_cpu_par_for_skip")
 {
     QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(1, 0);
@@ -257,6 +294,1470 @@ TEST_CASE("test_qengine_cpu_par_for_mask")
     });
 }
 
+TEST_CASE("test_qengine_cpu_par_for_pool")
+{
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(1, 0);
+
+    const int32_t NUM_CORES = 4;
+    const bitCapIntOcl NUM_ENTRIES = 8U * NUM_CORES * (ONE_BCI << PSTRIDEPOW);
+    const bitCapIntOcl NUM_INNER = 4U * NUM_CORES * (ONE_BCI << PSTRIDEPOW);
+
+    std::vector<std::atomic_bool> hit(NUM_ENTRIES);
+    std::atomic_int calls;
+    std::atomic_int badCpus;
+    std::atomic_int innerCalls;
+
+    calls.store(0);
+    badCpus.store(0);
+    innerCalls.store(0);
+
+    for (bitCapIntOcl i = 0; i < NUM_ENTRIES; i++) {
+        hit[i].store(false);
+    }
+
+    qengine->SetConcurrencyLevel(NUM_CORES);
+
+    // Every item is visited exactly once, and "cpu" is always a valid per-thread index.
+    for (int rep = 0; rep < 10; rep++) {
+        qengine->par_for(0, NUM_ENTRIES, [&](const bitCapInt lcv, const int cpu) {
+            hit[(bitCapIntOcl)lcv].exchange(!hit[(bitCapIntOcl)lcv].load());
+            if ((cpu < 0) || (cpu >= NUM_CORES)) {
+                badCpus++;
+            }
+            calls++;
+        });
+    }
+
+    REQUIRE(calls.load() == (int)(10U * NUM_ENTRIES));
+    REQUIRE(badCpus.load() == 0);
+    for (bitCapIntOcl i = 0; i < NUM_ENTRIES; i++) {
+        REQUIRE(hit[i].load() == false);
+    }
+
+    // Parallel loops started from inside pool workers must complete, (without deadlock).
+    ParallelFor innerPool;
+    innerPool.SetConcurrencyLevel(NUM_CORES);
+    qengine->par_for(0, NUM_CORES * (ONE_BCI << PSTRIDEPOW), [&](const bitCapInt lcv, const int cpu) {
+        if ((lcv % (ONE_BCI << PSTRIDEPOW)) == 0) {
+            innerPool.par_for(0, NUM_INNER, [&](const bitCapInt lcv2, const int cpu2) { innerCalls++; });
+        }
+    });
+
+    REQUIRE(innerCalls.load() == (int)(NUM_CORES * NUM_INNER));
+
+    // An exception thrown by a task, (on a pool worker, unless the caller steals it,) reaches the caller, after every
+    // other task has finished.
+    std::atomic_int finished;
+    finished.store(0);
+    REQUIRE_THROWS_AS(ThreadPool::Instance()->RunAll(NUM_CORES,
+                          [&](const int32_t task) {
+                              if (task == (NUM_CORES - 1)) {
+                                  throw std::invalid_argument("test_qengine_cpu_par_for_pool");
+                              }
+                              finished++;
+                          }),
+        std::invalid_argument);
+    REQUIRE(finished.load() == (NUM_CORES - 1));
+}
+
+TEST_CASE("test_qengine_cpu_par_for_weighted")
+{
+    ParallelFor pfControl;
+    pfControl.SetConcurrencyLevel(4);
+
+    const int NUM_ENTRIES = 300;
+    std::atomic_bool hit[NUM_ENTRIES];
+    std::atomic_int calls;
+
+    calls.store(0);
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        hit[i].store(false);
+    }
+
+    // Heavy enough items to go parallel, even though there are few of them
+    pfControl.par_for_weighted(0, NUM_ENTRIES, 1U << 12U, [&](const bitCapInt lcv, const int cpu) {
+        bool old = true;
+        old = hit[(bitCapIntOcl)lcv].exchange(old);
+        REQUIRE(old == false);
+        REQUIRE(cpu >= 0);
+        REQUIRE(cpu < 4);
+        calls++;
+    });
+
+    REQUIRE(calls.load() == NUM_ENTRIES);
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        REQUIRE(hit[i].load() == true);
+    }
+}
+
+TEST_CASE("test_qengine_cpu_par_for_grain")
+{
+    ParallelFor pfControl;
+    pfControl.SetConcurrencyLevel(4);
+
+    const bitCapIntOcl minStride = ONE_BCI << PSTRIDEPOW;
+    bitCapIntOcl stride;
+    int32_t threads;
+
+    pfControl.GetGrain(minStride, ParallelFor::PAR_KERNEL_FOR, stride, threads);
+    REQUIRE(threads == 1);
+
+    for (bitLenInt i = PSTRIDEPOW; i < 30; i += 3) {
+        bitCapInt itemCount = pow2(i);
+        pfControl.GetGrain(itemCount, ParallelFor::PAR_KERNEL_NORM, stride, threads);
+        REQUIRE(threads >= 1);
+        REQUIRE(threads <= 4);
+        REQUIRE(stride >= minStride);
+        REQUIRE((stride & (stride - ONE_BCI)) == 0);
+        REQUIRE((bitCapInt)stride <= itemCount);
+    }
+}
+
+TEST_CASE("test_dispatch_queue")
+{
+    // More operations than the ring has slots, so that the producer has to wait on the consumer
+    const int opCount = 4 * QRACK_DISPATCH_RING_SIZE;
+    std::vector<int> order;
+    std::shared_ptr<int> token = std::make_shared<int>(0);
+
+    {
+        DispatchQueue queue;
+        REQUIRE(queue.isFinished());
+
+        for (int i = 0; i < opCount; i++) {
+            queue.dispatch([&order, i] { order.push_back(i); });
+        }
+        queue.finish();
+        REQUIRE(queue.isFinished());
+        REQUIRE(order.size() == (size_t)opCount);
+        for (int i = 0; i < opCount; i++) {
+            REQUIRE(order[i] == i);
+        }
+
+        // Captures too large to store in a slot go to the heap.
+        std::array<real1, 64> big;
+        big.fill(ONE_R1);
+        real1 sum = ZERO_R1;
+        queue.dispatch([big, &sum] {
+            for (size_t i = 0; i < big.size(); i++) {
+                sum += big[i];
+            }
+        });
+        queue.finish();
+        REQUIRE_FLOAT(sum, (real1)64);
+
+        // dump() waits for the running operation, but skips the queued ones.
+        std::atomic<bool> isFirstStarted(false);
+        std::atomic<bool> isFirstDone(false);
+        std::atomic<int> count(0);
+        queue.dispatch([&isFirstStarted, &isFirstDone] {
+            isFirstStarted = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            isFirstDone = true;
+        });
+        while (!isFirstStarted) {
+        }
+        for (int i = 0; i < 8; i++) {
+            queue.dispatch([&count, token] { count++; });
+        }
+        queue.dump();
+        REQUIRE(isFirstDone);
+        REQUIRE(count == 0);
+        REQUIRE(token.use_count() == 1);
+
+        queue.dispatch([&count] { count++; });
+        queue.finish();
+        REQUIRE(count == 1);
+
+        // Operations still queued at destruction are released without running.
+        queue.dispatch([] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+        for (int i = 0; i < 8; i++) {
+            queue.dispatch([&count, token] { count++; });
+        }
+    }
+    REQUIRE(token.use_count() == 1);
+}
+
+TEST_CASE("test_wide_simd_runs")
+{
+    const bitCapIntOcl RUN_LENGTH = 19; // Not a multiple of the vector width, to cover the scalar tail
+    const real1 sqrt1_2 = (real1)M_SQRT1_2;
+    const complex mtrx[4] = { complex(sqrt1_2, ZERO_R1), complex(ZERO_R1, sqrt1_2), complex(ZERO_R1, sqrt1_2),
+        complex(sqrt1_2, ZERO_R1) };
+
+    std::vector<complex> amps0(RUN_LENGTH);
+    std::vector<complex> amps1(RUN_LENGTH);
+    std::vector<complex> expected0(RUN_LENGTH);
+    std::vector<complex> expected1(RUN_LENGTH);
+    real1 expectedNorm = ZERO_R1;
+    real1 expectedFloored = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < RUN_LENGTH; i++) {
+        amps0[i] = complex((real1)i / 8, -(real1)(i % 3) / 4);
+        amps1[i] = complex((real1)(i % 5) / 2, (real1)i / 16);
+        expected0[i] = (mtrx[0] * amps0[i]) + (mtrx[1] * amps1[i]);
+        expected1[i] = (mtrx[2] * amps0[i]) + (mtrx[3] * amps1[i]);
+        expectedNorm += norm(amps0[i]);
+        if (norm(amps0[i]) >= ONE_R1) {
+            expectedFloored += norm(amps0[i]);
+        }
+    }
+
+    REQUIRE(NormRun(&(amps0[0]), RUN_LENGTH) == Approx(expectedNorm));
+    REQUIRE(NormRun(&(amps0[0]), RUN_LENGTH, ONE_R1) == Approx(expectedFloored));
+
+    Apply2x2Run(&(amps0[0]), &(amps1[0]), RUN_LENGTH, mtrx);
+    for (bitCapIntOcl i = 0; i < RUN_LENGTH; i++) {
+        REQUIRE(norm(amps0[i] - expected0[i]) < REAL1_EPSILON);
+        REQUIRE(norm(amps1[i] - expected1[i]) < REAL1_EPSILON);
+    }
+}
+
+TEST_CASE("test_qengine_cpu_gate_fusion")
+{
+    QEngineCPUPtr fused = std::make_shared<QEngineCPU>(4, 0, nullptr, ONE_CMPLX, false, false);
+    QEngineCPUPtr unfused = std::make_shared<QEngineCPU>(4, 0, nullptr, ONE_CMPLX, false, false);
+
+    fused->SetGateFusion(true);
+    REQUIRE(fused->GetGateFusion());
+
+    QEngineCPUPtr engines[2] = { fused, unfused };
+    for (int i = 0; i < 2; i++) {
+        engines[i]->H(0);
+        engines[i]->T(0);
+        engines[i]->RX(M_PI / 3, 0);
+        engines[i]->H(1);
+        engines[i]->S(1);
+        engines[i]->CNOT(0, 2);
+        engines[i]->RY(M_PI / 5, 0);
+        engines[i]->X(3);
+        engines[i]->RZ(M_PI / 7, 3);
+    }
+
+    // Qubits 1 and 3 have only seen single qubit gates, so they should still be pending.
+    REQUIRE_FALSE(fused->isFinished());
+    REQUIRE_FLOAT(fused->Prob(0), unfused->Prob(0));
+    REQUIRE(fused->isFinished());
+    REQUIRE(fused->ApproxCompare(unfused));
+
+    fused->H(2);
+    unfused->H(2);
+    fused->SetGateFusion(false);
+    REQUIRE_FALSE(fused->GetGateFusion());
+    REQUIRE(fused->ApproxCompare(unfused));
+}
+
+TEST_CASE("test_qengine_cpu_diagonal_fusion")
+{
+    const bitLenInt n = 5U;
+    QEngineCPUPtr fused = std::make_shared<QEngineCPU>(n, 0, nullptr, ONE_CMPLX, false, false);
+    QEngineCPUPtr unfused = std::make_shared<QEngineCPU>(n, 0, nullptr, ONE_CMPLX, false, false);
+    fused->SetGateFusion(true);
+
+    QEngineCPUPtr engines[2] = { fused, unfused };
+    for (int i = 0; i < 2; i++) {
+        for (bitLenInt j = 0; j < n; j++) {
+            engines[i]->H(j);
+        }
+        engines[i]->Finish();
+    }
+
+    // A QAOA style cost layer, with every kind of phase-only gate, is a single pass once fused.
+    QProfiler::Reset();
+    QProfiler::SetEnabled(true);
+    const bitLenInt controls[2] = { 0, 3 };
+    for (int i = 0; i < 2; i++) {
+        for (bitLenInt j = 0; j < n; j++) {
+            engines[i]->UniformParityRZ(pow2(j) | pow2((j + 1U) % n), (real1)(0.2f + 0.1f * j));
+            engines[i]->RZ((real1)(0.7f - 0.2f * j), j);
+        }
+        engines[i]->CZ(1, 4);
+        engines[i]->CZ(1, 4);
+        engines[i]->CZ(2, 4);
+        engines[i]->T(2);
+        engines[i]->ApplyAntiControlledSinglePhase(controls, 2U, 1U, ONE_CMPLX, I_CMPLX);
+        engines[i]->CUniformParityRZ(controls, 2U, 6U, (real1)0.9f);
+
+        if (i == 0) {
+            REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) == 0U);
+            REQUIRE_FALSE(fused->isFinished());
+        }
+    }
+    QProfiler::SetEnabled(false);
+
+    // A non-diagonal gate on any qubit of the terms applies them first.
+    for (int i = 0; i < 2; i++) {
+        for (bitLenInt j = 0; j < n; j++) {
+            engines[i]->RX((real1)0.4f, j);
+        }
+    }
+    REQUIRE(fused->ApproxCompare(unfused));
+    REQUIRE(fused->isFinished());
+}
+
+TEST_CASE("test_qengine_cpu_tiled_fusion")
+{
+    // Tiles of 16 amplitudes, over an 8 qubit state, (with and without normalization)
+    const bitLenInt n = 8U;
+    for (int doNorm = 0; doNorm < 2; doNorm++) {
+        QEngineCPUPtr tiled = std::make_shared<QEngineCPU>(n, 0, nullptr, ONE_CMPLX, doNorm == 1, false);
+        QEngineCPUPtr untiled = std::make_shared<QEngineCPU>(n, 0, nullptr, ONE_CMPLX, doNorm == 1, false);
+        tiled->SetGateFusion(true);
+        tiled->SetTileQubits(4U);
+        REQUIRE(tiled->GetTileQubits() == 4U);
+
+        QEngineCPUPtr engines[2] = { tiled, untiled };
+        for (int i = 0; i < 2; i++) {
+            engines[i]->H(6);
+            engines[i]->CNOT(6, 2);
+            engines[i]->Finish();
+        }
+
+        // One sweep applies the pending gates on qubits 0 through 3, (and qubit 6 is swept on its own).
+        QProfiler::Reset();
+        QProfiler::SetEnabled(true);
+        for (int i = 0; i < 2; i++) {
+            for (bitLenInt j = 0; j < 4U; j++) {
+                engines[i]->RX((real1)(0.3f + 0.2f * j), j);
+                engines[i]->H(j);
+            }
+            engines[i]->RY((real1)0.6f, 6);
+            if (i == 0) {
+                REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) == 0U);
+                tiled->Finish();
+                REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) == 2U);
+            }
+        }
+        QProfiler::SetEnabled(false);
+
+        REQUIRE(tiled->ApproxCompare(untiled));
+        REQUIRE_FLOAT(tiled->Prob(3), untiled->Prob(3));
+    }
+}
+
+TEST_CASE("test_qengine_cpu_lazy_normalization")
+{
+    QEngineCPUPtr lazy = std::make_shared<QEngineCPU>(4, 0, nullptr, ONE_CMPLX, true, false);
+    QEngineCPUPtr eager = std::make_shared<QEngineCPU>(4, 0, nullptr, ONE_CMPLX, true, false);
+
+    lazy->SetLazyNormalization(true);
+    REQUIRE(lazy->GetLazyNormalization());
+
+    // A non-unitary "gate" changes the norm of only the amplitudes its controls select.
+    const real1 shrink = (real1)0.8f;
+    const real1 sqrt1_2 = (real1)M_SQRT1_2;
+    const complex damped[4] = { complex(shrink * sqrt1_2, ZERO_R1), complex(shrink * sqrt1_2, ZERO_R1),
+        complex(shrink * sqrt1_2, ZERO_R1), complex(-shrink * sqrt1_2, ZERO_R1) };
+    const bitLenInt controls[1] = { 0 };
+
+    QEngineCPUPtr engines[2] = { lazy, eager };
+    for (int i = 0; i < 2; i++) {
+        engines[i]->H(0);
+        engines[i]->H(1);
+        engines[i]->CRY(M_PI / 3, 1, 2);
+        engines[i]->ApplyControlledSingleBit(controls, 1, 3, damped);
+        engines[i]->Finish();
+    }
+
+    REQUIRE_FLOAT(lazy->GetRunningNorm(), eager->GetRunningNorm());
+    REQUIRE(lazy->GetRunningNorm() < ONE_R1);
+
+    for (int i = 0; i < 2; i++) {
+        engines[i]->ApplyAntiControlledSingleBit(controls, 1, 2, damped);
+        engines[i]->RX(M_PI / 5, 1);
+    }
+
+    REQUIRE_FLOAT(lazy->Prob(3), eager->Prob(3));
+    REQUIRE(lazy->ApproxCompare(eager));
+}
+
+#if !defined(_WIN32)
+TEST_CASE("test_qengine_cpu_mapped_state_vector")
+{
+    QEngineCPUPtr mapped = std::make_shared<QEngineCPU>(12, 0, nullptr, ONE_CMPLX, false, false);
+    // "useHostMem" doesn't select the memory-mapped, file-backed state vector, (as QUnit and QPager pass it along,)
+    // but SetMappedStateVec() does.
+    QEngineCPUPtr inRam = std::make_shared<QEngineCPU>(12, 0, nullptr, ONE_CMPLX, false, false, true);
+    REQUIRE(!inRam->GetMappedStateVec());
+    mapped->H(0);
+    mapped->SetMappedStateVec(true);
+    REQUIRE(mapped->GetMappedStateVec());
+    mapped->H(0);
+
+    QEngineCPUPtr engines[2] = { mapped, inRam };
+    for (int i = 0; i < 2; i++) {
+        engines[i]->H(0, 12);
+        engines[i]->CNOT(0, 11);
+        engines[i]->RY(M_PI / 3, 5);
+        engines[i]->INC(5, 0, 8);
+        engines[i]->CRZ(M_PI / 7, 11, 2);
+    }
+
+    REQUIRE_FLOAT(mapped->Prob(11), inRam->Prob(11));
+    REQUIRE(mapped->ApproxCompare(inRam));
+
+    QEngineCPUPtr clone = std::dynamic_pointer_cast<QEngineCPU>(mapped->Clone());
+    REQUIRE(clone->GetMappedStateVec());
+    REQUIRE(clone->ApproxCompare(inRam));
+}
+#endif
+
+TEST_CASE("test_qengine_cpu_numa_placement")
+{
+    // 18 qubits is at least one huge page, so these take the NUMA-aware path, on Linux. Placement can't change results.
+    QEngineCPUPtr onNode = std::make_shared<QEngineCPU>(18, 0, nullptr, ONE_CMPLX, false, false, false, 0);
+    QEngineCPUPtr interleaved = std::make_shared<QEngineCPU>(18, 0, nullptr, ONE_CMPLX, false, false, false, -1);
+    // A node that doesn't exist is ignored.
+    QEngineCPUPtr badNode = std::make_shared<QEngineCPU>(18, 0, nullptr, ONE_CMPLX, false, false, false, 1024);
+
+    QEngineCPUPtr engines[3] = { onNode, interleaved, badNode };
+    for (int i = 0; i < 3; i++) {
+        engines[i]->H(0, 18);
+        engines[i]->CNOT(0, 17);
+        engines[i]->RY(M_PI / 3, 9);
+        engines[i]->CRZ(M_PI / 7, 17, 2);
+    }
+
+    REQUIRE_FLOAT(onNode->Prob(9), interleaved->Prob(9));
+    REQUIRE(onNode->ApproxCompare(interleaved));
+    REQUIRE(badNode->ApproxCompare(interleaved));
+
+    QInterfacePtr clone = onNode->Clone();
+    REQUIRE(std::dynamic_pointer_cast<QEngineCPU>(clone)->ApproxCompare(interleaved));
+}
+
+TEST_CASE("test_qengine_cpu_inplace_arithmetic")
+{
+    // Dense state vectors permute in place, by two passes of swaps, so check each amplitude's destination.
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(8, 0, nullptr, ONE_CMPLX, false, false);
+    for (bitLenInt j = 0; j < 8; j++) {
+        qengine->RY(M_PI * (j + 1) / 9, j);
+        qengine->RZ(M_PI * (j + 2) / 7, j);
+    }
+
+    complex before[256];
+    complex after[256];
+    bitLenInt controls[2] = { 7, 0 };
+
+    for (int op = 0; op < 4; op++) {
+        qengine->GetQuantumState(before);
+        switch (op) {
+        case 0:
+            qengine->ROL(3, 1, 5);
+            break;
+        case 1:
+            qengine->INC(5, 2, 4);
+            break;
+        case 2:
+            qengine->DEC(37, 0, 7);
+            break;
+        default:
+            qengine->CINC(6, 1, 5, controls, 2);
+        }
+        qengine->GetQuantumState(after);
+
+        bool isCorrect = true;
+        for (bitCapIntOcl i = 0; i < 256U; i++) {
+            bitCapIntOcl o;
+            switch (op) {
+            case 0:
+                o = (i & 0xC1U) | (((((i >> 1U) & 0x1FU) << 3U) | (((i >> 1U) & 0x1FU) >> 2U)) & 0x1FU) << 1U;
+                break;
+            case 1:
+                o = (i & 0xC3U) | ((((i >> 2U) + 5U) & 0xFU) << 2U);
+                break;
+            case 2:
+                o = (i & 0x80U) | ((i + 128U - 37U) & 0x7FU);
+                break;
+            default:
+                o = ((i & 0x81U) != 0x81U) ? i : ((i & 0xC1U) | ((((i >> 1U) + 6U) & 0x1FU) << 1U));
+            }
+            isCorrect &= (norm(after[o] - before[i]) < (10 * REAL1_EPSILON));
+        }
+        REQUIRE(isCorrect);
+    }
+}
+
+TEST_CASE("test_qengine_cpu_clone_copy_on_write")
+{
+    // A clone shares its original's state vector until either one writes, so neither one's writes may reach the other.
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(6, 0, nullptr, ONE_CMPLX, false, false);
+    qengine->H(0, 3);
+    qengine->CNOT(0, 5);
+
+    QEngineCPUPtr clone = std::dynamic_pointer_cast<QEngineCPU>(qengine->Clone());
+    QEngineCPUPtr control = std::dynamic_pointer_cast<QEngineCPU>(qengine->Clone());
+    REQUIRE(clone->ApproxCompare(qengine));
+
+    clone->X(4);
+    REQUIRE_FLOAT(clone->Prob(4), ONE_R1);
+    REQUIRE_FLOAT(qengine->Prob(4), ZERO_R1);
+    REQUIRE(qengine->ApproxCompare(control));
+
+    qengine->SetPermutation(7);
+    REQUIRE(clone->GetAmplitude(0x10) != ZERO_CMPLX);
+    REQUIRE_FLOAT(qengine->ProbAll(7), ONE_R1);
+
+    clone->X(4);
+    REQUIRE(clone->ApproxCompare(control));
+}
+
+TEST_CASE("test_statevector_sparse_shards")
+{
+    StateVectorSparsePtr sv = std::make_shared<StateVectorSparse>(256);
+    const bitCapInt perms[5] = { 3, 17, 128, 130, 255 };
+    for (int i = 0; i < 5; i++) {
+        sv->write(perms[i], complex((real1)(i + 1), ZERO_R1));
+    }
+    sv->write(17, ZERO_CMPLX);
+    REQUIRE(sv->size() == 4U);
+    REQUIRE(sv->read(255) == complex(5, 0));
+    REQUIRE(sv->read(17) == ZERO_CMPLX);
+
+    // Masked iteration drops the masked bits, and is sorted and unique.
+    std::vector<bitCapInt> masked = sv->iterable(2);
+    REQUIRE(masked.size() == 3U);
+    REQUIRE(masked[0] == 1U);
+    REQUIRE(masked[1] == 128U);
+    REQUIRE(masked[2] == 253U);
+    // Filtered on bit 7 being set
+    REQUIRE(sv->iterable(0, 128, 128).size() == 3U);
+
+    complex out[256];
+    sv->copy_out(out);
+    REQUIRE(out[3] == complex(1, 0));
+    REQUIRE(out[130] == complex(4, 0));
+    REQUIRE(out[4] == ZERO_CMPLX);
+
+    // The high half trades places with the other's low half.
+    StateVectorSparsePtr other = std::make_shared<StateVectorSparse>(256);
+    other->write(5, ONE_CMPLX);
+    other->write(200, I_CMPLX);
+    sv->shuffle(other);
+    REQUIRE(sv->read(133) == ONE_CMPLX);
+    REQUIRE(sv->read(3) == complex(1, 0));
+    REQUIRE(sv->read(128) == ZERO_CMPLX);
+    REQUIRE(other->read(0) == complex(3, 0));
+    REQUIRE(other->read(127) == complex(5, 0));
+    REQUIRE(other->read(200) == I_CMPLX);
+    REQUIRE(sv->size() == 2U);
+    REQUIRE(other->size() == 4U);
+
+    other->copy_in(NULL, 0, 128);
+    REQUIRE(other->size() == 1U);
+    sv->copy(other);
+    REQUIRE(sv->iterable() == std::vector<bitCapInt>(1, 200));
+}
+
+TEST_CASE("test_qengine_cpu_sparse_switching")
+{
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(10, 0, nullptr, ONE_CMPLX, false, false);
+    QEngineCPUPtr control = std::make_shared<QEngineCPU>(10, 0, nullptr, ONE_CMPLX, false, false);
+    REQUIRE_THROWS(qengine->SetSparseSwitching(true, ONE_R1 / 8, ONE_R1 / 4));
+    qengine->SetSparseSwitching(true);
+    REQUIRE(qengine->GetSparseSwitching());
+    // A single permutation is already sparse.
+    REQUIRE(qengine->IsSparseStateVec());
+
+    QEngineCPUPtr engines[2] = { qengine, control };
+    for (int i = 0; i < 2; i++) {
+        engines[i]->SetPermutation(0x25);
+        engines[i]->INC(3, 0, 6);
+        engines[i]->CNOT(2, 7);
+    }
+    REQUIRE(qengine->IsSparseStateVec());
+    REQUIRE(qengine->ApproxCompare(control));
+
+    // Filling in switches to dense, and measurement collapses back to sparse.
+    for (int i = 0; i < 2; i++) {
+        engines[i]->H(0, 10);
+        engines[i]->CZ(1, 8);
+    }
+    REQUIRE(!qengine->IsSparseStateVec());
+    REQUIRE(qengine->ApproxCompare(control));
+
+    for (int i = 0; i < 2; i++) {
+        engines[i]->ForceMReg(0, 8, 0xA5);
+    }
+    REQUIRE(qengine->IsSparseStateVec());
+    REQUIRE(qengine->ApproxCompare(control));
+}
+
+TEST_CASE("test_qengine_shard_phase_buffers")
+{
+    QEngineShard shards[4];
+    ShardToPhaseMap& targetOf = shards[0].targetOfShards;
+
+    // Buffers link both ways, and iterate in order of partner, like the std::map they replaced.
+    for (int i = 3; i > 0; i--) {
+        shards[0].AddPhaseAngles(&shards[i], ONE_CMPLX, -ONE_CMPLX);
+        REQUIRE(shards[i].controlsShards.find(&shards[0]) != shards[i].controlsShards.end());
+    }
+    REQUIRE(targetOf.size() == 3U);
+    bool isSorted = true;
+    for (ShardToPhaseMap::iterator phaseShard = targetOf.begin(); (phaseShard + 1) != targetOf.end(); phaseShard++) {
+        isSorted &= std::less<QEngineShardPtr>()(phaseShard->first, (phaseShard + 1)->first);
+    }
+    REQUIRE(isSorted);
+    REQUIRE(targetOf.upper_bound(targetOf.begin()->first) == (targetOf.begin() + 1));
+
+    // Adding the inverse angles leaves an identity buffer, which is removed.
+    shards[0].AddPhaseAngles(&shards[2], ONE_CMPLX, -ONE_CMPLX);
+    REQUIRE(targetOf.find(&shards[2]) == targetOf.end());
+    REQUIRE(shards[2].controlsShards.size() == 0U);
+
+    // Buffers with no phase on the "different" branch can be flipped to make this shard the control.
+    shards[0].OptimizeTargets();
+    REQUIRE(targetOf.size() == 0U);
+    REQUIRE(shards[0].controlsShards.size() == 2U);
+    REQUIRE(shards[1].targetOfShards.find(&shards[0]) != shards[1].targetOfShards.end());
+
+    shards[0].DumpControlOf();
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(shards[i].controlsShards.size() == 0U);
+        REQUIRE(shards[i].targetOfShards.size() == 0U);
+    }
+}
+
+TEST_CASE("test_qunit_cached_probabilities")
+{
+    // Repeated reads come from each unit's cached probabilities, which a gate on that unit must invalidate.
+    QInterfacePtr qUnit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 6, 0, rng, ONE_CMPLX, true, false);
+    QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, 6, 0, rng, ONE_CMPLX, true, false);
+    QInterfacePtr engines[2] = { qUnit, reference };
+    for (int i = 0; i < 2; i++) {
+        engines[i]->H(0);
+        engines[i]->CNOT(0, 1);
+        engines[i]->RY(M_PI / 3, 2);
+        engines[i]->CNOT(2, 3);
+        engines[i]->X(4);
+    }
+
+    const bitCapInt masks[3] = { 0x3, 0x2D, 0x3F };
+    for (int pass = 0; pass < 3; pass++) {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(qUnit->ProbParity(masks[i]) == Approx(reference->ProbParity(masks[i])).epsilon(0.001f));
+            REQUIRE(qUnit->ProbMask(masks[i], masks[i] & 0x15) ==
+                Approx(reference->ProbMask(masks[i], masks[i] & 0x15)).epsilon(0.001f));
+        }
+        REQUIRE(qUnit->ProbAll(0x13) == Approx(reference->ProbAll(0x13)).epsilon(0.001f));
+        REQUIRE(qUnit->ProbMask(0x1, 0x2) == ZERO_R1);
+
+        // A gate on one unit changes its answers, (and leaves the other unit's cache valid).
+        qUnit->RX(M_PI / 5, 1 + pass);
+        reference->RX(M_PI / 5, 1 + pass);
+    }
+}
+
+TEST_CASE("test_qhybrid_calibration")
+{
+    // The crossover is the narrowest width from which the GPU stays faster.
+    std::vector<real1> cpuNs = { 1, 2, 4, 8, 16 };
+    std::vector<real1> gpuNs = { 8, 1, 8, 4, 4 };
+    REQUIRE(QHybridCalibration::FindCrossover(cpuNs, gpuNs, 4) == 7U);
+    gpuNs[4] = 32;
+    REQUIRE(QHybridCalibration::FindCrossover(cpuNs, gpuNs, 4) == 9U);
+
+    QHybridCalibration calibration;
+    calibration.crossoverQb[HYBRID_GATE_CONTROLLED] = 13;
+    calibration.amortizeGates[HYBRID_GATE_ARITHMETIC] = 1.5f;
+    std::stringstream stream;
+    calibration.Write(stream);
+
+    QHybridCalibration loaded;
+    REQUIRE(loaded.Read(stream));
+    REQUIRE(loaded.crossoverQb[HYBRID_GATE_CONTROLLED] == 13U);
+    REQUIRE(loaded.amortizeGates[HYBRID_GATE_ARITHMETIC] == 1.5f);
+    std::stringstream truncated("0 12 1.0\n1 14");
+    REQUIRE(!loaded.Read(truncated));
+    REQUIRE(loaded.crossoverQb[HYBRID_GATE_CONTROLLED] == 13U);
+
+    // An explicit threshold overrides calibration, whatever the gate class.
+    QHybrid qftReg(4, 0, nullptr, ONE_CMPLX, false, false, false, -1, false, false, REAL1_EPSILON, {}, 9);
+    qftReg.SetGateClass(HYBRID_GATE_ARITHMETIC);
+    REQUIRE(qftReg.GetThresholdQubits() == 9U);
+    REQUIRE(!qftReg.IsOpencl());
+}
+
+TEST_CASE("test_rdrandom_buffered")
+{
+    RdRandom rng;
+    if (!rng.SupportsRDRAND()) {
+        return;
+    }
+
+    // Draws span several buffer refills, from both the hardware and the counter-based source.
+    const size_t count = 3U * QRACK_RDRAND_BUFFER_SIZE + 7U;
+    std::vector<real1> values(count);
+    for (int isPrng = 0; isPrng < 2; isPrng++) {
+        rng.SetCounterPrng(isPrng == 1);
+        REQUIRE(rng.GetCounterPrng() == (isPrng == 1));
+
+        values[0] = rng.Next();
+        rng.FillRandom(&(values[1]), count - 1U);
+
+        real1 mean = ZERO_R1;
+        bool isInRange = true;
+        for (size_t i = 0; i < count; i++) {
+            isInRange &= (values[i] >= ZERO_R1) && (values[i] < ONE_R1);
+            mean += values[i];
+        }
+        mean /= count;
+        REQUIRE(isInRange);
+        REQUIRE(mean > 0.4f);
+        REQUIRE(mean < 0.6f);
+    }
+}
+
+TEST_CASE("test_profiler_counters")
+{
+    QProfiler::Reset();
+    QEngineCPUPtr engine = std::make_shared<QEngineCPU>(4, 0, rng, ONE_CMPLX, true, false);
+
+    // Nothing is recorded, while profiling is off.
+    QProfiler::SetEnabled(false);
+    engine->H(0);
+    engine->Finish();
+    REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) == 0U);
+
+    QProfiler::SetTracing(true);
+    REQUIRE(QProfiler::IsEnabled());
+    engine->H(0, 4);
+    engine->Finish();
+
+    QInterfacePtr qUnit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 2, 0, rng);
+    qUnit->H(0);
+    qUnit->CNOT(0, 1);
+    qUnit->M(0);
+
+    QStabilizerHybridPtr hybrid = std::dynamic_pointer_cast<QStabilizerHybrid>(
+        CreateQuantumInterface(QINTERFACE_STABILIZER_HYBRID, QINTERFACE_CPU, 2, 0, rng));
+    hybrid->SwitchToEngine();
+    QProfiler::SetEnabled(false);
+
+    REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) >= 4U);
+    REQUIRE(QProfiler::GetCount(PROFILE_QUNIT_COMPOSE) >= 1U);
+    REQUIRE(QProfiler::GetCount(PROFILE_QUNIT_DECOMPOSE) >= 1U);
+    REQUIRE(QProfiler::GetCount(PROFILE_STABILIZER_TO_ENGINE) == 1U);
+    REQUIRE(QProfiler::GetBytes(PROFILE_STABILIZER_TO_ENGINE) == (4U * sizeof(complex)));
+
+    uint64_t histogramTotal = 0U;
+    for (unsigned i = 0U; i < QRACK_PROFILE_HISTOGRAM_BINS; i++) {
+        histogramTotal += QProfiler::GetHistogram(PROFILE_APPLY_2X2, i);
+    }
+    REQUIRE(histogramTotal == QProfiler::GetCount(PROFILE_APPLY_2X2));
+
+    std::stringstream trace;
+    QProfiler::WriteTrace(trace);
+    REQUIRE(trace.str().find("{\"traceEvents\":[") == 0U);
+    REQUIRE(trace.str().find("\"name\":\"QStabilizerHybrid::SwitchToEngine\",\"cat\":\"qrack\",\"ph\":\"X\"") !=
+        std::string::npos);
+
+    QProfiler::Reset();
+    REQUIRE(QProfiler::GetCount(PROFILE_APPLY_2X2) == 0U);
+}
+
+TEST_CASE("test_qunit_separate_probe")
+{
+    QInterfacePtr qUnit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 3, 0, rng);
+    qUnit->RY(0.7, 0);
+    qUnit->CNOT(0, 1);
+    qUnit->H(2);
+    // (This flushes the CNOT, which QUnit might still be buffering.)
+    REQUIRE(qUnit->Prob(0) > ZERO_R1);
+
+    QProfiler::Reset();
+    QProfiler::SetEnabled(true);
+
+    REQUIRE(!qUnit->TrySeparate(0));
+    REQUIRE(QProfiler::GetCount(PROFILE_QUNIT_SEPARATE_PROBE) == 1U);
+
+    // A failed probe isn't repeated, (and gates on other qubits of the subsystem can't make this one separable).
+    REQUIRE(!qUnit->TrySeparate(0));
+    qUnit->RY(0.2, 1);
+    qUnit->RY(-0.2, 1);
+    REQUIRE(!qUnit->TrySeparate(0));
+    REQUIRE(QProfiler::GetCount(PROFILE_QUNIT_SEPARATE_PROBE) == 1U);
+
+    // A gate on the qubit itself makes it worth probing again.
+    qUnit->CNOT(0, 1);
+    qUnit->RY(-0.7, 0);
+    REQUIRE(qUnit->TrySeparate(0));
+    REQUIRE_THAT(qUnit, HasProbability(0, 2, 0));
+
+    QProfiler::SetEnabled(false);
+    QProfiler::Reset();
+}
+
+TEST_CASE("test_profiler_kernels")
+{
+    // Kernel totals are kept by ID, (as QEngineOCL's event callbacks report them,) and summarized in the trace.
+    QProfiler::Reset();
+    const unsigned kernel = QRACK_PROFILE_MAX_KERNELS - 1U;
+    const std::string name = QProfiler::GetKernelName(kernel);
+    QProfiler::SetKernelName(kernel, "testkernel");
+    QProfiler::RecordKernel(kernel, 100U);
+    QProfiler::RecordKernel(kernel, 250U);
+    QProfiler::RecordKernel(QRACK_PROFILE_MAX_KERNELS, 1000U);
+
+    REQUIRE(QProfiler::GetKernelCount(kernel) == 2U);
+    REQUIRE(QProfiler::GetKernelNanoseconds(kernel) == 350U);
+    REQUIRE(QProfiler::GetKernelCount(QRACK_PROFILE_MAX_KERNELS) == 0U);
+
+    std::stringstream trace;
+    QProfiler::WriteTrace(trace);
+    REQUIRE(trace.str().find("\"kernels\":{\"testkernel\":{\"count\":2,\"ns\":350}}") != std::string::npos);
+
+    QProfiler::Reset();
+    REQUIRE(QProfiler::GetKernelCount(kernel) == 0U);
+    QProfiler::SetKernelName(kernel, name);
+}
+
+TEST_CASE("test_qengine_cpu_storage_precision")
+{
+    // Narrow storage keeps fewer significant digits per amplitude, (about 3, for bfloat16,) so compare loosely.
+    QEngineCPUPtr full = std::make_shared<QEngineCPU>(8, 0, nullptr, ONE_CMPLX, true, false);
+    QEngineCPUPtr bf16 = std::make_shared<QEngineCPU>(8, 0, nullptr, ONE_CMPLX, true, false);
+    bf16->SetStoragePrecision(STORAGE_BF16);
+    REQUIRE(bf16->GetStoragePrecision() == STORAGE_BF16);
+    // The factory picks precision per instance.
+    QEngineCPUPtr single = std::dynamic_pointer_cast<QEngineCPU>(
+        CreateQuantumInterface(STORAGE_FLOAT, QINTERFACE_CPU, 8, 0, nullptr, ONE_CMPLX, true, false));
+    REQUIRE(single->GetStoragePrecision() == STORAGE_FLOAT);
+
+    QEngineCPUPtr engines[3] = { full, bf16, single };
+    for (int i = 0; i < 3; i++) {
+        engines[i]->H(0, 8);
+        engines[i]->RY(M_PI / 3, 5);
+        engines[i]->CNOT(5, 1);
+        engines[i]->INC(5, 0, 6);
+        engines[i]->CRZ(M_PI / 7, 7, 2);
+        engines[i]->H(3);
+    }
+
+    bool isClose = true;
+    for (bitCapInt i = 0; i < 256; i++) {
+        isClose &= (std::abs(full->ProbAll(i) - bf16->ProbAll(i)) < 0.001f);
+    }
+    REQUIRE(isClose);
+    REQUIRE(single->ApproxCompare(full));
+
+    // Narrow storage can also be the destination of a state vector copy.
+    QEngineCPUPtr copy = std::dynamic_pointer_cast<QEngineCPU>(
+        CreateQuantumInterface(STORAGE_FLOAT, QINTERFACE_CPU, 8, 0, nullptr, ONE_CMPLX, true, false));
+    copy->CopyStateVec(full);
+    REQUIRE(copy->GetStoragePrecision() == STORAGE_FLOAT);
+    REQUIRE(copy->ApproxCompare(full));
+
+    // Clones keep the storage, and converting back keeps the state.
+    QEngineCPUPtr clone = std::dynamic_pointer_cast<QEngineCPU>(bf16->Clone());
+    REQUIRE(clone->GetStoragePrecision() == STORAGE_BF16);
+    clone->X(0);
+    bf16->SetStoragePrecision(STORAGE_NATIVE);
+    REQUIRE(bf16->GetStoragePrecision() == STORAGE_NATIVE);
+    REQUIRE(std::abs(bf16->Prob(5) - full->Prob(5)) < 0.01f);
+}
+
+static void DestroyPoolTestItem(int& item) { item = 0; }
+
+TEST_CASE("test_statevector_pool")
+{
+    // A pool keeps at most QRACK_STATEVEC_POOL_DEPTH buffers per size, per device.
+    StateVecPool<int> testPool(DestroyPoolTestItem);
+    for (int i = 0; i < (int)QRACK_STATEVEC_POOL_DEPTH; i++) {
+        REQUIRE(testPool.Release(0, 64U, i));
+    }
+    int item = -1;
+    REQUIRE(!testPool.Release(0, 64U, item));
+    REQUIRE(testPool.Release(1, 64U, item));
+    REQUIRE(testPool.GetPooledBytes() == ((QRACK_STATEVEC_POOL_DEPTH + 1U) * 64U));
+    REQUIRE(!testPool.Acquire(0, 128U, item));
+    REQUIRE(testPool.Acquire(1, 64U, item));
+    REQUIRE(item == -1);
+
+    // Freed CPU state vectors go back to the pool, and the next allocation of the same size takes them out.
+    StateVecPool<complex*>* pool = StateVectorArray::GetPool();
+    pool->Clear();
+    QInterfacePtr engine = std::make_shared<QEngineCPU>(10, 0, nullptr, ONE_CMPLX, false, false);
+    engine->H(0, 10);
+    engine = NULL;
+    REQUIRE(pool->GetPooledBytes() == (sizeof(complex) << 10U));
+
+    engine = std::make_shared<QEngineCPU>(10, 5, nullptr, ONE_CMPLX, false, false);
+    REQUIRE(pool->GetPooledBytes() == 0U);
+    REQUIRE_THAT(engine, HasProbability(0, 10, 5));
+
+    // Shard churn in QUnit draws from the pool, without changing results.
+    QInterfacePtr qUnit =
+        CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 10, 0, nullptr, ONE_CMPLX, false, false);
+    for (int i = 0; i < 4; i++) {
+        qUnit->H(0);
+        qUnit->CNOT(0, 9);
+        qUnit->CNOT(9, 0);
+        qUnit->H(9);
+        qUnit->M(0);
+        qUnit->M(9);
+    }
+    qUnit->SetPermutation(0x2AA);
+    REQUIRE_THAT(qUnit, HasProbability(0, 10, 0x2AA));
+    pool->Clear();
+}
+
+TEST_CASE("test_qpager_meta_qubits")
+{
+    // 2 qubits per page leaves qubits 2 through 4 as page ("meta-") qubits, across 8 pages.
+    QPagerPtr pager = std::make_shared<QPager>(QINTERFACE_CPU, 5, 0, nullptr, ONE_CMPLX, false, false, false, -1,
+        true, false, REAL1_EPSILON, std::vector<int>{}, 2);
+    QEngineCPUPtr engine = std::make_shared<QEngineCPU>(5, 0, nullptr, ONE_CMPLX, false, false);
+
+    REQUIRE(pager->GetQubitsPerPage() == 2);
+    REQUIRE(pager->GetPageCount() == 8);
+
+    QInterfacePtr qRegs[2] = { pager, engine };
+    for (int i = 0; i < 2; i++) {
+        qRegs[i]->H(0);
+        qRegs[i]->H(3);
+        qRegs[i]->RY(M_PI / 3, 4);
+        qRegs[i]->CNOT(3, 1);
+        qRegs[i]->CNOT(0, 2);
+        qRegs[i]->CCNOT(3, 0, 4);
+        qRegs[i]->AntiCNOT(1, 3);
+        qRegs[i]->T(4);
+        qRegs[i]->S(2);
+        qRegs[i]->Y(3);
+        qRegs[i]->CRX(M_PI / 5, 4, 1);
+        qRegs[i]->Swap(2, 4);
+        qRegs[i]->Swap(1, 3);
+    }
+
+    REQUIRE(pager->GetPageCount() == 8);
+    REQUIRE_FLOAT(pager->Prob(3), engine->Prob(3));
+    REQUIRE_FLOAT(pager->ProbMask(0x1A, 0x12), engine->ProbMask(0x1A, 0x12));
+    REQUIRE_FLOAT(pager->ProbParity(0x15), engine->ProbParity(0x15));
+
+    complex pagerState[32];
+    complex engineState[32];
+    pager->GetQuantumState(pagerState);
+    engine->GetQuantumState(engineState);
+    for (int i = 0; i < 32; i++) {
+        REQUIRE_FLOAT(real(pagerState[i]), real(engineState[i]));
+        REQUIRE_FLOAT(imag(pagerState[i]), imag(engineState[i]));
+    }
+
+    bool result = pager->M(4);
+    engine->ForceM(4, result);
+    REQUIRE_FLOAT(pager->Prob(4), result ? ONE_R1 : ZERO_R1);
+    REQUIRE_FLOAT(pager->Prob(1), engine->Prob(1));
+}
+
+#if ENABLE_MPI
+TEST_CASE("test_mpi_pager_meta_qubits")
+{
+    // With 1 qubit per rank, as many high qubits as the job has ranks, (as a power of 2,) select the rank.
+    QMPIPagerPtr pager = std::make_shared<QMPIPager>(QINTERFACE_CPU, 5, 0, nullptr, ONE_CMPLX, false, false, false,
+        -1, true, false, REAL1_EPSILON, std::vector<int>{}, 1);
+    QEngineCPUPtr engine = std::make_shared<QEngineCPU>(5, 0, nullptr, ONE_CMPLX, false, false);
+
+    REQUIRE((bitCapIntOcl)pager->GetRankCount() >= pager->GetPageCount());
+    REQUIRE((pager->GetPageCount() == 1U) == (pager->GetQubitsPerPage() == 5U));
+
+    QInterfacePtr qRegs[2] = { pager, engine };
+    for (int i = 0; i < 2; i++) {
+        qRegs[i]->H(0);
+        qRegs[i]->H(3);
+        qRegs[i]->RY(M_PI / 3, 4);
+        qRegs[i]->CNOT(3, 1);
+        qRegs[i]->CNOT(0, 2);
+        qRegs[i]->CCNOT(3, 0, 4);
+        qRegs[i]->AntiCNOT(1, 3);
+        qRegs[i]->T(4);
+        qRegs[i]->CZ(0, 4);
+        qRegs[i]->S(2);
+        qRegs[i]->Y(3);
+        qRegs[i]->CRX(M_PI / 5, 4, 1);
+        qRegs[i]->Swap(2, 4);
+        qRegs[i]->Swap(1, 3);
+        qRegs[i]->Swap(0, 4);
+        qRegs[i]->INC(3, 0, 5);
+    }
+
+    REQUIRE_FLOAT(pager->Prob(3), engine->Prob(3));
+    REQUIRE_FLOAT(pager->ProbAll(0x13), engine->ProbAll(0x13));
+    REQUIRE_FLOAT(pager->ProbMask(0x1A, 0x12), engine->ProbMask(0x1A, 0x12));
+    REQUIRE_FLOAT(pager->ProbParity(0x15), engine->ProbParity(0x15));
+
+    complex pagerState[32];
+    complex engineState[32];
+    pager->GetQuantumState(pagerState);
+    engine->GetQuantumState(engineState);
+    for (int i = 0; i < 32; i++) {
+        REQUIRE_FLOAT(real(pagerState[i]), real(engineState[i]));
+        REQUIRE_FLOAT(imag(pagerState[i]), imag(engineState[i]));
+    }
+
+    // Every rank sees the same result.
+    bool result = pager->M(4);
+    engine->ForceM(4, result);
+    REQUIRE_FLOAT(pager->Prob(4), result ? ONE_R1 : ZERO_R1);
+    REQUIRE_FLOAT(pager->Prob(1), engine->Prob(1));
+}
+#endif
+
+TEST_CASE("test_stabilizer_multiword_tableau")
+{
+    // 100 qubits need two 64-bit tableau words per row, so entanglement has to cross a word boundary.
+    const bitLenInt n = 100U;
+    QStabilizerPtr stabilizer = std::make_shared<QStabilizer>(n, 0, false);
+
+    stabilizer->H(0);
+    for (bitLenInt i = 1; i < n; i++) {
+        stabilizer->CNOT(i - 1U, i);
+    }
+    REQUIRE(stabilizer->IsSeparable(63) == 0);
+    REQUIRE(stabilizer->IsSeparable(64) == 0);
+
+    bool result = stabilizer->M(70);
+    for (bitLenInt i = 0; i < n; i++) {
+        REQUIRE(stabilizer->IsSeparableZ(i));
+        REQUIRE(stabilizer->M(i) == result);
+    }
+
+    // Compose and decompose across the word boundary, too.
+    QStabilizerPtr other = std::make_shared<QStabilizer>(3, 0x5, false);
+    REQUIRE(stabilizer->Compose(other, 62) == 62);
+    REQUIRE(stabilizer->GetQubitCount() == (n + 3U));
+    REQUIRE(stabilizer->M(61) == result);
+    REQUIRE(stabilizer->M(62));
+    REQUIRE(!stabilizer->M(63));
+    REQUIRE(stabilizer->M(64));
+    REQUIRE(stabilizer->M(65) == result);
+
+    QStabilizerPtr dest = std::make_shared<QStabilizer>(3, 0, false);
+    stabilizer->Decompose(62, dest);
+    REQUIRE(stabilizer->GetQubitCount() == n);
+    REQUIRE(stabilizer->M(62) == result);
+    REQUIRE(dest->M(0));
+    REQUIRE(!dest->M(1));
+    REQUIRE(dest->M(2));
+}
+
+TEST_CASE("test_param_circuit_gradient")
+{
+    const bitLenInt n = 3U;
+    QParamCircuit circuit(n, QINTERFACE_CPU, rng);
+
+    // A layer of rotations, an entangling layer, a uniformly controlled rotation, (as in QNeuron,) and one parameter
+    // shared by two gates
+    for (bitLenInt i = 0; i < n; i++) {
+        circuit.RX(circuit.AddParameter((real1)(0.3f + 0.2f * i)), i);
+        circuit.RZ(circuit.AddParameter((real1)(1.1f - 0.3f * i)), i);
+    }
+    circuit.H(0);
+    circuit.CNOT(0, 1);
+    circuit.CZ(1, 2);
+
+    bitLenInt controls[2] = { 0, 1 };
+    bitCapIntOcl params[4];
+    for (bitLenInt i = 0; i < 4U; i++) {
+        params[i] = circuit.AddParameter((real1)(0.4f * i - 0.5f));
+    }
+    circuit.UniformlyControlledRY(controls, 2U, 2U, params);
+
+    const bitCapIntOcl shared = circuit.AddParameter((real1)0.7f);
+    circuit.RY(shared, 0);
+    circuit.CRY(controls + 1U, 1U, shared, 2U);
+
+    std::vector<PauliTerm> observable = { PauliTerm{ 0U, 4U, (real1)0.5f }, PauliTerm{ 3U, 0U, (real1)-0.8f },
+        PauliTerm{ 5U, 1U, (real1)1.2f } };
+
+    const bitCapIntOcl paramCount = circuit.GetParameterCount();
+    std::vector<real1> gradients(paramCount);
+    const real1 expectation = circuit.Gradient(observable, &(gradients[0]));
+    REQUIRE_FLOAT(expectation, circuit.Run()->ExpectationObservable(observable));
+
+    // Central differences
+    const real1 h = (real1)1e-2f;
+    for (bitCapIntOcl i = 0; i < paramCount; i++) {
+        const real1 theta = circuit.GetParameter(i);
+        circuit.SetParameter(i, theta + h);
+        const real1 plus = circuit.Run()->ExpectationObservable(observable);
+        circuit.SetParameter(i, theta - h);
+        const real1 minus = circuit.Run()->ExpectationObservable(observable);
+        circuit.SetParameter(i, theta);
+
+        REQUIRE(std::abs(gradients[i] - ((plus - minus) / (2 * h))) < (real1)2e-3f);
+    }
+
+    REQUIRE_THROWS(circuit.RY(paramCount, 0));
+    REQUIRE_THROWS(circuit.CNOT(1, 1));
+}
+
+TEST_CASE("test_param_circuit_compile")
+{
+    const bitLenInt n = 4U;
+    QParamCircuit circuit(n, QINTERFACE_CPU, rng);
+    const bitCapIntOcl p0 = circuit.AddParameter();
+    const bitCapIntOcl p1 = circuit.AddParameter();
+    const bitCapIntOcl p2 = circuit.AddParameter();
+
+    // Two H gates cancel, the second RZ on 1 merges with the first across a CZ, and the fixed gates on 2 and 3 fuse.
+    circuit.H(0);
+    circuit.H(0);
+    circuit.H(0);
+    circuit.CNOT(0, 1);
+    circuit.RZ(p0, 1);
+    circuit.CZ(1, 2);
+    circuit.RZ(p1, 1);
+    circuit.RY(p2, 2);
+    circuit.X(3);
+    circuit.Y(3);
+    circuit.CNOT(2, 3);
+    circuit.H(3);
+    circuit.RX(p0, 0);
+
+    REQUIRE(circuit.GetGateCount() == 13U);
+    REQUIRE(circuit.GetCompiledGateCount() == 6U);
+
+    const bitCapIntOcl maxQPower = 1U << n;
+    std::unique_ptr<complex[]> expected(new complex[maxQPower]);
+    std::unique_ptr<complex[]> actual(new complex[maxQPower]);
+    for (int pass = 0; pass < 2; pass++) {
+        const real1 theta[3] = { (real1)(0.3f + pass), (real1)(-1.2f + pass), (real1)(0.8f - pass) };
+        circuit.SetParameters(theta);
+
+        QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, n, 0, rng, ONE_CMPLX, false, false);
+        reference->H(0);
+        reference->CNOT(0, 1);
+        reference->RZ(theta[0], 1);
+        reference->CZ(1, 2);
+        reference->RZ(theta[1], 1);
+        reference->RY(theta[2], 2);
+        reference->X(3);
+        reference->Y(3);
+        reference->CNOT(2, 3);
+        reference->H(3);
+        reference->RX(theta[0], 0);
+        reference->GetQuantumState(expected.get());
+
+        // Replayed onto a QUnit, without fusion, as well as run on the default engine
+        QInterfacePtr qUnit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, n, 0, rng);
+        for (int i = 0; i < 2; i++) {
+            if (i == 0) {
+                circuit.Run()->GetQuantumState(actual.get());
+            } else {
+                circuit.Compile(1U);
+                circuit.Replay(qUnit);
+                qUnit->GetQuantumState(actual.get());
+                circuit.Compile();
+            }
+
+            complex innerProd = ZERO_CMPLX;
+            for (bitCapIntOcl j = 0; j < maxQPower; j++) {
+                innerProd += conj(expected[j]) * actual[j];
+            }
+            REQUIRE_FLOAT(norm(innerProd), ONE_R1);
+        }
+    }
+
+    REQUIRE_THROWS(circuit.Compile(5U));
+}
+
+TEST_CASE("test_param_circuit_long_batch")
+{
+    // One run of uncontrolled gates, longer than a bitLenInt can count, is replayed as one batch.
+    const bitLenInt n = 2U;
+    const int pairCount = 150;
+    QParamCircuit circuit(n, QINTERFACE_CPU, rng);
+    const bitCapIntOcl p0 = circuit.AddParameter((real1)0.1f);
+    const bitCapIntOcl p1 = circuit.AddParameter((real1)0.2f);
+
+    QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, n, 0, rng, ONE_CMPLX, false, false);
+    for (int i = 0; i < pairCount; i++) {
+        circuit.RX(p0, 0);
+        circuit.RY(p1, 0);
+        reference->RX((real1)0.1f, 0);
+        reference->RY((real1)0.2f, 0);
+    }
+    REQUIRE(circuit.GetCompiledGateCount() == (2U * pairCount));
+
+    REQUIRE_FLOAT(circuit.Run()->Prob(0), reference->Prob(0));
+}
+
+TEST_CASE("test_param_circuit_remap")
+{
+    const bitLenInt n = 6U;
+    QParamCircuit circuit(n, QINTERFACE_CPU, rng);
+    const bitCapIntOcl p0 = circuit.AddParameter();
+    const bitCapIntOcl p1 = circuit.AddParameter();
+
+    // The high qubits carry nearly all of the non-diagonal gates, so they should be swapped into the low positions.
+    for (int i = 0; i < 6; i++) {
+        circuit.RX(p0, 4);
+        circuit.H(5);
+        circuit.RY(p1, 5);
+        circuit.CNOT(4, 0);
+        circuit.H(4);
+    }
+    circuit.H(1);
+    circuit.CZ(1, 5);
+
+    circuit.Compile(1U);
+    const size_t plainCount = circuit.GetCompiledGateCount();
+    circuit.Compile(1U, 2U);
+    REQUIRE(circuit.GetCompiledGateCount() > plainCount);
+
+    const bitCapIntOcl maxQPower = 1U << n;
+    std::unique_ptr<complex[]> expected(new complex[maxQPower]);
+    std::unique_ptr<complex[]> actual(new complex[maxQPower]);
+    for (int pass = 0; pass < 2; pass++) {
+        const real1 theta[2] = { (real1)(0.7f - pass), (real1)(-0.4f + pass) };
+        circuit.SetParameters(theta);
+
+        QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, n, 5, rng, ONE_CMPLX, false, false);
+        for (int i = 0; i < 6; i++) {
+            reference->RX(theta[0], 4);
+            reference->H(5);
+            reference->RY(theta[1], 5);
+            reference->CNOT(4, 0);
+            reference->H(4);
+        }
+        reference->H(1);
+        reference->CZ(1, 5);
+        reference->GetQuantumState(expected.get());
+
+        // Qubits end in their logical positions, whether or not the circuit was remapped.
+        circuit.Run(5)->GetQuantumState(actual.get());
+
+        complex innerProd = ZERO_CMPLX;
+        for (bitCapIntOcl j = 0; j < maxQPower; j++) {
+            innerProd += conj(expected[j]) * actual[j];
+        }
+        REQUIRE_FLOAT(norm(innerProd), ONE_R1);
+    }
+}
+
+TEST_CASE("test_stabilizer_get_quantum_state")
+{
+    // Enough nonzero amplitudes that the expansion is split into several chunks
+    const bitLenInt n = 10U;
+    const bitCapIntOcl maxQPower = 1U << n;
+    QStabilizerPtr stabilizer = std::make_shared<QStabilizer>(n, 0, false, rng);
+    QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, n, 0, rng);
+    for (bitLenInt i = 0; i < n; i++) {
+        stabilizer->H(i);
+        reference->H(i);
+    }
+    for (bitLenInt i = 1; i < n; i += 2) {
+        stabilizer->CNOT(i, i - 1U);
+        reference->CNOT(i, i - 1U);
+        stabilizer->S(i);
+        reference->ApplySinglePhase(ONE_CMPLX, I_CMPLX, i);
+        stabilizer->H(i - 1U);
+        reference->H(i - 1U);
+    }
+    stabilizer->SetConcurrencyLevel(4);
+
+    std::unique_ptr<complex[]> stabilizerState(new complex[maxQPower]);
+    std::unique_ptr<complex[]> referenceState(new complex[maxQPower]);
+    stabilizer->GetQuantumState(stabilizerState.get());
+    reference->GetQuantumState(referenceState.get());
+
+    complex inner = ZERO_CMPLX;
+    for (bitCapIntOcl i = 0; i < maxQPower; i++) {
+        inner += conj(referenceState[i]) * stabilizerState[i];
+    }
+    REQUIRE_FLOAT(norm(inner), ONE_R1);
+}
+
+TEST_CASE("test_stabilizer_hybrid_phase_buffer")
+{
+    const bitLenInt n = 4U;
+    const bitCapIntOcl maxQPower = 1U << n;
+    QStabilizerHybridPtr hybrid = std::dynamic_pointer_cast<QStabilizerHybrid>(
+        CreateQuantumInterface(QINTERFACE_STABILIZER_HYBRID, QINTERFACE_CPU, n, 0, rng));
+    QInterfacePtr reference = CreateQuantumInterface(QINTERFACE_CPU, n, 0, rng);
+
+    std::unique_ptr<complex[]> hybridState(new complex[maxQPower]);
+    std::unique_ptr<complex[]> referenceState(new complex[maxQPower]);
+    auto fidelity = [&]() {
+        hybrid->GetQuantumState(hybridState.get());
+        reference->GetQuantumState(referenceState.get());
+        complex inner = ZERO_CMPLX;
+        for (bitCapIntOcl i = 0; i < maxQPower; i++) {
+            inner += conj(referenceState[i]) * hybridState[i];
+        }
+        return norm(inner);
+    };
+
+    for (int i = 0; i < 2; i++) {
+        QInterfacePtr q = i ? reference : std::dynamic_pointer_cast<QInterface>(hybrid);
+        q->H(0);
+        q->CNOT(0, 1);
+        q->H(2);
+        q->T(0);
+        // Everything here commutes with, or passes through, the phase on qubit 0.
+        q->CNOT(0, 3);
+        q->CZ(0, 2);
+        q->X(0);
+        q->Z(1);
+        q->RZ(0.3f, 1);
+        q->Swap(1, 2);
+        q->H(3);
+        q->T(1);
+    }
+    REQUIRE(hybrid->isClifford());
+    REQUIRE_FLOAT(fidelity(), ONE_R1);
+    REQUIRE_FLOAT(hybrid->Prob(0), reference->Prob(0));
+
+    // T twice is S, which goes back into the tableau.
+    hybrid->T(1);
+    reference->T(1);
+    hybrid->H(1);
+    reference->H(1);
+    REQUIRE(hybrid->isClifford());
+    REQUIRE_FLOAT(fidelity(), ONE_R1);
+
+    // A Hadamard on an entangled qubit with a T phase pending can't stay Clifford.
+    hybrid->H(0);
+    reference->H(0);
+    REQUIRE(!hybrid->isClifford());
+    REQUIRE_FLOAT(fidelity(), ONE_R1);
+
+    // Measurement commutes with a pending phase, which is only global, afterward.
+    hybrid = std::dynamic_pointer_cast<QStabilizerHybrid>(
+        CreateQuantumInterface(QINTERFACE_STABILIZER_HYBRID, QINTERFACE_QUNIT, QINTERFACE_CPU, 2, 0, rng));
+    hybrid->H(0);
+    hybrid->CNOT(0, 1);
+    hybrid->T(0);
+    REQUIRE_FLOAT(hybrid->Prob(1), ONE_R1 / 2);
+    bool result = hybrid->M(0);
+    hybrid->H(0);
+    REQUIRE(hybrid->isClifford());
+    REQUIRE(hybrid->M(1) == result);
+}
+
+TEST_CASE("test_pauli_frame_sampler")
+{
+    const bitCapIntOcl shots = 1000U;
+    const bitCapIntOcl words = (shots + 63U) / 64U;
+
+    QPauliFrameSamplerPtr sampler = std::make_shared<QPauliFrameSampler>(3, 0x4);
+    sampler->H(0);
+    sampler->CNOT(0, 1);
+    REQUIRE(sampler->M(0) == 0U);
+    REQUIRE(sampler->M(1) == 1U);
+    REQUIRE(sampler->M(2) == 2U);
+    sampler->X(2);
+    sampler->XError(1, ONE_R1);
+    sampler->M(2);
+    sampler->M(1);
+    REQUIRE(sampler->GetMeasurementCount() == 5U);
+
+    std::vector<uint64_t> record = sampler->Sample(shots);
+    REQUIRE(record.size() == (5U * words));
+
+    bitCapIntOcl ones = 0;
+    for (bitCapIntOcl s = 0; s < shots; s++) {
+        const bitCapIntOcl w = s / 64U;
+        const uint64_t bit = 1ULL << (s % 64U);
+        const bool m0 = record[w] & bit;
+        // Bell pair halves always agree.
+        REQUIRE(m0 == (bool)(record[words + w] & bit));
+        // Deterministic results (|1>, then X) are the same in every shot.
+        REQUIRE((bool)(record[2U * words + w] & bit));
+        REQUIRE(!(record[3U * words + w] & bit));
+        // A certain X error flips the (collapsed) Bell pair half.
+        REQUIRE(m0 != (bool)(record[4U * words + w] & bit));
+        ones += m0 ? 1U : 0U;
+    }
+    // The Bell pair outcome is random.
+    REQUIRE(ones > (shots / 4U));
+    REQUIRE(ones < (3U * shots / 4U));
+
+    // Padding bits stay clear.
+    REQUIRE(!(record[2U * words + words - 1U] >> (shots % 64U)));
+
+    // Noise at a known rate
+    QPauliFrameSamplerPtr noisy = std::make_shared<QPauliFrameSampler>(1);
+    noisy->XError(0, (real1)0.1f);
+    noisy->H(0);
+    noisy->ZError(0, (real1)0.2f);
+    noisy->H(0);
+    noisy->M(0);
+    record = noisy->Sample(64000U);
+    ones = 0;
+    for (size_t i = 0; i < record.size(); i++) {
+        for (bitLenInt j = 0; j < 64U; j++) {
+            ones += (record[i] >> j) & 1U;
+        }
+    }
+    // Flip probability is 0.1 * 0.8 + 0.9 * 0.2 = 0.26.
+    REQUIRE(ones > 15360U);
+    REQUIRE(ones < 17920U);
+
+    CHECK_THROWS(noisy->CNOT(0, 0));
+    CHECK_THROWS(noisy->H(1));
+}
+
+TEST_CASE("test_trajectory_sampler")
+{
+    const bitCapIntOcl shots = 4000U;
+    const bitCapIntOcl words = (shots + 63U) / 64U;
+
+    QTrajectorySamplerPtr sampler = std::make_shared<QTrajectorySampler>(4, 0x3);
+    // Two damping channels in a row, (drawn from one reduction,) on |1> qubits
+    sampler->AmplitudeDamping(0, (real1)0.3f);
+    sampler->AmplitudeDamping(1, (real1)0.6f);
+    REQUIRE(sampler->M(0) == 0U);
+    REQUIRE(sampler->M(1) == 1U);
+    // Damping on an entangled pair
+    sampler->H(2);
+    sampler->CNOT(2, 3);
+    sampler->AmplitudeDamping(2, (real1)0.5f);
+    sampler->AmplitudeDamping(3, (real1)0.5f);
+    sampler->M(2);
+    sampler->M(3);
+    // Certain depolarization of |0>, then readout error on a qubit reset to |0>
+    sampler->Reset(0);
+    sampler->Depolarize(0, ONE_R1);
+    sampler->M(0);
+    sampler->Reset(1);
+    sampler->M(1, ONE_R1);
+    REQUIRE(sampler->GetMeasurementCount() == 6U);
+
+    std::vector<uint64_t> record = sampler->Sample(shots);
+    REQUIRE(record.size() == (6U * words));
+
+    bitCapIntOcl ones[6] = { 0, 0, 0, 0, 0, 0 };
+    for (bitCapIntOcl s = 0; s < shots; s++) {
+        const bitCapIntOcl w = s / 64U;
+        const uint64_t bit = 1ULL << (s % 64U);
+        for (bitCapIntOcl m = 0; m < 6U; m++) {
+            ones[m] += (record[m * words + w] & bit) ? 1U : 0U;
+        }
+    }
+
+    // |1> survives damping with probability 1 - gamma.
+    REQUIRE(ones[0] > 2600U);
+    REQUIRE(ones[0] < 3000U);
+    REQUIRE(ones[1] > 1400U);
+    REQUIRE(ones[1] < 1800U);
+    // Each half of the pair is |1> with probability 0.5 * 0.5.
+    REQUIRE(ones[2] > 800U);
+    REQUIRE(ones[2] < 1200U);
+    REQUIRE(ones[3] > 800U);
+    REQUIRE(ones[3] < 1200U);
+    // X and Y flip |0>, and Z doesn't.
+    REQUIRE(ones[4] > 2467U);
+    REQUIRE(ones[4] < 2867U);
+    REQUIRE(ones[5] == shots);
+
+    CHECK_THROWS(sampler->CNOT(0, 0));
+    CHECK_THROWS(sampler->H(4));
+    CHECK_THROWS(sampler->Depolarize(0, (real1)2.0f));
+}
+
 TEST_CASE("test_exp2x2_log2x2")
 {
     complex mtrx1[4] = { complex(ONE_R1, ZERO_R1), complex(ZERO_R1, ZERO_R1), complex(ZERO_R1, ZERO_R1),
@@ -284,6 +1785,95 @@ TEST_CASE("test_exp2x2_log2x2")
     REQUIRE_FLOAT(imag(mtrx1[3]), ZERO_R1);
 }
 
+TEST_CASE("test_checkpoint_malformed")
+{
+    // Stream offsets: the header is a magic number and a version, and each record opens with a tag and a width.
+    const size_t headerBytes = sizeof(uint64_t) + sizeof(uint8_t);
+    const size_t recordBytes = sizeof(uint8_t) + sizeof(uint64_t);
+    auto patch = [](std::string& bytes, size_t offset, uint64_t value) {
+        bytes.replace(offset, sizeof(value), std::string((const char*)&value, sizeof(value)));
+    };
+
+    // Two QUnit shards mapped to the same qubit of a Bell pair unit aren't a layout.
+    QInterfacePtr qUnit = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 2, 0, rng);
+    qUnit->H(0);
+    qUnit->CNOT(0, 1);
+    REQUIRE_FLOAT(qUnit->Prob(0), ONE_R1 / 2);
+    std::stringstream unitStream;
+    qUnit->SaveCheckpoint(unitStream);
+    std::string unitBytes = unitStream.str();
+    const size_t shardBytes = 2U * sizeof(uint64_t) + 3U * sizeof(uint8_t) + 4U * sizeof(real1);
+    patch(unitBytes, headerBytes + recordBytes + shardBytes + sizeof(uint64_t), 0U);
+
+    QInterfacePtr qUnit2 = CreateQuantumInterface(QINTERFACE_QUNIT, QINTERFACE_CPU, 2, 1, rng);
+    std::stringstream badUnitStream(unitBytes);
+    REQUIRE_THROWS_AS(qUnit2->LoadCheckpoint(badUnitStream), std::invalid_argument);
+    REQUIRE(qUnit2->MReg(0, 2) == 1U);
+
+    // A stabilizer tableau length is checked before it's allocated, and the register is left as it was.
+    QInterfacePtr hybrid = CreateQuantumInterface(QINTERFACE_STABILIZER_HYBRID, QINTERFACE_CPU, 2, 0, rng);
+    hybrid->H(0);
+    hybrid->CNOT(0, 1);
+    std::stringstream hybridStream;
+    hybrid->SaveCheckpoint(hybridStream);
+    std::string hybridBytes = hybridStream.str();
+    patch(hybridBytes, headerBytes + recordBytes + sizeof(uint8_t) + 2U * sizeof(complex) + recordBytes,
+        (uint64_t)1U << 40U);
+
+    QInterfacePtr hybrid2 = CreateQuantumInterface(QINTERFACE_STABILIZER_HYBRID, QINTERFACE_CPU, 2, 2, rng);
+    std::stringstream badHybridStream(hybridBytes);
+    REQUIRE_THROWS_AS(hybrid2->LoadCheckpoint(badHybridStream), std::invalid_argument);
+    REQUIRE(hybrid2->MReg(0, 2) == 2U);
+
+    std::stringstream goodHybridStream(hybridStream.str());
+    hybrid2->LoadCheckpoint(goodHybridStream);
+    REQUIRE(hybrid->ApproxCompare(hybrid2));
+}
+
+TEST_CASE("test_pinvoke_run_program_released")
+{
+    const unsigned sid = init_count(3);
+    // Releasing a middle qubit ID leaves it unmapped, but still in range.
+    REQUIRE(release(sid, 1));
+
+    _QrackProgramOp ops[3] = {};
+    ops[0].op = QRACK_PROGRAM_X;
+    ops[0].target = 0;
+    ops[1].op = QRACK_PROGRAM_X;
+    ops[1].target = 1;
+    ops[2].op = QRACK_PROGRAM_M;
+    ops[2].target = 0;
+    unsigned results[3];
+
+    // Execution stops at the released target.
+    REQUIRE(run_program(sid, 3, ops, results) == 0U);
+    REQUIRE_FLOAT((real1)Prob(sid, 0), ONE_R1);
+
+    // ...and likewise at a released control, or SWAP argument.
+    ops[1].target = 2;
+    ops[1].controlLen = 1;
+    ops[1].controls[0] = 1;
+    REQUIRE(run_program(sid, 3, ops, results) == 0U);
+    REQUIRE_FLOAT((real1)Prob(sid, 0), ZERO_R1);
+    REQUIRE_FLOAT((real1)Prob(sid, 2), ZERO_R1);
+
+    ops[1].op = QRACK_PROGRAM_SWAP;
+    ops[1].target = 0;
+    ops[1].arg = 1;
+    ops[1].controlLen = 0;
+    REQUIRE(run_program(sid, 3, ops, results) == 0U);
+    REQUIRE_FLOAT((real1)Prob(sid, 0), ONE_R1);
+
+    // With only live IDs, the whole program runs.
+    ops[0].op = QRACK_PROGRAM_Z;
+    ops[1].arg = 2;
+    REQUIRE(run_program(sid, 3, ops, results) == 1U);
+    REQUIRE(results[0] == 0U);
+    REQUIRE_FLOAT((real1)Prob(sid, 2), ONE_R1);
+
+    destroy(sid);
+}
+
 #if ENABLE_OPENCL && !ENABLE_SNUCL
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_oclengine")
 {
@@ -299,6 +1889,20 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_oclengine")
     }
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_ocl_lazy_init")
+{
+    if (testEngineType == QINTERFACE_OPENCL) {
+        // The engine of the fixture has built the device it runs on.
+        const int devID = std::dynamic_pointer_cast<QEngineOCL>(qftReg)->GetDeviceID();
+        DeviceContextPtr devCntxt = OCLEngine::Instance()->GetDeviceContextPtr(devID);
+        REQUIRE(devCntxt->IsInitialized());
+        REQUIRE(OCLEngine::Instance()->InitDeviceContext(devCntxt));
+        REQUIRE(OCLEngine::Instance()->GetBuiltDeviceContextPtr(devID) == devCntxt);
+
+        CHECK_THROWS(OCLEngine::Instance()->GetBuiltDeviceContextPtr(-2));
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_change_device")
 {
     if (testEngineType == QINTERFACE_OPENCL) {
@@ -308,6 +1912,99 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_change_device")
         REQUIRE_THAT(qftReg, HasProbability(0x55F00));
     }
 }
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_ocl_batch")
+{
+    if (testEngineType == QINTERFACE_OPENCL) {
+        const bitCapIntOcl copies = 5;
+        QEngineOCLBatchPtr batch = std::make_shared<QEngineOCLBatch>(4, copies, 0x1);
+        REQUIRE(batch->GetCopyQubitCount() == 4);
+        REQUIRE(batch->GetCopyCount() == copies);
+
+        // A shared gate, then a different angle in each register
+        batch->X(0);
+        real1 angles[copies];
+        for (bitCapIntOcl i = 0; i < copies; i++) {
+            angles[i] = (real1)(M_PI * i / (copies - 1));
+        }
+        batch->RYEach(angles, 2);
+
+        real1 probs[copies];
+        batch->ProbEach(0, probs);
+        for (bitCapIntOcl i = 0; i < copies; i++) {
+            REQUIRE_FLOAT(probs[i], ZERO_R1);
+        }
+        batch->ProbEach(2, probs);
+        for (bitCapIntOcl i = 0; i < copies; i++) {
+            REQUIRE_FLOAT(probs[i], (real1)(sin(angles[i] / 2) * sin(angles[i] / 2)));
+        }
+
+        bool results[copies];
+        batch->MEach(2, results);
+        REQUIRE(!results[0]);
+        REQUIRE(results[copies - 1]);
+
+        complex state[16];
+        batch->GetCopyState(copies - 1, state);
+        REQUIRE_FLOAT(norm(state[0x4]), ONE_R1);
+        batch->SetCopyState(0, state);
+        batch->ProbEach(2, probs);
+        REQUIRE_FLOAT(probs[0], ONE_R1);
+
+        REQUIRE_THROWS_AS(batch->RYEach(angles, 4), std::invalid_argument);
+        REQUIRE_THROWS_AS(batch->GetCopyState(copies, state), std::invalid_argument);
+    }
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_ocl_specialized_gates")
+{
+    if (testEngineType == QINTERFACE_OPENCL) {
+        // Enough repeats that these gates switch to specialized kernels part way through, (once they're built)
+        QInterfacePtr qReg = CreateQuantumInterface(QINTERFACE_OPENCL, 4, 0x2, rng);
+        for (unsigned int i = 0; i < (8U * QRACK_OCL_SPEC_HOT_COUNT); i++) {
+            qReg->H(0);
+            qReg->CNOT(0, 3);
+            qReg->X(1);
+            qReg->CNOT(0, 3);
+            qReg->H(0);
+        }
+        REQUIRE_THAT(qReg, HasProbability(0x2));
+
+        qReg->X(1);
+        qReg->H(0);
+        qReg->CNOT(0, 3);
+        REQUIRE_FLOAT(qReg->ProbAll(0x0), ONE_R1 / 2);
+        REQUIRE_FLOAT(qReg->ProbAll(0x9), ONE_R1 / 2);
+    }
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_ocl_lookup_table")
+{
+    if (testEngineType == QINTERFACE_OPENCL) {
+        unsigned char values[256];
+        for (unsigned int i = 0; i < 256; i++) {
+            values[i] = 255 - i;
+        }
+        OCLLookupTablePtr table = OCLEngine::Instance()->RegisterTable(values, 256);
+        REQUIRE(OCLEngine::Instance()->RegisterTable(values, 256) == table);
+        REQUIRE(OCLEngine::Instance()->GetTable(values, 256) == table);
+        REQUIRE(OCLEngine::Instance()->GetTable(values, 512) == nullptr);
+
+        QInterfacePtr qReg = CreateQuantumInterface(QINTERFACE_OPENCL, 16, 0x2d, rng);
+        qReg->IndexedLDA(0, 8, 8, 8, values);
+        REQUIRE_THAT(qReg, HasProbability(0xd22d));
+
+        // The device copy is refreshed after the host table changes.
+        values[0x2d] = 0x17;
+        table->Update();
+        qReg->SetPermutation(0x2d);
+        qReg->IndexedLDA(0, 8, 8, 8, values);
+        REQUIRE_THAT(qReg, HasProbability(0x172d));
+
+        table.reset();
+        REQUIRE(OCLEngine::Instance()->GetTable(values, 256) == nullptr);
+    }
+}
 #endif
 
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_qengine_getmaxqpower")
@@ -659,6 +2356,67 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_single_bit")
     REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x80001));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_nxn")
+{
+    // CNOT, with targets[0] as control and targets[1] as target
+    complex cnot[16] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ONE_CMPLX,
+        ZERO_CMPLX, ZERO_CMPLX, ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX };
+    bitLenInt targets2[2] = { 19, 3 };
+    qftReg->SetPermutation(0x80001);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x80001));
+    qftReg->ApplyNxN(cnot, targets2, 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x80009));
+    qftReg->ApplyNxN(cnot, targets2, 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x80001));
+
+    // Tensor product of 3 Hadamard gates
+    complex hhh[64];
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            int parity = 0;
+            for (int k = i & j; k; k &= k - 1) {
+                parity ^= 1;
+            }
+            hhh[(i * 8) + j] = complex((parity ? -ONE_R1 : ONE_R1) / (real1)sqrt(8.0), ZERO_R1);
+        }
+    }
+    bitLenInt targets3[3] = { 1, 5, 2 };
+    qftReg->SetPermutation(0x20);
+    qftReg->ApplyNxN(hhh, targets3, 3);
+    REQUIRE_FLOAT(qftReg->Prob(1), 0.5);
+    REQUIRE_FLOAT(qftReg->Prob(2), 0.5);
+    REQUIRE_FLOAT(qftReg->Prob(5), 0.5);
+    qftReg->ApplyNxN(hhh, targets3, 3);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x20));
+
+    bitLenInt badTargets[2] = { 4, 4 };
+    REQUIRE_THROWS(qftReg->ApplyNxN(cnot, badTargets, 2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_single_bit_batch")
+{
+    const real1 sqrt1_2 = (real1)M_SQRT1_2;
+    const complex pauliX[4] = { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX };
+    const complex hadamard[4] = { complex(sqrt1_2, ZERO_R1), complex(sqrt1_2, ZERO_R1), complex(sqrt1_2, ZERO_R1),
+        complex(-sqrt1_2, ZERO_R1) };
+
+    // Repeated targets apply in order, and high and low qubits mix.
+    const bitLenInt qubits[7] = { 0, 1, 19, 1, 2, 0, 4 };
+    const complex* gates[7] = { pauliX, hadamard, pauliX, hadamard, pauliX, pauliX, hadamard };
+    complex mtrxs[28];
+    for (int i = 0; i < 7; i++) {
+        std::copy(gates[i], gates[i] + 4, mtrxs + 4 * i);
+    }
+
+    qftReg->SetPermutation(0);
+    qftReg->ApplySingleBitBatch(mtrxs, qubits, 6);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0x80004));
+    qftReg->ApplySingleBitBatch(mtrxs + 24, qubits + 6, 1);
+    REQUIRE_FLOAT(qftReg->Prob(4), 0.5);
+    qftReg->ApplySingleBitBatch(mtrxs, qubits, 7);
+    REQUIRE_THAT(qftReg, HasProbability(0, 20, 0));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_controlled_single_bit")
 {
     complex pauliX[4] = { ZERO_CMPLX, ONE_CMPLX, ONE_CMPLX, ZERO_CMPLX };
@@ -3272,6 +5030,99 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_qft_h")
     REQUIRE_THAT(qftReg, HasProbability(0, 8, randPerm));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_qft_engine")
+{
+    std::vector<QInterfaceEngine> engines = { QINTERFACE_CPU };
+#if ENABLE_OPENCL
+    engines.push_back(QINTERFACE_OPENCL);
+#endif
+
+    const bitLenInt n = 10;
+    std::vector<complex> state(pow2Ocl(n));
+    real1 nrm = ZERO_R1;
+    for (auto&& amp : state) {
+        amp = complex(qftReg->Rand() - ONE_R1 / 2, qftReg->Rand() - ONE_R1 / 2);
+        nrm += norm(amp);
+    }
+    for (auto&& amp : state) {
+        amp /= (real1)sqrt(nrm);
+    }
+
+    // The engines' Fourier transforms should match the gate sequence of QInterface, both where each of the 4 threads
+    // transforms whole copies of the register, and where the register is so wide that its stages are parallelized.
+    const bitLenInt starts[3] = { 2, 0, 1 };
+    const bitLenInt lengths[3] = { 5, 10, 7 };
+    std::vector<complex> out(pow2Ocl(n)), expected(pow2Ocl(n));
+    for (auto&& engine : engines) {
+        for (int i = 0; i < 3; i++) {
+            QInterfacePtr qReg = CreateQuantumInterface(engine, n, 0, rng);
+            QInterfacePtr ref = CreateQuantumInterface(engine, n, 0, rng);
+            qReg->SetConcurrency(4);
+
+            for (int inverse = 0; inverse < 2; inverse++) {
+                qReg->SetQuantumState(&(state[0]));
+                ref->SetQuantumState(&(state[0]));
+                if (inverse) {
+                    qReg->IQFT(starts[i], lengths[i]);
+                    ref->QInterface::IQFT(starts[i], lengths[i]);
+                } else {
+                    qReg->QFT(starts[i], lengths[i]);
+                    ref->QInterface::QFT(starts[i], lengths[i]);
+                }
+                qReg->GetQuantumState(&(out[0]));
+                ref->GetQuantumState(&(expected[0]));
+                for (bitCapIntOcl j = 0; j < pow2Ocl(n); j++) {
+                    REQUIRE_FLOAT(real(out[j]), real(expected[j]));
+                    REQUIRE_FLOAT(imag(out[j]), imag(expected[j]));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_grover_diffusion_engine")
+{
+    std::vector<QInterfaceEngine> engines = { QINTERFACE_CPU };
+#if ENABLE_OPENCL
+    engines.push_back(QINTERFACE_OPENCL);
+#endif
+
+    const bitLenInt n = 10;
+    std::vector<complex> state(pow2Ocl(n));
+    real1 nrm = ZERO_R1;
+    for (auto&& amp : state) {
+        amp = complex(qftReg->Rand() - ONE_R1 / 2, qftReg->Rand() - ONE_R1 / 2);
+        nrm += norm(amp);
+    }
+    for (auto&& amp : state) {
+        amp /= (real1)sqrt(nrm);
+    }
+
+    // The engines' diffusion should match H, ZeroPhaseFlip(), and H, both where each of the 4 threads reflects whole
+    // copies of the register, and where there are too few copies to go around.
+    const bitLenInt starts[4] = { 2, 0, 1, 7 };
+    const bitLenInt lengths[4] = { 5, 10, 8, 1 };
+    std::vector<complex> out(pow2Ocl(n)), expected(pow2Ocl(n));
+    for (auto&& engine : engines) {
+        for (int i = 0; i < 4; i++) {
+            QInterfacePtr qReg = CreateQuantumInterface(engine, n, 0, rng);
+            QInterfacePtr ref = CreateQuantumInterface(engine, n, 0, rng);
+            qReg->SetConcurrency(4);
+
+            qReg->SetQuantumState(&(state[0]));
+            ref->SetQuantumState(&(state[0]));
+            qReg->GroverDiffusion(starts[i], lengths[i]);
+            ref->QInterface::GroverDiffusion(starts[i], lengths[i]);
+            qReg->GetQuantumState(&(out[0]));
+            ref->GetQuantumState(&(expected[0]));
+            for (bitCapIntOcl j = 0; j < pow2Ocl(n); j++) {
+                REQUIRE_FLOAT(real(out[j]), real(expected[j]));
+                REQUIRE_FLOAT(imag(out[j]), imag(expected[j]));
+            }
+        }
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_isfinished")
 {
     if (QINTERFACE_RESTRICTED) {
@@ -3556,6 +5407,40 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_clone")
     REQUIRE_THAT(qftReg2, HasProbability(0, 20, 0xd4));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_checkpoint")
+{
+    qftReg->SetPermutation(0x2b);
+    qftReg->H(0, 12);
+    qftReg->CZ(0, 8);
+    qftReg->CS(1, 9);
+    qftReg->CT(2, 10);
+    qftReg->CNOT(3, 11);
+
+    for (int i = 0; i < 2; i++) {
+        const bool doCompress = (i == 1);
+        std::stringstream checkpoint;
+        qftReg->SaveCheckpoint(checkpoint, doCompress);
+
+        QInterfacePtr qftReg2 = MakeEngine(20U);
+        qftReg2->LoadCheckpoint(checkpoint);
+        REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+        qftReg2->CNOT(3, 11);
+        qftReg2->CIT(2, 10);
+        qftReg2->CIS(1, 9);
+        qftReg2->CZ(0, 8);
+        qftReg2->H(0, 12);
+        REQUIRE_THAT(qftReg2, HasProbability(0, 12, 0x2b));
+
+        checkpoint.clear();
+        checkpoint.seekg(0);
+        REQUIRE_THROWS_AS(MakeEngine(8U)->LoadCheckpoint(checkpoint), std::invalid_argument);
+    }
+
+    std::stringstream garbage("not a checkpoint");
+    REQUIRE_THROWS_AS(MakeEngine(20U)->LoadCheckpoint(garbage), std::invalid_argument);
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_decompose")
 {
     qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 4, 0x0b, rng);
@@ -3678,6 +5563,25 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_probmaskall")
         REQUIRE(qftReg->ProbMask(1, 0) > 0.99);
         delete[] probsN;
     }
+
+    // A non-contiguous mask, compared against ProbMask() for each masked permutation
+    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 8, 0, rng);
+    qftReg->H(0, 8);
+    qftReg->RY(M_PI / 3, 2);
+    qftReg->CNOT(2, 5);
+    qftReg->RX(M_PI / 5, 0);
+    const bitCapInt masked[3] = { pow2(0), pow2(2), pow2(5) };
+    real1 probs3[8];
+    qftReg->ProbMaskAll(masked[0] | masked[1] | masked[2], probs3);
+    for (bitCapIntOcl j = 0; j < 8U; j++) {
+        bitCapInt perm = 0;
+        for (bitLenInt b = 0; b < 3U; b++) {
+            if (j & pow2Ocl(b)) {
+                perm |= masked[b];
+            }
+        }
+        REQUIRE_FLOAT(probs3[j], qftReg->ProbMask(masked[0] | masked[1] | masked[2], perm));
+    }
 }
 
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_probparity")
@@ -3816,10 +5720,38 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_multishotmeasuremask")
 
     std::map<bitCapInt, int> results = qftReg->MultiShotMeasureMask(qPowers, 3U, 1000);
     std::map<bitCapInt, int>::iterator it = results.begin();
+    int shotCount = 0;
     while (it != results.end()) {
         REQUIRE(possibleResults.find(it->first) != possibleResults.end());
+        shotCount += it->second;
         it++;
     }
+    REQUIRE(shotCount == 1000);
+
+    // Fewer shots than masked permutations takes the binary search path, rather than the alias table.
+    results = qftReg->MultiShotMeasureMask(qPowers, 3U, 5);
+    shotCount = 0;
+    for (it = results.begin(); it != results.end(); it++) {
+        REQUIRE(possibleResults.find(it->first) != possibleResults.end());
+        shotCount += it->second;
+    }
+    REQUIRE(shotCount == 5);
+
+    // Sampling never collapses the state.
+    REQUIRE_FLOAT(qftReg->Prob(6), 0.5);
+    REQUIRE_FLOAT(qftReg->Prob(3), 0.5);
+
+    // A wider table, with fewer shots than entries, (sampled on the device, for OpenCL,) and with the result bits in
+    // reverse order
+    qftReg->SetPermutation(0x35);
+    bitCapInt reversed[8];
+    for (bitLenInt b = 0; b < 8U; b++) {
+        reversed[b] = pow2(7U - b);
+    }
+    results = qftReg->MultiShotMeasureMask(reversed, 8U, 100);
+    REQUIRE(results.size() == 1U);
+    REQUIRE(results.begin()->first == 0xAC);
+    REQUIRE(results.begin()->second == 100);
 }
 
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_forcem")
@@ -3895,6 +5827,38 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_getprobs")
     }
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_lockstateview")
+{
+    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 4, 0x0b, rng);
+    {
+        QStateViewPtr view = qftReg->LockStateView();
+        REQUIRE(view->GetLength() == 16U);
+        REQUIRE(!view->IsWritable());
+        REQUIRE_THROWS_AS(view->GetWritableAmplitudes(), std::invalid_argument);
+        for (bitCapIntOcl i = 0; i < 16; i++) {
+            REQUIRE_FLOAT(norm(view->GetAmplitudes()[i]), (i == 0x0b) ? ONE_R1 : ZERO_R1);
+        }
+    }
+
+    {
+        // Writes through the view take effect when it's released.
+        QStateViewPtr view = qftReg->LockStateView(true);
+        complex* amps = view->GetWritableAmplitudes();
+        std::fill(amps, amps + 16, ZERO_CMPLX);
+        amps[0x03] = C_SQRT1_2;
+        amps[0x0c] = C_I_SQRT1_2;
+    }
+    REQUIRE_FLOAT(qftReg->ProbAll(0x03), ONE_R1 / 2);
+    REQUIRE_FLOAT(qftReg->ProbAll(0x0c), ONE_R1 / 2);
+
+    qftReg->H(0);
+    {
+        QStateViewPtr view = qftReg->LockStateView();
+        REQUIRE_FLOAT(norm(view->GetAmplitudes()[0x02]), ONE_R1 / 4);
+        REQUIRE_FLOAT(norm(view->GetAmplitudes()[0x0d]), ONE_R1 / 4);
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_normalize")
 {
     qftReg->SetPermutation(0x03);
@@ -3940,6 +5904,28 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_grover")
     REQUIRE_THAT(qftReg, HasProbability(0, 16, TARGET_PROB));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_grover_diffusion")
+{
+    int i;
+
+    const bitCapInt TARGET_PROB = 100;
+
+    qftReg->SetPermutation(0);
+    qftReg->H(0, 8);
+
+    for (i = 0; i < 12; i++) {
+        qftReg->DEC(100, 0, 8);
+        qftReg->ZeroPhaseFlip(0, 8);
+        qftReg->INC(100, 0, 8);
+        qftReg->GroverDiffusion(0, 8);
+        qftReg->PhaseFlip();
+    }
+
+    qftReg->MReg(0, 8);
+
+    REQUIRE_THAT(qftReg, HasProbability(0, 16, TARGET_PROB));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_grover_lookup")
 {
     int i;
@@ -4664,6 +6650,135 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_uniform")
     REQUIRE_FLOAT(abs((ONE_R1 - qftReg->Prob(0)) - cos(aParam * tDiff) * cos(aParam * tDiff)), 0);
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_trotter")
+{
+    const real1 a = (real1)0.7f;
+    const real1 b = (real1)0.4f;
+    const real1 tTotal = (real1)1.5f;
+    const bitCapIntOcl steps = 8U;
+
+    BitOp xTerm(new complex[4], std::default_delete<complex[]>());
+    xTerm.get()[0] = ZERO_CMPLX;
+    xTerm.get()[1] = complex(a, ZERO_R1);
+    xTerm.get()[2] = complex(a, ZERO_R1);
+    xTerm.get()[3] = ZERO_CMPLX;
+
+    BitOp zTerm(new complex[4], std::default_delete<complex[]>());
+    zTerm.get()[0] = complex(b, ZERO_R1);
+    zTerm.get()[1] = ZERO_CMPLX;
+    zTerm.get()[2] = ZERO_CMPLX;
+    zTerm.get()[3] = complex(-b, ZERO_R1);
+
+    // H = a X_0 + |1><1|_1 b Z_0, for which the two terms don't commute.
+    bitLenInt controls[1] = { 1 };
+    Hamiltonian h(2);
+    h[0] = std::make_shared<HamiltonianOp>(0, xTerm);
+    h[1] = std::make_shared<HamiltonianOp>(controls, 1, 0, zTerm);
+
+    // Starting from |+>|0>, e^(-i H t) acts as e^(-i a X t) if qubit 1 is |0> and e^(-i (a X + b Z) t) if it's |1>.
+    const real1 w = sqrt(a * a + b * b);
+    const real1 invSqrt2 = (real1)M_SQRT1_2;
+    const complex exact[4] = { complex(cos(a * tTotal) * invSqrt2, ZERO_R1),
+        complex(ZERO_R1, -sin(a * tTotal) * invSqrt2),
+        complex(cos(w * tTotal) * invSqrt2, -sin(w * tTotal) * (b / w) * invSqrt2),
+        complex(ZERO_R1, -sin(w * tTotal) * (a / w) * invSqrt2) };
+
+    const int orders[2] = { 2, 4 };
+    for (int i = 0; i < 2; i++) {
+        CompiledHamiltonian compiled(h, tTotal / steps, orders[i]);
+
+        qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 2, 0, rng);
+        qftReg->H(1);
+        compiled.Evolve(*qftReg, steps);
+
+        complex overlap = ZERO_CMPLX;
+        for (bitCapIntOcl j = 0; j < 4U; j++) {
+            overlap += conj(exact[j]) * qftReg->GetAmplitude(j);
+        }
+        REQUIRE(norm(overlap) > (real1)0.999f);
+    }
+
+    // In the Strang splitting, the middle two half steps of the last term fuse into one gate.
+    REQUIRE(CompiledHamiltonian(h, tTotal, 2).GetGateCount() == 3U);
+
+    // Terms on disjoint qubits commute, so a later term on qubit 0 fuses into the first, past a term on qubit 1.
+    Hamiltonian h2(3);
+    h2[0] = std::make_shared<HamiltonianOp>(0, xTerm);
+    h2[1] = std::make_shared<HamiltonianOp>(1, zTerm);
+    h2[2] = std::make_shared<HamiltonianOp>(0, zTerm);
+    CompiledHamiltonian compiled2(h2, tTotal);
+    REQUIRE(compiled2.GetGateCount() == 2U);
+
+    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 2, 0, rng);
+    qftReg->H(1);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+    compiled2.Evolve(*qftReg);
+    const complex u0[4] = { cos(a * tTotal), complex(ZERO_R1, -sin(a * tTotal)), complex(ZERO_R1, -sin(a * tTotal)),
+        cos(a * tTotal) };
+    const complex u1[4] = { complex(cos(b * tTotal), -sin(b * tTotal)), ZERO_CMPLX, ZERO_CMPLX,
+        complex(cos(b * tTotal), sin(b * tTotal)) };
+    qftReg2->ApplySingleBit(u0, 0);
+    qftReg2->ApplySingleBit(u1, 1);
+    qftReg2->ApplySingleBit(u1, 0);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    REQUIRE_THROWS(CompiledHamiltonian(h, tTotal, 3));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_expectation_pauli_strings")
+{
+    const bitLenInt n = 5U;
+    const bitCapIntOcl termCount = 40U;
+
+    // Bell state: <XX> = <ZZ> = 1, <YY> = -1, and <ZI> = 0
+    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 2U, 0, rng);
+    qftReg->H(0);
+    qftReg->CNOT(0, 1);
+    REQUIRE_FLOAT(qftReg->ExpectationPauliString(3U, 0U), ONE_R1);
+    REQUIRE_FLOAT(qftReg->ExpectationPauliString(0U, 3U), ONE_R1);
+    REQUIRE_FLOAT(qftReg->ExpectationPauliString(3U, 3U), -ONE_R1);
+    REQUIRE_FLOAT(qftReg->ExpectationPauliString(0U, 1U), ZERO_R1);
+    REQUIRE_FLOAT(qftReg->ExpectationPauliString(0U, 0U), ONE_R1);
+
+    std::vector<PauliTerm> terms(termCount);
+    for (bitCapIntOcl i = 0; i < termCount; i++) {
+        terms[i].xMask = (bitCapInt)(qftReg->Rand() * pow2Ocl(n)) & pow2MaskOcl(n);
+        terms[i].zMask = (bitCapInt)(qftReg->Rand() * pow2Ocl(n)) & pow2MaskOcl(n);
+        terms[i].coefficient = qftReg->Rand() - (ONE_R1 / 2);
+    }
+
+    // Compare against rotating the basis of a copy and measuring parity, for a Clifford and a non-Clifford circuit.
+    for (int isClifford = 1; isClifford >= 0; isClifford--) {
+        qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, n, 0, rng);
+        for (int layer = 0; layer < 6; layer++) {
+            for (bitLenInt i = 0; i < n; i++) {
+                qftReg->H(i);
+                if (isClifford) {
+                    qftReg->Z(i);
+                } else {
+                    qftReg->T(i);
+                    qftReg->RY(qftReg->Rand() * 2 * (real1)M_PI, i);
+                }
+            }
+            for (bitLenInt i = (layer & 1U); (i + 1U) < n; i += 2U) {
+                qftReg->CNOT(i, i + 1U);
+            }
+        }
+
+        std::vector<real1> expected(termCount);
+        std::vector<real1> actual(termCount);
+        qftReg->QInterface::ExpectationPauliStrings(&(terms[0]), termCount, &(expected[0]));
+        qftReg->ExpectationPauliStrings(&(terms[0]), termCount, &(actual[0]));
+
+        real1 observable = ZERO_R1;
+        for (bitCapIntOcl i = 0; i < termCount; i++) {
+            REQUIRE_FLOAT(actual[i], expected[i]);
+            observable += terms[i].coefficient * expected[i];
+        }
+        REQUIRE_FLOAT(qftReg->ExpectationObservable(terms), observable);
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_qfusion_controlled")
 {
     if (QINTERFACE_RESTRICTED) {
@@ -4730,6 +6845,20 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_qneuron")
         test = ((~perm) + 1U) & (OutputPower - 1);
         REQUIRE(comp == test);
     }
+
+    bitCapInt inputs[InputPower];
+    real1 outputs[InputPower];
+    for (perm = 0; perm < InputPower; perm++) {
+        // Set bits outside of the inputs should be ignored.
+        inputs[perm] = perm | pow2(InputCount);
+    }
+    for (bitLenInt i = 0; i < OutputCount; i++) {
+        outputLayer[i]->PredictBatch(inputs, InputPower, outputs, i & 1U);
+        for (perm = 0; perm < InputPower; perm++) {
+            qftReg->SetPermutation(perm);
+            REQUIRE_FLOAT(outputs[perm], outputLayer[i]->Predict(i & 1U));
+        }
+    }
 }
 
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_bell_m")
@@ -41,6 +41,11 @@ extern std::string mOutputFileName;
 extern std::ofstream mOutputFile;
 extern bool isBinaryOutput;
 extern int benchmarkSamples;
+// Structured benchmark results, (see the --report option of the benchmarks target)
+extern std::string reportFileName;
+extern std::ofstream reportFile;
+extern bool isJsonReport;
+extern bool isReportEmpty;
 
 /* Declare the stream-to-probability prior to including catch.hpp. */
 namespace Qrack {